@@ -50,4 +50,12 @@
 #define PIN_BME280_SDA   NRF_GPIO_PIN_MAP(0, 26)
 #define PIN_BME280_SCL   NRF_GPIO_PIN_MAP(0, 27)
 
+// MX25R1635F SPI flash. IO2 and IO3 are used as WP# and HOLD# in SPI mode.
+#define PIN_FLASH_CS     NRF_GPIO_PIN_MAP(1, 15)
+#define PIN_FLASH_SCK    NRF_GPIO_PIN_MAP(1, 14)
+#define PIN_FLASH_MOSI   NRF_GPIO_PIN_MAP(1, 12)
+#define PIN_FLASH_MISO   NRF_GPIO_PIN_MAP(1, 13)
+#define PIN_FLASH_WP     NRF_GPIO_PIN_MAP(0,  7)
+#define PIN_FLASH_HOLD   NRF_GPIO_PIN_MAP(0,  5)
+
 #endif // PINOUT_H
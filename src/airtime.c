@@ -0,0 +1,130 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include "airtime.h"
+
+#define SLOT_DURATION_MS (AIRTIME_WINDOW_MS / AIRTIME_NUM_SLOTS)
+
+static uint8_t m_sf;
+static uint8_t m_cr;
+static float   m_bw_khz;
+
+static uint32_t m_slots[AIRTIME_NUM_SLOTS];
+static uint64_t m_current_slot; // absolute number of the newest slot
+
+
+/**@brief Move the window forward so the newest slot contains the given time.
+ * @details
+ * Slots that dropped out of the window are cleared.
+ */
+static void advance_window(uint64_t now)
+{
+	uint64_t slot = now / SLOT_DURATION_MS;
+
+	if(slot <= m_current_slot) {
+		return;
+	}
+
+	if(slot - m_current_slot >= AIRTIME_NUM_SLOTS) {
+		memset(m_slots, 0, sizeof(m_slots));
+	} else {
+		for(uint64_t s = m_current_slot + 1; s <= slot; s++) {
+			m_slots[s % AIRTIME_NUM_SLOTS] = 0;
+		}
+	}
+
+	m_current_slot = slot;
+}
+
+
+void airtime_init(void)
+{
+	m_sf = 12;
+	m_cr = 1;
+	m_bw_khz = 125.0f;
+
+	memset(m_slots, 0, sizeof(m_slots));
+	m_current_slot = 0;
+}
+
+
+void airtime_set_modulation(uint8_t sf, uint8_t cr, float bw_khz)
+{
+	m_sf = sf;
+	m_cr = cr;
+	m_bw_khz = bw_khz;
+}
+
+
+float airtime_calc_toa_ms(uint8_t n_bytes_payload)
+{
+	const uint8_t n_symb_pre    = 8;  // preamble symbols
+	const uint8_t n_symb_header = 20; // explicit header
+	const uint8_t n_bit_crc     = 16; // CRC enabled
+
+	float arg = 8*n_bytes_payload + n_bit_crc - 4*m_sf + n_symb_header;
+
+	if(arg < 0) {
+		arg = 0;
+	}
+
+	float n_symb = n_symb_pre + 4.25 + 8
+		+ (int)(1.0f + arg / (4*m_sf)) * (m_cr+4);
+
+	return powf(2, m_sf) / m_bw_khz * n_symb;
+}
+
+
+void airtime_record(uint64_t now, uint32_t toa_ms)
+{
+	advance_window(now);
+
+	m_slots[m_current_slot % AIRTIME_NUM_SLOTS] += toa_ms;
+}
+
+
+uint32_t airtime_get_used_ms(uint64_t now)
+{
+	uint32_t used = 0;
+
+	advance_window(now);
+
+	for(uint8_t i = 0; i < AIRTIME_NUM_SLOTS; i++) {
+		used += m_slots[i];
+	}
+
+	return used;
+}
+
+
+bool airtime_is_available(uint64_t now, uint32_t toa_ms)
+{
+	const uint32_t budget = (uint64_t)AIRTIME_WINDOW_MS * AIRTIME_BUDGET_PERCENT / 100;
+
+	return (airtime_get_used_ms(now) + toa_ms) <= budget;
+}
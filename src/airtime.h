@@ -0,0 +1,93 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef AIRTIME_H
+#define AIRTIME_H
+
+/**@file
+ *
+ * @brief Time-on-air calculation and transmit airtime budget.
+ *
+ * @details
+ * The LoRa driver reports every transmission to this module. The airtime used
+ * in a sliding window is tracked in slots of one minute, so other modules can
+ * check whether a transmission fits into the budget before it is started.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// length of the sliding window used for the airtime budget
+#define AIRTIME_WINDOW_MS       600000 // milliseconds
+
+// number of slots the window is divided into
+#define AIRTIME_NUM_SLOTS           10
+
+// maximum percentage of the window that may be used for transmissions
+#define AIRTIME_BUDGET_PERCENT      10
+
+/**@brief Reset the airtime statistics and set the default modulation (SF12, CR 4/5, 125 kHz).
+ */
+void airtime_init(void);
+
+/**@brief Set the modulation parameters used by @ref airtime_calc_toa_ms().
+ *
+ * @param sf       Spreading factor (5 to 12).
+ * @param cr       Coding rate ID (1 = 4/5 to 4 = 4/8).
+ * @param bw_khz   Bandwidth in kHz.
+ */
+void airtime_set_modulation(uint8_t sf, uint8_t cr, float bw_khz);
+
+/**@brief Calculate the time on air of a LoRa packet.
+ * @details
+ * An explicit header, CRC and 8 preamble symbols are assumed.
+ *
+ * @param n_bytes_payload   Length of the payload in bytes.
+ * @returns                 The time on air in milliseconds.
+ */
+float airtime_calc_toa_ms(uint8_t n_bytes_payload);
+
+/**@brief Account a transmission.
+ *
+ * @param now      The current time in milliseconds.
+ * @param toa_ms   The time on air of the transmission.
+ */
+void airtime_record(uint64_t now, uint32_t toa_ms);
+
+/**@brief Get the airtime used in the current window.
+ *
+ * @param now   The current time in milliseconds.
+ */
+uint32_t airtime_get_used_ms(uint64_t now);
+
+/**@brief Check whether a transmission fits into the airtime budget.
+ *
+ * @param now      The current time in milliseconds.
+ * @param toa_ms   The time on air of the planned transmission.
+ * @returns        True if the transmission can be started.
+ */
+bool airtime_is_available(uint64_t now, uint32_t toa_ms);
+
+#endif // AIRTIME_H
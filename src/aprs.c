@@ -94,8 +94,6 @@ static char m_error_message[256];
 
 static uint32_t m_config_flags;
 
-static aprs_rx_history_t m_rx_history;
-
 /* Wait at least this long before transmitting the comment again. */
 #define MIN_COMMENT_INTERVAL_TIME_MS  600000
 
@@ -105,6 +103,8 @@ static aprs_rx_history_t m_rx_history;
 /* Between the time limits above, transmit the comment after this number of packets. */
 #define MIN_COMMENT_INTERVAL_PACKETS      10
 
+#define MPS_TO_KNOTS  1.943844f
+
 
 static void append_address(uint8_t **frameptr, char *addr, bool is_last)
 {
@@ -193,7 +193,52 @@ static char* encode_position_readable(char *str, size_t max_len, char table, cha
 	}
 }
 
-static char* encode_position_compressed(char *str, size_t max_len, char table, char symbol)
+static void calc_course_speed_compressed(float course_deg, float speed_mps, uint8_t *c, uint8_t *s)
+{
+	// course in 4 degree steps, speed = 1.08^s - 1 knots
+	*c = (uint8_t)((int)(course_deg / 4.0f + 0.5f) % 90);
+
+	int speed = (int)(logf(speed_mps * MPS_TO_KNOTS + 1.0f) / 0.0769610411f + 0.5f); // the magic constant is ln(1.08)
+	if(speed > 89) {
+		speed = 89;
+	}
+
+	*s = (uint8_t)speed;
+}
+
+static void calc_course_speed_readable(float course_deg, float speed_mps, uint16_t *course, uint16_t *speed)
+{
+	// course 0 means “unknown”, so north is encoded as 360
+	*course = (uint16_t)(course_deg + 0.5f) % 360;
+	if(*course == 0) {
+		*course = 360;
+	}
+
+	float speed_kn = speed_mps * MPS_TO_KNOTS + 0.5f;
+	*speed = (speed_kn > 999.0f) ? 999 : (uint16_t)speed_kn;
+}
+
+static char* encode_course_speed_readable(char *str, size_t max_len, const aprs_args_t *args)
+{
+	uint16_t course, speed;
+
+	calc_course_speed_readable(args->course_deg, args->speed_mps, &course, &speed);
+
+	int ret = snprintf(str, max_len, "%03u/%03u", course, speed);
+
+	if(ret < 0) {
+		*str = 0;
+		return NULL; // error
+	} else if(ret < max_len) {
+		return str + ret; // everything encoded ok
+	} else {
+		// string was truncated. Incomplete data extension is misinterpreted as comment
+		*str = 0;
+		return NULL; // error
+	}
+}
+
+static char* encode_position_compressed(char *str, size_t max_len, char table, char symbol, const aprs_args_t *args)
 {
 	/*
 	 * compressed format: /YYYYXXXX$csT
@@ -202,7 +247,7 @@ static char* encode_position_compressed(char *str, size_t max_len, char table, c
 	 * YYYY = compressed latitude (base-91 encoded)
 	 * XXXX = compressed longitude (base-91 encoded)
 	 * $    = icon
-	 * cs   = compressed altitude (alternatives: course/speed, radio range)
+	 * cs   = compressed altitude or course/speed (alternative: radio range)
 	 * T    = compression type (bitmask, base-91 encoded)
 	 */
 
@@ -232,23 +277,39 @@ static char* encode_position_compressed(char *str, size_t max_len, char table, c
 		lon_compressed /= 91;
 	}
 
-	// compressed altitude calculation
-	// encoded value = log_1.002(altitude in feet)
+	uint8_t type;
 
-	float alt_ft = m_alt_m / 0.3048f;
-	if(alt_ft < 1) {
-		alt_ft = 1; // prevent exception in the logarithm
-	}
+	if(args->course_speed_valid) {
+		uint8_t c, s;
 
-	uint32_t alt_encoded = (uint32_t)(logf(alt_ft) / 0.00199800266f); // the magic constant is ln(1.002)
+		calc_course_speed_compressed(args->course_deg, args->speed_mps, &c, &s);
 
-	str[10] = '!' + (alt_encoded / 91) % 91;
-	str[11] = '!' + alt_encoded % 91;
+		str[10] = '!' + c;
+		str[11] = '!' + s;
 
-	// Type byte
-	uint8_t type = (1 << 5) /* current position */
-	             | (2 << 3) /* source = GGA (necessary for altitude encoding) */
-	             | (0 << 0) /* origin = compressed */;
+		// Type byte
+		type = (1 << 5) /* current position */
+		     | (3 << 3) /* source = RMC (cs is course/speed) */
+		     | (0 << 0) /* origin = compressed */;
+	} else {
+		// compressed altitude calculation
+		// encoded value = log_1.002(altitude in feet)
+
+		float alt_ft = m_alt_m / 0.3048f;
+		if(alt_ft < 1) {
+			alt_ft = 1; // prevent exception in the logarithm
+		}
+
+		uint32_t alt_encoded = (uint32_t)(logf(alt_ft) / 0.00199800266f); // the magic constant is ln(1.002)
+
+		str[10] = '!' + (alt_encoded / 91) % 91;
+		str[11] = '!' + alt_encoded % 91;
+
+		// Type byte
+		type = (1 << 5) /* current position */
+		     | (2 << 3) /* source = GGA (necessary for altitude encoding) */
+		     | (0 << 0) /* origin = compressed */;
+	}
 
 	str[12] = '!' + type;
 
@@ -378,9 +439,14 @@ static bool update_info_field(const aprs_args_t *args)
 	/* encode position */
 
 	if(m_config_flags & APRS_FLAG_COMPRESS_LOCATION) {
-		retptr = encode_position_compressed(infoptr, info_end - infoptr, m_table, m_icon);
+		retptr = encode_position_compressed(infoptr, info_end - infoptr, m_table, m_icon, args);
 	} else {
 		retptr = encode_position_readable(infoptr, info_end - infoptr, m_table, m_icon, dao);
+
+		/* course/speed data extension directly follows the symbol */
+		if(retptr && args->course_speed_valid) {
+			retptr = encode_course_speed_readable(retptr, info_end - retptr, args);
+		}
 	}
 
 	if (!retptr) {
@@ -388,8 +454,9 @@ static bool update_info_field(const aprs_args_t *args)
 	}
 	infoptr = retptr;
 
-	/* add altitude for uncompressed packets (already included in compressed format) */
-	if(!(m_config_flags & APRS_FLAG_COMPRESS_LOCATION)
+	/* add altitude for uncompressed packets (already included in compressed
+	 * format, unless course/speed is transmitted instead) */
+	if((!(m_config_flags & APRS_FLAG_COMPRESS_LOCATION) || args->course_speed_valid)
 			&& (m_config_flags & APRS_FLAG_ADD_ALTITUDE)) {
 		retptr = encode_altitude_readable(first_entry, infoptr, info_end - infoptr);
 		if(retptr) {
@@ -442,8 +509,8 @@ static bool update_info_field(const aprs_args_t *args)
 		}
 	}
 
-	/* add Vbat */
-	if (m_config_flags & APRS_FLAG_ADD_VBAT) {
+	/* add Vbat, unless it is sent as telemetry */
+	if ((m_config_flags & APRS_FLAG_ADD_VBAT) && !(m_config_flags & APRS_FLAG_TELEMETRY)) {
 		retptr = encode_vbat(first_entry, infoptr, info_end - infoptr, args->vbat_millivolt);
 		if(retptr) {
 			infoptr = retptr;
@@ -482,8 +549,6 @@ void aprs_init(void)
 	m_comment[0] = '\0';
 	m_comment[APRS_MAX_COMMENT_LEN] = '\0';
 
-	m_rx_history.num_entries = 0;
-
 	// default flags (compatible with v0.3)
 	m_config_flags = APRS_FLAG_ADD_FRAME_COUNTER | APRS_FLAG_ADD_ALTITUDE;
 }
@@ -540,6 +605,26 @@ void aprs_set_icon(char table, char icon)
 	m_icon  = icon;
 }
 
+void aprs_quantize_course_speed(float *course_deg, float *speed_mps)
+{
+	if(m_config_flags & APRS_FLAG_COMPRESS_LOCATION) {
+		uint8_t c, s;
+
+		calc_course_speed_compressed(*course_deg, *speed_mps, &c, &s);
+
+		*course_deg = c * 4.0f;
+		*speed_mps = (powf(1.08f, s) - 1.0f) / MPS_TO_KNOTS;
+	} else {
+		uint16_t course, speed;
+
+		calc_course_speed_readable(*course_deg, *speed_mps, &course, &speed);
+
+		*course_deg = course % 360;
+		*speed_mps = speed / MPS_TO_KNOTS;
+	}
+}
+
+
 void aprs_get_icon(char *table, char *icon)
 {
 	*table = m_table;
@@ -562,31 +647,26 @@ bool aprs_can_build_frame(void)
 	return (m_src[0] != '\0') && (m_dest[0] != '\0');
 }
 
-size_t aprs_build_frame(uint8_t *frame, const aprs_args_t *args, aprs_packet_type_t packet_type)
+/**@brief Append the LoRa-APRS header, the source and destination call and the path.
+ *
+ * @param frameptr   Pointer to the write position. Is moved behind the appended data.
+ * @param use_path   Whether the digipeater path shall be added (if digipeating is enabled).
+ */
+static void append_header(uint8_t **frameptr, bool use_path)
 {
-	uint8_t *frameptr = frame;
-	uint8_t *infoptr;
-
-	if (packet_type == APRS_PACKET_TYPE_WX) {
-		if (!((m_config_flags & APRS_FLAG_ADD_WEATHER) && args->transmit_env_data)) {
-			return 0;
-		}
-	}
-
-	*(frameptr++) = '<';
-	*(frameptr++) = 0xFF;
-	*(frameptr++) = 0x01;
+	*((*frameptr)++) = '<';
+	*((*frameptr)++) = 0xFF;
+	*((*frameptr)++) = 0x01;
 
-	append_address(&frameptr, m_src, 1);
-	*(frameptr++) = '>';
+	append_address(frameptr, m_src, 1);
+	*((*frameptr)++) = '>';
 
 	/* adjust path according to the current digipeating configuration. */
 
-	if((m_npath == 0) || (packet_type == APRS_PACKET_TYPE_WX) || !(m_config_flags & APRS_FLAG_USE_DIGIPEATING)) {
-		// if no path is set, digipeating is disabled or in any case for
-		// weather reports, just append the destination (with SSID 0) and no
-		// further path
-		append_address(&frameptr, m_dest, true);
+	if(!use_path || (m_npath == 0) || !(m_config_flags & APRS_FLAG_USE_DIGIPEATING)) {
+		// if no path is set or digipeating is disabled, just append the
+		// destination (with SSID 0) and no further path
+		append_address(frameptr, m_dest, true);
 	} else {
 		// If digipeating is enabled, but WIDEn-n is not, replace the WIDEn-n in
 		// the path with destination call digipeating (i.e. put the n in the
@@ -603,19 +683,35 @@ size_t aprs_build_frame(uint8_t *frame, const aprs_args_t *args, aprs_packet_typ
 			dest_mod[dest_len+1] = m_path[0][4]; // copy n from WIDEn-n
 			dest_mod[dest_len+2] = '\0';
 
-			append_address(&frameptr, dest_mod, (m_npath == 1));
+			append_address(frameptr, dest_mod, (m_npath == 1));
 			pathstart++; // skip WIDEn-n in the path
 		} else {
 			// first entry in the path is not WIDEn-n
-			append_address(&frameptr, m_dest, (m_npath == 0));
+			append_address(frameptr, m_dest, (m_npath == 0));
 		}
 
 		// append the remaining path
 		for(uint8_t i = pathstart; i < m_npath; i++) {
-			append_address(&frameptr, m_path[i], (m_npath == (i+1)));
+			append_address(frameptr, m_path[i], (m_npath == (i+1)));
+		}
+	}
+}
+
+
+size_t aprs_build_frame(uint8_t *frame, const aprs_args_t *args, aprs_packet_type_t packet_type)
+{
+	uint8_t *frameptr = frame;
+	uint8_t *infoptr;
+
+	if (packet_type == APRS_PACKET_TYPE_WX) {
+		if (!((m_config_flags & APRS_FLAG_ADD_WEATHER) && args->transmit_env_data)) {
+			return 0;
 		}
 	}
 
+	// weather reports are never digipeated
+	append_header(&frameptr, packet_type != APRS_PACKET_TYPE_WX);
+
 	*(frameptr++) = ':';
 
 	switch(packet_type) {
@@ -683,6 +779,74 @@ size_t aprs_build_frame(uint8_t *frame, const aprs_args_t *args, aprs_packet_typ
 }
 
 
+size_t aprs_build_message_frame(uint8_t *frame, const char *addressee, const char *text, const char *msg_id)
+{
+	uint8_t *frameptr = frame;
+
+	size_t text_len = strlen(text);
+	size_t id_len = msg_id ? strlen(msg_id) : 0;
+
+	if(strlen(addressee) > APRS_MESSAGE_ADDRESSEE_LEN
+			|| text_len > APRS_MAX_MESSAGE_TEXT_LEN
+			|| id_len > APRS_MAX_MESSAGE_ID_LEN) {
+		return 0;
+	}
+
+	append_header(&frameptr, true);
+
+	// the addressee is padded with spaces to a fixed width
+	*(frameptr++) = ':';
+	*(frameptr++) = ':';
+
+	frameptr += sprintf((char*)frameptr, "%-*s", APRS_MESSAGE_ADDRESSEE_LEN, addressee);
+
+	*(frameptr++) = ':';
+
+	memcpy(frameptr, text, text_len);
+	frameptr += text_len;
+
+	if(id_len > 0) {
+		*(frameptr++) = '{';
+		memcpy(frameptr, msg_id, id_len);
+		frameptr += id_len;
+	}
+
+	*frameptr = '\0';
+
+	return (size_t)(frameptr - frame);
+}
+
+
+size_t aprs_build_telemetry_frame(uint8_t *frame, uint16_t seq, const uint8_t analog[APRS_TELEMETRY_NUM_ANALOG], uint8_t digital)
+{
+	uint8_t *frameptr = frame;
+
+	if(seq > 999) {
+		return 0;
+	}
+
+	append_header(&frameptr, true);
+
+	*(frameptr++) = ':';
+
+	frameptr += sprintf((char*)frameptr, "T#%03u", seq);
+
+	for(uint8_t i = 0; i < APRS_TELEMETRY_NUM_ANALOG; i++) {
+		frameptr += sprintf((char*)frameptr, ",%03u", analog[i]);
+	}
+
+	*(frameptr++) = ',';
+
+	for(uint8_t i = 0; i < 8; i++) {
+		*(frameptr++) = (digital & (1 << i)) ? '1' : '0';
+	}
+
+	*frameptr = '\0';
+
+	return (size_t)(frameptr - frame);
+}
+
+
 uint32_t aprs_get_config_flags(void)
 {
 	return m_config_flags;
@@ -1102,118 +1266,3 @@ const char* aprs_get_parser_error(void)
 {
 	return m_error_message;
 }
-
-
-uint8_t aprs_rx_history_insert(
-		const aprs_frame_t *frame,
-		const aprs_rx_raw_data_t *raw,
-		uint64_t rx_timestamp,
-		bool rx_time_valid,
-		uint8_t protected_index)
-{
-	aprs_rx_history_entry_t *insert_pos = NULL;
-	bool updating_existing_entry = false;
-
-	// first try: check if the source call sign already exists
-	if(insert_pos == NULL) {
-		const char *newsrc = frame->source;
-		for(uint8_t i = 0; i < m_rx_history.num_entries; i++) {
-			const char *oldsrc = m_rx_history.history[i].decoded.source;
-
-			if(strcmp(newsrc, oldsrc) == 0) {
-				updating_existing_entry = true;
-				insert_pos = &m_rx_history.history[i];
-				break;
-			}
-		}
-	}
-
-	// second try: append at the end
-	if(insert_pos == NULL) {
-		if(m_rx_history.num_entries < APRS_RX_HISTORY_SIZE) {
-			insert_pos = &m_rx_history.history[m_rx_history.num_entries];
-			m_rx_history.num_entries++;
-		}
-	}
-
-	// third try: replace the oldest entry, but never the protected one (which
-	// is likely currently being viewed)
-	if(insert_pos == NULL) {
-		uint64_t oldest_timestamp = UINT64_MAX;
-
-		for(uint8_t i = 0; i < m_rx_history.num_entries; i++) {
-			if(i == protected_index) {
-				continue;
-			}
-
-			uint64_t timestamp = m_rx_history.history[i].rx_timestamp;
-			if(timestamp < oldest_timestamp) {
-				oldest_timestamp = timestamp;
-				insert_pos = &m_rx_history.history[i];
-			}
-		}
-	}
-
-	if(insert_pos == NULL) {
-		// could not find a suitable location (this should never happen with
-		// the above algorithm, but to play it safe, this case is catched here)
-		return 0;
-	}
-
-	bool is_positionless = (frame->lat == 0.0f) && (frame->lon == 0.0f);
-
-	// if the current frame is positionless, we save the unavailable
-	// information from previous frames and restore it later
-	float lat, lon, alt;
-	char table, symbol;
-	if(updating_existing_entry && is_positionless) {
-		lat    = insert_pos->decoded.lat;
-		lon    = insert_pos->decoded.lon;
-		alt    = insert_pos->decoded.alt;
-		table  = insert_pos->decoded.table;
-		symbol = insert_pos->decoded.symbol;
-	}
-
-	// update the stored data
-	insert_pos->decoded = *frame;
-	insert_pos->rx_timestamp = rx_timestamp;
-	insert_pos->rx_time_valid = rx_time_valid;
-	insert_pos->raw = *raw;
-
-	// restore the data unavailable in the positionless frame
-	if(updating_existing_entry && is_positionless) {
-		insert_pos->decoded.lat    = lat;
-		insert_pos->decoded.lon    = lon;
-		insert_pos->decoded.alt    = alt;
-		insert_pos->decoded.table  = table;
-		insert_pos->decoded.symbol = symbol;
-	}
-
-	return (insert_pos - m_rx_history.history);
-}
-
-
-const aprs_rx_history_t* aprs_get_rx_history(void)
-{
-	return &m_rx_history;
-}
-
-/**
- * @brief Updates rx packet history entries timestamp
- * @details The following funtion updates all history rx'ed packet
- * containing an invalid rx timestamp, identified by rx_time_valid variable.
- *
- * @param unix_time The current Unix epoch timestamp to update the
-*					history entries.
-*/
-void aprs_rx_history_fix_timestamp(uint64_t unix_time)
-{
-	for(uint8_t i = 0; i < m_rx_history.num_entries; i++) {
-
-		if (!m_rx_history.history[i].rx_time_valid)
-		{
-			m_rx_history.history[i].rx_time_valid = true;
-			m_rx_history.history[i].rx_timestamp = unix_time - m_rx_history.history[i].rx_timestamp;
-		}
-	}
-}
@@ -35,6 +35,12 @@
 #define APRS_MAX_INFO_LEN (APRS_MAX_FRAME_LEN - (1+7+7+8*7+1+1+2+1))
 #define APRS_MAX_COMMENT_LEN 32
 
+#define APRS_MESSAGE_ADDRESSEE_LEN  9
+#define APRS_MAX_MESSAGE_TEXT_LEN  67
+#define APRS_MAX_MESSAGE_ID_LEN     5
+
+#define APRS_TELEMETRY_NUM_ANALOG   5
+
 typedef enum
 {
 	APRS_PACKET_TYPE_POSITION,
@@ -74,12 +80,20 @@ typedef enum {
 	APRS_FLAG_STARTUP_TX_ON     = (1 << 7),
 	APRS_FLAG_USE_DIGIPEATING   = (1 << 8), // enable digipeating (via WIDE-N or dest call)
 	APRS_FLAG_USE_WIDEN_N       = (1 << 9), // use full WIDEn-n digipeating; if not set, use destination call digipeating
+	APRS_FLAG_FILL_IN_DIGIPEATER = (1 << 10), // repeat received frames that request WIDE1-1 or the own call
+	APRS_FLAG_SLOTTED_TX        = (1 << 11), // defer own reports to a GNSS-time-synchronized slot
+	APRS_FLAG_TELEMETRY         = (1 << 12), // send sensor data as telemetry instead of Vbat in the comment
+	APRS_FLAG_BLE_RX_BATCHING   = (1 << 13), // pack several received frames into one BLE notification
 } aprs_flag_t;
 
 typedef struct {
 	uint32_t frame_id;
 	uint16_t vbat_millivolt;
 
+	bool  course_speed_valid; // add course and speed to position reports
+	float course_deg;
+	float speed_mps;
+
 	bool  transmit_env_data;
 	float temperature_celsius;
 	float humidity_rH;
@@ -102,8 +116,6 @@ typedef struct {
 	char symbol;
 } aprs_frame_t;
 
-#define APRS_RX_HISTORY_SIZE 3
-
 typedef struct {
 	uint8_t      data[256];
 	uint8_t      data_len;
@@ -113,18 +125,6 @@ typedef struct {
 	float signalRssi;
 } aprs_rx_raw_data_t;
 
-typedef struct {
-	aprs_rx_raw_data_t raw;
-	aprs_frame_t       decoded;
-	uint64_t           rx_timestamp;
-	bool               rx_time_valid;
-} aprs_rx_history_entry_t;
-
-typedef struct {
-	aprs_rx_history_entry_t history[APRS_RX_HISTORY_SIZE];
-	uint8_t                 num_entries;
-} aprs_rx_history_t;
-
 
 void aprs_init(void);
 void aprs_set_dest(const char *dest);
@@ -134,12 +134,33 @@ void aprs_get_source(char *source, size_t source_len);
 void aprs_clear_path();
 uint8_t aprs_add_path(const char *call);
 void aprs_update_pos_time(float lat, float lon, float alt_m, time_t t);
+
+/**@brief Round course and speed to the precision of the current packet format.
+ * @details
+ * Receivers only see the encoded values. Use this to predict what they
+ * extrapolate from a position report.
+ *
+ * @param[inout] course_deg  Course in degrees (0 to 360).
+ * @param[inout] speed_mps   Speed in meters per second.
+ */
+void aprs_quantize_course_speed(float *course_deg, float *speed_mps);
 void aprs_get_icon(char *table, char *icon);
 void aprs_set_icon(char table, char icon);
 void aprs_set_icon_default(aprs_icon_t icon);
 void aprs_set_comment(const char *comment);
 bool aprs_can_build_frame(void);
 size_t aprs_build_frame(uint8_t *frame, const aprs_args_t *args, aprs_packet_type_t packet_type);
+size_t aprs_build_message_frame(uint8_t *frame, const char *addressee, const char *text, const char *msg_id);
+
+/**@brief Build a telemetry data frame (T#sss,aaa,aaa,aaa,aaa,aaa,bbbbbbbb).
+ *
+ * @param frame    Buffer for the frame (at least @ref APRS_MAX_FRAME_LEN bytes).
+ * @param seq      Sequence number (0 to 999).
+ * @param analog   The raw analog values (0 to 255).
+ * @param digital  The digital values. Bit 0 is B1.
+ * @returns        The length of the frame or 0 on error.
+ */
+size_t aprs_build_telemetry_frame(uint8_t *frame, uint16_t seq, const uint8_t analog[APRS_TELEMETRY_NUM_ANALOG], uint8_t digital);
 
 uint32_t aprs_get_config_flags(void);
 void aprs_set_config_flags(uint32_t new_flags);
@@ -150,26 +171,4 @@ void aprs_toggle_config_flag(aprs_flag_t flag);
 bool aprs_parse_frame(const uint8_t *frame, size_t len, aprs_frame_t *result);
 const char* aprs_get_parser_error(void);
 
-/**@brief Insert the given frame in the history and return its index.
- * @details
- * If a frame with the received call already exists in the history, that frame
- * is replaced by the new frame. If it does not exist and the history is full
- * before the new frame is inserted, the oldest frame in the history is
- * replaced.
- *
- * You can specify the index of an entry to protect. That entry will never be
- * replaced, except if the callsign matches. Set protected_index to
- * APRS_RX_HISTORY_SIZE or greater to disable the protection.
- */
-uint8_t aprs_rx_history_insert(
-		const aprs_frame_t *frame,
-		const aprs_rx_raw_data_t *raw,
-		uint64_t rx_timestamp,
-		bool rx_time_valid,
-		uint8_t protected_index);
-
-const aprs_rx_history_t* aprs_get_rx_history(void);
-
-void aprs_rx_history_fix_timestamp(uint64_t unix_time);
-
 #endif // APRS_H
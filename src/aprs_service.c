@@ -36,8 +36,168 @@ NRF_LOG_MODULE_REGISTER();
 
 #include "ble_srv_common.h"
 #include "ble_conn_state.h"
+#include "nrf_sdh_ble.h"
 
+#include "ble_notify.h"
 #include "config.h"
+#include "energy.h"
+#include "event_queue.h"
+
+/**@brief Handle a write to the TX Message characteristic.
+ * @details
+ * The written value has the format "ADDRESSEE:text". Invalid values are
+ * ignored.
+ *
+ * @param[in] p_srv        Service structure.
+ * @param[in] p_evt_write  The write event parameters.
+ */
+static void on_tx_message_write(aprs_service_t * p_srv, ble_gatts_evt_write_t const * p_evt_write)
+{
+	aprs_service_evt_t evt;
+
+	const uint8_t *sep = memchr(p_evt_write->data, ':', p_evt_write->len);
+
+	if(!sep) {
+		NRF_LOG_WARNING("TX message without addressee separator ignored.");
+		return;
+	}
+
+	size_t addressee_len = sep - p_evt_write->data;
+	size_t text_len = p_evt_write->len - addressee_len - 1;
+
+	if(addressee_len == 0 || addressee_len > APRS_SERVICE_MAX_ADDRESSEE_LEN
+			|| text_len == 0 || text_len > APRS_SERVICE_MAX_MESSAGE_TEXT_LEN) {
+		NRF_LOG_WARNING("TX message with invalid length ignored.");
+		return;
+	}
+
+	evt.type = APRS_SERVICE_EVT_TX_MESSAGE;
+
+	memcpy(evt.params.tx_message.addressee, p_evt_write->data, addressee_len);
+	evt.params.tx_message.addressee[addressee_len] = '\0';
+
+	memcpy(evt.params.tx_message.text, sep + 1, text_len);
+	evt.params.tx_message.text[text_len] = '\0';
+
+	p_srv->callback(&evt);
+}
+
+/**@brief Handle a write to the Settings Restore characteristic.
+ * @details
+ * A snapshot may be larger than one write, so the chunks are collected until
+ * the length from the snapshot header is reached. An empty write discards
+ * the collected data.
+ *
+ * @param[in] p_srv        Service structure.
+ * @param[in] p_evt_write  The write event parameters.
+ */
+static void on_settings_restore_write(aprs_service_t * p_srv, ble_gatts_evt_write_t const * p_evt_write)
+{
+	aprs_service_evt_t evt;
+
+	if(p_evt_write->len == 0) {
+		p_srv->restore_len = 0;
+		return;
+	}
+
+	size_t space = sizeof(p_srv->restore_buf) - p_srv->restore_len;
+	size_t len = p_evt_write->len;
+
+	if(len > space) {
+		len = space;
+	}
+
+	memcpy(p_srv->restore_buf + p_srv->restore_len, p_evt_write->data, len);
+	p_srv->restore_len += len;
+
+	size_t total_len = settings_tlv_get_total_len(p_srv->restore_buf, p_srv->restore_len);
+
+	if(len == p_evt_write->len && (total_len == 0 || total_len > p_srv->restore_len)) {
+		// wait for more data
+		return;
+	}
+
+	// complete or too long: the latter is rejected by the parser
+	evt.type = APRS_SERVICE_EVT_SETTINGS_RESTORE;
+	evt.params.snapshot.data = p_srv->restore_buf;
+	evt.params.snapshot.data_len = p_srv->restore_len;
+
+	p_srv->restore_len = 0;
+
+	p_srv->callback(&evt);
+}
+
+/**@brief Handle a write to the RX Archive characteristic.
+ * @details
+ * The written value contains the first sequence number and the number of
+ * records (u32 each, little endian) to download. An empty write cancels a
+ * running download.
+ *
+ * @param[in] p_srv        Service structure.
+ * @param[in] p_evt_write  The write event parameters.
+ */
+static void on_rx_archive_write(aprs_service_t * p_srv, ble_gatts_evt_write_t const * p_evt_write)
+{
+	aprs_service_evt_t evt;
+
+	if(p_evt_write->len == 0) {
+		evt.type = APRS_SERVICE_EVT_RX_ARCHIVE_CANCEL;
+		p_srv->callback(&evt);
+		return;
+	}
+
+	if(p_evt_write->len != 8) {
+		NRF_LOG_WARNING("RX archive request with invalid length ignored.");
+		return;
+	}
+
+	const uint8_t *p = p_evt_write->data;
+
+	evt.type = APRS_SERVICE_EVT_RX_ARCHIVE_REQUEST;
+	evt.params.rx_archive.start_seq = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	evt.params.rx_archive.count     = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+
+	p_srv->callback(&evt);
+}
+
+/**@brief Handle a write to the Track Export characteristic.
+ * @details
+ * The written value contains the format (u8), optionally followed by the
+ * first and the last Unix timestamp to export (u32 each, little endian). An
+ * empty write cancels a running export.
+ *
+ * @param[in] p_srv        Service structure.
+ * @param[in] p_evt_write  The write event parameters.
+ */
+static void on_track_export_write(aprs_service_t * p_srv, ble_gatts_evt_write_t const * p_evt_write)
+{
+	aprs_service_evt_t evt;
+
+	if(p_evt_write->len == 0) {
+		evt.type = APRS_SERVICE_EVT_TRACK_EXPORT_CANCEL;
+		p_srv->callback(&evt);
+		return;
+	}
+
+	if(p_evt_write->len != 1 && p_evt_write->len != 9) {
+		NRF_LOG_WARNING("Track export request with invalid length ignored.");
+		return;
+	}
+
+	const uint8_t *p = p_evt_write->data;
+
+	evt.type = APRS_SERVICE_EVT_TRACK_EXPORT_REQUEST;
+	evt.params.track_export.format = p[0];
+	evt.params.track_export.start_time = 0;
+	evt.params.track_export.end_time = 0;
+
+	if(p_evt_write->len == 9) {
+		evt.params.track_export.start_time = p[1] | (p[2] << 8) | (p[3] << 16) | ((uint32_t)p[4] << 24);
+		evt.params.track_export.end_time   = p[5] | (p[6] << 8) | (p[7] << 16) | ((uint32_t)p[8] << 24);
+	}
+
+	p_srv->callback(&evt);
+}
 
 /**@brief Function for handling the Write event.
  *
@@ -65,6 +225,10 @@ static void on_write(aprs_service_t * p_srv, ble_evt_t const * p_ble_evt)
 		evt.type = APRS_SERVICE_EVT_SYMBOL_CHANGED;
 		p_srv->callback(&evt);
 	}
+	else if (p_evt_write->handle == p_srv->tx_message_char_handles.value_handle)
+	{
+		on_tx_message_write(p_srv, p_evt_write);
+	}
 	else if (p_evt_write->handle == p_srv->settings_write_char_handles.value_handle)
 	{
 		switch(p_evt_write->len)
@@ -97,6 +261,18 @@ static void on_write(aprs_service_t * p_srv, ble_evt_t const * p_ble_evt)
 				break;
 		}
 	}
+	else if (p_evt_write->handle == p_srv->settings_restore_char_handles.value_handle)
+	{
+		on_settings_restore_write(p_srv, p_evt_write);
+	}
+	else if (p_evt_write->handle == p_srv->rx_archive_char_handles.value_handle)
+	{
+		on_rx_archive_write(p_srv, p_evt_write);
+	}
+	else if (p_evt_write->handle == p_srv->track_export_char_handles.value_handle)
+	{
+		on_track_export_write(p_srv, p_evt_write);
+	}
 }
 
 /**@brief Handle BLE events.
@@ -113,6 +289,23 @@ void aprs_service_on_ble_evt(ble_evt_t const * p_ble_evt, void * p_context)
 			on_write(p_srv, p_ble_evt);
 			break;
 
+		case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+			// the SoftDevice has space for new notifications
+			event_queue_post(EVENT_BLE_RX_NOTIFY);
+			event_queue_post(EVENT_BLE_ARCHIVE_NOTIFY);
+			event_queue_post(EVENT_BLE_TRACK_NOTIFY);
+			break;
+
+		case BLE_GAP_EVT_DISCONNECTED:
+			p_srv->max_notify_len = BLE_GATT_ATT_MTU_DEFAULT - BLE_NOTIFY_OVERHEAD;
+			p_srv->restore_len = 0;
+
+			// discard the queued messages and stop a download
+			event_queue_post(EVENT_BLE_RX_NOTIFY);
+			event_queue_post(EVENT_BLE_ARCHIVE_NOTIFY);
+			event_queue_post(EVENT_BLE_TRACK_NOTIFY);
+			break;
+
 		default:
 			// No implementation needed.
 			break;
@@ -145,6 +338,10 @@ uint32_t aprs_service_init(aprs_service_t * p_srv, const aprs_service_init_t * p
 
 	// Initialize service structure.
 	p_srv->callback  = p_srv_init->callback;
+	p_srv->max_notify_len = BLE_GATT_ATT_MTU_DEFAULT - BLE_NOTIFY_OVERHEAD;
+	p_srv->restore_len = 0;
+
+	notify_queue_init(&p_srv->rx_queue);
 
 	// Add service.
 	ble_uuid128_t base_uuid = {APRS_SERVICE_UUID_BASE};
@@ -241,6 +438,43 @@ uint32_t aprs_service_init(aprs_service_t * p_srv, const aprs_service_init_t * p
 	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->rx_message_char_handles);
 	VERIFY_SUCCESS(err_code);
 
+	/* Add tx message characteristic. */
+	memset(&add_char_params, 0, sizeof(add_char_params));
+	add_char_params.uuid              = APRS_SERVICE_UUID_TX_MESSAGE;
+	add_char_params.uuid_type         = p_srv->uuid_type;
+	add_char_params.init_len          = 0;
+	add_char_params.max_len           = APRS_SERVICE_MAX_ADDRESSEE_LEN + 1 + APRS_SERVICE_MAX_MESSAGE_TEXT_LEN;
+	add_char_params.is_var_len        = 1;
+	add_char_params.p_init_value      = NULL;
+	add_char_params.char_props.read   = 0;
+	add_char_params.char_props.write  = 1;
+
+	add_char_params.write_access      = SEC_MITM;
+
+	fill_user_desc(&add_user_desc, "TX Message");
+	add_char_params.p_user_descr = &add_user_desc;
+
+	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->tx_message_char_handles);
+	VERIFY_SUCCESS(err_code);
+
+	/* Add energy statistics characteristic. */
+	memset(&add_char_params, 0, sizeof(add_char_params));
+	add_char_params.uuid              = APRS_SERVICE_UUID_ENERGY_STATS;
+	add_char_params.uuid_type         = p_srv->uuid_type;
+	add_char_params.init_len          = 0;
+	add_char_params.max_len           = ENERGY_ENCODED_STATS_LEN;
+	add_char_params.is_var_len        = 1;
+	add_char_params.p_init_value      = NULL;
+	add_char_params.char_props.read   = 1;
+
+	add_char_params.read_access       = SEC_OPEN;
+
+	fill_user_desc(&add_user_desc, "Energy statistics");
+	add_char_params.p_user_descr = &add_user_desc;
+
+	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->energy_stats_char_handles);
+	VERIFY_SUCCESS(err_code);
+
 	/* Add settings-write characteristic. */
 	memset(&add_char_params, 0, sizeof(add_char_params));
 	add_char_params.uuid              = APRS_SERVICE_UUID_SETTINGS_WRITE;
@@ -280,6 +514,89 @@ uint32_t aprs_service_init(aprs_service_t * p_srv, const aprs_service_init_t * p
 	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->settings_read_char_handles);
 	VERIFY_SUCCESS(err_code);
 
+	/* Add settings snapshot characteristic. */
+	memset(&add_char_params, 0, sizeof(add_char_params));
+	add_char_params.uuid              = APRS_SERVICE_UUID_SETTINGS_SNAPSHOT;
+	add_char_params.uuid_type         = p_srv->uuid_type;
+	add_char_params.init_len          = 0;
+	add_char_params.max_len           = SETTINGS_TLV_MAX_LEN;
+	add_char_params.is_var_len        = 1;
+	add_char_params.p_init_value      = NULL;
+	add_char_params.char_props.read   = 1;
+
+	add_char_params.read_access       = SEC_MITM;
+
+	fill_user_desc(&add_user_desc, "Settings snapshot");
+	add_char_params.p_user_descr = &add_user_desc;
+
+	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->settings_snapshot_char_handles);
+	VERIFY_SUCCESS(err_code);
+
+	/* Add settings restore characteristic. */
+	memset(&add_char_params, 0, sizeof(add_char_params));
+	add_char_params.uuid              = APRS_SERVICE_UUID_SETTINGS_RESTORE;
+	add_char_params.uuid_type         = p_srv->uuid_type;
+	add_char_params.init_len          = 0;
+	add_char_params.max_len           = APRS_SERVICE_MAX_RESTORE_CHUNK_LEN;
+	add_char_params.is_var_len        = 1;
+	add_char_params.p_init_value      = NULL;
+	add_char_params.char_props.read   = 0;
+	add_char_params.char_props.write  = 1;
+	add_char_params.char_props.notify = 1;
+
+	add_char_params.write_access      = SEC_MITM;
+	add_char_params.cccd_write_access = SEC_MITM;
+
+	fill_user_desc(&add_user_desc, "Settings restore");
+	add_char_params.p_user_descr = &add_user_desc;
+
+	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->settings_restore_char_handles);
+	VERIFY_SUCCESS(err_code);
+
+	/* Add RX archive characteristic. */
+	memset(&add_char_params, 0, sizeof(add_char_params));
+	add_char_params.uuid              = APRS_SERVICE_UUID_RX_ARCHIVE;
+	add_char_params.uuid_type         = p_srv->uuid_type;
+	add_char_params.init_len          = 0;
+	add_char_params.max_len           = 8;
+	add_char_params.is_var_len        = 1;
+	add_char_params.p_init_value      = NULL;
+	add_char_params.char_props.read   = 1;
+	add_char_params.char_props.write  = 1;
+	add_char_params.char_props.notify = 1;
+
+	add_char_params.read_access       = SEC_OPEN;
+	add_char_params.write_access      = SEC_OPEN;
+	add_char_params.cccd_write_access = SEC_OPEN;
+
+	fill_user_desc(&add_user_desc, "RX archive");
+	add_char_params.p_user_descr = &add_user_desc;
+
+	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->rx_archive_char_handles);
+	VERIFY_SUCCESS(err_code);
+
+	/* Add track export characteristic. */
+	memset(&add_char_params, 0, sizeof(add_char_params));
+	add_char_params.uuid              = APRS_SERVICE_UUID_TRACK_EXPORT;
+	add_char_params.uuid_type         = p_srv->uuid_type;
+	add_char_params.init_len          = 0;
+	add_char_params.max_len           = 9;
+	add_char_params.is_var_len        = 1;
+	add_char_params.p_init_value      = NULL;
+	add_char_params.char_props.read   = 0;
+	add_char_params.char_props.write  = 1;
+	add_char_params.char_props.notify = 1;
+
+	// the track reveals where the user has been
+	add_char_params.write_access      = SEC_MITM;
+	add_char_params.cccd_write_access = SEC_MITM;
+
+	fill_user_desc(&add_user_desc, "Track export");
+	add_char_params.p_user_descr = &add_user_desc;
+
+	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->track_export_char_handles);
+	VERIFY_SUCCESS(err_code);
+
 	return err_code;
 }
 
@@ -353,6 +670,14 @@ ret_code_t aprs_service_get_symbol(aprs_service_t * p_srv, char *p_table, char *
 }
 
 
+ret_code_t aprs_service_set_energy_stats(aprs_service_t * p_srv, const uint8_t *p_data, uint16_t data_len)
+{
+	ble_gatts_value_t value = {data_len, 0, (uint8_t*)p_data};
+
+	return sd_ble_gatts_value_set(BLE_CONN_HANDLE_INVALID, p_srv->energy_stats_char_handles.value_handle, &value);
+}
+
+
 ret_code_t aprs_service_notify_rx_message(aprs_service_t * p_srv, uint16_t conn_handle, uint8_t *p_message, uint8_t message_len)
 {
 
@@ -365,20 +690,72 @@ ret_code_t aprs_service_notify_rx_message(aprs_service_t * p_srv, uint16_t conn_
 				p_srv->rx_message_char_handles.value_handle,
 				&value);
 	} else {
-		uint16_t len = message_len;
+		if(!notify_queue_push(&p_srv->rx_queue, p_message, message_len)) {
+			return NRF_ERROR_NO_MEM;
+		}
+
+		event_queue_post(EVENT_BLE_RX_NOTIFY);
+		return NRF_SUCCESS;
+	}
+}
+
+
+void aprs_service_send_rx_notifications(aprs_service_t * p_srv, uint16_t conn_handle, bool batching)
+{
+	uint8_t buf[NRF_SDH_BLE_GATT_MAX_MTU_SIZE - BLE_NOTIFY_OVERHEAD];
+
+	if(ble_conn_state_status(conn_handle) != BLE_CONN_STATUS_CONNECTED) {
+		notify_queue_clear(&p_srv->rx_queue);
+		return;
+	}
+
+	size_t max_len = p_srv->max_notify_len;
+
+	if(max_len > sizeof(buf)) {
+		max_len = sizeof(buf);
+	}
+
+	uint32_t frames;
+	size_t len;
+
+	while((len = notify_queue_build(&p_srv->rx_queue, buf, max_len, batching, &frames)) > 0) {
+		uint16_t hvx_len = len;
 		ble_gatts_hvx_params_t params;
 
 		memset(&params, 0, sizeof(params));
 		params.type   = BLE_GATT_HVX_NOTIFICATION;
 		params.handle = p_srv->rx_message_char_handles.value_handle;
-		params.p_data = p_message;
-		params.p_len  = &len;
+		params.p_data = buf;
+		params.p_len  = &hvx_len;
 
-		return sd_ble_gatts_hvx(conn_handle, &params);
+		ret_code_t err_code = sd_ble_gatts_hvx(conn_handle, &params);
+
+		if(err_code == NRF_ERROR_RESOURCES) {
+			// retried after BLE_GATTS_EVT_HVN_TX_COMPLETE
+			return;
+		}
+
+		if(err_code != NRF_SUCCESS) {
+			// notifications are not enabled: the client can still read the value.
+			ble_gatts_value_t value = {len, 0, buf};
+
+			sd_ble_gatts_value_set(
+					BLE_CONN_HANDLE_INVALID,
+					p_srv->rx_message_char_handles.value_handle,
+					&value);
+		}
+
+		notify_queue_pop(&p_srv->rx_queue, frames);
 	}
 }
 
 
+void aprs_service_set_att_mtu(aprs_service_t * p_srv, uint16_t att_mtu)
+{
+	p_srv->max_notify_len = att_mtu - BLE_NOTIFY_OVERHEAD;
+}
+
+
 ret_code_t aprs_service_notify_setting(aprs_service_t * p_srv, uint16_t conn_handle,
 		settings_id_t setting_id, bool success, const uint8_t *p_data, uint16_t data_len)
 {
@@ -427,3 +804,81 @@ ret_code_t aprs_service_notify_setting(aprs_service_t * p_srv, uint16_t conn_han
 		return sd_ble_gatts_hvx(conn_handle, &params);
 	}
 }
+
+
+ret_code_t aprs_service_set_settings_snapshot(aprs_service_t * p_srv, const uint8_t *p_data, uint16_t data_len)
+{
+	ble_gatts_value_t value = {data_len, 0, (uint8_t*)p_data};
+
+	return sd_ble_gatts_value_set(BLE_CONN_HANDLE_INVALID, p_srv->settings_snapshot_char_handles.value_handle, &value);
+}
+
+
+ret_code_t aprs_service_notify_restore_status(aprs_service_t * p_srv, uint16_t conn_handle,
+		aprs_service_restore_status_t status, settings_id_t setting_id)
+{
+	uint8_t message[2] = {status, setting_id};
+
+	if(ble_conn_state_status(conn_handle) != BLE_CONN_STATUS_CONNECTED) {
+		// nobody is waiting for the result
+		return NRF_SUCCESS;
+	}
+
+	uint16_t len = sizeof(message);
+	ble_gatts_hvx_params_t params;
+
+	memset(&params, 0, sizeof(params));
+	params.type   = BLE_GATT_HVX_NOTIFICATION;
+	params.handle = p_srv->settings_restore_char_handles.value_handle;
+	params.p_data = message;
+	params.p_len  = &len;
+
+	return sd_ble_gatts_hvx(conn_handle, &params);
+}
+
+
+ret_code_t aprs_service_set_rx_archive_info(aprs_service_t * p_srv, uint32_t first_seq, uint32_t next_seq)
+{
+	uint8_t info[8];
+
+	for(uint8_t i = 0; i < 4; i++) {
+		info[i]     = first_seq >> (8 * i);
+		info[4 + i] = next_seq >> (8 * i);
+	}
+
+	ble_gatts_value_t value = {sizeof(info), 0, info};
+
+	return sd_ble_gatts_value_set(BLE_CONN_HANDLE_INVALID, p_srv->rx_archive_char_handles.value_handle, &value);
+}
+
+
+ret_code_t aprs_service_notify_rx_archive(aprs_service_t * p_srv, uint16_t conn_handle,
+		const uint8_t *p_data, uint16_t data_len)
+{
+	uint16_t len = data_len;
+	ble_gatts_hvx_params_t params;
+
+	memset(&params, 0, sizeof(params));
+	params.type   = BLE_GATT_HVX_NOTIFICATION;
+	params.handle = p_srv->rx_archive_char_handles.value_handle;
+	params.p_data = p_data;
+	params.p_len  = &len;
+
+	return sd_ble_gatts_hvx(conn_handle, &params);
+}
+
+
+ret_code_t aprs_service_notify_track_export(aprs_service_t * p_srv, uint16_t conn_handle,
+		const uint8_t *p_data, uint16_t data_len)
+{
+	uint16_t len = data_len;
+	ble_gatts_hvx_params_t params;
+
+	memset(&params, 0, sizeof(params));
+	params.type   = BLE_GATT_HVX_NOTIFICATION;
+	params.handle = p_srv->track_export_char_handles.value_handle;
+	params.p_data = p_data;
+	params.p_len  = &len;
+
+	return sd_ble_gatts_hvx(conn_handle, &params);
+}
@@ -43,6 +43,8 @@
 #include "ble.h"
 
 #include "settings.h"
+#include "settings_tlv.h"
+#include "notify_queue.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -66,11 +68,23 @@ NRF_SDH_BLE_OBSERVER(_name ## _obs,
 #define APRS_SERVICE_UUID_COMMENT            0x0102      // Comment
 #define APRS_SERVICE_UUID_SYMBOL             0x0103      // Symbol code
 #define APRS_SERVICE_UUID_RX_MESSAGE         0x0104      // The last received message
+#define APRS_SERVICE_UUID_TX_MESSAGE         0x0105      // Send an APRS message ("ADDRESSEE:text")
+#define APRS_SERVICE_UUID_ENERGY_STATS       0x0106      // Estimated energy consumption
 #define APRS_SERVICE_UUID_SETTINGS_WRITE     0x0110      // Write or select a setting
 #define APRS_SERVICE_UUID_SETTINGS_READ      0x0111      // Read setting value
+#define APRS_SERVICE_UUID_SETTINGS_SNAPSHOT  0x0112      // All settings in one value
+#define APRS_SERVICE_UUID_SETTINGS_RESTORE   0x0113      // Restore a snapshot
+#define APRS_SERVICE_UUID_RX_ARCHIVE         0x0114      // Download archived packets
+#define APRS_SERVICE_UUID_TRACK_EXPORT       0x0115      // Download the track log
 
 #define APRS_SERVICE_MAX_SETTING_DATA_LEN  255
 
+// largest chunk of a snapshot that is written at once (ATT MTU 247)
+#define APRS_SERVICE_MAX_RESTORE_CHUNK_LEN  244
+
+#define APRS_SERVICE_MAX_ADDRESSEE_LEN       9
+#define APRS_SERVICE_MAX_MESSAGE_TEXT_LEN   67
+
 // Forward declaration of the aprs_service_t type.
 typedef struct aprs_service_s aprs_service_t;
 
@@ -80,8 +94,23 @@ typedef enum {
 	APRS_SERVICE_EVT_SYMBOL_CHANGED,
 	APRS_SERVICE_EVT_SETTING_WRITE,
 	APRS_SERVICE_EVT_SETTING_SELECT,
+	APRS_SERVICE_EVT_TX_MESSAGE,
+	APRS_SERVICE_EVT_SETTINGS_RESTORE,
+	APRS_SERVICE_EVT_RX_ARCHIVE_REQUEST,
+	APRS_SERVICE_EVT_RX_ARCHIVE_CANCEL,
+	APRS_SERVICE_EVT_TRACK_EXPORT_REQUEST,
+	APRS_SERVICE_EVT_TRACK_EXPORT_CANCEL,
 } aprs_service_evt_type_t;
 
+/**@brief Status codes notified on the Settings Restore characteristic. */
+typedef enum {
+	APRS_SERVICE_RESTORE_STATUS_COMMITTED     = 0x00, /**< All settings were written. */
+	APRS_SERVICE_RESTORE_STATUS_INVALID_DATA  = 0x01, /**< The snapshot is malformed or corrupted. */
+	APRS_SERVICE_RESTORE_STATUS_INVALID_VALUE = 0x02, /**< A setting has an invalid value. */
+	APRS_SERVICE_RESTORE_STATUS_BUSY          = 0x03, /**< Another write is in progress. */
+	APRS_SERVICE_RESTORE_STATUS_FLASH_ERROR   = 0x04, /**< Writing to flash failed. */
+} aprs_service_restore_status_t;
+
 typedef struct {
 	aprs_service_evt_type_t type;
 
@@ -92,6 +121,31 @@ typedef struct {
 			uint16_t data_len;
 			uint8_t data[APRS_SERVICE_MAX_SETTING_DATA_LEN];
 		} setting;
+
+		/**@brief Used for TX Message events. */
+		struct {
+			char addressee[APRS_SERVICE_MAX_ADDRESSEE_LEN + 1];
+			char text[APRS_SERVICE_MAX_MESSAGE_TEXT_LEN + 1];
+		} tx_message;
+
+		/**@brief Used for Settings Restore events. */
+		struct {
+			const uint8_t *data;
+			uint16_t data_len;
+		} snapshot;
+
+		/**@brief Used for RX Archive Request events. */
+		struct {
+			uint32_t start_seq;
+			uint32_t count;      /**< Number of records; 0 means all. */
+		} rx_archive;
+
+		/**@brief Used for Track Export Request events. */
+		struct {
+			uint8_t  format;     /**< See track_export_format_t. */
+			uint32_t start_time; /**< First Unix timestamp to export. */
+			uint32_t end_time;   /**< Last Unix timestamp to export; 0 means no limit. */
+		} track_export;
 	} params;
 } aprs_service_evt_t;
 
@@ -116,10 +170,20 @@ struct aprs_service_s
 	ble_gatts_char_handles_t    comment_char_handles;         /**< Handles related to the Comment Characteristic. */
 	ble_gatts_char_handles_t    symbol_char_handles;          /**< Handles related to the Symbol Characteristic. */
 	ble_gatts_char_handles_t    rx_message_char_handles;      /**< Handles related to the RX Message Characteristic. */
+	ble_gatts_char_handles_t    tx_message_char_handles;      /**< Handles related to the TX Message Characteristic. */
+	ble_gatts_char_handles_t    energy_stats_char_handles;    /**< Handles related to the Energy Statistics Characteristic. */
 	ble_gatts_char_handles_t    settings_write_char_handles;  /**< Handles related to the Write/Select Settings Characteristic. */
 	ble_gatts_char_handles_t    settings_read_char_handles;   /**< Handles related to the Read Settings Characteristic. */
+	ble_gatts_char_handles_t    settings_snapshot_char_handles; /**< Handles related to the Settings Snapshot Characteristic. */
+	ble_gatts_char_handles_t    settings_restore_char_handles;  /**< Handles related to the Settings Restore Characteristic. */
+	ble_gatts_char_handles_t    rx_archive_char_handles;      /**< Handles related to the RX Archive Characteristic. */
+	ble_gatts_char_handles_t    track_export_char_handles;    /**< Handles related to the Track Export Characteristic. */
 	uint8_t                     uuid_type;                    /**< UUID type for the APRS Service. */
 	aprs_service_callback_t     callback;                     /**< Pointer to the callback function. */
+	uint16_t                    max_notify_len;               /**< Maximum notification length for the current ATT MTU. */
+	notify_queue_t              rx_queue;                     /**< Received messages waiting to be notified. */
+	uint8_t                     restore_buf[SETTINGS_TLV_MAX_LEN]; /**< Reassembly buffer for a written snapshot. */
+	uint16_t                    restore_len;                  /**< Number of bytes in restore_buf. */
 };
 
 
@@ -213,16 +277,56 @@ ret_code_t aprs_service_set_symbol(aprs_service_t * p_srv, char table, char symb
 ret_code_t aprs_service_get_symbol(aprs_service_t * p_srv, char *p_table, char *p_symbol);
 
 
+/**@brief Set the encoded energy statistics.
+ *
+ * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
+ * @param[in]  p_data      Pointer to the data generated by energy_encode_stats().
+ * @param[in]  data_len    Size of the data.
+ * @returns                The result code from the BLE stack.
+ */
+ret_code_t aprs_service_set_energy_stats(aprs_service_t * p_srv, const uint8_t *p_data, uint16_t data_len);
+
+
 /**@brief Set the received message and send a notification.
+ * @details
+ * While connected, the message is queued and the notification is sent from
+ * @ref aprs_service_send_rx_notifications(), which is requested via
+ * EVENT_BLE_RX_NOTIFY. This function may be called from interrupt context.
  *
  * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
  * @param[in]  p_message   Pointer to the message.
  * @param[in]  message_len Size of the message.
- * @returns                The result code from the BLE stack.
+ * @retval     NRF_ERROR_NO_MEM if the queue is full and the message was dropped.
+ * @returns                Otherwise, the result code from the BLE stack.
  */
 ret_code_t aprs_service_notify_rx_message(aprs_service_t * p_srv, uint16_t conn_handle, uint8_t *p_message, uint8_t message_len);
 
 
+/**@brief Send queued received messages as notifications.
+ * @details
+ * Sends notifications until the queue is empty or the SoftDevice cannot
+ * buffer more of them. In the latter case, the rest is sent after the next
+ * BLE_GATTS_EVT_HVN_TX_COMPLETE event. If notifications are not enabled, the
+ * characteristic value is set instead.
+ *
+ * With batching, several messages are packed into one notification, each
+ * preceded by a length byte.
+ *
+ * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
+ * @param[in]  conn_handle Handle of the current connection.
+ * @param[in]  batching    Whether to pack several messages into one notification.
+ */
+void aprs_service_send_rx_notifications(aprs_service_t * p_srv, uint16_t conn_handle, bool batching);
+
+
+/**@brief Set the ATT MTU of the current connection.
+ *
+ * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
+ * @param[in]  att_mtu     The effective ATT MTU.
+ */
+void aprs_service_set_att_mtu(aprs_service_t * p_srv, uint16_t att_mtu);
+
+
 /**@brief Set the read-setting characteristic and send a notification.
  *
  * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
@@ -236,6 +340,69 @@ ret_code_t aprs_service_notify_rx_message(aprs_service_t * p_srv, uint16_t conn_
 ret_code_t aprs_service_notify_setting(aprs_service_t * p_srv, uint16_t conn_handle, settings_id_t setting_id, bool success, const uint8_t *p_data, uint16_t data_len);
 
 
+/**@brief Set the settings snapshot characteristic.
+ *
+ * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
+ * @param[in]  p_data      Pointer to the snapshot from settings_export_snapshot().
+ * @param[in]  data_len    Length of the snapshot.
+ * @returns                The result code from the BLE stack.
+ */
+ret_code_t aprs_service_set_settings_snapshot(aprs_service_t * p_srv, const uint8_t *p_data, uint16_t data_len);
+
+
+/**@brief Report the result of a settings restore.
+ * @details
+ * The value consists of the status code and the ID of the rejected setting
+ * (0 if there is none).
+ *
+ * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
+ * @param[in]  conn_handle Connection handle to send the notification for.
+ * @param[in]  status      The result of the restore.
+ * @param[in]  setting_id  The setting with an invalid value.
+ * @returns                The result code from the BLE stack.
+ */
+ret_code_t aprs_service_notify_restore_status(aprs_service_t * p_srv, uint16_t conn_handle,
+		aprs_service_restore_status_t status, settings_id_t setting_id);
+
+
+/**@brief Set the range of the RX archive that is reported on read.
+ *
+ * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
+ * @param[in]  first_seq   Sequence number of the oldest archived packet.
+ * @param[in]  next_seq    Sequence number of the next packet to be archived.
+ * @returns                The result code from the BLE stack.
+ */
+ret_code_t aprs_service_set_rx_archive_info(aprs_service_t * p_srv, uint32_t first_seq, uint32_t next_seq);
+
+
+/**@brief Send a part of the RX archive download stream.
+ *
+ * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
+ * @param[in]  conn_handle Connection handle to send the notification for.
+ * @param[in]  p_data      Pointer to the data from rx_archive_read_stream().
+ * @param[in]  data_len    Length of the data, at most max_notify_len.
+ * @retval     NRF_ERROR_RESOURCES if the SoftDevice cannot buffer more
+ *             notifications. Retry after EVENT_BLE_ARCHIVE_NOTIFY.
+ * @returns                Otherwise, the result code from the BLE stack.
+ */
+ret_code_t aprs_service_notify_rx_archive(aprs_service_t * p_srv, uint16_t conn_handle,
+		const uint8_t *p_data, uint16_t data_len);
+
+
+/**@brief Send a part of the track export stream.
+ *
+ * @param[in]  p_srv       Service structure (as returned by aprs_service_init()).
+ * @param[in]  conn_handle Connection handle to send the notification for.
+ * @param[in]  p_data      Pointer to the data from track_export_read().
+ * @param[in]  data_len    Length of the data, at most max_notify_len.
+ * @retval     NRF_ERROR_RESOURCES if the SoftDevice cannot buffer more
+ *             notifications. Retry after EVENT_BLE_TRACK_NOTIFY.
+ * @returns                Otherwise, the result code from the BLE stack.
+ */
+ret_code_t aprs_service_notify_track_export(aprs_service_t * p_srv, uint16_t conn_handle,
+		const uint8_t *p_data, uint16_t data_len);
+
+
 #ifdef __cplusplus
 }
 #endif
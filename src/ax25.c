@@ -0,0 +1,357 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "ax25.h"
+
+#define ADDR_LEN        7
+#define CALL_LEN        6
+
+#define CONTROL_UI      0x03
+#define PID_NO_LAYER3   0xF0
+
+#define SSID_RESERVED   0x60  // reserved bits, always 1
+#define SSID_CH_BIT     0x80  // command bit (destination) or has-been-repeated bit (digipeaters)
+#define SSID_EXT_BIT    0x01  // set on the last address
+
+static bool is_call_char(uint8_t c)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+
+/**@brief Encode one address from TNC2 notation (CALL[-SSID][*]).
+ *
+ * @returns  False if the address is invalid.
+ */
+static bool encode_address(const uint8_t *text, size_t len, uint8_t *out, bool *repeated)
+{
+	*repeated = false;
+
+	if(len > 0 && text[len - 1] == '*') {
+		*repeated = true;
+		len--;
+	}
+
+	size_t call_len = 0;
+
+	while(call_len < len && text[call_len] != '-') {
+		call_len++;
+	}
+
+	if(call_len == 0 || call_len > CALL_LEN) {
+		return false;
+	}
+
+	uint8_t ssid = 0;
+
+	if(call_len < len) {
+		// SSID: 1 or 2 digits after '-'
+		size_t ssid_len = len - call_len - 1;
+
+		if(ssid_len == 0 || ssid_len > 2) {
+			return false;
+		}
+
+		for(size_t i = call_len + 1; i < len; i++) {
+			if(text[i] < '0' || text[i] > '9') {
+				return false;
+			}
+
+			ssid = ssid * 10 + (text[i] - '0');
+		}
+
+		if(ssid > 15) {
+			return false;
+		}
+	}
+
+	for(size_t i = 0; i < CALL_LEN; i++) {
+		uint8_t c = ' ';
+
+		if(i < call_len) {
+			c = text[i];
+
+			if(!is_call_char(c)) {
+				return false;
+			}
+		}
+
+		out[i] = c << 1;
+	}
+
+	out[CALL_LEN] = SSID_RESERVED | (ssid << 1);
+
+	return true;
+}
+
+
+size_t ax25_from_tnc2(const uint8_t *tnc2, size_t len, uint8_t *out, size_t out_size)
+{
+	const uint8_t *info = memchr(tnc2, ':', len);
+
+	if(!info) {
+		return 0;
+	}
+
+	size_t header_len = info - tnc2;
+	size_t info_len = len - header_len - 1;
+	info++;
+
+	if(info_len > AX25_MAX_INFO_LEN) {
+		return 0;
+	}
+
+	// split the header into source, destination and digipeaters
+	const uint8_t *gt = memchr(tnc2, '>', header_len);
+
+	if(!gt) {
+		return 0;
+	}
+
+	uint8_t *p = out;
+	uint8_t naddr = 0;
+	size_t last_repeated = 0; // number of digipeaters up to the last one marked with '*'
+	bool repeated;
+
+	const uint8_t *field = gt + 1;
+	const uint8_t *header_end = tnc2 + header_len;
+
+	// source address goes second, so skip its slot for now
+	if(out_size < 2 * ADDR_LEN) {
+		return 0;
+	}
+
+	p += 2 * ADDR_LEN;
+
+	while(field <= header_end) {
+		const uint8_t *comma = memchr(field, ',', header_end - field);
+		const uint8_t *field_end = comma ? comma : header_end;
+
+		if(naddr == 0) {
+			// destination
+			if(!encode_address(field, field_end - field, out, &repeated) || repeated) {
+				return 0;
+			}
+
+			out[CALL_LEN] |= SSID_CH_BIT; // command frame
+		} else {
+			if(naddr > AX25_MAX_DIGIS || (size_t)(p - out) + ADDR_LEN > out_size) {
+				return 0;
+			}
+
+			if(!encode_address(field, field_end - field, p, &repeated)) {
+				return 0;
+			}
+
+			if(repeated) {
+				last_repeated = naddr;
+			}
+
+			p += ADDR_LEN;
+		}
+
+		naddr++;
+
+		if(!comma) {
+			break;
+		}
+
+		field = comma + 1;
+	}
+
+	if(!encode_address(tnc2, gt - tnc2, out + ADDR_LEN, &repeated) || repeated) {
+		return 0;
+	}
+
+	// has-been-repeated bits of all digipeaters up to the marked one
+	for(size_t i = 0; i < last_repeated; i++) {
+		out[(2 + i) * ADDR_LEN + CALL_LEN] |= SSID_CH_BIT;
+	}
+
+	*(p - 1) |= SSID_EXT_BIT;
+
+	if((size_t)(p - out) + 2 + info_len > out_size) {
+		return 0;
+	}
+
+	*(p++) = CONTROL_UI;
+	*(p++) = PID_NO_LAYER3;
+
+	memcpy(p, info, info_len);
+	p += info_len;
+
+	return p - out;
+}
+
+
+/**@brief Decode one address to TNC2 notation (without the '*').
+ *
+ * @returns  The length of the text, 0 if the address is invalid or does not fit.
+ */
+static size_t decode_address(const uint8_t *addr, uint8_t *out, size_t out_size)
+{
+	uint8_t text[CALL_LEN + 3];
+	size_t n = 0;
+
+	for(size_t i = 0; i < CALL_LEN; i++) {
+		uint8_t c = addr[i] >> 1;
+
+		if(addr[i] & 0x01) {
+			return 0;
+		}
+
+		if(c == ' ') {
+			break;
+		}
+
+		if(!is_call_char(c)) {
+			return 0;
+		}
+
+		text[n++] = c;
+	}
+
+	if(n == 0) {
+		return 0;
+	}
+
+	uint8_t ssid = (addr[CALL_LEN] >> 1) & 0x0F;
+
+	if(ssid > 0) {
+		text[n++] = '-';
+
+		if(ssid >= 10) {
+			text[n++] = '1';
+		}
+
+		text[n++] = '0' + ssid % 10;
+	}
+
+	if(n > out_size) {
+		return 0;
+	}
+
+	memcpy(out, text, n);
+	return n;
+}
+
+
+size_t ax25_to_tnc2(const uint8_t *frame, size_t len, uint8_t *out, size_t out_size)
+{
+	// find the end of the address field
+	size_t naddr = 0;
+
+	do {
+		if((naddr + 1) * ADDR_LEN > len || naddr >= 2 + AX25_MAX_DIGIS) {
+			return 0;
+		}
+
+		naddr++;
+	} while(!(frame[naddr * ADDR_LEN - 1] & SSID_EXT_BIT));
+
+	if(naddr < 2) {
+		return 0;
+	}
+
+	size_t pos = naddr * ADDR_LEN;
+
+	if(pos + 2 > len || frame[pos] != CONTROL_UI || frame[pos + 1] != PID_NO_LAYER3) {
+		return 0;
+	}
+
+	pos += 2;
+
+	const uint8_t *info = frame + pos;
+	size_t info_len = len - pos;
+
+	// the last digipeater with the has-been-repeated bit gets the '*' (0: none)
+	size_t last_repeated = 0;
+
+	for(size_t i = 2; i < naddr; i++) {
+		if(frame[i * ADDR_LEN + CALL_LEN] & SSID_CH_BIT) {
+			last_repeated = i;
+		}
+	}
+
+	uint8_t *p = out;
+	uint8_t *end = out + out_size;
+	size_t n;
+
+	// source
+	if((n = decode_address(frame + ADDR_LEN, p, end - p)) == 0) {
+		return 0;
+	}
+
+	p += n;
+
+	if(p >= end) {
+		return 0;
+	}
+
+	*(p++) = '>';
+
+	// destination and digipeaters
+	for(size_t i = 0; i < naddr; i++) {
+		if(i == 1) {
+			continue;
+		}
+
+		if(i > 1) {
+			if(p >= end) {
+				return 0;
+			}
+
+			*(p++) = ',';
+		}
+
+		if((n = decode_address(frame + i * ADDR_LEN, p, end - p)) == 0) {
+			return 0;
+		}
+
+		p += n;
+
+		if(last_repeated > 0 && i == last_repeated) {
+			if(p >= end) {
+				return 0;
+			}
+
+			*(p++) = '*';
+		}
+	}
+
+	if((size_t)(end - p) < 1 + info_len) {
+		return 0;
+	}
+
+	*(p++) = ':';
+
+	memcpy(p, info, info_len);
+	p += info_len;
+
+	return p - out;
+}
@@ -0,0 +1,77 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef AX25_H
+#define AX25_H
+
+/**@file
+ *
+ * @brief Conversion between TNC2 text frames and binary AX.25 UI frames.
+ *
+ * @details
+ * LoRa-APRS transmits frames in the TNC2 text format, for example
+ * "DE0ABC-7>APLETK,WIDE1-1:!...". Applications that talk to a KISS TNC expect
+ * binary AX.25 frames (without FCS) instead. Only UI frames with PID 0xF0 are
+ * supported, which is what APRS uses.
+ *
+ * In TNC2 format, the last digipeater that has repeated the frame is marked
+ * with a '*'. In AX.25, the has-been-repeated bit is set on that digipeater
+ * and all digipeaters before it.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AX25_MAX_DIGIS      8
+#define AX25_MAX_INFO_LEN   256
+
+// addresses, control field, PID and information field
+#define AX25_MAX_FRAME_LEN  ((2 + AX25_MAX_DIGIS) * 7 + 2 + AX25_MAX_INFO_LEN)
+
+/**@brief Convert a TNC2 text frame to an AX.25 UI frame.
+ *
+ * @param tnc2       The text frame (not necessarily null-terminated).
+ * @param len        The length of the text frame.
+ * @param out        Buffer for the AX.25 frame.
+ * @param out_size   Size of the buffer.
+ * @returns          The length of the AX.25 frame, or 0 if the text frame is
+ *                   invalid or does not fit into the buffer.
+ */
+size_t ax25_from_tnc2(const uint8_t *tnc2, size_t len, uint8_t *out, size_t out_size);
+
+/**@brief Convert an AX.25 UI frame to a TNC2 text frame.
+ * @details
+ * The result is not null-terminated.
+ *
+ * @param frame      The AX.25 frame without FCS.
+ * @param len        The length of the AX.25 frame.
+ * @param out        Buffer for the text frame.
+ * @param out_size   Size of the buffer.
+ * @returns          The length of the text frame, or 0 if the AX.25 frame is
+ *                   invalid, not a UI frame or does not fit into the buffer.
+ */
+size_t ax25_to_tnc2(const uint8_t *frame, size_t len, uint8_t *out, size_t out_size);
+
+#endif // AX25_H
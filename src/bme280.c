@@ -34,6 +34,7 @@ NRF_LOG_MODULE_REGISTER();
 #include "bme280_comp.h"
 #include "pinout.h"
 #include "periph_pwr.h"
+#include "event_queue.h"
 
 #include "bme280.h"
 
@@ -197,6 +198,7 @@ static ret_code_t handle_completed_transfer(const nrfx_twim_xfer_desc_t *transfe
 			if(m_twi_rx_buf[0] != 0x60) {
 				m_state = BME280_STATE_NOT_PRESENT;
 				m_shutdown_needed = true;
+				event_queue_post(EVENT_BME280_SHUTDOWN);
 				m_callback(BME280_EVT_INIT_NOT_PRESENT);
 			} else {
 				m_state = BME280_STATE_READ_CAL1;
@@ -236,6 +238,7 @@ static ret_code_t handle_completed_transfer(const nrfx_twim_xfer_desc_t *transfe
 
 			m_state = BME280_STATE_INITIALIZED;
 			m_shutdown_needed = true;
+			event_queue_post(EVENT_BME280_SHUTDOWN);
 			m_callback(BME280_EVT_INIT_DONE);
 			break;
 
@@ -256,6 +259,7 @@ static ret_code_t handle_completed_transfer(const nrfx_twim_xfer_desc_t *transfe
 
 		case BME280_STATE_READOUT:
 			m_shutdown_needed = true;
+			event_queue_post(EVENT_BME280_SHUTDOWN);
 
 			{ // convert the readings
 				int32_t press_raw =
@@ -283,6 +287,7 @@ static ret_code_t handle_completed_transfer(const nrfx_twim_xfer_desc_t *transfe
 
 		default:
 			m_shutdown_needed = true;
+			event_queue_post(EVENT_BME280_SHUTDOWN);
 			return NRF_ERROR_INVALID_STATE;
 	}
 
@@ -298,6 +303,7 @@ static void cb_twim(nrfx_twim_evt_t const * p_event, void * p_context)
 		case NRFX_TWIM_EVT_ADDRESS_NACK:
 			m_state = BME280_STATE_NOT_PRESENT;
 			m_shutdown_needed = true;
+			event_queue_post(EVENT_BME280_SHUTDOWN);
 			m_callback(BME280_EVT_INIT_NOT_PRESENT);
 			break;
 
@@ -306,6 +312,7 @@ static void cb_twim(nrfx_twim_evt_t const * p_event, void * p_context)
 		case NRFX_TWIM_EVT_BUS_ERROR:
 			m_state = BME280_STATE_COMMUNICATION_ERROR;
 			m_shutdown_needed = true;
+			event_queue_post(EVENT_BME280_SHUTDOWN);
 			m_callback(BME280_EVT_COMMUNICATION_ERROR);
 			break;
 
@@ -339,6 +346,24 @@ static ret_code_t setup_twim(void)
 }
 
 
+static void handle_shutdown(void)
+{
+	if(m_shutdown_needed) {
+		m_shutdown_needed = false;
+
+		NRF_LOG_DEBUG("shutdown");
+
+		nrfx_twim_disable(&m_twim);
+		nrfx_twim_uninit(&m_twim);
+
+		nrf_gpio_cfg_default(PIN_BME280_SCL);
+		nrf_gpio_cfg_default(PIN_BME280_SDA);
+
+		periph_pwr_stop_activity(PERIPH_PWR_FLAG_BME280);
+	}
+}
+
+
 ret_code_t bme280_init(bme280_callback_t callback)
 {
 	ret_code_t err_code;
@@ -347,6 +372,8 @@ ret_code_t bme280_init(bme280_callback_t callback)
 
 	m_shutdown_needed = false;
 
+	event_queue_register(EVENT_BME280_SHUTDOWN, handle_shutdown);
+
 	err_code = app_timer_create(&m_delay_timer, APP_TIMER_MODE_SINGLE_SHOT, cb_delay_timer);
 	VERIFY_SUCCESS(err_code);
 
@@ -395,24 +422,6 @@ bool bme280_is_ready(void)
 }
 
 
-void bme280_loop(void)
-{
-	if(m_shutdown_needed) {
-		m_shutdown_needed = false;
-
-		NRF_LOG_DEBUG("shutdown");
-
-		nrfx_twim_disable(&m_twim);
-		nrfx_twim_uninit(&m_twim);
-
-		nrf_gpio_cfg_default(PIN_BME280_SCL);
-		nrf_gpio_cfg_default(PIN_BME280_SDA);
-
-		periph_pwr_stop_activity(PERIPH_PWR_FLAG_BME280);
-	}
-}
-
-
 float bme280_get_temperature(void)
 {
 	return m_temperature;
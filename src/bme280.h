@@ -57,6 +57,4 @@ float bme280_get_temperature(void);
 float bme280_get_humidity(void);
 float bme280_get_pressure(void);
 
-void bme280_loop(void);
-
 #endif // BME280_H
@@ -0,0 +1,173 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "conn_policy.h"
+
+static bool                m_connected;
+static conn_policy_mode_t  m_requested;          // mode of the last accepted request
+static bool                m_phy_requested;
+static uint64_t            m_bulk_until;
+static uint64_t            m_next_request_time;
+
+static conn_policy_stats_t m_stats;
+
+void conn_policy_init(void)
+{
+	conn_policy_handle_disconnected();
+
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+void conn_policy_handle_connected(uint64_t now)
+{
+	m_connected = true;
+	m_requested = CONN_POLICY_MODE_NONE;
+	m_phy_requested = false;
+	m_bulk_until = now + CONN_POLICY_CONNECT_BULK_MS;
+	m_next_request_time = now;
+
+	m_stats.bulk_periods++;
+}
+
+
+void conn_policy_handle_disconnected(void)
+{
+	m_connected = false;
+	m_requested = CONN_POLICY_MODE_NONE;
+	m_phy_requested = false;
+	m_bulk_until = 0;
+	m_next_request_time = 0;
+}
+
+
+bool conn_policy_is_connected(void)
+{
+	return m_connected;
+}
+
+
+void conn_policy_handle_activity(uint64_t now)
+{
+	if(!m_connected) {
+		return;
+	}
+
+	if(now >= m_bulk_until) {
+		m_stats.bulk_periods++;
+	}
+
+	if(now + CONN_POLICY_BULK_HOLDOFF_MS > m_bulk_until) {
+		m_bulk_until = now + CONN_POLICY_BULK_HOLDOFF_MS;
+	}
+}
+
+
+conn_policy_mode_t conn_policy_get_target_mode(uint64_t now)
+{
+	if(!m_connected) {
+		return CONN_POLICY_MODE_NONE;
+	}
+
+	return (now < m_bulk_until) ? CONN_POLICY_MODE_BULK : CONN_POLICY_MODE_IDLE;
+}
+
+
+bool conn_policy_poll(uint64_t now, conn_policy_action_t *action)
+{
+	conn_policy_mode_t target = conn_policy_get_target_mode(now);
+
+	if(target == CONN_POLICY_MODE_NONE || target == m_requested || now < m_next_request_time) {
+		return false;
+	}
+
+	action->mode = target;
+
+	// the PHY is kept for the rest of the connection: it also shortens the
+	// radio-on time of the idle connection events
+	action->request_2m_phy = (target == CONN_POLICY_MODE_BULK) && !m_phy_requested;
+
+	return true;
+}
+
+
+void conn_policy_handle_request_result(uint64_t now, const conn_policy_action_t *action, bool accepted)
+{
+	if(!accepted) {
+		m_next_request_time = now + CONN_POLICY_RETRY_MS;
+		return;
+	}
+
+	m_requested = action->mode;
+	m_next_request_time = now + CONN_POLICY_MIN_UPDATE_INTERVAL_MS;
+
+	if(action->request_2m_phy) {
+		m_phy_requested = true;
+	}
+
+	m_stats.updates++;
+}
+
+
+void conn_policy_handle_rejected(void)
+{
+	// m_requested is kept, so the request is not repeated until the target
+	// mode changes
+	m_stats.rejected++;
+}
+
+
+uint64_t conn_policy_get_next_time(uint64_t now)
+{
+	if(!m_connected) {
+		return CONN_POLICY_NEVER;
+	}
+
+	uint64_t next = CONN_POLICY_NEVER;
+
+	// end of bulk mode
+	if(m_bulk_until > now) {
+		next = m_bulk_until;
+	}
+
+	// pending or postponed request
+	if(conn_policy_get_target_mode(now) != m_requested) {
+		uint64_t request_time = (m_next_request_time > now) ? m_next_request_time : now;
+
+		if(request_time < next) {
+			next = request_time;
+		}
+	}
+
+	return next;
+}
+
+
+void conn_policy_get_stats(conn_policy_stats_t *stats)
+{
+	*stats = m_stats;
+}
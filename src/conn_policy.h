@@ -0,0 +1,154 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef CONN_POLICY_H
+#define CONN_POLICY_H
+
+/**@file
+ *
+ * @brief Selection of the BLE connection parameters depending on the activity.
+ *
+ * @details
+ * While the connection is idle, long connection intervals with slave latency
+ * are requested, so the radio only wakes up every few seconds. During bulk
+ * transfers (service discovery, settings dump, bursts of notifications and
+ * writes), a short interval and the 2M PHY are requested. The connection
+ * falls back to the idle parameters after a quiet period.
+ *
+ * This module only makes the decisions. The caller requests the parameters
+ * from the BLE stack and reports the result.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// idle parameters: the radio wakes up every 2 to 2.5 seconds if there is
+// nothing to send
+#define CONN_POLICY_IDLE_MIN_INTERVAL_MS   400
+#define CONN_POLICY_IDLE_MAX_INTERVAL_MS   500
+#define CONN_POLICY_IDLE_SLAVE_LATENCY       4
+#define CONN_POLICY_IDLE_SUP_TIMEOUT_MS   6000
+
+// bulk transfer parameters. 15 ms is the shortest interval iOS accepts.
+#define CONN_POLICY_BULK_MIN_INTERVAL_MS    15
+#define CONN_POLICY_BULK_MAX_INTERVAL_MS    30
+#define CONN_POLICY_BULK_SLAVE_LATENCY       0
+#define CONN_POLICY_BULK_SUP_TIMEOUT_MS   4000
+
+// bulk mode after connecting, while the client discovers the services
+#define CONN_POLICY_CONNECT_BULK_MS      10000 // milliseconds
+
+// bulk mode is left after this time without activity
+#define CONN_POLICY_BULK_HOLDOFF_MS       3000 // milliseconds
+
+// minimum time between two parameter update requests
+#define CONN_POLICY_MIN_UPDATE_INTERVAL_MS  1000 // milliseconds
+
+// time to wait before retrying a request that the BLE stack did not accept
+#define CONN_POLICY_RETRY_MS               500 // milliseconds
+
+// returned if no update is pending
+#define CONN_POLICY_NEVER  UINT64_MAX
+
+typedef enum {
+	CONN_POLICY_MODE_NONE,   //!< Not connected or no parameters requested yet.
+	CONN_POLICY_MODE_IDLE,
+	CONN_POLICY_MODE_BULK,
+} conn_policy_mode_t;
+
+typedef struct {
+	conn_policy_mode_t mode;        //!< Parameters to request.
+	bool               request_2m_phy; //!< Also switch to the 2M PHY.
+} conn_policy_action_t;
+
+typedef struct {
+	uint32_t bulk_periods;   //!< Number of times bulk mode was entered.
+	uint32_t updates;        //!< Parameter update requests passed to the BLE stack.
+	uint32_t rejected;       //!< Parameter sets the client did not accept.
+} conn_policy_stats_t;
+
+/**@brief Reset the state and the statistics.
+ */
+void conn_policy_init(void);
+
+/**@brief Notify the policy about a new connection.
+ * @details
+ * Bulk mode is entered for @ref CONN_POLICY_CONNECT_BULK_MS.
+ */
+void conn_policy_handle_connected(uint64_t now);
+
+/**@brief Notify the policy that the connection was closed.
+ */
+void conn_policy_handle_disconnected(void);
+
+/**@brief Check whether a connection is active.
+ */
+bool conn_policy_is_connected(void);
+
+/**@brief Notify the policy about a bulk transfer.
+ * @details
+ * Bulk mode is entered or extended until @ref CONN_POLICY_BULK_HOLDOFF_MS
+ * after this call.
+ */
+void conn_policy_handle_activity(uint64_t now);
+
+/**@brief Get the mode the connection should be in.
+ */
+conn_policy_mode_t conn_policy_get_target_mode(uint64_t now);
+
+/**@brief Check whether parameters should be requested now.
+ * @details
+ * If this returns true, the caller must request the parameters of the
+ * returned mode and report the result with @ref conn_policy_handle_request_result().
+ *
+ * @param now      The current time.
+ * @param action   Set to the parameters to request.
+ * @returns        True if a request should be made now.
+ */
+bool conn_policy_poll(uint64_t now, conn_policy_action_t *action);
+
+/**@brief Report whether the BLE stack accepted a request from @ref conn_policy_poll().
+ * @details
+ * Requests that were not accepted (e.g. because another procedure is still
+ * running) are retried after @ref CONN_POLICY_RETRY_MS.
+ */
+void conn_policy_handle_request_result(uint64_t now, const conn_policy_action_t *action, bool accepted);
+
+/**@brief Notify the policy that the client rejected the requested parameters.
+ * @details
+ * The current parameters are kept until the target mode changes again.
+ */
+void conn_policy_handle_rejected(void);
+
+/**@brief Get the time when @ref conn_policy_poll() should be called next.
+ * @returns   The time or @ref CONN_POLICY_NEVER if only new events can cause a request.
+ */
+uint64_t conn_policy_get_next_time(uint64_t now);
+
+/**@brief Get the statistics since @ref conn_policy_init().
+ */
+void conn_policy_get_stats(conn_policy_stats_t *stats);
+
+#endif // CONN_POLICY_H
@@ -0,0 +1,318 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "airtime.h"
+#include "dupe_cache.h"
+
+#include "digipeater.h"
+
+typedef struct
+{
+	uint8_t  data[DIGIPEATER_MAX_FRAME_LEN];
+	uint8_t  len;
+	uint32_t hash;
+	uint64_t due;
+	bool     valid;
+} digipeater_entry_t;
+
+typedef struct
+{
+	const uint8_t *start;
+	size_t         len;
+	bool           used;
+} path_element_t;
+
+static digipeater_entry_t m_queue[DIGIPEATER_QUEUE_SIZE];
+
+static digipeater_stats_t m_stats;
+
+
+/**@brief Check whether a (path) element matches a string exactly.
+ */
+static bool element_equals(const uint8_t *start, size_t len, const char *str)
+{
+	return (strlen(str) == len) && (memcmp(start, str, len) == 0);
+}
+
+
+/**@brief Append data to the output frame.
+ * @returns  False if the frame would become too long.
+ */
+static bool append(uint8_t *out, size_t *out_len, const void *data, size_t len)
+{
+	if(*out_len + len > DIGIPEATER_MAX_FRAME_LEN) {
+		return false;
+	}
+
+	memcpy(out + *out_len, data, len);
+	*out_len += len;
+	return true;
+}
+
+
+/**@brief Check whether the path of a frame contains a used element.
+ */
+static bool frame_was_digipeated(const uint8_t *frame, size_t len)
+{
+	const uint8_t *dest = memchr(frame, '>', len);
+	if(!dest) {
+		return false;
+	}
+
+	const uint8_t *info = memchr(dest, ':', len - (dest - frame));
+	if(!info) {
+		return false;
+	}
+
+	return memchr(dest, '*', info - dest) != NULL;
+}
+
+
+void digipeater_init(void)
+{
+	memset(m_queue, 0, sizeof(m_queue));
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+size_t digipeater_rewrite_path(const uint8_t *frame, size_t len, const char *mycall, uint8_t *out)
+{
+	path_element_t path[DIGIPEATER_MAX_PATH_LEN];
+	uint8_t n_path = 0;
+	int last_used = -1;
+
+	// only LoRa-APRS frames are repeated
+	if(len <= 3 || frame[0] != '<' || frame[1] != 0xFF || frame[2] != 0x01) {
+		return 0;
+	}
+
+	const uint8_t *body = frame + 3;
+	size_t body_len = len - 3;
+
+	const uint8_t *src_end = memchr(body, '>', body_len);
+	if(!src_end) {
+		return 0;
+	}
+
+	const uint8_t *info = memchr(src_end, ':', body_len - (src_end - body));
+	if(!info) {
+		return 0;
+	}
+
+	// never repeat own frames
+	if(element_equals(body, src_end - body, mycall)) {
+		return 0;
+	}
+
+	// split destination and path
+	const uint8_t *dest = src_end + 1;
+	const uint8_t *dest_end = memchr(dest, ',', info - dest);
+
+	if(!dest_end) {
+		return 0; // no path at all
+	}
+
+	const uint8_t *p = dest_end + 1;
+
+	while(p <= info) {
+		const uint8_t *elem_end = memchr(p, ',', info - p);
+		if(!elem_end) {
+			elem_end = info;
+		}
+
+		if(n_path == DIGIPEATER_MAX_PATH_LEN || elem_end == p) {
+			return 0; // too many or empty path elements
+		}
+
+		path_element_t *elem = &path[n_path];
+
+		elem->start = p;
+		elem->len = elem_end - p;
+		elem->used = (p[elem->len - 1] == '*');
+
+		if(elem->used) {
+			elem->len--;
+			last_used = n_path;
+		}
+
+		n_path++;
+		p = elem_end + 1;
+	}
+
+	// In TNC2 notation, only the last used element is marked, but all
+	// elements before it were used as well.
+	for(int i = 0; i <= last_used; i++) {
+		if(element_equals(path[i].start, path[i].len, mycall)) {
+			return 0; // already repeated by us
+		}
+	}
+
+	int next = last_used + 1;
+
+	if(next >= n_path) {
+		return 0; // all hops used
+	}
+
+	if(!element_equals(path[next].start, path[next].len, "WIDE1-1")
+			&& !element_equals(path[next].start, path[next].len, mycall)) {
+		return 0; // not a request for a fill-in digipeater
+	}
+
+	// build the new frame
+	size_t out_len = 0;
+
+	if(!append(out, &out_len, frame, dest_end - frame)) {
+		return 0;
+	}
+
+	for(int i = 0; i < n_path; i++) {
+		bool ok = append(out, &out_len, ",", 1);
+
+		if(i == next) {
+			ok = ok && append(out, &out_len, mycall, strlen(mycall))
+				&& append(out, &out_len, "*", 1);
+		} else {
+			ok = ok && append(out, &out_len, path[i].start, path[i].len);
+		}
+
+		if(!ok) {
+			return 0;
+		}
+	}
+
+	if(!append(out, &out_len, info, len - (info - frame))) {
+		return 0;
+	}
+
+	return out_len;
+}
+
+
+bool digipeater_handle_rx(const uint8_t *frame, size_t len, const char *mycall, uint64_t now, uint32_t random)
+{
+	uint8_t repeated[DIGIPEATER_MAX_FRAME_LEN];
+
+	size_t repeated_len = digipeater_rewrite_path(frame, len, mycall, repeated);
+
+	if(repeated_len == 0) {
+		return false;
+	}
+
+	for(uint8_t i = 0; i < DIGIPEATER_QUEUE_SIZE; i++) {
+		digipeater_entry_t *entry = &m_queue[i];
+
+		if(entry->valid) {
+			continue;
+		}
+
+		memcpy(entry->data, repeated, repeated_len);
+		entry->len = repeated_len;
+		entry->hash = dupe_cache_calc_hash(frame, len);
+		entry->due = now + DIGIPEATER_HOLDOFF_MIN_MS
+			+ random % (DIGIPEATER_HOLDOFF_MAX_MS - DIGIPEATER_HOLDOFF_MIN_MS + 1);
+		entry->valid = true;
+
+		m_stats.queued++;
+		return true;
+	}
+
+	m_stats.dropped_queue_full++;
+	return false;
+}
+
+
+void digipeater_handle_duplicate(const uint8_t *frame, size_t len)
+{
+	if(!frame_was_digipeated(frame, len)) {
+		return;
+	}
+
+	uint32_t hash = dupe_cache_calc_hash(frame, len);
+
+	for(uint8_t i = 0; i < DIGIPEATER_QUEUE_SIZE; i++) {
+		digipeater_entry_t *entry = &m_queue[i];
+
+		if(entry->valid && entry->hash == hash) {
+			entry->valid = false;
+			m_stats.cancelled++;
+		}
+	}
+}
+
+
+uint64_t digipeater_get_next_due_time(void)
+{
+	uint64_t next = DIGIPEATER_NO_FRAME;
+
+	for(uint8_t i = 0; i < DIGIPEATER_QUEUE_SIZE; i++) {
+		if(m_queue[i].valid && m_queue[i].due < next) {
+			next = m_queue[i].due;
+		}
+	}
+
+	return next;
+}
+
+
+bool digipeater_get_due_frame(uint64_t now, uint8_t *frame, uint8_t *len)
+{
+	for(;;) {
+		digipeater_entry_t *oldest = NULL;
+
+		for(uint8_t i = 0; i < DIGIPEATER_QUEUE_SIZE; i++) {
+			digipeater_entry_t *entry = &m_queue[i];
+
+			if(entry->valid && entry->due <= now
+					&& (!oldest || entry->due < oldest->due)) {
+				oldest = entry;
+			}
+		}
+
+		if(!oldest) {
+			return false;
+		}
+
+		oldest->valid = false;
+
+		if(!airtime_is_available(now, (uint32_t)airtime_calc_toa_ms(oldest->len))) {
+			m_stats.dropped_airtime++;
+			continue;
+		}
+
+		memcpy(frame, oldest->data, oldest->len);
+		*len = oldest->len;
+
+		m_stats.repeated++;
+		return true;
+	}
+}
+
+
+const digipeater_stats_t* digipeater_get_stats(void)
+{
+	return &m_stats;
+}
@@ -0,0 +1,135 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef DIGIPEATER_H
+#define DIGIPEATER_H
+
+/**@file
+ *
+ * @brief Fill-in digipeater.
+ *
+ * @details
+ * Received frames that request the first hop via `WIDE1-1` or via the own call
+ * sign are repeated with the path element replaced by the own call sign,
+ * marked as used (`WIDE1-1` → `MYCALL*`).
+ *
+ * Repeated frames are not sent immediately, but after a random holdoff time.
+ * If another digipeater repeats the frame during that time, the pending
+ * transmission is cancelled. Frames that would exceed the airtime budget
+ * (see airtime.h) are dropped.
+ *
+ * This module expects that received frames are checked with the duplicate
+ * cache (see dupe_cache.h) first: new frames are passed to @ref
+ * digipeater_handle_rx(), duplicates to @ref digipeater_handle_duplicate().
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// number of frames that can wait for retransmission
+#define DIGIPEATER_QUEUE_SIZE          4
+
+// random holdoff before a frame is repeated
+#define DIGIPEATER_HOLDOFF_MIN_MS   1000 // milliseconds
+#define DIGIPEATER_HOLDOFF_MAX_MS   5000 // milliseconds
+
+// maximum length of a repeated frame (limited by the LoRa packet size)
+#define DIGIPEATER_MAX_FRAME_LEN     255
+
+// maximum number of path elements that are handled
+#define DIGIPEATER_MAX_PATH_LEN        8
+
+// returned by @ref digipeater_get_next_due_time() if the queue is empty
+#define DIGIPEATER_NO_FRAME   UINT64_MAX
+
+typedef struct
+{
+	uint32_t queued;             //!< Frames accepted for retransmission
+	uint32_t repeated;           //!< Frames handed out for transmission
+	uint32_t cancelled;          //!< Frames repeated by another digipeater first
+	uint32_t dropped_queue_full; //!< Frames dropped because the queue was full
+	uint32_t dropped_airtime;    //!< Frames dropped because the airtime budget was exhausted
+} digipeater_stats_t;
+
+/**@brief Clear the queue and the statistics.
+ */
+void digipeater_init(void);
+
+/**@brief Build the frame to repeat.
+ *
+ * @param frame       The received frame, including the LoRa-APRS header.
+ * @param len         Length of the received frame.
+ * @param mycall      The own call sign.
+ * @param[out] out    Buffer for the repeated frame. Must hold @ref DIGIPEATER_MAX_FRAME_LEN bytes.
+ * @returns           The length of the repeated frame or 0 if the frame shall not be repeated.
+ */
+size_t digipeater_rewrite_path(const uint8_t *frame, size_t len, const char *mycall, uint8_t *out);
+
+/**@brief Handle a newly received frame.
+ * @details
+ * If the frame shall be repeated, it is queued with a holdoff time between
+ * @ref DIGIPEATER_HOLDOFF_MIN_MS and @ref DIGIPEATER_HOLDOFF_MAX_MS.
+ *
+ * @param frame    The received frame, including the LoRa-APRS header.
+ * @param len      Length of the received frame.
+ * @param mycall   The own call sign.
+ * @param now      The current time in milliseconds.
+ * @param random   A random number to select the holdoff time.
+ * @returns        True if the frame was queued.
+ */
+bool digipeater_handle_rx(const uint8_t *frame, size_t len, const char *mycall, uint64_t now, uint32_t random);
+
+/**@brief Handle a received duplicate of an earlier frame.
+ * @details
+ * If the duplicate was already repeated by another digipeater, a pending
+ * retransmission of the same frame is cancelled.
+ *
+ * @param frame    The received frame, including the LoRa-APRS header.
+ * @param len      Length of the received frame.
+ */
+void digipeater_handle_duplicate(const uint8_t *frame, size_t len);
+
+/**@brief Get the time when the next queued frame is due.
+ * @returns  The time in milliseconds or @ref DIGIPEATER_NO_FRAME if the queue is empty.
+ */
+uint64_t digipeater_get_next_due_time(void);
+
+/**@brief Take the next due frame from the queue.
+ * @details
+ * Due frames that do not fit into the airtime budget are dropped.
+ *
+ * @param now          The current time in milliseconds.
+ * @param[out] frame   Buffer for the frame. Must hold @ref DIGIPEATER_MAX_FRAME_LEN bytes.
+ * @param[out] len     Length of the frame.
+ * @returns            True if a frame shall be transmitted now.
+ */
+bool digipeater_get_due_frame(uint64_t now, uint8_t *frame, uint8_t *len);
+
+/**@brief Get the digipeater statistics.
+ */
+const digipeater_stats_t* digipeater_get_stats(void);
+
+#endif // DIGIPEATER_H
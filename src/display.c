@@ -27,12 +27,17 @@
 #include <math.h>
 
 #include "aprs.h"
+#include "station_db.h"
+#include "dupe_cache.h"
 #include "menusystem.h"
 #include "nmea.h"
 #include "tracker.h"
 #include "utils.h"
 #include "wall_clock.h"
 #include "bme280.h"
+#include "energy.h"
+#include "time_base.h"
+#include "profiling.h"
 
 #include "epaper.h"
 
@@ -65,6 +70,9 @@ extern uint8_t m_display_rx_index;
 
 extern char m_passkey[6];
 
+// number of stations shown on one page of the RX overview
+#define DISPLAY_RX_STATIONS_PER_PAGE 3
+
 typedef struct {
 	float x;
 	float y;
@@ -178,7 +186,7 @@ void redraw_display(bool full_update)
 	char s[64];
 	char tmp1[16], tmp2[16], tmp3[16];
 
-	const aprs_rx_history_t *aprs_history = aprs_get_rx_history();
+	uint32_t prof_start = profiling_start();
 
 	uint8_t line_height = epaper_fb_get_line_height();
 	uint8_t yoffset = line_height;
@@ -610,12 +618,43 @@ void redraw_display(bool full_update)
 			case DISP_STATE_LORA_RX_OVERVIEW:
 				yoffset -= line_height;
 
-				for(uint8_t i = 0; i < APRS_RX_HISTORY_SIZE+1; i++) {
+				// find the page that contains the selected station
+				uint8_t page_start = station_db_first();
+
+				if(m_display_rx_index != STATION_DB_INVALID) {
+					uint8_t pos = 0;
+					uint8_t idx = station_db_first();
+
+					while(idx != STATION_DB_INVALID) {
+						if(pos % DISPLAY_RX_STATIONS_PER_PAGE == 0) {
+							page_start = idx;
+						}
+
+						if(idx == m_display_rx_index) {
+							break;
+						}
+
+						idx = station_db_next(idx);
+						pos++;
+					}
+				}
+
+				uint8_t station_idx = page_start;
+
+				for(uint8_t i = 0; i < DISPLAY_RX_STATIONS_PER_PAGE+1; i++) {
 					yoffset += 2*line_height;
 
 					uint8_t fg_color, bg_color;
+					bool is_station_row = (i < DISPLAY_RX_STATIONS_PER_PAGE);
+
+					uint8_t row_idx = STATION_DB_INVALID;
+					if(is_station_row) {
+						row_idx = station_idx;
+						station_idx = station_db_next(station_idx);
+					}
 
-					if(i == m_display_rx_index) {
+					if((is_station_row && row_idx != STATION_DB_INVALID && row_idx == m_display_rx_index)
+							|| (!is_station_row && m_display_rx_index == STATION_DB_INVALID)) {
 						fg_color = EPAPER_COLOR_WHITE;
 						bg_color = EPAPER_COLOR_BLACK;
 					} else {
@@ -627,18 +666,21 @@ void redraw_display(bool full_update)
 
 #define HISTORY_TEXT_BASE_OFFSET 6
 
-					if(i < APRS_RX_HISTORY_SIZE) {
+					if(is_station_row) {
 						// decoded entries
-						const aprs_rx_history_entry_t *entry = &aprs_history->history[i];
+						const station_db_entry_t *entry = station_db_get(row_idx);
 
-						// skip entries that have reception time 0, i.e. are not set.
-						if(entry->rx_timestamp == 0) {
+						// skip rows without a station
+						if(entry == NULL) {
 							continue;
 						}
 
+						float lat, lon, alt;
+						station_db_get_position(entry, &lat, &lon, &alt);
+
 						// source call
 						epaper_fb_move_to(0, yoffset - line_height - HISTORY_TEXT_BASE_OFFSET);
-						epaper_fb_draw_string(entry->decoded.source, fg_color);
+						epaper_fb_draw_string(entry->call, fg_color);
 
 						// time since reception
 						uint32_t timedelta = unix_now - entry->rx_timestamp;
@@ -649,14 +691,14 @@ void redraw_display(bool full_update)
 						epaper_fb_draw_string(s, fg_color);
 
 						// calculate distance and course if we know our own position
-						if(m_nmea_has_position) {
+						if(m_nmea_has_position && entry->has_position) {
 							float distance = great_circle_distance_m(
 									m_nmea_data.lat, m_nmea_data.lon,
-									entry->decoded.lat, entry->decoded.lon);
+									lat, lon);
 
 							float direction = direction_angle(
 									m_nmea_data.lat, m_nmea_data.lon,
-									entry->decoded.lat, entry->decoded.lon);
+									lat, lon);
 
 							if(distance < 1000.0f) {
 								snprintf(s, sizeof(s), "%dm", (int)(distance + 0.5f));
@@ -749,29 +791,42 @@ void redraw_display(bool full_update)
 				break;
 
 			case DISP_STATE_LORA_PACKET_DETAIL:
-				if(m_display_rx_index < APRS_RX_HISTORY_SIZE) {
-					const aprs_rx_history_entry_t *entry = &aprs_history->history[m_display_rx_index];
+				if(station_db_get(m_display_rx_index) != NULL) {
+					const station_db_entry_t *entry = station_db_get(m_display_rx_index);
+
+					float lat, lon, alt;
+					station_db_get_position(entry, &lat, &lon, &alt);
+
+					// the comment is not stored in the database, so it is decoded
+					// again from the raw frame (if still available).
+					aprs_frame_t decoded;
+					uint8_t raw_data[256];
+					uint8_t raw_len;
 
-					epaper_fb_draw_string(entry->decoded.source, EPAPER_COLOR_BLACK);
+					bool decoded_valid =
+						station_db_get_raw(m_display_rx_index, raw_data, &raw_len)
+						&& aprs_parse_frame(raw_data, raw_len, &decoded);
+
+					epaper_fb_draw_string(entry->call, EPAPER_COLOR_BLACK);
 
 					yoffset += line_height;
 					epaper_fb_move_to(0, yoffset);
 
-					format_float(tmp1, sizeof(tmp1), entry->decoded.lat, 6);
+					format_float(tmp1, sizeof(tmp1), lat, 6);
 					snprintf(s, sizeof(s), "Lat: %s", tmp1);
 					epaper_fb_draw_string(s, EPAPER_COLOR_BLACK);
 
 					yoffset += line_height;
 					epaper_fb_move_to(0, yoffset);
 
-					format_float(tmp1, sizeof(tmp1), entry->decoded.lon, 6);
+					format_float(tmp1, sizeof(tmp1), lon, 6);
 					snprintf(s, sizeof(s), "Lon: %s", tmp1);
 					epaper_fb_draw_string(s, EPAPER_COLOR_BLACK);
 
 					yoffset += line_height;
 					epaper_fb_move_to(0, yoffset);
 
-					format_float(tmp1, sizeof(tmp1), entry->decoded.alt, 1);
+					format_float(tmp1, sizeof(tmp1), alt, 1);
 					snprintf(s, sizeof(s), "Alt: %s m", tmp1);
 					epaper_fb_draw_string(s, EPAPER_COLOR_BLACK);
 
@@ -780,7 +835,12 @@ void redraw_display(bool full_update)
 					yoffset += 5 * line_height / 4;
 					epaper_fb_move_to(0, yoffset);
 
-					strncpy(s, entry->decoded.comment, sizeof(s));
+					if(decoded_valid) {
+						strncpy(s, decoded.comment, sizeof(s));
+					} else {
+						strncpy(s, "(raw data expired)", sizeof(s));
+					}
+
 					if(strlen(s) > 40) {
 						s[38] = '\0';
 						strcat(s, "...");
@@ -789,14 +849,14 @@ void redraw_display(bool full_update)
 
 					yoffset = epaper_fb_get_cursor_pos_y();
 
-					if(m_nmea_has_position) {
+					if(m_nmea_has_position && entry->has_position) {
 						float distance = great_circle_distance_m(
 								m_nmea_data.lat, m_nmea_data.lon,
-								entry->decoded.lat, entry->decoded.lon);
+								lat, lon);
 
 						float direction = direction_angle(
 								m_nmea_data.lat, m_nmea_data.lon,
-								entry->decoded.lat, entry->decoded.lon);
+								lat, lon);
 
 						format_float(tmp1, sizeof(tmp1), distance / 1000.0f, 3);
 						snprintf(s, sizeof(s), "%s km", tmp1);
@@ -825,16 +885,23 @@ void redraw_display(bool full_update)
 
 					epaper_fb_draw_string("R: ", EPAPER_COLOR_BLACK);
 
-					format_float(tmp1, sizeof(tmp1), entry->raw.rssi, 1);
+					format_float(tmp1, sizeof(tmp1), entry->rssi * 0.1f, 1);
 					epaper_fb_draw_string(tmp1, EPAPER_COLOR_BLACK);
 					epaper_fb_draw_string(" / ", EPAPER_COLOR_BLACK);
 
-					format_float(tmp1, sizeof(tmp1), entry->raw.snr, 2);
+					format_float(tmp1, sizeof(tmp1), entry->snr * 0.01f, 2);
 					epaper_fb_draw_string(tmp1, EPAPER_COLOR_BLACK);
 					epaper_fb_draw_string(" / ", EPAPER_COLOR_BLACK);
 
-					format_float(tmp1, sizeof(tmp1), entry->raw.signalRssi, 1);
+					format_float(tmp1, sizeof(tmp1), entry->signal_rssi * 0.1f, 1);
 					epaper_fb_draw_string(tmp1, EPAPER_COLOR_BLACK);
+
+					yoffset += line_height;
+					epaper_fb_move_to(0, yoffset);
+
+					snprintf(s, sizeof(s), "Dupes: %u (total: %lu)",
+							entry->dupe_count, dupe_cache_get_duplicate_count());
+					epaper_fb_draw_string(s, EPAPER_COLOR_BLACK);
 				} else {
 					/* show error message */
 					epaper_fb_draw_string("Decoder Error:", EPAPER_COLOR_BLACK);
@@ -937,6 +1004,73 @@ void redraw_display(bool full_update)
 				}
 				break;
 
+			case DISP_STATE_ENERGY:
+				{
+					// short names, because two consumers share one line
+					static const char *CONSUMER_NAMES[ENERGY_NUM_CONSUMERS] = {
+						"Base", "GNSS", "RX", "TX", "Disp.", "Other"
+					};
+
+					energy_stats_t stats;
+					energy_get_stats(time_base_get(), &stats);
+
+					epaper_fb_draw_string("Uptime:", EPAPER_COLOR_BLACK);
+
+					format_float(tmp1, sizeof(tmp1), stats.total_ms / 3600000.0f, 1);
+					snprintf(s, sizeof(s), "%s h", tmp1);
+
+					epaper_fb_move_to(EPAPER_WIDTH - epaper_fb_calc_text_width(s), yoffset);
+					epaper_fb_draw_string(s, EPAPER_COLOR_BLACK);
+
+					yoffset += line_height;
+
+					epaper_fb_move_to(0, yoffset);
+					epaper_fb_draw_string("Used:", EPAPER_COLOR_BLACK);
+
+					format_float(tmp1, sizeof(tmp1), stats.total_mah, 2);
+					snprintf(s, sizeof(s), "%s mAh", tmp1);
+
+					epaper_fb_move_to(EPAPER_WIDTH - epaper_fb_calc_text_width(s), yoffset);
+					epaper_fb_draw_string(s, EPAPER_COLOR_BLACK);
+
+					yoffset += line_height;
+
+					epaper_fb_move_to(0, yoffset);
+					epaper_fb_draw_string("Avg. current:", EPAPER_COLOR_BLACK);
+
+					format_float(tmp1, sizeof(tmp1), stats.avg_current_ma, 2);
+					snprintf(s, sizeof(s), "%s mA", tmp1);
+
+					epaper_fb_move_to(EPAPER_WIDTH - epaper_fb_calc_text_width(s), yoffset);
+					epaper_fb_draw_string(s, EPAPER_COLOR_BLACK);
+
+					yoffset += line_height/2;
+
+					epaper_fb_move_to(0, yoffset);
+					epaper_fb_line_to(EPAPER_WIDTH, yoffset, EPAPER_COLOR_BLACK | EPAPER_LINE_DRAWING_MODE_DASHED);
+
+					yoffset += line_height;
+
+					// charge per consumer in mAh, in two columns
+					for(uint8_t i = 0; i < ENERGY_NUM_CONSUMERS; i++) {
+						uint8_t col_left = (i % 2) ? (EPAPER_WIDTH/2 + 4) : 0;
+						uint8_t col_right = (i % 2) ? EPAPER_WIDTH : (EPAPER_WIDTH/2 - 4);
+
+						epaper_fb_move_to(col_left, yoffset);
+						epaper_fb_draw_string(CONSUMER_NAMES[i], EPAPER_COLOR_BLACK);
+
+						format_float(s, sizeof(s), stats.consumer_mah[i], 2);
+
+						epaper_fb_move_to(col_right - epaper_fb_calc_text_width(s), yoffset);
+						epaper_fb_draw_string(s, EPAPER_COLOR_BLACK);
+
+						if(i % 2) {
+							yoffset += line_height;
+						}
+					}
+				}
+				break;
+
 			case DISP_STATE_CLEAR:
 				// draw nothing at all
 				break;
@@ -948,6 +1082,8 @@ void redraw_display(bool full_update)
 		}
 	}
 
+	profiling_end(PROFILING_SPAN_REDRAW_DISPLAY, prof_start);
+
 	epaper_update(full_update);
 }
 
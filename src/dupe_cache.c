@@ -0,0 +1,140 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "dupe_cache.h"
+#include "utils.h"
+
+typedef struct {
+	uint32_t hash;
+	uint64_t timestamp;
+	bool     valid;
+} dupe_cache_entry_t;
+
+static dupe_cache_entry_t m_entries[DUPE_CACHE_SIZE];
+static uint8_t            m_next_entry;
+
+static uint32_t m_duplicate_count;
+
+
+/**@brief Skip the LoRa-APRS header, if present.
+ */
+static const uint8_t* skip_header(const uint8_t *frame, size_t *len)
+{
+	if(*len > 3 && frame[0] == '<' && frame[1] == 0xFF && frame[2] == 0x01) {
+		*len -= 3;
+		return frame + 3;
+	}
+
+	return frame;
+}
+
+
+uint32_t dupe_cache_calc_hash(const uint8_t *frame, size_t len)
+{
+	uint32_t hash = FNV1A_INIT;
+
+	frame = skip_header(frame, &len);
+
+	const uint8_t *src_end = memchr(frame, '>', len);
+	const uint8_t *info = memchr(frame, ':', len);
+
+	if(!src_end || !info || info < src_end) {
+		// not a valid frame: use all data
+		return fnv1a_update(hash, frame, len);
+	}
+
+	info++; // skip the ':'
+
+	hash = fnv1a_update(hash, frame, src_end - frame);
+	hash = fnv1a_update(hash, (const uint8_t*)">", 1); // separator
+	hash = fnv1a_update(hash, info, len - (info - frame));
+
+	return hash;
+}
+
+
+void dupe_cache_init(void)
+{
+	memset(m_entries, 0, sizeof(m_entries));
+	m_next_entry = 0;
+	m_duplicate_count = 0;
+}
+
+
+bool dupe_cache_check_and_insert(const uint8_t *frame, size_t len, uint64_t now)
+{
+	uint32_t hash = dupe_cache_calc_hash(frame, len);
+
+	for(uint8_t i = 0; i < DUPE_CACHE_SIZE; i++) {
+		const dupe_cache_entry_t *entry = &m_entries[i];
+
+		if(entry->valid
+				&& entry->hash == hash
+				&& (now - entry->timestamp) < DUPE_CACHE_WINDOW_MS) {
+			m_duplicate_count++;
+			return true;
+		}
+	}
+
+	// not found: replace the oldest entry
+	m_entries[m_next_entry].hash = hash;
+	m_entries[m_next_entry].timestamp = now;
+	m_entries[m_next_entry].valid = true;
+
+	m_next_entry = (m_next_entry + 1) % DUPE_CACHE_SIZE;
+
+	return false;
+}
+
+
+uint32_t dupe_cache_get_duplicate_count(void)
+{
+	return m_duplicate_count;
+}
+
+
+bool dupe_cache_get_source(const uint8_t *frame, size_t len, char *call, size_t call_size)
+{
+	frame = skip_header(frame, &len);
+
+	const uint8_t *src_end = memchr(frame, '>', len);
+
+	if(!src_end || call_size == 0) {
+		return false;
+	}
+
+	size_t call_len = src_end - frame;
+
+	if(call_len >= call_size) {
+		call_len = call_size - 1;
+	}
+
+	memcpy(call, frame, call_len);
+	call[call_len] = '\0';
+
+	return true;
+}
@@ -0,0 +1,90 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef DUPE_CACHE_H
+#define DUPE_CACHE_H
+
+/**@file
+ *
+ * @brief Duplicate packet detection.
+ *
+ * @details
+ * When a packet is digipeated, the same payload is received several times
+ * within a few seconds, only with a different path. This module remembers a
+ * hash of the source call and the information field of recently received
+ * frames, so these copies can be detected before the frame is decoded.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// number of remembered frames
+#define DUPE_CACHE_SIZE         16
+
+// frames with the same content are duplicates if received within this time
+#define DUPE_CACHE_WINDOW_MS 30000 // milliseconds
+
+/**@brief Clear the cache and reset the duplicate counter.
+ */
+void dupe_cache_init(void);
+
+/**@brief Check whether the frame is a duplicate and remember it.
+ * @details
+ * The path is not considered in the comparison. If the frame is not a
+ * duplicate, it is added to the cache. Duplicates do not extend the time
+ * window of the original frame.
+ *
+ * @param frame   The raw frame data, including the LoRa-APRS header.
+ * @param len     Length of the raw frame.
+ * @param now     The current time in milliseconds.
+ * @returns       True if the same frame was seen within the time window.
+ */
+bool dupe_cache_check_and_insert(const uint8_t *frame, size_t len, uint64_t now);
+
+/**@brief Hash the source call and the information field of a frame.
+ * @details
+ * Frames that are considered duplicates by this module have the same hash.
+ *
+ * @param frame   The raw frame data, including the LoRa-APRS header.
+ * @param len     Length of the raw frame.
+ */
+uint32_t dupe_cache_calc_hash(const uint8_t *frame, size_t len);
+
+/**@brief Get the number of duplicates detected since initialization.
+ */
+uint32_t dupe_cache_get_duplicate_count(void);
+
+/**@brief Extract the source call from a raw frame.
+ *
+ * @param frame       The raw frame data, including the LoRa-APRS header.
+ * @param len         Length of the raw frame.
+ * @param[out] call   Buffer for the null-terminated call sign.
+ * @param call_size   Size of the call buffer.
+ * @returns           True if a source call was found.
+ */
+bool dupe_cache_get_source(const uint8_t *frame, size_t len, char *call, size_t call_size);
+
+#endif // DUPE_CACHE_H
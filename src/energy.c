@@ -0,0 +1,318 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include <app_util_platform.h>
+
+#include "energy.h"
+
+// the model currents are given in units of 10 µA
+#define CURRENT_UNIT_MA   0.01f
+
+#define MS_PER_HOUR       3600000.0f
+
+static const energy_model_t DEFAULT_MODEL = {
+	.base = 10,
+	.rail = {
+		5,      // 3.3V regulator
+		20,     // peripheral power switch
+	},
+	.activity = {
+		0,      // init
+		20,     // BLE connection
+		50,     // voltage measurement
+		300,    // e-paper update
+		4000,   // GNSS tracking
+		500,    // LoRa RX
+		1000,   // LEDs
+		40,     // BME280
+		300,    // SPI flash
+	},
+	.gps_standby = 100,
+	.tx = {
+		11800,  // +22 dBm
+		10200,  // +20 dBm
+		9000,   // +17 dBm
+		4500,   // +14 dBm
+		3200,   // +10 dBm
+		1500,   //   0 dBm
+		1000,   //  -9 dBm
+	},
+};
+
+static energy_model_t m_model;
+
+static uint64_t m_start_time;
+static uint64_t m_last_update;
+
+static uint32_t m_activities;
+static uint32_t m_rails;
+static bool     m_gps_standby;
+
+static uint64_t m_activity_ms[ENERGY_NUM_ACTIVITIES];
+static uint64_t m_rail_ms[ENERGY_NUM_RAILS];
+static uint64_t m_gps_standby_ms;
+static uint64_t m_tx_ms[ENERGY_NUM_TX_LEVELS];
+
+
+/**@brief Add the time since the last update to all running consumers.
+ * @details The counters are updated from the main loop, the LoRa state machine
+ * and the battery callback, so this must be called inside a critical region.
+ */
+static void accumulate(uint64_t now)
+{
+	if(now <= m_last_update) {
+		return;
+	}
+
+	uint64_t dt = now - m_last_update;
+
+	for(uint8_t i = 0; i < ENERGY_NUM_ACTIVITIES; i++) {
+		if(m_activities & (1 << i)) {
+			m_activity_ms[i] += dt;
+		}
+	}
+
+	for(uint8_t i = 0; i < ENERGY_NUM_RAILS; i++) {
+		if(m_rails & (1 << i)) {
+			m_rail_ms[i] += dt;
+		}
+	}
+
+	// standby only counts while the GNSS module is actually powered
+	if(m_gps_standby && (m_activities & (1 << ENERGY_ACTIVITY_GPS))) {
+		m_gps_standby_ms += dt;
+	}
+
+	m_last_update = now;
+}
+
+
+static float charge_mah(uint16_t current, uint64_t duration_ms)
+{
+	return (float)current * CURRENT_UNIT_MA * (float)duration_ms / MS_PER_HOUR;
+}
+
+
+void energy_init(uint64_t now)
+{
+	m_model = DEFAULT_MODEL;
+
+	m_start_time = now;
+	m_last_update = now;
+
+	m_activities = 0;
+	m_rails = 0;
+	m_gps_standby = false;
+
+	memset(m_activity_ms, 0, sizeof(m_activity_ms));
+	memset(m_rail_ms, 0, sizeof(m_rail_ms));
+	m_gps_standby_ms = 0;
+	memset(m_tx_ms, 0, sizeof(m_tx_ms));
+}
+
+
+void energy_update(uint64_t now, uint32_t activities, uint32_t rails)
+{
+	CRITICAL_REGION_ENTER();
+
+	accumulate(now);
+
+	m_activities = activities;
+	m_rails = rails;
+
+	CRITICAL_REGION_EXIT();
+}
+
+
+void energy_set_gps_standby(uint64_t now, bool standby)
+{
+	CRITICAL_REGION_ENTER();
+
+	accumulate(now);
+
+	m_gps_standby = standby;
+
+	CRITICAL_REGION_EXIT();
+}
+
+
+void energy_record_tx(uint8_t power_level, uint32_t duration_ms)
+{
+	if(power_level >= ENERGY_NUM_TX_LEVELS) {
+		return;
+	}
+
+	CRITICAL_REGION_ENTER();
+	m_tx_ms[power_level] += duration_ms;
+	CRITICAL_REGION_EXIT();
+}
+
+
+void energy_get_default_model(energy_model_t *model)
+{
+	*model = DEFAULT_MODEL;
+}
+
+
+void energy_set_model(const energy_model_t *model)
+{
+	m_model = *model;
+}
+
+
+void energy_get_model(energy_model_t *model)
+{
+	*model = m_model;
+}
+
+
+void energy_get_stats(uint64_t now, energy_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	// take a consistent snapshot of the counters; the charges are calculated
+	// from the copy only
+	CRITICAL_REGION_ENTER();
+
+	accumulate(now);
+
+	stats->total_ms = m_last_update - m_start_time;
+	memcpy(stats->activity_ms, m_activity_ms, sizeof(stats->activity_ms));
+	memcpy(stats->rail_ms, m_rail_ms, sizeof(stats->rail_ms));
+	stats->gps_standby_ms = m_gps_standby_ms;
+	memcpy(stats->tx_ms, m_tx_ms, sizeof(stats->tx_ms));
+
+	CRITICAL_REGION_EXIT();
+
+	float *consumer = stats->consumer_mah;
+
+	consumer[ENERGY_CONSUMER_BASE] = charge_mah(m_model.base, stats->total_ms);
+
+	for(uint8_t i = 0; i < ENERGY_NUM_RAILS; i++) {
+		consumer[ENERGY_CONSUMER_BASE] += charge_mah(m_model.rail[i], stats->rail_ms[i]);
+	}
+
+	for(uint8_t i = 0; i < ENERGY_NUM_ACTIVITIES; i++) {
+		float charge = charge_mah(m_model.activity[i], stats->activity_ms[i]);
+
+		switch(i) {
+			case ENERGY_ACTIVITY_CONNECTED:
+				consumer[ENERGY_CONSUMER_BASE] += charge;
+				break;
+
+			case ENERGY_ACTIVITY_EPAPER:
+				consumer[ENERGY_CONSUMER_DISPLAY] += charge;
+				break;
+
+			case ENERGY_ACTIVITY_GPS:
+				// standby current replaces the tracking current
+				consumer[ENERGY_CONSUMER_GNSS] +=
+					charge_mah(m_model.activity[i], stats->activity_ms[i] - stats->gps_standby_ms)
+					+ charge_mah(m_model.gps_standby, stats->gps_standby_ms);
+				break;
+
+			case ENERGY_ACTIVITY_LORA:
+				// handled below
+				break;
+
+			default:
+				consumer[ENERGY_CONSUMER_OTHER] += charge;
+				break;
+		}
+	}
+
+	// transmission current replaces the RX current
+	uint64_t tx_total_ms = 0;
+
+	for(uint8_t i = 0; i < ENERGY_NUM_TX_LEVELS; i++) {
+		consumer[ENERGY_CONSUMER_LORA_TX] += charge_mah(m_model.tx[i], stats->tx_ms[i]);
+		tx_total_ms += stats->tx_ms[i];
+	}
+
+	uint64_t lora_ms = stats->activity_ms[ENERGY_ACTIVITY_LORA];
+
+	// the transmission is recorded when it starts, so it may not be fully
+	// contained in the activity time yet
+	uint64_t rx_ms = (lora_ms > tx_total_ms) ? (lora_ms - tx_total_ms) : 0;
+
+	consumer[ENERGY_CONSUMER_LORA_RX] = charge_mah(m_model.activity[ENERGY_ACTIVITY_LORA], rx_ms);
+
+	for(uint8_t i = 0; i < ENERGY_NUM_CONSUMERS; i++) {
+		stats->total_mah += consumer[i];
+	}
+
+	if(stats->total_ms > 0) {
+		stats->avg_current_ma = stats->total_mah * MS_PER_HOUR / (float)stats->total_ms;
+	}
+}
+
+
+static uint8_t* encode_u32(uint8_t *p, uint64_t value)
+{
+	if(value > UINT32_MAX) {
+		value = UINT32_MAX;
+	}
+
+	*p++ = (value >>  0) & 0xFF;
+	*p++ = (value >>  8) & 0xFF;
+	*p++ = (value >> 16) & 0xFF;
+	*p++ = (value >> 24) & 0xFF;
+
+	return p;
+}
+
+
+size_t energy_encode_stats(uint8_t *buf, uint64_t now)
+{
+	energy_stats_t stats;
+	uint8_t *p = buf;
+
+	energy_get_stats(now, &stats);
+
+	p = encode_u32(p, stats.total_ms / 1000);
+	p = encode_u32(p, (uint64_t)(stats.total_mah * 1000.0f + 0.5f));
+
+	for(uint8_t i = 0; i < ENERGY_NUM_CONSUMERS; i++) {
+		p = encode_u32(p, (uint64_t)(stats.consumer_mah[i] * 1000.0f + 0.5f));
+	}
+
+	for(uint8_t i = 0; i < ENERGY_NUM_ACTIVITIES; i++) {
+		p = encode_u32(p, stats.activity_ms[i] / 1000);
+	}
+
+	for(uint8_t i = 0; i < ENERGY_NUM_RAILS; i++) {
+		p = encode_u32(p, stats.rail_ms[i] / 1000);
+	}
+
+	p = encode_u32(p, stats.gps_standby_ms / 1000);
+
+	for(uint8_t i = 0; i < ENERGY_NUM_TX_LEVELS; i++) {
+		p = encode_u32(p, stats.tx_ms[i]);
+	}
+
+	return p - buf;
+}
@@ -0,0 +1,172 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+/**@file
+ *
+ * @brief Estimation of the consumed battery charge.
+ *
+ * @details
+ * The module is informed about every change of the running peripheral
+ * activities and the powered supply rails (see periph_pwr.c) and accumulates
+ * the on-time of each of them. LoRa transmissions are accounted separately per
+ * output power level, as are the phases in which the GNSS module is in
+ * standby.
+ *
+ * Multiplying these times with the currents from a configurable model gives
+ * an estimate of the charge drawn from the battery since startup. The model
+ * is only as good as its currents, but it shows clearly which part of the
+ * device uses most of the energy.
+ *
+ * All functions take the current time as a parameter, so this module does
+ * not depend on a specific clock.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// one entry per activity flag bit in periph_pwr.h
+#define ENERGY_NUM_ACTIVITIES   9
+
+// bit indices of the activities that are accounted specially
+#define ENERGY_ACTIVITY_CONNECTED   1
+#define ENERGY_ACTIVITY_EPAPER      3
+#define ENERGY_ACTIVITY_GPS         4
+#define ENERGY_ACTIVITY_LORA        5
+
+// supply rails, same bits as the module flags in periph_pwr.c
+#define ENERGY_NUM_RAILS        2
+
+// one entry per LoRa power level, same order as lora_pwr_t
+#define ENERGY_NUM_TX_LEVELS    7
+
+// length of the data generated by energy_encode_stats()
+#define ENERGY_ENCODED_STATS_LEN  108
+
+/**@brief Current consumption model.
+ * @details
+ * All currents are given in units of 10 µA. The activity and rail currents
+ * are added to the base current while the activity runs or the rail is on.
+ * During a LoRa transmission, the TX current of the used power level
+ * replaces the current of the LoRa activity. While the GNSS is in standby,
+ * the standby current replaces the GNSS activity current.
+ *
+ * This struct is stored as-is in the settings (40 bytes, little endian), so
+ * the field order must not be changed.
+ */
+typedef struct {
+	uint16_t base;                              //!< MCU and BLE advertising.
+	uint16_t rail[ENERGY_NUM_RAILS];            //!< Quiescent current of each supply rail.
+	uint16_t activity[ENERGY_NUM_ACTIVITIES];   //!< Additional current of each activity.
+	uint16_t gps_standby;                       //!< GNSS module in standby.
+	uint16_t tx[ENERGY_NUM_TX_LEVELS];          //!< LoRa module while transmitting.
+} energy_model_t;
+
+#define ENERGY_MODEL_LEN  40
+
+typedef enum {
+	ENERGY_CONSUMER_BASE,      //!< MCU, BLE and the supply rails.
+	ENERGY_CONSUMER_GNSS,      //!< GNSS module, active and standby.
+	ENERGY_CONSUMER_LORA_RX,   //!< LoRa module while not transmitting.
+	ENERGY_CONSUMER_LORA_TX,   //!< LoRa transmissions.
+	ENERGY_CONSUMER_DISPLAY,   //!< E-Paper updates.
+	ENERGY_CONSUMER_OTHER,     //!< All remaining activities.
+
+	ENERGY_NUM_CONSUMERS
+} energy_consumer_t;
+
+typedef struct {
+	uint64_t total_ms;                             //!< Time since energy_init().
+	uint64_t activity_ms[ENERGY_NUM_ACTIVITIES];   //!< On-time of each activity.
+	uint64_t rail_ms[ENERGY_NUM_RAILS];            //!< On-time of each supply rail.
+	uint64_t gps_standby_ms;                       //!< Time in GNSS standby.
+	uint64_t tx_ms[ENERGY_NUM_TX_LEVELS];          //!< Transmission time per power level.
+
+	float    consumer_mah[ENERGY_NUM_CONSUMERS];   //!< Estimated charge per consumer.
+	float    total_mah;                            //!< Estimated total charge.
+	float    avg_current_ma;                       //!< Average current since energy_init().
+} energy_stats_t;
+
+/**@brief Reset all accumulated times and restore the default model.
+ *
+ * @param now   The current time in milliseconds.
+ */
+void energy_init(uint64_t now);
+
+/**@brief Account the time since the last update and set the new power state.
+ *
+ * @param now          The current time in milliseconds.
+ * @param activities   Bit mask of the running activities (PERIPH_PWR_FLAG_*).
+ * @param rails        Bit mask of the powered supply rails.
+ */
+void energy_update(uint64_t now, uint32_t activities, uint32_t rails);
+
+/**@brief Account the time since the last update and set the GNSS standby state.
+ */
+void energy_set_gps_standby(uint64_t now, bool standby);
+
+/**@brief Record a LoRa transmission.
+ *
+ * @param power_level   The used power level (a lora_pwr_t value).
+ * @param duration_ms   The time on air of the transmission.
+ */
+void energy_record_tx(uint8_t power_level, uint32_t duration_ms);
+
+/**@brief Get the default current model.
+ */
+void energy_get_default_model(energy_model_t *model);
+
+/**@brief Set the current model used for the estimation.
+ * @details
+ * The accumulated times are kept, so the new model applies to the whole
+ * time since energy_init().
+ */
+void energy_set_model(const energy_model_t *model);
+
+/**@brief Get the active current model.
+ */
+void energy_get_model(energy_model_t *model);
+
+/**@brief Get the accumulated times and the charge estimation up to now.
+ */
+void energy_get_stats(uint64_t now, energy_stats_t *stats);
+
+/**@brief Encode the statistics for transmission over BLE.
+ * @details
+ * All values are 32 bit little endian integers in this order: uptime in
+ * seconds, total charge in µAh, charge per consumer in µAh, on-time per
+ * activity in seconds, on-time per rail in seconds, GNSS standby time in
+ * seconds and transmission time per power level in milliseconds.
+ *
+ * @param buf   Buffer of at least @ref ENERGY_ENCODED_STATS_LEN bytes.
+ * @param now   The current time in milliseconds.
+ * @returns     The number of bytes written.
+ */
+size_t energy_encode_stats(uint8_t *buf, uint64_t now);
+
+#endif // ENERGY_H
@@ -42,6 +42,7 @@ NRF_LOG_MODULE_REGISTER();
 
 #include "pinout.h"
 #include "periph_pwr.h"
+#include "event_queue.h"
 #include "fasttrigon.h"
 
 #include "epaper.h"
@@ -192,6 +193,7 @@ static ret_code_t send_command(void)
 
 		// actual display shutdown will be done from the main loop
 		m_shutdown_needed = true;
+		event_queue_post(EVENT_EPAPER_SHUTDOWN);
 
 		return NRF_SUCCESS;
 	}
@@ -374,6 +376,26 @@ void epaper_config_gpios(bool power_supplied)
 }
 
 
+static void handle_shutdown(void)
+{
+	if(m_shutdown_needed) {
+		nrfx_spim_uninit(&m_spim); // to save power
+
+		epaper_config_gpios(true); // safe powered state
+
+		periph_pwr_stop_activity(PERIPH_PWR_FLAG_EPAPER_UPDATE);
+
+		// copy last sent framebuffer to previous image buffer
+		memcpy(m_frame_buffer_prev, m_frame_buffer, FRAMEBUFFER_SIZE_BYTES);
+
+		m_busy = false;
+		m_shutdown_needed = false;
+
+		event_queue_post(EVENT_EPAPER_IDLE);
+	}
+}
+
+
 ret_code_t epaper_init(void)
 {
 	// initialize the GPIOs.
@@ -395,6 +417,8 @@ ret_code_t epaper_init(void)
 	m_cursor.x = m_cursor.y = 0;
 	m_font = NULL;
 
+	event_queue_register(EVENT_EPAPER_SHUTDOWN, handle_shutdown);
+
 	NRF_LOG_DEBUG("init.");
 
 	return app_timer_create(&m_sequence_timer, APP_TIMER_MODE_SINGLE_SHOT, cb_sequence_timer);
@@ -457,24 +481,6 @@ bool epaper_is_busy(void)
 }
 
 
-void epaper_loop(void)
-{
-	if(m_shutdown_needed) {
-		nrfx_spim_uninit(&m_spim); // to save power
-
-		epaper_config_gpios(true); // safe powered state
-
-		periph_pwr_stop_activity(PERIPH_PWR_FLAG_EPAPER_UPDATE);
-
-		// copy last sent framebuffer to previous image buffer
-		memcpy(m_frame_buffer_prev, m_frame_buffer, FRAMEBUFFER_SIZE_BYTES);
-
-		m_busy = false;
-		m_shutdown_needed = false;
-	}
-}
-
-
 /***** Framebuffer drawing functions *****/
 
 void epaper_fb_clear(uint8_t color)
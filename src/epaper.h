@@ -108,13 +108,6 @@ ret_code_t epaper_update(bool full_refresh);
  */
 bool epaper_is_busy(void);
 
-/**@brief Main loop function.
- * @details
- * Call this from the main loop as often as possible. Relevant for power
- * management.
- */
-void epaper_loop(void);
-
 /**@brief Configure the GPIOs depending on the general power state.
  *
  * This function is mainly called by the periph_pwr module when the enable
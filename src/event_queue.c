@@ -0,0 +1,130 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+
+#include <app_scheduler.h>
+#include <app_util_platform.h>
+#include <app_error.h>
+
+#include "time_base.h"
+
+#include "event_queue.h"
+
+typedef struct
+{
+	event_type_t type;
+	uint64_t     post_time;
+} event_t;
+
+// every event type is queued at most once. The scheduler removes an entry only
+// after its handler returned, so one more entry is needed for an event that is
+// posted again from its own handler.
+#define QUEUE_SIZE  (EVENT_NUM_TYPES + 1)
+
+static event_handler_t m_handlers[EVENT_NUM_TYPES];
+static event_stats_t m_stats[EVENT_NUM_TYPES];
+
+static volatile uint32_t m_pending;
+
+
+static void cb_scheduler(void *p_event_data, uint16_t event_size)
+{
+	event_t *evt = p_event_data;
+
+	(void)event_size;
+
+	// clear the pending flag before calling the handler, so the event can be
+	// posted again while it is being handled.
+	CRITICAL_REGION_ENTER();
+	m_pending &= ~(1UL << evt->type);
+	CRITICAL_REGION_EXIT();
+
+	uint64_t latency = time_base_get() - evt->post_time;
+
+	event_stats_t *stats = &m_stats[evt->type];
+
+	stats->dispatched++;
+
+	if(latency > stats->max_latency_ms) {
+		stats->max_latency_ms = (latency > UINT32_MAX) ? UINT32_MAX : latency;
+	}
+
+	if(m_handlers[evt->type]) {
+		m_handlers[evt->type]();
+	}
+}
+
+
+ret_code_t event_queue_init(void)
+{
+	APP_SCHED_INIT(sizeof(event_t), QUEUE_SIZE);
+
+	m_pending = 0;
+
+	return NRF_SUCCESS;
+}
+
+
+void event_queue_register(event_type_t type, event_handler_t handler)
+{
+	m_handlers[type] = handler;
+}
+
+
+void event_queue_post(event_type_t type)
+{
+	event_t evt = {
+		.type = type,
+		.post_time = time_base_get()
+	};
+
+	CRITICAL_REGION_ENTER();
+
+	if(!(m_pending & (1UL << type))) {
+		m_pending |= (1UL << type);
+
+		// cannot fail: each type is pending at most once, plus the entry of
+		// the handler that is currently running
+		ret_code_t err_code = app_sched_event_put(&evt, sizeof(evt), cb_scheduler);
+		APP_ERROR_CHECK(err_code);
+	}
+
+	CRITICAL_REGION_EXIT();
+}
+
+
+void event_queue_dispatch(void)
+{
+	app_sched_execute();
+}
+
+
+void event_queue_get_stats(event_type_t type, event_stats_t *stats)
+{
+	CRITICAL_REGION_ENTER();
+	*stats = m_stats[type];
+	CRITICAL_REGION_EXIT();
+}
@@ -0,0 +1,118 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+/**@file
+ *
+ * @brief Main loop event queue.
+ *
+ * @details
+ * Interrupt handlers and timer callbacks post typed events here instead of
+ * setting flags that the main loop has to poll. The main loop dispatches the
+ * queued events to their registered handlers and goes back to sleep as soon as
+ * the queue is empty.
+ *
+ * Posting an event that is already waiting in the queue has no effect, so
+ * every event type occupies at most one queue entry and the queue can never
+ * overflow. Handlers must therefore check the actual state of their module
+ * instead of relying on the number of calls.
+ */
+
+#include <stdint.h>
+#include <sdk_errors.h>
+
+typedef enum
+{
+	EVENT_EPAPER_SHUTDOWN,   //!< The e-Paper update sequence has finished.
+	EVENT_EPAPER_IDLE,       //!< The e-Paper is ready for the next update.
+	EVENT_GPS_SENTENCE,      //!< A complete NMEA sentence was received.
+	EVENT_LORA_SHUTDOWN,     //!< The LoRa module has entered the OFF state.
+	EVENT_BME280_SHUTDOWN,   //!< The BME280 measurement sequence has finished.
+	EVENT_DISPLAY_UPDATE,    //!< The display contents should be redrawn.
+	EVENT_TX_QUEUE_POLL,     //!< A frame in the transmit queue may be due.
+	EVENT_BLE_RX_NOTIFY,     //!< Received messages can be notified to the BLE client.
+	EVENT_BLE_KISS_NOTIFY,   //!< Received frames can be sent to the BLE KISS client.
+	EVENT_BLE_CONN_POLICY,   //!< The BLE connection parameters may have to be changed.
+	EVENT_SETTINGS_FLUSH,    //!< Changed settings should be written to flash.
+	EVENT_STORAGE_GC,        //!< A flash garbage collection is due.
+	EVENT_RX_ARCHIVE_WRITE,  //!< Received packets are waiting to be archived.
+	EVENT_BLE_ARCHIVE_NOTIFY, //!< The next part of the RX archive can be sent to the BLE client.
+	EVENT_BLE_TRACK_NOTIFY,  //!< The next part of the track export can be sent to the BLE client.
+	EVENT_TRACK_LOG_WRITE,   //!< A full track log page is waiting to be written.
+
+	EVENT_NUM_TYPES
+} event_type_t;
+
+typedef void (*event_handler_t)(void);
+
+typedef struct
+{
+	uint32_t dispatched;     //!< Number of handler calls since boot.
+	uint32_t max_latency_ms; //!< Longest time from posting to dispatching.
+} event_stats_t;
+
+/**@brief Initialize the event queue.
+ * @details
+ * Must be called before any other module posts events.
+ *
+ * @returns   The result code of the scheduler initialization.
+ */
+ret_code_t event_queue_init(void);
+
+/**@brief Register the handler for an event type.
+ * @details
+ * Only one handler can be registered per event type. Registering a new one
+ * replaces the previous handler.
+ *
+ * @param[in] type      The event type.
+ * @param[in] handler   The function to call in the main loop.
+ */
+void event_queue_register(event_type_t type, event_handler_t handler);
+
+/**@brief Post an event for the main loop.
+ * @details
+ * This function is safe to call from interrupt context.
+ *
+ * @param[in] type      The event type.
+ */
+void event_queue_post(event_type_t type);
+
+/**@brief Dispatch all queued events to their handlers.
+ * @details
+ * Must be called from the main loop only. Events posted by a handler are also
+ * dispatched before this function returns.
+ */
+void event_queue_dispatch(void);
+
+/**@brief Get the dispatch statistics of an event type.
+ *
+ * @param[in]  type     The event type.
+ * @param[out] stats    Pointer to the structure to fill.
+ */
+void event_queue_get_stats(event_type_t type, event_stats_t *stats);
+
+#endif // EVENT_QUEUE_H
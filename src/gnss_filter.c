@@ -0,0 +1,294 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "gnss_filter.h"
+
+#define F_PI   3.141592653589793f
+
+// length of one degree of latitude
+#define MM_PER_DEGREE   111194927.0f // millimeters
+
+// filter gains in Q16 format. The pair follows the Benedict-Bordner relation
+// beta = alpha² / (2 - alpha) for 1 Hz updates, which reduces the velocity
+// noise to about 8 % of the position noise per second. After a turn, the
+// velocity settles within about 5 seconds.
+#define ALPHA_Q16   19661 // 0.30
+#define BETA_Q16     3468 // 0.053
+
+// gains used when the measurement is far off the prediction. This happens
+// when turning or braking at higher speed, where the change of the velocity
+// is large compared to the noise, so the slow gains would delay the
+// position.
+#define MANEUVER_RESIDUAL_MM   4000 // millimeters
+#define MANEUVER_ALPHA_Q16    45875 // 0.70
+#define MANEUVER_BETA_Q16     24719 // 0.377
+
+// the reference point is moved to the current estimate if the device is
+// further away than this, so the fixed-point state does not overflow and the
+// flat earth approximation stays precise.
+#define MAX_OFFSET_MM   5000000 // 5 km
+
+// at walking speed, the heading is the direction of the distance covered
+// within this number of epochs. A longer baseline reduces the heading noise,
+// but delays turns by up to the same time.
+#define COURSE_BASELINE   5 // epochs
+
+typedef struct {
+	int32_t pos_mm;   // relative to the reference point
+	int32_t vel_mmps;
+} axis_state_t;
+
+static bool     m_valid = false;
+static bool     m_restarted;    // the current epoch restarted the filter
+static bool     m_first_update; // no update was processed in this epoch yet
+static uint64_t m_last_time;
+static uint32_t m_dt_ms;        // time since the previous epoch
+
+// reference point of the local frame
+static float    m_ref_lat;
+static float    m_ref_lon;
+static float    m_lon_scale; // cos(m_ref_lat)
+
+// filter state and the prediction for the current epoch. The prediction is
+// kept because the receiver sends several sentences per epoch, but only the
+// GGA sentence carries the new position. The RMC sentence, which comes
+// first, still contains the position of the previous epoch. If the first
+// update of an epoch repeats the last position, only the prediction is
+// returned. Every later update of the same epoch repeats the correction
+// with its position, even if it did not change (static hold).
+static axis_state_t m_north, m_east;
+static axis_state_t m_pred_north, m_pred_east;
+
+// last position received from the GNSS module
+static float    m_meas_lat;
+static float    m_meas_lon;
+
+static float    m_heading;
+
+// measured positions of the last epochs, relative to the reference point
+static int32_t  m_track_north_mm[COURSE_BASELINE + 1];
+static int32_t  m_track_east_mm[COURSE_BASELINE + 1];
+static uint8_t  m_track_idx;   // entry of the current epoch
+static uint8_t  m_track_count; // number of valid entries
+
+
+static void set_reference(float lat, float lon)
+{
+	m_ref_lat = lat;
+	m_ref_lon = lon;
+	m_lon_scale = cosf(lat * (F_PI / 180.0f));
+}
+
+
+static int32_t lat_to_mm(float lat)
+{
+	return (int32_t)lroundf((lat - m_ref_lat) * MM_PER_DEGREE);
+}
+
+
+static int32_t lon_to_mm(float lon)
+{
+	return (int32_t)lroundf((lon - m_ref_lon) * (MM_PER_DEGREE * m_lon_scale));
+}
+
+
+static void restart(const nmea_data_t *data, uint64_t now)
+{
+	set_reference(data->lat, data->lon);
+
+	m_north.pos_mm = 0;
+	m_east.pos_mm = 0;
+
+	if(data->speed_heading_valid) {
+		float heading = data->heading * (F_PI / 180.0f);
+
+		m_north.vel_mmps = (int32_t)lroundf(data->speed * cosf(heading) * 1000.0f);
+		m_east.vel_mmps  = (int32_t)lroundf(data->speed * sinf(heading) * 1000.0f);
+		m_heading = data->heading;
+	} else {
+		m_north.vel_mmps = 0;
+		m_east.vel_mmps = 0;
+	}
+
+	m_meas_lat = data->lat;
+	m_meas_lon = data->lon;
+
+	m_track_idx = 0;
+	m_track_north_mm[0] = 0;
+	m_track_east_mm[0] = 0;
+	m_track_count = 1;
+
+	m_last_time = now;
+	m_restarted = true;
+	m_valid = true;
+}
+
+
+/**@brief Move the reference point to the current estimate if it is too far away.
+ */
+static void check_reference(void)
+{
+	if(m_north.pos_mm > MAX_OFFSET_MM || m_north.pos_mm < -MAX_OFFSET_MM
+			|| m_east.pos_mm > MAX_OFFSET_MM || m_east.pos_mm < -MAX_OFFSET_MM) {
+		set_reference(m_ref_lat + m_north.pos_mm / MM_PER_DEGREE,
+		              m_ref_lon + m_east.pos_mm / (MM_PER_DEGREE * m_lon_scale));
+
+		for(uint8_t i = 0; i <= COURSE_BASELINE; i++) {
+			m_track_north_mm[i] -= m_north.pos_mm;
+			m_track_east_mm[i] -= m_east.pos_mm;
+		}
+
+		m_north.pos_mm = 0;
+		m_east.pos_mm = 0;
+	}
+}
+
+
+static void predict(const axis_state_t *state, axis_state_t *pred, uint32_t dt_ms)
+{
+	pred->pos_mm = state->pos_mm + (int32_t)((int64_t)state->vel_mmps * dt_ms / 1000);
+	pred->vel_mmps = state->vel_mmps;
+}
+
+
+static void correct(const axis_state_t *pred, axis_state_t *state, int32_t meas_mm, uint32_t dt_ms)
+{
+	int64_t residual_mm = meas_mm - pred->pos_mm;
+
+	int32_t alpha = ALPHA_Q16;
+	int32_t beta = BETA_Q16;
+
+	if(residual_mm > MANEUVER_RESIDUAL_MM || residual_mm < -MANEUVER_RESIDUAL_MM) {
+		alpha = MANEUVER_ALPHA_Q16;
+		beta = MANEUVER_BETA_Q16;
+	}
+
+	state->pos_mm = pred->pos_mm + (int32_t)((residual_mm * alpha) >> 16);
+	state->vel_mmps = pred->vel_mmps + (int32_t)(((residual_mm * beta * 1000) >> 16) / dt_ms);
+}
+
+
+void gnss_filter_reset(void)
+{
+	m_valid = false;
+	m_heading = 0.0f;
+}
+
+
+void gnss_filter_update(nmea_data_t *data, uint64_t now)
+{
+	if(!data->pos_valid) {
+		return;
+	}
+
+	if(!m_valid || now < m_last_time || (now - m_last_time) > GNSS_FILTER_MAX_GAP_MS
+			|| (now == m_last_time && m_restarted)) {
+		restart(data, now);
+	} else {
+		if(now > m_last_time) {
+			// new epoch
+			check_reference();
+
+			m_dt_ms = now - m_last_time;
+			m_last_time = now;
+			m_restarted = false;
+
+			predict(&m_north, &m_pred_north, m_dt_ms);
+			predict(&m_east, &m_pred_east, m_dt_ms);
+
+			m_north = m_pred_north;
+			m_east = m_pred_east;
+
+			// the new epoch starts at the last measured position until its
+			// measurement arrives
+			uint8_t prev_idx = m_track_idx;
+
+			m_track_idx = (m_track_idx + 1) % (COURSE_BASELINE + 1);
+			m_track_north_mm[m_track_idx] = m_track_north_mm[prev_idx];
+			m_track_east_mm[m_track_idx] = m_track_east_mm[prev_idx];
+
+			if(m_track_count <= COURSE_BASELINE) {
+				m_track_count++;
+			}
+
+			m_first_update = true;
+		}
+
+		bool repeated = (data->lat == m_meas_lat) && (data->lon == m_meas_lon);
+
+		if(!repeated || !m_first_update) {
+			m_meas_lat = data->lat;
+			m_meas_lon = data->lon;
+
+			m_track_north_mm[m_track_idx] = lat_to_mm(data->lat);
+			m_track_east_mm[m_track_idx] = lon_to_mm(data->lon);
+
+			correct(&m_pred_north, &m_north, m_track_north_mm[m_track_idx], m_dt_ms);
+			correct(&m_pred_east, &m_east, m_track_east_mm[m_track_idx], m_dt_ms);
+		}
+
+		m_first_update = false;
+	}
+
+	float vel_n = m_north.vel_mmps / 1000.0f;
+	float vel_e = m_east.vel_mmps / 1000.0f;
+	float speed = sqrtf(vel_n * vel_n + vel_e * vel_e);
+
+	data->lat = m_ref_lat + m_north.pos_mm / MM_PER_DEGREE;
+	data->lon = m_ref_lon + m_east.pos_mm / (MM_PER_DEGREE * m_lon_scale);
+
+	if(speed >= GNSS_FILTER_WALK_SPEED && data->speed_heading_valid) {
+		// moving fast: the receiver's speed and course follow turns without
+		// the delay of the filter
+		m_heading = data->heading;
+		return;
+	}
+
+	if(speed >= GNSS_FILTER_SLOW_SPEED) {
+		float dir_n = vel_n;
+		float dir_e = vel_e;
+
+		if(m_track_count > COURSE_BASELINE) {
+			// walking: the course over the baseline averages the heading noise,
+			// but follows a turn faster than the filtered velocity
+			uint8_t oldest_idx = (m_track_idx + 1) % (COURSE_BASELINE + 1);
+
+			dir_n = (float)(m_track_north_mm[m_track_idx] - m_track_north_mm[oldest_idx]);
+			dir_e = (float)(m_track_east_mm[m_track_idx] - m_track_east_mm[oldest_idx]);
+		}
+
+		m_heading = atan2f(dir_e, dir_n) * (180.0f / F_PI);
+
+		if(m_heading < 0.0f) {
+			m_heading += 360.0f;
+		}
+	}
+
+	data->speed = speed;
+	data->heading = m_heading;
+	data->speed_heading_valid = true;
+}
@@ -0,0 +1,90 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef GNSS_FILTER_H
+#define GNSS_FILTER_H
+
+/**@file
+ *
+ * @brief Smoothing filter for GNSS position, speed and heading.
+ *
+ * @details
+ * A stationary device seems to move by a few meters per second in random
+ * directions because of position noise. This triggers tracker decisions that
+ * are not caused by any real movement.
+ *
+ * This module runs an alpha-beta filter on the position and the velocity in
+ * a local north/east frame. The filter state is kept in fixed-point
+ * (millimeters and millimeters per second), relative to a reference point
+ * that is moved along with the device. The position is always replaced by the
+ * filtered one. Below @ref GNSS_FILTER_SLOW_SPEED, speed is derived from the
+ * filtered velocity and the last heading is kept, as the direction of the
+ * velocity is mostly noise there. Up to @ref GNSS_FILTER_WALK_SPEED, the
+ * heading is the course over the last few measured positions, which follows
+ * turns faster than the filtered velocity. Above, the receiver's speed and
+ * heading are kept, because the heading noise is small compared to the speed
+ * and the turn checks need the receiver's low delay.
+ *
+ * The filter is restarted from the receiver data after a gap of more than
+ * @ref GNSS_FILTER_MAX_GAP_MS, e.g. after GNSS standby.
+ *
+ * Like gnss_sched, this module does not depend on any SDK functionality, so
+ * it can be tested on the host.
+ */
+
+#include <stdint.h>
+
+#include "nmea.h"
+
+// the filter restarts if no position was received for this time
+#define GNSS_FILTER_MAX_GAP_MS          5000 // milliseconds
+
+// below this filtered speed, the heading is not updated.
+#define GNSS_FILTER_SLOW_SPEED          1.0f // meters per second
+
+// up to this filtered speed, speed and heading are taken from the filter. This
+// covers walking, where the tracker already checks for turns. Above, the
+// receiver's values are passed through.
+#define GNSS_FILTER_WALK_SPEED          3.0f // meters per second
+
+/**@brief Reset the filter.
+ * @details
+ * The next valid position restarts the filter.
+ */
+void gnss_filter_reset(void);
+
+/**@brief Process a new position and replace it by the filtered estimate.
+ * @details
+ * Latitude and longitude in the given data are replaced, speed and heading
+ * only below @ref GNSS_FILTER_WALK_SPEED or if the receiver did not provide
+ * them. All other fields are not modified. Data without a valid position is not
+ * processed and left unchanged.
+ *
+ * @param[inout] data   Latest NMEA data from the GNSS module.
+ * @param[in]    now    The current time in milliseconds.
+ */
+void gnss_filter_update(nmea_data_t *data, uint64_t now);
+
+#endif // GNSS_FILTER_H
@@ -0,0 +1,202 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "utils.h"
+
+#include "gnss_sched.h"
+
+// the device is considered stationary if it stays within this radius…
+#define STATIONARY_RADIUS_M           30.0f // meters
+
+// …does not move faster than this…
+#define STATIONARY_MAX_SPEED           0.7f // meters per second
+
+// …for at least this amount of time.
+#define STATIONARY_DETECT_MS        120000 // milliseconds
+
+// after waking up, wait this long after the first valid fix before deciding
+// again. This gives the receiver time to refine the position.
+#define WAKEUP_SETTLE_MS              5000 // milliseconds
+
+// wake up the GNSS module this long before the next transmission is due. This
+// includes the hot-start time-to-first-fix and some margin.
+#define HOT_START_LEAD_MS            30000 // milliseconds
+
+// do not enter standby for shorter periods than this. Switching states has
+// some overhead and the following hot start costs energy as well.
+#define MIN_STANDBY_MS               60000 // milliseconds
+
+// the module finishes the output of the current second after the standby
+// command. Data received within this time after entering standby is ignored.
+#define STANDBY_GUARD_MS              1000 // milliseconds
+
+// never stay in standby longer than this, so movement is detected in time.
+// This is well below the limit where the receiver falls back to a warm start.
+#define MAX_STANDBY_MS              600000 // milliseconds
+
+static gnss_sched_state_t m_state;
+
+static float    m_anchor_lat;
+static float    m_anchor_lon;
+static uint64_t m_anchor_time;
+static bool     m_anchor_valid;
+
+// set after a wakeup while the device was stationary before
+static bool     m_resume_stationary;
+
+static uint64_t m_first_fix_time;
+static uint64_t m_standby_start;
+static uint32_t m_standby_duration;
+static uint64_t m_total_standby_time;
+
+
+static void set_anchor(const nmea_data_t *data, uint64_t now)
+{
+	m_anchor_lat = data->lat;
+	m_anchor_lon = data->lon;
+	m_anchor_time = now;
+	m_anchor_valid = true;
+}
+
+
+static void leave_standby(uint64_t now)
+{
+	uint64_t standby_time = now - m_standby_start;
+
+	// the module may wake up a bit later than requested, but never count more
+	// than the requested duration as standby time.
+	if(standby_time > m_standby_duration) {
+		standby_time = m_standby_duration;
+	}
+
+	m_total_standby_time += standby_time;
+
+	m_state = GNSS_SCHED_STATE_ACQUIRING;
+}
+
+
+void gnss_sched_reset(uint64_t now)
+{
+	m_state = GNSS_SCHED_STATE_ACQUIRING;
+	m_anchor_valid = false;
+	m_anchor_time = now;
+	m_resume_stationary = false;
+}
+
+
+uint32_t gnss_sched_update(const nmea_data_t *data, uint64_t now, uint64_t next_tx_due)
+{
+	if(m_state == GNSS_SCHED_STATE_STANDBY) {
+		if((now - m_standby_start) < STANDBY_GUARD_MS) {
+			// remaining output of the second in which standby was entered
+			return 0;
+		}
+
+		// the module woke up on its own
+		leave_standby(now);
+	}
+
+	if(!data->pos_valid) {
+		// without a position, nothing can be decided
+		m_state = GNSS_SCHED_STATE_ACQUIRING;
+		return 0;
+	}
+
+	if(m_state == GNSS_SCHED_STATE_ACQUIRING) {
+		m_state = GNSS_SCHED_STATE_TRACKING;
+		m_first_fix_time = now;
+	}
+
+	bool moving = data->speed_heading_valid && (data->speed > STATIONARY_MAX_SPEED);
+
+	if(!moving && m_anchor_valid) {
+		float distance = great_circle_distance_m(
+				data->lat, data->lon,
+				m_anchor_lat, m_anchor_lon);
+
+		moving = (distance > STATIONARY_RADIUS_M);
+	}
+
+	if(moving || !m_anchor_valid) {
+		// movement detected: start over
+		set_anchor(data, now);
+		m_resume_stationary = false;
+		return 0;
+	}
+
+	if((now - m_first_fix_time) < WAKEUP_SETTLE_MS) {
+		return 0;
+	}
+
+	if(!m_resume_stationary && ((now - m_anchor_time) < STATIONARY_DETECT_MS)) {
+		return 0;
+	}
+
+	// the device is stationary. Determine how long the GNSS may sleep.
+	if(next_tx_due < now + HOT_START_LEAD_MS + MIN_STANDBY_MS) {
+		return 0;
+	}
+
+	uint64_t standby_ms = next_tx_due - HOT_START_LEAD_MS - now;
+
+	if(standby_ms > MAX_STANDBY_MS) {
+		standby_ms = MAX_STANDBY_MS;
+	}
+
+	m_state = GNSS_SCHED_STATE_STANDBY;
+	m_standby_start = now;
+	m_standby_duration = (uint32_t)standby_ms;
+
+	// after wakeup, a single fix near the anchor is sufficient to go back to
+	// standby.
+	m_resume_stationary = true;
+
+	return m_standby_duration;
+}
+
+
+void gnss_sched_wakeup(uint64_t now)
+{
+	if(m_state == GNSS_SCHED_STATE_STANDBY) {
+		leave_standby(now);
+	}
+
+	// an external wakeup usually means that something changed, so stationary
+	// detection starts over.
+	m_resume_stationary = false;
+	m_anchor_valid = false;
+}
+
+
+gnss_sched_state_t gnss_sched_get_state(void)
+{
+	return m_state;
+}
+
+
+uint64_t gnss_sched_get_total_standby_time(void)
+{
+	return m_total_standby_time;
+}
@@ -0,0 +1,102 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef GNSS_SCHED_H
+#define GNSS_SCHED_H
+
+/**@file
+ *
+ * @brief GNSS duty-cycle scheduler.
+ *
+ * @details
+ * While the tracker is active and the device does not move, the GNSS module
+ * would stream positions continuously although the tracker will not transmit
+ * before the next forced beacon is due. This module detects such stationary
+ * periods and decides how long the GNSS module may be put into standby. The
+ * standby period ends early enough before the next transmission so the
+ * module can get a hot-start fix in time.
+ *
+ * This module only makes decisions. Switching the GNSS module is done by the
+ * caller. It does not depend on any SDK functionality, so it can be tested on
+ * the host.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nmea.h"
+
+typedef enum {
+	GNSS_SCHED_STATE_ACQUIRING, //!< GNSS is on and waits for a valid fix.
+	GNSS_SCHED_STATE_TRACKING,  //!< GNSS is on and has a valid fix.
+	GNSS_SCHED_STATE_STANDBY,   //!< GNSS was put into standby.
+} gnss_sched_state_t;
+
+/**@brief Reset the scheduler state.
+ * @details
+ * Call this whenever the GNSS module is (re-)started, for example when the
+ * tracker is enabled. Stationary detection starts over.
+ *
+ * @param now    The current time in milliseconds.
+ */
+void gnss_sched_reset(uint64_t now);
+
+/**@brief Process new GNSS data and decide whether to enter standby.
+ * @details
+ * Must be called after the tracker has processed the same data, so
+ * next_tx_due already reflects a transmission triggered by it.
+ *
+ * The module still sends the remaining sentences of the current second after
+ * the standby command. Such data is ignored and the scheduler stays in standby
+ * state. If data arrives later while the scheduler is in standby state, the
+ * module has woken up on its own and the scheduler switches back to
+ * acquisition.
+ *
+ * @param data          Latest NMEA data from the GNSS module.
+ * @param now           The current time in milliseconds.
+ * @param next_tx_due   Time (in milliseconds) at which the tracker will
+ *                      transmit the next time without any movement.
+ * @returns             The standby duration in milliseconds. 0 means that the
+ *                      GNSS module must stay active.
+ */
+uint32_t gnss_sched_update(const nmea_data_t *data, uint64_t now, uint64_t next_tx_due);
+
+/**@brief Notify the scheduler that the GNSS module was woken up externally.
+ *
+ * @param now    The current time in milliseconds.
+ */
+void gnss_sched_wakeup(uint64_t now);
+
+/**@brief Get the current scheduler state.
+ */
+gnss_sched_state_t gnss_sched_get_state(void);
+
+/**@brief Get the accumulated time the GNSS module spent in standby.
+ *
+ * @returns  The total standby time in milliseconds since startup.
+ */
+uint64_t gnss_sched_get_total_standby_time(void);
+
+#endif // GNSS_SCHED_H
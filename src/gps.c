@@ -22,6 +22,8 @@
  * SOFTWARE.
  */
 
+#include <stdio.h>
+
 #include <nrfx_uarte.h>
 #include <nrf_gpio.h>
 
@@ -35,7 +37,11 @@ NRF_LOG_MODULE_REGISTER();
 
 #include "pinout.h"
 #include "periph_pwr.h"
+#include "event_queue.h"
 #include "nmea.h"
+#include "energy.h"
+#include "time_base.h"
+#include "profiling.h"
 
 #include "gps.h"
 
@@ -52,6 +58,10 @@ typedef enum {
 #define GPS_RESET_MS_WAIT2    3000  // boot time after reset
 #define GPS_RESET_MS_WAIT3    1000  // time between configuration and power-off
 
+// the module finishes the output of the current second after the standby
+// command. Sentences received within this time do not end the standby.
+#define GPS_STANDBY_GUARD_MS  1000
+
 
 static nrfx_uarte_t m_uarte = NRFX_UARTE_INSTANCE(0);
 
@@ -74,6 +84,43 @@ static nmea_data_t m_nmea_data;
 static gps_reset_state_t m_reset_state;
 
 static bool m_is_powered;
+static bool m_is_standby;
+static uint64_t m_standby_start;
+
+static uint8_t m_cmd_buffer[32];
+
+/**@brief Send a CASIC command to the GNSS module.
+ * @details
+ * The leading '$' and the trailing checksum are added by this function.
+ *
+ * @param body   The command and its arguments, e.g. "PCAS12,60".
+ */
+static ret_code_t send_casic_command(const char *body)
+{
+	uint8_t checksum = 0;
+
+	for(const char *c = body; *c; c++) {
+		checksum ^= (uint8_t)*c;
+	}
+
+	int len = snprintf((char*)m_cmd_buffer, sizeof(m_cmd_buffer), "$%s*%02X\r\n", body, checksum);
+
+	if(len < 0 || len >= (int)sizeof(m_cmd_buffer)) {
+		return NRF_ERROR_NO_MEM;
+	}
+
+	return nrfx_uarte_tx(&m_uarte, m_cmd_buffer, len);
+}
+
+/**@brief Update the standby state and inform the energy accounting on changes.
+ */
+static void set_standby(bool standby)
+{
+	if(standby != m_is_standby) {
+		m_is_standby = standby;
+		energy_set_gps_standby(time_base_get(), standby);
+	}
+}
 
 static void cb_uarte(nrfx_uarte_event_t const * p_event, void *p_context)
 {
@@ -91,6 +138,7 @@ static void cb_uarte(nrfx_uarte_event_t const * p_event, void *p_context)
 			if((rx_byte == '\n') || (m_rx_buffer_used[m_rx_buffer_idx] >= RX_BUF_SIZE)) {
 				m_rx_buffer_complete_idx = m_rx_buffer_idx;
 				m_rx_buffer_complete = true;
+				event_queue_post(EVENT_GPS_SENTENCE);
 
 				m_rx_buffer_idx = (m_rx_buffer_idx + 1) % 2;
 				m_rx_buffer_used[m_rx_buffer_idx] = 0;
@@ -183,18 +231,57 @@ void cb_gps_reset_timer(void *p_context)
 }
 
 
+static void handle_sentence(void)
+{
+	if(m_rx_buffer_complete) {
+		m_rx_buffer_complete = false;
+
+		uint8_t len = m_rx_buffer_used[m_rx_buffer_complete_idx];
+		uint8_t *buf = m_rx_buffer[m_rx_buffer_complete_idx];
+
+		// ensure that the buffer is safe to print
+		if(len >= RX_BUF_SIZE) {
+			len = RX_BUF_SIZE - 1;
+		}
+
+		buf[len] = '\0';
+
+		//NRF_LOG_INFO("received sentence: %s", NRF_LOG_PUSH((char*)buf));
+
+		// the module only sends data when it is awake, except for the rest of
+		// the second in which the standby command was sent
+		if(m_is_standby && (time_base_get() - m_standby_start) >= GPS_STANDBY_GUARD_MS) {
+			set_standby(false);
+		}
+
+		bool pos_updated = false;
+
+		uint32_t prof_start = profiling_start();
+		nmea_parse((char*)buf, &pos_updated, &m_nmea_data);
+		profiling_end(PROFILING_SPAN_NMEA_PARSE, prof_start);
+
+		if(pos_updated) {
+			m_callback(GPS_EVT_DATA_RECEIVED, &m_nmea_data);
+		}
+	}
+}
+
+
 ret_code_t gps_init(gps_callback_t callback)
 {
 	ret_code_t err_code;
 
 	m_callback = callback;
 
+	event_queue_register(EVENT_GPS_SENTENCE, handle_sentence);
+
 	gps_config_gpios(false);
 
 	err_code = app_timer_create(&m_gps_reset_timer, APP_TIMER_MODE_SINGLE_SHOT, cb_gps_reset_timer);
 	VERIFY_SUCCESS(err_code);
 
 	m_is_powered = false;
+	m_is_standby = false;
 
 	NRF_LOG_DEBUG("initialized.");
 
@@ -275,6 +362,7 @@ ret_code_t gps_power_off(void)
 	ret_code_t err_code;
 
 	m_is_powered = false;
+	set_standby(false);
 
 	nrfx_uarte_rx_abort(&m_uarte);
 	nrfx_uarte_uninit(&m_uarte);
@@ -288,39 +376,67 @@ ret_code_t gps_power_off(void)
 }
 
 
-void gps_loop(void)
+ret_code_t gps_cold_restart(void)
 {
-	if(m_rx_buffer_complete) {
-		m_rx_buffer_complete = false;
+	if(!m_is_powered) {
+		return NRF_ERROR_INVALID_STATE;
+	}
 
-		uint8_t len = m_rx_buffer_used[m_rx_buffer_complete_idx];
-		uint8_t *buf = m_rx_buffer[m_rx_buffer_complete_idx];
+	static uint8_t cmd[] = "$PCAS10,2*1E\r\n"; // cold restart (forget everything except configuration)
+	return nrfx_uarte_tx(&m_uarte, cmd, strlen((const char*)cmd));
+}
 
-		// ensure that the buffer is safe to print
-		if(len >= RX_BUF_SIZE) {
-			len = RX_BUF_SIZE - 1;
-		}
 
-		buf[len] = '\0';
+ret_code_t gps_standby(uint32_t duration_ms)
+{
+	char body[20];
 
-		//NRF_LOG_INFO("received sentence: %s", NRF_LOG_PUSH((char*)buf));
+	if(!m_is_powered) {
+		return NRF_ERROR_INVALID_STATE;
+	}
 
-		bool pos_updated = false;
-		nmea_parse((char*)buf, &pos_updated, &m_nmea_data);
+	uint32_t duration_s = duration_ms / 1000;
 
-		if(pos_updated) {
-			m_callback(GPS_EVT_DATA_RECEIVED, &m_nmea_data);
-		}
+	if(duration_s == 0) {
+		return NRF_ERROR_INVALID_PARAM;
 	}
+
+	snprintf(body, sizeof(body), "PCAS12,%lu", duration_s);
+
+	VERIFY_SUCCESS(send_casic_command(body));
+
+	NRF_LOG_INFO("entering standby for %u seconds", duration_s);
+
+	m_standby_start = time_base_get();
+	set_standby(true);
+
+	return NRF_SUCCESS;
 }
 
 
-ret_code_t gps_cold_restart(void)
+ret_code_t gps_wakeup(void)
 {
 	if(!m_is_powered) {
 		return NRF_ERROR_INVALID_STATE;
 	}
 
-	static uint8_t cmd[] = "$PCAS10,2*1E\r\n"; // cold restart (forget everything except configuration)
-	return nrfx_uarte_tx(&m_uarte, cmd, strlen((const char*)cmd));
+	if(!m_is_standby) {
+		return NRF_SUCCESS;
+	}
+
+	NRF_LOG_INFO("waking up from standby");
+
+	// any incoming UART data wakes the module. A hot start command is used
+	// because it does not discard any data.
+	VERIFY_SUCCESS(send_casic_command("PCAS10,0"));
+
+	set_standby(false);
+
+	return NRF_SUCCESS;
+}
+
+
+bool gps_is_standby(void)
+{
+	return m_is_standby;
 }
@@ -40,8 +40,6 @@ typedef void (* gps_callback_t)(gps_evt_t evt, const nmea_data_t *data);
 
 ret_code_t gps_init(gps_callback_t callback);
 
-void gps_loop(void);
-
 void gps_config_gpios(bool power_supplied);
 
 ret_code_t gps_reset(void);
@@ -51,4 +49,25 @@ ret_code_t gps_power_off(void);
 
 ret_code_t gps_cold_restart(void);
 
+/**@brief Put the GNSS module into standby mode.
+ * @details
+ * Satellite data is retained in standby, so the module can get a hot-start fix
+ * after wakeup. The module wakes up on its own after the given duration or
+ * when @ref gps_wakeup() is called.
+ *
+ * @param duration_ms   Standby duration in milliseconds. Resolution is 1 s.
+ * @retval NRF_ERROR_INVALID_STATE   The module is not powered.
+ * @retval NRF_ERROR_INVALID_PARAM   The duration is shorter than 1 second.
+ * @returns                          Otherwise, the result of the UART transfer.
+ */
+ret_code_t gps_standby(uint32_t duration_ms);
+
+/**@brief Wake up the GNSS module from standby mode before the timeout.
+ */
+ret_code_t gps_wakeup(void);
+
+/**@brief Check whether the GNSS module is in standby mode.
+ */
+bool gps_is_standby(void);
+
 #endif // GPS_H
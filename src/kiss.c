@@ -0,0 +1,186 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "kiss.h"
+
+typedef enum {
+	ENCODER_IDLE,
+	ENCODER_START,
+	ENCODER_BODY,
+	ENCODER_END
+} encoder_state_t;
+
+
+void kiss_decoder_init(kiss_decoder_t *decoder)
+{
+	decoder->len = 0;
+	decoder->in_frame = false;
+	decoder->escape = false;
+	decoder->invalid = false;
+	decoder->frames = 0;
+	decoder->errors = 0;
+}
+
+
+static void end_frame(kiss_decoder_t *decoder, kiss_frame_callback_t callback, void *context)
+{
+	if(decoder->invalid || decoder->escape) {
+		decoder->errors++;
+	} else if(decoder->len > 0) {
+		decoder->frames++;
+		callback(decoder->buf[0] >> 4, decoder->buf[0] & 0x0F,
+				decoder->buf + 1, decoder->len - 1, context);
+	}
+
+	// FEND also starts the next frame
+	decoder->len = 0;
+	decoder->in_frame = true;
+	decoder->escape = false;
+	decoder->invalid = false;
+}
+
+
+void kiss_decoder_feed(kiss_decoder_t *decoder, const uint8_t *data, size_t len,
+		kiss_frame_callback_t callback, void *context)
+{
+	for(size_t i = 0; i < len; i++) {
+		uint8_t byte = data[i];
+
+		if(byte == KISS_FEND) {
+			end_frame(decoder, callback, context);
+			continue;
+		}
+
+		if(!decoder->in_frame || decoder->invalid) {
+			// garbage before the first FEND or the rest of a discarded frame
+			continue;
+		}
+
+		if(decoder->escape) {
+			decoder->escape = false;
+
+			if(byte == KISS_TFEND) {
+				byte = KISS_FEND;
+			} else if(byte == KISS_TFESC) {
+				byte = KISS_FESC;
+			} else {
+				decoder->invalid = true;
+				continue;
+			}
+		} else if(byte == KISS_FESC) {
+			decoder->escape = true;
+			continue;
+		}
+
+		if(decoder->len >= sizeof(decoder->buf)) {
+			decoder->invalid = true;
+			continue;
+		}
+
+		decoder->buf[decoder->len++] = byte;
+	}
+}
+
+
+void kiss_encoder_init(kiss_encoder_t *encoder)
+{
+	encoder->data = NULL;
+	encoder->len = 0;
+	encoder->pos = 0;
+	encoder->state = ENCODER_IDLE;
+	encoder->pending = 0;
+}
+
+
+void kiss_encoder_start(kiss_encoder_t *encoder, uint8_t port, uint8_t command,
+		const uint8_t *data, size_t len)
+{
+	encoder->data = data;
+	encoder->len = len;
+	encoder->pos = 0;
+	encoder->header = (port << 4) | (command & 0x0F);
+	encoder->state = ENCODER_START;
+	encoder->pending = 0;
+}
+
+
+bool kiss_encoder_is_busy(const kiss_encoder_t *encoder)
+{
+	return encoder->state != ENCODER_IDLE;
+}
+
+
+size_t kiss_encoder_read(kiss_encoder_t *encoder, uint8_t *out, size_t max_len)
+{
+	size_t n = 0;
+
+	while(n < max_len && encoder->state != ENCODER_IDLE) {
+		if(encoder->pending) {
+			out[n++] = encoder->pending;
+			encoder->pending = 0;
+			continue;
+		}
+
+		switch(encoder->state) {
+			case ENCODER_START:
+				out[n++] = KISS_FEND;
+				encoder->state = ENCODER_BODY;
+				break;
+
+			case ENCODER_BODY:
+				{
+					if(encoder->pos > encoder->len) {
+						encoder->state = ENCODER_END;
+						break;
+					}
+
+					uint8_t byte = (encoder->pos == 0) ? encoder->header : encoder->data[encoder->pos - 1];
+					encoder->pos++;
+
+					if(byte == KISS_FEND) {
+						out[n++] = KISS_FESC;
+						encoder->pending = KISS_TFEND;
+					} else if(byte == KISS_FESC) {
+						out[n++] = KISS_FESC;
+						encoder->pending = KISS_TFESC;
+					} else {
+						out[n++] = byte;
+					}
+				}
+				break;
+
+			case ENCODER_END:
+				out[n++] = KISS_FEND;
+				encoder->state = ENCODER_IDLE;
+				break;
+
+			default:
+				encoder->state = ENCODER_IDLE;
+				break;
+		}
+	}
+
+	return n;
+}
@@ -0,0 +1,130 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef KISS_H
+#define KISS_H
+
+/**@file
+ *
+ * @brief Streaming KISS encoder and decoder.
+ *
+ * @details
+ * KISS frames are delimited by FEND bytes. FEND and FESC bytes inside a frame
+ * are replaced by two-byte escape sequences. The first byte of each frame
+ * contains the TNC port (upper nibble) and the command (lower nibble).
+ *
+ * Both the encoder and the decoder work on arbitrarily split data, so frames
+ * can be transferred in chunks of any size, for example in BLE notifications
+ * and writes.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define KISS_FEND   0xC0
+#define KISS_FESC   0xDB
+#define KISS_TFEND  0xDC
+#define KISS_TFESC  0xDD
+
+#define KISS_CMD_DATA  0x00
+
+// longest AX.25 frame: 10 addresses, control, PID and 256 bytes of information
+#define KISS_MAX_FRAME_LEN  (10 * 7 + 2 + 256)
+
+/**@brief Called by the decoder for each complete frame.
+ *
+ * @param port      The TNC port.
+ * @param command   The KISS command.
+ * @param data      The unescaped frame data without the command byte.
+ * @param len       The length of the frame data.
+ * @param context   The context pointer passed to @ref kiss_decoder_feed().
+ */
+typedef void (*kiss_frame_callback_t)(uint8_t port, uint8_t command, const uint8_t *data, size_t len, void *context);
+
+typedef struct {
+	uint8_t  buf[1 + KISS_MAX_FRAME_LEN];   //!< Command byte and frame data.
+	size_t   len;
+	bool     in_frame;                      //!< At least one FEND was received.
+	bool     escape;                        //!< The previous byte was FESC.
+	bool     invalid;                       //!< The current frame is discarded.
+
+	uint32_t frames;                        //!< Number of decoded frames.
+	uint32_t errors;                        //!< Frames discarded due to errors.
+} kiss_decoder_t;
+
+typedef struct {
+	const uint8_t *data;
+	size_t   len;
+	size_t   pos;        //!< Next byte to encode. 0 is the command byte.
+	uint8_t  header;     //!< The command byte.
+	uint8_t  state;
+	uint8_t  pending;    //!< Second byte of an escape sequence, 0 if none.
+} kiss_encoder_t;
+
+/**@brief Reset the decoder state and statistics.
+ */
+void kiss_decoder_init(kiss_decoder_t *decoder);
+
+/**@brief Decode received data.
+ * @details
+ * The callback is called for each frame that is completed by this data.
+ * Frames that are too long or contain invalid escape sequences are discarded.
+ *
+ * @param decoder    The decoder.
+ * @param data       The received data.
+ * @param len        The length of the data.
+ * @param callback   Function to call for each decoded frame.
+ * @param context    Passed to the callback.
+ */
+void kiss_decoder_feed(kiss_decoder_t *decoder, const uint8_t *data, size_t len,
+		kiss_frame_callback_t callback, void *context);
+
+/**@brief Reset the encoder to idle, discarding any frame in progress.
+ */
+void kiss_encoder_init(kiss_encoder_t *encoder);
+
+/**@brief Start encoding a frame.
+ * @details
+ * The data is not copied and must remain valid until
+ * @ref kiss_encoder_is_busy() returns false.
+ */
+void kiss_encoder_start(kiss_encoder_t *encoder, uint8_t port, uint8_t command,
+		const uint8_t *data, size_t len);
+
+/**@brief Check whether the encoder has more data to output.
+ */
+bool kiss_encoder_is_busy(const kiss_encoder_t *encoder);
+
+/**@brief Get the next part of the encoded frame.
+ *
+ * @param encoder    The encoder.
+ * @param out        Buffer for the encoded data.
+ * @param max_len    Maximum number of bytes to write.
+ * @returns          The number of bytes written. 0 once the frame is complete.
+ */
+size_t kiss_encoder_read(kiss_encoder_t *encoder, uint8_t *out, size_t max_len);
+
+#endif // KISS_H
@@ -0,0 +1,386 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ble_gap.h"
+#include "ble_gatt.h"
+#include "ble_gatts.h"
+#include "ble_types.h"
+#include "nrf_error.h"
+
+#define NRF_LOG_MODULE_NAME kiss_service
+#include <nrf_log.h>
+NRF_LOG_MODULE_REGISTER();
+
+#include "kiss_service.h"
+
+#include "ble_srv_common.h"
+#include "ble_conn_state.h"
+#include "nrf_sdh_ble.h"
+
+#include "airtime.h"
+#include "ble_notify.h"
+#include "event_queue.h"
+
+// header of LoRa APRS frames
+#define LORA_HEADER_LEN  3
+
+static bool has_lora_header(const uint8_t *frame, size_t len)
+{
+	return len > LORA_HEADER_LEN && frame[0] == '<' && frame[1] == 0xFF && frame[2] == 0x01;
+}
+
+
+/**@brief Handle a frame decoded from the data written by the client.
+ * @details
+ * Data frames are converted to TNC2 and queued for transmission. Other KISS
+ * commands (TX delay, persistence etc.) do not apply to LoRa and are ignored.
+ */
+static void cb_kiss_frame(uint8_t port, uint8_t command, const uint8_t *data, size_t len, void *context)
+{
+	kiss_service_t *p_srv = context;
+	uint8_t frame[NOTIFY_QUEUE_MAX_FRAME_LEN];
+
+	(void)port;
+
+	if(command != KISS_CMD_DATA) {
+		return;
+	}
+
+	size_t tnc2_len = ax25_to_tnc2(data, len, frame + LORA_HEADER_LEN, sizeof(frame) - LORA_HEADER_LEN);
+
+	if(tnc2_len == 0) {
+		NRF_LOG_WARNING("Invalid or too long AX.25 frame ignored.");
+		return;
+	}
+
+	frame[0] = '<';
+	frame[1] = 0xFF;
+	frame[2] = 0x01;
+
+	if(!notify_queue_push(&p_srv->tx_queue, frame, LORA_HEADER_LEN + tnc2_len)) {
+		NRF_LOG_WARNING("TX queue full, frame dropped.");
+		return;
+	}
+
+	kiss_service_evt_t evt;
+	evt.type = KISS_SERVICE_EVT_TX_FRAME;
+	p_srv->callback(&evt);
+}
+
+
+/**@brief Function for handling the Write event.
+ *
+ * @param[in] p_srv      Service structure.
+ * @param[in] p_ble_evt  Event received from the BLE stack.
+ */
+static void on_write(kiss_service_t * p_srv, ble_evt_t const * p_ble_evt)
+{
+	ble_gatts_evt_write_t const * p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+
+	if (p_evt_write->handle == p_srv->tx_char_handles.value_handle)
+	{
+		kiss_decoder_feed(&p_srv->decoder, p_evt_write->data, p_evt_write->len, cb_kiss_frame, p_srv);
+	}
+	else if (p_evt_write->handle == p_srv->rx_char_handles.cccd_handle && p_evt_write->len == 2)
+	{
+		p_srv->notify_enabled = ble_srv_is_notification_enabled(p_evt_write->data);
+
+		// the stream is started or discarded
+		event_queue_post(EVENT_BLE_KISS_NOTIFY);
+	}
+}
+
+
+/**@brief Handle BLE events.
+ * @details
+ * The actual event handling is distributed over event-specific functions.
+ */
+void kiss_service_on_ble_evt(ble_evt_t const * p_ble_evt, void * p_context)
+{
+	kiss_service_t * p_srv = (kiss_service_t *)p_context;
+
+	switch (p_ble_evt->header.evt_id)
+	{
+		case BLE_GATTS_EVT_WRITE:
+			on_write(p_srv, p_ble_evt);
+			break;
+
+		case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+			// the SoftDevice has space for new notifications
+			event_queue_post(EVENT_BLE_KISS_NOTIFY);
+			break;
+
+		case BLE_GAP_EVT_DISCONNECTED:
+			p_srv->max_notify_len = BLE_GATT_ATT_MTU_DEFAULT - BLE_NOTIFY_OVERHEAD;
+			p_srv->notify_enabled = false;
+
+			// a partially written frame must not be continued by the next client
+			kiss_decoder_init(&p_srv->decoder);
+
+			// discard the queued frames
+			event_queue_post(EVENT_BLE_KISS_NOTIFY);
+			break;
+
+		default:
+			// No implementation needed.
+			break;
+	}
+}
+
+
+static void fill_user_desc(ble_add_char_user_desc_t *user_desc, const char *str)
+{
+	memset(user_desc, 0, sizeof(ble_add_char_user_desc_t));
+	user_desc->is_var_len       = 0;
+	user_desc->char_props.read  = 1;
+	user_desc->size             = strlen((char*)str);
+	user_desc->max_size         = user_desc->size;
+	user_desc->p_char_user_desc = (uint8_t*)str;
+	user_desc->is_value_user    = 0;
+	user_desc->read_access      = SEC_OPEN;
+	user_desc->write_access     = SEC_NO_ACCESS;
+}
+
+
+uint32_t kiss_service_init(kiss_service_t * p_srv, const kiss_service_init_t * p_srv_init)
+{
+	uint32_t                 err_code;
+	ble_uuid_t               ble_uuid;
+	ble_add_char_params_t    add_char_params;
+	ble_add_char_user_desc_t add_user_desc;
+
+	// Initialize service structure.
+	p_srv->callback  = p_srv_init->callback;
+	p_srv->max_notify_len = BLE_GATT_ATT_MTU_DEFAULT - BLE_NOTIFY_OVERHEAD;
+	p_srv->notify_enabled = false;
+	p_srv->chunk_len = 0;
+
+	notify_queue_init(&p_srv->rx_queue);
+	notify_queue_init(&p_srv->tx_queue);
+	p_srv->tx_retry_time = 0;
+	kiss_encoder_init(&p_srv->encoder);
+	kiss_decoder_init(&p_srv->decoder);
+
+	// Add service.
+	ble_uuid128_t base_uuid = {KISS_SERVICE_UUID_BASE};
+	err_code = sd_ble_uuid_vs_add(&base_uuid, &p_srv->uuid_type);
+	VERIFY_SUCCESS(err_code);
+
+	ble_uuid.type = p_srv->uuid_type;
+	ble_uuid.uuid = KISS_SERVICE_UUID_SERVICE;
+
+	err_code = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY, &ble_uuid, &p_srv->service_handle);
+	VERIFY_SUCCESS(err_code);
+
+	/* Add TX characteristic. Transmitting requires pairing, like the TX Message of the APRS Service. */
+	memset(&add_char_params, 0, sizeof(add_char_params));
+	add_char_params.uuid              = KISS_SERVICE_UUID_TX;
+	add_char_params.uuid_type         = p_srv->uuid_type;
+	add_char_params.init_len          = 0;
+	add_char_params.max_len           = KISS_SERVICE_MAX_CHUNK_LEN;
+	add_char_params.is_var_len        = 1;
+	add_char_params.p_init_value      = NULL;
+	add_char_params.char_props.read   = 0;
+	add_char_params.char_props.write  = 1;
+	add_char_params.char_props.write_wo_resp = 1;
+
+	add_char_params.write_access      = SEC_MITM;
+
+	fill_user_desc(&add_user_desc, "KISS TX");
+	add_char_params.p_user_descr = &add_user_desc;
+
+	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->tx_char_handles);
+	VERIFY_SUCCESS(err_code);
+
+	/* Add RX characteristic. */
+	memset(&add_char_params, 0, sizeof(add_char_params));
+	add_char_params.uuid              = KISS_SERVICE_UUID_RX;
+	add_char_params.uuid_type         = p_srv->uuid_type;
+	add_char_params.init_len          = 0;
+	add_char_params.max_len           = KISS_SERVICE_MAX_CHUNK_LEN;
+	add_char_params.is_var_len        = 1;
+	add_char_params.char_props.read   = 0;
+	add_char_params.char_props.notify = 1;
+
+	add_char_params.cccd_write_access = SEC_OPEN;
+
+	fill_user_desc(&add_user_desc, "KISS RX");
+	add_char_params.p_user_descr = &add_user_desc;
+
+	err_code = characteristic_add(p_srv->service_handle, &add_char_params, &p_srv->rx_char_handles);
+	VERIFY_SUCCESS(err_code);
+
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t kiss_service_notify_rx_frame(kiss_service_t * p_srv, const uint8_t *p_frame, uint8_t frame_len)
+{
+	if(!p_srv->notify_enabled) {
+		// no client is listening
+		return NRF_SUCCESS;
+	}
+
+	if(!notify_queue_push(&p_srv->rx_queue, p_frame, frame_len)) {
+		return NRF_ERROR_NO_MEM;
+	}
+
+	event_queue_post(EVENT_BLE_KISS_NOTIFY);
+	return NRF_SUCCESS;
+}
+
+
+/**@brief Start encoding the next queued frame.
+ * @details
+ * Frames that cannot be represented in AX.25 (for example because of
+ * non-standard call signs) are skipped.
+ *
+ * @returns  True if a frame was started, false if the queue is empty.
+ */
+static bool start_next_frame(kiss_service_t * p_srv)
+{
+	uint8_t  frame[NOTIFY_QUEUE_MAX_FRAME_LEN];
+	uint32_t frames;
+	size_t   len;
+
+	while((len = notify_queue_build(&p_srv->rx_queue, frame, sizeof(frame), false, &frames)) > 0) {
+		notify_queue_pop(&p_srv->rx_queue, frames);
+
+		if(has_lora_header(frame, len)) {
+			size_t ax25_len = ax25_from_tnc2(frame + LORA_HEADER_LEN, len - LORA_HEADER_LEN,
+					p_srv->ax25_frame, sizeof(p_srv->ax25_frame));
+
+			if(ax25_len > 0) {
+				kiss_encoder_start(&p_srv->encoder, 0, KISS_CMD_DATA, p_srv->ax25_frame, ax25_len);
+				return true;
+			}
+		}
+
+		NRF_LOG_INFO("Frame without AX.25 representation skipped.");
+	}
+
+	return false;
+}
+
+
+void kiss_service_send_notifications(kiss_service_t * p_srv, uint16_t conn_handle)
+{
+	if(ble_conn_state_status(conn_handle) != BLE_CONN_STATUS_CONNECTED || !p_srv->notify_enabled) {
+		notify_queue_clear(&p_srv->rx_queue);
+		kiss_encoder_init(&p_srv->encoder);
+		p_srv->chunk_len = 0;
+		return;
+	}
+
+	size_t max_len = p_srv->max_notify_len;
+
+	if(max_len > sizeof(p_srv->chunk)) {
+		max_len = sizeof(p_srv->chunk);
+	}
+
+	for(;;) {
+		// fill the notification, possibly with several frames
+		while(p_srv->chunk_len < max_len) {
+			if(!kiss_encoder_is_busy(&p_srv->encoder) && !start_next_frame(p_srv)) {
+				break;
+			}
+
+			p_srv->chunk_len += kiss_encoder_read(&p_srv->encoder,
+					p_srv->chunk + p_srv->chunk_len, max_len - p_srv->chunk_len);
+		}
+
+		if(p_srv->chunk_len == 0) {
+			return;
+		}
+
+		uint16_t hvx_len = p_srv->chunk_len;
+		ble_gatts_hvx_params_t params;
+
+		memset(&params, 0, sizeof(params));
+		params.type   = BLE_GATT_HVX_NOTIFICATION;
+		params.handle = p_srv->rx_char_handles.value_handle;
+		params.p_data = p_srv->chunk;
+		params.p_len  = &hvx_len;
+
+		ret_code_t err_code = sd_ble_gatts_hvx(conn_handle, &params);
+
+		if(err_code == NRF_ERROR_RESOURCES) {
+			// the chunk is kept and retried after BLE_GATTS_EVT_HVN_TX_COMPLETE
+			return;
+		}
+
+		p_srv->chunk_len = 0;
+
+		if(err_code != NRF_SUCCESS) {
+			// the stream is broken: restart with the next frame
+			NRF_LOG_WARNING("KISS notification failed: 0x%08x", err_code);
+
+			notify_queue_clear(&p_srv->rx_queue);
+			kiss_encoder_init(&p_srv->encoder);
+			return;
+		}
+	}
+}
+
+
+bool kiss_service_get_tx_frame(kiss_service_t * p_srv, uint64_t now, uint8_t *p_frame, uint8_t *p_len)
+{
+	if(now < p_srv->tx_retry_time) {
+		return false;
+	}
+
+	uint32_t frames;
+	size_t len = notify_queue_build(&p_srv->tx_queue, p_frame, NOTIFY_QUEUE_MAX_FRAME_LEN, false, &frames);
+
+	if(len == 0) {
+		return false;
+	}
+
+	// the frame stays queued until it fits into the airtime budget
+	if(!airtime_is_available(now, (uint32_t)airtime_calc_toa_ms(len))) {
+		p_srv->tx_retry_time = now + KISS_SERVICE_AIRTIME_DELAY_MS;
+		return false;
+	}
+
+	notify_queue_pop(&p_srv->tx_queue, frames);
+
+	*p_len = len;
+	return true;
+}
+
+
+uint64_t kiss_service_get_next_tx_time(const kiss_service_t * p_srv)
+{
+	if(notify_queue_count(&p_srv->tx_queue) == 0) {
+		return UINT64_MAX;
+	}
+
+	return p_srv->tx_retry_time;
+}
+
+
+void kiss_service_set_att_mtu(kiss_service_t * p_srv, uint16_t att_mtu)
+{
+	p_srv->max_notify_len = att_mtu - BLE_NOTIFY_OVERHEAD;
+}
@@ -0,0 +1,219 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ *
+ * @defgroup kiss_service KISS TNC Service Server
+ * @{
+ * @ingroup ble_sdk_srv
+ *
+ * @brief KISS TNC Service Server module.
+ *
+ * @details This module implements a KISS TNC over BLE, as used by APRS apps
+ *          on phones. Received LoRa frames are converted to AX.25 and sent to
+ *          the client as a KISS stream in notifications. KISS frames written
+ *          by the client are converted to the TNC2 format used on LoRa and
+ *          transmitted.
+ *
+ *          KISS frames are not aligned to notifications or writes: a frame
+ *          may be split over several of them and one notification may contain
+ *          the end of one frame and the beginning of the next.
+ */
+
+#ifndef KISS_SERVICE_H__
+#define KISS_SERVICE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble.h"
+
+#include "ax25.h"
+#include "kiss.h"
+#include "notify_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@brief   Macro for defining a kiss_service instance.
+ *
+ * @param   _name   Name of the instance.
+ * @hideinitializer
+ */
+#define KISS_SERVICE_DEF(_name)                                                                          \
+static kiss_service_t _name;                                                                             \
+NRF_SDH_BLE_OBSERVER(_name ## _obs,                                                             \
+                     APP_BLE_OBSERVER_PRIO,                                                     \
+                     kiss_service_on_ble_evt, &_name)
+
+// 00000001-ba2a-46c9-ae49-01b0961f68bb, as used by other KISS TNCs with BLE
+#define KISS_SERVICE_UUID_BASE               { 0xbb, 0x68, 0x1f, 0x96, 0xb0, 0x01, 0x49, 0xae, \
+                                               0xc9, 0x46, 0x2a, 0xba, 0x00, 0x00, 0x00, 0x00}
+#define KISS_SERVICE_UUID_SERVICE            0x0001
+#define KISS_SERVICE_UUID_TX                 0x0002      // KISS data from the client
+#define KISS_SERVICE_UUID_RX                 0x0003      // KISS data to the client
+
+// maximum length of a write or notification (ATT MTU 247)
+#define KISS_SERVICE_MAX_CHUNK_LEN  244
+
+// retry interval for a frame that does not fit into the airtime budget
+#define KISS_SERVICE_AIRTIME_DELAY_MS  5000 // milliseconds
+
+// Forward declaration of the kiss_service_t type.
+typedef struct kiss_service_s kiss_service_t;
+
+typedef enum {
+	KISS_SERVICE_EVT_TX_FRAME,   //!< A frame was queued for transmission.
+} kiss_service_evt_type_t;
+
+typedef struct {
+	kiss_service_evt_type_t type;
+} kiss_service_evt_t;
+
+/**@brief Callback function type.
+ * @details
+ * Called from the BLE event handler, which may run in interrupt context.
+ *
+ * @param evt       The event.
+ */
+typedef void (*kiss_service_callback_t)(kiss_service_evt_t *evt);
+
+/** @brief Service init structure. This structure contains all options and data needed for
+ *         initialization of the service.*/
+typedef struct
+{
+	kiss_service_callback_t callback; /**< Pointer to the callback function */
+} kiss_service_init_t;
+
+/**@brief Service structure. This structure contains the service's internal state. */
+struct kiss_service_s
+{
+	uint16_t                    service_handle;               /**< Handle of Service (as provided by the BLE stack). */
+	ble_gatts_char_handles_t    tx_char_handles;              /**< Handles related to the TX Characteristic. */
+	ble_gatts_char_handles_t    rx_char_handles;              /**< Handles related to the RX Characteristic. */
+	uint8_t                     uuid_type;                    /**< UUID type for the KISS Service. */
+	kiss_service_callback_t     callback;                     /**< Pointer to the callback function. */
+	uint16_t                    max_notify_len;               /**< Maximum notification length for the current ATT MTU. */
+	bool                        notify_enabled;               /**< The client has enabled notifications on the RX Characteristic. */
+
+	notify_queue_t              rx_queue;                     /**< Received LoRa frames waiting to be sent to the client. */
+	notify_queue_t              tx_queue;                     /**< Frames from the client waiting for transmission (TNC2 format). */
+	uint64_t                    tx_retry_time;                /**< The next frame is held until this time because of the airtime budget. */
+
+	kiss_encoder_t              encoder;                      /**< Encoder for the frame that is currently sent. */
+	uint8_t                     ax25_frame[AX25_MAX_FRAME_LEN];  /**< The frame that is currently sent. */
+	uint8_t                     chunk[KISS_SERVICE_MAX_CHUNK_LEN]; /**< Notification waiting for a free SoftDevice buffer. */
+	uint16_t                    chunk_len;                    /**< Length of the pending notification, 0 if none. */
+
+	kiss_decoder_t              decoder;                      /**< Decoder for the data written by the client. */
+};
+
+
+/**@brief Function for initializing the Service.
+ *
+ * @param[out] p_srv      Service structure. This structure must be supplied by
+ *                        the application. It is initialized by this function and will later
+ *                        be used to identify this particular service instance.
+ * @param[in] p_srv_init  Information needed to initialize the service.
+ *
+ * @retval NRF_SUCCESS If the service was initialized successfully. Otherwise, an error code is returned.
+ */
+uint32_t kiss_service_init(kiss_service_t * p_srv, const kiss_service_init_t * p_srv_init);
+
+
+/**@brief Function for handling the application's BLE stack events.
+ *
+ * @details This function handles all events from the BLE stack that are of interest to the Service.
+ *
+ * @param[in] p_ble_evt  Event received from the BLE stack.
+ * @param[in] p_context  Service structure (as returned by kiss_service_init()).
+ */
+void kiss_service_on_ble_evt(ble_evt_t const * p_ble_evt, void * p_context);
+
+
+/**@brief Queue a received LoRa frame for the client.
+ * @details
+ * The frame is only queued if the client has enabled notifications. It is
+ * sent from @ref kiss_service_send_notifications(), which is requested via
+ * EVENT_BLE_KISS_NOTIFY.
+ *
+ * @param[in]  p_srv       Service structure (as returned by kiss_service_init()).
+ * @param[in]  p_frame     The frame as received via LoRa.
+ * @param[in]  frame_len   Length of the frame.
+ * @retval     NRF_ERROR_NO_MEM if the queue is full and the frame was dropped.
+ * @retval     NRF_SUCCESS otherwise.
+ */
+ret_code_t kiss_service_notify_rx_frame(kiss_service_t * p_srv, const uint8_t *p_frame, uint8_t frame_len);
+
+
+/**@brief Send queued received frames as KISS stream.
+ * @details
+ * Frames are converted to AX.25 and KISS-encoded into notifications of the
+ * maximum length for the current ATT MTU. Frames that cannot be converted are
+ * skipped. If the SoftDevice cannot buffer more notifications, sending
+ * continues after the next BLE_GATTS_EVT_HVN_TX_COMPLETE event.
+ *
+ * @param[in]  p_srv       Service structure (as returned by kiss_service_init()).
+ * @param[in]  conn_handle Handle of the current connection.
+ */
+void kiss_service_send_notifications(kiss_service_t * p_srv, uint16_t conn_handle);
+
+
+/**@brief Get the next frame written by the client.
+ * @details
+ * If the frame does not fit into the airtime budget, it stays queued and is
+ * retried after @ref KISS_SERVICE_AIRTIME_DELAY_MS.
+ *
+ * @param[in]  p_srv       Service structure (as returned by kiss_service_init()).
+ * @param[in]  now         Current time in milliseconds.
+ * @param[out] p_frame     Buffer for the frame in LoRa format (at least 255 bytes).
+ * @param[out] p_len       Length of the frame.
+ * @returns                True if a frame was returned, false if none is due.
+ */
+bool kiss_service_get_tx_frame(kiss_service_t * p_srv, uint64_t now, uint8_t *p_frame, uint8_t *p_len);
+
+
+/**@brief Get the time when the next frame from the client can be sent.
+ *
+ * @param[in]  p_srv       Service structure (as returned by kiss_service_init()).
+ * @returns                The time in milliseconds, UINT64_MAX if no frame is waiting.
+ */
+uint64_t kiss_service_get_next_tx_time(const kiss_service_t * p_srv);
+
+
+/**@brief Set the ATT MTU of the current connection.
+ *
+ * @param[in]  p_srv       Service structure (as returned by kiss_service_init()).
+ * @param[in]  att_mtu     The effective ATT MTU.
+ */
+void kiss_service_set_att_mtu(kiss_service_t * p_srv, uint16_t att_mtu);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KISS_SERVICE_H__
+
+/** @} */
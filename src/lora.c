@@ -31,8 +31,6 @@
  * - Bandwidth: 125 kHz (0x04)
  */
 
-#include <math.h>
-
 #include <nrfx_spim.h>
 #include <app_timer.h>
 
@@ -44,7 +42,11 @@ NRF_LOG_MODULE_REGISTER();
 #include "nrf_error.h"
 #include "pinout.h"
 #include "periph_pwr.h"
+#include "event_queue.h"
 #include "leds.h"
+#include "airtime.h"
+#include "time_base.h"
+#include "energy.h"
 
 #include "lora.h"
 
@@ -379,28 +381,31 @@ static ret_code_t handle_state_entry(void);
 static ret_code_t handle_state_exit(void);
 
 
-static float calc_toa(
-		uint8_t sf,
-		uint8_t cr,
-		float bw_khz,
-		uint8_t n_symb_pre,
-		uint8_t n_bytes_payload,
-		bool explicit_header,
-		bool use_crc)
+static float bandwidth_to_khz(uint8_t bw_id)
 {
-	uint8_t n_symb_header = explicit_header ? 20 : 0;
-	uint8_t n_bit_crc     = use_crc ? 16 : 0;
-
-	float arg = 8*n_bytes_payload + n_bit_crc - 4*sf + n_symb_header;
-
-	if(arg < 0) {
-		arg = 0;
+	switch(bw_id) {
+		case SX1262_LORA_BW_7:   return   7.81f;
+		case SX1262_LORA_BW_10:  return  10.42f;
+		case SX1262_LORA_BW_15:  return  15.63f;
+		case SX1262_LORA_BW_20:  return  20.83f;
+		case SX1262_LORA_BW_31:  return  31.25f;
+		case SX1262_LORA_BW_41:  return  41.67f;
+		case SX1262_LORA_BW_62:  return  62.50f;
+		case SX1262_LORA_BW_125: return 125.00f;
+		case SX1262_LORA_BW_250: return 250.00f;
+		case SX1262_LORA_BW_500: return 500.00f;
+		default:
+			NRF_LOG_ERROR("Invalid bandwidth setting: 0x%02x", bw_id);
+			return 125.0f;
 	}
+}
 
-	float n_symb = n_symb_pre + 4.25 + 8
-		+ (int)(1.0f + arg / (4*sf)) * (cr+4);
 
-	return pow(2, sf) / bw_khz * n_symb;
+/**@brief Pass the current modulation parameters to the airtime calculation.
+ */
+static void update_airtime_modulation(void)
+{
+	airtime_set_modulation(m_sf, m_cr, bandwidth_to_khz(m_bw));
 }
 
 
@@ -515,8 +520,9 @@ static ret_code_t handle_state_entry(void)
 	{
 		case LORA_STATE_OFF:
 			// as we enter the idle state here, we shut down all used
-			// peripherals on the next main loop iteration.
+			// peripherals from the main loop.
 			m_shutdown_needed = true;
+			event_queue_post(EVENT_LORA_SHUTDOWN);
 			break;
 
 		case LORA_STATE_WAIT_BUSY:
@@ -698,33 +704,10 @@ static ret_code_t handle_state_entry(void)
 
 		case LORA_STATE_START_TX:
 			{
-				float bw_khz = 125.0f;
-
-				switch(m_bw) {
-					case SX1262_LORA_BW_7:   bw_khz =   7.81f; break;
-					case SX1262_LORA_BW_10:  bw_khz =  10.42f; break;
-					case SX1262_LORA_BW_15:  bw_khz =  15.63f; break;
-					case SX1262_LORA_BW_20:  bw_khz =  20.83f; break;
-					case SX1262_LORA_BW_31:  bw_khz =  31.25f; break;
-					case SX1262_LORA_BW_41:  bw_khz =  41.67f; break;
-					case SX1262_LORA_BW_62:  bw_khz =  62.50f; break;
-					case SX1262_LORA_BW_125: bw_khz = 125.00f; break;
-					case SX1262_LORA_BW_250: bw_khz = 250.00f; break;
-					case SX1262_LORA_BW_500: bw_khz = 500.00f; break;
-					default:
-						NRF_LOG_ERROR("Invalid bandwidth setting: 0x%02x", m_bw);
-						bw_khz = 125.0f;
-						break;
-				}
+				float toa = airtime_calc_toa_ms(m_payload_length);
 
-				float toa = calc_toa(
-						m_sf,   // SF
-						m_cr,   // CR=4/5
-						bw_khz, // BW
-						8,      // preamble symbols
-						m_payload_length,
-						true,   // explicit header
-						true);  // use CRC
+				airtime_record(time_base_get(), (uint32_t)toa);
+				energy_record_tx(m_power, (uint32_t)toa);
 
 				m_tx_timeout = 1.50f * toa * 1000.0f / TX_DONE_POLL_INTERVAL_MS;
 
@@ -1086,10 +1069,31 @@ void lora_config_gpios(bool power_supplied)
 }
 
 
+static void handle_shutdown(void)
+{
+	if(m_shutdown_needed) {
+		NRF_LOG_DEBUG("Shutting down peripherals.");
+
+		nrfx_spim_uninit(&m_spim); // to save power
+
+		lora_config_gpios(true); // safe powered state
+
+		periph_pwr_stop_activity(PERIPH_PWR_FLAG_LORA);
+
+		m_shutdown_needed = false;
+		m_poweroff_requested = false;
+
+		m_callback(LORA_EVT_OFF, NULL);
+	}
+}
+
+
 ret_code_t lora_init(lora_callback_t callback)
 {
 	m_callback = callback;
 
+	event_queue_register(EVENT_LORA_SHUTDOWN, handle_shutdown);
+
 	// initialize the GPIOs.
 	nrf_gpio_cfg_default(PIN_LORA_RST);
 	nrf_gpio_cfg_input(PIN_LORA_BUSY, NRF_GPIO_PIN_NOPULL);
@@ -1105,6 +1109,8 @@ ret_code_t lora_init(lora_callback_t callback)
 
 	m_state = LORA_STATE_OFF;
 
+	update_airtime_modulation();
+
 	return app_timer_create(&m_sequence_timer, APP_TIMER_MODE_SINGLE_SHOT, cb_sequence_timer);
 }
 
@@ -1230,25 +1236,6 @@ bool lora_is_off(void)
 }
 
 
-void lora_loop(void)
-{
-	if(m_shutdown_needed) {
-		NRF_LOG_DEBUG("Shutting down peripherals.");
-
-		nrfx_spim_uninit(&m_spim); // to save power
-
-		lora_config_gpios(true); // safe powered state
-
-		periph_pwr_stop_activity(PERIPH_PWR_FLAG_LORA);
-
-		m_shutdown_needed = false;
-		m_poweroff_requested = false;
-
-		m_callback(LORA_EVT_OFF, NULL);
-	}
-}
-
-
 ret_code_t lora_set_power(lora_pwr_t power)
 {
 	if(power >= LORA_PWR_NUM_ENTRIES) {
@@ -1295,6 +1282,7 @@ ret_code_t lora_set_spreading_factor(uint8_t sf_id)
 	}
 
 	m_sf = sf_id;
+	update_airtime_modulation();
 
 	return NRF_SUCCESS;
 }
@@ -1313,6 +1301,7 @@ ret_code_t lora_set_bandwidth(uint8_t bw_id)
 	}
 
 	m_bw = bw_id;
+	update_airtime_modulation();
 
 	return NRF_SUCCESS;
 }
@@ -1331,6 +1320,7 @@ ret_code_t lora_set_coding_rate(uint8_t cr_id)
 	}
 
 	m_cr = cr_id;
+	update_airtime_modulation();
 
 	return NRF_SUCCESS;
 }
@@ -82,7 +82,6 @@ ret_code_t lora_send_packet(const uint8_t *data, uint8_t length);
 ret_code_t lora_start_rx(void);
 bool lora_is_busy(void);
 bool lora_is_off(void);
-void lora_loop(void);
 
 ret_code_t lora_set_power(lora_pwr_t power);
 lora_pwr_t lora_get_power(void);
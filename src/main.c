@@ -65,6 +65,7 @@
 #include "nrf_gpio.h"
 #include "nrf_sdh.h"
 #include "nrf_sdh_soc.h"
+#include "nrf_soc.h"
 #include "nrf_sdh_ble.h"
 #include "app_timer.h"
 #include "fds.h"
@@ -79,12 +80,18 @@
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
+#include "SEGGER_RTT.h"
 
 #include "lns_wrap.h"
 #include "aprs_service.h"
+#include "kiss_service.h"
+#include "conn_policy.h"
 
 #include "pinout.h"
 #include "time_base.h"
+#include "event_queue.h"
+#include "profiling.h"
+#include "trace.h"
 #include "wall_clock.h"
 #include "epaper.h"
 #include "gps.h"
@@ -94,13 +101,26 @@
 #include "leds.h"
 #include "buttons.h"
 #include "tracker.h"
+#include "gnss_sched.h"
+#include "gnss_filter.h"
 #include "utils.h"
 #include "settings.h"
+#include "storage.h"
+#include "track_log.h"
+#include "rx_archive.h"
+#include "track_export.h"
 #include "menusystem.h"
 #include "display.h"
 #include "bme280.h"
 
 #include "aprs.h"
+#include "station_db.h"
+#include "dupe_cache.h"
+#include "airtime.h"
+#include "digipeater.h"
+#include "messaging.h"
+#include "telemetry.h"
+#include "energy.h"
 
 #include "config.h"
 
@@ -115,10 +135,10 @@
 #define APP_BLE_OBSERVER_PRIO           3                                       /**< Application's BLE observer priority. You shouldn't need to modify this value. */
 #define APP_BLE_CONN_CFG_TAG            1                                       /**< A tag identifying the SoftDevice BLE configuration. */
 
-#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(100, UNIT_1_25_MS)        /**< Minimum acceptable connection interval (0.1 seconds). */
-#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(200, UNIT_1_25_MS)        /**< Maximum acceptable connection interval (0.2 second). */
-#define SLAVE_LATENCY                   0                                       /**< Slave latency. */
-#define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(4000, UNIT_10_MS)         /**< Connection supervisory timeout (4 seconds). */
+#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(CONN_POLICY_IDLE_MIN_INTERVAL_MS, UNIT_1_25_MS) /**< Minimum acceptable connection interval while idle. */
+#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(CONN_POLICY_IDLE_MAX_INTERVAL_MS, UNIT_1_25_MS) /**< Maximum acceptable connection interval while idle. */
+#define SLAVE_LATENCY                   CONN_POLICY_IDLE_SLAVE_LATENCY                                /**< Slave latency while idle. */
+#define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(CONN_POLICY_IDLE_SUP_TIMEOUT_MS, UNIT_10_MS)    /**< Connection supervisory timeout while idle. */
 
 #define FIRST_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(5000)                   /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (5 seconds). */
 #define NEXT_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(30000)                  /**< Time between each call to sd_ble_gap_conn_param_update after the first call (30 seconds). */
@@ -138,12 +158,17 @@
 #define VOLTAGE_MONITOR_INTERVAL_IDLE        3600   // seconds
 #define VOLTAGE_MONITOR_INTERVAL_ACTIVE        60   // seconds
 
+#define STORAGE_GC_TX_GUARD_MS  1000   // no flash GC if a frame is due within this time
+
+#define TRACE_RTT_CHANNEL       1      // RTT up channel for the binary trace, see tools/trace_decode.py
+
 #define SHUTDOWN_FLAG_INITIATED (1 << 0)
 #define SHUTDOWN_FLAG_DISPLAY_LOCKED (1 << 1)
 #define SHUTDOWN_FLAG_DISPLAY_CLEARED (1 << 2)
 #define SHUTDOWN_FLAG_LORA_OFF (1 << 3)
+#define SHUTDOWN_FLAG_SETTINGS_SAVED (1 << 4)
 
-#define SHUTDOWN_FLAG_ALL_SET 0x0F
+#define SHUTDOWN_FLAG_ALL_SET 0x1F
 
 NRF_BLE_GATT_DEF(m_gatt);                                                       /**< GATT module instance. */
 NRF_BLE_QWR_DEF(m_qwr);                                                         /**< Context for the Queued Write module.*/
@@ -152,12 +177,23 @@ BLE_ADVERTISING_DEF(m_advertising);
 APP_TIMER_DEF(m_backlight_timer);
 APP_TIMER_DEF(m_lowspeed_tick_timer);
 APP_TIMER_DEF(m_startup_timer);
+APP_TIMER_DEF(m_tx_queue_timer);
+APP_TIMER_DEF(m_conn_policy_timer);
+APP_TIMER_DEF(m_track_log_timer);
 
 static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID;                        /**< Handle of the current connection. */
 
+static uint8_t m_trace_rtt_buffer[1024];                                       /**< RTT up buffer for the binary trace. */
+
 static bool m_epaper_update_requested = false;                                  /**< If set to true, the e-paper display will be redrawn ASAP from the main loop. */
 static bool m_epaper_force_full_refresh = false;                                /**< e-Paper needs a full refresh from time to time to get rid of ghosting. */
 
+static bool m_tx_queue_poll_requested = false;                                  /**< If set to true, due reports, messages and digipeater frames are transmitted from the main loop. */
+
+static bool m_ble_conn_changed = false;                                         /**< A BLE connection was established or closed since the last connection policy update. */
+static bool m_ble_bulk_requested = false;                                       /**< A BLE bulk transfer is running, so fast connection parameters should be used. */
+static bool m_ble_conn_params_rejected = false;                                 /**< The client did not accept the requested connection parameters. */
+
 static bool m_bme280_updated = false;
 static uint64_t m_bme280_next_readout_time = 0;
 
@@ -168,11 +204,11 @@ nmea_data_t m_nmea_data;
 bool m_nmea_has_position = false;
 
 #define DISP_CYCLE_FIRST   DISP_STATE_GPS
-#define DISP_CYCLE_LAST    DISP_STATE_CLOCK_BME280
+#define DISP_CYCLE_LAST    DISP_STATE_ENERGY
 
 display_state_t m_display_state = DISP_STATE_STARTUP;
 display_state_t m_prev_display_state = DISP_CYCLE_FIRST;
-uint8_t         m_display_rx_index = 0;
+uint8_t         m_display_rx_index = STATION_DB_INVALID;
 
 aprs_rx_raw_data_t m_last_undecodable_data;
 uint64_t m_last_undecodable_timestamp;
@@ -183,6 +219,39 @@ bool m_lora_tx_busy = false;
 bool m_lora_rx_active = false;
 bool m_tracker_active = false;
 bool m_gnss_keep_active = false;
+bool m_track_log_available = false;
+bool m_rx_archive_available = false;
+
+// a download over BLE that is generated as fast as the connection can transfer it
+typedef size_t (*ble_stream_read_t)(uint8_t *buf, size_t max_len);
+typedef ret_code_t (*ble_stream_notify_t)(aprs_service_t * p_srv, uint16_t conn_handle,
+		const uint8_t *p_data, uint16_t data_len);
+
+typedef struct {
+	uint8_t             chunk[NRF_SDH_BLE_GATT_MAX_MTU_SIZE];
+	uint16_t            chunk_len;   // sent when the SoftDevice has space again
+} ble_stream_t;
+
+// download of the RX archive over BLE
+static rx_archive_reader_t m_archive_reader;
+static bool                m_archive_reading = false;
+static ble_stream_t        m_archive_stream;
+
+static volatile bool       m_archive_request = false;  // set from the BLE event handler
+static volatile bool       m_archive_cancel = false;
+static uint32_t            m_archive_start_seq;
+static uint32_t            m_archive_count;
+
+// download of the track log over BLE
+static track_export_t      m_track_export;
+static bool                m_track_exporting = false;
+static ble_stream_t        m_track_stream;
+
+static volatile bool       m_track_request = false;    // set from the BLE event handler
+static volatile bool       m_track_cancel = false;
+static uint8_t             m_track_format;
+static uint32_t            m_track_start_time;
+static uint32_t            m_track_end_time;
 
 char m_passkey[6];
 
@@ -192,6 +261,7 @@ static uint8_t m_shutdown_flags = 0x0;
 BLE_BAS_DEF(m_ble_bas); // battery service
 
 APRS_SERVICE_DEF(m_aprs_service);
+KISS_SERVICE_DEF(m_kiss_service);
 
 // YOUR_JOB: Use UUIDs for service(s) used in your application.
 static ble_uuid_t m_adv_uuids[] =                                               /**< Universally unique service identifiers. */
@@ -202,6 +272,34 @@ static ble_uuid_t m_adv_uuids[] =
 
 static void advertising_start(bool erase_bonds);
 static void cb_menusystem(menusystem_evt_t evt, const menusystem_evt_data_t *data);
+static void tx_queue_schedule(void);
+
+
+/**@brief Request a redraw of the e-paper display from the main loop.
+ */
+static void request_display_update(void)
+{
+	m_epaper_update_requested = true;
+	event_queue_post(EVENT_DISPLAY_UPDATE);
+}
+
+
+/**@brief Request to transmit due frames from the transmit queue.
+ */
+static void request_tx_queue_poll(void)
+{
+	m_tx_queue_poll_requested = true;
+	event_queue_post(EVENT_TX_QUEUE_POLL);
+}
+
+
+/**@brief Request fast BLE connection parameters for a bulk transfer.
+ */
+static void request_ble_bulk(void)
+{
+	m_ble_bulk_requested = true;
+	event_queue_post(EVENT_BLE_CONN_POLICY);
+}
 
 
 /**@brief Callback function for asserts in the SoftDevice.
@@ -264,6 +362,98 @@ void readout_bme280_if_already_powered(void)
 }
 
 
+/**@brief Log and reset the run-time statistics.
+ */
+static void log_profiling(void)
+{
+	NRF_LOG_INFO("CPU awake for %u ms since last report.",
+			(uint32_t)(profiling_get_awake_us() / 1000));
+
+	for(profiling_span_t span = 0; span < PROFILING_NUM_SPANS; span++) {
+		profiling_stats_t stats;
+		profiling_get_stats(span, &stats);
+
+		if(stats.count == 0) {
+			continue;
+		}
+
+		NRF_LOG_INFO("%s: n=%u, min/avg/max = %u/%u/%u us",
+				profiling_get_span_name(span),
+				stats.count,
+				stats.min_ticks / PROFILING_TICKS_PER_US,
+				(uint32_t)(stats.total_ticks / stats.count / PROFILING_TICKS_PER_US),
+				stats.max_ticks / PROFILING_TICKS_PER_US);
+
+		// buckets start at 0, 16, 64 and 256 us and 1, 4, 16 and 65 ms
+		NRF_LOG_INFO("  histogram: %u %u %u %u", stats.histogram[0], stats.histogram[1],
+				stats.histogram[2], stats.histogram[3]);
+		NRF_LOG_INFO("             %u %u %u %u", stats.histogram[4], stats.histogram[5],
+				stats.histogram[6], stats.histogram[7]);
+	}
+
+	NRF_LOG_INFO("BLE RX notifications: %u dropped, max. queue depth %u.",
+			m_aprs_service.rx_queue.dropped, m_aprs_service.rx_queue.max_depth);
+	NRF_LOG_INFO("BLE KISS: %u RX frames dropped, %u TX frames decoded, %u discarded.",
+			m_kiss_service.rx_queue.dropped, m_kiss_service.decoder.frames,
+			m_kiss_service.decoder.errors);
+
+	conn_policy_stats_t conn_stats;
+	conn_policy_get_stats(&conn_stats);
+
+	NRF_LOG_INFO("BLE connection policy: %u bulk periods, %u updates, %u rejected.",
+			conn_stats.bulk_periods, conn_stats.updates, conn_stats.rejected);
+
+	settings_stats_t settings_stats;
+	settings_get_stats(&settings_stats);
+
+	NRF_LOG_INFO("Settings: %u flash writes, %u saved by caching.",
+			settings_stats.flash_writes, settings_stats.flash_writes_saved);
+
+	trace_stats_t trace_stats;
+	trace_get_stats(&trace_stats);
+
+	NRF_LOG_INFO("Trace: %u events, %u bytes, %u dropped, max. %u bytes buffered.",
+			trace_stats.events, trace_stats.bytes, trace_stats.dropped, trace_stats.max_fill);
+
+	storage_stats_t storage_stats;
+	storage_get_stats(&storage_stats);
+
+	NRF_LOG_INFO("Flash storage: %u writes, %u deletes, %u failed, %u free words, %u freeable.",
+			storage_stats.writes, storage_stats.deletes, storage_stats.write_failures,
+			storage_stats.words_free, storage_stats.words_freeable);
+	NRF_LOG_INFO("Flash storage: %u GC runs, %u words freed.",
+			storage_stats.gc_runs, storage_stats.words_freed);
+
+	NRF_LOG_INFO("Tracker: %u reports, %u triggered by turns.",
+			tracker_get_tx_counter(), tracker_get_turn_counter());
+
+	track_log_stats_t track_log_stats;
+	track_log_get_stats(&track_log_stats);
+
+	NRF_LOG_INFO("Track log: %u fixes, %u pages, %u sector erases, %u write errors, round %u.",
+			track_log_stats.fixes_logged, track_log_stats.pages_written,
+			track_log_stats.sector_erases, track_log_stats.write_errors,
+			track_log_stats.rounds);
+
+	rx_archive_stats_t rx_archive_stats;
+	rx_archive_get_stats(&rx_archive_stats);
+
+	NRF_LOG_INFO("RX archive: %u records, %u bytes, %u sector erases, %u write errors, %u dropped.",
+			rx_archive_stats.records, rx_archive_stats.bytes, rx_archive_stats.sector_erases,
+			rx_archive_stats.write_errors, rx_archive_stats.dropped);
+
+	for(event_type_t type = 0; type < EVENT_NUM_TYPES; type++) {
+		event_stats_t stats;
+		event_queue_get_stats(type, &stats);
+
+		NRF_LOG_INFO("event %u: n=%u, max latency %u ms",
+				type, stats.dispatched, stats.max_latency_ms);
+	}
+
+	profiling_reset();
+}
+
+
 /**@brief Timeout handler for low-frequency background jobs
  *
  * This timer handles various background jobs that are executed at very low
@@ -274,6 +464,9 @@ void readout_bme280_if_already_powered(void)
  * - Trigger a full e-Paper refresh every 1 hour.
  * - Trigger a BME280 readout every tick, but only if it is powered already.
  * - Update the display on every tick, but only if it is powered already.
+ * - Log the run-time statistics every 1 hour.
+ * - Retry a flash garbage collection that was deferred because the radio or
+ *   the display was busy.
  */
 static void cb_lowspeed_tick_timer(void *arg)
 {
@@ -283,12 +476,18 @@ static void cb_lowspeed_tick_timer(void *arg)
 
 	if(tick_count % 240 == 0) {
 		m_epaper_force_full_refresh = true;
-		m_epaper_update_requested = true;
+		request_display_update();
+
+		log_profiling();
 	}
 
 	// refresh epaper if power is on anyways
 	if(periph_pwr_is_activity_power_already_available(PERIPH_PWR_FLAG_EPAPER_UPDATE)) {
-		m_epaper_update_requested = true;
+		request_display_update();
+	}
+
+	if(storage_gc_pending()) {
+		event_queue_post(EVENT_STORAGE_GC);
 	}
 
 	tick_count++;
@@ -302,7 +501,31 @@ static void cb_lowspeed_tick_timer(void *arg)
 static void cb_startup_timer(void *arg)
 {
 	m_display_state = DISP_CYCLE_FIRST;
-	m_epaper_update_requested = true;
+	request_display_update();
+}
+
+
+/**@brief Timeout handler for own reports and queued message and digipeater frames.
+ */
+static void cb_tx_queue_timer(void *arg)
+{
+	request_tx_queue_poll();
+}
+
+
+/**@brief Timeout handler for the end of BLE bulk transfers and postponed parameter updates.
+ */
+static void cb_conn_policy_timer(void *arg)
+{
+	event_queue_post(EVENT_BLE_CONN_POLICY);
+}
+
+
+/**@brief Timeout handler for polling a running track log sector erase.
+ */
+static void cb_track_log_timer(void *arg)
+{
+	event_queue_post(EVENT_TRACK_LOG_WRITE);
 }
 
 
@@ -326,6 +549,15 @@ static void timers_init(void)
 
 	err_code = app_timer_create(&m_startup_timer, APP_TIMER_MODE_SINGLE_SHOT, cb_startup_timer);
 	APP_ERROR_CHECK(err_code);
+
+	err_code = app_timer_create(&m_tx_queue_timer, APP_TIMER_MODE_SINGLE_SHOT, cb_tx_queue_timer);
+	APP_ERROR_CHECK(err_code);
+
+	err_code = app_timer_create(&m_conn_policy_timer, APP_TIMER_MODE_SINGLE_SHOT, cb_conn_policy_timer);
+	APP_ERROR_CHECK(err_code);
+
+	err_code = app_timer_create(&m_track_log_timer, APP_TIMER_MODE_SINGLE_SHOT, cb_track_log_timer);
+	APP_ERROR_CHECK(err_code);
 }
 
 
@@ -377,11 +609,23 @@ static void gap_params_init(void)
 }
 
 
+/**@brief Function for handling events from the GATT module.
+ */
+static void gatt_evt_handler(nrf_ble_gatt_t *p_gatt, nrf_ble_gatt_evt_t const *p_evt)
+{
+	if(p_evt->evt_id == NRF_BLE_GATT_EVT_ATT_MTU_UPDATED) {
+		NRF_LOG_INFO("ATT MTU is now %u.", p_evt->params.att_mtu_effective);
+		aprs_service_set_att_mtu(&m_aprs_service, p_evt->params.att_mtu_effective);
+		kiss_service_set_att_mtu(&m_kiss_service, p_evt->params.att_mtu_effective);
+	}
+}
+
+
 /**@brief Function for initializing the GATT module.
 */
 static void gatt_init(void)
 {
-	ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, NULL);
+	ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, gatt_evt_handler);
 	APP_ERROR_CHECK(err_code);
 }
 
@@ -419,6 +663,63 @@ static void notify_current_setting_value(settings_id_t id, bool op_success)
 }
 
 
+/**@brief Update the settings snapshot characteristic from the stored settings.
+ */
+static void update_settings_snapshot(void)
+{
+	uint8_t snapshot[SETTINGS_TLV_MAX_LEN];
+	size_t snapshot_len = sizeof(snapshot);
+
+	ret_code_t err_code = settings_export_snapshot(snapshot, &snapshot_len);
+
+	if(err_code == NRF_SUCCESS) {
+		aprs_service_set_settings_snapshot(&m_aprs_service, snapshot, snapshot_len);
+	} else {
+		NRF_LOG_WARNING("settings: cannot create snapshot: 0x%08x", err_code);
+	}
+}
+
+
+/**@brief Start restoring a settings snapshot written by the client.
+ */
+static void restore_settings_snapshot(const uint8_t *data, uint16_t data_len)
+{
+	settings_id_t invalid_id;
+	aprs_service_restore_status_t status;
+
+	// the restore causes many flash operations and notifications
+	request_ble_bulk();
+
+	ret_code_t err_code = settings_import_snapshot(data, data_len, &invalid_id);
+
+	switch(err_code) {
+		case NRF_SUCCESS:
+			// the result is notified from cb_settings()
+			return;
+
+		case NRF_ERROR_INVALID_DATA:
+			status = APRS_SERVICE_RESTORE_STATUS_INVALID_DATA;
+			break;
+
+		case NRF_ERROR_INVALID_PARAM:
+			status = APRS_SERVICE_RESTORE_STATUS_INVALID_VALUE;
+			break;
+
+		case NRF_ERROR_BUSY:
+			status = APRS_SERVICE_RESTORE_STATUS_BUSY;
+			break;
+
+		default:
+			status = APRS_SERVICE_RESTORE_STATUS_FLASH_ERROR;
+			break;
+	}
+
+	NRF_LOG_WARNING("settings: snapshot rejected: 0x%08x", err_code);
+
+	aprs_service_notify_restore_status(&m_aprs_service, m_conn_handle, status, invalid_id);
+}
+
+
 static void cb_aprs_service(aprs_service_evt_t *evt)
 {
 	switch(evt->type)
@@ -451,24 +752,47 @@ static void cb_aprs_service(aprs_service_evt_t *evt)
 
 				APP_ERROR_CHECK(aprs_service_get_symbol(&m_aprs_service, &table, &symbol));
 
-				// save the new symbol code as last custom symbol code. The
-				// SETTINGS_ID_SYMBOL_CODE setting is updated from
-				// cb_settings() once this write completes.
+				// save the new symbol code as last custom symbol code and
+				// as current symbol code
 				uint8_t buf[2] = {table, symbol};
 				settings_write(SETTINGS_ID_LAST_BLE_SYMBOL, buf, sizeof(buf));
+				settings_write(SETTINGS_ID_SYMBOL_CODE, buf, sizeof(buf));
 
 				aprs_set_icon(table, symbol);
 			}
 			break;
 
 		case APRS_SERVICE_EVT_SETTING_SELECT:
+			// clients usually read or write all settings in a row
+			request_ble_bulk();
+
 			notify_current_setting_value(evt->params.setting.setting_id, true);
 			break;
 
+		case APRS_SERVICE_EVT_TX_MESSAGE:
+			{
+				ret_code_t err_code = messaging_send(
+						evt->params.tx_message.addressee,
+						evt->params.tx_message.text,
+						time_base_get());
+
+				if(err_code == NRF_SUCCESS) {
+					request_tx_queue_poll();
+				} else {
+					NRF_LOG_WARNING("messaging: cannot queue message: 0x%08x", err_code);
+				}
+
+				// the next message of a burst is expected soon
+				request_ble_bulk();
+			}
+			break;
+
 		case APRS_SERVICE_EVT_SETTING_WRITE:
 			{
 				ret_code_t err_code;
 
+				request_ble_bulk();
+
 				// setting value safeguards
 				switch(evt->params.setting.setting_id) {
 					case SETTINGS_ID_RF_FREQUENCY:
@@ -525,6 +849,43 @@ static void cb_aprs_service(aprs_service_evt_t *evt)
 						}
 						break;
 
+					case SETTINGS_ID_SMARTBEACON:
+						{
+							tracker_smartbeacon_params_t params;
+
+							if(evt->params.setting.data_len != TRACKER_SMARTBEACON_PARAMS_LEN) {
+								err_code = NRF_ERROR_INVALID_LENGTH;
+								break;
+							}
+
+							memcpy(&params, evt->params.setting.data, sizeof(params));
+
+							// rejected parameters are not applied, so nothing to restore here
+							err_code = tracker_set_smartbeacon_params(&params);
+						}
+						break;
+
+					case SETTINGS_ID_DEAD_RECKONING:
+						if(evt->params.setting.data_len != 2) {
+							err_code = NRF_ERROR_INVALID_LENGTH;
+						} else {
+							err_code = tracker_set_dead_reckoning_max_error(*(uint16_t*)evt->params.setting.data);
+						}
+						break;
+
+					case SETTINGS_ID_ENERGY_MODEL:
+						if(evt->params.setting.data_len != ENERGY_MODEL_LEN) {
+							err_code = NRF_ERROR_INVALID_LENGTH;
+						} else {
+							energy_model_t model;
+
+							memcpy(&model, evt->params.setting.data, sizeof(model));
+							energy_set_model(&model);
+
+							err_code = NRF_SUCCESS;
+						}
+						break;
+
 					default:
 						// other settings are not so critical that they have to be checked
 						err_code = NRF_SUCCESS;
@@ -553,6 +914,53 @@ static void cb_aprs_service(aprs_service_evt_t *evt)
 				}
 			}
 			break;
+
+		case APRS_SERVICE_EVT_SETTINGS_RESTORE:
+			restore_settings_snapshot(evt->params.snapshot.data, evt->params.snapshot.data_len);
+			break;
+
+		case APRS_SERVICE_EVT_RX_ARCHIVE_REQUEST:
+			// the flash is read from the main loop
+			m_archive_start_seq = evt->params.rx_archive.start_seq;
+			m_archive_count = evt->params.rx_archive.count;
+			m_archive_request = true;
+			event_queue_post(EVENT_BLE_ARCHIVE_NOTIFY);
+			break;
+
+		case APRS_SERVICE_EVT_RX_ARCHIVE_CANCEL:
+			m_archive_cancel = true;
+			event_queue_post(EVENT_BLE_ARCHIVE_NOTIFY);
+			break;
+
+		case APRS_SERVICE_EVT_TRACK_EXPORT_REQUEST:
+			m_track_format = evt->params.track_export.format;
+			m_track_start_time = evt->params.track_export.start_time;
+			m_track_end_time = evt->params.track_export.end_time;
+			m_track_request = true;
+			event_queue_post(EVENT_BLE_TRACK_NOTIFY);
+			break;
+
+		case APRS_SERVICE_EVT_TRACK_EXPORT_CANCEL:
+			m_track_cancel = true;
+			event_queue_post(EVENT_BLE_TRACK_NOTIFY);
+			break;
+	}
+}
+
+
+/**@brief Handle events from the KISS TNC service.
+ * @details
+ * Called from the BLE event handler, so only the TX queue poll is requested
+ * here.
+ */
+static void cb_kiss_service(kiss_service_evt_t *evt)
+{
+	switch(evt->type)
+	{
+		case KISS_SERVICE_EVT_TX_FRAME:
+			request_tx_queue_poll();
+			request_ble_bulk();
+			break;
 	}
 }
 
@@ -600,6 +1008,16 @@ static void services_init(void)
 
 	err_code = aprs_service_init(&m_aprs_service, &aprs_init);
 	APP_ERROR_CHECK(err_code);
+
+	// Initialize the KISS TNC Service
+	kiss_service_init_t kiss_init;
+
+	memset(&kiss_init, 0, sizeof(kiss_init));
+
+	kiss_init.callback = cb_kiss_service;
+
+	err_code = kiss_service_init(&m_kiss_service, &kiss_init);
+	APP_ERROR_CHECK(err_code);
 }
 
 
@@ -607,20 +1025,18 @@ static void services_init(void)
  *
  * @details This function will be called for all events in the Connection Parameters Module which
  *          are passed to the application.
- *          @note All this function does is to disconnect. This could have been done by simply
- *                setting the disconnect_on_fail config parameter, but instead we use the event
- *                handler mechanism to demonstrate its use.
+ *          @note The connection is kept if the client rejects the parameters
+ *                requested by the connection policy. It then only uses more
+ *                energy than necessary.
  *
  * @param[in] p_evt  Event received from the Connection Parameters Module.
  */
 static void on_conn_params_evt(ble_conn_params_evt_t * p_evt)
 {
-	ret_code_t err_code;
-
 	if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
 	{
-		err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
-		APP_ERROR_CHECK(err_code);
+		m_ble_conn_params_rejected = true;
+		event_queue_post(EVENT_BLE_CONN_POLICY);
 	}
 }
 
@@ -759,9 +1175,12 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
 
 			periph_pwr_stop_activity(PERIPH_PWR_FLAG_CONNECTED);
 
+			m_ble_conn_changed = true;
+			event_queue_post(EVENT_BLE_CONN_POLICY);
+
 			if(m_display_state == DISP_STATE_PASSKEY) {
 				m_display_state = m_prev_display_state;
-				m_epaper_update_requested = true;
+				request_display_update();
 			}
 			break;
 
@@ -776,6 +1195,9 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
 			// enable external peripherals
 			periph_pwr_start_activity(PERIPH_PWR_FLAG_LEDS);
 			periph_pwr_start_activity(PERIPH_PWR_FLAG_CONNECTED);
+
+			m_ble_conn_changed = true;
+			event_queue_post(EVENT_BLE_CONN_POLICY);
 			break;
 
 		case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
@@ -811,7 +1233,7 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
 
 			m_prev_display_state = m_display_state;
 			m_display_state = DISP_STATE_PASSKEY;
-			m_epaper_update_requested = true;
+			request_display_update();
 			break;
 
 		default:
@@ -829,10 +1251,17 @@ static void cb_voltage_monitor(int16_t *meas_millivolt, uint8_t bat_percent)
 	m_bat_percent = bat_percent;
 	m_bat_millivolt = meas_millivolt[0];
 
-	m_epaper_update_requested = true;
+	telemetry_add_sample(TELEMETRY_CH_VBAT, meas_millivolt[0] / 1000.0f);
+
+	request_display_update();
 
 	NRF_LOG_INFO("VBAT measured: %d mV (-> %d %%)", meas_millivolt[0], bat_percent);
 
+	uint8_t energy_stats[ENERGY_ENCODED_STATS_LEN];
+	size_t energy_stats_len = energy_encode_stats(energy_stats, time_base_get());
+
+	APP_ERROR_CHECK(aprs_service_set_energy_stats(&m_aprs_service, energy_stats, energy_stats_len));
+
 	err_code = ble_bas_battery_level_update(&m_ble_bas, bat_percent, BLE_CONN_HANDLE_ALL);
 
 	switch(err_code)
@@ -850,9 +1279,86 @@ static void cb_voltage_monitor(int16_t *meas_millivolt, uint8_t bat_percent)
 	}
 }
 
+/**@brief Add the current position to the track log in the external flash.
+ * @details
+ * Called for every GNSS fix. A full page is written later from the main
+ * loop, so the NMEA processing is never blocked by the flash.
+ */
+static void track_log_add_position(const nmea_data_t *data)
+{
+	if(!m_track_log_available || !data->pos_valid || !wall_clock_is_valid()) {
+		return;
+	}
+
+	track_log_fix_t fix;
+
+	fix.time = wall_clock_get_unix();
+	fix.lat  = lroundf(data->lat * 1e6f);
+	fix.lon  = lroundf(data->lon * 1e6f);
+	fix.alt  = lroundf(data->altitude);
+
+	ret_code_t err_code = track_log_append(&fix);
+	if(err_code != NRF_SUCCESS) {
+		NRF_LOG_WARNING("track log: append failed: 0x%08x", err_code);
+	}
+
+	if(track_log_write_pending()) {
+		event_queue_post(EVENT_TRACK_LOG_WRITE);
+	}
+}
+
+
+/**@brief Queue a received packet for the RX archive.
+ * @details
+ * Called from interrupt context, so the record is written to the external
+ * flash later from the main loop.
+ */
+static void rx_archive_add_packet(const lora_evt_data_t *data)
+{
+	if(!m_rx_archive_available) {
+		return;
+	}
+
+	rx_archive_record_t record;
+
+	record.time  = wall_clock_get_unix();
+	record.flags = wall_clock_is_valid() ? RX_ARCHIVE_FLAG_TIME_VALID : 0;
+	record.rssi  = lroundf(data->rx_packet_data.rssi * 10.0f);
+
+	long snr = lroundf(data->rx_packet_data.snr * 4.0f);
+	record.snr = (snr < INT8_MIN) ? INT8_MIN : (snr > INT8_MAX) ? INT8_MAX : snr;
+
+	record.data_len = data->rx_packet_data.data_len;
+	memcpy(record.data, data->rx_packet_data.data, record.data_len);
+
+	if(rx_archive_push(&record)) {
+		event_queue_post(EVENT_RX_ARCHIVE_WRITE);
+	}
+}
+
+
+/**@brief Write the buffered track log entries to the external flash.
+ */
+static void track_log_save(void)
+{
+	if(!m_track_log_available) {
+		return;
+	}
+
+	ret_code_t err_code = track_log_flush();
+	if(err_code != NRF_SUCCESS) {
+		NRF_LOG_WARNING("track log: flush failed: 0x%08x", err_code);
+	}
+}
+
+
 /**@brief Callback function for the GPS. */
 static void cb_gps(gps_evt_t evt, const nmea_data_t *data)
 {
+	ret_code_t err_code;
+
+	uint32_t prof_start = profiling_start();
+
 	switch(evt) {
 		case GPS_EVT_RESET_COMPLETE:
 			// tracker may have been activated by autostart, so we should not turn
@@ -863,8 +1369,11 @@ static void cb_gps(gps_evt_t evt, const nmea_data_t *data)
 			break;
 
 		case GPS_EVT_DATA_RECEIVED:
-			// make a copy for display rendering
+			// make a copy for display rendering and the tracker. The
+			// position is smoothed, speed and heading only while standing
+			// still, to suppress GNSS noise.
 			m_nmea_data = *data;
+			gnss_filter_update(&m_nmea_data, time_base_get());
 			m_nmea_has_position = m_nmea_has_position || m_nmea_data.pos_valid;
 
 			//APP_ERROR_CHECK(lns_wrap_update_data(data));
@@ -884,51 +1393,263 @@ static void cb_gps(gps_evt_t evt, const nmea_data_t *data)
 					aprs_args.pressure_hPa        = bme280_get_pressure();
 				}
 
-				tracker_run(data, &aprs_args);
+				tracker_run(&m_nmea_data, &aprs_args);
+				track_log_add_position(data);
+
+				// the time of the next report may have changed
+				tx_queue_schedule();
+
+				// put the GNSS into standby while the device is stationary, unless
+				// the user explicitly requested it to stay active. The unfiltered
+				// data is used, so movement is detected without delay.
+				if(!m_gnss_keep_active) {
+					uint64_t now = time_base_get();
+					uint64_t next_tx = tracker_get_next_forced_tx_time(aprs_args.transmit_env_data);
+
+					uint32_t standby_ms = gnss_sched_update(data, now, next_tx);
+
+					if(standby_ms > 0) {
+						err_code = gps_standby(standby_ms);
+						if(err_code != NRF_SUCCESS) {
+							NRF_LOG_WARNING("GNSS standby failed: 0x%08x", err_code);
+							gnss_sched_wakeup(now);
+						}
+					}
+				}
 			}
 			break;
 	}
+
+	profiling_end(PROFILING_SPAN_CB_GPS, prof_start);
 }
 
 
-static void cb_lora(lora_evt_t evt, const lora_evt_data_t *data)
+/**@brief Get the time when the next report, message or digipeater frame is due.
+ * @details
+ * Frames from the KISS client are due immediately.
+ */
+static uint64_t tx_queue_get_next_due_time(void)
 {
-	ret_code_t err_code;
+	uint64_t due = messaging_get_next_due_time();
+	uint64_t digi_due = digipeater_get_next_due_time();
+	uint64_t kiss_due = kiss_service_get_next_tx_time(&m_kiss_service);
 
-	bool     decode_ok;
-	uint64_t rx_timestamp;
-	bool     rx_time_valid;
+	if(digi_due < due) {
+		due = digi_due;
+	}
 
-	aprs_frame_t decoded_frame;
-	aprs_rx_raw_data_t raw;
+	if(kiss_due < due) {
+		due = kiss_due;
+	}
 
-	bool switch_to_rxd = (m_display_state != DISP_STATE_LORA_PACKET_DETAIL);
+	if(m_tracker_active) {
+		uint64_t report_due = tracker_get_next_tx_time();
 
-	switch(evt)
-	{
-		case LORA_EVT_PACKET_RECEIVED:
-			// try to parse the packet.
-			rx_timestamp = wall_clock_get_unix();
-			rx_time_valid = wall_clock_is_valid();
+		if(report_due < due) {
+			due = report_due;
+		}
+	}
 
-			decode_ok = aprs_parse_frame(
-			                       data->rx_packet_data.data,
-			                       data->rx_packet_data.data_len,
-			                       &decoded_frame);
+	return due;
+}
 
-			if(decode_ok) {
-				raw.rssi       = data->rx_packet_data.rssi;
-				raw.signalRssi = data->rx_packet_data.signalRssi;
-				raw.snr        = data->rx_packet_data.snr;
 
-				memcpy(raw.data, data->rx_packet_data.data, data->rx_packet_data.data_len);
-				raw.data_len = data->rx_packet_data.data_len;
+/**@brief Start the TX queue timer for the next due report, message or digipeater frame.
+ */
+static void tx_queue_schedule(void)
+{
+	APP_ERROR_CHECK(app_timer_stop(m_tx_queue_timer));
 
-				uint8_t idx = aprs_rx_history_insert(
-						&decoded_frame,
-						&raw,
-						rx_timestamp,
-						rx_time_valid,
+	uint64_t due = tx_queue_get_next_due_time();
+
+	if(due == UINT64_MAX) {
+		return;
+	}
+
+	uint64_t now = time_base_get();
+	uint32_t ticks = (due > now) ? APP_TIMER_TICKS(due - now) : 0;
+
+	if(ticks < APP_TIMER_MIN_TIMEOUT_TICKS) {
+		ticks = APP_TIMER_MIN_TIMEOUT_TICKS;
+	}
+
+	APP_ERROR_CHECK(app_timer_start(m_tx_queue_timer, ticks, NULL));
+}
+
+
+/**@brief Pass a received frame to the digipeater if the fill-in digipeater is enabled.
+ */
+static void digipeater_handle_received_frame(const uint8_t *data, uint8_t len)
+{
+	char     mycall[16];
+	uint32_t random = 0;
+
+	if(!(aprs_get_config_flags() & APRS_FLAG_FILL_IN_DIGIPEATER)) {
+		return;
+	}
+
+	aprs_get_source(mycall, sizeof(mycall));
+
+	if(sd_rand_application_vector_get((uint8_t*)&random, sizeof(random)) != NRF_SUCCESS) {
+		// not enough random data available: use the minimum holdoff
+		random = 0;
+	}
+
+	if(digipeater_handle_rx(data, len, mycall, time_base_get(), random)) {
+		NRF_LOG_INFO("digipeater: frame queued");
+		tx_queue_schedule();
+	}
+}
+
+
+/**@brief Transmit the next due report, message or digipeater frame.
+ * @details
+ * Own reports are sent first because their slot is short. Messages and
+ * acknowledgements are sent before frames from the KISS client, which are
+ * sent before repeated frames.
+ */
+static void tx_queue_transmit_due_frame(void)
+{
+	uint8_t frame[APRS_MAX_FRAME_LEN];
+	uint8_t len;
+	bool    have_frame;
+
+	uint64_t now = time_base_get();
+
+	if(!(aprs_get_config_flags() & APRS_FLAG_FILL_IN_DIGIPEATER)
+			&& digipeater_get_next_due_time() != DIGIPEATER_NO_FRAME) {
+		// disabled while frames were waiting: drop them
+		digipeater_init();
+	}
+
+	if(m_tracker_active && tracker_transmit_due(now)) {
+		tx_queue_schedule();
+		return;
+	}
+
+	have_frame = messaging_get_due_frame(now, frame, &len)
+		|| kiss_service_get_tx_frame(&m_kiss_service, now, frame, &len)
+		|| digipeater_get_due_frame(now, frame, &len);
+
+	if(have_frame) {
+		ret_code_t err_code = lora_send_packet(frame, len);
+
+		if(err_code != NRF_SUCCESS) {
+			NRF_LOG_WARNING("TX queue: frame dropped: 0x%08x", err_code);
+		}
+	}
+
+	tx_queue_schedule();
+}
+
+
+/**@brief Pass a received frame to the messaging subsystem.
+ */
+static void messaging_handle_received_frame(const uint8_t *data, uint8_t len)
+{
+	switch(messaging_handle_rx(data, len, time_base_get())) {
+		case MESSAGING_RX_NEW_MESSAGE:
+			NRF_LOG_INFO("messaging: new message from %s",
+					NRF_LOG_PUSH((char*)messaging_get_inbox_entry(0)->source));
+			break;
+
+		case MESSAGING_RX_ACK:
+			NRF_LOG_INFO("messaging: message acknowledged");
+			break;
+
+		case MESSAGING_RX_REJ:
+			NRF_LOG_WARNING("messaging: message rejected");
+			break;
+
+		default:
+			break;
+	}
+
+	// an acknowledgement may have been queued
+	tx_queue_schedule();
+}
+
+
+static void cb_lora(lora_evt_t evt, const lora_evt_data_t *data)
+{
+	ret_code_t err_code;
+
+	uint32_t prof_start = profiling_start();
+
+	bool     decode_ok;
+	uint64_t rx_timestamp;
+	bool     rx_time_valid;
+
+	aprs_frame_t decoded_frame;
+	aprs_rx_raw_data_t raw;
+
+	bool switch_to_rxd = (m_display_state != DISP_STATE_LORA_PACKET_DETAIL);
+
+	switch(evt)
+	{
+		case LORA_EVT_PACKET_RECEIVED:
+			// every frame occupies the channel, including duplicates
+			tracker_handle_received_frame(data->rx_packet_data.data_len);
+
+			// the archive keeps duplicates as well
+			rx_archive_add_packet(data);
+
+			// digipeated copies of a packet that was already received are
+			// dropped here, so they do not cause further processing or
+			// display updates.
+			if(dupe_cache_check_and_insert(
+						data->rx_packet_data.data,
+						data->rx_packet_data.data_len,
+						time_base_get())) {
+				char call[STATION_DB_CALL_LEN];
+
+				if(dupe_cache_get_source(
+							data->rx_packet_data.data,
+							data->rx_packet_data.data_len,
+							call, sizeof(call))) {
+					station_db_count_duplicate(call);
+				}
+
+				digipeater_handle_duplicate(
+						data->rx_packet_data.data,
+						data->rx_packet_data.data_len);
+
+				NRF_LOG_INFO("duplicate packet ignored");
+
+				m_lora_rx_busy = false;
+				break;
+			}
+
+			digipeater_handle_received_frame(
+					data->rx_packet_data.data,
+					data->rx_packet_data.data_len);
+
+			messaging_handle_received_frame(
+					data->rx_packet_data.data,
+					data->rx_packet_data.data_len);
+
+			// try to parse the packet.
+			rx_timestamp = wall_clock_get_unix();
+			rx_time_valid = wall_clock_is_valid();
+
+			decode_ok = aprs_parse_frame(
+			                       data->rx_packet_data.data,
+			                       data->rx_packet_data.data_len,
+			                       &decoded_frame);
+
+			if(decode_ok) {
+				raw.rssi       = data->rx_packet_data.rssi;
+				raw.signalRssi = data->rx_packet_data.signalRssi;
+				raw.snr        = data->rx_packet_data.snr;
+
+				memcpy(raw.data, data->rx_packet_data.data, data->rx_packet_data.data_len);
+				raw.data_len = data->rx_packet_data.data_len;
+
+				uint8_t idx = station_db_insert(
+						&decoded_frame,
+						&raw,
+						rx_timestamp,
+						rx_time_valid,
 						m_display_rx_index);
 
 				if(switch_to_rxd) {
@@ -945,7 +1666,7 @@ static void cb_lora(lora_evt_t evt, const lora_evt_data_t *data)
 				m_last_undecodable_timestamp = rx_timestamp;
 
 				if(switch_to_rxd) {
-					m_display_rx_index = APRS_RX_HISTORY_SIZE;
+					m_display_rx_index = STATION_DB_INVALID;
 				}
 			}
 
@@ -953,6 +1674,13 @@ static void cb_lora(lora_evt_t evt, const lora_evt_data_t *data)
 				m_display_state = DISP_STATE_LORA_RX_OVERVIEW;
 			}
 
+			if(kiss_service_notify_rx_frame(
+						&m_kiss_service,
+						data->rx_packet_data.data,
+						data->rx_packet_data.data_len) != NRF_SUCCESS) {
+				NRF_LOG_WARNING("KISS: queue full, frame dropped");
+			}
+
 			err_code = aprs_service_notify_rx_message(
 					&m_aprs_service,
 					m_conn_handle,
@@ -960,6 +1688,8 @@ static void cb_lora(lora_evt_t evt, const lora_evt_data_t *data)
 					data->rx_packet_data.data_len);
 
 			switch(err_code) {
+				case NRF_ERROR_NO_MEM:
+					// queue full, counted as dropped
 				case NRF_ERROR_RESOURCES:
 				case NRF_ERROR_INVALID_STATE:
 				case NRF_ERROR_BUSY:
@@ -975,7 +1705,7 @@ static void cb_lora(lora_evt_t evt, const lora_evt_data_t *data)
 			}
 
 			m_lora_rx_busy = false;
-			m_epaper_update_requested = true;
+			request_display_update();
 			break;
 
 		case LORA_EVT_CONFIGURED_IDLE:
@@ -990,29 +1720,42 @@ static void cb_lora(lora_evt_t evt, const lora_evt_data_t *data)
 
 		case LORA_EVT_RX_STARTED:
 			m_lora_rx_busy = true;
-			m_epaper_update_requested = true;
+			request_display_update();
 			break;
 
 		case LORA_EVT_TX_STARTED:
 			m_lora_tx_busy = true;
-			m_epaper_update_requested = true;
+			request_display_update();
 			break;
 
 		case LORA_EVT_TX_COMPLETE:
 			m_lora_tx_busy = false;
-			m_epaper_update_requested = true;
+
+			// a queued frame may have become due during the transmission
+			if(tx_queue_get_next_due_time() != UINT64_MAX) {
+				request_tx_queue_poll();
+			}
+
+			request_display_update();
 			break;
 
 		case LORA_EVT_OFF:
 			m_lora_rx_busy = false;
 			m_lora_tx_busy = false;
-			m_epaper_update_requested = true;
+			request_display_update();
 			m_shutdown_flags |= SHUTDOWN_FLAG_LORA_OFF;
 			break;
 
 		default:
 			break;
 	}
+
+	// a transmission that had to wait for the transmitter may be possible now
+	if(m_tx_queue_poll_requested) {
+		event_queue_post(EVENT_TX_QUEUE_POLL);
+	}
+
+	profiling_end(PROFILING_SPAN_CB_LORA, prof_start);
 }
 
 
@@ -1023,7 +1766,7 @@ static void cb_tracker(tracker_evt_t evt)
 	switch(evt) {
 		case TRACKER_EVT_TRANSMISSION_STARTED:
 			m_bme280_updated = false;
-			m_epaper_update_requested = true;
+			request_display_update();
 			break;
 	}
 }
@@ -1048,6 +1791,11 @@ static void cb_bme280(bme280_evt_t evt)
 
 		case BME280_EVT_READOUT_COMPLETE:
 			m_bme280_updated = true;
+
+			telemetry_add_sample(TELEMETRY_CH_TEMPERATURE, bme280_get_temperature());
+			telemetry_add_sample(TELEMETRY_CH_HUMIDITY,    bme280_get_humidity());
+			telemetry_add_sample(TELEMETRY_CH_PRESSURE,    bme280_get_pressure());
+
 			NRF_LOG_INFO("BME280 readout complete.");
 			break;
 	}
@@ -1076,22 +1824,20 @@ static void cb_buttons(uint8_t btn_id, uint8_t evt)
 					if(menusystem_is_active()) {
 						menusystem_input(MENUSYSTEM_INPUT_NEXT);
 					} else if(m_display_state == DISP_STATE_LORA_RX_OVERVIEW) {
-						const aprs_rx_history_t *history = aprs_get_rx_history();
-
-						// skip unset entries
-						do {
-							m_display_rx_index++;
-						} while(m_display_rx_index < APRS_RX_HISTORY_SIZE
-								&& history->history[m_display_rx_index].rx_timestamp == 0);
-
-						m_display_rx_index %= (APRS_RX_HISTORY_SIZE + 1);
+						// step through the stations from the most recent to the
+						// oldest one, then select the decoder error entry
+						if(m_display_rx_index == STATION_DB_INVALID) {
+							m_display_rx_index = station_db_first();
+						} else {
+							m_display_rx_index = station_db_next(m_display_rx_index);
+						}
 					}
 
 					// always refresh the display when touch button is pressed
 					// (only uses minimal additional power because the
 					// backlight is on anyways and the display therefore
 					// already powered).
-					m_epaper_update_requested = true;
+					request_display_update();
 				}
 			}
 			break;
@@ -1102,7 +1848,7 @@ static void cb_buttons(uint8_t btn_id, uint8_t evt)
 					menusystem_input(MENUSYSTEM_INPUT_CONFIRM);
 				} else if(m_display_state == DISP_STATE_PASSKEY) {
 					m_display_state = m_prev_display_state;
-					m_epaper_update_requested = true;
+					request_display_update();
 				} else if(buttons_button_is_pressed(BUTTONS_BTN_TOUCH)) {
 					// cycle through various module enable states:
 					// all off -> RX on -> RX+TX on -> TX on -> all off.
@@ -1125,12 +1871,12 @@ static void cb_buttons(uint8_t btn_id, uint8_t evt)
 						m_display_state++;
 					}
 
-					m_epaper_update_requested = true;
+					request_display_update();
 				}
 			} else if(evt == BUTTONS_EVT_LONGPRESS) {
 				if(!menusystem_is_active()) {
 					menusystem_enter();
-					m_epaper_update_requested = true;
+					request_display_update();
 				}
 			}
 			break;
@@ -1148,6 +1894,15 @@ static void cb_settings(settings_evt_t evt, settings_id_t id)
 	ret_code_t err_code;
 
 	switch(evt) {
+		case SETTINGS_EVT_RESTORE_COMPLETE:
+			NRF_LOG_INFO("Settings snapshot restored.");
+
+			aprs_service_notify_restore_status(&m_aprs_service, m_conn_handle,
+					APRS_SERVICE_RESTORE_STATUS_COMMITTED, SETTINGS_ID_INVALID);
+
+			// apply the restored settings like on startup
+			/* fall through */
+
 		case SETTINGS_EVT_INIT:
 			NRF_LOG_INFO("Settings initialized. Loading...");
 
@@ -1229,14 +1984,73 @@ static void cb_settings(settings_evt_t evt, settings_id_t id)
 				NRF_LOG_WARNING("Error while loading LoRa Modulation Config: 0x%08x", err_code);
 				// use default frequency set in aprs_init().
 			}
+
+			len = sizeof(buffer);
+			err_code = settings_query(SETTINGS_ID_SMARTBEACON, buffer, &len);
+			if(err_code == NRF_SUCCESS) {
+				tracker_smartbeacon_params_t params;
+
+				memcpy(&params, buffer, sizeof(params));
+
+				err_code = tracker_set_smartbeacon_params(&params);
+				NRF_LOG_INFO("SmartBeaconing parameters loaded: 0x%08x", err_code);
+			} else {
+				NRF_LOG_WARNING("Error while loading SmartBeaconing parameters: 0x%08x", err_code);
+				// use default parameters set in the tracker.
+			}
+
+			len = sizeof(buffer);
+			err_code = settings_query(SETTINGS_ID_DEAD_RECKONING, buffer, &len);
+			if(err_code == NRF_SUCCESS) {
+				uint16_t max_error_m = *(uint16_t*)buffer;
+				NRF_LOG_INFO("Dead reckoning max. error loaded: %d m", max_error_m);
+				tracker_set_dead_reckoning_max_error(max_error_m);
+			} else {
+				NRF_LOG_WARNING("Error while loading dead reckoning max. error: 0x%08x", err_code);
+				// dead reckoning stays disabled.
+			}
+
+			len = sizeof(buffer);
+			err_code = settings_query(SETTINGS_ID_ENERGY_MODEL, buffer, &len);
+			if(err_code == NRF_SUCCESS && len != ENERGY_MODEL_LEN) {
+				err_code = NRF_ERROR_INVALID_LENGTH;
+			}
+
+			if(err_code == NRF_SUCCESS) {
+				energy_model_t model;
+
+				memcpy(&model, buffer, sizeof(model));
+				energy_set_model(&model);
+				NRF_LOG_INFO("Energy model loaded.");
+			} else {
+				NRF_LOG_WARNING("Error while loading energy model: 0x%08x", err_code);
+				// use the default model.
+			}
+
+			update_settings_snapshot();
+			break;
+
+		case SETTINGS_EVT_RESTORE_FAILED:
+			NRF_LOG_ERROR("Settings snapshot could not be restored.");
+
+			aprs_service_notify_restore_status(&m_aprs_service, m_conn_handle,
+					APRS_SERVICE_RESTORE_STATUS_FLASH_ERROR, SETTINGS_ID_INVALID);
 			break;
 
 		case SETTINGS_EVT_UPDATE_COMPLETE:
-			// whenever the last BLE symbol code was stored, also update the
-			// current APRS symbol
-			if(id == SETTINGS_ID_LAST_BLE_SYMBOL) {
-				aprs_get_icon((char*)&buffer[0], (char*)&buffer[1]);
-				settings_write(SETTINGS_ID_SYMBOL_CODE, buffer, 2);
+			NRF_LOG_INFO("Setting %d saved.", id);
+			break;
+
+		case SETTINGS_EVT_FLUSH_COMPLETE:
+			update_settings_snapshot();
+
+			// writes rejected because the flash is full do not cause an FDS event
+			storage_check();
+
+			if(m_shutdown_flags & SHUTDOWN_FLAG_INITIATED) {
+				// continue the shutdown even if the flash could not be written
+				m_shutdown_flags |= SHUTDOWN_FLAG_SETTINGS_SAVED;
+				request_display_update();
 			}
 			break;
 	}
@@ -1270,11 +2084,13 @@ static void cb_menusystem(menusystem_evt_t evt, const menusystem_evt_data_t *dat
 				m_tracker_active = true;
 				tracker_reset_tx_counter();
 				tracker_force_tx();
+				gnss_sched_reset(time_base_get());
 			}
 			break;
 
 		case MENUSYSTEM_EVT_TRACKER_DISABLE:
 			m_tracker_active = false;
+			track_log_save();
 			break;
 
 		case MENUSYSTEM_EVT_GNSS_WARMUP_ENABLE:
@@ -1321,14 +2137,21 @@ static void cb_menusystem(menusystem_evt_t evt, const menusystem_evt_data_t *dat
 			// initiate the shutdown
 			m_shutdown_flags = SHUTDOWN_FLAG_INITIATED;
 
+			// write pending setting changes. Continued on SETTINGS_EVT_FLUSH_COMPLETE.
+			if(settings_flush() != NRF_SUCCESS) {
+				m_shutdown_flags |= SHUTDOWN_FLAG_SETTINGS_SAVED;
+			}
+
 			// clear the display
 			m_display_state = DISP_STATE_CLEAR;
-			m_epaper_update_requested = true;
+			request_display_update();
 			m_epaper_force_full_refresh = true;
 
 			// put LoRa into low power mode
 			m_lora_rx_active = false;
 			m_tracker_active = false;
+			track_log_save();
+
 			if(lora_is_off()) {
 				m_shutdown_flags |= SHUTDOWN_FLAG_LORA_OFF;
 			} else {
@@ -1358,11 +2181,17 @@ static void cb_menusystem(menusystem_evt_t evt, const menusystem_evt_data_t *dat
 		voltage_monitor_start(VOLTAGE_MONITOR_INTERVAL_IDLE);
 	}
 
+	if(m_gnss_keep_active && gps_is_standby()) {
+		// the user wants the GNSS to be active now
+		APP_ERROR_CHECK(gps_wakeup());
+		gnss_sched_wakeup(time_base_get());
+	}
+
 	if(gnss_cold_reboot_request) {
 		APP_ERROR_CHECK(gps_cold_restart());
 	}
 
-	m_epaper_update_requested = true;
+	request_display_update();
 }
 
 /**@brief Function for initializing the BLE stack.
@@ -1526,12 +2355,24 @@ static void buttons_leds_init(void)
 
 /**@brief Function for initializing the nrf log module.
 */
+static size_t trace_output_rtt(const uint8_t *data, size_t len)
+{
+	return SEGGER_RTT_Write(TRACE_RTT_CHANNEL, data, len);
+}
+
+
 static void log_init(void)
 {
 	ret_code_t err_code = NRF_LOG_INIT(NULL);
 	APP_ERROR_CHECK(err_code);
 
 	NRF_LOG_DEFAULT_BACKENDS_INIT();
+
+	// the binary trace is sent on its own channel, so it does not disturb
+	// the text log. Events that do not fit are dropped and counted.
+	SEGGER_RTT_ConfigUpBuffer(TRACE_RTT_CHANNEL, "Trace", m_trace_rtt_buffer,
+			sizeof(m_trace_rtt_buffer), SEGGER_RTT_MODE_NO_BLOCK_TRIM);
+	trace_init(trace_output_rtt);
 }
 
 
@@ -1551,9 +2392,13 @@ static void power_management_init(void)
  */
 static void idle_state_handle(void)
 {
-	if (NRF_LOG_PROCESS() == false)
+	bool trace_pending = trace_flush();
+
+	if (NRF_LOG_PROCESS() == false && !trace_pending)
 	{
+		profiling_sleep_enter();
 		nrf_pwr_mgmt_run();
+		profiling_sleep_exit();
 	}
 }
 
@@ -1608,6 +2453,453 @@ static void apply_startup_settings(void)
 }
 
 
+/**@brief Redraw the display if requested and continue a pending shutdown.
+ * @details
+ * Called for EVENT_DISPLAY_UPDATE and EVENT_EPAPER_IDLE, so requests that
+ * arrive during a running update are handled once the display is ready.
+ */
+static void handle_display_update(void)
+{
+	static bool first_redraw = true;
+
+	if(epaper_is_busy()) {
+		return;
+	}
+
+	if(m_epaper_update_requested) {
+		m_epaper_update_requested = false;
+
+		if(first_redraw) {
+			first_redraw = false;
+
+			bool erase_bonds = buttons_button_is_pressed(BUTTONS_BTN_1);
+			advertising_start(erase_bonds);
+		}
+
+		if((m_shutdown_flags & SHUTDOWN_FLAG_INITIATED) == 0
+				|| (m_shutdown_flags & SHUTDOWN_FLAG_DISPLAY_LOCKED) == 0) {
+			// lock display redraws after shutdown was initiated
+			m_shutdown_flags |= SHUTDOWN_FLAG_DISPLAY_LOCKED;
+
+			redraw_display(m_epaper_force_full_refresh);
+			m_epaper_force_full_refresh = false;
+		}
+	}
+
+	if(((m_shutdown_flags & SHUTDOWN_FLAG_DISPLAY_LOCKED) != 0) && !epaper_is_busy()) {
+		m_shutdown_flags |= SHUTDOWN_FLAG_DISPLAY_CLEARED;
+	}
+
+	// handle shutdown
+	if(m_shutdown_flags == SHUTDOWN_FLAG_ALL_SET) {
+		sleep_mode_enter();
+	}
+}
+
+
+/**@brief Transmit due frames from the transmit queue if requested.
+ * @details
+ * Queued frames are only sent if the transmitter is free. A running reception
+ * is aborted, like it is done for tracker transmissions. Otherwise, the poll
+ * is repeated on the next LoRa event.
+ */
+static void handle_tx_queue_poll(void)
+{
+	if(m_tx_queue_poll_requested && !m_lora_tx_busy
+			&& (m_lora_rx_busy || !lora_is_busy())) {
+		m_tx_queue_poll_requested = false;
+		tx_queue_transmit_due_frame();
+	}
+}
+
+
+/**@brief Run a due flash garbage collection if the transmitter and the display are idle.
+ * @details
+ * Erasing a flash page halts the CPU, which would delay a transmission or a
+ * display update. The receiver is not considered, as it runs continuously.
+ * If anything is busy, the GC is retried on the next low speed tick.
+ */
+static void handle_storage_gc(void)
+{
+	if(m_lora_tx_busy || epaper_is_busy()) {
+		return;
+	}
+
+	if(m_shutdown_flags & SHUTDOWN_FLAG_INITIATED) {
+		// the device is switched off as soon as the settings are saved
+		return;
+	}
+
+	uint64_t due = tx_queue_get_next_due_time();
+
+	if(due != UINT64_MAX && due < time_base_get() + STORAGE_GC_TX_GUARD_MS) {
+		return;
+	}
+
+	ret_code_t err_code = storage_run_gc();
+
+	if(err_code != NRF_SUCCESS) {
+		NRF_LOG_WARNING("storage: cannot start GC: 0x%08x", err_code);
+	}
+}
+
+
+/**@brief Send queued received messages to the BLE client.
+ */
+static void handle_ble_rx_notify(void)
+{
+	bool batching = (aprs_get_config_flags() & APRS_FLAG_BLE_RX_BATCHING) != 0;
+
+	aprs_service_send_rx_notifications(&m_aprs_service, m_conn_handle, batching);
+
+	if(notify_queue_count(&m_aprs_service.rx_queue) > 0) {
+		// the SoftDevice buffers are full: speed up the connection
+		request_ble_bulk();
+	}
+}
+
+
+/**@brief Send queued received frames to the BLE KISS client.
+ */
+static void handle_ble_kiss_notify(void)
+{
+	kiss_service_send_notifications(&m_kiss_service, m_conn_handle);
+
+	if(m_kiss_service.chunk_len > 0) {
+		// the SoftDevice buffers are full: speed up the connection
+		request_ble_bulk();
+	}
+}
+
+
+/**@brief Write the queued received packets to the RX archive.
+ */
+static void handle_rx_archive_write(void)
+{
+	ret_code_t err_code = rx_archive_write_queued();
+	if(err_code != NRF_SUCCESS) {
+		NRF_LOG_WARNING("RX archive: write failed: 0x%08x", err_code);
+	}
+
+	rx_archive_stats_t stats;
+	rx_archive_get_stats(&stats);
+
+	aprs_service_set_rx_archive_info(&m_aprs_service, stats.first_seq, stats.next_seq);
+}
+
+
+/**@brief Write a full track log page to the external flash.
+ * @details
+ * A sector erase is polled from a timer, so other events are handled while
+ * it runs.
+ */
+static void handle_track_log_write(void)
+{
+	ret_code_t err_code = track_log_write();
+	if(err_code == NRF_ERROR_BUSY) {
+		// a new fix may have posted the event while the timer was running
+		APP_ERROR_CHECK(app_timer_stop(m_track_log_timer));
+		APP_ERROR_CHECK(app_timer_start(m_track_log_timer, APP_TIMER_TICKS(TRACK_LOG_ERASE_POLL_MS), NULL));
+	} else if(err_code != NRF_SUCCESS) {
+		NRF_LOG_WARNING("track log: write failed: 0x%08x", err_code);
+	}
+}
+
+
+/**@brief Send chunks of a BLE download until the SoftDevice buffers are full.
+ * @details
+ * A chunk that cannot be sent is kept and sent first on the next call, which
+ * should follow the next BLE_GATTS_EVT_HVN_TX_COMPLETE event. The source is
+ * therefore only read as fast as the connection can transfer the data.
+ *
+ * @param[in] stream  The pending chunk of the download.
+ * @param[in] read    Reads the next chunk from the source, returns 0 at the end.
+ * @param[in] notify  Sends a chunk as notification.
+ *
+ * @retval NRF_ERROR_RESOURCES  The buffers are full; the stream continues later.
+ * @retval NRF_SUCCESS          The end of the stream was sent.
+ * @returns                     Any other error of the notification.
+ */
+static ret_code_t ble_stream_send(ble_stream_t *stream, ble_stream_read_t read, ble_stream_notify_t notify)
+{
+	for(;;) {
+		if(stream->chunk_len == 0) {
+			size_t max_len = m_aprs_service.max_notify_len;
+
+			if(max_len > sizeof(stream->chunk)) {
+				max_len = sizeof(stream->chunk);
+			}
+
+			stream->chunk_len = read(stream->chunk, max_len);
+
+			if(stream->chunk_len == 0) {
+				return NRF_SUCCESS;
+			}
+		}
+
+		ret_code_t err_code = notify(&m_aprs_service, m_conn_handle,
+				stream->chunk, stream->chunk_len);
+
+		if(err_code == NRF_ERROR_RESOURCES) {
+			// the SoftDevice buffers are full: speed up the connection
+			request_ble_bulk();
+			return err_code;
+		}
+
+		if(err_code != NRF_SUCCESS) {
+			return err_code;
+		}
+
+		stream->chunk_len = 0;
+	}
+}
+
+
+/**@brief Read the next chunk of the RX archive download.
+ */
+static size_t rx_archive_stream_read(uint8_t *buf, size_t max_len)
+{
+	return rx_archive_read_stream(&m_archive_reader, buf, max_len);
+}
+
+
+/**@brief Stop a running RX archive download.
+ */
+static void rx_archive_download_stop(void)
+{
+	if(m_archive_reading) {
+		rx_archive_read_end(&m_archive_reader);
+		m_archive_reading = false;
+	}
+
+	m_archive_stream.chunk_len = 0;
+}
+
+
+/**@brief Send the next part of the RX archive to the BLE client.
+ */
+static void handle_ble_archive_notify(void)
+{
+	if(m_archive_cancel || m_archive_request) {
+		m_archive_cancel = false;
+		rx_archive_download_stop();
+	}
+
+	if(m_archive_request) {
+		m_archive_request = false;
+
+		if(!m_rx_archive_available) {
+			return;
+		}
+
+		ret_code_t err_code = rx_archive_read_start(&m_archive_reader, m_archive_start_seq, m_archive_count);
+		if(err_code != NRF_SUCCESS) {
+			NRF_LOG_WARNING("RX archive: cannot start download: 0x%08x", err_code);
+			return;
+		}
+
+		m_archive_reading = true;
+	}
+
+	if(!m_archive_reading) {
+		return;
+	}
+
+	if(ble_conn_state_status(m_conn_handle) != BLE_CONN_STATUS_CONNECTED) {
+		rx_archive_download_stop();
+		return;
+	}
+
+	ret_code_t err_code = ble_stream_send(&m_archive_stream, rx_archive_stream_read,
+			aprs_service_notify_rx_archive);
+
+	if(err_code == NRF_ERROR_RESOURCES) {
+		return;
+	}
+
+	if(err_code != NRF_SUCCESS) {
+		// e.g. notifications are disabled
+		NRF_LOG_WARNING("RX archive: download aborted: 0x%08x", err_code);
+	}
+
+	// the end marker was sent or the download failed
+	rx_archive_download_stop();
+}
+
+
+/**@brief Read the next chunk of the track export.
+ */
+static size_t track_export_stream_read(uint8_t *buf, size_t max_len)
+{
+	return track_export_read(&m_track_export, buf, max_len);
+}
+
+
+/**@brief Stop a running track export.
+ */
+static void track_export_stop(void)
+{
+	if(m_track_exporting) {
+		NRF_LOG_INFO("track export: %u fixes, %u bytes.", m_track_export.fixes, m_track_export.bytes);
+
+		track_export_end(&m_track_export);
+		m_track_exporting = false;
+	}
+
+	m_track_stream.chunk_len = 0;
+}
+
+
+/**@brief Send the next part of the track export to the BLE client.
+ * @details
+ * Like the RX archive, the stream is generated only as fast as the connection
+ * can transfer it (see @ref ble_stream_send()).
+ */
+static void handle_ble_track_notify(void)
+{
+	if(m_track_cancel || m_track_request) {
+		m_track_cancel = false;
+		track_export_stop();
+	}
+
+	if(m_track_request) {
+		m_track_request = false;
+
+		if(!m_track_log_available) {
+			return;
+		}
+
+		// include the positions that are still buffered
+		track_log_save();
+
+		ret_code_t err_code = track_export_start(&m_track_export, m_track_format,
+				m_track_start_time, m_track_end_time);
+		if(err_code != NRF_SUCCESS) {
+			NRF_LOG_WARNING("track export: cannot start: 0x%08x", err_code);
+			return;
+		}
+
+		m_track_exporting = true;
+	}
+
+	if(!m_track_exporting) {
+		return;
+	}
+
+	if(ble_conn_state_status(m_conn_handle) != BLE_CONN_STATUS_CONNECTED) {
+		track_export_stop();
+		return;
+	}
+
+	ret_code_t err_code = ble_stream_send(&m_track_stream, track_export_stream_read,
+			aprs_service_notify_track_export);
+
+	if(err_code == NRF_ERROR_RESOURCES) {
+		return;
+	}
+
+	if(err_code != NRF_SUCCESS) {
+		NRF_LOG_WARNING("track export: aborted: 0x%08x", err_code);
+	}
+
+	// the end of the stream was sent or the export failed
+	track_export_stop();
+}
+
+
+/**@brief Fill the GAP connection parameters for a connection policy mode.
+ */
+static void conn_policy_get_gap_params(conn_policy_mode_t mode, ble_gap_conn_params_t *params)
+{
+	if(mode == CONN_POLICY_MODE_BULK) {
+		params->min_conn_interval = MSEC_TO_UNITS(CONN_POLICY_BULK_MIN_INTERVAL_MS, UNIT_1_25_MS);
+		params->max_conn_interval = MSEC_TO_UNITS(CONN_POLICY_BULK_MAX_INTERVAL_MS, UNIT_1_25_MS);
+		params->slave_latency     = CONN_POLICY_BULK_SLAVE_LATENCY;
+		params->conn_sup_timeout  = MSEC_TO_UNITS(CONN_POLICY_BULK_SUP_TIMEOUT_MS, UNIT_10_MS);
+	} else {
+		params->min_conn_interval = MIN_CONN_INTERVAL;
+		params->max_conn_interval = MAX_CONN_INTERVAL;
+		params->slave_latency     = SLAVE_LATENCY;
+		params->conn_sup_timeout  = CONN_SUP_TIMEOUT;
+	}
+}
+
+
+/**@brief Update the connection policy and request new connection parameters if necessary.
+ * @details
+ * The data length is already extended by the GATT module when the
+ * connection is established, so only the interval and the PHY are changed
+ * here.
+ */
+static void handle_ble_conn_policy(void)
+{
+	uint64_t now = time_base_get();
+	conn_policy_action_t action;
+
+	if(m_ble_conn_changed) {
+		m_ble_conn_changed = false;
+
+		conn_policy_handle_disconnected();
+
+		if(ble_conn_state_status(m_conn_handle) == BLE_CONN_STATUS_CONNECTED) {
+			conn_policy_handle_connected(now);
+		}
+	}
+
+	if(m_ble_conn_params_rejected) {
+		m_ble_conn_params_rejected = false;
+
+		NRF_LOG_WARNING("BLE client rejected the connection parameters.");
+		conn_policy_handle_rejected();
+	}
+
+	if(m_ble_bulk_requested) {
+		m_ble_bulk_requested = false;
+		conn_policy_handle_activity(now);
+	}
+
+	if(conn_policy_poll(now, &action)) {
+		ble_gap_conn_params_t params;
+
+		conn_policy_get_gap_params(action.mode, &params);
+
+		ret_code_t err_code = ble_conn_params_change_conn_params(m_conn_handle, &params);
+
+		if(err_code == NRF_SUCCESS && action.request_2m_phy) {
+			ble_gap_phys_t const phys =
+			{
+				.rx_phys = BLE_GAP_PHY_2MBPS,
+				.tx_phys = BLE_GAP_PHY_2MBPS,
+			};
+
+			// not supported by all clients, so failures are only logged
+			ret_code_t phy_err_code = sd_ble_gap_phy_update(m_conn_handle, &phys);
+
+			if(phy_err_code != NRF_SUCCESS) {
+				NRF_LOG_INFO("PHY update not possible: 0x%08x", phy_err_code);
+			}
+		}
+
+		conn_policy_handle_request_result(now, &action, err_code == NRF_SUCCESS);
+	}
+
+	// schedule the next update
+	APP_ERROR_CHECK(app_timer_stop(m_conn_policy_timer));
+
+	uint64_t next = conn_policy_get_next_time(now);
+
+	if(next != CONN_POLICY_NEVER) {
+		uint32_t ticks = APP_TIMER_TICKS(next - now);
+
+		if(ticks < APP_TIMER_MIN_TIMEOUT_TICKS) {
+			ticks = APP_TIMER_MIN_TIMEOUT_TICKS;
+		}
+
+		APP_ERROR_CHECK(app_timer_start(m_conn_policy_timer, ticks, NULL));
+	}
+}
+
+
 /**@brief Function for application main entry.
 */
 int main(void)
@@ -1615,12 +2907,24 @@ int main(void)
 
 	// Initialize.
 	log_init();
+	profiling_init();
+	APP_ERROR_CHECK(event_queue_init());
 	gpio_init();
 	timers_init();
 	power_management_init();
 
 	// settings set some values in this module, so we must initialize it first.
 	aprs_init();
+	station_db_init();
+	dupe_cache_init();
+	airtime_init();
+	digipeater_init();
+	messaging_init();
+	telemetry_init();
+	conn_policy_init();
+
+	// monitor the flash storage (must be done before settings_init()!)
+	APP_ERROR_CHECK(storage_init());
 
 	// load the settings (must be done before peer_manager_init()!)
 	settings_init(cb_settings);
@@ -1637,6 +2941,7 @@ int main(void)
 
 	periph_pwr_init();
 	time_base_init();
+	energy_init(time_base_get());
 	wall_clock_init();
 	epaper_init();
 	gps_init(cb_gps);
@@ -1645,10 +2950,43 @@ int main(void)
 	tracker_init(cb_tracker);
 	APP_ERROR_CHECK(bme280_init(cb_bme280));
 
+	// the device is usable without the track log and the RX archive
+	APP_ERROR_CHECK(spi_flash_init());
+
+	ret_code_t err_code = track_log_init();
+	if(err_code == NRF_SUCCESS) {
+		m_track_log_available = true;
+	} else {
+		NRF_LOG_ERROR("track log: init failed: 0x%08x", err_code);
+	}
+
+	err_code = rx_archive_init();
+	if(err_code == NRF_SUCCESS) {
+		m_rx_archive_available = true;
+
+		rx_archive_stats_t rx_archive_stats;
+		rx_archive_get_stats(&rx_archive_stats);
+		aprs_service_set_rx_archive_info(&m_aprs_service, rx_archive_stats.first_seq, rx_archive_stats.next_seq);
+	} else {
+		NRF_LOG_ERROR("RX archive: init failed: 0x%08x", err_code);
+	}
+
 	voltage_monitor_init(cb_voltage_monitor);
 
 	menusystem_init(cb_menusystem);
 
+	event_queue_register(EVENT_DISPLAY_UPDATE, handle_display_update);
+	event_queue_register(EVENT_EPAPER_IDLE, handle_display_update);
+	event_queue_register(EVENT_TX_QUEUE_POLL, handle_tx_queue_poll);
+	event_queue_register(EVENT_BLE_RX_NOTIFY, handle_ble_rx_notify);
+	event_queue_register(EVENT_BLE_KISS_NOTIFY, handle_ble_kiss_notify);
+	event_queue_register(EVENT_BLE_CONN_POLICY, handle_ble_conn_policy);
+	event_queue_register(EVENT_STORAGE_GC, handle_storage_gc);
+	event_queue_register(EVENT_RX_ARCHIVE_WRITE, handle_rx_archive_write);
+	event_queue_register(EVENT_BLE_ARCHIVE_NOTIFY, handle_ble_archive_notify);
+	event_queue_register(EVENT_BLE_TRACK_NOTIFY, handle_ble_track_notify);
+	event_queue_register(EVENT_TRACK_LOG_WRITE, handle_track_log_write);
+
 	// Start execution.
 	NRF_LOG_INFO("LoRa-APRS started.");
 	application_timers_start();
@@ -1672,43 +3010,10 @@ int main(void)
 	m_display_state = DISP_STATE_STARTUP;
 	redraw_display(true);
 
-	bool first_redraw = true;
-
 	// Enter main loop.
 	for (;;)
 	{
-		if(m_epaper_update_requested && !epaper_is_busy()) {
-			m_epaper_update_requested = false;
-
-			if(first_redraw) {
-				first_redraw = false;
-
-				bool erase_bonds = buttons_button_is_pressed(BUTTONS_BTN_1);
-				advertising_start(erase_bonds);
-			}
-
-			if((m_shutdown_flags & SHUTDOWN_FLAG_INITIATED) == 0
-					|| (m_shutdown_flags & SHUTDOWN_FLAG_DISPLAY_LOCKED) == 0) {
-				// lock display redraws after shutdown was initiated
-				m_shutdown_flags |= SHUTDOWN_FLAG_DISPLAY_LOCKED;
-
-				redraw_display(m_epaper_force_full_refresh);
-				m_epaper_force_full_refresh = false;
-			}
-		} else if(((m_shutdown_flags & SHUTDOWN_FLAG_DISPLAY_LOCKED) != 0) && !epaper_is_busy()) {
-			m_shutdown_flags |= SHUTDOWN_FLAG_DISPLAY_CLEARED;
-		}
-
-		// handle shutdown
-		if(m_shutdown_flags == SHUTDOWN_FLAG_ALL_SET) {
-			sleep_mode_enter();
-		}
-
-		epaper_loop();
-		gps_loop();
-		lora_loop();
-		bme280_loop();
-
+		event_queue_dispatch();
 		idle_state_handle();
 	}
 }
@@ -68,6 +68,7 @@ enum aprs_config_adv_entry_ids_t {
 	APRS_CONFIG_ADV_ENTRY_IDX_WEATHER           = 3,
 	APRS_CONFIG_ADV_ENTRY_IDX_STARTUP           = 4,
 	APRS_CONFIG_ADV_ENTRY_IDX_DIGIPEATING       = 5,
+	APRS_CONFIG_ADV_ENTRY_IDX_FILL_IN_DIGI      = 6,
 
 	APRS_CONFIG_ADV_ENTRY_COUNT
 };
@@ -265,6 +266,13 @@ static void menusystem_update_values(void)
 		}
 	}
 
+	entry = &(m_aprs_config_adv_menu.entries[APRS_CONFIG_ADV_ENTRY_IDX_FILL_IN_DIGI]);
+	if(aprs_flags & APRS_FLAG_FILL_IN_DIGIPEATER) {
+		strncpy(entry->value,  "on", sizeof(entry->value));
+	} else {
+		strncpy(entry->value,  "off", sizeof(entry->value));
+	}
+
 	// info menu
 	entry = &(m_info_menu.entries[INFO_ENTRY_IDX_APRS_SOURCE]);
 	aprs_get_source(entry->value, sizeof(entry->value));
@@ -476,6 +484,11 @@ static void menu_handler_aprs_config_adv(menu_t *menu, menuentry_t *entry)
 			}
 			break;
 
+		case APRS_CONFIG_ADV_ENTRY_IDX_FILL_IN_DIGI:
+			aprs_toggle_config_flag(APRS_FLAG_FILL_IN_DIGIPEATER);
+			flags_changed = true;
+			break;
+
 		default:
 			m_selected_entry = 0;
 			m_callback(MENUSYSTEM_EVT_REDRAW_REQUIRED, NULL);
@@ -678,6 +691,10 @@ void menusystem_init(menusystem_callback_t callback)
 	m_aprs_config_adv_menu.entries[APRS_CONFIG_ADV_ENTRY_IDX_DIGIPEATING].text = "Digipeating";
 	m_aprs_config_adv_menu.entries[APRS_CONFIG_ADV_ENTRY_IDX_DIGIPEATING].value[0] = '\0';
 
+	m_aprs_config_adv_menu.entries[APRS_CONFIG_ADV_ENTRY_IDX_FILL_IN_DIGI].handler = menu_handler_aprs_config_adv;
+	m_aprs_config_adv_menu.entries[APRS_CONFIG_ADV_ENTRY_IDX_FILL_IN_DIGI].text = "Fill-in digi";
+	m_aprs_config_adv_menu.entries[APRS_CONFIG_ADV_ENTRY_IDX_FILL_IN_DIGI].value[0] = '\0';
+
 	// prepare the symbol select menu
 	m_symbol_select_menu.n_entries = SYMBOL_SELECT_ENTRY_COUNT;
 	m_symbol_select_menu.entries = m_symbol_select_entries;
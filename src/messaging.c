@@ -0,0 +1,544 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <stdio.h>
+
+#include "airtime.h"
+
+#include "messaging.h"
+
+typedef struct
+{
+	char     call[MESSAGING_CALL_LEN];
+	char     msg_id[APRS_MAX_MESSAGE_ID_LEN + 1];
+	uint64_t due;
+	bool     valid;
+} ack_entry_t;
+
+typedef struct
+{
+	char     addressee[APRS_MESSAGE_ADDRESSEE_LEN + 1];
+	char     text[APRS_MAX_MESSAGE_TEXT_LEN + 1];
+	char     msg_id[APRS_MAX_MESSAGE_ID_LEN + 1];
+	uint64_t due;
+	uint32_t interval;
+	uint8_t  tries;
+	bool     valid;
+} outbox_entry_t;
+
+static messaging_inbox_entry_t m_inbox[MESSAGING_INBOX_SIZE];
+static uint8_t                 m_inbox_next;
+static uint8_t                 m_inbox_count;
+
+static outbox_entry_t m_outbox[MESSAGING_OUTBOX_SIZE];
+static ack_entry_t    m_ack_queue[MESSAGING_ACK_QUEUE_SIZE];
+
+static uint8_t  m_ack_tokens;
+static uint64_t m_ack_refill_time;
+
+static uint32_t m_next_msg_id;
+
+static messaging_stats_t m_stats;
+
+
+/**@brief Copy at most size-1 characters and terminate the string.
+ */
+static void copy_string(char *dest, size_t size, const char *src, size_t len)
+{
+	if(len >= size) {
+		len = size - 1;
+	}
+
+	memcpy(dest, src, len);
+	dest[len] = '\0';
+}
+
+
+/**@brief Extract a message ID that ends at '}' or at the end of the text.
+ * @returns  False if the ID is empty or too long.
+ */
+static bool extract_msg_id(const char *start, const char *end, char *msg_id)
+{
+	const char *id_end = memchr(start, '}', end - start);
+	if(!id_end) {
+		id_end = end;
+	}
+
+	size_t id_len = id_end - start;
+
+	if(id_len == 0 || id_len > APRS_MAX_MESSAGE_ID_LEN) {
+		return false;
+	}
+
+	copy_string(msg_id, APRS_MAX_MESSAGE_ID_LEN + 1, start, id_len);
+	return true;
+}
+
+
+/**@brief Check whether the text after "ack"/"rej" is a valid message ID.
+ * @details The ID has 1 to APRS_MAX_MESSAGE_ID_LEN alphanumeric characters and
+ * may be followed by '}' (reply-ack format). A '{' anywhere makes the text a
+ * normal message.
+ */
+static bool is_ack_id(const char *start, const char *end)
+{
+	if(memchr(start, '{', end - start)) {
+		return false;
+	}
+
+	const char *p = start;
+	while(p < end && *p != '}') {
+		char c = *p;
+		if(!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))) {
+			return false;
+		}
+		p++;
+	}
+
+	size_t id_len = p - start;
+	return id_len > 0 && id_len <= APRS_MAX_MESSAGE_ID_LEN;
+}
+
+
+/**@brief Queue an acknowledgement for an inbox entry, if the rate limit allows it.
+ */
+static void queue_ack(messaging_inbox_entry_t *entry, uint64_t now)
+{
+	if(entry->rx_count > 1 && (now - entry->last_ack_time) < MESSAGING_ACK_HOLDOFF_MS) {
+		m_stats.acks_suppressed++;
+		return;
+	}
+
+	// refill the token bucket
+	while(m_ack_tokens < MESSAGING_ACK_BUCKET_SIZE
+			&& (now - m_ack_refill_time) >= MESSAGING_ACK_REFILL_MS) {
+		m_ack_tokens++;
+		m_ack_refill_time += MESSAGING_ACK_REFILL_MS;
+	}
+
+	if(m_ack_tokens == MESSAGING_ACK_BUCKET_SIZE) {
+		m_ack_refill_time = now;
+	}
+
+	if(m_ack_tokens == 0) {
+		m_stats.acks_suppressed++;
+		return;
+	}
+
+	for(uint8_t i = 0; i < MESSAGING_ACK_QUEUE_SIZE; i++) {
+		ack_entry_t *ack = &m_ack_queue[i];
+
+		if(ack->valid) {
+			continue;
+		}
+
+		strcpy(ack->call, entry->source);
+		strcpy(ack->msg_id, entry->msg_id);
+		ack->due = now;
+		ack->valid = true;
+
+		entry->last_ack_time = now;
+		m_ack_tokens--;
+		return;
+	}
+
+	m_stats.acks_suppressed++;
+}
+
+
+/**@brief Find a message in the inbox.
+ * @details
+ * Messages with ID are identified by source and ID, messages without ID by
+ * source and text.
+ */
+static messaging_inbox_entry_t* find_in_inbox(const messaging_msg_t *msg)
+{
+	for(uint8_t i = 0; i < MESSAGING_INBOX_SIZE; i++) {
+		messaging_inbox_entry_t *entry = &m_inbox[i];
+
+		if(!entry->valid || strcmp(entry->source, msg->source) != 0) {
+			continue;
+		}
+
+		if(msg->msg_id[0] != '\0') {
+			if(strcmp(entry->msg_id, msg->msg_id) == 0) {
+				return entry;
+			}
+		} else if(entry->msg_id[0] == '\0' && strcmp(entry->text, msg->text) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+
+static messaging_rx_result_t handle_message(const messaging_msg_t *msg, uint64_t now)
+{
+	messaging_rx_result_t result = MESSAGING_RX_REPEATED_MESSAGE;
+
+	messaging_inbox_entry_t *entry = find_in_inbox(msg);
+
+	if(!entry) {
+		// store the message, replacing the oldest one if the inbox is full
+		entry = &m_inbox[m_inbox_next];
+
+		strcpy(entry->source, msg->source);
+		strcpy(entry->text, msg->text);
+		strcpy(entry->msg_id, msg->msg_id);
+		entry->rx_time = now;
+		entry->last_ack_time = 0;
+		entry->rx_count = 0;
+		entry->valid = true;
+
+		m_inbox_next = (m_inbox_next + 1) % MESSAGING_INBOX_SIZE;
+		if(m_inbox_count < MESSAGING_INBOX_SIZE) {
+			m_inbox_count++;
+		}
+
+		result = MESSAGING_RX_NEW_MESSAGE;
+	}
+
+	if(entry->rx_count < UINT8_MAX) {
+		entry->rx_count++;
+	}
+
+	if(entry->msg_id[0] != '\0') {
+		queue_ack(entry, now);
+	}
+
+	return result;
+}
+
+
+static messaging_rx_result_t handle_ack_or_rej(const messaging_msg_t *msg)
+{
+	for(uint8_t i = 0; i < MESSAGING_OUTBOX_SIZE; i++) {
+		outbox_entry_t *entry = &m_outbox[i];
+
+		if(entry->valid
+				&& strcmp(entry->addressee, msg->source) == 0
+				&& strcmp(entry->msg_id, msg->msg_id) == 0) {
+			entry->valid = false;
+
+			if(msg->type == MESSAGING_TYPE_ACK) {
+				m_stats.msg_acked++;
+				return MESSAGING_RX_ACK;
+			} else {
+				m_stats.msg_failed++;
+				return MESSAGING_RX_REJ;
+			}
+		}
+	}
+
+	return MESSAGING_RX_IGNORED;
+}
+
+
+void messaging_init(void)
+{
+	memset(m_inbox, 0, sizeof(m_inbox));
+	m_inbox_next = 0;
+	m_inbox_count = 0;
+
+	memset(m_outbox, 0, sizeof(m_outbox));
+	memset(m_ack_queue, 0, sizeof(m_ack_queue));
+
+	m_ack_tokens = MESSAGING_ACK_BUCKET_SIZE;
+	m_ack_refill_time = 0;
+
+	m_next_msg_id = 1;
+
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+bool messaging_parse(const uint8_t *frame, size_t len, messaging_msg_t *msg)
+{
+	// skip the LoRa-APRS header, if present
+	if(len > 3 && frame[0] == '<' && frame[1] == 0xFF && frame[2] == 0x01) {
+		frame += 3;
+		len -= 3;
+	}
+
+	const char *start = (const char*)frame;
+	const char *end = start + len;
+
+	const char *src_end = memchr(start, '>', len);
+	if(!src_end) {
+		return false;
+	}
+
+	const char *info = memchr(src_end, ':', end - src_end);
+	if(!info) {
+		return false;
+	}
+
+	// info field: ":ADDRESSEE:text"
+	const char *addressee = info + 2;
+	const char *text = addressee + APRS_MESSAGE_ADDRESSEE_LEN + 1;
+
+	if(text > end || info[1] != ':' || text[-1] != ':') {
+		return false;
+	}
+
+	copy_string(msg->source, sizeof(msg->source), start, src_end - start);
+
+	size_t addressee_len = APRS_MESSAGE_ADDRESSEE_LEN;
+	while(addressee_len > 0 && addressee[addressee_len - 1] == ' ') {
+		addressee_len--;
+	}
+
+	if(addressee_len == 0) {
+		return false;
+	}
+
+	copy_string(msg->addressee, sizeof(msg->addressee), addressee, addressee_len);
+
+	msg->msg_id[0] = '\0';
+
+	size_t text_len = end - text;
+
+	if(text_len > 3 && (memcmp(text, "ack", 3) == 0 || memcmp(text, "rej", 3) == 0)
+			&& is_ack_id(text + 3, end)) {
+		msg->type = (text[0] == 'a') ? MESSAGING_TYPE_ACK : MESSAGING_TYPE_REJ;
+		msg->text[0] = '\0';
+
+		return extract_msg_id(text + 3, end, msg->msg_id);
+	}
+
+	msg->type = MESSAGING_TYPE_MESSAGE;
+
+	// the message ID follows the last '{'
+	const char *id_start = NULL;
+	for(const char *p = text; p < end; p++) {
+		if(*p == '{') {
+			id_start = p;
+		}
+	}
+
+	if(id_start && extract_msg_id(id_start + 1, end, msg->msg_id)) {
+		text_len = id_start - text;
+	}
+
+	copy_string(msg->text, sizeof(msg->text), text, text_len);
+
+	return true;
+}
+
+
+messaging_rx_result_t messaging_handle_rx(const uint8_t *frame, size_t len, uint64_t now)
+{
+	messaging_msg_t msg;
+	char mycall[16];
+
+	if(!messaging_parse(frame, len, &msg)) {
+		return MESSAGING_RX_IGNORED;
+	}
+
+	aprs_get_source(mycall, sizeof(mycall));
+
+	if(strcmp(msg.addressee, mycall) != 0) {
+		return MESSAGING_RX_IGNORED;
+	}
+
+	switch(msg.type) {
+		case MESSAGING_TYPE_MESSAGE:
+			return handle_message(&msg, now);
+
+		case MESSAGING_TYPE_ACK:
+		case MESSAGING_TYPE_REJ:
+			return handle_ack_or_rej(&msg);
+	}
+
+	return MESSAGING_RX_IGNORED;
+}
+
+
+ret_code_t messaging_send(const char *addressee, const char *text, uint64_t now)
+{
+	size_t addressee_len = strlen(addressee);
+	size_t text_len = strlen(text);
+
+	if(addressee_len == 0 || addressee_len > APRS_MESSAGE_ADDRESSEE_LEN
+			|| text_len == 0 || text_len > APRS_MAX_MESSAGE_TEXT_LEN) {
+		return NRF_ERROR_INVALID_PARAM;
+	}
+
+	for(uint8_t i = 0; i < MESSAGING_OUTBOX_SIZE; i++) {
+		outbox_entry_t *entry = &m_outbox[i];
+
+		if(entry->valid) {
+			continue;
+		}
+
+		strcpy(entry->addressee, addressee);
+		strcpy(entry->text, text);
+		snprintf(entry->msg_id, sizeof(entry->msg_id), "%u", (unsigned)(m_next_msg_id % 100000));
+
+		entry->due = now;
+		entry->interval = MESSAGING_RETRY_INITIAL_MS;
+		entry->tries = 0;
+		entry->valid = true;
+
+		m_next_msg_id = (m_next_msg_id % 99999) + 1;
+
+		return NRF_SUCCESS;
+	}
+
+	return NRF_ERROR_NO_MEM;
+}
+
+
+uint64_t messaging_get_next_due_time(void)
+{
+	uint64_t next = MESSAGING_NO_FRAME;
+
+	for(uint8_t i = 0; i < MESSAGING_ACK_QUEUE_SIZE; i++) {
+		if(m_ack_queue[i].valid && m_ack_queue[i].due < next) {
+			next = m_ack_queue[i].due;
+		}
+	}
+
+	for(uint8_t i = 0; i < MESSAGING_OUTBOX_SIZE; i++) {
+		if(m_outbox[i].valid && m_outbox[i].due < next) {
+			next = m_outbox[i].due;
+		}
+	}
+
+	return next;
+}
+
+
+bool messaging_get_due_frame(uint64_t now, uint8_t *frame, uint8_t *len)
+{
+	char ack_text[4 + APRS_MAX_MESSAGE_ID_LEN];
+	size_t frame_len;
+
+	// acknowledgements first
+	for(uint8_t i = 0; i < MESSAGING_ACK_QUEUE_SIZE; i++) {
+		ack_entry_t *ack = &m_ack_queue[i];
+
+		if(!ack->valid || ack->due > now) {
+			continue;
+		}
+
+		strcpy(ack_text, "ack");
+		strcat(ack_text, ack->msg_id);
+
+		frame_len = aprs_build_message_frame(frame, ack->call, ack_text, NULL);
+
+		if(frame_len == 0) {
+			ack->valid = false;
+			continue;
+		}
+
+		if(!airtime_is_available(now, (uint32_t)airtime_calc_toa_ms(frame_len))) {
+			ack->due = now + MESSAGING_AIRTIME_DELAY_MS;
+			continue;
+		}
+
+		ack->valid = false;
+		*len = frame_len;
+		m_stats.acks_sent++;
+		return true;
+	}
+
+	// outgoing messages
+	for(uint8_t i = 0; i < MESSAGING_OUTBOX_SIZE; i++) {
+		outbox_entry_t *entry = &m_outbox[i];
+
+		if(!entry->valid || entry->due > now) {
+			continue;
+		}
+
+		if(entry->tries >= MESSAGING_MAX_TRIES) {
+			// no acknowledgement after the last try: give up
+			entry->valid = false;
+			m_stats.msg_failed++;
+			continue;
+		}
+
+		frame_len = aprs_build_message_frame(frame, entry->addressee, entry->text, entry->msg_id);
+
+		if(frame_len == 0) {
+			entry->valid = false;
+			m_stats.msg_failed++;
+			continue;
+		}
+
+		if(!airtime_is_available(now, (uint32_t)airtime_calc_toa_ms(frame_len))) {
+			entry->due = now + MESSAGING_AIRTIME_DELAY_MS;
+			continue;
+		}
+
+		entry->tries++;
+		entry->due = now + entry->interval;
+		entry->interval *= 2;
+
+		*len = frame_len;
+		m_stats.msg_sent++;
+		return true;
+	}
+
+	return false;
+}
+
+
+uint8_t messaging_get_inbox_count(void)
+{
+	return m_inbox_count;
+}
+
+
+const messaging_inbox_entry_t* messaging_get_inbox_entry(uint8_t idx)
+{
+	if(idx >= m_inbox_count) {
+		return NULL;
+	}
+
+	return &m_inbox[(m_inbox_next + MESSAGING_INBOX_SIZE - 1 - idx) % MESSAGING_INBOX_SIZE];
+}
+
+
+uint8_t messaging_get_outbox_count(void)
+{
+	uint8_t count = 0;
+
+	for(uint8_t i = 0; i < MESSAGING_OUTBOX_SIZE; i++) {
+		if(m_outbox[i].valid) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
+const messaging_stats_t* messaging_get_stats(void)
+{
+	return &m_stats;
+}
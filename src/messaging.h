@@ -0,0 +1,208 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef MESSAGING_H
+#define MESSAGING_H
+
+/**@file
+ *
+ * @brief APRS messaging.
+ *
+ * @details
+ * Messages addressed to the own call sign (`:MYCALL   :text{id`) are stored
+ * in a fixed-size inbox and acknowledged automatically. Acknowledgements are
+ * rate limited: the same message is acknowledged at most once within
+ * @ref MESSAGING_ACK_HOLDOFF_MS and a token bucket limits the total number of
+ * acknowledgements.
+ *
+ * Outgoing messages are transmitted until they are acknowledged. The interval
+ * between transmissions doubles after each try, starting with
+ * @ref MESSAGING_RETRY_INITIAL_MS. If no acknowledgement is received after
+ * @ref MESSAGING_MAX_TRIES transmissions, the message is given up.
+ *
+ * Frames to transmit are taken from this module with @ref
+ * messaging_get_due_frame().
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sdk_errors.h>
+
+#include "aprs.h"
+
+// number of received messages that are kept
+#define MESSAGING_INBOX_SIZE            8
+
+// number of outgoing messages that can wait for an acknowledgement
+#define MESSAGING_OUTBOX_SIZE           4
+
+// number of acknowledgements that can wait for transmission
+#define MESSAGING_ACK_QUEUE_SIZE        4
+
+#define MESSAGING_CALL_LEN             10
+
+// retry interval after the first transmission; doubled after each try
+#define MESSAGING_RETRY_INITIAL_MS  30000 // milliseconds
+
+// number of transmissions of an unacknowledged message
+#define MESSAGING_MAX_TRIES             5
+
+// a repeated message is not acknowledged again within this time
+#define MESSAGING_ACK_HOLDOFF_MS    30000 // milliseconds
+
+// acknowledgement rate limit: burst size and time to regain one token
+#define MESSAGING_ACK_BUCKET_SIZE       3
+#define MESSAGING_ACK_REFILL_MS     20000 // milliseconds
+
+// delay of a transmission that does not fit into the airtime budget
+#define MESSAGING_AIRTIME_DELAY_MS   5000 // milliseconds
+
+// returned by @ref messaging_get_next_due_time() if nothing is to be sent
+#define MESSAGING_NO_FRAME   UINT64_MAX
+
+typedef enum
+{
+	MESSAGING_TYPE_MESSAGE,
+	MESSAGING_TYPE_ACK,
+	MESSAGING_TYPE_REJ,
+} messaging_type_t;
+
+typedef struct
+{
+	messaging_type_t type;
+
+	char source[MESSAGING_CALL_LEN];
+	char addressee[APRS_MESSAGE_ADDRESSEE_LEN + 1];
+	char text[APRS_MAX_MESSAGE_TEXT_LEN + 1];
+	char msg_id[APRS_MAX_MESSAGE_ID_LEN + 1]; //!< Empty if the message does not need an acknowledgement
+} messaging_msg_t;
+
+typedef struct
+{
+	char     source[MESSAGING_CALL_LEN];
+	char     text[APRS_MAX_MESSAGE_TEXT_LEN + 1];
+	char     msg_id[APRS_MAX_MESSAGE_ID_LEN + 1];
+	uint64_t rx_time;       //!< Time of the first reception
+	uint64_t last_ack_time; //!< Time of the last acknowledgement
+	uint8_t  rx_count;      //!< How often the message was received
+	bool     valid;
+} messaging_inbox_entry_t;
+
+typedef enum
+{
+	MESSAGING_RX_IGNORED,          //!< Not a message for us
+	MESSAGING_RX_NEW_MESSAGE,      //!< A new message was stored in the inbox
+	MESSAGING_RX_REPEATED_MESSAGE, //!< A message that is already in the inbox
+	MESSAGING_RX_ACK,              //!< One of our messages was acknowledged
+	MESSAGING_RX_REJ,              //!< One of our messages was rejected
+} messaging_rx_result_t;
+
+typedef struct
+{
+	uint32_t msg_sent;        //!< Transmissions of outgoing messages (including retries)
+	uint32_t msg_acked;       //!< Outgoing messages that were acknowledged
+	uint32_t msg_failed;      //!< Outgoing messages that were rejected or given up
+	uint32_t acks_sent;       //!< Acknowledgements transmitted
+	uint32_t acks_suppressed; //!< Acknowledgements suppressed by the rate limit
+} messaging_stats_t;
+
+/**@brief Clear the inbox, all queues and the statistics.
+ */
+void messaging_init(void);
+
+/**@brief Parse an APRS message frame.
+ *
+ * @param frame      The raw frame data, including the LoRa-APRS header.
+ * @param len        Length of the raw frame.
+ * @param[out] msg   The parsed message.
+ * @returns          True if the frame is a valid message, ack or rej.
+ */
+bool messaging_parse(const uint8_t *frame, size_t len, messaging_msg_t *msg);
+
+/**@brief Handle a received frame.
+ * @details
+ * Messages for the own call are stored in the inbox and acknowledged, if
+ * requested. Acknowledgements for outgoing messages remove them from the
+ * outbox.
+ *
+ * @param frame    The raw frame data, including the LoRa-APRS header.
+ * @param len      Length of the raw frame.
+ * @param now      The current time in milliseconds.
+ * @returns        What was received.
+ */
+messaging_rx_result_t messaging_handle_rx(const uint8_t *frame, size_t len, uint64_t now);
+
+/**@brief Queue an outgoing message.
+ * @details
+ * The message is transmitted immediately (see @ref messaging_get_due_frame())
+ * and retried until it is acknowledged.
+ *
+ * @param addressee   Call sign of the receiver.
+ * @param text        The message text.
+ * @param now         The current time in milliseconds.
+ * @retval NRF_ERROR_INVALID_PARAM   If addressee or text are empty or too long.
+ * @retval NRF_ERROR_NO_MEM          If the outbox is full.
+ */
+ret_code_t messaging_send(const char *addressee, const char *text, uint64_t now);
+
+/**@brief Get the time when the next frame is due.
+ * @returns  The time in milliseconds or @ref MESSAGING_NO_FRAME.
+ */
+uint64_t messaging_get_next_due_time(void);
+
+/**@brief Get the next due frame.
+ * @details
+ * Acknowledgements are sent before outgoing messages. Transmissions that do
+ * not fit into the airtime budget are delayed.
+ *
+ * @param now          The current time in milliseconds.
+ * @param[out] frame   Buffer for the frame. Must hold @ref APRS_MAX_FRAME_LEN bytes.
+ * @param[out] len     Length of the frame.
+ * @returns            True if a frame shall be transmitted now.
+ */
+bool messaging_get_due_frame(uint64_t now, uint8_t *frame, uint8_t *len);
+
+/**@brief Get the number of messages in the inbox.
+ */
+uint8_t messaging_get_inbox_count(void);
+
+/**@brief Get a message from the inbox.
+ *
+ * @param idx   Index of the message. 0 is the newest message.
+ * @returns     The inbox entry or NULL if idx is out of range.
+ */
+const messaging_inbox_entry_t* messaging_get_inbox_entry(uint8_t idx);
+
+/**@brief Get the number of outgoing messages waiting for an acknowledgement.
+ */
+uint8_t messaging_get_outbox_count(void);
+
+/**@brief Get the messaging statistics.
+ */
+const messaging_stats_t* messaging_get_stats(void);
+
+#endif // MESSAGING_H
@@ -0,0 +1,144 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "notify_queue.h"
+
+#if (NOTIFY_QUEUE_DEPTH & (NOTIFY_QUEUE_DEPTH - 1)) != 0
+#error "NOTIFY_QUEUE_DEPTH must be a power of 2."
+#endif
+
+#define INDEX(i)  ((i) & (NOTIFY_QUEUE_DEPTH - 1))
+
+
+void notify_queue_init(notify_queue_t *queue)
+{
+	queue->head = 0;
+	queue->tail = 0;
+	queue->dropped = 0;
+	queue->max_depth = 0;
+}
+
+
+bool notify_queue_push(notify_queue_t *queue, const uint8_t *data, uint8_t len)
+{
+	uint32_t tail = queue->tail;
+	uint32_t count = tail - queue->head;
+
+	if(count >= NOTIFY_QUEUE_DEPTH) {
+		queue->dropped++;
+		return false;
+	}
+
+	memcpy(queue->data[INDEX(tail)], data, len);
+	queue->len[INDEX(tail)] = len;
+
+	// the entry must be complete before the consumer can see it
+	__asm__ volatile("" ::: "memory");
+	queue->tail = tail + 1;
+
+	if(count + 1 > queue->max_depth) {
+		queue->max_depth = count + 1;
+	}
+
+	return true;
+}
+
+
+uint32_t notify_queue_count(const notify_queue_t *queue)
+{
+	return queue->tail - queue->head;
+}
+
+
+size_t notify_queue_build(const notify_queue_t *queue, uint8_t *buf, size_t max_len,
+		bool batching, uint32_t *frames)
+{
+	uint32_t head = queue->head;
+	uint32_t count = queue->tail - head;
+
+	// do not read the entries before the producer has completed them
+	__asm__ volatile("" ::: "memory");
+
+	*frames = 0;
+
+	if(count == 0 || max_len == 0) {
+		return 0;
+	}
+
+	if(!batching) {
+		size_t len = queue->len[INDEX(head)];
+
+		if(len > max_len) {
+			len = max_len;
+		}
+
+		memcpy(buf, queue->data[INDEX(head)], len);
+		*frames = 1;
+		return len;
+	}
+
+	size_t used = 0;
+
+	for(uint32_t i = 0; i < count; i++) {
+		size_t len = queue->len[INDEX(head + i)];
+
+		if(used + 1 + len > max_len) {
+			if(i > 0) {
+				break;
+			}
+
+			// a single frame that is too long is truncated
+			len = max_len - 1;
+		}
+
+		buf[used] = len;
+		memcpy(buf + used + 1, queue->data[INDEX(head + i)], len);
+		used += 1 + len;
+
+		(*frames)++;
+	}
+
+	return used;
+}
+
+
+void notify_queue_pop(notify_queue_t *queue, uint32_t frames)
+{
+	uint32_t count = queue->tail - queue->head;
+
+	if(frames > count) {
+		frames = count;
+	}
+
+	queue->head += frames;
+}
+
+
+void notify_queue_clear(notify_queue_t *queue)
+{
+	queue->head = queue->tail;
+}
@@ -0,0 +1,114 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef NOTIFY_QUEUE_H
+#define NOTIFY_QUEUE_H
+
+/**@file
+ *
+ * @brief Queue for frames passed between interrupt priorities, e.g. for BLE notifications.
+ *
+ * @details
+ * The SoftDevice can only buffer a limited number of notifications. Frames
+ * that arrive while its buffer is full are kept in this queue until the
+ * SoftDevice reports that notifications have been sent. The queue is also
+ * used for frames that are received via BLE and wait for transmission.
+ *
+ * Optionally, several frames are packed into one notification. In that case,
+ * each frame is preceded by one byte containing its length.
+ *
+ * The queue is safe for one producer and one consumer running in different
+ * interrupt priorities: @ref notify_queue_push() must only be called by the
+ * producer, all other functions except the statistics only by the consumer.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// number of queued frames. Must be a power of 2.
+#ifndef NOTIFY_QUEUE_DEPTH
+#define NOTIFY_QUEUE_DEPTH  8
+#endif
+
+#define NOTIFY_QUEUE_MAX_FRAME_LEN  255
+
+typedef struct {
+	uint8_t  data[NOTIFY_QUEUE_DEPTH][NOTIFY_QUEUE_MAX_FRAME_LEN];
+	uint8_t  len[NOTIFY_QUEUE_DEPTH];
+
+	volatile uint32_t head;   //!< Index of the oldest frame, written by the consumer.
+	volatile uint32_t tail;   //!< Index of the next free entry, written by the producer.
+
+	uint32_t dropped;         //!< Frames that were dropped because the queue was full.
+	uint32_t max_depth;       //!< Maximum number of frames in the queue.
+} notify_queue_t;
+
+/**@brief Initialize an empty queue and reset the statistics.
+ */
+void notify_queue_init(notify_queue_t *queue);
+
+/**@brief Append a frame to the queue.
+ * @details
+ * If the queue is full, the new frame is dropped and counted.
+ *
+ * @param queue   The queue.
+ * @param data    The frame data.
+ * @param len     The length of the frame.
+ * @returns       True if the frame was queued, false if it was dropped.
+ */
+bool notify_queue_push(notify_queue_t *queue, const uint8_t *data, uint8_t len);
+
+/**@brief Get the number of queued frames.
+ */
+uint32_t notify_queue_count(const notify_queue_t *queue);
+
+/**@brief Build the next notification from the oldest frames.
+ * @details
+ * Without batching, the notification contains the oldest frame as-is. With
+ * batching, as many frames as fit into max_len are packed with a length byte
+ * each. Frames that are longer than the notification are truncated. The
+ * frames are not removed from the queue; call @ref notify_queue_pop() after
+ * the notification was accepted.
+ *
+ * @param queue     The queue.
+ * @param buf       Buffer for the notification data.
+ * @param max_len   Maximum length of the notification.
+ * @param batching  Whether several frames may be packed into one notification.
+ * @param frames    Returns the number of frames in the notification.
+ * @returns         The length of the notification, 0 if the queue is empty.
+ */
+size_t notify_queue_build(const notify_queue_t *queue, uint8_t *buf, size_t max_len,
+		bool batching, uint32_t *frames);
+
+/**@brief Remove frames from the head of the queue.
+ */
+void notify_queue_pop(notify_queue_t *queue, uint32_t frames);
+
+/**@brief Remove all frames from the queue. The statistics are kept.
+ */
+void notify_queue_clear(notify_queue_t *queue);
+
+#endif // NOTIFY_QUEUE_H
@@ -32,10 +32,14 @@ NRF_LOG_MODULE_REGISTER();
 #include "epaper.h"
 #include "gps.h"
 #include "lora.h"
+#include "spi_flash.h"
+#include "time_base.h"
+#include "energy.h"
 
 #include "periph_pwr.h"
 
 
+// the module flags are also used as rail bits in the energy accounting
 #define MODULE_FLAG_3V3_REG     (1 << 0)
 #define MODULE_FLAG_PWR_ON      (1 << 1)
 
@@ -52,6 +56,7 @@ static void periph_pwr_on(void)
 
 	epaper_config_gpios(true);
 	gps_config_gpios(true);
+	spi_flash_config_gpios(true);
 }
 
 /**@brief Switch off external peripheral power.
@@ -62,6 +67,7 @@ static void periph_pwr_off(void)
 
 	epaper_config_gpios(false);
 	gps_config_gpios(false);
+	spi_flash_config_gpios(false);
 }
 
 
@@ -111,6 +117,9 @@ static uint32_t modules_required_by_activity(periph_pwr_activity_flag_t activity
 
 		case PERIPH_PWR_FLAG_BME280:
 			return MODULE_FLAG_3V3_REG | MODULE_FLAG_PWR_ON;
+
+		case PERIPH_PWR_FLAG_FLASH:
+			return MODULE_FLAG_3V3_REG | MODULE_FLAG_PWR_ON;
 	}
 
 	return 0;
@@ -155,6 +164,8 @@ ret_code_t periph_pwr_start_activity(periph_pwr_activity_flag_t activity)
 	m_running_activities |= activity;
 	m_active_modules |= requested_modules;
 
+	energy_update(time_base_get(), m_running_activities, m_active_modules);
+
 	return NRF_SUCCESS;
 }
 
@@ -195,6 +206,8 @@ ret_code_t periph_pwr_stop_activity(periph_pwr_activity_flag_t activity)
 
 	m_active_modules = remaining_modules;
 
+	energy_update(time_base_get(), m_running_activities, m_active_modules);
+
 	return NRF_SUCCESS;
 }
 
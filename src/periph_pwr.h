@@ -38,6 +38,7 @@
 #define PERIPH_PWR_FLAG_LORA                (1 << 5)
 #define PERIPH_PWR_FLAG_LEDS                (1 << 6)
 #define PERIPH_PWR_FLAG_BME280              (1 << 7)
+#define PERIPH_PWR_FLAG_FLASH               (1 << 8)
 
 #define PERIPH_PWR_FLAG_ALL                 0xFFFFFFFF
 
@@ -0,0 +1,137 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "profiling.h"
+
+// the first bucket ends at 16 µs = 2^10 ticks
+#define FIRST_BUCKET_BITS  10
+
+static const char *SPAN_NAMES[PROFILING_NUM_SPANS] = {
+	"cb_lora",
+	"cb_gps",
+	"redraw_display",
+	"nmea_parse",
+};
+
+static profiling_stats_t m_stats[PROFILING_NUM_SPANS];
+
+static uint64_t m_awake_ticks;
+static uint32_t m_wakeup_time;
+
+
+void profiling_init(void)
+{
+#if defined(__ARM_ARCH)
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+	profiling_reset();
+}
+
+
+void profiling_reset(void)
+{
+	memset(m_stats, 0, sizeof(m_stats));
+
+	for(uint8_t i = 0; i < PROFILING_NUM_SPANS; i++) {
+		m_stats[i].min_ticks = UINT32_MAX;
+	}
+
+	m_awake_ticks = 0;
+	m_wakeup_time = profiling_now();
+}
+
+
+void profiling_record(profiling_span_t span, uint32_t ticks)
+{
+	profiling_stats_t *stats = &m_stats[span];
+
+	stats->count++;
+	stats->total_ticks += ticks;
+
+	if(ticks < stats->min_ticks) {
+		stats->min_ticks = ticks;
+	}
+
+	if(ticks > stats->max_ticks) {
+		stats->max_ticks = ticks;
+	}
+
+	// bucket index from the position of the highest set bit: 2 bits per bucket
+	int32_t msb = 31 - __builtin_clz(ticks | 1);
+	int32_t bucket = (msb - FIRST_BUCKET_BITS) / 2 + 1;
+
+	if(msb < FIRST_BUCKET_BITS) {
+		bucket = 0;
+	} else if(bucket >= PROFILING_NUM_BUCKETS) {
+		bucket = PROFILING_NUM_BUCKETS - 1;
+	}
+
+	stats->histogram[bucket]++;
+}
+
+
+void profiling_sleep_enter(void)
+{
+	m_awake_ticks += profiling_now() - m_wakeup_time;
+}
+
+
+void profiling_sleep_exit(void)
+{
+	m_wakeup_time = profiling_now();
+}
+
+
+void profiling_get_stats(profiling_span_t span, profiling_stats_t *stats)
+{
+	*stats = m_stats[span];
+}
+
+
+uint64_t profiling_get_awake_us(void)
+{
+	return m_awake_ticks / PROFILING_TICKS_PER_US;
+}
+
+
+const char* profiling_get_span_name(profiling_span_t span)
+{
+	return SPAN_NAMES[span];
+}
+
+
+uint32_t profiling_get_bucket_start_us(uint8_t bucket)
+{
+	if(bucket == 0) {
+		return 0;
+	}
+
+	return (1UL << (FIRST_BUCKET_BITS + 2 * (bucket - 1))) / PROFILING_TICKS_PER_US;
+}
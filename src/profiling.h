@@ -0,0 +1,155 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef PROFILING_H
+#define PROFILING_H
+
+/**@file
+ *
+ * @brief Run-time measurement of selected code spans.
+ *
+ * @details
+ * A span is measured by calling @ref profiling_start() at its beginning and
+ * @ref profiling_end() at its end. For each span, the number of calls, the
+ * minimum, average and maximum duration and a histogram of the durations are
+ * kept. Additionally, the time the CPU spends outside of the main loop's sleep
+ * is accumulated.
+ *
+ * On the target, the durations are taken from the DWT cycle counter, which
+ * costs only a few cycles per span. On the host, clock_gettime() is used and
+ * scaled to the same tick rate, so the same code can be measured in the test
+ * harnesses.
+ *
+ * The statistics are not protected against concurrent updates. If the same
+ * span is ended in different interrupt priorities at the same time, single
+ * measurements may get lost.
+ */
+
+#include <stdint.h>
+
+#if defined(__ARM_ARCH)
+#include <nrf.h>
+#else
+#include <time.h>
+#endif
+
+// all durations are measured in CPU cycles at 64 MHz
+#define PROFILING_TICKS_PER_US  64
+
+// histogram buckets: < 16 µs, then a factor of 4 per bucket up to >= 65.5 ms
+#define PROFILING_NUM_BUCKETS   8
+
+typedef enum {
+	PROFILING_SPAN_CB_LORA,          //!< LoRa event handler in main.c.
+	PROFILING_SPAN_CB_GPS,           //!< GNSS event handler in main.c.
+	PROFILING_SPAN_REDRAW_DISPLAY,   //!< Rendering of the display contents.
+	PROFILING_SPAN_NMEA_PARSE,       //!< Parsing of one NMEA sentence.
+
+	PROFILING_NUM_SPANS
+} profiling_span_t;
+
+typedef struct {
+	uint32_t count;                              //!< Number of measurements.
+	uint32_t min_ticks;                          //!< Shortest duration.
+	uint32_t max_ticks;                          //!< Longest duration.
+	uint64_t total_ticks;                        //!< Sum of all durations.
+	uint32_t histogram[PROFILING_NUM_BUCKETS];   //!< Number of measurements per bucket.
+} profiling_stats_t;
+
+/**@brief Get the current value of the tick counter.
+ * @details
+ * The counter wraps around after 67 seconds, so only shorter spans can be
+ * measured.
+ */
+static inline uint32_t profiling_now(void)
+{
+#if defined(__ARM_ARCH)
+	return DWT->CYCCNT;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec) * PROFILING_TICKS_PER_US / 1000);
+#endif
+}
+
+/**@brief Enable the tick counter and reset all statistics.
+ */
+void profiling_init(void);
+
+/**@brief Reset all statistics, including the awake time.
+ */
+void profiling_reset(void);
+
+/**@brief Add a measured duration to the statistics of a span.
+ *
+ * @param span    The span that was measured.
+ * @param ticks   The duration in ticks.
+ */
+void profiling_record(profiling_span_t span, uint32_t ticks);
+
+/**@brief Begin a measurement.
+ *
+ * @returns   The start time to pass to @ref profiling_end().
+ */
+static inline uint32_t profiling_start(void)
+{
+	return profiling_now();
+}
+
+/**@brief End a measurement started with @ref profiling_start().
+ */
+static inline void profiling_end(profiling_span_t span, uint32_t start)
+{
+	profiling_record(span, profiling_now() - start);
+}
+
+/**@brief Call this right before the main loop puts the CPU to sleep.
+ */
+void profiling_sleep_enter(void);
+
+/**@brief Call this right after the CPU woke up in the main loop.
+ */
+void profiling_sleep_exit(void);
+
+/**@brief Get the statistics of a span.
+ *
+ * @param span    The span.
+ * @param stats   Pointer to the structure to fill.
+ */
+void profiling_get_stats(profiling_span_t span, profiling_stats_t *stats);
+
+/**@brief Get the time the CPU was awake since the last reset in microseconds.
+ */
+uint64_t profiling_get_awake_us(void);
+
+/**@brief Get the name of a span for log output.
+ */
+const char* profiling_get_span_name(profiling_span_t span);
+
+/**@brief Get the lower bound of a histogram bucket in microseconds.
+ */
+uint32_t profiling_get_bucket_start_us(uint8_t bucket);
+
+#endif // PROFILING_H
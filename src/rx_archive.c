@@ -0,0 +1,687 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include <sdk_macros.h>
+
+#define NRF_LOG_MODULE_NAME rx_archive
+#include <nrf_log.h>
+NRF_LOG_MODULE_REGISTER();
+
+#include "rx_archive.h"
+#include "utils.h"
+
+#define OFS_LEN     0
+#define OFS_SEQ     2
+#define OFS_TIME    6
+#define OFS_RSSI    10
+#define OFS_SNR     12
+#define OFS_FLAGS   13
+
+#define LEN_ERASED  0xFFFF
+#define LEN_CLOSED  0x0000
+
+#define CRC_LEN     2
+
+// no record fits into a smaller rest of a sector
+#define MIN_RECORD_LEN  (RX_ARCHIVE_HEADER_LEN + 1 + CRC_LEN)
+
+// sectors tried if a record cannot be verified
+#define WRITE_ATTEMPTS  2
+
+#define SECTOR_ADDR(sector)  (RX_ARCHIVE_FLASH_START + (sector) * SPI_FLASH_SECTOR_SIZE)
+
+#if RX_ARCHIVE_FLASH_START + RX_ARCHIVE_FLASH_SIZE > SPI_FLASH_SIZE
+#error "The RX archive does not fit into the flash."
+#endif
+
+typedef enum {
+	RECORD_VALID,
+	RECORD_ERASED,     //!< End of the written data.
+	RECORD_CLOSED,     //!< No further records in this sector.
+	RECORD_INVALID,    //!< Damaged, e.g. by a power loss while it was written.
+} record_state_t;
+
+// the write position
+static uint32_t m_head_sector;
+static uint32_t m_head_offset;
+static uint32_t m_next_seq;
+static uint32_t m_first_seq;
+
+static uint8_t  m_write_buf[RX_ARCHIVE_MAX_RECORD_LEN];
+static uint8_t  m_verify_buf[RX_ARCHIVE_MAX_RECORD_LEN];
+static uint8_t  m_read_buf[RX_ARCHIVE_MAX_RECORD_LEN];
+
+static uint32_t m_reads;
+
+// records from the interrupt context
+static rx_archive_record_t m_queue[RX_ARCHIVE_QUEUE_DEPTH];
+static volatile uint32_t   m_queue_head;   // written by the main loop
+static volatile uint32_t   m_queue_tail;   // written by the producer
+
+static rx_archive_stats_t m_stats;
+
+
+/**@brief Program data that may cross page boundaries.
+ */
+static ret_code_t program(uint32_t addr, const uint8_t *data, size_t len)
+{
+	while(len > 0) {
+		size_t chunk = SPI_FLASH_PAGE_SIZE - (addr % SPI_FLASH_PAGE_SIZE);
+
+		if(chunk > len) {
+			chunk = len;
+		}
+
+		VERIFY_SUCCESS(spi_flash_program(addr, data, chunk));
+
+		addr += chunk;
+		data += chunk;
+		len  -= chunk;
+	}
+
+	return NRF_SUCCESS;
+}
+
+
+/**@brief Read and check the record at the given position.
+ *
+ * @param[in]  sector    The sector index.
+ * @param[in]  offset    Offset of the record in the sector.
+ * @param[out] buf       Buffer for the record, @ref RX_ARCHIVE_MAX_RECORD_LEN bytes.
+ * @param[out] state     The result of the check.
+ * @param[out] rec_len   Length of the record including the CRC, if it is valid.
+ */
+static ret_code_t read_record(uint32_t sector, uint32_t offset, uint8_t *buf,
+		record_state_t *state, uint16_t *rec_len)
+{
+	if(SPI_FLASH_SECTOR_SIZE - offset < MIN_RECORD_LEN) {
+		*state = RECORD_CLOSED;
+		return NRF_SUCCESS;
+	}
+
+	uint32_t addr = SECTOR_ADDR(sector) + offset;
+
+	m_reads++;
+	VERIFY_SUCCESS(spi_flash_read(addr, buf, RX_ARCHIVE_HEADER_LEN));
+
+	uint16_t data_len = get_u16(&buf[OFS_LEN]);
+
+	if(data_len == LEN_ERASED) {
+		*state = RECORD_ERASED;
+		return NRF_SUCCESS;
+	}
+
+	if(data_len == LEN_CLOSED) {
+		*state = RECORD_CLOSED;
+		return NRF_SUCCESS;
+	}
+
+	uint16_t len = RX_ARCHIVE_HEADER_LEN + data_len + CRC_LEN;
+
+	if(data_len > RX_ARCHIVE_MAX_FRAME_LEN || offset + len > SPI_FLASH_SECTOR_SIZE) {
+		*state = RECORD_INVALID;
+		return NRF_SUCCESS;
+	}
+
+	m_reads++;
+	VERIFY_SUCCESS(spi_flash_read(addr + RX_ARCHIVE_HEADER_LEN,
+				buf + RX_ARCHIVE_HEADER_LEN, data_len + CRC_LEN));
+
+	if(get_u16(&buf[len - CRC_LEN]) != crc16_ccitt(buf, len - CRC_LEN)) {
+		*state = RECORD_INVALID;
+		return NRF_SUCCESS;
+	}
+
+	*state = RECORD_VALID;
+	*rec_len = len;
+	return NRF_SUCCESS;
+}
+
+
+/**@brief Get the sequence number of the first record in a sector.
+ *
+ * @retval NRF_ERROR_NOT_FOUND   The sector does not start with a valid record.
+ */
+static ret_code_t read_first_seq(uint32_t sector, uint32_t *seq)
+{
+	record_state_t state;
+	uint16_t rec_len;
+
+	VERIFY_SUCCESS(read_record(sector, 0, m_read_buf, &state, &rec_len));
+
+	if(state != RECORD_VALID) {
+		return NRF_ERROR_NOT_FOUND;
+	}
+
+	*seq = get_u32(&m_read_buf[OFS_SEQ]);
+	return NRF_SUCCESS;
+}
+
+
+/**@brief Find the end of the records in a sector.
+ *
+ * @param[in]  sector     The sector index.
+ * @param[out] offset     Offset after the last valid record.
+ * @param[out] last_seq   Sequence number of the last valid record.
+ * @param[out] state      Why the walk stopped.
+ */
+static ret_code_t walk_sector(uint32_t sector, uint32_t *offset, uint32_t *last_seq, record_state_t *state)
+{
+	uint16_t rec_len;
+
+	*offset = 0;
+
+	for(;;) {
+		VERIFY_SUCCESS(read_record(sector, *offset, m_read_buf, state, &rec_len));
+
+		if(*state != RECORD_VALID) {
+			return NRF_SUCCESS;
+		}
+
+		*last_seq = get_u32(&m_read_buf[OFS_SEQ]);
+		*offset += rec_len;
+	}
+}
+
+
+/**@brief Mark the rest of a sector as unused.
+ */
+static ret_code_t close_sector(uint32_t sector, uint32_t offset)
+{
+	if(SPI_FLASH_SECTOR_SIZE - offset < MIN_RECORD_LEN) {
+		// no record can start there anyway
+		return NRF_SUCCESS;
+	}
+
+	uint8_t marker[2] = {0x00, 0x00};
+
+	return program(SECTOR_ADDR(sector) + offset, marker, sizeof(marker));
+}
+
+
+/**@brief Find the write position.
+ * @details
+ * In the order of writing, the first records of the sectors have increasing
+ * sequence numbers. The sectors from 0 to the newest one start with a
+ * sequence number not lower than that of sector 0; the following sectors
+ * hold older records or are empty.
+ */
+static ret_code_t find_head(void)
+{
+	uint32_t seq0;
+	uint32_t last_seq = 0;
+	uint32_t offset;
+	record_state_t state;
+
+	ret_code_t err_code = read_first_seq(0, &seq0);
+
+	if(err_code == NRF_ERROR_NOT_FOUND) {
+		// either the archive is empty or sector 0 is the next one to write
+		m_head_sector = 0;
+		m_head_offset = 0;
+		m_next_seq = 0;
+
+		uint32_t seq;
+		err_code = read_first_seq(RX_ARCHIVE_NUM_SECTORS - 1, &seq);
+
+		if(err_code == NRF_ERROR_NOT_FOUND) {
+			return NRF_SUCCESS;
+		}
+
+		VERIFY_SUCCESS(err_code);
+		VERIFY_SUCCESS(walk_sector(RX_ARCHIVE_NUM_SECTORS - 1, &offset, &last_seq, &state));
+
+		m_next_seq = last_seq + 1;
+		return NRF_SUCCESS;
+	}
+
+	VERIFY_SUCCESS(err_code);
+
+	uint32_t lo = 0;
+	uint32_t hi = RX_ARCHIVE_NUM_SECTORS;
+
+	while(hi - lo > 1) {
+		uint32_t mid = (lo + hi) / 2;
+		uint32_t seq;
+
+		err_code = read_first_seq(mid, &seq);
+
+		if(err_code == NRF_SUCCESS && seq >= seq0) {
+			lo = mid;
+		} else if(err_code == NRF_SUCCESS || err_code == NRF_ERROR_NOT_FOUND) {
+			hi = mid;
+		} else {
+			return err_code;
+		}
+	}
+
+	VERIFY_SUCCESS(walk_sector(lo, &offset, &last_seq, &state));
+
+	m_next_seq = last_seq + 1;
+
+	if(state == RECORD_ERASED) {
+		m_head_sector = lo;
+		m_head_offset = offset;
+		return NRF_SUCCESS;
+	}
+
+	if(state == RECORD_INVALID) {
+		NRF_LOG_WARNING("damaged record at sector %u, offset %u", lo, offset);
+		close_sector(lo, offset);
+	}
+
+	m_head_sector = (lo + 1) % RX_ARCHIVE_NUM_SECTORS;
+	m_head_offset = 0;
+	return NRF_SUCCESS;
+}
+
+
+/**@brief Get the oldest sector in the order of writing.
+ * @details
+ * A head sector without records has not been erased yet, so it still
+ * contains the oldest records.
+ */
+static uint32_t oldest_sector(void)
+{
+	if(m_head_offset == 0) {
+		return m_head_sector;
+	}
+
+	return (m_head_sector + 1) % RX_ARCHIVE_NUM_SECTORS;
+}
+
+
+/**@brief Find the oldest record after the write position.
+ */
+static void find_first(void)
+{
+	const uint32_t candidates[] = {
+		oldest_sector(),
+		(oldest_sector() + 1) % RX_ARCHIVE_NUM_SECTORS,
+		0,
+	};
+
+	m_first_seq = m_next_seq;
+
+	for(size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		uint32_t seq;
+
+		if(read_first_seq(candidates[i], &seq) == NRF_SUCCESS && seq < m_next_seq) {
+			m_first_seq = seq;
+			return;
+		}
+	}
+}
+
+
+/**@brief Move the write position to the start of the next sector.
+ */
+static void next_sector(void)
+{
+	m_head_sector = (m_head_sector + 1) % RX_ARCHIVE_NUM_SECTORS;
+	m_head_offset = 0;
+}
+
+
+/**@brief Make room for a record at the write position.
+ * @details
+ * Closes the current sector if the record does not fit and erases a sector
+ * before its first record is written.
+ */
+static ret_code_t prepare_write(uint16_t rec_len)
+{
+	if(m_head_offset > 0 && SPI_FLASH_SECTOR_SIZE - m_head_offset < rec_len) {
+		VERIFY_SUCCESS(close_sector(m_head_sector, m_head_offset));
+		next_sector();
+	}
+
+	if(m_head_offset == 0) {
+		VERIFY_SUCCESS(spi_flash_erase_sector(SECTOR_ADDR(m_head_sector)));
+		m_stats.sector_erases++;
+
+		// the oldest records may just have been erased
+		uint32_t seq;
+		uint32_t following = (m_head_sector + 1) % RX_ARCHIVE_NUM_SECTORS;
+
+		if(read_first_seq(following, &seq) == NRF_SUCCESS
+				&& seq > m_first_seq && seq < m_next_seq) {
+			m_first_seq = seq;
+		}
+	}
+
+	return NRF_SUCCESS;
+}
+
+
+static ret_code_t write_record(uint16_t rec_len)
+{
+	VERIFY_SUCCESS(prepare_write(rec_len));
+
+	uint32_t addr = SECTOR_ADDR(m_head_sector) + m_head_offset;
+
+	put_u32(&m_write_buf[OFS_SEQ], m_next_seq);
+	put_u16(&m_write_buf[rec_len - CRC_LEN], crc16_ccitt(m_write_buf, rec_len - CRC_LEN));
+
+	VERIFY_SUCCESS(program(addr, m_write_buf, rec_len));
+	VERIFY_SUCCESS(spi_flash_read(addr, m_verify_buf, rec_len));
+
+	if(memcmp(m_write_buf, m_verify_buf, rec_len) != 0) {
+		return NRF_ERROR_INTERNAL;
+	}
+
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t rx_archive_init(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_reads = 0;
+	m_queue_head = 0;
+	m_queue_tail = 0;
+
+	VERIFY_SUCCESS(spi_flash_power_up());
+
+	ret_code_t err_code = find_head();
+
+	if(err_code == NRF_SUCCESS) {
+		find_first();
+	} else {
+		// start over, so that at least new packets are stored
+		m_head_sector = 0;
+		m_head_offset = 0;
+		m_next_seq = 0;
+		m_first_seq = 0;
+	}
+
+	spi_flash_power_down();
+
+	m_stats.init_reads = m_reads;
+
+	NRF_LOG_INFO("records %u to %u, next at sector %u, offset %u, found with %u reads",
+			m_first_seq, m_next_seq, m_head_sector, m_head_offset, m_reads);
+
+	return err_code;
+}
+
+
+ret_code_t rx_archive_append(rx_archive_record_t *record)
+{
+	if(record->data_len == 0 || record->data_len > RX_ARCHIVE_MAX_FRAME_LEN) {
+		return NRF_ERROR_INVALID_LENGTH;
+	}
+
+	uint16_t rec_len = RX_ARCHIVE_HEADER_LEN + record->data_len + CRC_LEN;
+
+	put_u16(&m_write_buf[OFS_LEN], record->data_len);
+	put_u32(&m_write_buf[OFS_TIME], record->time);
+	put_u16(&m_write_buf[OFS_RSSI], record->rssi);
+	m_write_buf[OFS_SNR] = record->snr;
+	m_write_buf[OFS_FLAGS] = record->flags;
+	memcpy(&m_write_buf[RX_ARCHIVE_HEADER_LEN], record->data, record->data_len);
+
+	VERIFY_SUCCESS(spi_flash_power_up());
+
+	ret_code_t err_code;
+
+	for(uint8_t attempt = 0; attempt < WRITE_ATTEMPTS; attempt++) {
+		err_code = write_record(rec_len);
+
+		if(err_code == NRF_SUCCESS) {
+			record->seq = m_next_seq++;
+			m_head_offset += rec_len;
+
+			m_stats.records++;
+			m_stats.bytes += rec_len;
+			break;
+		}
+
+		m_stats.write_errors++;
+		NRF_LOG_WARNING("writing record %u failed: 0x%08x", m_next_seq, err_code);
+
+		// skip the damaged area; a sector is erased again on the next attempt
+		if(m_head_offset > 0) {
+			close_sector(m_head_sector, m_head_offset);
+			next_sector();
+		}
+	}
+
+	spi_flash_power_down();
+
+	return err_code;
+}
+
+
+bool rx_archive_push(const rx_archive_record_t *record)
+{
+	uint32_t tail = m_queue_tail;
+
+	if(tail - m_queue_head >= RX_ARCHIVE_QUEUE_DEPTH) {
+		m_stats.dropped++;
+		return false;
+	}
+
+	m_queue[tail % RX_ARCHIVE_QUEUE_DEPTH] = *record;
+	m_queue_tail = tail + 1;
+
+	return true;
+}
+
+
+ret_code_t rx_archive_write_queued(void)
+{
+	ret_code_t result = NRF_SUCCESS;
+
+	while(m_queue_head != m_queue_tail) {
+		ret_code_t err_code = rx_archive_append(&m_queue[m_queue_head % RX_ARCHIVE_QUEUE_DEPTH]);
+
+		if(err_code != NRF_SUCCESS) {
+			result = err_code;
+		}
+
+		m_queue_head++;
+	}
+
+	return result;
+}
+
+
+/**@brief Read the next record of the range.
+ *
+ * @param[inout] reader    The iterator.
+ * @param[out]   buf       Buffer for the record.
+ * @param[out]   rec_len   Length of the record including the CRC.
+ * @retval NRF_ERROR_NOT_FOUND   There are no more records in the range.
+ */
+static ret_code_t read_next_raw(rx_archive_reader_t *reader, uint8_t *buf, uint16_t *rec_len)
+{
+	while(!reader->done && reader->sectors_left > 0) {
+		record_state_t state;
+
+		ret_code_t err_code = read_record(reader->sector, reader->offset, buf, &state, rec_len);
+
+		if(err_code != NRF_SUCCESS) {
+			reader->done = true;
+			return err_code;
+		}
+
+		if(state != RECORD_VALID) {
+			reader->sector = (reader->sector + 1) % RX_ARCHIVE_NUM_SECTORS;
+			reader->offset = 0;
+			reader->sectors_left--;
+			continue;
+		}
+
+		uint32_t seq = get_u32(&buf[OFS_SEQ]);
+
+		reader->offset += *rec_len;
+
+		if(seq >= reader->end_seq) {
+			break;
+		}
+
+		// older records in the first sector of the range
+		if(seq < reader->next_seq) {
+			continue;
+		}
+
+		reader->next_seq = seq + 1;
+		return NRF_SUCCESS;
+	}
+
+	reader->done = true;
+	reader->next_seq = reader->end_seq;
+	return NRF_ERROR_NOT_FOUND;
+}
+
+
+ret_code_t rx_archive_read_start(rx_archive_reader_t *reader, uint32_t start_seq, uint32_t count)
+{
+	VERIFY_SUCCESS(spi_flash_power_up());
+
+	if(start_seq < m_first_seq) {
+		start_seq = m_first_seq;
+	}
+
+	reader->next_seq = start_seq;
+	reader->end_seq = m_next_seq;
+
+	if(count > 0 && count < m_next_seq - start_seq) {
+		reader->end_seq = start_seq + count;
+	}
+
+	reader->done = (start_seq >= reader->end_seq);
+	reader->buf_len = 0;
+	reader->buf_pos = 0;
+	reader->end_sent = false;
+
+	// the sectors in the order of writing, oldest first
+	uint32_t first = oldest_sector();
+	uint32_t num = RX_ARCHIVE_NUM_SECTORS;
+
+	// find the last sector that starts before start_seq
+	uint32_t lo = 0;
+	uint32_t hi = num;
+
+	while(!reader->done && lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		uint32_t seq;
+
+		ret_code_t err_code = read_first_seq((first + mid) % RX_ARCHIVE_NUM_SECTORS, &seq);
+
+		if(err_code == NRF_ERROR_NOT_FOUND || (err_code == NRF_SUCCESS && seq <= start_seq)) {
+			lo = mid + 1;
+		} else if(err_code == NRF_SUCCESS) {
+			hi = mid;
+		} else {
+			spi_flash_power_down();
+			return err_code;
+		}
+	}
+
+	uint32_t start = (lo > 0) ? lo - 1 : 0;
+
+	reader->sector = (first + start) % RX_ARCHIVE_NUM_SECTORS;
+	reader->offset = 0;
+	reader->sectors_left = num - start;
+
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t rx_archive_read_next(rx_archive_reader_t *reader, rx_archive_record_t *record)
+{
+	uint16_t rec_len;
+
+	VERIFY_SUCCESS(read_next_raw(reader, m_read_buf, &rec_len));
+
+	record->seq      = get_u32(&m_read_buf[OFS_SEQ]);
+	record->time     = get_u32(&m_read_buf[OFS_TIME]);
+	record->rssi     = (int16_t)get_u16(&m_read_buf[OFS_RSSI]);
+	record->snr      = (int8_t)m_read_buf[OFS_SNR];
+	record->flags    = m_read_buf[OFS_FLAGS];
+	record->data_len = get_u16(&m_read_buf[OFS_LEN]);
+
+	memcpy(record->data, &m_read_buf[RX_ARCHIVE_HEADER_LEN], record->data_len);
+
+	return NRF_SUCCESS;
+}
+
+
+size_t rx_archive_read_stream(rx_archive_reader_t *reader, uint8_t *buf, size_t max_len)
+{
+	size_t len = 0;
+
+	while(len < max_len) {
+		if(reader->buf_pos == reader->buf_len) {
+			if(reader->end_sent) {
+				break;
+			}
+
+			uint16_t rec_len;
+
+			if(read_next_raw(reader, reader->buf, &rec_len) == NRF_SUCCESS) {
+				// the CRC is not needed on a reliable link
+				reader->buf_len = rec_len - CRC_LEN;
+			} else {
+				put_u16(&reader->buf[0], RX_ARCHIVE_STREAM_END);
+				put_u32(&reader->buf[2], reader->next_seq);
+				reader->buf_len = RX_ARCHIVE_STREAM_END_LEN;
+				reader->end_sent = true;
+			}
+
+			reader->buf_pos = 0;
+		}
+
+		size_t chunk = reader->buf_len - reader->buf_pos;
+
+		if(chunk > max_len - len) {
+			chunk = max_len - len;
+		}
+
+		memcpy(buf + len, reader->buf + reader->buf_pos, chunk);
+		reader->buf_pos += chunk;
+		len += chunk;
+	}
+
+	return len;
+}
+
+
+void rx_archive_read_end(rx_archive_reader_t *reader)
+{
+	(void)reader;
+	spi_flash_power_down();
+}
+
+
+void rx_archive_get_stats(rx_archive_stats_t *stats)
+{
+	*stats = m_stats;
+	stats->first_seq = m_first_seq;
+	stats->next_seq = m_next_seq;
+}
@@ -0,0 +1,195 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef RX_ARCHIVE_H
+#define RX_ARCHIVE_H
+
+/**@file
+ *
+ * @brief Archive of all received packets in the external SPI flash.
+ *
+ * @details
+ * Every received frame is stored with its reception time, RSSI and SNR and a
+ * sequence number that increases by one per packet. Frames arrive in
+ * interrupt context, so they are queued in RAM and written to the flash from
+ * the main loop. Records never cross a sector boundary. If a record does
+ * not fit into the rest of a sector, the sector is closed and the next one is
+ * erased, so the area is used as a ring and the oldest sector is overwritten.
+ *
+ * Record layout (little endian):
+ *
+ *   0  frame length (u16); 0xFFFF: not written yet, 0x0000: sector closed
+ *   2  sequence number (u32)
+ *   6  reception time (u32, Unix timestamp)
+ *  10  RSSI (i16, 0.1 dBm)
+ *  12  SNR (i8, 0.25 dB)
+ *  13  flags (u8, see RX_ARCHIVE_FLAG_*)
+ *  14  frame data
+ *   n  CRC-16/CCITT over all previous bytes (u16)
+ *
+ * At startup, the newest sector is found with a binary search over the
+ * first record of each sector. Records that were torn by a power loss are
+ * detected by their CRC; the rest of such a sector is closed.
+ *
+ * The archive can be read as a byte stream (see @ref rx_archive_read_stream())
+ * which is sent over BLE. The stream consists of the records without the
+ * CRC, followed by an end marker: 0xFFFF (u16) and the sequence number where
+ * a following download should continue (u32).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sdk_errors.h>
+
+#include "spi_flash.h"
+#include "track_log.h"
+
+// the area after the track log
+#define RX_ARCHIVE_FLASH_START  (TRACK_LOG_FLASH_START + TRACK_LOG_FLASH_SIZE)
+
+#ifndef RX_ARCHIVE_FLASH_SIZE
+#define RX_ARCHIVE_FLASH_SIZE   (1024UL * 1024)
+#endif
+
+#define RX_ARCHIVE_NUM_SECTORS  (RX_ARCHIVE_FLASH_SIZE / SPI_FLASH_SECTOR_SIZE)
+
+#define RX_ARCHIVE_MAX_FRAME_LEN   255
+
+#define RX_ARCHIVE_HEADER_LEN      14
+#define RX_ARCHIVE_MAX_RECORD_LEN  (RX_ARCHIVE_HEADER_LEN + RX_ARCHIVE_MAX_FRAME_LEN + 2)
+
+// length field of the end marker in the stream
+#define RX_ARCHIVE_STREAM_END      0xFFFF
+#define RX_ARCHIVE_STREAM_END_LEN  6
+
+#define RX_ARCHIVE_FLAG_TIME_VALID  0x01   //!< The time was set from GNSS.
+
+// records waiting to be written. Must be a power of 2.
+#ifndef RX_ARCHIVE_QUEUE_DEPTH
+#define RX_ARCHIVE_QUEUE_DEPTH  4
+#endif
+
+typedef struct {
+	uint32_t seq;       //!< Sequence number, set by @ref rx_archive_append().
+	uint32_t time;      //!< Unix timestamp of the reception.
+	int16_t  rssi;      //!< RSSI in 0.1 dBm.
+	int8_t   snr;       //!< SNR in 0.25 dB.
+	uint8_t  flags;     //!< See RX_ARCHIVE_FLAG_*.
+	uint16_t data_len;
+	uint8_t  data[RX_ARCHIVE_MAX_FRAME_LEN];
+} rx_archive_record_t;
+
+typedef struct {
+	uint32_t records;        //!< Records written since startup.
+	uint32_t bytes;          //!< Bytes written since startup, including the record headers.
+	uint32_t sector_erases;  //!< Sectors erased since startup.
+	uint32_t write_errors;   //!< Records that failed verification.
+	uint32_t dropped;        //!< Records that were dropped because the queue was full.
+	uint32_t init_reads;     //!< Flash reads needed to find the write position at startup.
+	uint32_t first_seq;      //!< Sequence number of the oldest record.
+	uint32_t next_seq;       //!< Sequence number of the next record.
+} rx_archive_stats_t;
+
+/**@brief Iterator over a range of records, see @ref rx_archive_read_start(). */
+typedef struct {
+	uint32_t sector;        //!< Current read position: sector index.
+	uint32_t offset;        //!< Current read position: offset in the sector.
+	uint32_t sectors_left;  //!< Limits the search for the next record.
+	uint32_t next_seq;      //!< Sequence number of the next record to return.
+	uint32_t end_seq;       //!< Stop before this sequence number.
+	bool     done;          //!< The end of the range was reached.
+
+	uint8_t  buf[RX_ARCHIVE_MAX_RECORD_LEN];  //!< Stream data not yet returned.
+	uint16_t buf_len;
+	uint16_t buf_pos;
+	bool     end_sent;      //!< The end marker is in the buffer.
+} rx_archive_reader_t;
+
+/**@brief Find the write position in the flash.
+ * @details
+ * @ref spi_flash_init() must have been called before.
+ */
+ret_code_t rx_archive_init(void);
+
+/**@brief Store a record in the flash.
+ *
+ * @param[inout] record   The record to store. The sequence number is set.
+ */
+ret_code_t rx_archive_append(rx_archive_record_t *record);
+
+/**@brief Queue a record for @ref rx_archive_write_queued().
+ * @details
+ * May be called from interrupt context, but only from one priority.
+ *
+ * @param[in] record   The record to store.
+ * @returns   False if the queue is full and the record was dropped.
+ */
+bool rx_archive_push(const rx_archive_record_t *record);
+
+/**@brief Store all queued records in the flash.
+ */
+ret_code_t rx_archive_write_queued(void);
+
+/**@brief Start reading a range of records.
+ * @details
+ * The flash is powered until @ref rx_archive_read_end() is called. Records
+ * that are appended after this call are not included.
+ *
+ * @param[out] reader     The iterator to initialize.
+ * @param[in]  start_seq  The first sequence number to return. Older records
+ *                        may have been overwritten already.
+ * @param[in]  count      Maximum number of records. 0 means all.
+ */
+ret_code_t rx_archive_read_start(rx_archive_reader_t *reader, uint32_t start_seq, uint32_t count);
+
+/**@brief Get the next record.
+ *
+ * @retval NRF_ERROR_NOT_FOUND   There are no more records in the range.
+ */
+ret_code_t rx_archive_read_next(rx_archive_reader_t *reader, rx_archive_record_t *record);
+
+/**@brief Get the next part of the stream.
+ * @details
+ * Records are split at arbitrary points, so every call can fill the whole
+ * buffer.
+ *
+ * @param[inout] reader    The iterator.
+ * @param[out]   buf       Buffer for the stream data.
+ * @param[in]    max_len   Size of the buffer.
+ * @returns      The number of bytes written to buf, 0 after the end marker.
+ */
+size_t rx_archive_read_stream(rx_archive_reader_t *reader, uint8_t *buf, size_t max_len);
+
+/**@brief Finish reading and power down the flash.
+ */
+void rx_archive_read_end(rx_archive_reader_t *reader);
+
+/**@brief Get the statistics and the available range of sequence numbers.
+ */
+void rx_archive_get_stats(rx_archive_stats_t *stats);
+
+#endif // RX_ARCHIVE_H
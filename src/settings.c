@@ -22,10 +22,13 @@
  * SOFTWARE.
  */
 
+
 #include <string.h>
 
 #include <fds.h>
 #include <sdk_macros.h>
+#include <app_error.h>
+#include <app_timer.h>
 
 #define NRF_LOG_MODULE_NAME settings
 #include <nrf_log.h>
@@ -35,40 +38,92 @@ NRF_LOG_MODULE_REGISTER();
 
 #include "nrf_error.h"
 #include "settings.h"
+#include "settings_tlv.h"
+#include "event_queue.h"
 
 #define SETTINGS_FDS_FILE_ID  0x0001
 
+// record key of the journal that holds a snapshot while it is restored
+#define SETTINGS_FDS_RESTORE_KEY  0x0100
+
+// changed settings are written to flash once no further change happened for
+// this time
+#define SETTINGS_FLUSH_DELAY_MS  5000
+
+// size of the RAM copy of all settings. Each setting occupies its maximum
+// length, rounded up to whole words.
+#define CACHE_DATA_WORDS  64
+
+#define PADDED_LEN(len)  (((len) + 3) & ~3U)
+
+typedef enum
+{
+	FLUSH_IDLE,
+	FLUSH_JOURNAL,     // a snapshot is being written to the journal
+	FLUSH_RECORDS,     // changed settings are being written one by one
+	FLUSH_CLEANUP      // the journal is being deleted
+} flush_state_t;
+
+typedef struct
+{
+	uint16_t offset;   // position of the value in m_cache_data (bytes)
+	uint8_t  len;      // length of the value
+	bool     present;  // the setting is stored. Otherwise, the default is used.
+	bool     dirty;    // the value has not been written to flash yet
+} cache_entry_t;
+
+APP_TIMER_DEF(m_flush_timer);
+
 static settings_callback m_callback;
-static settings_id_t     m_pending_id = SETTINGS_ID_INVALID;
 
-static uint8_t m_write_cache[256];
+static cache_entry_t m_cache[SETTINGS_NUM_IDS];
+static uint32_t      m_cache_data[CACHE_DATA_WORDS];
+static bool          m_cache_loaded;
+
+static flush_state_t m_flush_state = FLUSH_IDLE;
+static settings_id_t m_flush_id;              // setting that is currently written
+static bool          m_journal_active;        // the records are written from a snapshot
+static bool          m_restore_requested;     // the application waits for the restore result
+
+static settings_stats_t m_stats;
+
+// FDS requires word-aligned data that stays valid until the operation completes
+static uint32_t m_write_cache[256 / 4];
+static uint32_t m_restore_buf[SETTINGS_TLV_MAX_LEN / 4];
+static size_t   m_restore_len;
+
+static const uint16_t LENGTH_MIN[SETTINGS_NUM_IDS] = {
+	0, // SETTINGS_ID_INVALID
+	3, // SETTINGS_ID_SOURCE_CALL
+	2, // SETTINGS_ID_SYMBOL_CODE
+	0, // SETTINGS_ID_COMMENT
+	1, // SETTINGS_ID_LORA_POWER
+	4, // SETTINGS_ID_APRS_FLAGS
+	2, // SETTINGS_ID_LAST_BLE_SYMBOL
+	4, // SETTINGS_ID_RF_FREQUENCY
+	4, // SETTINGS_ID_LORA_MOD_CONFIG
+	12, // SETTINGS_ID_SMARTBEACON
+	2, // SETTINGS_ID_DEAD_RECKONING
+	38, // SETTINGS_ID_ENERGY_MODEL
+};
+
+static const uint16_t LENGTH_MAX[SETTINGS_NUM_IDS] = {
+	0, // SETTINGS_ID_INVALID
+	12, // SETTINGS_ID_SOURCE_CALL
+	2, // SETTINGS_ID_SYMBOL_CODE
+	64, // SETTINGS_ID_COMMENT
+	1, // SETTINGS_ID_LORA_POWER
+	4, // SETTINGS_ID_APRS_FLAGS
+	2, // SETTINGS_ID_LAST_BLE_SYMBOL
+	4, // SETTINGS_ID_RF_FREQUENCY
+	4, // SETTINGS_ID_LORA_MOD_CONFIG
+	12, // SETTINGS_ID_SMARTBEACON
+	2, // SETTINGS_ID_DEAD_RECKONING
+	38, // SETTINGS_ID_ENERGY_MODEL
+};
 
 ret_code_t check_data_for_setting(settings_id_t id, const uint8_t *data, size_t data_len)
 {
-	static const uint16_t LENGTH_MIN[SETTINGS_NUM_IDS] = {
-		0, // SETTINGS_ID_INVALID
-		3, // SETTINGS_ID_SOURCE_CALL
-		2, // SETTINGS_ID_SYMBOL_CODE
-		0, // SETTINGS_ID_COMMENT
-		1, // SETTINGS_ID_LORA_POWER
-		4, // SETTINGS_ID_APRS_FLAGS
-		2, // SETTINGS_ID_LAST_BLE_SYMBOL
-		4, // SETTINGS_ID_RF_FREQUENCY
-		4, // SETTINGS_ID_LORA_MOD_CONFIG
-	};
-
-	static const uint16_t LENGTH_MAX[SETTINGS_NUM_IDS] = {
-		0, // SETTINGS_ID_INVALID
-		12, // SETTINGS_ID_SOURCE_CALL
-		2, // SETTINGS_ID_SYMBOL_CODE
-		64, // SETTINGS_ID_COMMENT
-		1, // SETTINGS_ID_LORA_POWER
-		4, // SETTINGS_ID_APRS_FLAGS
-		2, // SETTINGS_ID_LAST_BLE_SYMBOL
-		4, // SETTINGS_ID_RF_FREQUENCY
-		4, // SETTINGS_ID_LORA_MOD_CONFIG
-	};
-
 	uint16_t len_min = LENGTH_MIN[id];
 	uint16_t len_max = LENGTH_MAX[id];
 
@@ -79,36 +134,420 @@ ret_code_t check_data_for_setting(settings_id_t id, const uint8_t *data, size_t
 	return NRF_SUCCESS;
 }
 
-static void cb_fds(fds_evt_t const * p_evt)
+
+static uint8_t* cache_value(settings_id_t id)
+{
+	return (uint8_t *)m_cache_data + m_cache[id].offset;
+}
+
+
+/**@brief Update the RAM copy of a setting.
+ *
+ * @param[in] id        The setting.
+ * @param[in] data      The new value, NULL to reset the setting to its default.
+ * @param[in] data_len  Length of the new value.
+ */
+static void cache_update(settings_id_t id, const uint8_t *data, size_t data_len)
+{
+	cache_entry_t *entry = &m_cache[id];
+	uint8_t *value = cache_value(id);
+	size_t slot_len = PADDED_LEN(LENGTH_MAX[id]);
+
+	// compare like FDS stores it: padded to whole words
+	uint8_t padded[PADDED_LEN(256)];
+
+	memset(padded, 0, slot_len);
+
+	if(data) {
+		memcpy(padded, data, data_len);
+	}
+
+	bool unchanged = (entry->present == (data != NULL))
+		&& (!data || (PADDED_LEN(entry->len) == PADDED_LEN(data_len)
+				&& memcmp(value, padded, slot_len) == 0));
+
+	if(unchanged || entry->dirty) {
+		// no additional flash write is necessary for this change
+		m_stats.flash_writes_saved++;
+	}
+
+	if(unchanged) {
+		return;
+	}
+
+	memcpy(value, padded, slot_len);
+	entry->len = data ? data_len : 0;
+	entry->present = (data != NULL);
+	entry->dirty = true;
+}
+
+
+static bool cache_is_dirty(void)
+{
+	for(settings_id_t id = SETTINGS_ID_INVALID + 1; id < SETTINGS_NUM_IDS; id++) {
+		if(m_cache[id].dirty) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**@brief Load all settings from flash into RAM.
+ */
+static void cache_load(void)
+{
+	fds_flash_record_t  flash_record;
+	fds_record_desc_t   record_desc;
+	fds_find_token_t    token;
+
+	for(settings_id_t id = SETTINGS_ID_INVALID + 1; id < SETTINGS_NUM_IDS; id++) {
+		cache_entry_t *entry = &m_cache[id];
+
+		memset(&token, 0x00, sizeof(fds_find_token_t));
+
+		if(fds_record_find(SETTINGS_FDS_FILE_ID, id, &record_desc, &token) != NRF_SUCCESS
+				|| fds_record_open(&record_desc, &flash_record) != NRF_SUCCESS) {
+			continue;
+		}
+
+		size_t record_len = flash_record.p_header->length_words * 4;
+		size_t slot_len = PADDED_LEN(LENGTH_MAX[id]);
+
+		if(record_len > slot_len) {
+			NRF_LOG_WARNING("record %04x truncated: %d > %d bytes", id, record_len, slot_len);
+			record_len = slot_len;
+		}
+
+		memcpy(cache_value(id), flash_record.p_data, record_len);
+		entry->len = record_len;
+		entry->present = true;
+
+		fds_record_close(&record_desc);
+	}
+
+	m_cache_loaded = true;
+}
+
+
+/**@brief Copy the values from a validated snapshot into RAM.
+ * @details
+ * Settings that are not part of the snapshot are reset to their defaults.
+ */
+static void cache_apply_snapshot(const uint8_t *snapshot, size_t snapshot_len)
+{
+	settings_tlv_reader_t reader;
+
+	settings_tlv_reader_init(&reader, snapshot, snapshot_len);
+
+	for(settings_id_t id = SETTINGS_ID_INVALID + 1; id < SETTINGS_NUM_IDS; id++) {
+		const uint8_t *value;
+		uint8_t value_len;
+
+		if(settings_tlv_find(&reader, id, &value, &value_len)) {
+			cache_update(id, value, value_len);
+		} else {
+			cache_update(id, NULL, 0);
+		}
+	}
+}
+
+
+static void start_flush_timer(void)
+{
+	app_timer_stop(m_flush_timer);
+	APP_ERROR_CHECK(app_timer_start(m_flush_timer, APP_TIMER_TICKS(SETTINGS_FLUSH_DELAY_MS), NULL));
+}
+
+
+/**@brief Write the flash record of one setting from its RAM copy.
+ *
+ * @param[in] id          The setting.
+ * @param[out] started    Set to false if no flash operation was necessary.
+ * @returns               The result from FDS.
+ */
+static ret_code_t flush_record(settings_id_t id, bool *started)
+{
+	cache_entry_t       *entry = &m_cache[id];
+	fds_record_desc_t   record_desc;
+	fds_find_token_t    token;
+	fds_record_t        record;
+
+	ret_code_t err_code;
+
+	memset(&token, 0x00, sizeof(fds_find_token_t));
+
+	bool record_exists = (fds_record_find(SETTINGS_FDS_FILE_ID, id, &record_desc, &token) == NRF_SUCCESS);
+
+	*started = false;
+
+	if(!entry->present) {
+		if(!record_exists) {
+			return NRF_SUCCESS;
+		}
+
+		NRF_LOG_INFO("deleting record %04x", id);
+		err_code = fds_record_delete(&record_desc);
+	} else {
+		// the RAM copy may change while FDS is busy
+		memcpy(m_write_cache, cache_value(id), PADDED_LEN(entry->len));
+
+		record.file_id           = SETTINGS_FDS_FILE_ID;
+		record.key               = id;
+		record.data.p_data       = m_write_cache;
+		record.data.length_words = PADDED_LEN(entry->len) / 4;
+
+		if(record_exists) {
+			NRF_LOG_INFO("updating record %04x", id);
+			err_code = fds_record_update(&record_desc, &record);
+		} else {
+			NRF_LOG_INFO("creating record %04x", id);
+			err_code = fds_record_write(NULL, &record);
+		}
+	}
+
+	if(err_code == NRF_SUCCESS) {
+		*started = true;
+		entry->dirty = false;
+		m_stats.flash_writes++;
+	}
+
+	return err_code;
+}
+
+
+/**@brief Finish writing changed settings and notify the application.
+ */
+static void flush_finish(bool success)
+{
+	bool journal_active = m_journal_active;
+
+	m_flush_state = FLUSH_IDLE;
+	m_journal_active = false;
+
+	if(cache_is_dirty()) {
+		// changed during the flush or failed: try again later
+		start_flush_timer();
+	}
+
+	if(journal_active && m_restore_requested) {
+		m_restore_requested = false;
+		m_callback(success ? SETTINGS_EVT_RESTORE_COMPLETE : SETTINGS_EVT_RESTORE_FAILED,
+				SETTINGS_ID_INVALID);
+	}
+
+	m_callback(SETTINGS_EVT_FLUSH_COMPLETE, SETTINGS_ID_INVALID);
+}
+
+
+/**@brief Start the next FDS operation of a flush.
+ * @details
+ * Changed settings are written in ID order. If the settings are restored
+ * from a snapshot, the journal is deleted once all settings are written.
+ */
+static void flush_continue(void)
+{
+	ret_code_t err_code;
+
+	while(++m_flush_id < SETTINGS_NUM_IDS) {
+		bool started;
+
+		if(!m_cache[m_flush_id].dirty) {
+			continue;
+		}
+
+		err_code = flush_record(m_flush_id, &started);
+
+		if(err_code != NRF_SUCCESS) {
+			NRF_LOG_ERROR("cannot write setting %d: 0x%08x", m_flush_id, err_code);
+			flush_finish(false);
+			return;
+		}
+
+		if(started) {
+			// continued from the FDS event
+			return;
+		}
+
+		m_cache[m_flush_id].dirty = false;
+	}
+
+	if(!m_journal_active) {
+		flush_finish(true);
+		return;
+	}
+
+	fds_record_desc_t record_desc;
+	fds_find_token_t  token;
+
+	memset(&token, 0x00, sizeof(fds_find_token_t));
+
+	m_flush_state = FLUSH_CLEANUP;
+
+	err_code = fds_record_find(SETTINGS_FDS_FILE_ID, SETTINGS_FDS_RESTORE_KEY, &record_desc, &token);
+
+	if(err_code == NRF_SUCCESS) {
+		err_code = fds_record_delete(&record_desc);
+	}
+
+	if(err_code != NRF_SUCCESS) {
+		NRF_LOG_ERROR("restore: cannot delete the journal: 0x%08x", err_code);
+		flush_finish(false);
+	}
+}
+
+
+static void flush_start(bool journal_active)
+{
+	m_flush_state = FLUSH_RECORDS;
+	m_flush_id = SETTINGS_ID_INVALID;
+	m_journal_active = journal_active;
+
+	flush_continue();
+}
+
+
+/**@brief Handle the completion of an FDS operation that belongs to a flush.
+ *
+ * @returns  True if the event was handled.
+ */
+static bool flush_handle_fds_evt(uint16_t record_key, ret_code_t result)
+{
+	switch(m_flush_state) {
+		case FLUSH_JOURNAL:
+			if(record_key != SETTINGS_FDS_RESTORE_KEY) {
+				return false;
+			}
+
+			if(result != NRF_SUCCESS) {
+				// nothing was changed
+				flush_finish(false);
+				return true;
+			}
+
+			// from now on, the restore is completed even after a reset
+			cache_apply_snapshot((const uint8_t *)m_restore_buf, m_restore_len);
+			flush_start(true);
+			return true;
+
+		case FLUSH_RECORDS:
+			if(record_key != m_flush_id) {
+				return false;
+			}
+
+			if(result != NRF_SUCCESS) {
+				// a journal is kept, so the restore is retried on the next start
+				m_cache[m_flush_id].dirty = true;
+				flush_finish(false);
+				return true;
+			}
+
+			m_callback(SETTINGS_EVT_UPDATE_COMPLETE, m_flush_id);
+			flush_continue();
+			return true;
+
+		case FLUSH_CLEANUP:
+			if(record_key != SETTINGS_FDS_RESTORE_KEY) {
+				return false;
+			}
+
+			flush_finish(result == NRF_SUCCESS);
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+
+/**@brief Continue a restore that was interrupted by a reset.
+ * @details
+ * The snapshot is applied to the RAM copy immediately, so the application
+ * sees the restored settings while they are written.
+ */
+static void restore_resume(void)
 {
-	bool op_done = false;
+	fds_flash_record_t  flash_record;
+	fds_record_desc_t   record_desc;
+	fds_find_token_t    token;
+
+	memset(&token, 0x00, sizeof(fds_find_token_t));
+
+	if(fds_record_find(SETTINGS_FDS_FILE_ID, SETTINGS_FDS_RESTORE_KEY, &record_desc, &token) != NRF_SUCCESS) {
+		return;
+	}
+
+	if(fds_record_open(&record_desc, &flash_record) != NRF_SUCCESS) {
+		return;
+	}
+
+	size_t record_len = flash_record.p_header->length_words * 4;
+
+	if(record_len > sizeof(m_restore_buf)) {
+		record_len = sizeof(m_restore_buf);
+	}
 
+	memcpy(m_restore_buf, flash_record.p_data, record_len);
+	fds_record_close(&record_desc);
+
+	// remove the padding
+	m_restore_len = settings_tlv_get_total_len((const uint8_t *)m_restore_buf, record_len);
+
+	settings_tlv_reader_t reader;
+
+	if(m_restore_len == 0 || m_restore_len > record_len
+			|| settings_tlv_reader_init(&reader, (const uint8_t *)m_restore_buf, m_restore_len) != SETTINGS_TLV_OK) {
+		NRF_LOG_ERROR("restore: invalid journal deleted");
+		fds_record_delete(&record_desc);
+		return;
+	}
+
+	NRF_LOG_INFO("restore: completing interrupted restore");
+
+	cache_apply_snapshot((const uint8_t *)m_restore_buf, m_restore_len);
+	flush_start(true);
+}
+
+
+static void cb_fds(fds_evt_t const * p_evt)
+{
 	switch(p_evt->id) {
 		case FDS_EVT_INIT:
 			NRF_LOG_INFO("callback: INIT");
+
+			cache_load();
+			restore_resume();
+
 			m_callback(SETTINGS_EVT_INIT, SETTINGS_ID_INVALID);
 			break;
 
 		case FDS_EVT_UPDATE:
 		case FDS_EVT_WRITE:
 			NRF_LOG_INFO("callback: WRITE/UPDATE %04x", p_evt->write.record_key);
-			op_done = (p_evt->write.record_key == m_pending_id);
+			flush_handle_fds_evt(p_evt->write.record_key, p_evt->result);
 			break;
 
 		case FDS_EVT_DEL_RECORD:
 			NRF_LOG_INFO("callback: DEL %04x", p_evt->del.record_key);
-			op_done = (p_evt->del.record_key == m_pending_id);
+			flush_handle_fds_evt(p_evt->del.record_key, p_evt->result);
 			break;
 
 		default:
 			break;
 	}
+}
 
-	if(op_done) {
-		NRF_LOG_INFO("callback: write operation on %04x complete!", m_pending_id);
-		m_callback(SETTINGS_EVT_UPDATE_COMPLETE, m_pending_id);
-		m_pending_id = SETTINGS_ID_INVALID;
-	}
+
+static void cb_flush_timer(void *p_context)
+{
+	event_queue_post(EVENT_SETTINGS_FLUSH);
+}
+
+
+static void handle_flush(void)
+{
+	settings_flush();
 }
 
 
@@ -118,6 +557,35 @@ ret_code_t settings_init(settings_callback callback)
 
 	m_callback = callback;
 
+	// assign the RAM copies
+	uint16_t offset = 0;
+
+	for(settings_id_t id = SETTINGS_ID_INVALID; id < SETTINGS_NUM_IDS; id++) {
+		m_cache[id].offset = offset;
+		m_cache[id].len = 0;
+		m_cache[id].present = false;
+		m_cache[id].dirty = false;
+
+		offset += PADDED_LEN(LENGTH_MAX[id]);
+	}
+
+	if(offset > sizeof(m_cache_data)) {
+		return NRF_ERROR_NO_MEM;
+	}
+
+	memset(m_cache_data, 0, sizeof(m_cache_data));
+	memset(&m_stats, 0, sizeof(m_stats));
+
+	m_cache_loaded = false;
+	m_flush_state = FLUSH_IDLE;
+	m_journal_active = false;
+	m_restore_requested = false;
+
+	err_code = app_timer_create(&m_flush_timer, APP_TIMER_MODE_SINGLE_SHOT, cb_flush_timer);
+	VERIFY_SUCCESS(err_code);
+
+	event_queue_register(EVENT_SETTINGS_FLUSH, handle_flush);
+
 	err_code = fds_register(cb_fds);
 	VERIFY_SUCCESS(err_code);
 
@@ -139,61 +607,49 @@ ret_code_t settings_init(settings_callback callback)
 
 ret_code_t settings_query(settings_id_t id, uint8_t *data, size_t *data_len)
 {
-	fds_flash_record_t  flash_record;
-	fds_record_desc_t   record_desc;
-	fds_find_token_t    token;
-
-	ret_code_t err_code;
-
 	if(id == SETTINGS_ID_INVALID || id >= SETTINGS_NUM_IDS) {
 		return NRF_ERROR_INVALID_PARAM;
 	}
 
-	memset(&token, 0x00, sizeof(fds_find_token_t));
+	if(!m_cache_loaded) {
+		return NRF_ERROR_INVALID_STATE;
+	}
 
-	err_code = fds_record_find(SETTINGS_FDS_FILE_ID, id, &record_desc, &token);
-	VERIFY_SUCCESS(err_code);
+	if(!m_cache[id].present) {
+		return FDS_ERR_NOT_FOUND;
+	}
 
-	err_code = fds_record_open(&record_desc, &flash_record);
-	VERIFY_SUCCESS(err_code);
+	size_t record_size_bytes = PADDED_LEN(m_cache[id].len);
 
-	size_t record_size_bytes = flash_record.p_header->length_words * 4;
-	NRF_LOG_INFO("size of record %04x = %d bytes", id, record_size_bytes);
 	if(*data_len < record_size_bytes) {
 		// insufficient memory provided for this record
 		NRF_LOG_INFO("insufficient memory to read record %04x: %d < %d bytes", id, *data_len, record_size_bytes);
 		*data_len = record_size_bytes;
-		fds_record_close(&record_desc);
 		return NRF_ERROR_NO_MEM;
 	}
 
 	*data_len = record_size_bytes;
-	memcpy(data, flash_record.p_data, record_size_bytes);
+	memcpy(data, cache_value(id), record_size_bytes);
 
-	return fds_record_close(&record_desc);
+	return NRF_SUCCESS;
 }
 
 
 ret_code_t settings_write(settings_id_t id, const uint8_t *data, size_t data_len)
 {
-	fds_record_desc_t   record_desc;
-	fds_find_token_t    token;
-	fds_record_t        record;
-
-	bool record_exists;
-
 	ret_code_t err_code;
 
 	if(id == SETTINGS_ID_INVALID || id >= SETTINGS_NUM_IDS) {
 		return NRF_ERROR_INVALID_PARAM;
 	}
 
-	if(m_pending_id != SETTINGS_ID_INVALID) {
-		return NRF_ERROR_BUSY;
+	if(!m_cache_loaded) {
+		return NRF_ERROR_INVALID_STATE;
 	}
 
-	if(data_len > sizeof(m_write_cache)) {
-		return NRF_ERROR_NO_MEM;
+	if(m_flush_state == FLUSH_JOURNAL) {
+		// the snapshot would overwrite the new value
+		return NRF_ERROR_BUSY;
 	}
 
 	err_code = check_data_for_setting(id, data, data_len);
@@ -202,38 +658,157 @@ ret_code_t settings_write(settings_id_t id, const uint8_t *data, size_t data_len
 		return err_code;
 	}
 
-	memset(&token, 0x00, sizeof(fds_find_token_t));
+	if(data_len == 0) {
+		cache_update(id, NULL, 0);
+	} else {
+		cache_update(id, data, data_len);
+	}
+
+	if(m_cache[id].dirty) {
+		// more changes are likely to follow, e.g. while navigating the menu
+		start_flush_timer();
+	}
+
+	return NRF_SUCCESS;
+}
 
-	err_code = fds_record_find(SETTINGS_FDS_FILE_ID, id, &record_desc, &token);
-	record_exists = (err_code == NRF_SUCCESS);
 
-	NRF_LOG_INFO("record %04x exists? %d", id, record_exists);
+ret_code_t settings_flush(void)
+{
+	if(!m_cache_loaded) {
+		return NRF_ERROR_INVALID_STATE;
+	}
 
-	m_pending_id = id; // for completion check. Also marks the settings module as busy.
+	app_timer_stop(m_flush_timer);
 
-	if(record_exists && data_len == 0) {
-		// delete the existing record
-		NRF_LOG_INFO("deleting record %04x", id);
-		return fds_record_delete(&record_desc);
+	if(m_flush_state != FLUSH_IDLE) {
+		// changes made in the meantime are written when it completes
+		return NRF_SUCCESS;
 	}
 
-	// copy the data into the write cache
-	memcpy(m_write_cache, data, data_len);
+	if(!cache_is_dirty()) {
+		m_callback(SETTINGS_EVT_FLUSH_COMPLETE, SETTINGS_ID_INVALID);
+		return NRF_SUCCESS;
+	}
+
+	flush_start(false);
+
+	return NRF_SUCCESS;
+}
+
+
+bool settings_is_saved(void)
+{
+	return m_flush_state == FLUSH_IDLE && !cache_is_dirty();
+}
+
+
+void settings_get_stats(settings_stats_t *stats)
+{
+	*stats = m_stats;
+}
+
+
+ret_code_t settings_export_snapshot(uint8_t *data, size_t *data_len)
+{
+	settings_tlv_writer_t writer;
+
+	if(!m_cache_loaded) {
+		return NRF_ERROR_INVALID_STATE;
+	}
+
+	settings_tlv_writer_init(&writer, data, *data_len);
+
+	for(settings_id_t id = SETTINGS_ID_INVALID + 1; id < SETTINGS_NUM_IDS; id++) {
+		if(!m_cache[id].present) {
+			// the default value is used
+			continue;
+		}
+
+		// remove the padding added by FDS
+		size_t value_len = m_cache[id].len;
 
-	// fill the record structure to write
+		if(value_len > LENGTH_MAX[id]) {
+			value_len = LENGTH_MAX[id];
+		}
+
+		if(!settings_tlv_add(&writer, id, cache_value(id), value_len)) {
+			return NRF_ERROR_NO_MEM;
+		}
+	}
+
+	*data_len = settings_tlv_finish(&writer);
+
+	return (*data_len > 0) ? NRF_SUCCESS : NRF_ERROR_NO_MEM;
+}
+
+
+ret_code_t settings_import_snapshot(const uint8_t *data, size_t data_len, settings_id_t *invalid_id)
+{
+	fds_record_desc_t   record_desc;
+	fds_find_token_t    token;
+	fds_record_t        record;
+
+	settings_tlv_reader_t reader;
+
+	uint8_t id;
+	const uint8_t *value;
+	uint8_t value_len;
+
+	ret_code_t err_code;
+
+	*invalid_id = SETTINGS_ID_INVALID;
+
+	if(!m_cache_loaded) {
+		return NRF_ERROR_INVALID_STATE;
+	}
+
+	if(m_flush_state != FLUSH_IDLE) {
+		return NRF_ERROR_BUSY;
+	}
+
+	if(data_len > sizeof(m_restore_buf)
+			|| settings_tlv_reader_init(&reader, data, data_len) != SETTINGS_TLV_OK) {
+		NRF_LOG_ERROR("restore: invalid snapshot (%zd bytes)", data_len);
+		return NRF_ERROR_INVALID_DATA;
+	}
+
+	// all values are checked before anything is written
+	while(settings_tlv_next(&reader, &id, &value, &value_len)) {
+		if(id == SETTINGS_ID_INVALID || id >= SETTINGS_NUM_IDS
+				|| check_data_for_setting(id, value, value_len) != NRF_SUCCESS) {
+			NRF_LOG_ERROR("restore: invalid value for setting %d", id);
+			*invalid_id = id;
+			return NRF_ERROR_INVALID_PARAM;
+		}
+	}
+
+	memset(m_restore_buf, 0, sizeof(m_restore_buf));
+	memcpy(m_restore_buf, data, data_len);
+	m_restore_len = data_len;
+
+	// the journal is written in one FDS operation, which either completes or
+	// leaves no trace
 	record.file_id           = SETTINGS_FDS_FILE_ID;
-	record.key               = id;
-	record.data.p_data       = m_write_cache;
-	/* The following calculation takes into account any eventual remainder of the division. */
-	record.data.length_words = (data_len + 3) / 4;
-
-	if(record_exists) {
-		// write new record and erase the old one
-		NRF_LOG_INFO("updating record %04x", id);
-		return fds_record_update(&record_desc, &record);
+	record.key               = SETTINGS_FDS_RESTORE_KEY;
+	record.data.p_data       = m_restore_buf;
+	record.data.length_words = PADDED_LEN(data_len) / 4;
+
+	memset(&token, 0x00, sizeof(fds_find_token_t));
+
+	if(fds_record_find(SETTINGS_FDS_FILE_ID, SETTINGS_FDS_RESTORE_KEY, &record_desc, &token) == NRF_SUCCESS) {
+		err_code = fds_record_update(&record_desc, &record);
 	} else {
-		// just create the new record
-		NRF_LOG_INFO("creating record %04x", id);
-		return fds_record_write(NULL, &record);
+		err_code = fds_record_write(NULL, &record);
 	}
+
+	if(err_code == NRF_SUCCESS) {
+		app_timer_stop(m_flush_timer);
+
+		m_flush_state = FLUSH_JOURNAL;
+		m_restore_requested = true;
+		m_journal_active = true;
+	}
+
+	return err_code;
 }
@@ -32,9 +32,14 @@
  * @details
  * This module implements a settings storage based on Nordic’s flash data
  * storage (FDS) library.
+ *
+ * All settings are kept in RAM. Changes are collected there and written to
+ * flash in a batch after a quiet period, which saves flash erase cycles and
+ * delays the FDS garbage collection.
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <sdk_errors.h>
 
@@ -52,6 +57,9 @@ typedef enum
 	SETTINGS_ID_LAST_BLE_SYMBOL  = 0x0006,
 	SETTINGS_ID_RF_FREQUENCY     = 0x0007,
 	SETTINGS_ID_LORA_MOD_CONFIG  = 0x0008,
+	SETTINGS_ID_SMARTBEACON      = 0x0009,
+	SETTINGS_ID_DEAD_RECKONING   = 0x000A,
+	SETTINGS_ID_ENERGY_MODEL     = 0x000B,
 
 	SETTINGS_NUM_IDS
 } settings_id_t;
@@ -61,9 +69,20 @@ typedef enum
 typedef enum
 {
 	SETTINGS_EVT_INIT,
-	SETTINGS_EVT_UPDATE_COMPLETE
+	SETTINGS_EVT_UPDATE_COMPLETE,
+	SETTINGS_EVT_RESTORE_COMPLETE,
+	SETTINGS_EVT_RESTORE_FAILED,
+	SETTINGS_EVT_FLUSH_COMPLETE
 } settings_evt_t;
 
+/**@brief Statistics of the flash usage.
+ */
+typedef struct
+{
+	uint32_t flash_writes;        //!< FDS write, update and delete operations.
+	uint32_t flash_writes_saved;  //!< Changes that did not need their own flash operation.
+} settings_stats_t;
+
 
 typedef void (*settings_callback)(settings_evt_t evt, settings_id_t id);
 
@@ -74,6 +93,10 @@ typedef void (*settings_callback)(settings_evt_t evt, settings_id_t id);
 ret_code_t settings_init(settings_callback callback);
 
 /**@brief Query a setting.
+ * @details
+ * The value is read from the RAM copy of all settings, which is loaded once
+ * during initialization. It already contains changes that have not been
+ * written to flash yet.
  *
  * @note
  * The result length will always be a multiple of 4 because FDS operates only
@@ -87,13 +110,17 @@ ret_code_t settings_init(settings_callback callback);
  * @retval NRF_ERROR_NO_MEM   If the provided data_len was too small for the
  *                            record. data_len will be set to the required
  *                            length if this happens.
- * @retval err_code        The result from the FDS operations.
+ * @retval FDS_ERR_NOT_FOUND If the setting uses its default value.
+ * @retval NRF_ERROR_INVALID_STATE If the settings are not loaded yet.
  */
 ret_code_t settings_query(settings_id_t id, uint8_t *data, size_t *data_len);
 
 /**@brief Write or delete a setting.
  * @details
- * This is an asynchronous operation.
+ * The RAM copy is updated immediately. The value is written to flash once no
+ * setting has changed for a few seconds, so several changes in a row cause
+ * only one flash write per setting. Values that do not change are not written
+ * at all. SETTINGS_EVT_UPDATE_COMPLETE is sent when the value is in flash.
  *
  * Set the data_len to 0 to delete an existing record. Otherwise, the record is
  * update if it exists or created if not.
@@ -106,9 +133,62 @@ ret_code_t settings_query(settings_id_t id, uint8_t *data, size_t *data_len);
  * @param[in] id        ID of the setting to update.
  * @param[in] data      Pointer to the data to write.
  * @param[in] data_len  Length of the data to write (0 = delete record).
- * @returns             The result from fds_record_write().
+ * @retval NRF_ERROR_BUSY   While a snapshot is being stored.
+ * @returns             Otherwise, the result of the data validation.
  */
 ret_code_t settings_write(settings_id_t id, const uint8_t *data, size_t data_len);
 
+/**@brief Write all changed settings to flash now.
+ * @details
+ * Use this before the device is switched off. SETTINGS_EVT_FLUSH_COMPLETE is
+ * sent once all changes are written or writing has failed.
+ *
+ * @retval NRF_ERROR_INVALID_STATE If the settings are not loaded yet.
+ */
+ret_code_t settings_flush(void);
+
+/**@brief Check whether all changes have been written to flash.
+ */
+bool settings_is_saved(void);
+
+/**@brief Get the flash usage statistics.
+ *
+ * @param[out] stats    Pointer to the structure to fill.
+ */
+void settings_get_stats(settings_stats_t *stats);
+
+/**@brief Encode all stored settings as a snapshot.
+ * @details
+ * Settings that use their default value are not included. See settings_tlv.h
+ * for the format.
+ *
+ * @param[in] data         Buffer for the snapshot.
+ * @param[inout] data_len  Upon call, the buffer size. Will be updated with
+ *                         the length of the snapshot.
+ * @retval NRF_ERROR_NO_MEM   If the buffer is too small.
+ * @retval NRF_ERROR_INVALID_STATE If the settings are not loaded yet.
+ */
+ret_code_t settings_export_snapshot(uint8_t *data, size_t *data_len);
+
+/**@brief Replace all settings with the contents of a snapshot.
+ * @details
+ * This is an asynchronous operation. All values are checked before anything
+ * is written. Settings that are not part of the snapshot are reset to their
+ * defaults. The snapshot is first stored as a whole, so a restore that is
+ * interrupted by a reset is completed during the next initialization.
+ *
+ * Completion is signalled with SETTINGS_EVT_RESTORE_COMPLETE or
+ * SETTINGS_EVT_RESTORE_FAILED.
+ *
+ * @param[in] data         The snapshot.
+ * @param[in] data_len     Length of the snapshot.
+ * @param[out] invalid_id  Set to the setting with an invalid value, if any.
+ * @retval NRF_ERROR_INVALID_DATA   If the snapshot is malformed.
+ * @retval NRF_ERROR_INVALID_PARAM  If a setting ID or value is invalid.
+ * @retval NRF_ERROR_BUSY           If settings are being written to flash.
+ * @retval err_code        Otherwise, the result from the FDS operations.
+ */
+ret_code_t settings_import_snapshot(const uint8_t *data, size_t data_len, settings_id_t *invalid_id);
+
 #endif // SETTINGS_H
 
@@ -0,0 +1,185 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "settings_tlv.h"
+#include "utils.h"
+
+#define ENTRY_HEADER_LEN  2
+
+void settings_tlv_writer_init(settings_tlv_writer_t *writer, uint8_t *buf, size_t size)
+{
+	writer->buf = buf;
+	writer->size = size;
+	writer->len = SETTINGS_TLV_HEADER_LEN;
+	writer->count = 0;
+	writer->overflow = (size < SETTINGS_TLV_HEADER_LEN + SETTINGS_TLV_CRC_LEN);
+}
+
+
+bool settings_tlv_add(settings_tlv_writer_t *writer, uint8_t id, const uint8_t *data, uint8_t len)
+{
+	if(writer->overflow
+			|| writer->count == UINT8_MAX
+			|| writer->len + ENTRY_HEADER_LEN + len + SETTINGS_TLV_CRC_LEN > writer->size) {
+		writer->overflow = true;
+		return false;
+	}
+
+	writer->buf[writer->len++] = id;
+	writer->buf[writer->len++] = len;
+
+	memcpy(writer->buf + writer->len, data, len);
+	writer->len += len;
+
+	writer->count++;
+
+	return true;
+}
+
+
+size_t settings_tlv_finish(settings_tlv_writer_t *writer)
+{
+	if(writer->overflow) {
+		return 0;
+	}
+
+	size_t entries_len = writer->len - SETTINGS_TLV_HEADER_LEN;
+
+	writer->buf[0] = SETTINGS_TLV_VERSION;
+	writer->buf[1] = writer->count;
+	writer->buf[2] = entries_len & 0xFF;
+	writer->buf[3] = (entries_len >> 8) & 0xFF;
+
+	uint16_t crc = crc16_ccitt(writer->buf, writer->len);
+
+	writer->buf[writer->len++] = crc & 0xFF;
+	writer->buf[writer->len++] = (crc >> 8) & 0xFF;
+
+	return writer->len;
+}
+
+
+size_t settings_tlv_get_total_len(const uint8_t *buf, size_t len)
+{
+	if(len < SETTINGS_TLV_HEADER_LEN) {
+		return 0;
+	}
+
+	size_t entries_len = buf[2] | ((size_t)buf[3] << 8);
+
+	return SETTINGS_TLV_HEADER_LEN + entries_len + SETTINGS_TLV_CRC_LEN;
+}
+
+
+settings_tlv_result_t settings_tlv_reader_init(settings_tlv_reader_t *reader, const uint8_t *buf, size_t len)
+{
+	size_t total_len = settings_tlv_get_total_len(buf, len);
+
+	if(total_len == 0 || len < total_len) {
+		return SETTINGS_TLV_ERR_TRUNCATED;
+	}
+
+	if(buf[0] != SETTINGS_TLV_VERSION) {
+		return SETTINGS_TLV_ERR_VERSION;
+	}
+
+	if(len > total_len) {
+		return SETTINGS_TLV_ERR_FORMAT;
+	}
+
+	size_t crc_pos = total_len - SETTINGS_TLV_CRC_LEN;
+	uint16_t crc = buf[crc_pos] | ((uint16_t)buf[crc_pos + 1] << 8);
+
+	if(crc != crc16_ccitt(buf, crc_pos)) {
+		return SETTINGS_TLV_ERR_CRC;
+	}
+
+	// check that the entries exactly fill the announced length
+	uint8_t seen[256 / 8] = {0};
+	uint8_t count = 0;
+	size_t  pos = SETTINGS_TLV_HEADER_LEN;
+
+	while(pos < crc_pos) {
+		if(pos + ENTRY_HEADER_LEN > crc_pos || pos + ENTRY_HEADER_LEN + buf[pos + 1] > crc_pos) {
+			return SETTINGS_TLV_ERR_FORMAT;
+		}
+
+		uint8_t id = buf[pos];
+
+		if(seen[id / 8] & (1 << (id % 8))) {
+			return SETTINGS_TLV_ERR_DUPLICATE;
+		}
+
+		seen[id / 8] |= 1 << (id % 8);
+
+		pos += ENTRY_HEADER_LEN + buf[pos + 1];
+		count++;
+	}
+
+	if(count != buf[1]) {
+		return SETTINGS_TLV_ERR_FORMAT;
+	}
+
+	reader->entries = buf + SETTINGS_TLV_HEADER_LEN;
+	reader->pos = reader->entries;
+	reader->end = buf + crc_pos;
+
+	return SETTINGS_TLV_OK;
+}
+
+
+bool settings_tlv_next(settings_tlv_reader_t *reader, uint8_t *id, const uint8_t **data, uint8_t *len)
+{
+	if(reader->pos >= reader->end) {
+		return false;
+	}
+
+	*id = reader->pos[0];
+	*len = reader->pos[1];
+	*data = reader->pos + ENTRY_HEADER_LEN;
+
+	reader->pos += ENTRY_HEADER_LEN + *len;
+
+	return true;
+}
+
+
+bool settings_tlv_find(const settings_tlv_reader_t *reader, uint8_t id, const uint8_t **data, uint8_t *len)
+{
+	settings_tlv_reader_t it = *reader;
+	uint8_t entry_id;
+
+	it.pos = it.entries;
+
+	while(settings_tlv_next(&it, &entry_id, data, len)) {
+		if(entry_id == id) {
+			return true;
+		}
+	}
+
+	return false;
+}
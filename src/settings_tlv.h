@@ -0,0 +1,122 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SETTINGS_TLV_H
+#define SETTINGS_TLV_H
+
+/**@file
+ *
+ * @brief Encoding of settings snapshots as type-length-value records.
+ *
+ * @details
+ * A snapshot contains several settings in one buffer, so all settings can be
+ * read or restored in a single BLE transfer. The format is:
+ *
+ * | Bytes | Content                                       |
+ * |-------|-----------------------------------------------|
+ * | 1     | Format version (@ref SETTINGS_TLV_VERSION)    |
+ * | 1     | Number of entries                             |
+ * | 2     | Length of all entries (little endian)         |
+ * | n     | Entries: setting ID (1 byte), value length (1 byte), value |
+ * | 2     | CRC-16/CCITT of all previous bytes (little endian) |
+ *
+ * Each setting ID may only appear once.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SETTINGS_TLV_VERSION       1
+
+#define SETTINGS_TLV_HEADER_LEN    4
+#define SETTINGS_TLV_CRC_LEN       2
+
+// maximum length of a snapshot
+#define SETTINGS_TLV_MAX_LEN     256
+
+typedef enum {
+	SETTINGS_TLV_OK,
+	SETTINGS_TLV_ERR_TRUNCATED,   //!< The data is shorter than the header says.
+	SETTINGS_TLV_ERR_VERSION,     //!< Unsupported format version.
+	SETTINGS_TLV_ERR_CRC,         //!< Checksum mismatch.
+	SETTINGS_TLV_ERR_FORMAT,      //!< Entries do not match the header or extra data.
+	SETTINGS_TLV_ERR_DUPLICATE,   //!< A setting ID appears more than once.
+} settings_tlv_result_t;
+
+typedef struct {
+	uint8_t *buf;
+	size_t   size;
+	size_t   len;
+	uint8_t  count;
+	bool     overflow;
+} settings_tlv_writer_t;
+
+typedef struct {
+	const uint8_t *entries;   //!< First entry.
+	const uint8_t *pos;       //!< Next entry to return.
+	const uint8_t *end;       //!< End of the entries.
+} settings_tlv_reader_t;
+
+/**@brief Start a new snapshot in the given buffer.
+ */
+void settings_tlv_writer_init(settings_tlv_writer_t *writer, uint8_t *buf, size_t size);
+
+/**@brief Append a setting to the snapshot.
+ * @returns  False if the buffer is too small. The snapshot is then invalid.
+ */
+bool settings_tlv_add(settings_tlv_writer_t *writer, uint8_t id, const uint8_t *data, uint8_t len);
+
+/**@brief Complete the snapshot by filling in the header and the checksum.
+ * @returns  The length of the snapshot, 0 if it did not fit into the buffer.
+ */
+size_t settings_tlv_finish(settings_tlv_writer_t *writer);
+
+/**@brief Get the total length of a snapshot from its beginning.
+ * @details
+ * Used to find out when a snapshot received in several parts is complete.
+ *
+ * @returns  The length or 0 if less than @ref SETTINGS_TLV_HEADER_LEN bytes are given.
+ */
+size_t settings_tlv_get_total_len(const uint8_t *buf, size_t len);
+
+/**@brief Validate a snapshot and prepare reading its entries.
+ * @details
+ * All entries are checked before this function returns, so a snapshot is
+ * either read completely or not at all.
+ */
+settings_tlv_result_t settings_tlv_reader_init(settings_tlv_reader_t *reader, const uint8_t *buf, size_t len);
+
+/**@brief Get the next entry of a validated snapshot.
+ * @returns  False if all entries have been read.
+ */
+bool settings_tlv_next(settings_tlv_reader_t *reader, uint8_t *id, const uint8_t **data, uint8_t *len);
+
+/**@brief Find the entry for a setting in a validated snapshot.
+ * @returns  False if the snapshot does not contain the setting.
+ */
+bool settings_tlv_find(const settings_tlv_reader_t *reader, uint8_t id, const uint8_t **data, uint8_t *len);
+
+#endif // SETTINGS_TLV_H
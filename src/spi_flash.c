@@ -0,0 +1,321 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include <nrfx_spim.h>
+#include <nrf_delay.h>
+#include <sdk_macros.h>
+
+#define NRF_LOG_MODULE_NAME spi_flash
+#include <nrf_log.h>
+NRF_LOG_MODULE_REGISTER();
+
+#include "pinout.h"
+#include "periph_pwr.h"
+
+#include "spi_flash.h"
+
+#define CMD_WRITE_ENABLE       0x06
+#define CMD_READ_STATUS        0x05
+#define CMD_READ               0x03
+#define CMD_PAGE_PROGRAM       0x02
+#define CMD_SECTOR_ERASE       0x20
+#define CMD_DEEP_POWER_DOWN    0xB9
+#define CMD_RELEASE_DPD        0xAB
+
+#define STATUS_WIP             0x01
+
+#define ADDR_CMD_LEN           4
+
+// timings from the MX25R1635F datasheet
+#define RELEASE_DPD_DELAY_US   35
+#define POWER_UP_DELAY_US      800
+#define PROGRAM_TIMEOUT_US     10000
+#define ERASE_TIMEOUT_US       240000
+#define POLL_INTERVAL_US       100
+
+static nrfx_spim_t m_spim = NRFX_SPIM_INSTANCE(3);
+
+// command, address and data of one transfer
+static uint8_t m_tx_buf[ADDR_CMD_LEN + SPI_FLASH_PAGE_SIZE];
+static uint8_t m_rx_buf[ADDR_CMD_LEN + SPI_FLASH_PAGE_SIZE];
+
+// users that currently need the flash powered
+static uint8_t m_power_refs;
+
+// a sector erase was started with spi_flash_erase_sector_start()
+static bool m_erase_running;
+
+
+static ret_code_t transfer(size_t tx_len, size_t rx_len)
+{
+	nrfx_spim_xfer_desc_t xfer_desc = NRFX_SPIM_XFER_TRX(m_tx_buf, tx_len, m_rx_buf, rx_len);
+
+	// no event handler is registered, so the transfer is blocking
+	return nrfx_spim_xfer(&m_spim, &xfer_desc, 0);
+}
+
+
+static ret_code_t command(uint8_t cmd)
+{
+	m_tx_buf[0] = cmd;
+	return transfer(1, 0);
+}
+
+
+static void set_cmd_addr(uint8_t cmd, uint32_t addr)
+{
+	m_tx_buf[0] = cmd;
+	m_tx_buf[1] = (addr >> 16) & 0xFF;
+	m_tx_buf[2] = (addr >>  8) & 0xFF;
+	m_tx_buf[3] = (addr >>  0) & 0xFF;
+}
+
+
+static ret_code_t wait_ready(uint32_t timeout_us)
+{
+	for(uint32_t waited = 0; waited < timeout_us; waited += POLL_INTERVAL_US) {
+		m_tx_buf[0] = CMD_READ_STATUS;
+		VERIFY_SUCCESS(transfer(1, 2));
+
+		if((m_rx_buf[1] & STATUS_WIP) == 0) {
+			return NRF_SUCCESS;
+		}
+
+		nrf_delay_us(POLL_INTERVAL_US);
+	}
+
+	NRF_LOG_ERROR("timeout after %d us", timeout_us);
+	return NRF_ERROR_TIMEOUT;
+}
+
+
+/**@brief Wait for the end of a sector erase that is still running.
+ * @details
+ * The flash ignores all commands but status reads during an erase, so every
+ * operation has to call this first.
+ */
+static ret_code_t finish_erase(void)
+{
+	if(!m_erase_running) {
+		return NRF_SUCCESS;
+	}
+
+	m_erase_running = false;
+	return wait_ready(ERASE_TIMEOUT_US);
+}
+
+
+void spi_flash_config_gpios(bool power_supplied)
+{
+	nrf_gpio_cfg_default(PIN_FLASH_MISO);
+	nrf_gpio_cfg_default(PIN_FLASH_MOSI);
+	nrf_gpio_cfg_default(PIN_FLASH_SCK);
+
+	if(power_supplied) {
+		// keep the flash deselected and IO2/IO3 inactive, as they have no
+		// function in SPI mode.
+		nrf_gpio_pin_set(PIN_FLASH_CS);
+		nrf_gpio_cfg_output(PIN_FLASH_CS);
+		nrf_gpio_pin_set(PIN_FLASH_WP);
+		nrf_gpio_cfg_output(PIN_FLASH_WP);
+		nrf_gpio_pin_set(PIN_FLASH_HOLD);
+		nrf_gpio_cfg_output(PIN_FLASH_HOLD);
+	} else {
+		// no current through the protection diodes while the rail is off
+		nrf_gpio_cfg_default(PIN_FLASH_CS);
+		nrf_gpio_cfg_default(PIN_FLASH_WP);
+		nrf_gpio_cfg_default(PIN_FLASH_HOLD);
+	}
+}
+
+
+ret_code_t spi_flash_init(void)
+{
+	m_power_refs = 0;
+	m_erase_running = false;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t spi_flash_power_up(void)
+{
+	if(m_power_refs > 0) {
+		m_power_refs++;
+		return NRF_SUCCESS;
+	}
+
+	bool rail_was_on = periph_pwr_is_activity_power_already_available(PERIPH_PWR_FLAG_FLASH);
+
+	VERIFY_SUCCESS(periph_pwr_start_activity(PERIPH_PWR_FLAG_FLASH));
+
+	nrfx_spim_config_t spi_config = NRFX_SPIM_DEFAULT_CONFIG;
+	spi_config.frequency      = NRF_SPIM_FREQ_8M;
+	spi_config.ss_pin         = PIN_FLASH_CS;
+	spi_config.miso_pin       = PIN_FLASH_MISO;
+	spi_config.mosi_pin       = PIN_FLASH_MOSI;
+	spi_config.sck_pin        = PIN_FLASH_SCK;
+
+	ret_code_t err_code = nrfx_spim_init(&m_spim, &spi_config, NULL, NULL);
+
+	if(err_code != NRF_SUCCESS) {
+		periph_pwr_stop_activity(PERIPH_PWR_FLAG_FLASH);
+		return err_code;
+	}
+
+	m_power_refs = 1;
+
+	if(!rail_was_on) {
+		// the flash starts in standby mode after power-on
+		nrf_delay_us(POWER_UP_DELAY_US);
+		return NRF_SUCCESS;
+	}
+
+	err_code = command(CMD_RELEASE_DPD);
+
+	if(err_code != NRF_SUCCESS) {
+		spi_flash_power_down();
+		return err_code;
+	}
+
+	nrf_delay_us(RELEASE_DPD_DELAY_US);
+
+	return NRF_SUCCESS;
+}
+
+
+void spi_flash_power_down(void)
+{
+	if(m_power_refs == 0 || --m_power_refs > 0) {
+		return;
+	}
+
+	// the deep power-down command would be ignored during an erase
+	finish_erase();
+
+	// the rail may stay on for other peripherals
+	command(CMD_DEEP_POWER_DOWN);
+
+	nrfx_spim_uninit(&m_spim);
+
+	spi_flash_config_gpios(true); // safe powered state
+
+	periph_pwr_stop_activity(PERIPH_PWR_FLAG_FLASH);
+}
+
+
+ret_code_t spi_flash_read(uint32_t addr, uint8_t *data, size_t len)
+{
+	if(m_power_refs == 0) {
+		return NRF_ERROR_INVALID_STATE;
+	}
+
+	VERIFY_SUCCESS(finish_erase());
+
+	while(len > 0) {
+		size_t chunk = (len > SPI_FLASH_PAGE_SIZE) ? SPI_FLASH_PAGE_SIZE : len;
+
+		set_cmd_addr(CMD_READ, addr);
+		VERIFY_SUCCESS(transfer(ADDR_CMD_LEN, ADDR_CMD_LEN + chunk));
+
+		memcpy(data, &m_rx_buf[ADDR_CMD_LEN], chunk);
+
+		addr += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t spi_flash_program(uint32_t addr, const uint8_t *data, size_t len)
+{
+	if(m_power_refs == 0) {
+		return NRF_ERROR_INVALID_STATE;
+	}
+
+	if(len == 0 || (addr % SPI_FLASH_PAGE_SIZE) + len > SPI_FLASH_PAGE_SIZE) {
+		return NRF_ERROR_INVALID_PARAM;
+	}
+
+	VERIFY_SUCCESS(finish_erase());
+	VERIFY_SUCCESS(command(CMD_WRITE_ENABLE));
+
+	set_cmd_addr(CMD_PAGE_PROGRAM, addr);
+	memcpy(&m_tx_buf[ADDR_CMD_LEN], data, len);
+
+	VERIFY_SUCCESS(transfer(ADDR_CMD_LEN + len, 0));
+
+	return wait_ready(PROGRAM_TIMEOUT_US);
+}
+
+
+ret_code_t spi_flash_erase_sector(uint32_t addr)
+{
+	VERIFY_SUCCESS(spi_flash_erase_sector_start(addr));
+
+	return finish_erase();
+}
+
+
+ret_code_t spi_flash_erase_sector_start(uint32_t addr)
+{
+	if(m_power_refs == 0) {
+		return NRF_ERROR_INVALID_STATE;
+	}
+
+	VERIFY_SUCCESS(finish_erase());
+	VERIFY_SUCCESS(command(CMD_WRITE_ENABLE));
+
+	set_cmd_addr(CMD_SECTOR_ERASE, addr);
+	VERIFY_SUCCESS(transfer(ADDR_CMD_LEN, 0));
+
+	m_erase_running = true;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t spi_flash_erase_poll(void)
+{
+	if(m_power_refs == 0) {
+		return NRF_ERROR_INVALID_STATE;
+	}
+
+	if(!m_erase_running) {
+		return NRF_SUCCESS;
+	}
+
+	m_tx_buf[0] = CMD_READ_STATUS;
+	VERIFY_SUCCESS(transfer(1, 2));
+
+	if(m_rx_buf[1] & STATUS_WIP) {
+		return NRF_ERROR_BUSY;
+	}
+
+	m_erase_running = false;
+	return NRF_SUCCESS;
+}
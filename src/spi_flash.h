@@ -0,0 +1,121 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SPI_FLASH_H
+#define SPI_FLASH_H
+
+/**@file
+ *
+ * @brief Driver for the external SPI NOR flash (Macronix MX25R1635F, 2 MiB).
+ *
+ * @details
+ * The flash is supplied from the switched peripheral power rail. Between
+ * operations it is kept in deep power-down mode and the SPI peripheral is
+ * released. All operations are blocking: a page program takes a few
+ * milliseconds and a sector erase up to 240 ms. To avoid the long wait, an
+ * erase can also be started with @ref spi_flash_erase_sector_start() and
+ * polled with @ref spi_flash_erase_poll(). Any other operation waits for a
+ * running erase to finish first.
+ *
+ * Like in any NOR flash, programming can only clear bits. A page must be in
+ * an erased sector before it is programmed.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sdk_errors.h>
+
+#define SPI_FLASH_SIZE         (2UL * 1024 * 1024)
+#define SPI_FLASH_SECTOR_SIZE  4096
+#define SPI_FLASH_PAGE_SIZE    256
+
+/**@brief Configure the GPIOs for the current state of the power rail.
+ * @details
+ * Called by the peripheral power management when the rail is switched.
+ *
+ * @param power_supplied   Set to true if the flash is powered, false if power is switched off.
+ */
+void spi_flash_config_gpios(bool power_supplied);
+
+/**@brief Initialize the driver.
+ * @details
+ * Does not access the flash.
+ */
+ret_code_t spi_flash_init(void);
+
+/**@brief Power the flash and wake it from deep power-down.
+ * @details
+ * Must be called before any other operation. Each call must be followed by
+ * @ref spi_flash_power_down(). Calls may be nested by different users; the
+ * flash stays powered until the last one has called
+ * @ref spi_flash_power_down().
+ */
+ret_code_t spi_flash_power_up(void);
+
+/**@brief Put the flash into deep power-down and release the power rail.
+ */
+void spi_flash_power_down(void);
+
+/**@brief Read data.
+ *
+ * @param[in]  addr    Start address.
+ * @param[out] data    Buffer for the data.
+ * @param[in]  len     Number of bytes to read.
+ */
+ret_code_t spi_flash_read(uint32_t addr, uint8_t *data, size_t len);
+
+/**@brief Program data into one page.
+ *
+ * @param[in] addr    Start address. The data must not cross a page boundary.
+ * @param[in] data    The data.
+ * @param[in] len     Number of bytes, at most @ref SPI_FLASH_PAGE_SIZE.
+ */
+ret_code_t spi_flash_program(uint32_t addr, const uint8_t *data, size_t len);
+
+/**@brief Erase one sector.
+ *
+ * @param[in] addr    An address in the sector.
+ */
+ret_code_t spi_flash_erase_sector(uint32_t addr);
+
+/**@brief Start erasing one sector without waiting for the end.
+ * @details
+ * The flash must stay powered until @ref spi_flash_erase_poll() reports the
+ * end of the erase.
+ *
+ * @param[in] addr    An address in the sector.
+ */
+ret_code_t spi_flash_erase_sector_start(uint32_t addr);
+
+/**@brief Check whether the erase started by @ref spi_flash_erase_sector_start() has finished.
+ *
+ * @retval NRF_ERROR_BUSY   The erase is still running.
+ * @retval NRF_SUCCESS      The erase has finished or none was started.
+ */
+ret_code_t spi_flash_erase_poll(void);
+
+#endif // SPI_FLASH_H
@@ -0,0 +1,396 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <math.h>
+
+#include "station_db.h"
+#include "utils.h"
+
+// every raw frame in the arena is preceded by this header
+#define ARENA_HEADER_LEN  2 // bytes: owner index, frame length
+
+static station_db_entry_t m_entries[STATION_DB_SIZE];
+static uint8_t            m_num_entries;
+
+static uint8_t m_hash_buckets[STATION_DB_HASH_BUCKETS];
+
+// doubly-linked list of all entries, ordered by reception time
+static uint8_t m_lru_head; // most recently heard
+static uint8_t m_lru_tail; // least recently heard
+
+static uint8_t  m_arena[STATION_DB_ARENA_SIZE];
+static uint16_t m_arena_head; // next write position
+static uint16_t m_arena_tail; // start of the oldest record
+static uint16_t m_arena_used; // bytes in use
+
+
+/**@brief FNV-1a hash of a call sign.
+ */
+static uint32_t calc_hash(const char *call)
+{
+	return fnv1a_update(FNV1A_INIT, (const uint8_t*)call, strnlen(call, STATION_DB_CALL_LEN-1));
+}
+
+
+static uint8_t hash_to_bucket(uint32_t hash)
+{
+	return hash & (STATION_DB_HASH_BUCKETS - 1);
+}
+
+
+static void hash_remove(uint8_t index)
+{
+	uint8_t *link = &m_hash_buckets[hash_to_bucket(m_entries[index].hash)];
+
+	while(*link != STATION_DB_INVALID) {
+		if(*link == index) {
+			*link = m_entries[index].hash_next;
+			return;
+		}
+
+		link = &m_entries[*link].hash_next;
+	}
+}
+
+
+static void hash_add(uint8_t index)
+{
+	uint8_t bucket = hash_to_bucket(m_entries[index].hash);
+
+	m_entries[index].hash_next = m_hash_buckets[bucket];
+	m_hash_buckets[bucket] = index;
+}
+
+
+static void lru_unlink(uint8_t index)
+{
+	station_db_entry_t *entry = &m_entries[index];
+
+	if(entry->lru_prev != STATION_DB_INVALID) {
+		m_entries[entry->lru_prev].lru_next = entry->lru_next;
+	} else {
+		m_lru_head = entry->lru_next;
+	}
+
+	if(entry->lru_next != STATION_DB_INVALID) {
+		m_entries[entry->lru_next].lru_prev = entry->lru_prev;
+	} else {
+		m_lru_tail = entry->lru_prev;
+	}
+}
+
+
+static void lru_push_front(uint8_t index)
+{
+	station_db_entry_t *entry = &m_entries[index];
+
+	entry->lru_prev = STATION_DB_INVALID;
+	entry->lru_next = m_lru_head;
+
+	if(m_lru_head != STATION_DB_INVALID) {
+		m_entries[m_lru_head].lru_prev = index;
+	} else {
+		m_lru_tail = index;
+	}
+
+	m_lru_head = index;
+}
+
+
+static void arena_read(uint16_t offset, uint8_t *data, size_t len)
+{
+	size_t first = STATION_DB_ARENA_SIZE - offset;
+
+	if(first > len) {
+		first = len;
+	}
+
+	memcpy(data, m_arena + offset, first);
+	memcpy(data + first, m_arena, len - first);
+}
+
+
+static void arena_write(uint16_t offset, const uint8_t *data, size_t len)
+{
+	size_t first = STATION_DB_ARENA_SIZE - offset;
+
+	if(first > len) {
+		first = len;
+	}
+
+	memcpy(m_arena + offset, data, first);
+	memcpy(m_arena, data + first, len - first);
+}
+
+
+/**@brief Drop the oldest record from the arena.
+ */
+static void arena_drop_oldest(void)
+{
+	uint8_t header[ARENA_HEADER_LEN];
+
+	arena_read(m_arena_tail, header, sizeof(header));
+
+	uint8_t owner = header[0];
+	uint8_t len = header[1];
+
+	// the record is only referenced if it is the owner’s latest frame
+	if(m_entries[owner].raw_valid && m_entries[owner].raw_offset == m_arena_tail) {
+		m_entries[owner].raw_valid = false;
+	}
+
+	m_arena_tail = (m_arena_tail + ARENA_HEADER_LEN + len) % STATION_DB_ARENA_SIZE;
+	m_arena_used -= ARENA_HEADER_LEN + len;
+}
+
+
+static void arena_store(uint8_t index, const uint8_t *data, uint8_t len)
+{
+	station_db_entry_t *entry = &m_entries[index];
+
+	while(STATION_DB_ARENA_SIZE - m_arena_used < ARENA_HEADER_LEN + len) {
+		arena_drop_oldest();
+	}
+
+	uint8_t header[ARENA_HEADER_LEN] = {index, len};
+
+	arena_write(m_arena_head, header, sizeof(header));
+	arena_write((m_arena_head + ARENA_HEADER_LEN) % STATION_DB_ARENA_SIZE, data, len);
+
+	entry->raw_offset = m_arena_head;
+	entry->raw_len = len;
+	entry->raw_valid = true;
+
+	m_arena_head = (m_arena_head + ARENA_HEADER_LEN + len) % STATION_DB_ARENA_SIZE;
+	m_arena_used += ARENA_HEADER_LEN + len;
+}
+
+
+/**@brief Allocate an entry for a new station.
+ */
+static uint8_t allocate_entry(uint8_t protected_index)
+{
+	uint8_t index;
+
+	if(m_num_entries < STATION_DB_SIZE) {
+		index = m_num_entries++;
+	} else {
+		// replace the least recently heard station, but never the protected one
+		index = m_lru_tail;
+
+		if(index == protected_index) {
+			index = m_entries[index].lru_prev;
+		}
+
+		hash_remove(index);
+		lru_unlink(index);
+	}
+
+	memset(&m_entries[index], 0, sizeof(station_db_entry_t));
+
+	return index;
+}
+
+
+static int16_t pack_int16(float value, float scale)
+{
+	float scaled = value * scale;
+
+	if(scaled > INT16_MAX) {
+		return INT16_MAX;
+	} else if(scaled < INT16_MIN) {
+		return INT16_MIN;
+	}
+
+	return (int16_t)lroundf(scaled);
+}
+
+
+void station_db_init(void)
+{
+	m_num_entries = 0;
+
+	memset(m_hash_buckets, STATION_DB_INVALID, sizeof(m_hash_buckets));
+
+	m_lru_head = STATION_DB_INVALID;
+	m_lru_tail = STATION_DB_INVALID;
+
+	m_arena_head = 0;
+	m_arena_tail = 0;
+	m_arena_used = 0;
+}
+
+
+uint8_t station_db_find(const char *call)
+{
+	uint32_t hash = calc_hash(call);
+	uint8_t index = m_hash_buckets[hash_to_bucket(hash)];
+
+	while(index != STATION_DB_INVALID) {
+		const station_db_entry_t *entry = &m_entries[index];
+
+		if(entry->hash == hash
+				&& strncmp(entry->call, call, STATION_DB_CALL_LEN-1) == 0) {
+			return index;
+		}
+
+		index = entry->hash_next;
+	}
+
+	return STATION_DB_INVALID;
+}
+
+
+uint8_t station_db_insert(
+		const aprs_frame_t *frame,
+		const aprs_rx_raw_data_t *raw,
+		uint64_t rx_timestamp,
+		bool rx_time_valid,
+		uint8_t protected_index)
+{
+	uint8_t index = station_db_find(frame->source);
+
+	if(index == STATION_DB_INVALID) {
+		index = allocate_entry(protected_index);
+
+		station_db_entry_t *entry = &m_entries[index];
+
+		// longer call signs are truncated. The hash is calculated from the
+		// truncated call as well, so the entry is found again.
+		size_t call_len = strnlen(frame->source, STATION_DB_CALL_LEN-1);
+		memcpy(entry->call, frame->source, call_len);
+		entry->call[call_len] = '\0';
+		entry->hash = calc_hash(frame->source);
+
+		hash_add(index);
+	} else {
+		lru_unlink(index);
+	}
+
+	lru_push_front(index);
+
+	station_db_entry_t *entry = &m_entries[index];
+
+	// position and symbol are only updated if the frame contains a position.
+	// Otherwise, the information from previous frames is kept.
+	bool is_positionless = (frame->lat == 0.0f) && (frame->lon == 0.0f);
+
+	if(!is_positionless) {
+		entry->lat = lroundf(frame->lat * 1e7f);
+		entry->lon = lroundf(frame->lon * 1e7f);
+		entry->alt = pack_int16(frame->alt, 1.0f);
+		entry->table = frame->table;
+		entry->symbol = frame->symbol;
+		entry->has_position = true;
+	}
+
+	entry->rssi = pack_int16(raw->rssi, 10.0f);
+	entry->snr = pack_int16(raw->snr, 100.0f);
+	entry->signal_rssi = pack_int16(raw->signalRssi, 10.0f);
+
+	entry->rx_timestamp = rx_timestamp;
+	entry->rx_time_valid = rx_time_valid;
+
+	arena_store(index, raw->data, raw->data_len);
+
+	return index;
+}
+
+
+void station_db_count_duplicate(const char *call)
+{
+	uint8_t index = station_db_find(call);
+
+	if(index != STATION_DB_INVALID && m_entries[index].dupe_count < UINT16_MAX) {
+		m_entries[index].dupe_count++;
+	}
+}
+
+
+const station_db_entry_t* station_db_get(uint8_t index)
+{
+	if(index >= m_num_entries) {
+		return NULL;
+	}
+
+	return &m_entries[index];
+}
+
+
+uint8_t station_db_first(void)
+{
+	return m_lru_head;
+}
+
+
+uint8_t station_db_next(uint8_t index)
+{
+	if(index >= m_num_entries) {
+		return STATION_DB_INVALID;
+	}
+
+	return m_entries[index].lru_next;
+}
+
+
+uint8_t station_db_count(void)
+{
+	return m_num_entries;
+}
+
+
+bool station_db_get_raw(uint8_t index, uint8_t *data, uint8_t *data_len)
+{
+	if(index >= m_num_entries || !m_entries[index].raw_valid) {
+		return false;
+	}
+
+	const station_db_entry_t *entry = &m_entries[index];
+
+	arena_read((entry->raw_offset + ARENA_HEADER_LEN) % STATION_DB_ARENA_SIZE, data, entry->raw_len);
+	*data_len = entry->raw_len;
+
+	return true;
+}
+
+
+void station_db_get_position(const station_db_entry_t *entry, float *lat, float *lon, float *alt)
+{
+	*lat = entry->lat * 1e-7f;
+	*lon = entry->lon * 1e-7f;
+	*alt = entry->alt;
+}
+
+
+void station_db_fix_timestamp(uint64_t unix_time)
+{
+	for(uint8_t i = 0; i < m_num_entries; i++) {
+		if(!m_entries[i].rx_time_valid) {
+			m_entries[i].rx_time_valid = true;
+			m_entries[i].rx_timestamp = unix_time - m_entries[i].rx_timestamp;
+		}
+	}
+}
@@ -0,0 +1,180 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef STATION_DB_H
+#define STATION_DB_H
+
+/**@file
+ *
+ * @brief Database of received stations.
+ *
+ * @details
+ * For each station (identified by its source call sign), the latest decoded
+ * position, the symbol, the signal quality and the reception time are kept in
+ * a compact entry. Stations are looked up through a hash table, so inserting a
+ * frame takes constant time on average.
+ *
+ * The raw frames are stored separately in a ring arena. The oldest frames are
+ * dropped when the arena is full, so the raw frame of a station that was not
+ * heard for a long time may no longer be available.
+ *
+ * When the database is full, the least recently heard station is replaced.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "aprs.h"
+
+// maximum number of stations in the database. Must be less than 255.
+#define STATION_DB_SIZE          128
+
+// number of buckets in the hash table. Must be a power of 2.
+#define STATION_DB_HASH_BUCKETS   64
+
+// size of the raw frame storage in bytes
+#define STATION_DB_ARENA_SIZE   8192
+
+// maximum call sign length including SSID and the terminating null byte
+#define STATION_DB_CALL_LEN       10
+
+// marker for invalid station indices (used at the end of iterations)
+#define STATION_DB_INVALID      0xFF
+
+typedef struct {
+	char     call[STATION_DB_CALL_LEN];
+
+	char     table;
+	char     symbol;
+
+	int32_t  lat;            // in 1e-7 degrees
+	int32_t  lon;            // in 1e-7 degrees
+	int16_t  alt;            // in meters
+
+	int16_t  rssi;           // in 0.1 dBm
+	int16_t  snr;            // in 0.01 dB
+	int16_t  signal_rssi;    // in 0.1 dBm
+
+	uint32_t rx_timestamp;
+	bool     rx_time_valid;
+	bool     has_position;
+
+	uint16_t dupe_count;     // number of duplicates (digipeated copies) received
+
+	// internal management data
+	uint32_t hash;
+	uint16_t raw_offset;
+	uint8_t  raw_len;
+	bool     raw_valid;
+
+	uint8_t  hash_next;
+	uint8_t  lru_prev;
+	uint8_t  lru_next;
+} station_db_entry_t;
+
+/**@brief Remove all stations from the database.
+ */
+void station_db_init(void);
+
+/**@brief Insert the given frame into the database.
+ * @details
+ * If the source call sign is already known, its entry is updated. Position
+ * and symbol are kept if the new frame is positionless. Otherwise, a new entry
+ * is allocated, replacing the least recently heard station if necessary.
+ *
+ * @param frame            The decoded frame.
+ * @param raw              The raw frame data including signal quality information.
+ * @param rx_timestamp     The reception time.
+ * @param rx_time_valid    Whether the reception time is a valid Unix timestamp.
+ * @param protected_index  An entry that must not be replaced (usually the one
+ *                         currently shown on the display). Set to
+ *                         STATION_DB_INVALID to disable the protection.
+ * @returns                The index of the updated entry.
+ */
+uint8_t station_db_insert(
+		const aprs_frame_t *frame,
+		const aprs_rx_raw_data_t *raw,
+		uint64_t rx_timestamp,
+		bool rx_time_valid,
+		uint8_t protected_index);
+
+/**@brief Count a duplicate packet (usually a digipeated copy) for a station.
+ * @details
+ * Nothing happens if the station is not in the database.
+ *
+ * @param call   The station’s call sign.
+ */
+void station_db_count_duplicate(const char *call);
+
+/**@brief Find a station by its call sign.
+ *
+ * @returns  The index of the station's entry or STATION_DB_INVALID if not found.
+ */
+uint8_t station_db_find(const char *call);
+
+/**@brief Get the entry at the given index.
+ *
+ * @returns  A pointer to the entry or NULL if the index is not in use.
+ */
+const station_db_entry_t* station_db_get(uint8_t index);
+
+/**@brief Get the index of the most recently heard station.
+ *
+ * @returns  The index or STATION_DB_INVALID if the database is empty.
+ */
+uint8_t station_db_first(void);
+
+/**@brief Get the index of the station heard before the given one.
+ *
+ * @returns  The index or STATION_DB_INVALID if the given station is the oldest.
+ */
+uint8_t station_db_next(uint8_t index);
+
+/**@brief Get the number of stations in the database.
+ */
+uint8_t station_db_count(void);
+
+/**@brief Copy the latest raw frame of a station.
+ *
+ * @param index          The station's index.
+ * @param[out] data      Buffer for the raw frame. Must hold at least 255 bytes.
+ * @param[out] data_len  Length of the raw frame.
+ * @returns              True if the raw frame was copied, false if it was
+ *                       already dropped from the arena.
+ */
+bool station_db_get_raw(uint8_t index, uint8_t *data, uint8_t *data_len);
+
+/**@brief Convert the packed position of an entry to degrees and meters.
+ */
+void station_db_get_position(const station_db_entry_t *entry, float *lat, float *lon, float *alt);
+
+/**@brief Updates the reception time of entries received before the time was valid.
+ *
+ * @param unix_time The current Unix epoch timestamp.
+ */
+void station_db_fix_timestamp(uint64_t unix_time);
+
+#endif // STATION_DB_H
@@ -0,0 +1,164 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include <fds.h>
+#include <sdk_macros.h>
+
+#define NRF_LOG_MODULE_NAME storage
+#include <nrf_log.h>
+NRF_LOG_MODULE_REGISTER();
+
+#include "storage.h"
+#include "event_queue.h"
+
+static bool m_gc_pending;
+static bool m_gc_running;
+
+static storage_stats_t m_stats;
+
+
+bool storage_gc_is_due(uint32_t words_free, uint32_t words_freeable)
+{
+	return words_free < STORAGE_GC_MIN_FREE_WORDS
+		&& words_freeable >= STORAGE_GC_MIN_FREEABLE_WORDS;
+}
+
+
+void storage_check(void)
+{
+	fds_stat_t stat;
+
+	if(fds_stat(&stat) != NRF_SUCCESS) {
+		return;
+	}
+
+	// words_used includes the page tags
+	uint32_t used = stat.words_used + stat.words_reserved;
+
+	m_stats.words_free = (used < STORAGE_CAPACITY_WORDS) ? (STORAGE_CAPACITY_WORDS - used) : 0;
+	m_stats.words_freeable = stat.freeable_words;
+
+	if(stat.corruption) {
+		NRF_LOG_WARNING("storage: corruption detected");
+	}
+
+	if(!m_gc_running && storage_gc_is_due(m_stats.words_free, m_stats.words_freeable)) {
+		if(!m_gc_pending) {
+			NRF_LOG_INFO("storage: GC due, %d words free, %d freeable",
+					m_stats.words_free, m_stats.words_freeable);
+		}
+
+		m_gc_pending = true;
+		event_queue_post(EVENT_STORAGE_GC);
+	}
+}
+
+
+static void cb_fds(fds_evt_t const * p_evt)
+{
+	switch(p_evt->id) {
+		case FDS_EVT_INIT:
+			storage_check();
+			break;
+
+		case FDS_EVT_WRITE:
+		case FDS_EVT_UPDATE:
+			if(p_evt->result == NRF_SUCCESS) {
+				m_stats.writes++;
+			} else if(p_evt->result == FDS_ERR_NO_SPACE_IN_FLASH) {
+				m_stats.write_failures++;
+			}
+
+			storage_check();
+			break;
+
+		case FDS_EVT_DEL_RECORD:
+		case FDS_EVT_DEL_FILE:
+			if(p_evt->result == NRF_SUCCESS) {
+				m_stats.deletes++;
+			}
+
+			storage_check();
+			break;
+
+		case FDS_EVT_GC:
+			// also counts GCs started by the peer manager
+			m_gc_running = false;
+
+			if(p_evt->result == NRF_SUCCESS) {
+				m_stats.gc_runs++;
+				m_stats.words_freed += m_stats.words_freeable;
+			} else {
+				NRF_LOG_ERROR("storage: GC failed: 0x%08x", p_evt->result);
+			}
+
+			storage_check();
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+ret_code_t storage_init(void)
+{
+	m_gc_pending = false;
+	m_gc_running = false;
+
+	memset(&m_stats, 0, sizeof(m_stats));
+
+	return fds_register(cb_fds);
+}
+
+
+bool storage_gc_pending(void)
+{
+	return m_gc_pending;
+}
+
+
+ret_code_t storage_run_gc(void)
+{
+	if(!m_gc_pending || m_gc_running) {
+		return NRF_SUCCESS;
+	}
+
+	ret_code_t err_code = fds_gc();
+	VERIFY_SUCCESS(err_code);
+
+	m_gc_pending = false;
+	m_gc_running = true;
+
+	return NRF_SUCCESS;
+}
+
+
+void storage_get_stats(storage_stats_t *stats)
+{
+	*stats = m_stats;
+}
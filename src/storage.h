@@ -0,0 +1,113 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+/**@file
+ *
+ * @brief Monitoring and garbage collection of the flash data storage.
+ *
+ * @details
+ * FDS never overwrites records: every update writes a new copy and only marks
+ * the old one as dirty. The space of dirty records is reclaimed by a garbage
+ * collection (GC), which copies the valid records of each page to the swap
+ * page and erases the old page.
+ *
+ * This module checks the fill level with fds_stat() after every change and
+ * requests a GC before the storage runs full, instead of waiting for a write
+ * to fail. The GC itself erases flash pages, which halts the CPU for tens of
+ * milliseconds per page. It is therefore only started by the application
+ * when the radio and the display are idle (EVENT_STORAGE_GC).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sdk_errors.h>
+#include <sdk_config.h>
+
+// size of the data pages in words. One virtual page is reserved for the GC.
+#define STORAGE_CAPACITY_WORDS  ((FDS_VIRTUAL_PAGES - 1) * FDS_VIRTUAL_PAGE_SIZE)
+
+// a GC is due if less than this number of words is free. This leaves room
+// for a full settings snapshot and several bond updates.
+#define STORAGE_GC_MIN_FREE_WORDS  512
+
+// a GC is only worth the page erases if it frees at least this many words
+#define STORAGE_GC_MIN_FREEABLE_WORDS  64
+
+typedef struct {
+	uint32_t writes;           //!< Completed record writes and updates.
+	uint32_t deletes;          //!< Completed record deletions.
+	uint32_t write_failures;   //!< Writes that failed because the storage was full.
+	uint32_t gc_runs;          //!< Completed GCs. Each erases every page with dirty records once.
+	uint32_t words_freed;      //!< Words reclaimed by GC.
+	uint16_t words_free;       //!< Free words at the last check.
+	uint16_t words_freeable;   //!< Words in dirty records at the last check.
+} storage_stats_t;
+
+/**@brief Initialize the storage monitor.
+ * @details
+ * Must be called before fds_init(), i.e. before settings_init().
+ *
+ * @returns   The result of the FDS callback registration.
+ */
+ret_code_t storage_init(void);
+
+/**@brief Decide whether a GC is due.
+ *
+ * @param[in] words_free      Words that can still be written.
+ * @param[in] words_freeable  Words occupied by dirty records.
+ * @returns   True if a GC should be run.
+ */
+bool storage_gc_is_due(uint32_t words_free, uint32_t words_freeable);
+
+/**@brief Check the fill level of the storage.
+ * @details
+ * Posts EVENT_STORAGE_GC if a GC is due. Called automatically after every
+ * completed FDS operation.
+ */
+void storage_check(void);
+
+/**@brief Whether a GC is due but has not been started yet.
+ */
+bool storage_gc_pending(void);
+
+/**@brief Start a GC if one is due.
+ * @details
+ * Must only be called when a blocking flash erase does not disturb the radio
+ * or the display.
+ *
+ * @returns   The result of fds_gc(), or NRF_SUCCESS if no GC is due.
+ */
+ret_code_t storage_run_gc(void);
+
+/**@brief Get the storage statistics.
+ *
+ * @param[out] stats    Pointer to the structure to fill.
+ */
+void storage_get_stats(storage_stats_t *stats);
+
+#endif // STORAGE_H
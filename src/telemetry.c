@@ -0,0 +1,277 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "aprs.h"
+
+#include "telemetry.h"
+
+typedef enum {
+	STAT_MIN,
+	STAT_AVG,
+	STAT_MAX
+} stat_t;
+
+/**@brief Definition of one analog telemetry value.
+ * @details
+ * The transmitted raw value x (0 to 255) is converted to the real value by
+ * receivers using the equation a*x² + b*x + c. Only linear equations (a = 0)
+ * are used here.
+ */
+typedef struct {
+	telemetry_channel_t channel;
+	stat_t      stat;
+	const char *name;   // length limit per value: 7, 7, 6, 6, 5
+	const char *unit;
+	float       b;
+	float       c;
+	const char *eqns;   // "b,c" as sent in the EQNS message
+} analog_def_t;
+
+static const analog_def_t ANALOG_DEFS[APRS_TELEMETRY_NUM_ANALOG] = {
+	{TELEMETRY_CH_VBAT,        STAT_AVG, "Vbat",  "V",    0.01f,   2.5f, "0.01,2.5"},
+	{TELEMETRY_CH_VBAT,        STAT_MIN, "Vmin",  "V",    0.01f,   2.5f, "0.01,2.5"},
+	{TELEMETRY_CH_TEMPERATURE, STAT_AVG, "Temp",  "degC", 0.5f,  -40.0f, "0.5,-40"},
+	{TELEMETRY_CH_HUMIDITY,    STAT_AVG, "Hum",   "%",    0.5f,    0.0f, "0.5,0"},
+	{TELEMETRY_CH_PRESSURE,    STAT_AVG, "Press", "hPa",  2.0f,  550.0f, "2,550"},
+};
+
+// digital value B1: weather sensor data available in this interval
+#define DIGITAL_SENSOR_OK  (1 << 0)
+
+typedef enum {
+	DEF_NONE,     // no definitions pending
+	DEF_PARM,
+	DEF_UNIT,
+	DEF_EQNS,
+	DEF_DONE      // definitions sent, data frame follows
+} def_state_t;
+
+typedef struct {
+	float    min;
+	float    max;
+	float    sum;
+	uint32_t count;
+} aggregate_t;
+
+static aggregate_t m_aggregates[TELEMETRY_NUM_CHANNELS];
+
+static uint16_t    m_seq;
+static uint32_t    m_data_count;
+static uint64_t    m_last_data_time;
+static def_state_t m_def_state;
+
+
+static void reset_aggregation(void)
+{
+	memset(m_aggregates, 0, sizeof(m_aggregates));
+}
+
+
+void telemetry_init(void)
+{
+	reset_aggregation();
+
+	m_seq = 0;
+	m_data_count = 0;
+	m_last_data_time = 0;
+	m_def_state = DEF_NONE;
+}
+
+
+void telemetry_add_sample(telemetry_channel_t channel, float value)
+{
+	aggregate_t *agg = &m_aggregates[channel];
+
+	if(agg->count == 0 || value < agg->min) {
+		agg->min = value;
+	}
+
+	if(agg->count == 0 || value > agg->max) {
+		agg->max = value;
+	}
+
+	agg->sum += value;
+	agg->count++;
+}
+
+
+void telemetry_get_stats(telemetry_channel_t channel, telemetry_stats_t *stats)
+{
+	const aggregate_t *agg = &m_aggregates[channel];
+
+	stats->count = agg->count;
+	stats->min = agg->min;
+	stats->max = agg->max;
+	stats->avg = (agg->count > 0) ? agg->sum / agg->count : 0.0f;
+}
+
+
+uint64_t telemetry_get_next_due_time(void)
+{
+	if(m_def_state != DEF_NONE) {
+		// continue with the next definition or the data frame
+		return 0;
+	}
+
+	return m_last_data_time + TELEMETRY_INTERVAL_MS;
+}
+
+
+/**@brief Convert a value to the raw 8-bit representation given by its equation.
+ */
+static uint8_t quantize(const analog_def_t *def, float value)
+{
+	float raw = roundf((value - def->c) / def->b);
+
+	if(raw < 0.0f) {
+		return 0;
+	} else if(raw > 255.0f) {
+		return 255;
+	} else {
+		return (uint8_t)raw;
+	}
+}
+
+
+/**@brief Build one of the definition messages to the own call sign.
+ */
+static size_t build_definition(uint8_t *frame, def_state_t def)
+{
+	char text[APRS_MAX_MESSAGE_TEXT_LEN + 1];
+	char call[16];
+	size_t len = 0;
+
+	switch(def) {
+		case DEF_PARM:
+			len = snprintf(text, sizeof(text), "PARM.");
+			for(uint8_t i = 0; i < APRS_TELEMETRY_NUM_ANALOG; i++) {
+				len += snprintf(text + len, sizeof(text) - len, "%s,", ANALOG_DEFS[i].name);
+			}
+			snprintf(text + len, sizeof(text) - len, "Sensor");
+			break;
+
+		case DEF_UNIT:
+			len = snprintf(text, sizeof(text), "UNIT.");
+			for(uint8_t i = 0; i < APRS_TELEMETRY_NUM_ANALOG; i++) {
+				len += snprintf(text + len, sizeof(text) - len, "%s,", ANALOG_DEFS[i].unit);
+			}
+			snprintf(text + len, sizeof(text) - len, "ok");
+			break;
+
+		case DEF_EQNS:
+			len = snprintf(text, sizeof(text), "EQNS.");
+			for(uint8_t i = 0; i < APRS_TELEMETRY_NUM_ANALOG; i++) {
+				len += snprintf(text + len, sizeof(text) - len, "%s0,%s",
+						(i == 0) ? "" : ",", ANALOG_DEFS[i].eqns);
+			}
+			break;
+
+		default:
+			return 0;
+	}
+
+	aprs_get_source(call, sizeof(call));
+
+	return aprs_build_message_frame(frame, call, text, NULL);
+}
+
+
+/**@brief Build the data frame from the aggregated values.
+ */
+static size_t build_data(uint8_t *frame)
+{
+	uint8_t analog[APRS_TELEMETRY_NUM_ANALOG];
+	uint8_t digital = 0;
+	bool    have_data = false;
+
+	for(uint8_t i = 0; i < APRS_TELEMETRY_NUM_ANALOG; i++) {
+		const analog_def_t *def = &ANALOG_DEFS[i];
+		telemetry_stats_t stats;
+
+		telemetry_get_stats(def->channel, &stats);
+
+		if(stats.count == 0) {
+			analog[i] = 0;
+			continue;
+		}
+
+		have_data = true;
+
+		switch(def->stat) {
+			case STAT_MIN: analog[i] = quantize(def, stats.min); break;
+			case STAT_MAX: analog[i] = quantize(def, stats.max); break;
+			default:       analog[i] = quantize(def, stats.avg); break;
+		}
+	}
+
+	if(!have_data) {
+		return 0;
+	}
+
+	if(m_aggregates[TELEMETRY_CH_TEMPERATURE].count > 0) {
+		digital |= DIGITAL_SENSOR_OK;
+	}
+
+	return aprs_build_telemetry_frame(frame, m_seq, analog, digital);
+}
+
+
+size_t telemetry_build_next_frame(uint8_t *frame, uint64_t now)
+{
+	size_t len;
+
+	if(m_def_state == DEF_NONE && (m_data_count % TELEMETRY_DEFINITION_INTERVAL) == 0) {
+		m_def_state = DEF_PARM;
+	}
+
+	switch(m_def_state) {
+		case DEF_PARM:
+		case DEF_UNIT:
+		case DEF_EQNS:
+			len = build_definition(frame, m_def_state);
+			m_def_state++;
+			return len;
+
+		default:
+			break;
+	}
+
+	len = build_data(frame);
+
+	if(len > 0) {
+		m_seq = (m_seq + 1) % 1000;
+		m_data_count++;
+	}
+
+	m_def_state = DEF_NONE;
+	m_last_data_time = now;
+	reset_aggregation();
+
+	return len;
+}
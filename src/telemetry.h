@@ -0,0 +1,103 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+/**@file
+ *
+ * @brief APRS telemetry for the battery voltage and the BME280 sensor data.
+ *
+ * @details
+ * Sensor readings are added whenever they are measured and aggregated to
+ * minimum, average and maximum per channel. At every telemetry interval, one
+ * compact `T#` frame carrying the aggregated values of all channels is sent
+ * and the aggregation restarts.
+ *
+ * Receivers need the channel names, units and scaling equations to display
+ * the raw values. They are sent as PARM, UNIT and EQNS messages to the own
+ * call sign before the first data frame and then only every
+ * @ref TELEMETRY_DEFINITION_INTERVAL data frames.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// interval between two telemetry data frames
+#define TELEMETRY_INTERVAL_MS         600000 // milliseconds
+
+// definitions are repeated after this many data frames
+#define TELEMETRY_DEFINITION_INTERVAL     12
+
+typedef enum {
+	TELEMETRY_CH_VBAT,         //!< Battery voltage in V.
+	TELEMETRY_CH_TEMPERATURE,  //!< Temperature in °C.
+	TELEMETRY_CH_HUMIDITY,     //!< Relative humidity in %.
+	TELEMETRY_CH_PRESSURE,     //!< Air pressure in hPa.
+
+	TELEMETRY_NUM_CHANNELS
+} telemetry_channel_t;
+
+typedef struct {
+	float    min;
+	float    max;
+	float    avg;
+	uint32_t count;   //!< Number of samples. If 0, the other values are invalid.
+} telemetry_stats_t;
+
+/**@brief Reset the aggregation, the sequence number and the definition state.
+ */
+void telemetry_init(void);
+
+/**@brief Add a sample to the aggregation of a channel.
+ */
+void telemetry_add_sample(telemetry_channel_t channel, float value);
+
+/**@brief Get the aggregated values of a channel since the last data frame.
+ */
+void telemetry_get_stats(telemetry_channel_t channel, telemetry_stats_t *stats);
+
+/**@brief Get the time when the next telemetry frame is due.
+ * @details
+ * While definitions are sent, the next frame is due immediately.
+ *
+ * @returns  The time in milliseconds (same time base as @ref time_base_get()).
+ */
+uint64_t telemetry_get_next_due_time(void);
+
+/**@brief Build the next telemetry frame.
+ * @details
+ * This is either one of the definition frames or a data frame. After a data
+ * frame, the aggregation restarts. If there is no data at all, the data frame
+ * is skipped and 0 is returned.
+ *
+ * @param frame   Buffer for the frame (at least @ref APRS_MAX_FRAME_LEN bytes).
+ * @param now     The current time in milliseconds.
+ * @returns       The length of the frame or 0 if nothing was generated.
+ */
+size_t telemetry_build_next_frame(uint8_t *frame, uint64_t now);
+
+#endif // TELEMETRY_H
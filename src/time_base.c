@@ -22,7 +22,9 @@
  * SOFTWARE.
  */
 
-#include <app_timer.h>
+#include <nrf.h>
+#include <nrf_rtc.h>
+#include <app_util_platform.h>
 #include <sdk_macros.h>
 
 #define NRF_LOG_MODULE_NAME time_base
@@ -31,61 +33,81 @@ NRF_LOG_MODULE_REGISTER();
 
 #include "time_base.h"
 
-#define TRACKING_TIMER_INTERVAL_MS 180000
+// RTC0 is used by the SoftDevice and RTC1 by the app_timer library.
+#define TIME_BASE_RTC               NRF_RTC2
+#define TIME_BASE_RTC_IRQn          RTC2_IRQn
+#define TIME_BASE_RTC_IRQHandler    RTC2_IRQHandler
 
-#define APP_TIMER_TICKS_PER_SEC (APP_TIMER_CLOCK_FREQ / (APP_TIMER_CONFIG_RTC_FREQUENCY + 1))
+// 32768 Hz / (31 + 1) = 1024 Hz. The 24 bit counter overflows every 4.55 hours.
+#define RTC_PRESCALER               31
+#define RTC_COUNTER_BITS            24
 
-static uint64_t m_cur_time;
-static uint32_t m_cnt_last;
-static uint32_t m_lost_subticks_accumulator;
+// The overflow counter must be up to date in all other interrupt handlers
+// that read the time.
+#define RTC_IRQ_PRIORITY            APP_IRQ_PRIORITY_HIGH
 
-APP_TIMER_DEF(m_tracking_timer);
+static volatile uint32_t m_overflows;
+static uint64_t          m_epoch_ticks;
 
 
-static void update_time(void)
+void TIME_BASE_RTC_IRQHandler(void)
 {
-	uint32_t cnt_now  = app_timer_cnt_get();
-	uint32_t delta    = app_timer_cnt_diff_compute(cnt_now, m_cnt_last);
-
-	uint32_t delta_subticks = delta * 1000;
-
-	uint32_t delta_ms = delta_subticks / APP_TIMER_TICKS_PER_SEC;
-	uint32_t delta_ms_with_lost = (delta_subticks + m_lost_subticks_accumulator) / APP_TIMER_TICKS_PER_SEC;
-
-	if(delta_ms != delta_ms_with_lost)
-	{ // at least one millisecond has been taken over from the lost subticks accumulator
-		m_lost_subticks_accumulator = (delta_subticks + m_lost_subticks_accumulator) % APP_TIMER_TICKS_PER_SEC;
-	}
-	else
-	{
-		// remainder of the division = time not represented in delta_ms
-		uint32_t lost_subticks = delta_subticks % APP_TIMER_TICKS_PER_SEC;
-
-		// accumulate remainder across updates
-		m_lost_subticks_accumulator += lost_subticks;
+	if(nrf_rtc_event_pending(TIME_BASE_RTC, NRF_RTC_EVENT_OVERFLOW)) {
+		nrf_rtc_event_clear(TIME_BASE_RTC, NRF_RTC_EVENT_OVERFLOW);
+		m_overflows++;
 	}
-
-	m_cnt_last = cnt_now;
-
-	m_cur_time += delta_ms_with_lost;
-
-	//NRF_LOG_INFO("delta: %8d => ms: %7d; accu: %8d", delta, delta_ms_with_lost, m_lost_subticks_accumulator);
 }
 
 
-static void cb_tracking_timer(void *context)
+/**@brief Extend the RTC counter to 64 bits.
+ * @details
+ * If this is called while the overflow interrupt is blocked (for example in a
+ * critical region or a higher-priority interrupt), a pending overflow event is
+ * taken into account directly.
+ */
+static uint64_t get_ticks(void)
 {
-	update_time();
+	uint32_t overflows;
+	uint32_t counter;
+	bool     pending;
+
+	do {
+		overflows = m_overflows;
+		counter = nrf_rtc_counter_get(TIME_BASE_RTC);
+		pending = nrf_rtc_event_pending(TIME_BASE_RTC, NRF_RTC_EVENT_OVERFLOW);
+
+		if(pending) {
+			// the overflow may have happened after the counter was read, so
+			// read it again to get a value from after the overflow.
+			counter = nrf_rtc_counter_get(TIME_BASE_RTC);
+		}
+
+		// retry if the overflow interrupt was handled in between
+	} while(overflows != m_overflows);
+
+	if(pending) {
+		overflows++;
+	}
+
+	return ((uint64_t)overflows << RTC_COUNTER_BITS) | counter;
 }
 
 
 ret_code_t time_base_init(void)
 {
-	m_cur_time = 0;
-	m_cnt_last = app_timer_cnt_get();
+	m_overflows = 0;
+
+	nrf_rtc_prescaler_set(TIME_BASE_RTC, RTC_PRESCALER);
+	nrf_rtc_event_clear(TIME_BASE_RTC, NRF_RTC_EVENT_OVERFLOW);
+	nrf_rtc_int_enable(TIME_BASE_RTC, NRF_RTC_INT_OVERFLOW_MASK);
 
-	VERIFY_SUCCESS(app_timer_create(&m_tracking_timer, APP_TIMER_MODE_REPEATED, cb_tracking_timer));
-	VERIFY_SUCCESS(app_timer_start(m_tracking_timer, APP_TIMER_TICKS(TRACKING_TIMER_INTERVAL_MS), NULL));
+	NVIC_SetPriority(TIME_BASE_RTC_IRQn, RTC_IRQ_PRIORITY);
+	NVIC_ClearPendingIRQ(TIME_BASE_RTC_IRQn);
+	NVIC_EnableIRQ(TIME_BASE_RTC_IRQn);
+
+	nrf_rtc_task_trigger(TIME_BASE_RTC, NRF_RTC_TASK_START);
+
+	m_epoch_ticks = get_ticks();
 
 	return NRF_SUCCESS;
 }
@@ -93,6 +115,8 @@ ret_code_t time_base_init(void)
 
 uint64_t time_base_get(void)
 {
-	update_time();
-	return m_cur_time;
+	uint64_t ticks = get_ticks() - m_epoch_ticks;
+
+	// exact conversion: 1000 / 1024 = 125 / 128
+	return (ticks * 125) >> 7;
 }
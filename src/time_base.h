@@ -33,9 +33,10 @@
  * This module tracks the system uptime in milliseconds. It can be used as a
  * monotonic time source.
  *
- * Internally, this is based on the app_timer framework which in turn uses an
- * RTC to track the time. The accuracy therefore depends on the RTC's clock
- * source.
+ * Internally, this uses a dedicated RTC instance (RTC2) that runs at 1024 Hz.
+ * Its 24 bit counter is extended to 64 bits by counting the overflows, so the
+ * only periodic wakeup is the overflow interrupt every 4.55 hours. The
+ * accuracy depends on the RTC's clock source.
  */
 
 #include <stdint.h>
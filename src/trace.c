@@ -0,0 +1,204 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include <app_util_platform.h>
+
+#include "trace.h"
+#include "utils.h"
+
+#define RING_MASK  (TRACE_RING_SIZE - 1)
+
+// worst case: header, dropped event ID and a 5 byte varint
+#define DROPPED_EVENT_MAX_LEN  (TRACE_HEADER_LEN + 5)
+
+static uint8_t  m_ring[TRACE_RING_SIZE];
+static uint32_t m_head;   // written by trace_write() in any priority
+static uint32_t m_tail;   // written by trace_flush() in the main loop
+
+static uint32_t m_dropped_unreported;
+
+static trace_output_t m_output;
+
+static trace_stats_t m_stats;
+
+
+static void encode_header(uint8_t *buf, uint16_t id, size_t payload_len)
+{
+	buf[0] = id & 0xFF;
+	buf[1] = id >> 8;
+	buf[2] = (uint8_t)payload_len;
+}
+
+
+/**@brief Copy data into the ring. Must be called in a critical region. */
+static void ring_put(const uint8_t *data, size_t len)
+{
+	uint32_t pos = m_head & RING_MASK;
+	size_t first = TRACE_RING_SIZE - pos;
+
+	if(first > len) {
+		first = len;
+	}
+
+	memcpy(&m_ring[pos], data, first);
+	memcpy(&m_ring[0], data + first, len - first);
+
+	m_head += len;
+}
+
+
+/**@brief Put an event into the ring. Must be called in a critical region. */
+static void put_event(const uint8_t *header, const uint8_t *payload, size_t payload_len)
+{
+	size_t len = TRACE_HEADER_LEN + payload_len;
+	size_t used = m_head - m_tail;
+	size_t needed = len;
+
+	if(m_dropped_unreported > 0) {
+		needed += DROPPED_EVENT_MAX_LEN;
+	}
+
+	if(used + needed > TRACE_RING_SIZE) {
+		m_dropped_unreported++;
+		m_stats.dropped++;
+		return;
+	}
+
+	if(m_dropped_unreported > 0) {
+		uint8_t dropped[DROPPED_EVENT_MAX_LEN];
+		size_t dropped_len = put_varint(&dropped[TRACE_HEADER_LEN], m_dropped_unreported);
+
+		encode_header(dropped, TRACE_ID_DROPPED, dropped_len);
+		ring_put(dropped, TRACE_HEADER_LEN + dropped_len);
+
+		m_stats.bytes += TRACE_HEADER_LEN + dropped_len;
+		m_dropped_unreported = 0;
+	}
+
+	ring_put(header, TRACE_HEADER_LEN);
+	ring_put(payload, payload_len);
+
+	m_stats.events++;
+	m_stats.bytes += len;
+
+	used = m_head - m_tail;
+
+	if(used > m_stats.max_fill) {
+		m_stats.max_fill = used;
+	}
+}
+
+
+void trace_init(trace_output_t output)
+{
+	m_head = 0;
+	m_tail = 0;
+	m_dropped_unreported = 0;
+	m_output = output;
+
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+void trace_write(uint16_t id, const uint32_t *args, size_t nargs)
+{
+	uint8_t header[TRACE_HEADER_LEN];
+	uint8_t payload[TRACE_MAX_ARGS * 5];
+	size_t  payload_len = 0;
+
+	if(nargs > TRACE_MAX_ARGS) {
+		nargs = TRACE_MAX_ARGS;
+	}
+
+	for(size_t i = 0; i < nargs; i++) {
+		payload_len += put_varint(&payload[payload_len], args[i]);
+	}
+
+	encode_header(header, id, payload_len);
+
+	CRITICAL_REGION_ENTER();
+	put_event(header, payload, payload_len);
+	CRITICAL_REGION_EXIT();
+}
+
+
+void trace_write_hex(uint16_t id, const uint8_t *data, size_t len)
+{
+	uint8_t header[TRACE_HEADER_LEN];
+
+	if(len > TRACE_MAX_PAYLOAD) {
+		len = TRACE_MAX_PAYLOAD;
+	}
+
+	encode_header(header, id, len);
+
+	CRITICAL_REGION_ENTER();
+	put_event(header, data, len);
+	CRITICAL_REGION_EXIT();
+}
+
+
+bool trace_flush(void)
+{
+	uint32_t head;
+
+	if(!m_output) {
+		return false;
+	}
+
+	CRITICAL_REGION_ENTER();
+	head = m_head;
+	CRITICAL_REGION_EXIT();
+
+	if(head == m_tail) {
+		return false;
+	}
+
+	// only the contiguous part; the rest follows on the next call
+	uint32_t pos = m_tail & RING_MASK;
+	size_t len = head - m_tail;
+
+	if(len > TRACE_RING_SIZE - pos) {
+		len = TRACE_RING_SIZE - pos;
+	}
+
+	size_t sent = m_output(&m_ring[pos], len);
+
+	CRITICAL_REGION_ENTER();
+	m_tail += sent;
+	CRITICAL_REGION_EXIT();
+
+	return sent > 0 && m_tail != head;
+}
+
+
+void trace_get_stats(trace_stats_t *stats)
+{
+	CRITICAL_REGION_ENTER();
+	*stats = m_stats;
+	CRITICAL_REGION_EXIT();
+}
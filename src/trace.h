@@ -0,0 +1,170 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/**@file
+ *
+ * @brief Compact binary trace of frequent log events.
+ *
+ * @details
+ * NRF_LOG formats every message in the main loop, which keeps the CPU awake
+ * and sends many bytes over RTT. A trace event instead consists of a 16 bit
+ * event ID and its integer arguments, packed into a RAM ring:
+ *
+ *     ID (2 bytes, LE) | payload length (1 byte) | payload
+ *
+ * The arguments are encoded as unsigned LEB128 varints, so small values take
+ * one byte. A hexdump event carries the raw data as payload.
+ *
+ * The event ID is the offset of the format string in the `trace_fmt` linker
+ * section. The firmware never reads the strings; tools/trace_decode.py
+ * extracts them from the ELF file and formats the events on the host.
+ * Dropped events are reported by an event with the ID @ref TRACE_ID_DROPPED
+ * and the number of dropped events as argument.
+ *
+ * Only integer conversions (%d, %i, %u, %x, %X, %o, %c) can be used in trace
+ * format strings. If TRACE_ENABLED is 0, the macros fall back to NRF_LOG.
+ *
+ * @ref trace_write() and @ref trace_write_hex() may be called from any
+ * interrupt priority. @ref trace_flush() must only be called from the main
+ * loop.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <nrf_log.h>
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED  1
+#endif
+
+// size of the RAM ring in bytes. Must be a power of 2.
+#define TRACE_RING_SIZE      1024
+
+// maximum number of arguments of one event
+#define TRACE_MAX_ARGS       8
+
+// maximum payload of one event; longer hexdumps are truncated
+#define TRACE_MAX_PAYLOAD    255
+
+#define TRACE_HEADER_LEN     3
+
+#define TRACE_ID_DROPPED     0xFFFF
+
+typedef struct {
+	uint32_t events;     //!< Events written to the ring.
+	uint32_t bytes;      //!< Bytes written to the ring.
+	uint32_t dropped;    //!< Events dropped because the ring was full.
+	uint16_t max_fill;   //!< Maximum number of bytes in the ring.
+} trace_stats_t;
+
+/**@brief Output function for the trace stream.
+ *
+ * @param[in] data    Pointer to the data.
+ * @param[in] len     Number of bytes.
+ * @returns   Number of bytes that were accepted.
+ */
+typedef size_t (*trace_output_t)(const uint8_t *data, size_t len);
+
+#if TRACE_ENABLED
+
+// provided by the linker at the start of the format strings
+extern const char __start_trace_fmt[];
+
+/**@brief Place a format string in the trace_fmt section and get its event ID. */
+#define TRACE_FMT_ID(fmt) \
+	({ \
+		static const char _trace_fmt[] __attribute__((section("trace_fmt"), used)) = fmt; \
+		(uint16_t)(_trace_fmt - __start_trace_fmt); \
+	})
+
+/**@brief Trace an event with up to @ref TRACE_MAX_ARGS integer arguments. */
+#define TRACE_INFO(fmt, ...) \
+	do { \
+		const uint32_t _trace_args[] = {0, ##__VA_ARGS__}; \
+		trace_write(TRACE_FMT_ID(fmt), &_trace_args[1], \
+				sizeof(_trace_args) / sizeof(_trace_args[0]) - 1); \
+	} while(0)
+
+/**@brief Trace a text followed by a hexdump of the given data. */
+#define TRACE_HEXDUMP(text, p_data, len) \
+	trace_write_hex(TRACE_FMT_ID(text " %H"), (p_data), (len))
+
+#else // TRACE_ENABLED
+
+#define TRACE_INFO(...)  NRF_LOG_INFO(__VA_ARGS__)
+
+#define TRACE_HEXDUMP(text, p_data, len) \
+	do { \
+		NRF_LOG_INFO(text); \
+		NRF_LOG_HEXDUMP_INFO((p_data), (len)); \
+	} while(0)
+
+#endif // TRACE_ENABLED
+
+/**@brief Initialize the trace ring.
+ *
+ * @param[in] output    Function that sends the trace stream to the host.
+ */
+void trace_init(trace_output_t output);
+
+/**@brief Add an event to the ring.
+ * @details
+ * Use @ref TRACE_INFO instead of calling this directly.
+ *
+ * @param[in] id      The event ID.
+ * @param[in] args    The arguments.
+ * @param[in] nargs   Number of arguments, at most @ref TRACE_MAX_ARGS.
+ */
+void trace_write(uint16_t id, const uint32_t *args, size_t nargs);
+
+/**@brief Add an event with a hexdump to the ring.
+ * @details
+ * Use @ref TRACE_HEXDUMP instead of calling this directly.
+ *
+ * @param[in] id      The event ID.
+ * @param[in] data    The data to dump.
+ * @param[in] len     Length of the data. Truncated to @ref TRACE_MAX_PAYLOAD.
+ */
+void trace_write_hex(uint16_t id, const uint8_t *data, size_t len);
+
+/**@brief Pass buffered events to the output function.
+ *
+ * @returns   True if the output accepted data and more is waiting in the
+ *            ring. False if the ring is empty or the output is full.
+ */
+bool trace_flush(void);
+
+/**@brief Get the trace statistics.
+ *
+ * @param[out] stats    Pointer to the structure to fill.
+ */
+void trace_get_stats(trace_stats_t *stats);
+
+#endif // TRACE_H
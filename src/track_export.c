@@ -0,0 +1,347 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include <sdk_macros.h>
+
+#define NRF_LOG_MODULE_NAME track_export
+#include <nrf_log.h>
+NRF_LOG_MODULE_REGISTER();
+
+#include "track_export.h"
+#include "utils.h"
+
+typedef enum {
+	STATE_HEADER,
+	STATE_FIXES,
+	STATE_FOOTER,
+	STATE_DONE,
+} export_state_t;
+
+static const char GPX_HEADER[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<gpx version=\"1.1\" creator=\"T-Echo LoRa-APRS\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n"
+	"<trk><name>T-Echo track</name>\n";
+
+static const char GPX_FOOTER[] =
+	"</trk>\n"
+	"</gpx>\n";
+
+static const char GPX_SEGMENT_START[] = "<trkseg>\n";
+static const char GPX_SEGMENT_END[]   = "</trkseg>\n";
+
+static const uint8_t COMPACT_HEADER[] = {'T', 'R', 'K', 1};
+
+
+static size_t put_str(uint8_t *p, const char *str)
+{
+	size_t len = strlen(str);
+
+	memcpy(p, str, len);
+	return len;
+}
+
+
+/**@brief Write an unsigned number with at least the given number of digits.
+ */
+static size_t put_uint(uint8_t *p, uint32_t v, uint8_t min_digits)
+{
+	uint8_t digits[10];
+	size_t n = 0;
+
+	do {
+		digits[n++] = '0' + (v % 10);
+		v /= 10;
+	} while(v > 0 || n < min_digits);
+
+	for(size_t i = 0; i < n; i++) {
+		p[i] = digits[n - 1 - i];
+	}
+
+	return n;
+}
+
+
+static size_t put_int(uint8_t *p, int32_t v)
+{
+	if(v < 0) {
+		p[0] = '-';
+		return 1 + put_uint(p + 1, -(uint32_t)v, 1);
+	}
+
+	return put_uint(p, v, 1);
+}
+
+
+/**@brief Write a coordinate in 1e-6 degrees as decimal degrees.
+ */
+static size_t put_coord(uint8_t *p, int32_t v)
+{
+	size_t len = 0;
+	uint32_t abs_v = v;
+
+	if(v < 0) {
+		p[len++] = '-';
+		abs_v = -(uint32_t)v;
+	}
+
+	len += put_uint(p + len, abs_v / 1000000, 1);
+	p[len++] = '.';
+	len += put_uint(p + len, abs_v % 1000000, 6);
+
+	return len;
+}
+
+
+/**@brief Write a Unix timestamp as ISO 8601 date and time in UTC.
+ * @details
+ * The date is calculated from the number of days without any tables, see
+ * http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+ */
+static size_t put_time(uint8_t *p, uint32_t unix_time)
+{
+	uint32_t days = unix_time / 86400;
+	uint32_t secs = unix_time % 86400;
+
+	// days since 0000-03-01; valid for all unsigned 32 bit timestamps
+	uint32_t z   = days + 719468;
+	uint32_t era = z / 146097;
+	uint32_t doe = z - era * 146097;
+	uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	uint32_t mp  = (5 * doy + 2) / 153;
+	uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+	uint32_t month = (mp < 10) ? mp + 3 : mp - 9;
+	uint32_t year = yoe + era * 400 + (month <= 2);
+
+	size_t len = put_uint(p, year, 4);
+	p[len++] = '-';
+	len += put_uint(p + len, month, 2);
+	p[len++] = '-';
+	len += put_uint(p + len, day, 2);
+	p[len++] = 'T';
+	len += put_uint(p + len, secs / 3600, 2);
+	p[len++] = ':';
+	len += put_uint(p + len, (secs / 60) % 60, 2);
+	p[len++] = ':';
+	len += put_uint(p + len, secs % 60, 2);
+	p[len++] = 'Z';
+
+	return len;
+}
+
+
+static size_t format_gpx_fix(track_export_t *exp, const track_log_fix_t *fix)
+{
+	uint8_t *p = exp->item;
+	size_t len = 0;
+
+	if(exp->fixes == 0) {
+		len += put_str(p + len, GPX_SEGMENT_START);
+	} else if(fix->time < exp->prev.time || fix->time - exp->prev.time > TRACK_EXPORT_SEGMENT_GAP_S) {
+		len += put_str(p + len, GPX_SEGMENT_END);
+		len += put_str(p + len, GPX_SEGMENT_START);
+	}
+
+	len += put_str(p + len, "<trkpt lat=\"");
+	len += put_coord(p + len, fix->lat);
+	len += put_str(p + len, "\" lon=\"");
+	len += put_coord(p + len, fix->lon);
+	len += put_str(p + len, "\"><ele>");
+	len += put_int(p + len, fix->alt);
+	len += put_str(p + len, "</ele><time>");
+	len += put_time(p + len, fix->time);
+	len += put_str(p + len, "</time></trkpt>\n");
+
+	return len;
+}
+
+
+static size_t format_compact_fix(track_export_t *exp, const track_log_fix_t *fix)
+{
+	uint8_t *p = exp->item;
+	size_t len = 0;
+
+	// 64 bits, so the end marker cannot occur for any difference
+	len += put_varint(p + len, (uint64_t)zigzag(fix->time - exp->prev.time) + 1);
+	len += put_varint(p + len, zigzag(fix->lat - exp->prev.lat));
+	len += put_varint(p + len, zigzag(fix->lon - exp->prev.lon));
+	len += put_varint(p + len, zigzag(fix->alt - exp->prev.alt));
+
+	return len;
+}
+
+
+static size_t format_compact_footer(track_export_t *exp)
+{
+	uint8_t *p = exp->item;
+
+	p[0] = 0x00;
+	p[1] = exp->fixes;
+	p[2] = exp->fixes >> 8;
+	p[3] = exp->fixes >> 16;
+	p[4] = exp->fixes >> 24;
+
+	return 5;
+}
+
+
+/**@brief Set the pending data to the next part of the stream.
+ */
+static void next_item(track_export_t *exp)
+{
+	bool gpx = (exp->format == TRACK_EXPORT_FORMAT_GPX);
+
+	switch(exp->state) {
+		case STATE_HEADER:
+			if(gpx) {
+				exp->pending = (const uint8_t *)GPX_HEADER;
+				exp->pending_len = sizeof(GPX_HEADER) - 1;
+			} else {
+				exp->pending = COMPACT_HEADER;
+				exp->pending_len = sizeof(COMPACT_HEADER);
+			}
+
+			exp->state = STATE_FIXES;
+			break;
+
+		case STATE_FIXES:
+			for(;;) {
+				track_log_fix_t fix;
+				ret_code_t err_code = track_log_read_next(&exp->reader, &fix);
+
+				if(err_code != NRF_SUCCESS) {
+					if(err_code != NRF_ERROR_NOT_FOUND) {
+						NRF_LOG_WARNING("reading the track log failed: 0x%08x", err_code);
+						exp->read_error = err_code;
+					}
+
+					exp->state = STATE_FOOTER;
+					break;
+				}
+
+				if(fix.time < exp->start_time || (exp->end_time != 0 && fix.time > exp->end_time)) {
+					continue;
+				}
+
+				if(gpx) {
+					exp->pending_len = format_gpx_fix(exp, &fix);
+				} else {
+					exp->pending_len = format_compact_fix(exp, &fix);
+				}
+
+				exp->pending = exp->item;
+				exp->prev = fix;
+				exp->fixes++;
+				return;
+			}
+
+			// fall through
+
+		case STATE_FOOTER:
+			if(gpx) {
+				size_t len = 0;
+
+				if(exp->fixes > 0) {
+					len += put_str(exp->item, GPX_SEGMENT_END);
+				}
+
+				exp->pending_len = len + put_str(exp->item + len, GPX_FOOTER);
+			} else {
+				exp->pending_len = format_compact_footer(exp);
+			}
+
+			exp->pending = exp->item;
+			exp->state = STATE_DONE;
+			break;
+
+		case STATE_DONE:
+			break;
+	}
+}
+
+
+ret_code_t track_export_start(track_export_t *exp, track_export_format_t format,
+		uint32_t start_time, uint32_t end_time)
+{
+	if(format >= TRACK_EXPORT_NUM_FORMATS) {
+		return NRF_ERROR_INVALID_PARAM;
+	}
+
+	VERIFY_SUCCESS(track_log_read_start(&exp->reader));
+
+	exp->format = format;
+	exp->start_time = start_time;
+	exp->end_time = end_time;
+	exp->state = STATE_HEADER;
+	exp->fixes = 0;
+	exp->bytes = 0;
+	exp->read_error = NRF_SUCCESS;
+	exp->pending = NULL;
+	exp->pending_len = 0;
+
+	memset(&exp->prev, 0, sizeof(exp->prev));
+
+	return NRF_SUCCESS;
+}
+
+
+size_t track_export_read(track_export_t *exp, uint8_t *buf, size_t max_len)
+{
+	size_t len = 0;
+
+	while(len < max_len) {
+		if(exp->pending_len == 0) {
+			if(exp->state == STATE_DONE) {
+				break;
+			}
+
+			next_item(exp);
+			continue;
+		}
+
+		size_t chunk = exp->pending_len;
+
+		if(chunk > max_len - len) {
+			chunk = max_len - len;
+		}
+
+		memcpy(buf + len, exp->pending, chunk);
+		exp->pending += chunk;
+		exp->pending_len -= chunk;
+		len += chunk;
+	}
+
+	exp->bytes += len;
+
+	return len;
+}
+
+
+void track_export_end(track_export_t *exp)
+{
+	track_log_read_end(&exp->reader);
+}
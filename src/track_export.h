@@ -0,0 +1,126 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TRACK_EXPORT_H
+#define TRACK_EXPORT_H
+
+/**@file
+ *
+ * @brief Export of the track log as a byte stream.
+ *
+ * @details
+ * The stream is generated piece by piece while the track log is read, so it
+ * can be sent in chunks of any size without building the whole file in RAM.
+ * Only a single fix is formatted at a time.
+ *
+ * Two formats are available:
+ *
+ * - GPX 1.1, ready to be opened by map applications. A new track segment is
+ *   started whenever two fixes are more than @ref TRACK_EXPORT_SEGMENT_GAP_S
+ *   apart, so every tracker session becomes a segment.
+ *
+ * - A compact binary format with about 7 bytes per fix, which is converted to
+ *   GPX on the receiving side. It starts with the magic "TRK" and the version
+ *   byte 1. Each fix is encoded as the differences to the previous fix (all
+ *   zero before the first one), as variable-length integers with 7 bits per
+ *   byte, least significant group first: time + 1, latitude, longitude and
+ *   altitude, all zigzag-encoded. The differences in time are stored with an
+ *   offset of 1 so that a single zero byte marks the end of the stream. It is
+ *   followed by the number of fixes (u32, little endian).
+ *
+ * Coordinates are exported with the resolution of the track log (1e-6
+ * degrees).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sdk_errors.h>
+
+#include "track_log.h"
+
+// fixes further apart start a new GPX track segment
+#define TRACK_EXPORT_SEGMENT_GAP_S  600
+
+// longest piece of the stream generated at once: a GPX track point
+#define TRACK_EXPORT_MAX_ITEM_LEN   160
+
+typedef enum {
+	TRACK_EXPORT_FORMAT_COMPACT = 0,   //!< Delta-encoded binary format.
+	TRACK_EXPORT_FORMAT_GPX     = 1,   //!< GPX 1.1 XML.
+
+	TRACK_EXPORT_NUM_FORMATS
+} track_export_format_t;
+
+/**@brief State of an export, see @ref track_export_start(). */
+typedef struct {
+	track_log_reader_t    reader;
+	track_export_format_t format;
+	uint32_t              start_time;      //!< First time to export.
+	uint32_t              end_time;        //!< Last time to export.
+	uint8_t               state;
+	track_log_fix_t       prev;            //!< The last exported fix.
+	uint32_t              fixes;           //!< Number of fixes exported so far.
+	uint32_t              bytes;           //!< Number of bytes generated so far.
+	ret_code_t            read_error;      //!< Error that ended the export early, NRF_SUCCESS if none.
+	uint8_t               item[TRACK_EXPORT_MAX_ITEM_LEN]; //!< The current fix, formatted.
+	const uint8_t        *pending;         //!< Data not yet returned by track_export_read().
+	size_t                pending_len;
+} track_export_t;
+
+/**@brief Start an export of the logged fixes.
+ * @details
+ * The flash is powered until @ref track_export_end() is called. Fixes that
+ * are still buffered in RAM are not included; call @ref track_log_flush()
+ * before if they are needed.
+ *
+ * @param[out] exp          The export state to initialize.
+ * @param[in]  format       The format of the stream.
+ * @param[in]  start_time   Fixes before this Unix timestamp are skipped.
+ * @param[in]  end_time     Fixes after this Unix timestamp are skipped; 0 means no limit.
+ * @retval NRF_ERROR_INVALID_PARAM   The format is unknown.
+ */
+ret_code_t track_export_start(track_export_t *exp, track_export_format_t format,
+		uint32_t start_time, uint32_t end_time);
+
+/**@brief Get the next part of the stream.
+ * @details
+ * If the track log cannot be read, the stream is terminated early, so it
+ * is still well-formed. The error is kept in exp->read_error.
+ *
+ * @param[inout] exp       The export state.
+ * @param[out]   buf       Buffer for the data.
+ * @param[in]    max_len   Size of the buffer.
+ * @returns The number of bytes written to buf. It is less than max_len only
+ *          at the end of the stream, and 0 after the end.
+ */
+size_t track_export_read(track_export_t *exp, uint8_t *buf, size_t max_len);
+
+/**@brief Finish the export and power down the flash.
+ */
+void track_export_end(track_export_t *exp);
+
+#endif // TRACK_EXPORT_H
@@ -0,0 +1,568 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include <sdk_macros.h>
+
+#define NRF_LOG_MODULE_NAME track_log
+#include <nrf_log.h>
+NRF_LOG_MODULE_REGISTER();
+
+#include "track_log.h"
+#include "utils.h"
+
+/* Page layout (little endian):
+ *
+ *  0  sequence number (u32)
+ *  4  time of the first fix (u32)
+ *  8  latitude of the first fix (i32)
+ * 12  longitude of the first fix (i32)
+ * 16  altitude of the first fix (i16)
+ * 18  number of fixes in the page (u8)
+ * 19  length of the delta data (u8)
+ * 20  delta data: for each further fix the time difference as unsigned
+ *     varint, then latitude, longitude and altitude differences as zigzag
+ *     varints
+ * 254 CRC-16/CCITT over bytes 0 to 253
+ */
+#define PAGE_OFS_SEQ    0
+#define PAGE_OFS_TIME   4
+#define PAGE_OFS_LAT    8
+#define PAGE_OFS_LON    12
+#define PAGE_OFS_ALT    16
+#define PAGE_OFS_COUNT  18
+#define PAGE_OFS_LEN    19
+#define PAGE_OFS_DATA   20
+#define PAGE_OFS_CRC    (SPI_FLASH_PAGE_SIZE - 2)
+
+#define PAGE_DATA_SIZE  (PAGE_OFS_CRC - PAGE_OFS_DATA)
+
+// maximum encoded size of one fix: 5 bytes per value
+#define FIX_MAX_LEN     20
+
+// pages tried if the verification fails
+#define WRITE_ATTEMPTS  3
+
+// polls of a sector erase before waiting for it; the erase takes up to 240 ms
+#define ERASE_MAX_POLLS (300 / TRACK_LOG_ERASE_POLL_MS)
+
+#define SEQ_TO_ADDR(seq)  (TRACK_LOG_FLASH_START + ((seq) % TRACK_LOG_NUM_PAGES) * SPI_FLASH_PAGE_SIZE)
+
+static uint8_t  m_page[SPI_FLASH_PAGE_SIZE];
+static uint8_t  m_verify[SPI_FLASH_PAGE_SIZE];
+static uint8_t  m_count;
+static uint8_t  m_data_len;
+
+// a full page waiting for track_log_write(), and the state of its write
+static uint8_t  m_queued_page[SPI_FLASH_PAGE_SIZE];
+static bool     m_queued;
+static bool     m_powered;
+static bool     m_erasing;
+static uint8_t  m_erase_polls;
+static uint8_t  m_attempts;
+
+static track_log_fix_t m_last;
+static bool            m_have_last;
+
+// sequence number of the next page to write
+static uint32_t m_next_seq;
+
+static track_log_stats_t m_stats;
+
+
+/**@brief Check whether a page read from the flash is valid.
+ *
+ * @param[in] page    The page content.
+ * @param[in] seq     Expected sequence number.
+ */
+static bool page_is_valid(const uint8_t *page, uint32_t seq)
+{
+	uint16_t crc = page[PAGE_OFS_CRC] | (page[PAGE_OFS_CRC + 1] << 8);
+
+	return get_u32(&page[PAGE_OFS_SEQ]) == seq
+		&& page[PAGE_OFS_COUNT] > 0
+		&& page[PAGE_OFS_LEN] <= PAGE_DATA_SIZE
+		&& crc == crc16_ccitt(page, PAGE_OFS_CRC);
+}
+
+
+static ret_code_t read_page(uint32_t page_idx, uint8_t *page)
+{
+	m_stats.init_reads++;
+	return spi_flash_read(TRACK_LOG_FLASH_START + page_idx * SPI_FLASH_PAGE_SIZE, page, SPI_FLASH_PAGE_SIZE);
+}
+
+
+/**@brief Get the round in which the page at the given position was written.
+ *
+ * @param[in]  page_idx   Position of the page in the log area.
+ * @param[out] round      The round, i.e. sequence number / number of pages.
+ * @retval NRF_ERROR_NOT_FOUND   The page is erased or damaged.
+ */
+static ret_code_t read_page_round(uint32_t page_idx, uint32_t *round)
+{
+	VERIFY_SUCCESS(read_page(page_idx, m_verify));
+
+	uint32_t seq = get_u32(&m_verify[PAGE_OFS_SEQ]);
+
+	if((seq % TRACK_LOG_NUM_PAGES) != page_idx || !page_is_valid(m_verify, seq)) {
+		return NRF_ERROR_NOT_FOUND;
+	}
+
+	*round = seq / TRACK_LOG_NUM_PAGES;
+	return NRF_SUCCESS;
+}
+
+
+/**@brief Get the round in which a sector was written.
+ * @details
+ * The second page is checked if the first one is damaged, for example by a
+ * power loss while it was programmed.
+ */
+static ret_code_t read_sector_round(uint32_t sector, uint32_t *round)
+{
+	uint32_t page_idx = sector * TRACK_LOG_PAGES_PER_SECTOR;
+
+	ret_code_t err_code = read_page_round(page_idx, round);
+
+	if(err_code == NRF_ERROR_NOT_FOUND) {
+		err_code = read_page_round(page_idx + 1, round);
+	}
+
+	return err_code;
+}
+
+
+static bool page_is_erased(const uint8_t *page)
+{
+	for(size_t i = 0; i < SPI_FLASH_PAGE_SIZE; i++) {
+		if(page[i] != 0xFF) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**@brief Find the sequence number of the next page to write.
+ * @details
+ * Within the current round, the sectors 0 to n have been written, the
+ * remaining sectors still hold the previous round or are empty. This is
+ * found with a binary search over the sectors. In the newest sector, the
+ * written pages are followed by erased ones, which is found with a second
+ * binary search.
+ */
+static ret_code_t find_head(uint32_t *next_seq)
+{
+	uint32_t round;
+	ret_code_t err_code = read_sector_round(0, &round);
+
+	if(err_code == NRF_ERROR_NOT_FOUND) {
+		// either the log is empty or sector 0 was erased for the next round
+		err_code = read_sector_round(TRACK_LOG_NUM_SECTORS - 1, &round);
+
+		if(err_code == NRF_ERROR_NOT_FOUND) {
+			*next_seq = 0;
+			return NRF_SUCCESS;
+		}
+
+		VERIFY_SUCCESS(err_code);
+
+		*next_seq = (round + 1) * TRACK_LOG_NUM_PAGES;
+		return NRF_SUCCESS;
+	}
+
+	VERIFY_SUCCESS(err_code);
+
+	// last sector written in this round: sector lo is, sector hi is not
+	uint32_t lo = 0;
+	uint32_t hi = TRACK_LOG_NUM_SECTORS;
+
+	while(hi - lo > 1) {
+		uint32_t mid = (lo + hi) / 2;
+		uint32_t mid_round;
+
+		err_code = read_sector_round(mid, &mid_round);
+
+		if(err_code == NRF_SUCCESS && mid_round == round) {
+			lo = mid;
+		} else if(err_code == NRF_SUCCESS || err_code == NRF_ERROR_NOT_FOUND) {
+			hi = mid;
+		} else {
+			return err_code;
+		}
+	}
+
+	// first erased page in sector lo; page 0 is known to be in use
+	uint32_t first_page = lo * TRACK_LOG_PAGES_PER_SECTOR;
+	uint32_t used = 1;
+	uint32_t end = TRACK_LOG_PAGES_PER_SECTOR;
+
+	while(end > used) {
+		uint32_t mid = (used + end) / 2;
+
+		VERIFY_SUCCESS(read_page(first_page + mid, m_verify));
+
+		if(page_is_erased(m_verify)) {
+			end = mid;
+		} else {
+			used = mid + 1;
+		}
+	}
+
+	*next_seq = round * TRACK_LOG_NUM_PAGES + first_page + used;
+	return NRF_SUCCESS;
+}
+
+
+static void start_page(const track_log_fix_t *fix)
+{
+	memset(m_page, 0xFF, sizeof(m_page));
+
+	put_u32(&m_page[PAGE_OFS_TIME], fix->time);
+	put_u32(&m_page[PAGE_OFS_LAT], fix->lat);
+	put_u32(&m_page[PAGE_OFS_LON], fix->lon);
+	m_page[PAGE_OFS_ALT]     = fix->alt;
+	m_page[PAGE_OFS_ALT + 1] = fix->alt >> 8;
+
+	m_count = 1;
+	m_data_len = 0;
+}
+
+
+/**@brief Program and verify the queued page.
+ * @details
+ * The sector must already be erased if this is its first page.
+ */
+static ret_code_t program_page(uint32_t seq)
+{
+	uint32_t addr = SEQ_TO_ADDR(seq);
+
+	put_u32(&m_queued_page[PAGE_OFS_SEQ], seq);
+
+	uint16_t crc = crc16_ccitt(m_queued_page, PAGE_OFS_CRC);
+	m_queued_page[PAGE_OFS_CRC]     = crc;
+	m_queued_page[PAGE_OFS_CRC + 1] = crc >> 8;
+
+	VERIFY_SUCCESS(spi_flash_program(addr, m_queued_page, SPI_FLASH_PAGE_SIZE));
+	VERIFY_SUCCESS(spi_flash_read(addr, m_verify, SPI_FLASH_PAGE_SIZE));
+
+	if(memcmp(m_queued_page, m_verify, SPI_FLASH_PAGE_SIZE) != 0) {
+		return NRF_ERROR_INTERNAL;
+	}
+
+	return NRF_SUCCESS;
+}
+
+
+/**@brief Move the page buffer to the write queue.
+ */
+static void queue_page(void)
+{
+	m_page[PAGE_OFS_COUNT] = m_count;
+	m_page[PAGE_OFS_LEN] = m_data_len;
+
+	memcpy(m_queued_page, m_page, sizeof(m_queued_page));
+
+	m_queued = true;
+	m_attempts = 0;
+	m_count = 0;
+}
+
+
+/**@brief Continue writing the queued page to the flash.
+ * @details
+ * If the page is the first one of a sector, the sector erase is started and
+ * NRF_ERROR_BUSY is returned until it has finished, unless wait is set. If
+ * the page cannot be verified, it is written to the next position. The flash
+ * stays powered until the page is done.
+ *
+ * @param[in] wait   Wait for a sector erase instead of returning.
+ */
+static ret_code_t write_queued(bool wait)
+{
+	if(!m_queued) {
+		return NRF_SUCCESS;
+	}
+
+	ret_code_t err_code;
+
+	if(!m_powered) {
+		err_code = spi_flash_power_up();
+
+		if(err_code != NRF_SUCCESS) {
+			NRF_LOG_ERROR("cannot power the flash: 0x%08x", err_code);
+			m_queued = false;
+			return err_code;
+		}
+
+		m_powered = true;
+	}
+
+	while(m_attempts < WRITE_ATTEMPTS) {
+		uint32_t addr = SEQ_TO_ADDR(m_next_seq);
+
+		err_code = NRF_SUCCESS;
+
+		if((addr % SPI_FLASH_SECTOR_SIZE) == 0) {
+			if(!m_erasing) {
+				err_code = spi_flash_erase_sector_start(addr);
+
+				if(err_code == NRF_SUCCESS) {
+					m_erasing = true;
+					m_erase_polls = 0;
+					m_stats.sector_erases++;
+				}
+			}
+
+			// after too many polls, spi_flash_program() waits with a timeout
+			if(m_erasing && !wait && m_erase_polls < ERASE_MAX_POLLS) {
+				err_code = spi_flash_erase_poll();
+
+				if(err_code == NRF_ERROR_BUSY) {
+					m_erase_polls++;
+					return NRF_ERROR_BUSY;
+				}
+			}
+
+			m_erasing = false;
+		}
+
+		if(err_code == NRF_SUCCESS) {
+			err_code = program_page(m_next_seq);
+		}
+
+		m_next_seq++;
+
+		if(err_code == NRF_SUCCESS) {
+			m_stats.pages_written++;
+			break;
+		}
+
+		m_attempts++;
+		m_stats.write_errors++;
+		NRF_LOG_WARNING("writing page %u failed: 0x%08x", m_next_seq - 1, err_code);
+	}
+
+	spi_flash_power_down();
+
+	m_powered = false;
+	m_queued = false;
+	return err_code;
+}
+
+
+ret_code_t track_log_init(void)
+{
+	m_count = 0;
+	m_have_last = false;
+	m_queued = false;
+	m_powered = false;
+	m_erasing = false;
+	memset(&m_stats, 0, sizeof(m_stats));
+
+	VERIFY_SUCCESS(spi_flash_power_up());
+
+	ret_code_t err_code = find_head(&m_next_seq);
+
+	spi_flash_power_down();
+
+	if(err_code != NRF_SUCCESS) {
+		// start at the beginning so that at least new fixes are logged
+		m_next_seq = 0;
+		return err_code;
+	}
+
+	NRF_LOG_INFO("next page: %u (round %u), found with %u reads",
+			m_next_seq, m_next_seq / TRACK_LOG_NUM_PAGES, m_stats.init_reads);
+
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t track_log_append(const track_log_fix_t *fix)
+{
+	track_log_fix_t f = *fix;
+
+	if(f.alt > INT16_MAX) {
+		f.alt = INT16_MAX;
+	} else if(f.alt < INT16_MIN) {
+		f.alt = INT16_MIN;
+	}
+
+	// a clock that was set backwards gives a large difference, which is kept
+	if(m_have_last && (f.time - m_last.time) < TRACK_LOG_MIN_INTERVAL_S) {
+		return NRF_SUCCESS;
+	}
+
+	ret_code_t err_code = NRF_SUCCESS;
+
+	if(m_count > 0) {
+		uint8_t delta[FIX_MAX_LEN];
+		size_t len = 0;
+
+		len += put_varint(&delta[len], f.time - m_last.time);
+		len += put_varint(&delta[len], zigzag(f.lat - m_last.lat));
+		len += put_varint(&delta[len], zigzag(f.lon - m_last.lon));
+		len += put_varint(&delta[len], zigzag(f.alt - m_last.alt));
+
+		if(m_data_len + len <= PAGE_DATA_SIZE && m_count < UINT8_MAX) {
+			memcpy(&m_page[PAGE_OFS_DATA + m_data_len], delta, len);
+			m_data_len += len;
+			m_count++;
+		} else {
+			// the previous page should have been written long ago
+			err_code = write_queued(true);
+			queue_page();
+		}
+	}
+
+	if(m_count == 0) {
+		start_page(&f);
+	}
+
+	m_last = f;
+	m_have_last = true;
+	m_stats.fixes_logged++;
+
+	return err_code;
+}
+
+
+bool track_log_write_pending(void)
+{
+	return m_queued;
+}
+
+
+ret_code_t track_log_write(void)
+{
+	return write_queued(false);
+}
+
+
+ret_code_t track_log_flush(void)
+{
+	ret_code_t err_code = write_queued(true);
+
+	if(m_count > 0) {
+		queue_page();
+
+		ret_code_t page_err_code = write_queued(true);
+
+		if(err_code == NRF_SUCCESS) {
+			err_code = page_err_code;
+		}
+	}
+
+	return err_code;
+}
+
+
+ret_code_t track_log_read_start(track_log_reader_t *reader)
+{
+	VERIFY_SUCCESS(spi_flash_power_up());
+
+	// the sector at the write position is erased before it is reached
+	uint32_t sector_start = m_next_seq - (m_next_seq % TRACK_LOG_PAGES_PER_SECTOR);
+	uint32_t span = TRACK_LOG_NUM_PAGES - TRACK_LOG_PAGES_PER_SECTOR;
+
+	reader->seq = (sector_start > span) ? sector_start - span : 0;
+	reader->end_seq = m_next_seq;
+	reader->remaining = 0;
+
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t track_log_read_next(track_log_reader_t *reader, track_log_fix_t *fix)
+{
+	while(reader->remaining == 0) {
+		if(reader->seq >= reader->end_seq) {
+			return NRF_ERROR_NOT_FOUND;
+		}
+
+		uint32_t seq = reader->seq++;
+
+		VERIFY_SUCCESS(spi_flash_read(SEQ_TO_ADDR(seq), reader->page, SPI_FLASH_PAGE_SIZE));
+
+		// pages that were damaged or already overwritten are skipped
+		if(!page_is_valid(reader->page, seq)) {
+			continue;
+		}
+
+		reader->fix.time = get_u32(&reader->page[PAGE_OFS_TIME]);
+		reader->fix.lat  = (int32_t)get_u32(&reader->page[PAGE_OFS_LAT]);
+		reader->fix.lon  = (int32_t)get_u32(&reader->page[PAGE_OFS_LON]);
+		reader->fix.alt  = (int16_t)(reader->page[PAGE_OFS_ALT] | (reader->page[PAGE_OFS_ALT + 1] << 8));
+
+		reader->remaining = reader->page[PAGE_OFS_COUNT] - 1;
+		reader->offset = PAGE_OFS_DATA;
+
+		*fix = reader->fix;
+		return NRF_SUCCESS;
+	}
+
+	const uint8_t *data = reader->page;
+	size_t end = PAGE_OFS_DATA + reader->page[PAGE_OFS_LEN];
+	size_t pos = reader->offset;
+	uint32_t dt, dlat, dlon, dalt;
+
+	if(!get_varint(data, end, &pos, &dt)
+			|| !get_varint(data, end, &pos, &dlat)
+			|| !get_varint(data, end, &pos, &dlon)
+			|| !get_varint(data, end, &pos, &dalt)) {
+		// cannot happen with a valid CRC; continue with the next page
+		reader->remaining = 0;
+		return track_log_read_next(reader, fix);
+	}
+
+	reader->fix.time += dt;
+	reader->fix.lat  += unzigzag(dlat);
+	reader->fix.lon  += unzigzag(dlon);
+	reader->fix.alt  += unzigzag(dalt);
+
+	reader->remaining--;
+	reader->offset = pos;
+
+	*fix = reader->fix;
+	return NRF_SUCCESS;
+}
+
+
+void track_log_read_end(track_log_reader_t *reader)
+{
+	(void)reader;
+	spi_flash_power_down();
+}
+
+
+void track_log_get_stats(track_log_stats_t *stats)
+{
+	*stats = m_stats;
+	stats->rounds = m_next_seq / TRACK_LOG_NUM_PAGES;
+}
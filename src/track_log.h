@@ -0,0 +1,176 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TRACK_LOG_H
+#define TRACK_LOG_H
+
+/**@file
+ *
+ * @brief Persistent log of GNSS fixes in the external SPI flash.
+ *
+ * @details
+ * Fixes are collected in RAM until a flash page is full. The page is then
+ * queued and written in one go by @ref track_log_write() from the main loop,
+ * so the flash is powered only once per page and adding a fix never waits
+ * for the flash. Each page
+ * is self-contained: its header holds the first fix in absolute values, the
+ * following fixes are stored as differences to their predecessor, encoded as
+ * variable-length integers. A CRC detects pages that were torn by a power
+ * loss.
+ *
+ * The log area is used as a ring. The page with sequence number n is always
+ * written to position n modulo the number of pages, and a sector is erased
+ * just before its first page is written. Therefore every sector is erased
+ * once per round, and the write position survives a reset: at startup, the
+ * newest sector is found with a binary search over the first page of each
+ * sector, and the first free page in it with a second binary search. This
+ * takes about 20 page reads instead of a scan of the whole area.
+ *
+ * A sector erase takes up to 240 ms. It is only started by
+ * @ref track_log_write(), which returns NRF_ERROR_BUSY until the erase has
+ * finished, so the main loop is not blocked meanwhile.
+ *
+ * Pages that cannot be verified after programming (worn-out flash) are
+ * skipped. Fixes that are still buffered in RAM are lost on a reset, unless
+ * @ref track_log_flush() was called before.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sdk_errors.h>
+
+#include "spi_flash.h"
+
+// the log area. The rest of the flash is available for other purposes.
+#ifndef TRACK_LOG_FLASH_SIZE
+#define TRACK_LOG_FLASH_SIZE    (1024UL * 1024)
+#endif
+
+#define TRACK_LOG_FLASH_START   0
+
+#define TRACK_LOG_PAGES_PER_SECTOR  (SPI_FLASH_SECTOR_SIZE / SPI_FLASH_PAGE_SIZE)
+#define TRACK_LOG_NUM_SECTORS       (TRACK_LOG_FLASH_SIZE / SPI_FLASH_SECTOR_SIZE)
+#define TRACK_LOG_NUM_PAGES         (TRACK_LOG_FLASH_SIZE / SPI_FLASH_PAGE_SIZE)
+
+// fixes closer together than this are not logged
+#define TRACK_LOG_MIN_INTERVAL_S    5
+
+// interval in which track_log_write() should be called during a sector erase
+#define TRACK_LOG_ERASE_POLL_MS     20
+
+typedef struct {
+	uint32_t time;   //!< Unix timestamp in seconds.
+	int32_t  lat;    //!< Latitude in 1e-6 degrees (about 0.1 m).
+	int32_t  lon;    //!< Longitude in 1e-6 degrees.
+	int32_t  alt;    //!< Altitude in meters.
+} track_log_fix_t;
+
+typedef struct {
+	uint32_t fixes_logged;   //!< Fixes added since startup.
+	uint32_t pages_written;  //!< Pages written since startup.
+	uint32_t sector_erases;  //!< Sectors erased since startup.
+	uint32_t write_errors;   //!< Pages that failed verification and were skipped.
+	uint32_t rounds;         //!< Completed rounds through the log area, i.e. erases per sector.
+	uint32_t init_reads;     //!< Page reads needed to find the write position at startup.
+} track_log_stats_t;
+
+/**@brief Iterator over the logged fixes, see @ref track_log_read_start(). */
+typedef struct {
+	uint32_t seq;                               //!< Sequence number of the current page.
+	uint32_t end_seq;                           //!< Sequence number after the last page.
+	uint8_t  page[SPI_FLASH_PAGE_SIZE];         //!< The current page.
+	uint8_t  remaining;                         //!< Fixes left in the current page.
+	uint16_t offset;                            //!< Read position in the current page.
+	track_log_fix_t fix;                        //!< The last returned fix.
+} track_log_reader_t;
+
+/**@brief Find the write position in the flash.
+ * @details
+ * Powers the flash for the search. @ref spi_flash_init() must have been
+ * called before.
+ */
+ret_code_t track_log_init(void);
+
+/**@brief Add a fix to the log.
+ * @details
+ * Fixes within @ref TRACK_LOG_MIN_INTERVAL_S of the previous one are
+ * ignored. If the page buffer is full, it is queued for
+ * @ref track_log_write(). Only if the previously queued page has still not
+ * been written, this function writes it and blocks.
+ *
+ * @param[in] fix    The fix to add.
+ */
+ret_code_t track_log_append(const track_log_fix_t *fix);
+
+/**@brief Check whether a full page is waiting for @ref track_log_write().
+ */
+bool track_log_write_pending(void);
+
+/**@brief Continue writing the queued page to the flash.
+ * @details
+ * Does nothing if no page is queued. A page program takes a few
+ * milliseconds; a sector erase is polled instead of waited for.
+ *
+ * @retval NRF_ERROR_BUSY   A sector erase is running. Call again after
+ *                          @ref TRACK_LOG_ERASE_POLL_MS.
+ */
+ret_code_t track_log_write(void);
+
+/**@brief Write the queued page and the buffered fixes to the flash, even if
+ * the page is not full.
+ * @details
+ * Blocks until everything is written, including sector erases.
+ */
+ret_code_t track_log_flush(void);
+
+/**@brief Start reading the logged fixes, oldest first.
+ * @details
+ * Buffered fixes that have not been flushed are not included. The flash is
+ * powered until @ref track_log_read_end() is called.
+ *
+ * @param[out] reader    The iterator to initialize.
+ */
+ret_code_t track_log_read_start(track_log_reader_t *reader);
+
+/**@brief Get the next logged fix.
+ *
+ * @param[inout] reader    The iterator.
+ * @param[out] fix         The next fix.
+ * @retval NRF_ERROR_NOT_FOUND   There are no more fixes.
+ */
+ret_code_t track_log_read_next(track_log_reader_t *reader, track_log_fix_t *fix);
+
+/**@brief Finish reading and power down the flash.
+ */
+void track_log_read_end(track_log_reader_t *reader);
+
+/**@brief Get the statistics.
+ *
+ * @param[out] stats    Pointer to the structure to fill.
+ */
+void track_log_get_stats(track_log_stats_t *stats);
+
+#endif // TRACK_LOG_H
@@ -32,41 +32,83 @@ NRF_LOG_MODULE_REGISTER();
 
 #include "lora.h"
 #include "time_base.h"
+#include "wall_clock.h"
+#include "tx_slot.h"
+#include "tx_sched.h"
+#include "telemetry.h"
+#include "airtime.h"
 #include "utils.h"
+#include "trace.h"
 
 #include "tracker.h"
 
-// ignore heading changes below this speed
-#define HEADING_CHECK_MIN_SPEED   1.0f // meters per second
-
-// transmit a position report if heading has changed by more than this angle
-// (positive or negative)
-#define MAX_HEADING_DELTA_DEG    30.0f // degrees
-
-// minimum time between two transmissions
-#define MIN_TX_INTERVAL_MS      15000 // milliseconds
-
-// force the transmission of a position report after this amount of time after
-// the last position report, even if heading and location have not changed
-#define MAX_POS_INTERVAL_MS   1800000 // milliseconds
-
 // interval between two weather reports
 #define WX_INTERVAL_MS         300000 // milliseconds
 
-// transmit a position report when the distance from the last report’s location
-// is greater than this value
-#define MAX_DISTANCE_M         2000 // meters
+// default SmartBeaconing parameters. Between slow and fast speed, the beacon
+// rate scales inversely with the speed, so a beacon is sent about every
+// fast_speed * fast_rate = 1.9 km, similar to the previous fixed 2 km
+// distance trigger.
+#define DEFAULT_FAST_RATE_S         100 // seconds
+#define DEFAULT_SLOW_RATE_S        1800 // seconds
+#define DEFAULT_FAST_SPEED_KMH       70 // km/h
+#define DEFAULT_SLOW_SPEED_KMH        4 // km/h
+#define DEFAULT_MIN_TURN_ANGLE_DEG   28 // degrees
+#define DEFAULT_TURN_SLOPE          240 // degrees * km/h
+#define DEFAULT_MIN_TURN_TIME_S      30 // seconds
+
+// smallest accepted dead reckoning error. Lower values would trigger
+// transmissions on GNSS noise alone.
+#define MIN_DEAD_RECKONING_ERROR_M   20 // meters
+
+static tracker_smartbeacon_params_t m_params = {
+	.fast_rate_s        = DEFAULT_FAST_RATE_S,
+	.slow_rate_s        = DEFAULT_SLOW_RATE_S,
+	.min_turn_time_s    = DEFAULT_MIN_TURN_TIME_S,
+	.turn_slope         = DEFAULT_TURN_SLOPE,
+	.fast_speed_kmh     = DEFAULT_FAST_SPEED_KMH,
+	.slow_speed_kmh     = DEFAULT_SLOW_SPEED_KMH,
+	.min_turn_angle_deg = DEFAULT_MIN_TURN_ANGLE_DEG,
+	.reserved           = 0,
+};
 
 static float m_last_tx_heading = 0.0f;
 
+// position, course and speed as seen by the receivers of the last report
 static float m_last_tx_lat = 0.0f;
 static float m_last_tx_lon = 0.0f;
+static float m_last_tx_course = 0.0f;
+static float m_last_tx_speed = 0.0f;
+static bool  m_last_tx_course_speed_valid = false;
+
+static bool  m_pos_reported = false;
+static bool  m_pos_tx_forced = true;
+
+// time when a movement trigger requested a position report. It is kept until
+// the report is sent, even if the trigger condition disappears meanwhile.
+static uint64_t m_pos_trigger_time = TX_SCHED_NEVER;
+
+// maximum deviation from the dead reckoning prediction (0 = disabled)
+static uint16_t m_dead_reckoning_max_error_m = 0;
+
+// slotted mode: the report waiting for the next slot
+static bool              m_slot_pending = false;
+static tx_sched_source_t m_slot_source;
+static uint64_t          m_slot_time = 0;
+static tx_slot_t         m_tx_slot;
+
+// reports are generated from the latest data when they are due
+static nmea_data_t m_latest_data;
+static aprs_args_t m_latest_args;
 
-static uint64_t m_last_tx_time = 0;
 static uint64_t m_last_pos_time = 0;
 static uint64_t m_last_wx_time = 0;
 
 static uint32_t m_tx_counter = 0;
+static uint32_t m_turn_counter = 0;
+
+// beacon rate for the latest speed
+static uint32_t m_beacon_rate_ms = DEFAULT_SLOW_RATE_S * 1000;
 
 static tracker_callback m_callback;
 
@@ -74,121 +116,475 @@ ret_code_t tracker_init(tracker_callback callback)
 {
 	m_callback = callback;
 
+	tx_slot_init(&m_tx_slot);
+	tx_sched_init();
+
 	return NRF_SUCCESS;
 }
 
 
-ret_code_t tracker_run(const nmea_data_t *data, aprs_args_t *args)
+void tracker_get_default_smartbeacon_params(tracker_smartbeacon_params_t *params)
+{
+	params->fast_rate_s        = DEFAULT_FAST_RATE_S;
+	params->slow_rate_s        = DEFAULT_SLOW_RATE_S;
+	params->min_turn_time_s    = DEFAULT_MIN_TURN_TIME_S;
+	params->turn_slope         = DEFAULT_TURN_SLOPE;
+	params->fast_speed_kmh     = DEFAULT_FAST_SPEED_KMH;
+	params->slow_speed_kmh     = DEFAULT_SLOW_SPEED_KMH;
+	params->min_turn_angle_deg = DEFAULT_MIN_TURN_ANGLE_DEG;
+	params->reserved           = 0;
+}
+
+
+ret_code_t tracker_set_smartbeacon_params(const tracker_smartbeacon_params_t *params)
 {
-	bool do_tx = false;
+	if(params->fast_rate_s < TX_SCHED_MIN_INTERVAL_MS / 1000
+			|| params->slow_rate_s < params->fast_rate_s
+			|| params->slow_speed_kmh == 0
+			|| params->fast_speed_kmh <= params->slow_speed_kmh
+			|| params->min_turn_angle_deg > 180) {
+		return NRF_ERROR_INVALID_PARAM;
+	}
+
+	m_params = *params;
+	m_beacon_rate_ms = m_params.slow_rate_s * 1000;
+
+	return NRF_SUCCESS;
+}
+
 
+void tracker_get_smartbeacon_params(tracker_smartbeacon_params_t *params)
+{
+	*params = m_params;
+}
+
+
+ret_code_t tracker_set_dead_reckoning_max_error(uint16_t max_error_m)
+{
+	if(max_error_m != 0 && max_error_m < MIN_DEAD_RECKONING_ERROR_M) {
+		return NRF_ERROR_INVALID_PARAM;
+	}
+
+	m_dead_reckoning_max_error_m = max_error_m;
+
+	return NRF_SUCCESS;
+}
+
+
+uint16_t tracker_get_dead_reckoning_max_error(void)
+{
+	return m_dead_reckoning_max_error_m;
+}
+
+
+bool tracker_get_reported_position(uint64_t now, float *lat, float *lon)
+{
+	if(!m_pos_reported) {
+		return false;
+	}
+
+	*lat = m_last_tx_lat;
+	*lon = m_last_tx_lon;
+
+	if(m_last_tx_course_speed_valid) {
+		float dist_m = m_last_tx_speed * (now - m_last_pos_time) / 1000.0f;
+		move_position(lat, lon, m_last_tx_course, dist_m);
+	}
+
+	return true;
+}
+
+
+/**@brief Calculate the SmartBeaconing rate for the given speed.
+ * @returns  The time between two position reports in milliseconds.
+ */
+static uint32_t calc_beacon_rate_ms(float speed_kmh)
+{
+	if(speed_kmh <= m_params.slow_speed_kmh) {
+		return m_params.slow_rate_s * 1000;
+	} else if(speed_kmh >= m_params.fast_speed_kmh) {
+		return m_params.fast_rate_s * 1000;
+	} else {
+		return (uint32_t)(1000.0f * m_params.fast_rate_s * m_params.fast_speed_kmh / speed_kmh);
+	}
+}
+
+
+/**@brief Generate and transmit a weather report.
+ */
+static void transmit_wx(aprs_args_t *args, uint64_t now)
+{
 	uint8_t message[APRS_MAX_FRAME_LEN];
 	size_t  frame_len;
 
-	uint64_t now = time_base_get();
+	TRACE_INFO("transmitting WX data");
+	frame_len = aprs_build_frame(message, args, APRS_PACKET_TYPE_WX);
+
+	if(frame_len) {
+		TRACE_HEXDUMP("Generated WX frame:", message, frame_len);
 
-	if((now - m_last_tx_time) < MIN_TX_INTERVAL_MS) {
-		// do not transmit too often
-		return NRF_ERROR_BUSY;
+		lora_send_packet(message, frame_len);
+
+		m_callback(TRACKER_EVT_TRANSMISSION_STARTED);
+	} else {
+		NRF_LOG_ERROR("APRS frame generation failed!");
 	}
 
-	// weather packet handling
-	if(args->transmit_env_data && ((now - m_last_wx_time) >= WX_INTERVAL_MS)) {
-		NRF_LOG_INFO("transmitting WX data");
-		frame_len = aprs_build_frame(message, args, APRS_PACKET_TYPE_WX);
+	m_last_wx_time = now;
+	tx_sched_handle_sent(TX_SCHED_SOURCE_WX, now, frame_len ? airtime_calc_toa_ms(frame_len) : 0);
+}
 
-		if(frame_len) {
-			NRF_LOG_INFO("Generated WX frame:");
-			NRF_LOG_HEXDUMP_INFO(message, frame_len);
 
-			lora_send_packet(message, frame_len);
+/**@brief Generate and transmit the next telemetry frame.
+ * @returns  True if a frame was transmitted.
+ */
+static bool transmit_telemetry(uint64_t now)
+{
+	uint8_t message[APRS_MAX_FRAME_LEN];
+	size_t  frame_len;
 
-			m_last_tx_time = now;
-			m_last_wx_time = now;
+	frame_len = telemetry_build_next_frame(message, now);
 
-			m_callback(TRACKER_EVT_TRANSMISSION_STARTED);
-		} else {
-			NRF_LOG_ERROR("APRS frame generation failed!");
-		}
+	if(!frame_len) {
+		// no data in this interval. The next frame is requested on the next
+		// GNSS update.
+		tx_sched_cancel(TX_SCHED_SOURCE_TELEMETRY);
+		return false;
+	}
+
+	TRACE_HEXDUMP("Generated telemetry frame:", message, frame_len);
+
+	lora_send_packet(message, frame_len);
+
+	m_callback(TRACKER_EVT_TRANSMISSION_STARTED);
+
+	tx_sched_handle_sent(TX_SCHED_SOURCE_TELEMETRY, now, airtime_calc_toa_ms(frame_len));
+
+	// definitions are directly followed by the next frame. This also keeps
+	// telemetry running while the GNSS is in standby.
+	tx_sched_request(TX_SCHED_SOURCE_TELEMETRY, telemetry_get_next_due_time());
+
+	return true;
+}
+
+
+/**@brief Generate and transmit a position report.
+ */
+static void transmit_position(const nmea_data_t *data, aprs_args_t *args, uint64_t now)
+{
+	uint8_t message[APRS_MAX_FRAME_LEN];
+	size_t  frame_len;
+
+	float speed_kmh = data->speed_heading_valid ? data->speed * 3.6f : 0.0f;
+
+	if(data->speed_heading_valid) {
+		m_last_tx_heading = data->heading;
+	}
+
+	m_last_pos_time = now;
+	m_pos_tx_forced = false;
+	m_pos_trigger_time = TX_SCHED_NEVER;
+	m_pos_reported = true;
+
+	m_last_tx_lat = data->lat;
+	m_last_tx_lon = data->lon;
+
+	// course and speed are only needed for dead reckoning. Below the slow
+	// speed, the reported speed is 0 so receivers do not extrapolate GNSS
+	// noise.
+	args->course_speed_valid = m_dead_reckoning_max_error_m && data->speed_heading_valid;
+
+	if(args->course_speed_valid) {
+		args->course_deg = data->heading;
+		args->speed_mps = (speed_kmh > m_params.slow_speed_kmh) ? data->speed : 0.0f;
+
+		m_last_tx_course = args->course_deg;
+		m_last_tx_speed = args->speed_mps;
+		aprs_quantize_course_speed(&m_last_tx_course, &m_last_tx_speed);
+	}
+
+	m_last_tx_course_speed_valid = args->course_speed_valid;
+
+	// generate a new APRS packet
+	aprs_update_pos_time(data->lat, data->lon, data->altitude, now / 1000);
+
+	args->frame_id = ++m_tx_counter;
+	frame_len = aprs_build_frame(message, args, APRS_PACKET_TYPE_POSITION);
+
+	if(frame_len) {
+		TRACE_HEXDUMP("Generated frame:", message, frame_len);
+
+		lora_send_packet(message, frame_len);
+
+		m_callback(TRACKER_EVT_TRANSMISSION_STARTED);
+	} else {
+		NRF_LOG_ERROR("APRS frame generation failed!");
+	}
+
+	tx_sched_handle_sent(TX_SCHED_SOURCE_POSITION, now, frame_len ? airtime_calc_toa_ms(frame_len) : 0);
+}
+
+
+/**@brief Check whether transmissions are deferred to the station’s slot.
+ * @details
+ * Slots are only used if the clock was set from the GNSS.
+ */
+static bool slotted_mode_active(void)
+{
+	return (aprs_get_config_flags() & APRS_FLAG_SLOTTED_TX) && wall_clock_is_valid();
+}
+
+
+/**@brief Determine the time of the next slot.
+ *
+ * @param now      The current time.
+ * @param offset   Only consider slots that begin at least this much later.
+ */
+static void schedule_slot(uint64_t now, uint32_t offset)
+{
+	char call[16];
+
+	aprs_get_source(call, sizeof(call));
+
+	m_slot_time = now + offset + tx_slot_calc_delay_ms(&m_tx_slot, call, wall_clock_get_unix_ms() + offset);
+}
+
+
+ret_code_t tracker_run(const nmea_data_t *data, aprs_args_t *args)
+{
+	bool triggered = false;
+	bool turned = false;
+
+	uint64_t now = time_base_get();
+
+	args->course_speed_valid = false;
+
+	m_latest_args = *args;
+
+	// weather reports are sent at a fixed interval while new data is available
+	if(args->transmit_env_data) {
+		tx_sched_request(TX_SCHED_SOURCE_WX, m_last_wx_time + WX_INTERVAL_MS);
+	} else {
+		tx_sched_cancel(TX_SCHED_SOURCE_WX);
+	}
+
+	if(aprs_get_config_flags() & APRS_FLAG_TELEMETRY) {
+		tx_sched_request(TX_SCHED_SOURCE_TELEMETRY, telemetry_get_next_due_time());
+	} else {
+		tx_sched_cancel(TX_SCHED_SOURCE_TELEMETRY);
 	}
 
 	// remaining handling below is for position packets
 
 	if(!data->pos_valid) {
 		// do not transmit invalid positions
+		tx_sched_cancel(TX_SCHED_SOURCE_POSITION);
 		return NRF_ERROR_INVALID_DATA;
 	}
 
-	if((now - m_last_pos_time) > MAX_POS_INTERVAL_MS) {
-		// transmit if the previous one was too long ago
-		NRF_LOG_INFO("forced tx after %d ms idle", now - m_last_pos_time);
-		do_tx = true;
+	m_latest_data = *data;
+
+	float speed_kmh = data->speed_heading_valid ? data->speed * 3.6f : 0.0f;
+
+	if(m_pos_tx_forced) {
+		TRACE_INFO("forced tx");
+		triggered = true;
 	}
 
-	if(data->speed_heading_valid && (data->speed >= HEADING_CHECK_MIN_SPEED)) {
-		float delta_heading = data->heading - m_last_tx_heading;
+	if(m_dead_reckoning_max_error_m) {
+		// dead reckoning: receivers extrapolate the position from the last
+		// course and speed. Transmit only if that prediction is too far off or
+		// the slow rate has expired.
+		m_beacon_rate_ms = m_params.slow_rate_s * 1000;
 
-		if(delta_heading < -180.0f) {
-			delta_heading += 360.0f;
-		} else if(delta_heading > 180.0f) {
-			delta_heading -= 360.0f;
-		}
+		float pred_lat, pred_lon;
 
-		if(delta_heading < 0.0f) {
-			delta_heading = -delta_heading;
+		if(tracker_get_reported_position(now, &pred_lat, &pred_lon)) {
+			float error = great_circle_distance_m(data->lat, data->lon, pred_lat, pred_lon);
+
+			if(error >= m_dead_reckoning_max_error_m) {
+				TRACE_INFO("dead reckoning error too high: %d m", (int)(error + 0.5f));
+				triggered = true;
+			}
+		}
+	} else {
+		// the interval between reports depends on the current speed
+		m_beacon_rate_ms = calc_beacon_rate_ms(speed_kmh);
+
+		// corner pegging: while moving, transmit when the heading changes by more
+		// than the turn threshold. The threshold grows at low speed where the
+		// heading is less precise and small turns cover only a short distance.
+		if(data->speed_heading_valid
+				&& (speed_kmh > m_params.slow_speed_kmh)
+				&& ((now - m_last_pos_time) >= m_params.min_turn_time_s * 1000)) {
+			float delta_heading = data->heading - m_last_tx_heading;
+
+			if(delta_heading < -180.0f) {
+				delta_heading += 360.0f;
+			} else if(delta_heading > 180.0f) {
+				delta_heading -= 360.0f;
+			}
+
+			if(delta_heading < 0.0f) {
+				delta_heading = -delta_heading;
+			}
+
+			float turn_threshold = m_params.min_turn_angle_deg + m_params.turn_slope / speed_kmh;
+
+			if(delta_heading >= turn_threshold) {
+				TRACE_INFO("heading changed too much: was: %d, is: %d, delta: %d, threshold: %d", (int)(m_last_tx_heading + 0.5f), (int)(data->heading + 0.5f), (int)(delta_heading + 0.5f), (int)(turn_threshold + 0.5f));
+				triggered = true;
+				turned = true;
+			}
 		}
+	}
 
-		if(delta_heading >= MAX_HEADING_DELTA_DEG) {
-			NRF_LOG_INFO("heading changed too much: was: %d, is: %d, delta: %d", (int)(m_last_tx_heading + 0.5f), (int)(data->heading + 0.5f), (int)(delta_heading + 0.5f));
-			do_tx = true;
+	if(triggered && m_pos_trigger_time == TX_SCHED_NEVER) {
+		m_pos_trigger_time = now;
+
+		if(turned) {
+			m_turn_counter++;
 		}
 	}
 
-	float distance = great_circle_distance_m(
-			data->lat, data->lon,
-			m_last_tx_lat, m_last_tx_lon);
+	uint64_t due = m_last_pos_time + m_beacon_rate_ms;
 
-	if(distance >= MAX_DISTANCE_M) {
-		NRF_LOG_INFO("distance since last TX too high: %d m", (int)(distance + 0.5f));
-		do_tx = true;
+	if(m_pos_trigger_time < due) {
+		due = m_pos_trigger_time;
 	}
 
-	if(do_tx) {
-		if(data->speed_heading_valid) {
-			m_last_tx_heading = data->heading;
-		}
+	tx_sched_request(TX_SCHED_SOURCE_POSITION, due);
+
+	return NRF_SUCCESS;
+}
 
-		m_last_tx_lat = data->lat;
-		m_last_tx_lon = data->lon;
-		m_last_tx_time = now;
-		m_last_pos_time = now;
 
-		// generate a new APRS packet
-		aprs_update_pos_time(data->lat, data->lon, data->altitude, now / 1000);
+uint64_t tracker_get_next_forced_tx_time(bool include_wx)
+{
+	uint64_t next_tx = m_last_pos_time + m_beacon_rate_ms;
 
-		args->frame_id = ++m_tx_counter;
-		frame_len = aprs_build_frame(message, args, APRS_PACKET_TYPE_POSITION);
+	if(include_wx && (m_last_wx_time + WX_INTERVAL_MS < next_tx)) {
+		next_tx = m_last_wx_time + WX_INTERVAL_MS;
+	}
 
-		if(frame_len) {
-			NRF_LOG_INFO("Generated frame:");
-			NRF_LOG_HEXDUMP_INFO(message, frame_len);
+	if(next_tx < tx_sched_get_earliest_time()) {
+		next_tx = tx_sched_get_earliest_time();
+	}
+
+	return next_tx;
+}
+
+
+uint64_t tracker_get_next_tx_time(void)
+{
+	if(!m_slot_pending) {
+		return tx_sched_get_next_time();
+	}
+
+	if(!slotted_mode_active()) {
+		// slotted mode was disabled while waiting: transmit immediately
+		return 0;
+	}
+
+	return m_slot_time;
+}
+
+
+/**@brief Generate and transmit a report from the given source.
+ * @returns  True if a report was transmitted.
+ */
+static bool transmit_source(tx_sched_source_t source, uint64_t now)
+{
+	switch(source) {
+		case TX_SCHED_SOURCE_POSITION:
+			transmit_position(&m_latest_data, &m_latest_args, now);
+			return true;
+
+		case TX_SCHED_SOURCE_WX:
+			if(!m_latest_args.transmit_env_data) {
+				// weather data became unavailable while waiting for a slot
+				tx_sched_cancel(TX_SCHED_SOURCE_WX);
+				return false;
+			}
+
+			transmit_wx(&m_latest_args, now);
+			return true;
+
+		case TX_SCHED_SOURCE_TELEMETRY:
+			if(!(aprs_get_config_flags() & APRS_FLAG_TELEMETRY)) {
+				// disabled while waiting for a slot
+				tx_sched_cancel(TX_SCHED_SOURCE_TELEMETRY);
+				return false;
+			}
+
+			return transmit_telemetry(now);
+
+		default:
+			return false;
+	}
+}
 
-			lora_send_packet(message, frame_len);
 
-			m_callback(TRACKER_EVT_TRANSMISSION_STARTED);
-		} else {
-			NRF_LOG_ERROR("APRS frame generation failed!");
+bool tracker_transmit_due(uint64_t now)
+{
+	if(m_slot_pending) {
+		if(slotted_mode_active()) {
+			if(now < m_slot_time) {
+				return false;
+			}
+
+			if(now - m_slot_time > TX_SLOT_MAX_LATE_MS) {
+				// slot missed, e.g. because the radio was busy
+				NRF_LOG_WARNING("slot missed by %d ms", now - m_slot_time);
+				schedule_slot(now, 0);
+				return false;
+			}
 		}
+
+		m_slot_pending = false;
+		return transmit_source(m_slot_source, now);
 	}
 
-	return NRF_SUCCESS;
+	tx_sched_source_t source;
+
+	if(!tx_sched_get_due_source(now, &source)) {
+		return false;
+	}
+
+	if(slotted_mode_active()) {
+		TRACE_INFO("report from source %d waits for the next slot", source);
+		m_slot_pending = true;
+		m_slot_source = source;
+		schedule_slot(now, 0);
+		return false;
+	}
+
+	return transmit_source(source, now);
+}
+
+
+void tracker_handle_received_frame(size_t frame_len)
+{
+	if(!wall_clock_is_valid()) {
+		return;
+	}
+
+	// the frame is complete now, so the transmission began one time on air ago
+	uint64_t start_unix_ms = wall_clock_get_unix_ms() - airtime_calc_toa_ms(frame_len);
+
+	tx_slot_handle_rx(&m_tx_slot, start_unix_ms);
 }
 
 
 void tracker_force_tx(void)
 {
-	// force transmission by resetting the last transmission time.
-	m_last_tx_time = 0;
+	// force transmission by dropping all waiting reports and resetting the
+	// minimum interval.
+	tx_sched_init();
+	m_pos_tx_forced = true;
+	m_pos_trigger_time = TX_SCHED_NEVER;
+
+	m_slot_pending = false;
 }
 
 
@@ -198,7 +594,14 @@ uint32_t tracker_get_tx_counter(void)
 }
 
 
+uint32_t tracker_get_turn_counter(void)
+{
+	return m_turn_counter;
+}
+
+
 void tracker_reset_tx_counter(void)
 {
 	m_tx_counter = 0;
+	m_turn_counter = 0;
 }
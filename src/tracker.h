@@ -36,20 +36,138 @@ typedef enum {
 
 typedef void (*tracker_callback)(tracker_evt_t evt);
 
+/**@brief SmartBeaconing parameters.
+ * @details
+ * This struct is stored as-is in the settings (12 bytes, little endian), so
+ * the field order must not be changed.
+ */
+typedef struct {
+	uint16_t fast_rate_s;        //!< Beacon interval at or above the fast speed.
+	uint16_t slow_rate_s;        //!< Beacon interval at or below the slow speed.
+	uint16_t min_turn_time_s;    //!< Minimum time between turn-triggered beacons.
+	uint16_t turn_slope;         //!< Speed-dependent part of the turn threshold (degrees * km/h).
+	uint8_t  fast_speed_kmh;     //!< Speed above which the fast rate is used.
+	uint8_t  slow_speed_kmh;     //!< Speed below which the slow rate is used.
+	uint8_t  min_turn_angle_deg; //!< Turn threshold at high speed.
+	uint8_t  reserved;           //!< Reserved, set to 0.
+} tracker_smartbeacon_params_t;
+
+#define TRACKER_SMARTBEACON_PARAMS_LEN  12
+
+// returned by tracker_get_next_tx_time() if no report is waiting
+#define TRACKER_NO_TX  UINT64_MAX
+
 /**@brief Initialize all modules necessary for tracking.
  */
 ret_code_t tracker_init(tracker_callback callback);
 
+/**@brief Get the default SmartBeaconing parameters.
+ */
+void tracker_get_default_smartbeacon_params(tracker_smartbeacon_params_t *params);
+
+/**@brief Set the SmartBeaconing parameters.
+ *
+ * @param params   The new parameters.
+ * @retval NRF_ERROR_INVALID_PARAM  If the parameters are inconsistent, e.g. the
+ *                                  slow rate is shorter than the fast rate.
+ *                                  The previous parameters are kept.
+ * @retval NRF_SUCCESS              If the parameters were applied.
+ */
+ret_code_t tracker_set_smartbeacon_params(const tracker_smartbeacon_params_t *params);
+
+/**@brief Get the active SmartBeaconing parameters.
+ */
+void tracker_get_smartbeacon_params(tracker_smartbeacon_params_t *params);
+
+/**@brief Enable or disable dead reckoning beacon suppression.
+ * @details
+ * In dead reckoning mode, course and speed are included in position reports.
+ * A new report is only transmitted when the current position deviates from
+ * the position extrapolated from the last report by more than the given
+ * error, or when the SmartBeaconing slow rate has expired. The other
+ * SmartBeaconing triggers are not used in this mode.
+ *
+ * @param max_error_m   Maximum deviation in meters. 0 disables dead reckoning.
+ * @retval NRF_ERROR_INVALID_PARAM  If the error is too small to be useful.
+ * @retval NRF_SUCCESS              If the value was applied.
+ */
+ret_code_t tracker_set_dead_reckoning_max_error(uint16_t max_error_m);
+
+/**@brief Get the maximum dead reckoning error (0 = disabled).
+ */
+uint16_t tracker_get_dead_reckoning_max_error(void);
+
+/**@brief Get the position that receivers assume from the last report.
+ * @details
+ * In dead reckoning mode, the position is extrapolated from the reported
+ * course and speed. Otherwise, it is the last reported position.
+ *
+ * @param[in]  now   Current time (same time base as @ref time_base_get()).
+ * @param[out] lat   Latitude in degrees.
+ * @param[out] lon   Longitude in degrees.
+ * @returns          false if no position was reported yet.
+ */
+bool tracker_get_reported_position(uint64_t now, float *lat, float *lon);
+
 /**@brief Process a new position report in the tracker.
+ * @details
+ * Reports are not transmitted directly. Instead, the time of the next report
+ * is updated. Call @ref tracker_transmit_due() at the time returned by @ref
+ * tracker_get_next_tx_time().
  *
  * @param data     Latest NMEA data from the GNSS module.
- * @param args     Arguments for building the APRS frame. The frame_id field
- *                 will be overwritten by this function.
+ * @param args     Arguments for building the APRS frame. The frame_id and
+ *                 course/speed fields will be overwritten by this function.
  * @returns        The result code of the internal function calls.
  */
 ret_code_t tracker_run(const nmea_data_t *data, aprs_args_t *args);
 
+/**@brief Get the time of the next transmission that happens without movement.
+ * @details
+ * Without movement, a position report is only transmitted when the beacon
+ * interval for the last known speed has passed. Weather reports are sent at a fixed interval.
+ *
+ * @param include_wx  Consider weather reports as well.
+ * @returns           The time of the next forced transmission in milliseconds
+ *                    (same time base as @ref time_base_get()).
+ */
+uint64_t tracker_get_next_forced_tx_time(bool include_wx);
+
+/**@brief Get the time when the next report is due.
+ * @details
+ * Position and weather reports are merged by the TX scheduler, which ensures
+ * the minimum interval between two reports and the airtime budget. In slotted
+ * mode (@ref APRS_FLAG_SLOTTED_TX), a due report additionally waits for the
+ * station’s next transmission slot.
+ *
+ * @returns  The time in milliseconds (same time base as @ref time_base_get())
+ *           or @ref TRACKER_NO_TX if no report is waiting.
+ */
+uint64_t tracker_get_next_tx_time(void);
+
+/**@brief Transmit the next report if it is due.
+ * @details
+ * At most one report is sent per call. It is generated from the data passed
+ * to the latest call of @ref tracker_run(). If the slot was missed, the next
+ * one is scheduled.
+ *
+ * @param now   The current time in milliseconds.
+ * @returns     True if a report was transmitted.
+ */
+bool tracker_transmit_due(uint64_t now);
+
+/**@brief Notify the tracker of a received frame.
+ * @details
+ * The time of the frame is used to find out which transmission slots are
+ * occupied by other stations, so the own slot can be moved to a free one.
+ *
+ * @param frame_len   Length of the received frame in bytes.
+ */
+void tracker_handle_received_frame(size_t frame_len);
+
 /**@brief Force a transmission on the next valid GPS update.
+ * @details
+ * Waiting reports are discarded and the minimum interval is reset.
  */
 void tracker_force_tx(void);
 
@@ -57,7 +175,12 @@ void tracker_force_tx(void);
  */
 uint32_t tracker_get_tx_counter(void);
 
-/**@brief Reset the transmission counter.
+/**@brief Get the number of reports triggered by a change of the heading
+ * (corner pegging).
+ */
+uint32_t tracker_get_turn_counter(void);
+
+/**@brief Reset the transmission and turn counters.
  */
 void tracker_reset_tx_counter(void);
 
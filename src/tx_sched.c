@@ -0,0 +1,121 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "airtime.h"
+
+#include "tx_sched.h"
+
+static uint64_t m_due[TX_SCHED_NUM_SOURCES];
+static uint32_t m_toa_estimate_ms[TX_SCHED_NUM_SOURCES];
+
+// no transmission is allowed before this time
+static uint64_t m_earliest_time;
+
+
+void tx_sched_init(void)
+{
+	for(uint8_t i = 0; i < TX_SCHED_NUM_SOURCES; i++) {
+		m_due[i] = TX_SCHED_NEVER;
+	}
+
+	memset(m_toa_estimate_ms, 0, sizeof(m_toa_estimate_ms));
+	m_earliest_time = 0;
+}
+
+
+void tx_sched_request(tx_sched_source_t source, uint64_t due)
+{
+	m_due[source] = due;
+}
+
+
+void tx_sched_cancel(tx_sched_source_t source)
+{
+	m_due[source] = TX_SCHED_NEVER;
+}
+
+
+uint64_t tx_sched_get_due_time(tx_sched_source_t source)
+{
+	return m_due[source];
+}
+
+
+uint64_t tx_sched_get_earliest_time(void)
+{
+	return m_earliest_time;
+}
+
+
+uint64_t tx_sched_get_next_time(void)
+{
+	uint64_t next = TX_SCHED_NEVER;
+
+	for(uint8_t i = 0; i < TX_SCHED_NUM_SOURCES; i++) {
+		if(m_due[i] < next) {
+			next = m_due[i];
+		}
+	}
+
+	if(next != TX_SCHED_NEVER && next < m_earliest_time) {
+		next = m_earliest_time;
+	}
+
+	return next;
+}
+
+
+bool tx_sched_get_due_source(uint64_t now, tx_sched_source_t *source)
+{
+	if(now < m_earliest_time) {
+		return false;
+	}
+
+	for(uint8_t i = 0; i < TX_SCHED_NUM_SOURCES; i++) {
+		if(m_due[i] > now) {
+			continue;
+		}
+
+		if(!airtime_is_available(now, m_toa_estimate_ms[i])) {
+			m_earliest_time = now + TX_SCHED_BUDGET_RETRY_MS;
+			return false;
+		}
+
+		*source = i;
+		return true;
+	}
+
+	return false;
+}
+
+
+void tx_sched_handle_sent(tx_sched_source_t source, uint64_t now, uint32_t toa_ms)
+{
+	m_due[source] = TX_SCHED_NEVER;
+	m_toa_estimate_ms[source] = toa_ms;
+	m_earliest_time = now + TX_SCHED_MIN_INTERVAL_MS;
+}
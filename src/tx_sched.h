@@ -0,0 +1,120 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TX_SCHED_H
+#define TX_SCHED_H
+
+/**@file
+ *
+ * @brief Scheduler for the tracker’s own packets.
+ *
+ * @details
+ * Every kind of packet the tracker sends on its own (position reports, weather
+ * reports, ...) is a source. Each source requests a transmission at a certain
+ * time. The scheduler merges all requests into a single next transmission
+ * time, taking the minimum interval between two transmissions and the airtime
+ * budget into account, so only one timer is needed to send them.
+ *
+ * Sources with a lower number take precedence if several are due at the same
+ * time.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// minimum time between two transmissions
+#define TX_SCHED_MIN_INTERVAL_MS   15000 // milliseconds
+
+// time to wait before checking the airtime budget again if it is exhausted
+#define TX_SCHED_BUDGET_RETRY_MS   60000 // milliseconds
+
+// returned if no transmission is requested
+#define TX_SCHED_NEVER  UINT64_MAX
+
+typedef enum {
+	TX_SCHED_SOURCE_POSITION,
+	TX_SCHED_SOURCE_WX,
+	TX_SCHED_SOURCE_TELEMETRY,
+
+	TX_SCHED_NUM_SOURCES
+} tx_sched_source_t;
+
+/**@brief Remove all requests and allow the next transmission immediately.
+ */
+void tx_sched_init(void);
+
+/**@brief Request a transmission from the given source.
+ * @details
+ * A previous request from the same source is replaced.
+ *
+ * @param source   The packet source.
+ * @param due      The time when the packet should be sent.
+ */
+void tx_sched_request(tx_sched_source_t source, uint64_t due);
+
+/**@brief Remove the request of the given source.
+ */
+void tx_sched_cancel(tx_sched_source_t source);
+
+/**@brief Get the time requested by the given source.
+ * @returns   The requested time or @ref TX_SCHED_NEVER.
+ */
+uint64_t tx_sched_get_due_time(tx_sched_source_t source);
+
+/**@brief Get the earliest time at which the next transmission may start.
+ * @details
+ * This only considers the minimum interval and the airtime budget, not the
+ * requests.
+ */
+uint64_t tx_sched_get_earliest_time(void);
+
+/**@brief Get the time of the next transmission.
+ * @returns   The time or @ref TX_SCHED_NEVER if nothing was requested.
+ */
+uint64_t tx_sched_get_next_time(void);
+
+/**@brief Select the source to transmit now.
+ * @details
+ * If the airtime budget does not allow a transmission, it is postponed by
+ * @ref TX_SCHED_BUDGET_RETRY_MS.
+ *
+ * @param now      The current time.
+ * @param source   Set to the source which should transmit now.
+ * @returns        True if a source may transmit now.
+ */
+bool tx_sched_get_due_source(uint64_t now, tx_sched_source_t *source);
+
+/**@brief Notify the scheduler that a source has transmitted.
+ * @details
+ * The request of the source is removed. The time on air is used to estimate
+ * the airtime of the source’s next packet.
+ *
+ * @param source   The packet source.
+ * @param now      The current time.
+ * @param toa_ms   The time on air of the packet.
+ */
+void tx_sched_handle_sent(tx_sched_source_t source, uint64_t now, uint32_t toa_ms);
+
+#endif // TX_SCHED_H
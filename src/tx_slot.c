@@ -0,0 +1,138 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "tx_slot.h"
+#include "utils.h"
+
+
+/**@brief Mix the bits of a hash value (MurmurHash3 finalizer).
+ * @details
+ * FNV-1a does not mix the last bytes well enough for a modulo by a small
+ * number.
+ */
+static uint32_t mix(uint32_t hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bUL;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35UL;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+
+static bool slot_is_occupied(const tx_slot_t *ctx, uint8_t slot, uint32_t cycle)
+{
+	uint32_t last_heard = ctx->last_heard[slot];
+
+	return (last_heard != 0) && (cycle + 1 - last_heard < TX_SLOT_OCCUPIED_CYCLES);
+}
+
+
+/**@brief Move to a slot that was not used by other stations recently.
+ * @details
+ * The search starts at a position derived from the call sign and the cycle
+ * number, so stations that lose their slot at the same time are unlikely to
+ * select the same new slot.
+ */
+static void select_free_slot(tx_slot_t *ctx, uint32_t cycle)
+{
+	uint8_t start = mix(ctx->call_hash ^ cycle) % TX_SLOT_COUNT;
+	uint8_t oldest = ctx->slot;
+
+	for(uint8_t i = 0; i < TX_SLOT_COUNT; i++) {
+		uint8_t slot = (start + i) % TX_SLOT_COUNT;
+
+		if(!slot_is_occupied(ctx, slot, cycle)) {
+			ctx->slot = slot;
+			return;
+		}
+
+		if(ctx->last_heard[slot] < ctx->last_heard[oldest]) {
+			oldest = slot;
+		}
+	}
+
+	// all slots are occupied: use the one that was free for the longest time
+	ctx->slot = oldest;
+}
+
+
+void tx_slot_init(tx_slot_t *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+
+void tx_slot_handle_rx(tx_slot_t *ctx, uint64_t start_unix_ms)
+{
+	// the clocks of sender and receiver differ slightly, so the transmission
+	// is assigned to the slot which starts closest to it
+	start_unix_ms += TX_SLOT_LENGTH_MS / 2;
+
+	uint32_t cycle = start_unix_ms / TX_SLOT_CYCLE_MS;
+	uint8_t  slot = (start_unix_ms % TX_SLOT_CYCLE_MS) / TX_SLOT_LENGTH_MS;
+
+	ctx->last_heard[slot] = cycle + 1;
+}
+
+
+uint32_t tx_slot_calc_delay_ms(tx_slot_t *ctx, const char *call, uint64_t unix_ms)
+{
+	uint32_t cycle = unix_ms / TX_SLOT_CYCLE_MS;
+	uint32_t phase = unix_ms % TX_SLOT_CYCLE_MS;
+
+	uint32_t call_hash = mix(fnv1a_update(FNV1A_INIT, (const uint8_t*)call, strlen(call)));
+
+	if(call_hash != ctx->call_hash) {
+		// new call sign: start with the slot derived from it
+		ctx->call_hash = call_hash;
+		ctx->slot = call_hash % TX_SLOT_COUNT;
+	}
+
+	if(slot_is_occupied(ctx, ctx->slot, cycle)) {
+		select_free_slot(ctx, cycle);
+	}
+
+	uint32_t slot_start = ctx->slot * TX_SLOT_LENGTH_MS;
+
+	if(phase <= slot_start) {
+		return slot_start - phase;
+	} else if(phase - slot_start <= TX_SLOT_MAX_LATE_MS) {
+		return 0;
+	} else {
+		// slot already passed in this cycle
+		return TX_SLOT_CYCLE_MS + slot_start - phase;
+	}
+}
+
+
+uint8_t tx_slot_get_slot(const tx_slot_t *ctx)
+{
+	return ctx->slot;
+}
@@ -0,0 +1,100 @@
+/*
+ * vim: noexpandtab
+ *
+ * Copyright (c) 2021-2022 Thomas Kolb <cfr34k-git@tkolb.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TX_SLOT_H
+#define TX_SLOT_H
+
+/**@file
+ *
+ * @brief GNSS-time-synchronized transmission slots.
+ *
+ * @details
+ * With SF12, a packet is on air for 1.5 to 3 seconds, so trackers that
+ * transmit at random times collide frequently. In slotted mode, the GNSS time
+ * is divided into cycles of @ref TX_SLOT_COUNT slots and a station may only
+ * start transmitting at the beginning of its own slot.
+ *
+ * The initial slot is derived from a hash of the call sign. As hashes of
+ * different call signs often end up in the same slot, the slots in which other
+ * stations were heard are remembered. If the own slot is used by another
+ * station, a different slot which was free recently is selected. This way,
+ * stations in range of each other settle on different slots.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// length of one slot. Must cover the longest packet plus the clock
+// uncertainty between stations.
+#define TX_SLOT_LENGTH_MS     3500 // milliseconds
+
+// number of slots per cycle
+#define TX_SLOT_COUNT           20
+
+#define TX_SLOT_CYCLE_MS  ((uint32_t)TX_SLOT_LENGTH_MS * TX_SLOT_COUNT)
+
+// a slot may still be used if it started at most this long ago
+#define TX_SLOT_MAX_LATE_MS    250 // milliseconds
+
+// a slot is considered occupied for this many cycles after another station
+// was heard in it
+#define TX_SLOT_OCCUPIED_CYCLES  10
+
+/**@brief State of the slot selection.
+ */
+typedef struct {
+	uint32_t call_hash;                    //!< Hash of the call sign the slot was selected for.
+	uint8_t  slot;                         //!< The currently used slot.
+	uint32_t last_heard[TX_SLOT_COUNT];    //!< Cycle number + 1 in which another station was last heard (0 = never).
+} tx_slot_t;
+
+/**@brief Reset the slot selection.
+ */
+void tx_slot_init(tx_slot_t *ctx);
+
+/**@brief Remember that another station transmitted at the given time.
+ *
+ * @param ctx            The slot selection state.
+ * @param start_unix_ms  UNIX time in milliseconds when the transmission began.
+ */
+void tx_slot_handle_rx(tx_slot_t *ctx, uint64_t start_unix_ms);
+
+/**@brief Calculate the time until the station’s next slot begins.
+ * @details
+ * If the current slot is occupied by another station, a new slot is selected
+ * first.
+ *
+ * @param ctx       The slot selection state.
+ * @param call      The station’s call sign, including the SSID.
+ * @param unix_ms   The current UNIX time in milliseconds.
+ * @returns         The delay in milliseconds. 0 if the slot has just begun.
+ */
+uint32_t tx_slot_calc_delay_ms(tx_slot_t *ctx, const char *call, uint64_t unix_ms);
+
+/**@brief Get the slot that is currently used.
+ */
+uint8_t tx_slot_get_slot(const tx_slot_t *ctx);
+
+#endif // TX_SLOT_H
@@ -55,6 +55,16 @@ float great_circle_distance_m(float lat1, float lon1, float lat2, float lon2)
 }
 
 
+void move_position(float *lat, float *lon, float heading_deg, float distance_m)
+{
+	float heading = heading_deg * (F_PI / 180.0f);
+	float dist_rad = distance_m / EARTH_RADIUS_M;
+
+	*lat += dist_rad * cosf(heading) * (180.0f / F_PI);
+	*lon += dist_rad * sinf(heading) / cosf(*lat * (F_PI / 180.0f)) * (180.0f / F_PI);
+}
+
+
 float direction_angle(float lat1, float lon1, float lat2, float lon2)
 {
 	// convert to radians
@@ -78,6 +88,108 @@ float direction_angle(float lat1, float lon1, float lat2, float lon2)
 }
 
 
+uint16_t crc16_ccitt(const uint8_t *data, size_t len)
+{
+	uint16_t crc = 0xFFFF;
+
+	for(size_t i = 0; i < len; i++) {
+		crc ^= (uint16_t)data[i] << 8;
+
+		for(uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+
+void put_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+
+void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+
+uint16_t get_u16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+uint32_t fnv1a_update(uint32_t hash, const uint8_t *data, size_t len)
+{
+	for(size_t i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+
+size_t put_varint(uint8_t *p, uint64_t v)
+{
+	size_t len = 0;
+
+	while(v >= 0x80) {
+		p[len++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+
+	p[len++] = v;
+	return len;
+}
+
+
+bool get_varint(const uint8_t *data, size_t len, size_t *pos, uint32_t *v)
+{
+	*v = 0;
+
+	for(uint8_t shift = 0; shift < 35; shift += 7) {
+		if(*pos >= len) {
+			return false;
+		}
+
+		uint8_t byte = data[(*pos)++];
+		*v |= (uint32_t)(byte & 0x7F) << shift;
+
+		if(byte < 0x80) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+
+int32_t unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+
 void format_float(char *s, size_t s_len, float f, uint8_t decimals)
 {
 	char fmt[32];
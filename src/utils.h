@@ -26,6 +26,7 @@
 #define UTILS_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 /**@brief Calculate the great-circle distance between two coordinates.
@@ -44,6 +45,19 @@
  */
 float great_circle_distance_m(float lat1, float lon1, float lat2, float lon2);
 
+/**@brief Move a coordinate by the given distance in the given direction.
+ *
+ * @details
+ * A flat earth is assumed, so this is only precise for distances up to a few
+ * kilometers.
+ *
+ * @param[inout] lat          Latitude of the point.
+ * @param[inout] lon          Longitude of the point.
+ * @param[in]    heading_deg  Direction in degrees from north.
+ * @param[in]    distance_m   Distance in meters.
+ */
+void move_position(float *lat, float *lon, float heading_deg, float distance_m);
+
 /**@brief Calculate the direction angle from coordinate 1 to coordinate 2.
  *
  * Formula from https://en.wikipedia.org/wiki/Great-circle_navigation .
@@ -58,6 +72,74 @@ float great_circle_distance_m(float lat1, float lon1, float lat2, float lon2);
 float direction_angle(float lat1, float lon1, float lat2, float lon2);
 
 
+/**@brief Calculate the CRC-16/CCITT-FALSE (polynomial 0x1021, start 0xFFFF).
+ *
+ * @param data    The data.
+ * @param len     Length of the data.
+ *
+ * @returns The checksum.
+ */
+uint16_t crc16_ccitt(const uint8_t *data, size_t len);
+
+/**@brief Store a 16 bit value in little endian byte order.
+ */
+void put_u16(uint8_t *p, uint16_t v);
+
+/**@brief Store a 32 bit value in little endian byte order.
+ */
+void put_u32(uint8_t *p, uint32_t v);
+
+/**@brief Read a 16 bit value in little endian byte order.
+ */
+uint16_t get_u16(const uint8_t *p);
+
+/**@brief Read a 32 bit value in little endian byte order.
+ */
+uint32_t get_u32(const uint8_t *p);
+
+
+// start value of the FNV-1a hash (offset basis)
+#define FNV1A_INIT  2166136261UL
+
+/**@brief Add data to a 32 bit FNV-1a hash.
+ *
+ * @param hash    The hash so far, @ref FNV1A_INIT for new hashes.
+ * @param data    The data.
+ * @param len     Length of the data.
+ *
+ * @returns The updated hash.
+ */
+uint32_t fnv1a_update(uint32_t hash, const uint8_t *data, size_t len);
+
+/**@brief Write an unsigned LEB128 varint (7 bits per byte, LSB first).
+ *
+ * @param[out] p    Output buffer (up to 10 bytes).
+ * @param[in]  v    The value.
+ *
+ * @returns The number of bytes written.
+ */
+size_t put_varint(uint8_t *p, uint64_t v);
+
+/**@brief Read a 32 bit unsigned LEB128 varint.
+ *
+ * @param[in]    data  The input data.
+ * @param[in]    len   Length of the input data.
+ * @param[inout] pos   Read position, advanced behind the varint.
+ * @param[out]   v     The value.
+ *
+ * @returns False if the varint is truncated or longer than 5 bytes.
+ */
+bool get_varint(const uint8_t *data, size_t len, size_t *pos, uint32_t *v);
+
+/**@brief Map a signed value to an unsigned one so small magnitudes stay small.
+ */
+uint32_t zigzag(int32_t v);
+
+/**@brief Reverse @ref zigzag().
+ */
+int32_t unzigzag(uint32_t v);
+
+
 /**@brief Format the given floating point number into a string.
  *
  * This function is a workaround for systems where there is no floating point
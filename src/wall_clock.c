@@ -26,7 +26,7 @@
 
 #include "wall_clock.h"
 
-#include "aprs.h"
+#include "station_db.h"
 
 static uint64_t m_unix_time_ref;
 static uint64_t m_time_base_ref;
@@ -58,6 +58,12 @@ uint64_t wall_clock_get_unix(void)
 }
 
 
+uint64_t wall_clock_get_unix_ms(void)
+{
+	return m_unix_time_ref * 1000 + (time_base_get() - m_time_base_ref);
+}
+
+
 void wall_clock_get_utc(struct tm *time)
 {
 	time_t unix_time = wall_clock_get_unix();
@@ -96,6 +102,6 @@ void wall_clock_set_from_gnss(const nmea_datetime_t *datetime)
 	if (unix_time > UNIX_MIN_VALID_EPOCH) {
 		m_time_is_valid = true;
 
-		aprs_rx_history_fix_timestamp(unix_time);
+		station_db_fix_timestamp(unix_time);
 	}
 }
@@ -59,6 +59,15 @@ void wall_clock_init(void);
  */
 uint64_t wall_clock_get_unix(void);
 
+/**@brief Returns the current UNIX time in milliseconds.
+ * @details
+ * The clock is set from the NMEA timestamps, so the sub-second part lags
+ * behind the real time by the GNSS module’s output delay.
+ *
+ * @returns   The UNIX time in milliseconds.
+ */
+uint64_t wall_clock_get_unix_ms(void);
+
 /**@brief Returns the current UTC.
  * @details
  * If the clock has never been set, it starts counting at 1970-01-01 00:00:00 UTC.
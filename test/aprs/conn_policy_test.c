@@ -0,0 +1,222 @@
+/*
+ * Host test for the BLE connection parameter policy.
+ *
+ * Checks the state machine and simulates one hour of a connection with a
+ * settings dump after connecting and a burst of received messages. The
+ * number of connection events of the peripheral is compared to the fixed
+ * parameters used before (100 to 200 ms, no slave latency).
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../src/conn_policy.h"
+
+#define SIM_DURATION_MS  3600000ULL // one hour
+
+// previously used fixed parameters
+#define FIXED_INTERVAL_MS  150.0
+
+static void test_parameters(void)
+{
+	// the supervision timeout must be longer than the time the peripheral
+	// may skip (Bluetooth Core Specification)
+	assert(CONN_POLICY_IDLE_SUP_TIMEOUT_MS
+			> 2 * (1 + CONN_POLICY_IDLE_SLAVE_LATENCY) * CONN_POLICY_IDLE_MAX_INTERVAL_MS);
+	assert(CONN_POLICY_BULK_SUP_TIMEOUT_MS
+			> 2 * (1 + CONN_POLICY_BULK_SLAVE_LATENCY) * CONN_POLICY_BULK_MAX_INTERVAL_MS);
+
+	// Apple accessory design guidelines
+	assert(CONN_POLICY_BULK_MIN_INTERVAL_MS >= 15);
+	assert(CONN_POLICY_IDLE_MAX_INTERVAL_MS * (1 + CONN_POLICY_IDLE_SLAVE_LATENCY) <= 6000);
+	assert(CONN_POLICY_IDLE_SUP_TIMEOUT_MS <= 6000);
+	assert(CONN_POLICY_IDLE_MIN_INTERVAL_MS + 15 <= CONN_POLICY_IDLE_MAX_INTERVAL_MS);
+	assert(CONN_POLICY_BULK_MIN_INTERVAL_MS + 15 <= CONN_POLICY_BULK_MAX_INTERVAL_MS);
+}
+
+
+static void test_state_machine(void)
+{
+	conn_policy_action_t action;
+	conn_policy_stats_t stats;
+	uint64_t now = 1000;
+
+	conn_policy_init();
+
+	// nothing to do while disconnected
+	conn_policy_handle_activity(now);
+	assert(!conn_policy_poll(now, &action));
+	assert(conn_policy_get_next_time(now) == CONN_POLICY_NEVER);
+
+	// bulk mode with 2M PHY after connecting
+	conn_policy_handle_connected(now);
+	assert(conn_policy_is_connected());
+	assert(conn_policy_get_next_time(now) == now);
+	assert(conn_policy_poll(now, &action));
+	assert(action.mode == CONN_POLICY_MODE_BULK);
+	assert(action.request_2m_phy);
+
+	// the stack is busy: retry later
+	conn_policy_handle_request_result(now, &action, false);
+	assert(!conn_policy_poll(now + CONN_POLICY_RETRY_MS - 1, &action));
+	assert(conn_policy_get_next_time(now) == now + CONN_POLICY_RETRY_MS);
+
+	now += CONN_POLICY_RETRY_MS;
+	assert(conn_policy_poll(now, &action));
+	conn_policy_handle_request_result(now, &action, true);
+	assert(!conn_policy_poll(now, &action));
+
+	// idle after the connect period
+	uint64_t bulk_end = 1000 + CONN_POLICY_CONNECT_BULK_MS;
+	assert(conn_policy_get_next_time(now) == bulk_end);
+	assert(conn_policy_get_target_mode(bulk_end - 1) == CONN_POLICY_MODE_BULK);
+
+	now = bulk_end;
+	assert(conn_policy_poll(now, &action));
+	assert(action.mode == CONN_POLICY_MODE_IDLE);
+	assert(!action.request_2m_phy);
+	conn_policy_handle_request_result(now, &action, true);
+	assert(conn_policy_get_next_time(now) == CONN_POLICY_NEVER);
+
+	// activity shortly after an update: rate limited
+	conn_policy_handle_activity(now + 100);
+	assert(!conn_policy_poll(now + 100, &action));
+	assert(conn_policy_get_next_time(now + 100) == now + CONN_POLICY_MIN_UPDATE_INTERVAL_MS);
+
+	now += CONN_POLICY_MIN_UPDATE_INTERVAL_MS;
+	assert(conn_policy_poll(now, &action));
+	assert(action.mode == CONN_POLICY_MODE_BULK);
+	assert(!action.request_2m_phy); // already requested on this connection
+	conn_policy_handle_request_result(now, &action, true);
+
+	// continuous activity keeps bulk mode
+	for(int i = 0; i < 10; i++) {
+		now += CONN_POLICY_BULK_HOLDOFF_MS / 2;
+		conn_policy_handle_activity(now);
+		assert(!conn_policy_poll(now, &action));
+	}
+
+	now += CONN_POLICY_BULK_HOLDOFF_MS;
+	assert(conn_policy_poll(now, &action));
+	assert(action.mode == CONN_POLICY_MODE_IDLE);
+	conn_policy_handle_request_result(now, &action, true);
+
+	// the client rejects the idle parameters: not repeated
+	conn_policy_handle_rejected();
+	assert(!conn_policy_poll(now + 60000, &action));
+
+	// a new connection starts over, including the PHY
+	conn_policy_handle_disconnected();
+	assert(!conn_policy_poll(now, &action));
+
+	conn_policy_handle_connected(now);
+	assert(conn_policy_poll(now, &action));
+	assert(action.request_2m_phy);
+
+	conn_policy_get_stats(&stats);
+	assert(stats.bulk_periods == 3);
+	assert(stats.updates == 4);
+	assert(stats.rejected == 1);
+}
+
+
+typedef struct {
+	uint64_t start;
+	uint64_t duration;
+} activity_t;
+
+static double connection_events(conn_policy_mode_t mode, uint64_t duration_ms)
+{
+	// the central picks an interval in the middle of the range. While idle,
+	// the peripheral only listens every (latency + 1) events.
+	double interval, latency;
+
+	if(mode == CONN_POLICY_MODE_BULK) {
+		interval = (CONN_POLICY_BULK_MIN_INTERVAL_MS + CONN_POLICY_BULK_MAX_INTERVAL_MS) / 2.0;
+		latency = CONN_POLICY_BULK_SLAVE_LATENCY;
+	} else {
+		interval = (CONN_POLICY_IDLE_MIN_INTERVAL_MS + CONN_POLICY_IDLE_MAX_INTERVAL_MS) / 2.0;
+		latency = CONN_POLICY_IDLE_SLAVE_LATENCY;
+	}
+
+	return duration_ms / (interval * (latency + 1));
+}
+
+
+static void test_simulation(void)
+{
+	// settings dump after connecting, message bursts and a KISS session
+	static const activity_t activities[] = {
+		{2000, 8000},
+		{900000, 5000},
+		{1800000, 20000},
+		{2700000, 2000},
+	};
+
+	conn_policy_action_t action;
+	conn_policy_mode_t mode = CONN_POLICY_MODE_IDLE;  // chosen by the central
+	uint64_t mode_since = 0;
+	uint64_t bulk_time = 0;
+	double events = 0;
+
+	conn_policy_init();
+	conn_policy_handle_connected(0);
+
+	// step through the simulation in 100 ms steps; the policy is polled when
+	// it asks for it
+	for(uint64_t now = 0; now < SIM_DURATION_MS; now += 100) {
+		for(size_t i = 0; i < sizeof(activities) / sizeof(activities[0]); i++) {
+			if(now >= activities[i].start && now < activities[i].start + activities[i].duration) {
+				conn_policy_handle_activity(now);
+			}
+		}
+
+		if(conn_policy_get_next_time(now) <= now && conn_policy_poll(now, &action)) {
+			conn_policy_handle_request_result(now, &action, true);
+
+			events += connection_events(mode, now - mode_since);
+
+			if(mode == CONN_POLICY_MODE_BULK) {
+				bulk_time += now - mode_since;
+			}
+
+			mode = action.mode;
+			mode_since = now;
+		}
+
+		// bulk transfers must run with the short interval, apart from the
+		// time until the first request
+		for(size_t i = 0; i < sizeof(activities) / sizeof(activities[0]); i++) {
+			if(now >= activities[i].start + CONN_POLICY_MIN_UPDATE_INTERVAL_MS
+					&& now < activities[i].start + activities[i].duration) {
+				assert(mode == CONN_POLICY_MODE_BULK);
+			}
+		}
+	}
+
+	events += connection_events(mode, SIM_DURATION_MS - mode_since);
+
+	double fixed_events = SIM_DURATION_MS / FIXED_INTERVAL_MS;
+
+	conn_policy_stats_t stats;
+	conn_policy_get_stats(&stats);
+
+	printf("connection events per hour: %.0f fixed, %.0f adaptive (%.1f %%), %.0f s in bulk mode, %u updates\n",
+			fixed_events, events, 100.0 * events / fixed_events, bulk_time / 1000.0, stats.updates);
+
+	assert(events < fixed_events / 5);
+	assert(stats.updates <= 2 * 5);
+}
+
+
+int main(void)
+{
+	test_parameters();
+	test_state_machine();
+	test_simulation();
+
+	printf("connection policy checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * Host test for the fill-in digipeater.
+ *
+ * Replays a log of received frames through the duplicate cache and the
+ * digipeater and compares the transmitted frames and their timing with the
+ * expected output. A simulated radio can only send one frame at a time and
+ * reports each transmission to the airtime budget.
+ *
+ * Usage: digipeater_test <rx log> <expected tx log>
+ *        digipeater_test <rx log>   (print the transmitted frames)
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/airtime.h"
+#include "../../src/dupe_cache.h"
+#include "../../src/digipeater.h"
+
+#define MYCALL "DB0TST"
+
+#define MAX_LOG_ENTRIES 256
+#define MAX_LINE_LEN    300
+
+// the holdoff is selected from these values in turn
+static const uint32_t RANDOM_VALUES[] = {0, 1000, 2000, 3000, 4000};
+
+typedef struct
+{
+	uint64_t time;
+	uint8_t  data[DIGIPEATER_MAX_FRAME_LEN];
+	size_t   len;
+} log_entry_t;
+
+static log_entry_t m_rx_log[MAX_LOG_ENTRIES];
+static size_t      m_rx_count;
+
+static char   m_tx_lines[MAX_LOG_ENTRIES][MAX_LINE_LEN];
+static size_t m_tx_count;
+
+
+static size_t add_header(const char *text, uint8_t *out)
+{
+	size_t len = strlen(text);
+
+	out[0] = '<';
+	out[1] = 0xFF;
+	out[2] = 0x01;
+	memcpy(out + 3, text, len);
+
+	return len + 3;
+}
+
+
+static size_t rewrite(const char *text, char *result)
+{
+	uint8_t frame[DIGIPEATER_MAX_FRAME_LEN];
+	uint8_t out[DIGIPEATER_MAX_FRAME_LEN];
+
+	size_t out_len = digipeater_rewrite_path(frame, add_header(text, frame), MYCALL, out);
+
+	if(out_len > 0) {
+		memcpy(result, out + 3, out_len - 3);
+		result[out_len - 3] = '\0';
+	}
+
+	return out_len;
+}
+
+
+static void test_rewrite(void)
+{
+	char result[DIGIPEATER_MAX_FRAME_LEN];
+
+	assert(rewrite("DL1ABC>APLETK,WIDE1-1:>x", result) > 0);
+	assert(strcmp(result, "DL1ABC>APLETK,DB0TST*:>x") == 0);
+
+	assert(rewrite("DL1ABC>APLETK,WIDE1-1,WIDE2-1:>x", result) > 0);
+	assert(strcmp(result, "DL1ABC>APLETK,DB0TST*,WIDE2-1:>x") == 0);
+
+	// only the last used element keeps the marker
+	assert(rewrite("DL1ABC>APLETK,DB0ABC*,WIDE1-1:>x", result) > 0);
+	assert(strcmp(result, "DL1ABC>APLETK,DB0ABC,DB0TST*:>x") == 0);
+
+	assert(rewrite("DL1ABC>APLETK,DB0TST:>x:y", result) > 0);
+	assert(strcmp(result, "DL1ABC>APLETK,DB0TST*:>x:y") == 0);
+
+	assert(rewrite("DL1ABC>APLETK,WIDE1*:>x", result) == 0);
+	assert(rewrite("DL1ABC>APLETK,WIDE2-1:>x", result) == 0);
+	assert(rewrite("DL1ABC>APLETK:>x", result) == 0);
+	assert(rewrite("DL1ABC>APLETK,:>x", result) == 0);
+	assert(rewrite("DB0TST>APLETK,WIDE1-1:>x", result) == 0);
+	assert(rewrite("DL1ABC>APLETK,DB0TST,WIDE1*:>x", result) == 0);
+	assert(rewrite("DL1ABC>APLETK,WIDE1-1", result) == 0);
+	assert(rewrite("garbage", result) == 0);
+
+	// frames without LoRa-APRS header are not repeated
+	uint8_t out[DIGIPEATER_MAX_FRAME_LEN];
+	const char *plain = "DL1ABC>APLETK,WIDE1-1:>x";
+	assert(digipeater_rewrite_path((const uint8_t*)plain, strlen(plain), MYCALL, out) == 0);
+
+	// the repeated frame must fit into a LoRa packet
+	uint8_t frame[DIGIPEATER_MAX_FRAME_LEN];
+	char long_frame[300];
+	snprintf(long_frame, sizeof(long_frame), "DL1ABC>APLETK,WIDE1-1:>%0*d", 253 - 3 - 23, 0);
+	size_t len = add_header(long_frame, frame);
+	assert(len == 253);
+	assert(digipeater_rewrite_path(frame, len, "DB0TST-10", out) == 0);
+	assert(digipeater_rewrite_path(frame, len - 1, "DB0TST-10", out) == DIGIPEATER_MAX_FRAME_LEN);
+}
+
+
+static void read_log(const char *filename)
+{
+	char line[MAX_LINE_LEN];
+
+	FILE *f = fopen(filename, "r");
+	if(!f) {
+		perror(filename);
+		exit(1);
+	}
+
+	while(fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if(line[0] == '#' || line[0] == '\0') {
+			continue;
+		}
+
+		char *frame = strchr(line, ' ');
+		assert(frame && m_rx_count < MAX_LOG_ENTRIES);
+
+		log_entry_t *entry = &m_rx_log[m_rx_count++];
+		entry->time = strtoull(line, NULL, 10);
+		entry->len = add_header(frame + 1, entry->data);
+	}
+
+	fclose(f);
+}
+
+
+static void replay(void)
+{
+	size_t next_rx = 0;
+	size_t next_random = 0;
+	uint64_t radio_busy_until = 0;
+
+	uint64_t end = m_rx_log[m_rx_count - 1].time + 2 * DIGIPEATER_HOLDOFF_MAX_MS;
+
+	for(uint64_t now = 0; now < end; now++) {
+		while(next_rx < m_rx_count && m_rx_log[next_rx].time == now) {
+			log_entry_t *entry = &m_rx_log[next_rx++];
+
+			if(dupe_cache_check_and_insert(entry->data, entry->len, now)) {
+				digipeater_handle_duplicate(entry->data, entry->len);
+			} else {
+				digipeater_handle_rx(entry->data, entry->len, MYCALL, now,
+						RANDOM_VALUES[next_random++ % (sizeof(RANDOM_VALUES) / sizeof(RANDOM_VALUES[0]))]);
+			}
+		}
+
+		if(now < radio_busy_until || digipeater_get_next_due_time() > now) {
+			continue;
+		}
+
+		uint8_t frame[DIGIPEATER_MAX_FRAME_LEN];
+		uint8_t len;
+
+		if(digipeater_get_due_frame(now, frame, &len)) {
+			uint32_t toa = airtime_calc_toa_ms(len);
+
+			airtime_record(now, toa);
+			radio_busy_until = now + toa;
+
+			assert(airtime_get_used_ms(now) <= AIRTIME_WINDOW_MS * AIRTIME_BUDGET_PERCENT / 100);
+
+			assert(m_tx_count < MAX_LOG_ENTRIES);
+			snprintf(m_tx_lines[m_tx_count++], MAX_LINE_LEN, "%llu %.*s",
+					(unsigned long long)now, len - 3, frame + 3);
+		}
+	}
+}
+
+
+static int compare_with_expected(const char *filename)
+{
+	char line[MAX_LINE_LEN];
+	size_t n = 0;
+	int errors = 0;
+
+	FILE *f = fopen(filename, "r");
+	if(!f) {
+		perror(filename);
+		return 1;
+	}
+
+	while(fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if(line[0] == '#' || line[0] == '\0') {
+			continue;
+		}
+
+		if(n >= m_tx_count) {
+			fprintf(stderr, "missing:  %s\n", line);
+			errors++;
+		} else if(strcmp(line, m_tx_lines[n]) != 0) {
+			fprintf(stderr, "expected: %s\ngot:      %s\n", line, m_tx_lines[n]);
+			errors++;
+		}
+
+		n++;
+	}
+
+	for(; n < m_tx_count; n++) {
+		fprintf(stderr, "unexpected: %s\n", m_tx_lines[n]);
+		errors++;
+	}
+
+	fclose(f);
+
+	return errors;
+}
+
+
+int main(int argc, char **argv)
+{
+	if(argc < 2) {
+		fprintf(stderr, "usage: %s <rx log> [<expected tx log>]\n", argv[0]);
+		return 1;
+	}
+
+	airtime_init();
+	dupe_cache_init();
+	digipeater_init();
+
+	test_rewrite();
+
+	read_log(argv[1]);
+	replay();
+
+	if(argc < 3) {
+		for(size_t i = 0; i < m_tx_count; i++) {
+			printf("%s\n", m_tx_lines[i]);
+		}
+		return 0;
+	}
+
+	const digipeater_stats_t *stats = digipeater_get_stats();
+
+	printf("digipeater: %u queued, %u repeated, %u cancelled, %u dropped (queue full), %u dropped (airtime)\n",
+			stats->queued, stats->repeated, stats->cancelled,
+			stats->dropped_queue_full, stats->dropped_airtime);
+
+	assert(stats->repeated == m_tx_count);
+	assert(stats->queued == stats->repeated + stats->cancelled + stats->dropped_airtime);
+
+	int errors = compare_with_expected(argv[2]);
+	if(errors) {
+		fprintf(stderr, "%d mismatches in the transmitted frames\n", errors);
+		return 1;
+	}
+
+	printf("digipeater checks passed\n");
+
+	return 0;
+}
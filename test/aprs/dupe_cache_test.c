@@ -0,0 +1,55 @@
+/*
+ * Host test for the duplicate packet cache.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../src/dupe_cache.h"
+
+static bool check(const char *frame, uint64_t now)
+{
+	return dupe_cache_check_and_insert((const uint8_t*)frame, strlen(frame), now);
+}
+
+int main(void)
+{
+	char call[10];
+
+	dupe_cache_init();
+
+	// the original frame and its digipeated copies
+	assert(!check("<\xff\x01" "DL1ABC-7>APLETK,WIDE1-1:!4900.00N/00824.00E>test", 1000));
+	assert(check("<\xff\x01" "DL1ABC-7>APLETK,DB0ABC*,WIDE1*:!4900.00N/00824.00E>test", 3000));
+	assert(check("<\xff\x01" "DL1ABC-7>APLETK,DB0XYZ-10*:!4900.00N/00824.00E>test", 5000));
+	assert(dupe_cache_get_duplicate_count() == 2);
+
+	// different content or source are not duplicates
+	assert(!check("<\xff\x01" "DL1ABC-7>APLETK,WIDE1-1:!4900.01N/00824.00E>test", 6000));
+	assert(!check("<\xff\x01" "DL1ABC-9>APLETK,WIDE1-1:!4900.00N/00824.00E>test", 6000));
+
+	// a repeated beacon after the time window is not a duplicate
+	assert(!check("<\xff\x01" "DL1ABC-7>APLETK,WIDE1-1:!4900.00N/00824.00E>test", 1000 + DUPE_CACHE_WINDOW_MS));
+	assert(dupe_cache_get_duplicate_count() == 2);
+
+	// frames without LoRa header or without information field are hashed completely
+	assert(!check("garbage", 40000));
+	assert(check("garbage", 40001));
+
+	// the oldest entries are replaced when the cache is full
+	char frame[64];
+	for(int i = 0; i < DUPE_CACHE_SIZE; i++) {
+		snprintf(frame, sizeof(frame), "N0CALL-%d>APRS:>status", i);
+		assert(!check(frame, 50000));
+	}
+	assert(!check("garbage", 50001));
+
+	assert(dupe_cache_get_source((const uint8_t*)"<\xff\x01" "DL1ABC-7>APLETK:x", 17, call, sizeof(call)));
+	assert(strcmp(call, "DL1ABC-7") == 0);
+	assert(!dupe_cache_get_source((const uint8_t*)"garbage", 7, call, sizeof(call)));
+
+	printf("dupe cache checks passed\n");
+
+	return 0;
+}
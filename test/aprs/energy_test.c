@@ -0,0 +1,298 @@
+/*
+ * Host test for the energy accounting.
+ *
+ * Drives the module with a fake clock and power state sequences like the
+ * ones generated by periph_pwr.c and checks the accumulated times, the charge
+ * estimation and the BLE encoding.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../src/energy.h"
+
+// periph_pwr.h cannot be included here (SDK dependencies)
+#define ACT_CONNECTED  (1 << ENERGY_ACTIVITY_CONNECTED)
+#define ACT_EPAPER     (1 << ENERGY_ACTIVITY_EPAPER)
+#define ACT_GPS        (1 << ENERGY_ACTIVITY_GPS)
+#define ACT_LORA       (1 << ENERGY_ACTIVITY_LORA)
+#define ACT_BME280     (1 << 7)
+#define ACT_FLASH      (1 << 8)
+
+#define RAIL_3V3       (1 << 0)
+#define RAIL_PWR_ON    (1 << 1)
+
+#define HOUR_MS  3600000ULL
+
+#define TX_LEVEL_22_DBM  0
+#define TX_LEVEL_10_DBM  4
+
+static void expect_near(const char *what, float value, float expected)
+{
+	if(fabsf(value - expected) > 0.001f + 1e-5f * fabsf(expected)) {
+		fprintf(stderr, "%s: expected %.4f, got %.4f\n", what, expected, value);
+		assert(false);
+	}
+}
+
+
+static float model_mah(uint16_t current, uint64_t duration_ms)
+{
+	return current * 0.01f * duration_ms / HOUR_MS;
+}
+
+
+static void test_gnss(void)
+{
+	energy_model_t model;
+	energy_stats_t stats;
+	uint64_t now = 1000;
+
+	energy_init(now);
+	energy_get_model(&model);
+
+	// one hour of tracking, the second half in standby
+	energy_update(now, ACT_GPS, RAIL_3V3 | RAIL_PWR_ON);
+
+	now += HOUR_MS / 2;
+	energy_set_gps_standby(now, true);
+
+	now += HOUR_MS / 2;
+	energy_set_gps_standby(now, false);
+	energy_update(now, 0, 0);
+
+	// nothing is running for another hour
+	now += HOUR_MS;
+
+	energy_get_stats(now, &stats);
+
+	assert(stats.total_ms == 2 * HOUR_MS);
+	assert(stats.activity_ms[ENERGY_ACTIVITY_GPS] == HOUR_MS);
+	assert(stats.rail_ms[0] == HOUR_MS);
+	assert(stats.rail_ms[1] == HOUR_MS);
+	assert(stats.gps_standby_ms == HOUR_MS / 2);
+
+	expect_near("GNSS", stats.consumer_mah[ENERGY_CONSUMER_GNSS],
+			model_mah(model.activity[ENERGY_ACTIVITY_GPS], HOUR_MS / 2)
+			+ model_mah(model.gps_standby, HOUR_MS / 2));
+
+	expect_near("base", stats.consumer_mah[ENERGY_CONSUMER_BASE],
+			model_mah(model.base, 2 * HOUR_MS)
+			+ model_mah(model.rail[0], HOUR_MS)
+			+ model_mah(model.rail[1], HOUR_MS));
+
+	expect_near("total", stats.total_mah,
+			stats.consumer_mah[ENERGY_CONSUMER_GNSS] + stats.consumer_mah[ENERGY_CONSUMER_BASE]);
+	expect_near("average", stats.avg_current_ma, stats.total_mah / 2.0f);
+
+	// a standby request while the GNSS is off does not count
+	energy_set_gps_standby(now, true);
+	now += HOUR_MS;
+	energy_get_stats(now, &stats);
+	assert(stats.gps_standby_ms == HOUR_MS / 2);
+}
+
+
+static void test_lora(void)
+{
+	energy_model_t model;
+	energy_stats_t stats;
+	uint64_t now = 0;
+
+	energy_init(now);
+	energy_get_model(&model);
+
+	// RX for one hour with some transmissions in between
+	energy_update(now, ACT_LORA, RAIL_3V3);
+
+	for(int i = 0; i < 60; i++) {
+		now += 60000;
+		energy_record_tx((i % 2) ? TX_LEVEL_22_DBM : TX_LEVEL_10_DBM, 500);
+	}
+
+	energy_update(now, 0, 0);
+
+	// invalid power levels are ignored
+	energy_record_tx(ENERGY_NUM_TX_LEVELS, 1000);
+
+	energy_get_stats(now, &stats);
+
+	assert(stats.activity_ms[ENERGY_ACTIVITY_LORA] == HOUR_MS);
+	assert(stats.tx_ms[TX_LEVEL_22_DBM] == 15000);
+	assert(stats.tx_ms[TX_LEVEL_10_DBM] == 15000);
+
+	expect_near("LoRa TX", stats.consumer_mah[ENERGY_CONSUMER_LORA_TX],
+			model_mah(model.tx[TX_LEVEL_22_DBM], 15000)
+			+ model_mah(model.tx[TX_LEVEL_10_DBM], 15000));
+
+	// the transmission time is not counted as RX time
+	expect_near("LoRa RX", stats.consumer_mah[ENERGY_CONSUMER_LORA_RX],
+			model_mah(model.activity[ENERGY_ACTIVITY_LORA], HOUR_MS - 30000));
+
+	// a transmission that was just started does not make the RX time negative
+	energy_init(now);
+	energy_update(now, ACT_LORA, RAIL_3V3);
+	energy_record_tx(TX_LEVEL_22_DBM, 500);
+	energy_get_stats(now + 100, &stats);
+	assert(stats.consumer_mah[ENERGY_CONSUMER_LORA_RX] == 0.0f);
+}
+
+
+static void test_model(void)
+{
+	energy_model_t model;
+	energy_stats_t stats;
+	uint64_t now = 0;
+
+	energy_init(now);
+
+	// e-paper update and sensor readout overlap
+	energy_update(now, ACT_EPAPER, RAIL_3V3 | RAIL_PWR_ON);
+	now += 2000;
+	energy_update(now, ACT_EPAPER | ACT_BME280, RAIL_3V3 | RAIL_PWR_ON);
+	now += 500;
+	// track log write during the sensor readout
+	energy_update(now, ACT_BME280 | ACT_FLASH, RAIL_3V3 | RAIL_PWR_ON);
+	now += 500;
+	energy_update(now, ACT_CONNECTED, 0);
+	now += HOUR_MS;
+
+	energy_get_stats(now, &stats);
+	assert(stats.activity_ms[ENERGY_ACTIVITY_EPAPER] == 2500);
+	assert(stats.activity_ms[7] == 1000);
+	assert(stats.activity_ms[8] == 500);
+	assert(stats.activity_ms[ENERGY_ACTIVITY_CONNECTED] == HOUR_MS);
+
+	// a new model applies to the whole time since startup
+	memset(&model, 0, sizeof(model));
+	model.activity[ENERGY_ACTIVITY_EPAPER] = 360 * 100;  // 360 mA
+	model.activity[7] = 360 * 100;                       // 360 mA
+	model.activity[8] = 360 * 100;                       // 360 mA
+	model.activity[ENERGY_ACTIVITY_CONNECTED] = 100;     // 1 mA
+	energy_set_model(&model);
+
+	energy_get_stats(now, &stats);
+	expect_near("display", stats.consumer_mah[ENERGY_CONSUMER_DISPLAY], 0.25f);
+	expect_near("other", stats.consumer_mah[ENERGY_CONSUMER_OTHER], 0.15f);
+	expect_near("base", stats.consumer_mah[ENERGY_CONSUMER_BASE], 1.0f);
+
+	energy_get_default_model(&model);
+	energy_set_model(&model);
+	energy_get_model(&model);
+	assert(model.activity[ENERGY_ACTIVITY_GPS] != 0);
+
+	// the settings contain the model as-is
+	assert(sizeof(energy_model_t) == ENERGY_MODEL_LEN);
+}
+
+
+static uint32_t decode_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static void test_encoding(void)
+{
+	uint8_t buf[ENERGY_ENCODED_STATS_LEN];
+	energy_stats_t stats;
+	uint64_t now = 0;
+
+	energy_init(now);
+	energy_update(now, ACT_GPS, RAIL_3V3 | RAIL_PWR_ON);
+	energy_record_tx(TX_LEVEL_22_DBM, 1234);
+	now += 7200500;
+
+	energy_get_stats(now, &stats);
+
+	size_t len = energy_encode_stats(buf, now);
+	assert(len == ENERGY_ENCODED_STATS_LEN);
+
+	const uint8_t *p = buf;
+
+	assert(decode_u32(p) == 7200); p += 4;
+	assert(decode_u32(p) == (uint32_t)(stats.total_mah * 1000.0f + 0.5f)); p += 4;
+
+	for(int i = 0; i < ENERGY_NUM_CONSUMERS; i++) {
+		assert(decode_u32(p) == (uint32_t)(stats.consumer_mah[i] * 1000.0f + 0.5f)); p += 4;
+	}
+
+	for(int i = 0; i < ENERGY_NUM_ACTIVITIES; i++) {
+		assert(decode_u32(p) == ((i == ENERGY_ACTIVITY_GPS) ? 7200 : 0)); p += 4;
+	}
+
+	assert(decode_u32(p) == 7200); p += 4;
+	assert(decode_u32(p) == 7200); p += 4;
+	assert(decode_u32(p) == 0); p += 4;
+
+	for(int i = 0; i < ENERGY_NUM_TX_LEVELS; i++) {
+		assert(decode_u32(p) == ((i == TX_LEVEL_22_DBM) ? 1234 : 0)); p += 4;
+	}
+
+	assert(p == buf + len);
+}
+
+
+/* A week of tracking with GNSS standby phases and a report every two
+ * minutes. The fake clock advances in small steps, like the real firmware
+ * would update the state, to check that nothing is lost to rounding. */
+static void test_long_run(void)
+{
+	energy_model_t model;
+	energy_stats_t stats;
+	uint64_t now = 0;
+	uint64_t tx_count = 0;
+
+	energy_init(now);
+	energy_get_model(&model);
+
+	uint64_t end = 7 * 24 * HOUR_MS;
+
+	while(now < end) {
+		// 40 s tracking, 80 s standby, TX of 800 ms at the end of each cycle
+		energy_update(now, ACT_GPS | ACT_LORA, RAIL_3V3 | RAIL_PWR_ON);
+		now += 40000;
+		energy_set_gps_standby(now, true);
+		now += 80000;
+		energy_set_gps_standby(now, false);
+		energy_record_tx(TX_LEVEL_22_DBM, 800);
+		tx_count++;
+	}
+
+	energy_get_stats(now, &stats);
+
+	assert(stats.total_ms == end);
+	assert(stats.activity_ms[ENERGY_ACTIVITY_GPS] == end);
+	assert(stats.gps_standby_ms == end * 2 / 3);
+	assert(stats.tx_ms[TX_LEVEL_22_DBM] == tx_count * 800);
+
+	float expected_ma = model.base * 0.01f
+		+ (model.rail[0] + model.rail[1]) * 0.01f
+		+ (model.activity[ENERGY_ACTIVITY_GPS] / 3.0f + model.gps_standby * 2.0f / 3.0f) * 0.01f
+		+ (model.activity[ENERGY_ACTIVITY_LORA] * (120000.0f - 800.0f) / 120000.0f) * 0.01f
+		+ (model.tx[TX_LEVEL_22_DBM] * 800.0f / 120000.0f) * 0.01f;
+
+	expect_near("average current", stats.avg_current_ma, expected_ma);
+
+	printf("1 week: %.1f mAh, %.2f mA average (GNSS %.1f, RX %.1f, TX %.1f mAh)\n",
+			stats.total_mah, stats.avg_current_ma,
+			stats.consumer_mah[ENERGY_CONSUMER_GNSS],
+			stats.consumer_mah[ENERGY_CONSUMER_LORA_RX],
+			stats.consumer_mah[ENERGY_CONSUMER_LORA_TX]);
+}
+
+
+int main(void)
+{
+	test_gnss();
+	test_lora();
+	test_model();
+	test_encoding();
+	test_long_run();
+
+	printf("Energy accounting checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * Host test for the KISS codec and the AX.25 conversion.
+ *
+ * Checks known frames, feeds random data to the decoder and the converters
+ * (fuzzing), verifies that frames survive encoding and decoding for any
+ * chunk size and measures the throughput.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/kiss.h"
+#include "../../src/ax25.h"
+
+// notification length with the maximum ATT MTU
+#define CHUNK_LEN_MAX  244
+
+typedef struct {
+	uint8_t  data[KISS_MAX_FRAME_LEN];
+	size_t   len;
+	uint8_t  port;
+	uint8_t  command;
+	uint32_t count;
+} received_t;
+
+static uint32_t m_rand_state = 4711;
+
+static uint32_t test_random(void)
+{
+	m_rand_state = m_rand_state * 1103515245u + 12345u;
+	return m_rand_state >> 8;
+}
+
+
+static void cb_frame(uint8_t port, uint8_t command, const uint8_t *data, size_t len, void *context)
+{
+	received_t *rx = context;
+
+	assert(len <= KISS_MAX_FRAME_LEN);
+
+	memcpy(rx->data, data, len);
+	rx->len = len;
+	rx->port = port;
+	rx->command = command;
+	rx->count++;
+}
+
+
+static size_t encode_all(const uint8_t *data, size_t len, uint8_t port, uint8_t *out, size_t chunk_len)
+{
+	kiss_encoder_t enc;
+	size_t total = 0;
+	size_t n;
+
+	kiss_encoder_start(&enc, port, KISS_CMD_DATA, data, len);
+
+	while((n = kiss_encoder_read(&enc, out + total, chunk_len)) > 0) {
+		assert(n <= chunk_len);
+		total += n;
+	}
+
+	assert(!kiss_encoder_is_busy(&enc));
+
+	return total;
+}
+
+
+static void test_kiss_known(void)
+{
+	const uint8_t data[] = {0x01, KISS_FEND, 0x02, KISS_FESC, 0x03};
+	const uint8_t expected[] = {
+		KISS_FEND, 0x00, 0x01, KISS_FESC, KISS_TFEND, 0x02,
+		KISS_FESC, KISS_TFESC, 0x03, KISS_FEND};
+
+	uint8_t out[64];
+	kiss_decoder_t dec;
+	kiss_encoder_t enc;
+	received_t rx = {0};
+
+	kiss_encoder_init(&enc);
+	assert(!kiss_encoder_is_busy(&enc));
+	assert(kiss_encoder_read(&enc, out, sizeof(out)) == 0);
+
+	assert(encode_all(data, sizeof(data), 0, out, sizeof(out)) == sizeof(expected));
+	assert(memcmp(out, expected, sizeof(expected)) == 0);
+
+	// port 12 gives a command byte that must be escaped itself
+	size_t len = encode_all(data, 1, 12, out, sizeof(out));
+	assert(len == 5);
+	assert(out[1] == KISS_FESC && out[2] == KISS_TFEND);
+
+	kiss_decoder_init(&dec);
+	kiss_decoder_feed(&dec, expected, sizeof(expected), cb_frame, &rx);
+	assert(rx.count == 1);
+	assert(rx.port == 0 && rx.command == KISS_CMD_DATA);
+	assert(rx.len == sizeof(data) && memcmp(rx.data, data, sizeof(data)) == 0);
+
+	kiss_decoder_feed(&dec, out, len, cb_frame, &rx);
+	assert(rx.count == 2);
+	assert(rx.port == 12 && rx.len == 1);
+
+	// garbage before the first FEND, empty frames and back-to-back frames
+	kiss_decoder_init(&dec);
+	rx.count = 0;
+
+	const uint8_t stream[] = {
+		0x41, 0x42, KISS_FEND, KISS_FEND, KISS_FEND, 0x00, 0x55, KISS_FEND,
+		0x00, 0x66, KISS_FEND};
+	kiss_decoder_feed(&dec, stream, sizeof(stream), cb_frame, &rx);
+	assert(rx.count == 2);
+	assert(rx.len == 1 && rx.data[0] == 0x66);
+	assert(dec.errors == 0);
+
+	// invalid escape sequence: the frame is dropped, the next one is fine
+	const uint8_t bad_escape[] = {
+		KISS_FEND, 0x00, KISS_FESC, 0x42, 0x43, KISS_FEND, 0x00, 0x77, KISS_FEND};
+	kiss_decoder_feed(&dec, bad_escape, sizeof(bad_escape), cb_frame, &rx);
+	assert(rx.count == 3);
+	assert(rx.len == 1 && rx.data[0] == 0x77);
+	assert(dec.errors == 1);
+
+	// too long frame
+	uint8_t long_frame[KISS_MAX_FRAME_LEN + 10];
+	memset(long_frame, 0x11, sizeof(long_frame));
+	kiss_decoder_feed(&dec, (const uint8_t[]){KISS_FEND}, 1, cb_frame, &rx);
+	kiss_decoder_feed(&dec, long_frame, sizeof(long_frame), cb_frame, &rx);
+	kiss_decoder_feed(&dec, (const uint8_t[]){KISS_FEND}, 1, cb_frame, &rx);
+	assert(rx.count == 3);
+	assert(dec.errors == 2);
+}
+
+
+static void test_ax25_known(void)
+{
+	const char *tnc2 = "N0CALL-7>APLETK:!test";
+	const uint8_t expected[] = {
+		0x82, 0xA0, 0x98, 0x8A, 0xA8, 0x96, 0xE0,   // APLETK, command bit
+		0x9C, 0x60, 0x86, 0x82, 0x98, 0x98, 0x6F,   // N0CALL-7, last address
+		0x03, 0xF0, '!', 't', 'e', 's', 't'};
+
+	uint8_t ax25[AX25_MAX_FRAME_LEN];
+	uint8_t text[300];
+
+	size_t len = ax25_from_tnc2((const uint8_t*)tnc2, strlen(tnc2), ax25, sizeof(ax25));
+	assert(len == sizeof(expected));
+	assert(memcmp(ax25, expected, len) == 0);
+
+	assert(ax25_to_tnc2(ax25, len, text, sizeof(text)) == strlen(tnc2));
+	assert(memcmp(text, tnc2, strlen(tnc2)) == 0);
+
+	// has-been-repeated bits are set up to the marked digipeater
+	const char *digi = "DE0ABC-15>APRS-1,DB0XYZ,WIDE1*,WIDE2-1::DE0ABC   :hi{1";
+	len = ax25_from_tnc2((const uint8_t*)digi, strlen(digi), ax25, sizeof(ax25));
+	assert(len == 5 * 7 + 2 + strlen(":DE0ABC   :hi{1"));
+	assert(ax25[2 * 7 + 6] & 0x80);
+	assert(ax25[3 * 7 + 6] & 0x80);
+	assert(!(ax25[4 * 7 + 6] & 0x80));
+	assert(ax25[4 * 7 + 6] & 0x01);
+	assert(!(ax25[1 * 7 + 6] & 0x01));
+	assert(((ax25[1 * 7 + 6] >> 1) & 0x0F) == 15);
+
+	size_t text_len = ax25_to_tnc2(ax25, len, text, sizeof(text));
+	assert(text_len == strlen(digi));
+	assert(memcmp(text, digi, text_len) == 0);
+
+	// output buffer too small
+	assert(ax25_to_tnc2(ax25, len, text, text_len - 1) == 0);
+	assert(ax25_from_tnc2((const uint8_t*)digi, strlen(digi), ax25, len - 1) == 0);
+
+	// invalid TNC2 frames
+	const char *invalid[] = {
+		"no separator",
+		"N0CALL>:x",
+		">APRS:x",
+		"N0CALL:x",
+		"N0CALL>APRS,:x",
+		"N0CALL-16>APRS:x",
+		"N0CALL-1a>APRS:x",
+		"TOOLONG>APRS:x",
+		"N0CALL*>APRS:x",
+		"n0call>APRS:x",
+		"N0CALL>APRS,D1,D2,D3,D4,D5,D6,D7,D8,D9:x",
+	};
+
+	for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		assert(ax25_from_tnc2((const uint8_t*)invalid[i], strlen(invalid[i]), ax25, sizeof(ax25)) == 0);
+	}
+
+	// 8 digipeaters are fine
+	const char *max_digis = "N0CALL>APRS,D1,D2,D3,D4,D5,D6,D7,D8:x";
+	len = ax25_from_tnc2((const uint8_t*)max_digis, strlen(max_digis), ax25, sizeof(ax25));
+	assert(len == 10 * 7 + 2 + 1);
+
+	// not a UI frame
+	len = ax25_from_tnc2((const uint8_t*)tnc2, strlen(tnc2), ax25, sizeof(ax25));
+	ax25[14] = 0x13;
+	assert(ax25_to_tnc2(ax25, len, text, sizeof(text)) == 0);
+}
+
+
+static void test_fuzz(void)
+{
+	uint8_t data[1024];
+	uint8_t out[AX25_MAX_FRAME_LEN + 64];
+	kiss_decoder_t dec;
+	received_t rx = {0};
+
+	kiss_decoder_init(&dec);
+
+	for(int iter = 0; iter < 200000; iter++) {
+		size_t len = test_random() % sizeof(data);
+
+		for(size_t i = 0; i < len; i++) {
+			// make special bytes frequent
+			uint32_t r = test_random();
+			data[i] = (r % 8 == 0) ? KISS_FEND : (r % 8 == 1) ? KISS_FESC : (r >> 4);
+		}
+
+		kiss_decoder_feed(&dec, data, len, cb_frame, &rx);
+
+		// the converters must reject or convert anything without overflowing
+		size_t out_size = test_random() % sizeof(out);
+		size_t n = ax25_to_tnc2(data, len % 400, out, out_size);
+		assert(n <= out_size);
+
+		n = ax25_from_tnc2(data, len % 400, out, out_size);
+		assert(n <= out_size);
+	}
+
+	printf("fuzzing: %u frames decoded, %u discarded\n", dec.frames, dec.errors);
+}
+
+
+static void test_roundtrip(void)
+{
+	uint8_t frame[KISS_MAX_FRAME_LEN];
+	uint8_t encoded[2 * KISS_MAX_FRAME_LEN + 4];
+	kiss_decoder_t dec;
+	received_t rx = {0};
+
+	kiss_decoder_init(&dec);
+
+	for(int iter = 0; iter < 20000; iter++) {
+		size_t len = 1 + test_random() % KISS_MAX_FRAME_LEN;
+		uint8_t port = test_random() % 16;
+
+		for(size_t i = 0; i < len; i++) {
+			uint32_t r = test_random();
+			frame[i] = (r % 4 == 0) ? KISS_FEND : (r % 4 == 1) ? KISS_FESC : (r >> 4);
+		}
+
+		size_t chunk_len = 1 + test_random() % CHUNK_LEN_MAX;
+		size_t enc_len = encode_all(frame, len, port, encoded, chunk_len);
+
+		// feed the decoder in chunks of a different size
+		size_t feed_len = 1 + test_random() % CHUNK_LEN_MAX;
+		uint32_t count = rx.count;
+
+		for(size_t pos = 0; pos < enc_len; pos += feed_len) {
+			size_t n = (enc_len - pos < feed_len) ? enc_len - pos : feed_len;
+			kiss_decoder_feed(&dec, encoded + pos, n, cb_frame, &rx);
+		}
+
+		assert(rx.count == count + 1);
+		assert(rx.port == port);
+		assert(rx.len == len);
+		assert(memcmp(rx.data, frame, len) == 0);
+	}
+
+	assert(dec.errors == 0);
+
+	// TNC2 -> AX.25 -> KISS -> AX.25 -> TNC2
+	const char *tnc2 = "DE0ABC-7>APLETK,WIDE1-1:!4903.50N/07201.75W-T-Echo";
+	uint8_t ax25[AX25_MAX_FRAME_LEN];
+	uint8_t text[300];
+
+	size_t ax25_len = ax25_from_tnc2((const uint8_t*)tnc2, strlen(tnc2), ax25, sizeof(ax25));
+	size_t enc_len = encode_all(ax25, ax25_len, 0, encoded, 20);
+
+	kiss_decoder_feed(&dec, encoded, enc_len, cb_frame, &rx);
+	assert(rx.len == ax25_len);
+	assert(ax25_to_tnc2(rx.data, rx.len, text, sizeof(text)) == strlen(tnc2));
+	assert(memcmp(text, tnc2, strlen(tnc2)) == 0);
+}
+
+
+static void test_throughput(void)
+{
+	uint8_t frame[200];
+	uint8_t chunk[CHUNK_LEN_MAX];
+	kiss_decoder_t dec;
+	kiss_encoder_t enc;
+	received_t rx = {0};
+
+	for(size_t i = 0; i < sizeof(frame); i++) {
+		frame[i] = test_random();
+	}
+
+	kiss_decoder_init(&dec);
+
+	const uint32_t frames = 200000;
+	uint64_t bytes = 0;
+
+	clock_t start = clock();
+
+	for(uint32_t i = 0; i < frames; i++) {
+		size_t n;
+
+		kiss_encoder_start(&enc, 0, KISS_CMD_DATA, frame, sizeof(frame));
+
+		while((n = kiss_encoder_read(&enc, chunk, sizeof(chunk))) > 0) {
+			kiss_decoder_feed(&dec, chunk, n, cb_frame, &rx);
+			bytes += n;
+		}
+	}
+
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	assert(rx.count == frames);
+
+	printf("throughput: %.1f MB/s encoded and decoded on the host\n",
+			bytes / 1e6 / (seconds > 0 ? seconds : 1e-9));
+}
+
+
+int main(void)
+{
+	test_kiss_known();
+	test_ax25_known();
+	test_fuzz();
+	test_roundtrip();
+	test_throughput();
+
+	printf("KISS checks passed\n");
+
+	return 0;
+}
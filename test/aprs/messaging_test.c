@@ -0,0 +1,389 @@
+/*
+ * Host test for APRS messaging.
+ *
+ * Checks the message parser and the inbox, then simulates round trips
+ * between this device and a remote station over a fake radio that loses a
+ * configurable fraction of the frames in both directions.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/aprs.h"
+#include "../../src/airtime.h"
+#include "../../src/messaging.h"
+#include "../../src/time_base.h"
+#include "../../src/wall_clock.h"
+
+#define MYCALL   "DL1TST"
+#define PEERCALL "DL2PEER"
+
+#define SIM_STEP_MS          100
+#define SIM_DURATION_MS  7200000 // 2 hours
+
+// the device sends a new message every 3 minutes, the peer every 4 minutes
+#define DEVICE_MSG_INTERVAL_MS  180000
+#define PEER_MSG_INTERVAL_MS    240000
+
+// the peer retries unacknowledged messages like a typical APRS client
+#define PEER_RETRY_MS            30000
+#define PEER_MAX_TRIES               5
+
+#define MAX_MESSAGES               100
+
+static uint64_t m_now;
+
+// stubs for the modules used by aprs.c
+uint64_t time_base_get(void)
+{
+	return m_now;
+}
+
+void wall_clock_get_utc(struct tm *utc)
+{
+	memset(utc, 0, sizeof(*utc));
+}
+
+
+static messaging_rx_result_t handle(const char *text)
+{
+	uint8_t frame[APRS_MAX_FRAME_LEN];
+	size_t len = strlen(text);
+
+	frame[0] = '<';
+	frame[1] = 0xFF;
+	frame[2] = 0x01;
+	memcpy(frame + 3, text, len);
+
+	return messaging_handle_rx(frame, len + 3, m_now);
+}
+
+
+static bool parse(const char *text, messaging_msg_t *msg)
+{
+	return messaging_parse((const uint8_t*)text, strlen(text), msg);
+}
+
+
+static void test_parser(void)
+{
+	messaging_msg_t msg;
+
+	assert(parse("DL2PEER>APLETK,WIDE1-1::DL1TST   :Hello there{42", &msg));
+	assert(msg.type == MESSAGING_TYPE_MESSAGE);
+	assert(strcmp(msg.source, PEERCALL) == 0);
+	assert(strcmp(msg.addressee, MYCALL) == 0);
+	assert(strcmp(msg.text, "Hello there") == 0);
+	assert(strcmp(msg.msg_id, "42") == 0);
+
+	// without ID, no acknowledgement is requested
+	assert(parse("DL2PEER>APLETK::DL1TST-10:no id", &msg));
+	assert(strcmp(msg.addressee, "DL1TST-10") == 0);
+	assert(strcmp(msg.text, "no id") == 0);
+	assert(msg.msg_id[0] == '\0');
+
+	// reply-ack format: the ID ends at '}'
+	assert(parse("DL2PEER>APLETK::DL1TST   :reply{MM}AA", &msg));
+	assert(strcmp(msg.text, "reply") == 0);
+	assert(strcmp(msg.msg_id, "MM") == 0);
+
+	// a '{' with an invalid ID is part of the text
+	assert(parse("DL2PEER>APLETK::DL1TST   :a{bcdefgh", &msg));
+	assert(strcmp(msg.text, "a{bcdefgh") == 0);
+	assert(msg.msg_id[0] == '\0');
+
+	assert(parse("DL2PEER>APLETK::DL1TST   :ack7", &msg));
+	assert(msg.type == MESSAGING_TYPE_ACK);
+	assert(strcmp(msg.msg_id, "7") == 0);
+
+	assert(parse("DL2PEER>APLETK::DL1TST   :rej123}", &msg));
+	assert(msg.type == MESSAGING_TYPE_REJ);
+	assert(strcmp(msg.msg_id, "123") == 0);
+
+	// not messages
+	assert(!parse("DL2PEER>APLETK:!4900.00N/00824.00E>", &msg));
+	assert(!parse("DL2PEER>APLETK::DL1TST:short", &msg));
+	assert(!parse("DL2PEER>APLETK::         :empty addressee", &msg));
+
+	// "ack" without ID is a normal message
+	assert(parse("DL2PEER>APLETK::DL1TST   :ack", &msg));
+	assert(msg.type == MESSAGING_TYPE_MESSAGE);
+
+	// text that only starts with "ack"/"rej" is a normal message
+	assert(parse("DL2PEER>APLETK::DL1TST   :ack ok{1", &msg));
+	assert(msg.type == MESSAGING_TYPE_MESSAGE);
+	assert(strcmp(msg.text, "ack ok") == 0);
+	assert(strcmp(msg.msg_id, "1") == 0);
+
+	assert(parse("DL2PEER>APLETK::DL1TST   :acknowledged{12", &msg));
+	assert(msg.type == MESSAGING_TYPE_MESSAGE);
+	assert(strcmp(msg.text, "acknowledged") == 0);
+	assert(strcmp(msg.msg_id, "12") == 0);
+
+	assert(!parse("garbage", &msg));
+}
+
+
+static void test_inbox(void)
+{
+	uint8_t frame[APRS_MAX_FRAME_LEN];
+	uint8_t len;
+
+	messaging_init();
+	airtime_init();
+	m_now = 1000;
+
+	assert(handle("DL2PEER>APLETK::DL1TST   :first{1") == MESSAGING_RX_NEW_MESSAGE);
+	assert(messaging_get_next_due_time() == m_now);
+	assert(messaging_get_due_frame(m_now, frame, &len));
+	frame[len] = '\0';
+	assert(strcmp((char*)frame + 3, MYCALL ">APLT01::DL2PEER  :ack1") == 0);
+	assert(!messaging_get_due_frame(m_now, frame, &len));
+
+	// messages for other stations are ignored
+	assert(handle("DL2PEER>APLETK::DL9XYZ   :other{1") == MESSAGING_RX_IGNORED);
+
+	// a repeated message is not acknowledged again within the holdoff time
+	m_now += MESSAGING_ACK_HOLDOFF_MS - 1;
+	assert(handle("DL2PEER>APLETK::DL1TST   :first{1") == MESSAGING_RX_REPEATED_MESSAGE);
+	assert(messaging_get_next_due_time() == MESSAGING_NO_FRAME);
+	m_now += 1;
+	assert(handle("DL2PEER>APLETK::DL1TST   :first{1") == MESSAGING_RX_REPEATED_MESSAGE);
+	assert(messaging_get_due_frame(m_now, frame, &len));
+	assert(messaging_get_inbox_count() == 1);
+	assert(messaging_get_inbox_entry(0)->rx_count == 3);
+
+	// rate limit: the bucket is empty after a burst of new messages
+	m_now += 1000;
+	assert(handle("DL3AAA>APLETK::DL1TST   :a{1") == MESSAGING_RX_NEW_MESSAGE);
+	assert(handle("DL3BBB>APLETK::DL1TST   :b{1") == MESSAGING_RX_NEW_MESSAGE);
+	assert(handle("DL3CCC>APLETK::DL1TST   :c{1") == MESSAGING_RX_NEW_MESSAGE);
+	assert(messaging_get_stats()->acks_suppressed == 2); // holdoff + bucket
+	m_now += MESSAGING_ACK_REFILL_MS;
+	assert(handle("DL3CCC>APLETK::DL1TST   :c{1") == MESSAGING_RX_REPEATED_MESSAGE);
+
+	int acks = 0;
+	while(messaging_get_due_frame(m_now, frame, &len)) {
+		acks++;
+	}
+	assert(acks == 3);
+
+	// the inbox keeps the newest messages
+	for(int i = 0; i < MESSAGING_INBOX_SIZE; i++) {
+		char text[64];
+		snprintf(text, sizeof(text), "DL4AAA>APLETK::DL1TST   :msg %d", i);
+		assert(handle(text) == MESSAGING_RX_NEW_MESSAGE);
+	}
+	assert(messaging_get_inbox_count() == MESSAGING_INBOX_SIZE);
+	assert(strcmp(messaging_get_inbox_entry(0)->text, "msg 7") == 0);
+	assert(strcmp(messaging_get_inbox_entry(MESSAGING_INBOX_SIZE - 1)->text, "msg 0") == 0);
+	assert(messaging_get_inbox_entry(MESSAGING_INBOX_SIZE) == NULL);
+
+	// outgoing messages are retried with exponential backoff and given up
+	messaging_init();
+	m_now = 0;
+	assert(messaging_send("DL2PEER-12", "too long addressee", m_now) == NRF_ERROR_INVALID_PARAM);
+	assert(messaging_send(PEERCALL, "", m_now) == NRF_ERROR_INVALID_PARAM);
+	assert(messaging_send(PEERCALL, "retry me", m_now) == NRF_SUCCESS);
+
+	uint64_t expected = 0;
+	uint32_t interval = MESSAGING_RETRY_INITIAL_MS;
+	for(int i = 0; i < MESSAGING_MAX_TRIES; i++) {
+		assert(messaging_get_next_due_time() == expected);
+		m_now = expected;
+		assert(messaging_get_due_frame(m_now, frame, &len));
+		frame[len] = '\0';
+		assert(strcmp((char*)frame + 3, MYCALL ">APLT01::DL2PEER  :retry me{1") == 0);
+		expected += interval;
+		interval *= 2;
+	}
+	m_now = expected;
+	assert(!messaging_get_due_frame(m_now, frame, &len));
+	assert(messaging_get_outbox_count() == 0);
+	assert(messaging_get_stats()->msg_failed == 1);
+
+	for(int i = 0; i < MESSAGING_OUTBOX_SIZE; i++) {
+		assert(messaging_send(PEERCALL, "fill", m_now) == NRF_SUCCESS);
+	}
+	assert(messaging_send(PEERCALL, "full", m_now) == NRF_ERROR_NO_MEM);
+}
+
+
+/* Round trip simulation */
+
+typedef struct
+{
+	bool     acked;
+	uint8_t  tries;
+	uint64_t next_try;
+} peer_msg_t;
+
+static uint32_t m_rand_state;
+
+static double sim_random(void)
+{
+	m_rand_state = m_rand_state * 1103515245u + 12345u;
+	return (double)(m_rand_state >> 8) / (double)(1u << 24);
+}
+
+
+typedef struct
+{
+	double   loss;
+	uint32_t device_msgs;
+	uint32_t device_acked;
+	uint32_t peer_msgs;
+	uint32_t peer_acked;
+	uint32_t peer_delivered;
+	uint32_t device_tx;
+	uint32_t airtime_ms;
+} sim_result_t;
+
+
+static void simulate(double loss, sim_result_t *res)
+{
+	peer_msg_t peer_msgs[MAX_MESSAGES];
+	bool device_msg_seen[MAX_MESSAGES];
+
+	memset(res, 0, sizeof(*res));
+	memset(peer_msgs, 0, sizeof(peer_msgs));
+	memset(device_msg_seen, 0, sizeof(device_msg_seen));
+
+	res->loss = loss;
+	m_rand_state = 4711;
+
+	messaging_init();
+	airtime_init();
+
+	for(m_now = 0; m_now < SIM_DURATION_MS; m_now += SIM_STEP_MS) {
+		uint8_t frame[APRS_MAX_FRAME_LEN];
+		uint8_t len;
+		char text[APRS_MAX_FRAME_LEN];
+
+		// new messages from the device (e.g. written via BLE)
+		if(m_now % DEVICE_MSG_INTERVAL_MS == 0 && res->device_msgs < MAX_MESSAGES) {
+			snprintf(text, sizeof(text), "device message %u", (unsigned)res->device_msgs);
+			if(messaging_send(PEERCALL, text, m_now) == NRF_SUCCESS) {
+				res->device_msgs++;
+			}
+		}
+
+		// new messages from the peer
+		if(m_now % PEER_MSG_INTERVAL_MS == 0 && res->peer_msgs < MAX_MESSAGES) {
+			peer_msgs[res->peer_msgs].next_try = m_now;
+			res->peer_msgs++;
+		}
+
+		// device -> peer
+		while(messaging_get_due_frame(m_now, frame, &len)) {
+			uint32_t toa = airtime_calc_toa_ms(len);
+			airtime_record(m_now, toa);
+			res->device_tx++;
+			res->airtime_ms += toa;
+
+			if(sim_random() < loss) {
+				continue;
+			}
+
+			messaging_msg_t msg;
+			assert(messaging_parse(frame, len, &msg));
+			assert(strcmp(msg.addressee, PEERCALL) == 0);
+
+			if(msg.type == MESSAGING_TYPE_ACK) {
+				unsigned id;
+				assert(sscanf(msg.msg_id, "P%u", &id) == 1 && id < res->peer_msgs);
+				if(!peer_msgs[id].acked) {
+					peer_msgs[id].acked = true;
+					res->peer_acked++;
+				}
+			} else {
+				// the peer acknowledges every copy it receives
+				unsigned id;
+				assert(sscanf(msg.text, "device message %u", &id) == 1);
+				device_msg_seen[id] = true;
+
+				if(sim_random() >= loss) {
+					snprintf(text, sizeof(text), PEERCALL ">APRS::%-9s:ack%s", MYCALL, msg.msg_id);
+					if(handle(text) == MESSAGING_RX_ACK) {
+						res->device_acked++;
+					}
+				}
+			}
+		}
+
+		// peer -> device
+		for(uint32_t i = 0; i < res->peer_msgs; i++) {
+			peer_msg_t *pm = &peer_msgs[i];
+
+			if(pm->acked || pm->tries >= PEER_MAX_TRIES || pm->next_try > m_now) {
+				continue;
+			}
+
+			pm->tries++;
+			pm->next_try = m_now + PEER_RETRY_MS;
+
+			if(sim_random() < loss) {
+				continue;
+			}
+
+			snprintf(text, sizeof(text), PEERCALL ">APRS::%-9s:peer message %u{P%u", MYCALL, (unsigned)i, (unsigned)i);
+			if(handle(text) == MESSAGING_RX_NEW_MESSAGE) {
+				res->peer_delivered++;
+			}
+		}
+	}
+
+	// every device message that reached the peer was sent at least once,
+	// and no message from the peer was stored twice
+	uint32_t seen = 0;
+	for(uint32_t i = 0; i < res->device_msgs; i++) {
+		seen += device_msg_seen[i];
+	}
+	assert(seen >= res->device_acked);
+	assert(res->peer_delivered <= res->peer_msgs);
+	assert(messaging_get_stats()->msg_acked == res->device_acked);
+}
+
+
+int main(void)
+{
+	static const double LOSS_RATES[] = {0.0, 0.2, 0.4, 0.6};
+
+	aprs_init();
+	aprs_set_source(MYCALL);
+	aprs_set_dest("APLT01");
+
+	test_parser();
+	test_inbox();
+
+	printf("loss | dev msgs | acked | peer msgs | delivered | acked | dev TX | airtime\n");
+
+	for(size_t i = 0; i < sizeof(LOSS_RATES) / sizeof(LOSS_RATES[0]); i++) {
+		sim_result_t res;
+
+		simulate(LOSS_RATES[i], &res);
+
+		printf("%3.0f%% | %8u | %5u | %9u | %9u | %5u | %6u | %5.1f s\n",
+				res.loss * 100,
+				res.device_msgs, res.device_acked,
+				res.peer_msgs, res.peer_delivered, res.peer_acked,
+				res.device_tx, res.airtime_ms / 1000.0);
+
+		if(res.loss == 0.0) {
+			// without loss, every message is acknowledged after the first try
+			assert(res.device_acked == res.device_msgs);
+			assert(res.peer_delivered == res.peer_msgs);
+			assert(res.peer_acked == res.peer_msgs);
+			assert(res.device_tx == res.device_msgs + res.peer_msgs);
+		} else if(res.loss <= 0.2) {
+			assert(res.device_acked >= res.device_msgs * 95 / 100);
+			assert(res.peer_delivered >= res.peer_msgs * 95 / 100);
+		}
+	}
+
+	printf("messaging checks passed\n");
+
+	return 0;
+}
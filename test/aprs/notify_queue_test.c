@@ -0,0 +1,190 @@
+/*
+ * Host test for the BLE notification queue.
+ *
+ * Checks the queue operations and the batching of frames, then simulates a
+ * burst of received packets while the SoftDevice can only buffer a few
+ * notifications per connection event.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../src/notify_queue.h"
+
+// notification length with the default and the maximum ATT MTU
+#define NOTIFY_LEN_DEFAULT   20
+#define NOTIFY_LEN_MAX      244
+
+static notify_queue_t m_queue;
+
+static void make_frame(uint8_t *buf, uint8_t len, uint8_t id)
+{
+	for(uint8_t i = 0; i < len; i++) {
+		buf[i] = id + i;
+	}
+}
+
+
+static void test_basic(void)
+{
+	uint8_t frame[NOTIFY_QUEUE_MAX_FRAME_LEN];
+	uint8_t buf[NOTIFY_LEN_MAX];
+	uint32_t frames;
+
+	notify_queue_init(&m_queue);
+
+	assert(notify_queue_count(&m_queue) == 0);
+	assert(notify_queue_build(&m_queue, buf, sizeof(buf), false, &frames) == 0);
+	assert(frames == 0);
+
+	// fill the queue, the next frame is dropped
+	for(uint8_t i = 0; i < NOTIFY_QUEUE_DEPTH; i++) {
+		make_frame(frame, 10 + i, i);
+		assert(notify_queue_push(&m_queue, frame, 10 + i));
+	}
+
+	assert(!notify_queue_push(&m_queue, frame, 10));
+	assert(m_queue.dropped == 1);
+	assert(m_queue.max_depth == NOTIFY_QUEUE_DEPTH);
+
+	// without batching, frames come out one by one and unchanged
+	for(uint8_t i = 0; i < NOTIFY_QUEUE_DEPTH; i++) {
+		size_t len = notify_queue_build(&m_queue, buf, sizeof(buf), false, &frames);
+
+		make_frame(frame, 10 + i, i);
+		assert(frames == 1);
+		assert(len == 10U + i);
+		assert(memcmp(buf, frame, len) == 0);
+
+		notify_queue_pop(&m_queue, frames);
+	}
+
+	assert(notify_queue_count(&m_queue) == 0);
+
+	// a frame that does not fit into the notification is truncated
+	make_frame(frame, 100, 0);
+	notify_queue_push(&m_queue, frame, 100);
+	assert(notify_queue_build(&m_queue, buf, NOTIFY_LEN_DEFAULT, false, &frames) == NOTIFY_LEN_DEFAULT);
+	assert(notify_queue_build(&m_queue, buf, NOTIFY_LEN_DEFAULT, true, &frames) == NOTIFY_LEN_DEFAULT);
+	assert(frames == 1);
+	assert(buf[0] == NOTIFY_LEN_DEFAULT - 1);
+	assert(memcmp(buf + 1, frame, NOTIFY_LEN_DEFAULT - 1) == 0);
+
+	notify_queue_clear(&m_queue);
+	assert(notify_queue_count(&m_queue) == 0);
+}
+
+
+static void test_batching(void)
+{
+	uint8_t frame[NOTIFY_QUEUE_MAX_FRAME_LEN];
+	uint8_t buf[NOTIFY_LEN_MAX];
+	uint32_t frames;
+
+	notify_queue_init(&m_queue);
+
+	// 60 + 70 + 80 bytes plus 3 length bytes fit, the fourth frame does not
+	for(uint8_t i = 0; i < 4; i++) {
+		make_frame(frame, 60 + 10 * i, i);
+		notify_queue_push(&m_queue, frame, 60 + 10 * i);
+	}
+
+	size_t len = notify_queue_build(&m_queue, buf, sizeof(buf), true, &frames);
+	assert(frames == 3);
+	assert(len == 3 + 60 + 70 + 80);
+
+	// split the notification again
+	size_t pos = 0;
+	for(uint8_t i = 0; i < frames; i++) {
+		make_frame(frame, 60 + 10 * i, i);
+		assert(buf[pos] == 60 + 10 * i);
+		assert(memcmp(buf + pos + 1, frame, buf[pos]) == 0);
+		pos += 1 + buf[pos];
+	}
+	assert(pos == len);
+
+	notify_queue_pop(&m_queue, frames);
+	assert(notify_queue_count(&m_queue) == 1);
+
+	len = notify_queue_build(&m_queue, buf, sizeof(buf), true, &frames);
+	assert(frames == 1);
+	assert(len == 1 + 90);
+
+	// popping more frames than queued is harmless
+	notify_queue_pop(&m_queue, 5);
+	assert(notify_queue_count(&m_queue) == 0);
+
+	// the indices wrap around without losing frames
+	for(uint32_t i = 0; i < 1000; i++) {
+		make_frame(frame, 20, i);
+		assert(notify_queue_push(&m_queue, frame, 20));
+		assert(notify_queue_build(&m_queue, buf, sizeof(buf), false, &frames) == 20);
+		assert(memcmp(buf, frame, 20) == 0);
+		notify_queue_pop(&m_queue, frames);
+	}
+}
+
+
+/* A burst of received packets: one packet arrives every 300 ms, while the
+ * SoftDevice accepts two notifications per connection event every 1 s (a slow
+ * connection interval while the phone is in the background). Returns the
+ * number of dropped packets. */
+static uint32_t simulate_burst(uint32_t packets, bool batching, uint32_t *notifications)
+{
+	uint8_t frame[NOTIFY_QUEUE_MAX_FRAME_LEN];
+	uint8_t buf[NOTIFY_LEN_MAX];
+	uint32_t frames;
+
+	notify_queue_init(&m_queue);
+	*notifications = 0;
+
+	for(uint32_t t = 0; t < packets * 300 + 10000; t += 100) {
+		if(t % 300 == 0 && t / 300 < packets) {
+			make_frame(frame, 60, t / 300);
+			notify_queue_push(&m_queue, frame, 60);
+		}
+
+		if(t % 1000 == 0) {
+			for(int slot = 0; slot < 2; slot++) {
+				if(notify_queue_build(&m_queue, buf, sizeof(buf), batching, &frames) == 0) {
+					break;
+				}
+
+				notify_queue_pop(&m_queue, frames);
+				(*notifications)++;
+			}
+		}
+	}
+
+	assert(notify_queue_count(&m_queue) == 0);
+
+	return m_queue.dropped;
+}
+
+
+int main(void)
+{
+	uint32_t notifications;
+
+	test_basic();
+	test_batching();
+
+	// packets arrive faster than single notifications can be sent, so the
+	// queue overflows eventually. Batching keeps up.
+	uint32_t dropped_single = simulate_burst(100, false, &notifications);
+	printf("burst of 100 packets, one frame per notification: %u dropped, %u notifications, max depth %u\n",
+			dropped_single, notifications, m_queue.max_depth);
+	assert(dropped_single > 0);
+
+	uint32_t single_notifications = notifications;
+	uint32_t dropped_batched = simulate_burst(100, true, &notifications);
+	printf("burst of 100 packets, batched: %u dropped, %u notifications, max depth %u\n",
+			dropped_batched, notifications, m_queue.max_depth);
+	assert(dropped_batched == 0);
+	assert(notifications < single_notifications);
+
+	printf("notification queue checks passed\n");
+
+	return 0;
+}
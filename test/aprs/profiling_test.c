@@ -0,0 +1,160 @@
+/*
+ * Host test for the run-time measurement.
+ *
+ * Checks the statistics and histogram buckets with synthetic durations, then
+ * measures real spans and sleep phases with the clock_gettime() backend.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../../src/profiling.h"
+
+#define US(x)  ((uint32_t)(x) * PROFILING_TICKS_PER_US)
+
+static void sleep_us(uint32_t us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1000000,
+		.tv_nsec = (us % 1000000) * 1000L
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+
+static void busy_us(uint32_t us)
+{
+	uint32_t start = profiling_now();
+
+	while(profiling_now() - start < US(us)) {
+		// spin
+	}
+}
+
+
+static void test_statistics(void)
+{
+	profiling_stats_t stats;
+
+	profiling_reset();
+
+	profiling_get_stats(PROFILING_SPAN_CB_LORA, &stats);
+	assert(stats.count == 0);
+	assert(stats.total_ticks == 0);
+
+	profiling_record(PROFILING_SPAN_CB_LORA, US(10));
+	profiling_record(PROFILING_SPAN_CB_LORA, US(30));
+	profiling_record(PROFILING_SPAN_CB_LORA, US(200));
+
+	profiling_get_stats(PROFILING_SPAN_CB_LORA, &stats);
+	assert(stats.count == 3);
+	assert(stats.min_ticks == US(10));
+	assert(stats.max_ticks == US(200));
+	assert(stats.total_ticks == US(240));
+
+	// other spans are not affected
+	profiling_get_stats(PROFILING_SPAN_CB_GPS, &stats);
+	assert(stats.count == 0);
+}
+
+
+static void test_buckets(void)
+{
+	profiling_stats_t stats;
+
+	// every bucket boundary and the values right below it
+	for(uint8_t bucket = 1; bucket < PROFILING_NUM_BUCKETS; bucket++) {
+		uint32_t start = US(profiling_get_bucket_start_us(bucket));
+
+		profiling_reset();
+		profiling_record(PROFILING_SPAN_NMEA_PARSE, start - 1);
+		profiling_record(PROFILING_SPAN_NMEA_PARSE, start);
+
+		profiling_get_stats(PROFILING_SPAN_NMEA_PARSE, &stats);
+
+		for(uint8_t i = 0; i < PROFILING_NUM_BUCKETS; i++) {
+			uint32_t expected = (i == bucket - 1 || i == bucket) ? 1 : 0;
+			assert(stats.histogram[i] == expected);
+		}
+	}
+
+	assert(profiling_get_bucket_start_us(1) == 16);
+	assert(profiling_get_bucket_start_us(4) == 1024);
+	assert(profiling_get_bucket_start_us(PROFILING_NUM_BUCKETS - 1) == 65536);
+
+	// extremes
+	profiling_reset();
+	profiling_record(PROFILING_SPAN_NMEA_PARSE, 0);
+	profiling_record(PROFILING_SPAN_NMEA_PARSE, UINT32_MAX);
+
+	profiling_get_stats(PROFILING_SPAN_NMEA_PARSE, &stats);
+	assert(stats.histogram[0] == 1);
+	assert(stats.histogram[PROFILING_NUM_BUCKETS - 1] == 1);
+}
+
+
+static void test_host_backend(void)
+{
+	profiling_stats_t stats;
+
+	profiling_reset();
+
+	for(int i = 0; i < 5; i++) {
+		uint32_t start = profiling_start();
+		busy_us(2000);
+		profiling_end(PROFILING_SPAN_REDRAW_DISPLAY, start);
+	}
+
+	profiling_get_stats(PROFILING_SPAN_REDRAW_DISPLAY, &stats);
+	assert(stats.count == 5);
+	assert(stats.min_ticks >= US(2000));
+	assert(stats.histogram[4] == 5); // 1 to 4 ms
+
+	// sleeping phases do not count as awake time
+	profiling_reset();
+
+	for(int i = 0; i < 5; i++) {
+		busy_us(1000);
+
+		profiling_sleep_enter();
+		sleep_us(10000);
+		profiling_sleep_exit();
+	}
+
+	uint64_t awake_us = profiling_get_awake_us();
+	assert(awake_us >= 5000);
+	assert(awake_us < 25000);
+
+	printf("redraw span: min %u us, max %u us; awake %u us of about 55000 us\n",
+			stats.min_ticks / PROFILING_TICKS_PER_US,
+			stats.max_ticks / PROFILING_TICKS_PER_US,
+			(uint32_t)awake_us);
+
+	// overhead of an empty span
+	profiling_reset();
+
+	for(int i = 0; i < 1000; i++) {
+		uint32_t start = profiling_start();
+		profiling_end(PROFILING_SPAN_CB_GPS, start);
+	}
+
+	profiling_get_stats(PROFILING_SPAN_CB_GPS, &stats);
+	assert(stats.count == 1000);
+	assert(stats.histogram[0] >= 990);
+}
+
+
+int main(void)
+{
+	profiling_init();
+
+	test_statistics();
+	test_buckets();
+	test_host_backend();
+
+	printf("profiling checks passed\n");
+
+	return 0;
+}
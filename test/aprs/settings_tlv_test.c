@@ -0,0 +1,253 @@
+/*
+ * Host test for the settings snapshot encoding.
+ *
+ * Checks a known snapshot, round trips, the detection of corrupted,
+ * truncated and malformed snapshots, reassembly from BLE-sized parts and
+ * feeds random data to the parser.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/settings_tlv.h"
+
+static uint32_t m_rand_state = 4711;
+
+static uint32_t test_random(void)
+{
+	m_rand_state = m_rand_state * 1103515245u + 12345u;
+	return m_rand_state >> 8;
+}
+
+
+static void test_known(void)
+{
+	// source call "AB" and LoRa power 20 dBm
+	const uint8_t expected[] = {
+		0x01, 0x02, 0x08, 0x00,
+		0x01, 0x03, 'A', 'B', 0x00,
+		0x04, 0x01, 20,
+		0x3A, 0x35};
+
+	uint8_t buf[SETTINGS_TLV_MAX_LEN];
+	settings_tlv_writer_t writer;
+
+	settings_tlv_writer_init(&writer, buf, sizeof(buf));
+	assert(settings_tlv_add(&writer, 0x01, (const uint8_t*)"AB", 3));
+	assert(settings_tlv_add(&writer, 0x04, (const uint8_t[]){20}, 1));
+
+	size_t len = settings_tlv_finish(&writer);
+	assert(len == sizeof(expected));
+	assert(memcmp(buf, expected, len) == 0);
+	assert(settings_tlv_get_total_len(buf, SETTINGS_TLV_HEADER_LEN) == len);
+	assert(settings_tlv_get_total_len(buf, SETTINGS_TLV_HEADER_LEN - 1) == 0);
+
+	settings_tlv_reader_t reader;
+	uint8_t id, value_len;
+	const uint8_t *value;
+
+	assert(settings_tlv_reader_init(&reader, buf, len) == SETTINGS_TLV_OK);
+
+	assert(settings_tlv_next(&reader, &id, &value, &value_len));
+	assert(id == 0x01 && value_len == 3 && memcmp(value, "AB", 3) == 0);
+	assert(settings_tlv_next(&reader, &id, &value, &value_len));
+	assert(id == 0x04 && value_len == 1 && value[0] == 20);
+	assert(!settings_tlv_next(&reader, &id, &value, &value_len));
+
+	assert(settings_tlv_find(&reader, 0x04, &value, &value_len) && value[0] == 20);
+	assert(!settings_tlv_find(&reader, 0x05, &value, &value_len));
+
+	// an empty snapshot is valid
+	settings_tlv_writer_init(&writer, buf, sizeof(buf));
+	len = settings_tlv_finish(&writer);
+	assert(len == SETTINGS_TLV_HEADER_LEN + SETTINGS_TLV_CRC_LEN);
+	assert(settings_tlv_reader_init(&reader, buf, len) == SETTINGS_TLV_OK);
+	assert(!settings_tlv_next(&reader, &id, &value, &value_len));
+}
+
+
+static size_t make_snapshot(uint8_t *buf, size_t size, uint8_t *ids, uint8_t *n_ids)
+{
+	settings_tlv_writer_t writer;
+	uint8_t value[64];
+
+	settings_tlv_writer_init(&writer, buf, size);
+
+	*n_ids = 0;
+
+	for(uint8_t id = 1; id < 12; id++) {
+		if(test_random() % 4 == 0) {
+			continue; // not stored, uses the default
+		}
+
+		uint8_t len = test_random() % sizeof(value);
+
+		for(uint8_t i = 0; i < len; i++) {
+			value[i] = test_random();
+		}
+
+		if(!settings_tlv_add(&writer, id, value, len)) {
+			break;
+		}
+
+		ids[(*n_ids)++] = id;
+	}
+
+	return settings_tlv_finish(&writer);
+}
+
+
+static void test_errors(void)
+{
+	uint8_t buf[SETTINGS_TLV_MAX_LEN];
+	uint8_t copy[SETTINGS_TLV_MAX_LEN + 1];
+	uint8_t ids[16];
+	uint8_t n_ids;
+	settings_tlv_reader_t reader;
+
+	size_t len;
+
+	do {
+		len = make_snapshot(buf, sizeof(buf), ids, &n_ids);
+	} while(len == 0);
+
+	assert(settings_tlv_reader_init(&reader, buf, len) == SETTINGS_TLV_OK);
+
+	// every single-bit error is detected
+	for(size_t i = 0; i < len; i++) {
+		for(uint8_t bit = 0; bit < 8; bit++) {
+			memcpy(copy, buf, len);
+			copy[i] ^= 1 << bit;
+			assert(settings_tlv_reader_init(&reader, copy, len) != SETTINGS_TLV_OK);
+		}
+	}
+
+	// truncation and extra data
+	for(size_t i = 0; i < len; i++) {
+		assert(settings_tlv_reader_init(&reader, buf, i) != SETTINGS_TLV_OK);
+	}
+
+	memcpy(copy, buf, len);
+	copy[len] = 0;
+	assert(settings_tlv_reader_init(&reader, copy, len + 1) == SETTINGS_TLV_ERR_FORMAT);
+
+	// duplicate IDs, with a valid checksum
+	settings_tlv_writer_t writer;
+
+	settings_tlv_writer_init(&writer, buf, sizeof(buf));
+	settings_tlv_add(&writer, 3, (const uint8_t*)"x", 1);
+	settings_tlv_add(&writer, 3, (const uint8_t*)"y", 1);
+	len = settings_tlv_finish(&writer);
+	assert(settings_tlv_reader_init(&reader, buf, len) == SETTINGS_TLV_ERR_DUPLICATE);
+
+	// future version
+	buf[0] = SETTINGS_TLV_VERSION + 1;
+	assert(settings_tlv_reader_init(&reader, buf, len) == SETTINGS_TLV_ERR_VERSION);
+
+	// buffer too small for the writer
+	uint8_t small[16];
+	settings_tlv_writer_init(&writer, small, sizeof(small));
+	assert(settings_tlv_add(&writer, 1, (const uint8_t*)"12345678", 8));
+	assert(!settings_tlv_add(&writer, 2, (const uint8_t*)"1", 1));
+	assert(settings_tlv_finish(&writer) == 0);
+}
+
+
+static void test_roundtrip(void)
+{
+	uint8_t buf[SETTINGS_TLV_MAX_LEN];
+	uint8_t assembled[SETTINGS_TLV_MAX_LEN];
+	uint8_t ids[16];
+	uint8_t n_ids;
+
+	for(int iter = 0; iter < 10000; iter++) {
+		size_t len = make_snapshot(buf, sizeof(buf), ids, &n_ids);
+
+		if(len == 0) {
+			continue; // did not fit
+		}
+
+		// reassemble from parts as they arrive in BLE writes
+		size_t chunk_len = 1 + test_random() % 244;
+		size_t received = 0;
+		size_t total = 0;
+
+		while(total == 0 || received < total) {
+			size_t n = (len - received < chunk_len) ? len - received : chunk_len;
+
+			memcpy(assembled + received, buf + received, n);
+			received += n;
+
+			total = settings_tlv_get_total_len(assembled, received);
+		}
+
+		assert(received == len && total == len);
+
+		settings_tlv_reader_t reader;
+		uint8_t id, value_len;
+		const uint8_t *value;
+		uint8_t count = 0;
+
+		assert(settings_tlv_reader_init(&reader, assembled, received) == SETTINGS_TLV_OK);
+
+		while(settings_tlv_next(&reader, &id, &value, &value_len)) {
+			assert(count < n_ids && id == ids[count]);
+			assert(value >= assembled && value + value_len <= assembled + len);
+			count++;
+		}
+
+		assert(count == n_ids);
+	}
+}
+
+
+static void test_fuzz(void)
+{
+	uint8_t buf[SETTINGS_TLV_MAX_LEN];
+	uint32_t valid = 0;
+
+	for(int iter = 0; iter < 200000; iter++) {
+		size_t len = test_random() % sizeof(buf);
+
+		for(size_t i = 0; i < len; i++) {
+			buf[i] = test_random();
+		}
+
+		// plausible headers are more interesting
+		if(len >= SETTINGS_TLV_HEADER_LEN && test_random() % 2) {
+			buf[0] = SETTINGS_TLV_VERSION;
+			buf[2] = (len - SETTINGS_TLV_HEADER_LEN - SETTINGS_TLV_CRC_LEN) & 0xFF;
+			buf[3] = 0;
+		}
+
+		settings_tlv_reader_t reader;
+
+		if(settings_tlv_reader_init(&reader, buf, len) == SETTINGS_TLV_OK) {
+			uint8_t id, value_len;
+			const uint8_t *value;
+
+			while(settings_tlv_next(&reader, &id, &value, &value_len)) {
+				assert(value + value_len <= buf + len);
+			}
+
+			valid++;
+		}
+	}
+
+	printf("fuzzing: %u random snapshots accepted\n", valid);
+}
+
+
+int main(void)
+{
+	test_known();
+	test_errors();
+	test_roundtrip();
+	test_fuzz();
+
+	printf("settings snapshot checks passed\n");
+
+	return 0;
+}
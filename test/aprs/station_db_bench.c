@@ -0,0 +1,324 @@
+/*
+ * Host test and benchmark for the station database.
+ *
+ * A synthetic busy-channel trace is generated: many stations with a Zipf-like
+ * popularity distribution (a few digipeaters and iGates are heard very often,
+ * most stations only occasionally), with random frame lengths. Each frame is
+ * inserted into the database and then looked up again.
+ *
+ * For comparison, the same trace is processed by a linear-search table
+ * equivalent to the previous rx history implementation, scaled to the same
+ * number of entries.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/station_db.h"
+
+#define NUM_CALLS      400
+#define NUM_PACKETS 200000
+
+typedef struct {
+	uint16_t call_idx;
+	uint8_t  len;
+} trace_entry_t;
+
+static char          m_calls[NUM_CALLS][STATION_DB_CALL_LEN];
+static trace_entry_t m_trace[NUM_PACKETS];
+
+/* Linear search table with the same layout as the old aprs_rx_history_t. */
+typedef struct {
+	aprs_rx_raw_data_t raw;
+	aprs_frame_t       decoded;
+	uint64_t           rx_timestamp;
+	bool               rx_time_valid;
+} linear_entry_t;
+
+static linear_entry_t m_linear[STATION_DB_SIZE];
+static uint8_t        m_linear_count;
+
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void make_frame(uint32_t n, aprs_frame_t *frame, aprs_rx_raw_data_t *raw)
+{
+	const trace_entry_t *t = &m_trace[n];
+
+	memset(frame, 0, sizeof(*frame));
+	strcpy(frame->source, m_calls[t->call_idx]);
+	strcpy(frame->dest, "APLETK");
+
+	// every fourth frame is positionless (status, message, …)
+	if(n % 4 != 3) {
+		frame->lat = 48.0f + t->call_idx * 0.001f;
+		frame->lon = 8.0f + t->call_idx * 0.002f;
+		frame->alt = t->call_idx;
+		frame->table = '/';
+		frame->symbol = '>';
+	}
+
+	raw->data_len = t->len;
+	for(uint8_t i = 0; i < t->len; i++) {
+		raw->data[i] = (uint8_t)(n + i);
+	}
+
+	raw->rssi = -100.5f;
+	raw->snr = 7.25f;
+	raw->signalRssi = -110.0f;
+}
+
+
+static uint8_t linear_insert(const aprs_frame_t *frame, const aprs_rx_raw_data_t *raw, uint64_t ts)
+{
+	linear_entry_t *pos = NULL;
+
+	for(uint8_t i = 0; i < m_linear_count; i++) {
+		if(strcmp(frame->source, m_linear[i].decoded.source) == 0) {
+			pos = &m_linear[i];
+			break;
+		}
+	}
+
+	if(!pos && m_linear_count < STATION_DB_SIZE) {
+		pos = &m_linear[m_linear_count++];
+	}
+
+	if(!pos) {
+		uint64_t oldest = UINT64_MAX;
+		for(uint8_t i = 0; i < m_linear_count; i++) {
+			if(m_linear[i].rx_timestamp < oldest) {
+				oldest = m_linear[i].rx_timestamp;
+				pos = &m_linear[i];
+			}
+		}
+	}
+
+	pos->decoded = *frame;
+	pos->raw = *raw;
+	pos->rx_timestamp = ts;
+	pos->rx_time_valid = true;
+
+	return pos - m_linear;
+}
+
+
+static uint8_t linear_find(const char *call)
+{
+	for(uint8_t i = 0; i < m_linear_count; i++) {
+		if(strcmp(call, m_linear[i].decoded.source) == 0) {
+			return i;
+		}
+	}
+
+	return STATION_DB_INVALID;
+}
+
+
+static void generate_trace(void)
+{
+	double weights[NUM_CALLS];
+	double total = 0;
+
+	for(int i = 0; i < NUM_CALLS; i++) {
+		snprintf(m_calls[i], sizeof(m_calls[i]), "D%c%d%c%c-%d",
+				'A' + i % 26, i % 10, 'A' + (i / 10) % 26, 'A' + (i / 260) % 26, i % 16);
+		weights[i] = 1.0 / pow(i + 1, 1.1);
+		total += weights[i];
+	}
+
+	srand(42);
+
+	for(int n = 0; n < NUM_PACKETS; n++) {
+		double r = (double)rand() / RAND_MAX * total;
+		int i = 0;
+
+		while(i < NUM_CALLS - 1 && r > weights[i]) {
+			r -= weights[i];
+			i++;
+		}
+
+		m_trace[n].call_idx = i;
+		m_trace[n].len = 40 + rand() % 120;
+	}
+}
+
+
+static void test_consistency(void)
+{
+	aprs_frame_t frame;
+	aprs_rx_raw_data_t raw;
+	uint8_t buf[256];
+	uint8_t len;
+
+	station_db_init();
+
+	for(uint32_t n = 0; n < NUM_PACKETS; n++) {
+		make_frame(n, &frame, &raw);
+
+		uint8_t idx = station_db_insert(&frame, &raw, n + 1, true, STATION_DB_INVALID);
+
+		// the station must be found again and be the most recent one
+		assert(station_db_find(frame.source) == idx);
+		assert(station_db_first() == idx);
+
+		const station_db_entry_t *entry = station_db_get(idx);
+		assert(entry != NULL);
+		assert(strcmp(entry->call, frame.source) == 0);
+		assert(entry->rx_timestamp == n + 1);
+		assert(entry->rssi == -1005);
+		assert(entry->snr == 725);
+
+		// the latest raw frame is always available
+		assert(station_db_get_raw(idx, buf, &len));
+		assert(len == raw.data_len);
+		assert(memcmp(buf, raw.data, len) == 0);
+
+		if(n % 4 != 3) {
+			float lat, lon, alt;
+			station_db_get_position(entry, &lat, &lon, &alt);
+			assert(fabsf(lat - frame.lat) < 1e-5f);
+			assert(fabsf(lon - frame.lon) < 1e-5f);
+		}
+	}
+
+	// the recency list must contain every entry exactly once, newest first
+	uint8_t count = 0;
+	uint32_t prev_ts = UINT32_MAX;
+
+	for(uint8_t idx = station_db_first(); idx != STATION_DB_INVALID; idx = station_db_next(idx)) {
+		const station_db_entry_t *entry = station_db_get(idx);
+		assert(entry->rx_timestamp < prev_ts);
+		prev_ts = entry->rx_timestamp;
+		count++;
+	}
+
+	assert(count == station_db_count());
+	assert(count == STATION_DB_SIZE);
+
+	// the protected entry must survive although it is the oldest one
+	uint8_t oldest = STATION_DB_INVALID;
+	for(uint8_t idx = station_db_first(); idx != STATION_DB_INVALID; idx = station_db_next(idx)) {
+		oldest = idx;
+	}
+
+	char oldest_call[STATION_DB_CALL_LEN];
+	strcpy(oldest_call, station_db_get(oldest)->call);
+
+	memset(&frame, 0, sizeof(frame));
+	strcpy(frame.source, "NEW1");
+	station_db_insert(&frame, &raw, NUM_PACKETS + 1, true, oldest);
+	strcpy(frame.source, "NEW2");
+	station_db_insert(&frame, &raw, NUM_PACKETS + 2, true, oldest);
+
+	assert(station_db_find(oldest_call) == oldest);
+
+	// positionless frames keep the previous position
+	uint8_t idx = station_db_find(m_calls[0]);
+	const station_db_entry_t *entry = station_db_get(idx);
+	int32_t lat_before = entry->lat;
+
+	memset(&frame, 0, sizeof(frame));
+	strcpy(frame.source, m_calls[0]);
+	station_db_insert(&frame, &raw, NUM_PACKETS + 3, true, STATION_DB_INVALID);
+
+	assert(entry->has_position);
+	assert(entry->lat == lat_before);
+
+	printf("consistency checks passed\n");
+}
+
+
+static void benchmark(void)
+{
+	static aprs_frame_t       frames[NUM_PACKETS / 10];
+	static aprs_rx_raw_data_t raws[NUM_PACKETS / 10];
+
+	const uint32_t n_frames = NUM_PACKETS / 10;
+
+	double t_insert = 0, t_find = 0;
+	double t_lin_insert = 0, t_lin_find = 0;
+	volatile uint32_t found = 0;
+
+	station_db_init();
+	m_linear_count = 0;
+
+	// frames are prepared in chunks so preparation is not measured
+	for(uint32_t chunk = 0; chunk < NUM_PACKETS; chunk += n_frames) {
+		for(uint32_t i = 0; i < n_frames; i++) {
+			make_frame(chunk + i, &frames[i], &raws[i]);
+		}
+
+		double t0 = now_ns();
+		for(uint32_t i = 0; i < n_frames; i++) {
+			station_db_insert(&frames[i], &raws[i], chunk + i + 1, true, STATION_DB_INVALID);
+		}
+
+		double t1 = now_ns();
+		for(uint32_t i = 0; i < n_frames; i++) {
+			found += (station_db_find(frames[i].source) != STATION_DB_INVALID);
+		}
+
+		double t2 = now_ns();
+		for(uint32_t i = 0; i < n_frames; i++) {
+			linear_insert(&frames[i], &raws[i], chunk + i + 1);
+		}
+
+		double t3 = now_ns();
+		for(uint32_t i = 0; i < n_frames; i++) {
+			found += (linear_find(frames[i].source) != STATION_DB_INVALID);
+		}
+
+		double t4 = now_ns();
+
+		t_insert += t1 - t0;
+		t_find += t2 - t1;
+		t_lin_insert += t3 - t2;
+		t_lin_find += t4 - t3;
+	}
+
+	uint32_t raw_available = 0;
+	uint8_t buf[256];
+	uint8_t len;
+
+	for(uint8_t idx = station_db_first(); idx != STATION_DB_INVALID; idx = station_db_next(idx)) {
+		raw_available += station_db_get_raw(idx, buf, &len);
+	}
+
+	printf("\n%u packets from %u stations, database size %u\n\n",
+			NUM_PACKETS, NUM_CALLS, STATION_DB_SIZE);
+
+	printf("%-22s %12s %12s %12s\n", "", "insert/ns", "lookup/ns", "RAM/bytes");
+	printf("%-22s %12.1f %12.1f %12zu\n", "station database",
+			t_insert / NUM_PACKETS, t_find / NUM_PACKETS,
+			sizeof(station_db_entry_t) * STATION_DB_SIZE + STATION_DB_HASH_BUCKETS + STATION_DB_ARENA_SIZE);
+	printf("%-22s %12.1f %12.1f %12zu\n", "linear (old layout)",
+			t_lin_insert / NUM_PACKETS, t_lin_find / NUM_PACKETS,
+			sizeof(m_linear));
+
+	printf("\nraw frame still available for %u of %u stations\n",
+			raw_available, station_db_count());
+}
+
+
+int main(void)
+{
+	generate_trace();
+
+	test_consistency();
+	benchmark();
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Host test for the APRS telemetry.
+ *
+ * Feeds sensor samples into the aggregation and checks the generated
+ * definition and data frames.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/aprs.h"
+#include "../../src/telemetry.h"
+#include "../../src/time_base.h"
+#include "../../src/wall_clock.h"
+
+#define MYCALL "DL1ABC-7"
+
+// stubs for the modules used by aprs.c
+uint64_t time_base_get(void)
+{
+	return 0;
+}
+
+void wall_clock_get_utc(struct tm *utc)
+{
+	memset(utc, 0, sizeof(*utc));
+}
+
+
+/* Build the next frame and compare its text (without the LoRa header). */
+static void expect_frame(uint64_t now, const char *expected)
+{
+	uint8_t frame[APRS_MAX_FRAME_LEN];
+	size_t len = telemetry_build_next_frame(frame, now);
+
+	if(!expected) {
+		assert(len == 0);
+		return;
+	}
+
+	assert(len > 3);
+
+	if(strcmp((const char*)frame + 3, expected) != 0) {
+		fprintf(stderr, "expected: %s\n     got: %s\n", expected, frame + 3);
+		assert(false);
+	}
+}
+
+
+static void build_text(uint64_t now, char *text)
+{
+	uint8_t frame[APRS_MAX_FRAME_LEN];
+	size_t len = telemetry_build_next_frame(frame, now);
+
+	assert(len > 3);
+	strcpy(text, (const char*)frame + 3);
+}
+
+
+static void test_aggregation(void)
+{
+	telemetry_stats_t stats;
+
+	telemetry_init();
+
+	telemetry_get_stats(TELEMETRY_CH_VBAT, &stats);
+	assert(stats.count == 0);
+
+	telemetry_add_sample(TELEMETRY_CH_VBAT, 3.9f);
+	telemetry_add_sample(TELEMETRY_CH_VBAT, 3.7f);
+	telemetry_add_sample(TELEMETRY_CH_VBAT, 4.1f);
+
+	telemetry_get_stats(TELEMETRY_CH_VBAT, &stats);
+	assert(stats.count == 3);
+	assert(stats.min == 3.7f);
+	assert(stats.max == 4.1f);
+	assert(stats.avg > 3.899f && stats.avg < 3.901f);
+
+	// channels are independent
+	telemetry_get_stats(TELEMETRY_CH_TEMPERATURE, &stats);
+	assert(stats.count == 0);
+}
+
+
+static void test_frames(void)
+{
+	telemetry_init();
+
+	// the first frame is due after one interval
+	assert(telemetry_get_next_due_time() == TELEMETRY_INTERVAL_MS);
+
+	telemetry_add_sample(TELEMETRY_CH_VBAT, 3.90f);
+	telemetry_add_sample(TELEMETRY_CH_VBAT, 3.80f);
+	telemetry_add_sample(TELEMETRY_CH_TEMPERATURE, 21.0f);
+	telemetry_add_sample(TELEMETRY_CH_TEMPERATURE, 22.0f);
+	telemetry_add_sample(TELEMETRY_CH_HUMIDITY, 55.0f);
+	telemetry_add_sample(TELEMETRY_CH_PRESSURE, 1013.2f);
+
+	// definitions first, each directly followed by the next frame
+	uint64_t now = TELEMETRY_INTERVAL_MS;
+
+	expect_frame(now, MYCALL ">APLETK,WIDE1-1::" MYCALL " :PARM.Vbat,Vmin,Temp,Hum,Press,Sensor");
+	assert(telemetry_get_next_due_time() == 0);
+	expect_frame(now, MYCALL ">APLETK,WIDE1-1::" MYCALL " :UNIT.V,V,degC,%,hPa,ok");
+	assert(telemetry_get_next_due_time() == 0);
+	expect_frame(now, MYCALL ">APLETK,WIDE1-1::" MYCALL " :EQNS.0,0.01,2.5,0,0.01,2.5,0,0.5,-40,0,0.5,0,0,2,550");
+	assert(telemetry_get_next_due_time() == 0);
+
+	// (3.85 - 2.5) / 0.01 = 135, (3.8 - 2.5) / 0.01 = 130,
+	// (21.5 + 40) / 0.5 = 123, 55 / 0.5 = 110, (1013.2 - 550) / 2 = 232
+	expect_frame(now, MYCALL ">APLETK,WIDE1-1:T#000,135,130,123,110,232,10000000");
+	assert(telemetry_get_next_due_time() == now + TELEMETRY_INTERVAL_MS);
+
+	// aggregation restarted. Without the sensor, the weather values are 0.
+	// Out-of-range values are clamped.
+	now += TELEMETRY_INTERVAL_MS;
+	telemetry_add_sample(TELEMETRY_CH_VBAT, 5.6f);
+	telemetry_add_sample(TELEMETRY_CH_VBAT, 2.0f);
+
+	expect_frame(now, MYCALL ">APLETK,WIDE1-1:T#001,130,000,000,000,000,00000000");
+
+	// no data at all: nothing is sent, but the interval restarts
+	now += TELEMETRY_INTERVAL_MS;
+	expect_frame(now, NULL);
+	assert(telemetry_get_next_due_time() == now + TELEMETRY_INTERVAL_MS);
+
+	// definitions are repeated after the configured number of data frames
+	char text[APRS_MAX_FRAME_LEN];
+
+	for(uint8_t i = 2; i < TELEMETRY_DEFINITION_INTERVAL; i++) {
+		now += TELEMETRY_INTERVAL_MS;
+		telemetry_add_sample(TELEMETRY_CH_VBAT, 4.0f);
+		build_text(now, text);
+
+		char expected[32];
+		snprintf(expected, sizeof(expected), ":T#%03u,150,150,", i);
+		assert(strstr(text, expected));
+	}
+
+	now += TELEMETRY_INTERVAL_MS;
+	telemetry_add_sample(TELEMETRY_CH_VBAT, 4.0f);
+
+	build_text(now, text);
+	assert(strstr(text, ":PARM."));
+	build_text(now, text);
+	assert(strstr(text, ":UNIT."));
+	build_text(now, text);
+	assert(strstr(text, ":EQNS."));
+	build_text(now, text);
+	assert(strstr(text, ":T#012,"));
+}
+
+
+static void test_position_without_vbat(void)
+{
+	uint8_t frame[APRS_MAX_FRAME_LEN];
+	aprs_args_t args;
+
+	memset(&args, 0, sizeof(args));
+	args.vbat_millivolt = 3950;
+
+	aprs_update_pos_time(49.0f, 8.4f, 100.0f, 0);
+
+	// battery voltage in the comment of every position report ...
+	aprs_set_config_flags(APRS_FLAG_ADD_VBAT);
+	assert(aprs_build_frame(frame, &args, APRS_PACKET_TYPE_POSITION) > 0);
+	assert(strstr((const char*)frame + 3, "3.95V"));
+
+	// ... is replaced by telemetry
+	aprs_set_config_flags(APRS_FLAG_ADD_VBAT | APRS_FLAG_TELEMETRY);
+	assert(aprs_build_frame(frame, &args, APRS_PACKET_TYPE_POSITION) > 0);
+	assert(!strstr((const char*)frame + 3, "3.95V"));
+}
+
+
+int main(void)
+{
+	aprs_init();
+	aprs_set_source(MYCALL);
+	aprs_set_dest("APLETK");
+	aprs_add_path("WIDE1-1");
+	aprs_set_config_flags(APRS_FLAG_USE_DIGIPEATING | APRS_FLAG_USE_WIDEN_N);
+
+	test_aggregation();
+	test_frames();
+	test_position_without_vbat();
+
+	printf("telemetry checks passed\n");
+
+	return 0;
+}
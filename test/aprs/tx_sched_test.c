@@ -0,0 +1,198 @@
+/*
+ * Host test for the TX scheduler.
+ *
+ * Runs the scheduler in virtual time: a simulated timer fires at the time
+ * returned by tx_sched_get_next_time() and the selected source "transmits" a
+ * packet of fixed length, which is recorded in the airtime budget.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../src/airtime.h"
+#include "../../src/tx_sched.h"
+
+#define FRAME_TOA_MS  2500
+
+#define POS_INTERVAL_MS   60000
+#define WX_INTERVAL_MS   300000
+
+typedef struct {
+	uint32_t count[TX_SCHED_NUM_SOURCES];
+	uint64_t min_gap;
+} sim_result_t;
+
+static void send(tx_sched_source_t source, uint64_t now, uint32_t toa_ms)
+{
+	airtime_record(now, toa_ms);
+	tx_sched_handle_sent(source, now, toa_ms);
+}
+
+
+static void test_basics(void)
+{
+	tx_sched_source_t source;
+
+	airtime_init();
+	tx_sched_init();
+
+	// nothing requested
+	assert(tx_sched_get_next_time() == TX_SCHED_NEVER);
+	assert(!tx_sched_get_due_source(1000, &source));
+
+	// a single request is due at the requested time
+	tx_sched_request(TX_SCHED_SOURCE_WX, 5000);
+	assert(tx_sched_get_next_time() == 5000);
+	assert(!tx_sched_get_due_source(4999, &source));
+	assert(tx_sched_get_due_source(5000, &source));
+	assert(source == TX_SCHED_SOURCE_WX);
+
+	// a new request replaces the old one
+	tx_sched_request(TX_SCHED_SOURCE_WX, 7000);
+	assert(tx_sched_get_due_time(TX_SCHED_SOURCE_WX) == 7000);
+	assert(!tx_sched_get_due_source(5000, &source));
+
+	// position reports take precedence
+	tx_sched_request(TX_SCHED_SOURCE_POSITION, 6000);
+	assert(tx_sched_get_next_time() == 6000);
+	assert(tx_sched_get_due_source(8000, &source));
+	assert(source == TX_SCHED_SOURCE_POSITION);
+
+	// only one packet is sent at a time: the weather report has to wait
+	send(TX_SCHED_SOURCE_POSITION, 8000, FRAME_TOA_MS);
+	assert(tx_sched_get_due_time(TX_SCHED_SOURCE_POSITION) == TX_SCHED_NEVER);
+	assert(tx_sched_get_next_time() == 8000 + TX_SCHED_MIN_INTERVAL_MS);
+	assert(!tx_sched_get_due_source(8000 + TX_SCHED_MIN_INTERVAL_MS - 1, &source));
+	assert(tx_sched_get_due_source(8000 + TX_SCHED_MIN_INTERVAL_MS, &source));
+	assert(source == TX_SCHED_SOURCE_WX);
+
+	// cancelled requests are not sent
+	tx_sched_cancel(TX_SCHED_SOURCE_WX);
+	assert(tx_sched_get_next_time() == TX_SCHED_NEVER);
+	assert(!tx_sched_get_due_source(100000, &source));
+
+	// the minimum interval does not delay requests for a later time
+	tx_sched_request(TX_SCHED_SOURCE_POSITION, 50000);
+	assert(tx_sched_get_next_time() == 50000);
+}
+
+
+static void test_airtime_budget(void)
+{
+	tx_sched_source_t source;
+
+	const uint32_t budget_ms = (uint64_t)AIRTIME_WINDOW_MS * AIRTIME_BUDGET_PERCENT / 100;
+
+	airtime_init();
+	tx_sched_init();
+
+	// the previous packet of the source is used as estimate
+	send(TX_SCHED_SOURCE_POSITION, 0, FRAME_TOA_MS);
+
+	// other transmissions (e.g. digipeated frames) used up the budget
+	airtime_record(1000, budget_ms - FRAME_TOA_MS);
+
+	tx_sched_request(TX_SCHED_SOURCE_POSITION, 20000);
+	assert(!tx_sched_get_due_source(20000, &source));
+
+	// retried later instead of every time the timer fires
+	assert(tx_sched_get_next_time() == 20000 + TX_SCHED_BUDGET_RETRY_MS);
+	assert(!tx_sched_get_due_source(20000 + TX_SCHED_BUDGET_RETRY_MS - 1, &source));
+
+	// available again once the used airtime has left the window
+	assert(tx_sched_get_due_source(AIRTIME_WINDOW_MS + 60000, &source));
+	assert(source == TX_SCHED_SOURCE_POSITION);
+}
+
+
+/* Periodic position and weather reports plus occasional event-triggered
+ * position reports (like corner pegging) over one hour. */
+static void run_sim(sim_result_t *result)
+{
+	tx_sched_source_t source;
+
+	uint64_t last_pos = 0;
+	uint64_t last_wx = 0;
+	uint64_t last_tx = 0;
+	bool     have_tx = false;
+
+	memset(result, 0, sizeof(*result));
+	result->min_gap = UINT64_MAX;
+
+	airtime_init();
+	tx_sched_init();
+
+	tx_sched_request(TX_SCHED_SOURCE_POSITION, 0);
+	tx_sched_request(TX_SCHED_SOURCE_WX, 0);
+
+	for(;;) {
+		uint64_t now = tx_sched_get_next_time();
+
+		assert(now != TX_SCHED_NEVER);
+
+		if(now >= 3600000) {
+			break;
+		}
+
+		// a turn shortly after some reports: the trigger is requested
+		// immediately, but must respect the minimum interval
+		if(result->count[TX_SCHED_SOURCE_POSITION] % 7 == 3) {
+			tx_sched_request(TX_SCHED_SOURCE_POSITION, last_pos + 5000);
+			now = tx_sched_get_next_time();
+		}
+
+		if(!tx_sched_get_due_source(now, &source)) {
+			continue;
+		}
+
+		// never before the requested time
+		assert(tx_sched_get_due_time(source) <= now);
+
+		if(have_tx) {
+			uint64_t gap = now - last_tx;
+
+			if(gap < result->min_gap) {
+				result->min_gap = gap;
+			}
+		}
+
+		send(source, now, FRAME_TOA_MS);
+		result->count[source]++;
+		last_tx = now;
+		have_tx = true;
+
+		// the sources request their next periodic report
+		if(source == TX_SCHED_SOURCE_POSITION) {
+			last_pos = now;
+			tx_sched_request(TX_SCHED_SOURCE_POSITION, last_pos + POS_INTERVAL_MS);
+		} else {
+			last_wx = now;
+			tx_sched_request(TX_SCHED_SOURCE_WX, last_wx + WX_INTERVAL_MS);
+		}
+	}
+}
+
+
+int main(void)
+{
+	sim_result_t result;
+
+	test_basics();
+	test_airtime_budget();
+
+	run_sim(&result);
+
+	printf("1 h simulation: %u position reports, %u weather reports, min. gap %.1f s\n",
+			result.count[TX_SCHED_SOURCE_POSITION],
+			result.count[TX_SCHED_SOURCE_WX],
+			result.min_gap / 1000.0);
+
+	assert(result.min_gap >= TX_SCHED_MIN_INTERVAL_MS);
+	assert(result.count[TX_SCHED_SOURCE_WX] >= 11 && result.count[TX_SCHED_SOURCE_WX] <= 12);
+	assert(result.count[TX_SCHED_SOURCE_POSITION] >= 60);
+
+	printf("TX scheduler checks passed\n");
+
+	return 0;
+}
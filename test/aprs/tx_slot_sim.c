@@ -0,0 +1,343 @@
+/*
+ * Multi-node simulation for the slotted transmission mode.
+ *
+ * A number of trackers share one channel and are all in range of each other.
+ * Each one generates position reports at random intervals and transmits them
+ * either immediately or at the beginning of its slot. The clock of every node
+ * lags behind the true GNSS time by the NMEA output delay of its receiver. Two
+ * transmissions that overlap in time are both counted as lost (no capture
+ * effect). Frames that were not lost are received by all other nodes, which
+ * use them to learn which slots are occupied.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/airtime.h"
+#include "../../src/tx_slot.h"
+
+#define SIM_DURATION_MS  (24 * 3600000ULL) // 24 hours
+
+// GNSS time at the start of the simulation
+#define SIM_START_UNIX_MS  1700000000000ULL
+
+// reports are generated every 60 to 180 seconds, like SmartBeaconing does
+// while moving
+#define MIN_REPORT_INTERVAL_MS   60000
+#define MAX_REPORT_INTERVAL_MS  180000
+
+// typical lengths of position reports
+#define MIN_FRAME_LEN  40
+#define MAX_FRAME_LEN  80
+
+// NMEA output delay of the GNSS module (per node) plus jitter (per report)
+#define MIN_CLOCK_LAG_MS   50
+#define MAX_CLOCK_LAG_MS  400
+#define MAX_JITTER_MS      50
+
+#define MAX_NODES     40
+#define MAX_ACTIVE    MAX_NODES
+
+#define NO_EVENT  UINT64_MAX
+
+typedef enum {
+	MODE_UNSLOTTED,
+	MODE_HASH_ONLY,   // slots from the call sign hash, no occupancy learning
+	MODE_ADAPTIVE
+} sim_mode_t;
+
+typedef struct {
+	uint64_t start;
+	uint64_t end;
+	uint8_t  node;
+	bool     collided;
+} tx_t;
+
+typedef struct {
+	char      call[16];
+	uint32_t  clock_lag;
+	tx_slot_t slot;
+	uint64_t  next_report;
+	uint64_t  pending_start;
+	uint32_t  pending_len;
+	bool      transmitting;
+} node_t;
+
+typedef struct {
+	uint32_t tx_count;
+	uint32_t collisions;
+	uint64_t delay_sum;
+	uint32_t delay_max;
+} result_t;
+
+static const uint8_t NODE_COUNTS[] = {5, 10, 20, 40};
+
+static node_t m_nodes[MAX_NODES];
+
+static tx_t   m_active[MAX_ACTIVE];
+static size_t m_active_count;
+
+static uint32_t m_rand_state;
+
+static uint32_t sim_random_range(uint32_t min, uint32_t max)
+{
+	m_rand_state = m_rand_state * 1103515245u + 12345u;
+	return min + (m_rand_state >> 8) % (max - min + 1);
+}
+
+
+static void generate_report(uint8_t n_nodes, uint8_t idx, sim_mode_t mode, result_t *result)
+{
+	node_t *node = &m_nodes[idx];
+
+	uint64_t now = node->next_report;
+	uint32_t frame_len = sim_random_range(MIN_FRAME_LEN, MAX_FRAME_LEN);
+	uint32_t jitter = sim_random_range(0, MAX_JITTER_MS);
+
+	(void)n_nodes;
+
+	node->next_report += sim_random_range(MIN_REPORT_INTERVAL_MS, MAX_REPORT_INTERVAL_MS);
+
+	if(node->transmitting || node->pending_start != NO_EVENT) {
+		// the tracker does not generate reports while one is waiting
+		return;
+	}
+
+	uint32_t delay = 0;
+
+	if(mode != MODE_UNSLOTTED) {
+		uint64_t node_unix_ms = SIM_START_UNIX_MS + now - node->clock_lag - jitter;
+		delay = tx_slot_calc_delay_ms(&node->slot, node->call, node_unix_ms);
+
+		assert(delay < TX_SLOT_CYCLE_MS);
+		assert(delay == 0 || (node_unix_ms + delay) % TX_SLOT_LENGTH_MS == 0);
+
+		result->delay_sum += delay;
+		if(delay > result->delay_max) {
+			result->delay_max = delay;
+		}
+	}
+
+	node->pending_start = now + delay;
+	node->pending_len = frame_len;
+}
+
+
+static void start_tx(uint8_t idx)
+{
+	node_t *node = &m_nodes[idx];
+	tx_t *tx = &m_active[m_active_count];
+
+	assert(m_active_count < MAX_ACTIVE);
+
+	tx->start = node->pending_start;
+	tx->end = tx->start + airtime_calc_toa_ms(node->pending_len);
+	tx->node = idx;
+	tx->collided = false;
+
+	for(size_t i = 0; i < m_active_count; i++) {
+		if(m_active[i].end > tx->start) {
+			m_active[i].collided = true;
+			tx->collided = true;
+		}
+	}
+
+	m_active_count++;
+
+	node->pending_start = NO_EVENT;
+	node->transmitting = true;
+}
+
+
+static void end_tx(uint8_t n_nodes, size_t active_idx, sim_mode_t mode, result_t *result)
+{
+	tx_t tx = m_active[active_idx];
+
+	m_active[active_idx] = m_active[m_active_count - 1];
+	m_active_count--;
+
+	m_nodes[tx.node].transmitting = false;
+
+	result->tx_count++;
+
+	if(tx.collided) {
+		result->collisions++;
+		return;
+	}
+
+	if(mode != MODE_ADAPTIVE) {
+		return;
+	}
+
+	for(uint8_t i = 0; i < n_nodes; i++) {
+		if(i != tx.node) {
+			tx_slot_handle_rx(&m_nodes[i].slot, SIM_START_UNIX_MS + tx.start - m_nodes[i].clock_lag);
+		}
+	}
+}
+
+
+static void run(uint8_t n_nodes, sim_mode_t mode, result_t *result)
+{
+	memset(result, 0, sizeof(*result));
+	m_active_count = 0;
+
+	// same nodes and reports in all modes
+	m_rand_state = 4711;
+
+	for(uint8_t i = 0; i < n_nodes; i++) {
+		node_t *node = &m_nodes[i];
+
+		snprintf(node->call, sizeof(node->call), "DL%u%c%c-%u",
+				i % 10, 'A' + i % 26, 'A' + (i * 7) % 26, 1 + i % 15);
+		node->clock_lag = sim_random_range(MIN_CLOCK_LAG_MS, MAX_CLOCK_LAG_MS);
+		node->next_report = sim_random_range(0, MAX_REPORT_INTERVAL_MS);
+		node->pending_start = NO_EVENT;
+		node->transmitting = false;
+
+		tx_slot_init(&node->slot);
+	}
+
+	for(;;) {
+		// find the next event. Ends of transmissions are handled before
+		// simultaneous starts, so back-to-back frames do not collide.
+		uint64_t next = NO_EVENT;
+		int end_idx = -1;
+		int start_idx = -1;
+		int report_idx = -1;
+
+		for(size_t i = 0; i < m_active_count; i++) {
+			if(m_active[i].end < next) {
+				next = m_active[i].end;
+				end_idx = i;
+			}
+		}
+
+		for(uint8_t i = 0; i < n_nodes; i++) {
+			if(m_nodes[i].pending_start < next) {
+				next = m_nodes[i].pending_start;
+				end_idx = -1;
+				start_idx = i;
+			}
+		}
+
+		for(uint8_t i = 0; i < n_nodes; i++) {
+			if(m_nodes[i].next_report < next) {
+				next = m_nodes[i].next_report;
+				end_idx = -1;
+				start_idx = -1;
+				report_idx = i;
+			}
+		}
+
+		if(next >= SIM_DURATION_MS) {
+			break;
+		}
+
+		if(end_idx >= 0) {
+			end_tx(n_nodes, end_idx, mode, result);
+		} else if(start_idx >= 0) {
+			start_tx(start_idx);
+		} else {
+			generate_report(n_nodes, report_idx, mode, result);
+		}
+	}
+}
+
+
+static void test_slot_selection(void)
+{
+	tx_slot_t ctx;
+	uint64_t cycle_start = 1000ULL * TX_SLOT_CYCLE_MS;
+
+	tx_slot_init(&ctx);
+
+	// the first slot is derived from the call sign
+	tx_slot_calc_delay_ms(&ctx, "DL1ABC-7", cycle_start);
+	uint8_t slot = tx_slot_get_slot(&ctx);
+	uint64_t slot_start = cycle_start + slot * TX_SLOT_LENGTH_MS;
+
+	// a slot that has just begun can still be used, a later one can not
+	assert(tx_slot_calc_delay_ms(&ctx, "DL1ABC-7", slot_start - 100) == 100);
+	assert(tx_slot_calc_delay_ms(&ctx, "DL1ABC-7", slot_start) == 0);
+	assert(tx_slot_calc_delay_ms(&ctx, "DL1ABC-7", slot_start + TX_SLOT_MAX_LATE_MS) == 0);
+	assert(tx_slot_calc_delay_ms(&ctx, "DL1ABC-7", slot_start + TX_SLOT_MAX_LATE_MS + 1)
+			== TX_SLOT_CYCLE_MS - TX_SLOT_MAX_LATE_MS - 1);
+
+	// another station heard slightly before the own slot starts: move away
+	tx_slot_handle_rx(&ctx, slot_start - 200);
+	tx_slot_calc_delay_ms(&ctx, "DL1ABC-7", slot_start + 1000);
+	assert(tx_slot_get_slot(&ctx) != slot);
+
+	// the old slot is free again after some cycles
+	uint8_t new_slot = tx_slot_get_slot(&ctx);
+	uint64_t later_cycle_start = cycle_start + TX_SLOT_OCCUPIED_CYCLES * TX_SLOT_CYCLE_MS;
+
+	tx_slot_handle_rx(&ctx, later_cycle_start - TX_SLOT_CYCLE_MS + new_slot * TX_SLOT_LENGTH_MS);
+
+	for(uint8_t i = 0; i < TX_SLOT_COUNT; i++) {
+		if(i != slot && i != new_slot) {
+			tx_slot_handle_rx(&ctx, later_cycle_start + i * TX_SLOT_LENGTH_MS);
+		}
+	}
+
+	tx_slot_calc_delay_ms(&ctx, "DL1ABC-7", later_cycle_start);
+	assert(tx_slot_get_slot(&ctx) == slot);
+
+	// all slots occupied: use the one that was free for the longest time
+	tx_slot_handle_rx(&ctx, later_cycle_start + slot * TX_SLOT_LENGTH_MS);
+	tx_slot_calc_delay_ms(&ctx, "DL1ABC-7", later_cycle_start + 100);
+	assert(tx_slot_get_slot(&ctx) == new_slot);
+
+	// a new call sign starts over with its own slot
+	tx_slot_init(&ctx);
+	tx_slot_calc_delay_ms(&ctx, "DL1ABC-8", cycle_start);
+	tx_slot_calc_delay_ms(&ctx, "DL1ABC-7", cycle_start);
+	assert(tx_slot_get_slot(&ctx) == slot);
+}
+
+
+int main(void)
+{
+	airtime_init();
+
+	// the longest report must fit into a slot despite the clock differences
+	assert(airtime_calc_toa_ms(MAX_FRAME_LEN) + (MAX_CLOCK_LAG_MS - MIN_CLOCK_LAG_MS) + MAX_JITTER_MS < TX_SLOT_LENGTH_MS);
+
+	test_slot_selection();
+
+	printf("%5s | %8s | %10s | %10s | %10s | %9s | %9s\n",
+			"nodes", "reports", "unslotted", "hash only", "adaptive", "avg delay", "max delay");
+
+	for(size_t i = 0; i < sizeof(NODE_COUNTS); i++) {
+		result_t unslotted, hash_only, adaptive;
+
+		run(NODE_COUNTS[i], MODE_UNSLOTTED, &unslotted);
+		run(NODE_COUNTS[i], MODE_HASH_ONLY, &hash_only);
+		run(NODE_COUNTS[i], MODE_ADAPTIVE, &adaptive);
+
+		double rate_unslotted = 100.0 * unslotted.collisions / unslotted.tx_count;
+		double rate_hash_only = 100.0 * hash_only.collisions / hash_only.tx_count;
+		double rate_adaptive = 100.0 * adaptive.collisions / adaptive.tx_count;
+
+		printf("%5u | %8u | %8.1f %% | %8.1f %% | %8.1f %% | %7.1f s | %7.1f s\n",
+				NODE_COUNTS[i], adaptive.tx_count,
+				rate_unslotted, rate_hash_only, rate_adaptive,
+				adaptive.delay_sum / 1000.0 / adaptive.tx_count,
+				adaptive.delay_max / 1000.0);
+
+		assert(rate_adaptive < rate_unslotted);
+
+		// as long as there are enough slots, the stations settle on
+		// different ones
+		if(NODE_COUNTS[i] <= TX_SLOT_COUNT) {
+			assert(rate_adaptive < 1.0);
+		}
+	}
+
+	printf("TX slot checks passed\n");
+
+	return 0;
+}
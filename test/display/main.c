@@ -9,6 +9,7 @@
 
 #include "utils.h"
 #include "aprs.h"
+#include "station_db.h"
 #include "nmea.h"
 #include "menusystem.h"
 
@@ -140,7 +141,7 @@ bool m_aprs_decode_ok = true;
 uint8_t m_display_message[256] = "Hello World!";
 uint8_t m_display_message_len = 12;
 
-uint8_t m_display_rx_index = 0;
+uint8_t m_display_rx_index = STATION_DB_INVALID;
 
 float m_rssi = -100, m_snr = 42, m_signalRssi = -127;
 
@@ -249,6 +250,7 @@ int main(int argc, char **argv) {
 	aprs_set_dest("APZTK1");
 
 	menusystem_init(cb_menusystem);
+	station_db_init();
 
 	screen = init_sdl();
 
@@ -263,7 +265,7 @@ int main(int argc, char **argv) {
 	raw.data_len = len;
 
 	if(aprs_parse_frame((uint8_t*)data, strlen(data), &frame)) {
-		aprs_rx_history_insert(&frame, &raw, time(NULL)-10, true, 255);
+		station_db_insert(&frame, &raw, time(NULL)-10, true, STATION_DB_INVALID);
 	}
 
 	raw.signalRssi = -123.0f;
@@ -275,7 +277,7 @@ int main(int argc, char **argv) {
 	raw.data_len = len;
 
 	if(aprs_parse_frame((uint8_t*)data, strlen(data), &frame)) {
-		aprs_rx_history_insert(&frame, &raw, time(NULL)-10000, true, 255);
+		station_db_insert(&frame, &raw, time(NULL)-10000, true, STATION_DB_INVALID);
 	}
 
 	data = "<\xff\001DH0xxx-14>APLC12,qAO,DO2TE-10:!\\6!czQGAQYA2QLoRaCube-System";
@@ -285,7 +287,7 @@ int main(int argc, char **argv) {
 	raw.data_len = len;
 
 	if(aprs_parse_frame((uint8_t*)data, strlen(data), &frame)) {
-		//aprs_rx_history_insert(&frame, &raw, time(NULL)-1000000, 255);
+		//station_db_insert(&frame, &raw, time(NULL)-1000000, true, STATION_DB_INVALID);
 	}
 
 	while(running && SDL_WaitEvent(&event)) {
@@ -308,8 +310,11 @@ int main(int argc, char **argv) {
 			}
 
 			if(m_display_state == DISP_STATE_LORA_RX_OVERVIEW) {
-				m_display_rx_index++;
-				m_display_rx_index %= APRS_RX_HISTORY_SIZE+1;
+				if(m_display_rx_index == STATION_DB_INVALID) {
+					m_display_rx_index = station_db_first();
+				} else {
+					m_display_rx_index = station_db_next(m_display_rx_index);
+				}
 				m_redraw_required = true;
 			}
 		}
@@ -0,0 +1,572 @@
+/*
+ * Host test for the archive of received packets.
+ *
+ * The archive runs against a simulated flash (spi_flash_fake.c) with a
+ * reduced area. The test checks the round trip of the records, reading of
+ * ranges, the wear distribution when the ring wraps around, the number of
+ * reads needed to find the write position and the recovery after power
+ * losses at random points.
+ *
+ * It also writes a download stream in BLE notification sized chunks and the
+ * expected output of tools/ble_client/rx_archive.py, which are compared by
+ * the check target.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "spi_flash_fake.h"
+
+#include "../../src/rx_archive.h"
+
+#define MAX_RECORDS   40000
+
+// notification payload with the maximum ATT MTU
+#define NOTIFY_LEN    244
+
+// at most 2 reads per probed sector, plus a walk through one sector
+#define MAX_INIT_READS  (2 * (4 + 2) + 2 * (SPI_FLASH_SECTOR_SIZE / 30) + 6)
+
+static rx_archive_record_t m_ref[MAX_RECORDS];
+static bool                m_ref_valid[MAX_RECORDS];
+
+static uint32_t m_rand = 4711;
+
+static uint8_t m_stream[256 * 1024];
+
+
+static uint32_t rand_next(void)
+{
+	m_rand = m_rand * 1103515245 + 12345;
+	return m_rand >> 8;
+}
+
+
+static int32_t rand_range(int32_t min, int32_t max)
+{
+	return min + (int32_t)(rand_next() % (uint32_t)(max - min + 1));
+}
+
+
+/**@brief Generate a received frame: mostly position reports, sometimes
+ * long or binary garbage. */
+static void make_record(rx_archive_record_t *record, uint32_t time)
+{
+	memset(record, 0, sizeof(*record));
+
+	record->time  = time;
+	record->flags = (rand_next() % 8) ? RX_ARCHIVE_FLAG_TIME_VALID : 0;
+	record->rssi  = rand_range(-1400, -300);
+	record->snr   = rand_range(-80, 50);
+
+	switch(rand_next() % 4) {
+		case 0:
+			// binary data of any length
+			record->data_len = rand_range(1, RX_ARCHIVE_MAX_FRAME_LEN);
+
+			for(uint16_t i = 0; i < record->data_len; i++) {
+				record->data[i] = rand_next();
+			}
+			break;
+
+		default:
+			record->data_len = snprintf((char *)record->data, sizeof(record->data),
+					"<\xff\x01" "DL%uABC-%u>APLT00,WIDE1-1:!48%02u.%02uN/011%02u.%02uE>%s",
+					rand_range(0, 9), rand_range(1, 15), rand_range(0, 59), rand_range(0, 99),
+					rand_range(0, 59), rand_range(0, 99),
+					(rand_next() % 2) ? "T-Echo, \"quoted\" comment" : "");
+			break;
+	}
+}
+
+
+static bool record_equal(const rx_archive_record_t *a, const rx_archive_record_t *b)
+{
+	return a->seq == b->seq && a->time == b->time && a->rssi == b->rssi && a->snr == b->snr
+		&& a->flags == b->flags && a->data_len == b->data_len
+		&& memcmp(a->data, b->data, a->data_len) == 0;
+}
+
+
+static void append(uint32_t time)
+{
+	rx_archive_record_t record;
+
+	make_record(&record, time);
+
+	assert(rx_archive_append(&record) == NRF_SUCCESS);
+	assert(record.seq < MAX_RECORDS);
+
+	m_ref[record.seq] = record;
+	m_ref_valid[record.seq] = true;
+}
+
+
+/**@brief Read a range and compare it with the reference.
+ * @returns The number of records read.
+ */
+static uint32_t check_range(uint32_t start, uint32_t count)
+{
+	rx_archive_stats_t stats;
+	rx_archive_reader_t reader;
+	rx_archive_record_t record;
+	ret_code_t err_code;
+
+	rx_archive_get_stats(&stats);
+
+	uint32_t expected = (start > stats.first_seq) ? start : stats.first_seq;
+	uint32_t end = stats.next_seq;
+
+	if(count > 0 && expected + count < end) {
+		end = expected + count;
+	}
+
+	assert(rx_archive_read_start(&reader, start, count) == NRF_SUCCESS);
+
+	uint32_t n = 0;
+
+	while((err_code = rx_archive_read_next(&reader, &record)) == NRF_SUCCESS) {
+		assert(record.seq == expected);
+		assert(m_ref_valid[record.seq]);
+		assert(record_equal(&record, &m_ref[record.seq]));
+
+		expected++;
+		n++;
+	}
+
+	assert(err_code == NRF_ERROR_NOT_FOUND);
+	assert(expected >= end);
+
+	rx_archive_read_end(&reader);
+
+	return n;
+}
+
+
+static void reset(void)
+{
+	spi_flash_fake_format();
+	memset(m_ref_valid, 0, sizeof(m_ref_valid));
+
+	assert(rx_archive_init() == NRF_SUCCESS);
+}
+
+
+static void test_empty(void)
+{
+	rx_archive_reader_t reader;
+	rx_archive_stats_t stats;
+	uint8_t buf[NOTIFY_LEN];
+
+	reset();
+
+	rx_archive_get_stats(&stats);
+	assert(stats.first_seq == 0 && stats.next_seq == 0);
+
+	assert(check_range(0, 0) == 0);
+
+	// the stream contains only the end marker
+	assert(rx_archive_read_start(&reader, 0, 0) == NRF_SUCCESS);
+	assert(rx_archive_read_stream(&reader, buf, sizeof(buf)) == RX_ARCHIVE_STREAM_END_LEN);
+	assert(buf[0] == 0xFF && buf[1] == 0xFF);
+	assert(buf[2] == 0 && buf[3] == 0 && buf[4] == 0 && buf[5] == 0);
+	assert(rx_archive_read_stream(&reader, buf, sizeof(buf)) == 0);
+	rx_archive_read_end(&reader);
+
+	// invalid frames are rejected
+	rx_archive_record_t record;
+	memset(&record, 0, sizeof(record));
+	assert(rx_archive_append(&record) == NRF_ERROR_INVALID_LENGTH);
+}
+
+
+static void test_roundtrip(void)
+{
+	rx_archive_stats_t stats;
+	spi_flash_fake_stats_t flash_before, flash_after;
+
+	reset();
+
+	spi_flash_fake_get_stats(&flash_before);
+
+	for(uint32_t i = 0; i < 300; i++) {
+		append(1700000000 + 17 * i);
+	}
+
+	spi_flash_fake_get_stats(&flash_after);
+	rx_archive_get_stats(&stats);
+
+	// every record is written immediately with one power-up
+	assert(flash_after.power_ups - flash_before.power_ups == 300);
+	assert(stats.records == 300 && stats.write_errors == 0);
+
+	printf("roundtrip: %u records, %u bytes, %u sector erases\n",
+			stats.records, stats.bytes, stats.sector_erases);
+
+	assert(check_range(0, 0) == 300);
+
+	// the same records are found after a restart
+	assert(rx_archive_init() == NRF_SUCCESS);
+
+	rx_archive_get_stats(&stats);
+	assert(stats.first_seq == 0 && stats.next_seq == 300);
+	assert(stats.init_reads <= MAX_INIT_READS);
+
+	assert(check_range(0, 0) == 300);
+
+	// ranges
+	assert(check_range(0, 1) == 1);
+	assert(check_range(299, 10) == 1);
+	assert(check_range(300, 0) == 0);
+	assert(check_range(1000, 5) == 0);
+
+	for(int i = 0; i < 200; i++) {
+		uint32_t start = rand_range(0, 320);
+		uint32_t count = rand_range(0, 50);
+
+		check_range(start, count);
+	}
+
+	// the archive continues at the same position
+	for(uint32_t i = 300; i < 400; i++) {
+		append(1700000000 + 17 * i);
+	}
+
+	assert(check_range(0, 0) == 400);
+}
+
+
+static void test_queue(void)
+{
+	rx_archive_record_t record;
+	rx_archive_stats_t stats;
+
+	reset();
+
+	for(uint32_t i = 0; i < RX_ARCHIVE_QUEUE_DEPTH; i++) {
+		make_record(&record, 1700000000 + i);
+		assert(rx_archive_push(&record));
+
+		record.seq = i;
+		m_ref[i] = record;
+		m_ref_valid[i] = true;
+	}
+
+	// full
+	assert(!rx_archive_push(&record));
+
+	assert(rx_archive_write_queued() == NRF_SUCCESS);
+
+	rx_archive_get_stats(&stats);
+	assert(stats.dropped == 1);
+	assert(stats.next_seq == RX_ARCHIVE_QUEUE_DEPTH);
+
+	assert(check_range(0, 0) == RX_ARCHIVE_QUEUE_DEPTH);
+}
+
+
+/**@brief Escape a frame like rx_archive.py does. */
+static void write_csv_frame(FILE *f, const uint8_t *data, size_t len)
+{
+	char text[4 * RX_ARCHIVE_MAX_FRAME_LEN + 1];
+	size_t pos = 0;
+	bool quote = false;
+
+	for(size_t i = 0; i < len; i++) {
+		if(data[i] == '\\') {
+			pos += sprintf(&text[pos], "\\\\");
+		} else if(data[i] < 0x20 || data[i] >= 0x7F) {
+			pos += sprintf(&text[pos], "\\x%02x", data[i]);
+		} else {
+			text[pos++] = data[i];
+			quote |= (data[i] == ',' || data[i] == '"');
+		}
+	}
+
+	text[pos] = '\0';
+
+	if(!quote) {
+		fputs(text, f);
+		return;
+	}
+
+	fputc('"', f);
+
+	for(size_t i = 0; i < pos; i++) {
+		if(text[i] == '"') {
+			fputc('"', f);
+		}
+
+		fputc(text[i], f);
+	}
+
+	fputc('"', f);
+}
+
+
+static void test_stream(const char *stream_path, const char *expected_path)
+{
+	rx_archive_reader_t reader;
+	uint8_t small[7];
+	size_t stream_len = 0;
+	size_t len;
+	uint32_t notifications = 0;
+
+	reset();
+
+	for(uint32_t i = 0; i < 500; i++) {
+		append(1700000000 + 23 * i);
+	}
+
+	// a range from the middle, in notifications of the maximum size
+	assert(rx_archive_read_start(&reader, 100, 250) == NRF_SUCCESS);
+
+	while((len = rx_archive_read_stream(&reader, &m_stream[stream_len], NOTIFY_LEN)) > 0) {
+		stream_len += len;
+		notifications++;
+
+		// only the last notification is not full
+		assert(len == NOTIFY_LEN || rx_archive_read_stream(&reader, small, sizeof(small)) == 0);
+		assert(stream_len + NOTIFY_LEN <= sizeof(m_stream));
+	}
+
+	rx_archive_read_end(&reader);
+
+	// the stream does not depend on the chunk size
+	assert(rx_archive_read_start(&reader, 100, 250) == NRF_SUCCESS);
+
+	size_t pos = 0;
+
+	while((len = rx_archive_read_stream(&reader, small, sizeof(small))) > 0) {
+		assert(memcmp(small, &m_stream[pos], len) == 0);
+		pos += len;
+	}
+
+	assert(pos == stream_len);
+	rx_archive_read_end(&reader);
+
+	FILE *f = fopen(stream_path, "wb");
+	assert(f);
+	assert(fwrite(m_stream, 1, stream_len, f) == stream_len);
+	fclose(f);
+
+	f = fopen(expected_path, "w");
+	assert(f);
+
+	fprintf(f, "seq,time,rssi_dbm,snr_db,frame\n");
+
+	size_t payload = 0;
+
+	for(uint32_t seq = 100; seq < 350; seq++) {
+		const rx_archive_record_t *r = &m_ref[seq];
+
+		fprintf(f, "%u,", r->seq);
+
+		if(r->flags & RX_ARCHIVE_FLAG_TIME_VALID) {
+			char buf[32];
+			time_t t = r->time;
+			strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+			fputs(buf, f);
+		}
+
+		fprintf(f, ",%.1f,%.2f,", r->rssi / 10.0, r->snr / 4.0);
+		write_csv_frame(f, r->data, r->data_len);
+		fprintf(f, "\n");
+
+		payload += r->data_len;
+	}
+
+	fclose(f);
+
+	printf("stream: 250 records with %zu frame bytes in %zu bytes, %u notifications\n",
+			payload, stream_len, notifications);
+}
+
+
+static void test_wrap(void)
+{
+	rx_archive_stats_t stats;
+	spi_flash_fake_stats_t flash_stats;
+	uint32_t max_init_reads = 0;
+	uint32_t min_kept = UINT32_MAX;
+
+	reset();
+
+	uint32_t n = 0;
+
+	while(n < 6 * RX_ARCHIVE_NUM_SECTORS * 25) {
+		append(1700000000 + n);
+		n++;
+
+		if(n % 97 != 0) {
+			continue;
+		}
+
+		uint32_t first_before, next_before;
+
+		rx_archive_get_stats(&stats);
+		first_before = stats.first_seq;
+		next_before = stats.next_seq;
+
+		assert(rx_archive_init() == NRF_SUCCESS);
+
+		rx_archive_get_stats(&stats);
+		assert(stats.next_seq == next_before);
+		assert(stats.first_seq == first_before);
+
+		if(stats.init_reads > max_init_reads) {
+			max_init_reads = stats.init_reads;
+		}
+
+		uint32_t kept = check_range(0, 0);
+		assert(kept == stats.next_seq - stats.first_seq);
+
+		if(n > RX_ARCHIVE_NUM_SECTORS * 30 && kept < min_kept) {
+			min_kept = kept;
+		}
+
+		check_range(stats.next_seq - 10, 5);
+		check_range(stats.first_seq + 1, 3);
+	}
+
+	spi_flash_fake_get_stats(&flash_stats);
+
+	uint32_t first_sector = RX_ARCHIVE_FLASH_START / SPI_FLASH_SECTOR_SIZE;
+	uint32_t min_erases = UINT32_MAX;
+	uint32_t max_erases = 0;
+
+	for(uint32_t s = 0; s < SPI_FLASH_NUM_SECTORS; s++) {
+		if(s < first_sector || s >= first_sector + RX_ARCHIVE_NUM_SECTORS) {
+			// nothing outside the archive area is touched
+			assert(flash_stats.erases[s] == 0);
+			continue;
+		}
+
+		if(flash_stats.erases[s] < min_erases) {
+			min_erases = flash_stats.erases[s];
+		}
+
+		if(flash_stats.erases[s] > max_erases) {
+			max_erases = flash_stats.erases[s];
+		}
+	}
+
+	printf("wrap: %u records, at least %u kept, erases per sector %u to %u, max. %u reads at startup\n",
+			n, min_kept, min_erases, max_erases, max_init_reads);
+
+	assert(max_erases - min_erases <= 1);
+	assert(max_init_reads <= MAX_INIT_READS);
+
+	// all sectors except the one being written hold records
+	assert(min_kept >= (RX_ARCHIVE_NUM_SECTORS - 1) * (SPI_FLASH_SECTOR_SIZE / RX_ARCHIVE_MAX_RECORD_LEN));
+}
+
+
+static void test_bad_page(void)
+{
+	rx_archive_stats_t stats;
+
+	reset();
+	spi_flash_fake_set_bad_page(RX_ARCHIVE_FLASH_START + SPI_FLASH_SECTOR_SIZE + SPI_FLASH_PAGE_SIZE);
+
+	for(uint32_t i = 0; i < 200; i++) {
+		append(1700000000 + i);
+	}
+
+	rx_archive_get_stats(&stats);
+	assert(stats.write_errors == 1);
+
+	assert(check_range(0, 0) == 200);
+
+	assert(rx_archive_init() == NRF_SUCCESS);
+	assert(check_range(0, 0) == 200);
+}
+
+
+static void test_power_loss(void)
+{
+	rx_archive_stats_t stats;
+	uint32_t losses = 0;
+	uint32_t failed = 0;
+	uint32_t max_init_reads = 0;
+	uint32_t time = 1700000000;
+
+	reset();
+
+	while(losses < 300) {
+		spi_flash_fake_power_loss_after(rand_range(0, 30));
+
+		for(int n = rand_range(1, 60); n > 0; n--) {
+			rx_archive_record_t record;
+
+			make_record(&record, time++);
+
+			rx_archive_get_stats(&stats);
+			uint32_t seq = stats.next_seq;
+
+			if(rx_archive_append(&record) != NRF_SUCCESS) {
+				// not stored, the sequence number will be used again
+				failed++;
+				m_ref_valid[seq] = false;
+				break;
+			}
+
+			assert(record.seq == seq);
+			m_ref[seq] = record;
+			m_ref_valid[seq] = true;
+		}
+
+		rx_archive_get_stats(&stats);
+		uint32_t next_before = stats.next_seq;
+
+		losses++;
+		spi_flash_fake_reboot();
+
+		assert(rx_archive_init() == NRF_SUCCESS);
+
+		rx_archive_get_stats(&stats);
+
+		if(stats.init_reads > max_init_reads) {
+			max_init_reads = stats.init_reads;
+		}
+
+		// nothing that was stored successfully is lost
+		assert(stats.next_seq == next_before);
+
+		uint32_t kept = check_range(0, 0);
+		assert(kept == stats.next_seq - stats.first_seq);
+
+		assert(stats.next_seq < MAX_RECORDS - 100);
+	}
+
+	rx_archive_get_stats(&stats);
+
+	printf("power loss: %u losses, %u failed writes, %u records, max. %u reads at startup\n",
+			losses, failed, stats.next_seq, max_init_reads);
+
+	assert(stats.next_seq > RX_ARCHIVE_NUM_SECTORS * 30);
+	assert(max_init_reads <= MAX_INIT_READS);
+}
+
+
+int main(int argc, char **argv)
+{
+	if(argc != 3) {
+		fprintf(stderr, "Usage: %s <stream.bin> <expected.csv>\n", argv[0]);
+		return 1;
+	}
+
+	test_empty();
+	test_roundtrip();
+	test_queue();
+	test_stream(argv[1], argv[2]);
+	test_wrap();
+	test_bad_page();
+	test_power_loss();
+
+	printf("RX archive checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Simulation of the SPI NOR flash for host tests.
+ *
+ * Programming can only clear bits, like on the real flash. Every operation
+ * checks that the flash was powered up before. Power-ups may be nested,
+ * like in the driver. A power loss can be injected
+ * after a given number of program and erase operations: the interrupted
+ * operation leaves a half programmed page or a half erased sector behind.
+ *
+ * A started erase is reported as running for a fixed number of polls. Like
+ * in the driver, any other operation waits for it, which is counted.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "spi_flash_fake.h"
+
+#define NO_BAD_PAGE  UINT32_MAX
+
+static uint8_t  m_flash[SPI_FLASH_SIZE];
+static uint8_t  m_power_refs;
+static uint32_t m_erase_busy;
+
+static bool     m_power_lost;
+static uint32_t m_ops_until_loss;
+static bool     m_loss_armed;
+
+static uint32_t m_bad_page = NO_BAD_PAGE;
+
+static spi_flash_fake_stats_t m_stats;
+
+
+void spi_flash_fake_format(void)
+{
+	memset(m_flash, 0xFF, sizeof(m_flash));
+	memset(&m_stats, 0, sizeof(m_stats));
+
+	m_power_refs = 0;
+	m_erase_busy = 0;
+	m_power_lost = false;
+	m_loss_armed = false;
+	m_bad_page = NO_BAD_PAGE;
+}
+
+
+void spi_flash_fake_power_loss_after(uint32_t ops)
+{
+	m_ops_until_loss = ops;
+	m_loss_armed = true;
+}
+
+
+void spi_flash_fake_reboot(void)
+{
+	m_power_refs = 0;
+	m_erase_busy = 0;
+	m_power_lost = false;
+	m_loss_armed = false;
+}
+
+
+void spi_flash_fake_set_bad_page(uint32_t addr)
+{
+	m_bad_page = addr - (addr % SPI_FLASH_PAGE_SIZE);
+}
+
+
+void spi_flash_fake_get_stats(spi_flash_fake_stats_t *stats)
+{
+	*stats = m_stats;
+}
+
+
+/**@brief Count a program or erase operation.
+ * @retval true if power is lost during this operation.
+ */
+static bool power_fails_now(void)
+{
+	if(!m_loss_armed) {
+		return false;
+	}
+
+	if(m_ops_until_loss == 0) {
+		m_loss_armed = false;
+		m_power_lost = true;
+		return true;
+	}
+
+	m_ops_until_loss--;
+	return false;
+}
+
+
+/**@brief Wait for a started erase, like every operation of the driver.
+ */
+static void finish_erase(void)
+{
+	if(m_erase_busy > 0) {
+		m_erase_busy = 0;
+		m_stats.erase_waits++;
+	}
+}
+
+
+void spi_flash_config_gpios(bool power_supplied)
+{
+	(void)power_supplied;
+}
+
+
+ret_code_t spi_flash_init(void)
+{
+	m_power_refs = 0;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t spi_flash_power_up(void)
+{
+	if(m_power_refs++ == 0) {
+		m_stats.power_ups++;
+	}
+
+	return NRF_SUCCESS;
+}
+
+
+void spi_flash_power_down(void)
+{
+	assert(m_power_refs > 0);
+
+	if(--m_power_refs == 0) {
+		finish_erase();
+	}
+}
+
+
+ret_code_t spi_flash_read(uint32_t addr, uint8_t *data, size_t len)
+{
+	assert(m_power_refs > 0);
+	assert(addr + len <= SPI_FLASH_SIZE);
+
+	if(m_power_lost) {
+		return NRF_ERROR_TIMEOUT;
+	}
+
+	finish_erase();
+
+	memcpy(data, &m_flash[addr], len);
+	m_stats.reads++;
+
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t spi_flash_program(uint32_t addr, const uint8_t *data, size_t len)
+{
+	assert(m_power_refs > 0);
+	assert(len <= SPI_FLASH_PAGE_SIZE);
+	assert((addr % SPI_FLASH_PAGE_SIZE) + len <= SPI_FLASH_PAGE_SIZE);
+
+	if(m_power_lost) {
+		return NRF_ERROR_TIMEOUT;
+	}
+
+	finish_erase();
+
+	if(power_fails_now()) {
+		len /= 2;
+	}
+
+	for(size_t i = 0; i < len; i++) {
+		m_flash[addr + i] &= data[i];
+	}
+
+	// worn cells do not keep the programmed state
+	if(addr - (addr % SPI_FLASH_PAGE_SIZE) == m_bad_page) {
+		for(size_t i = 0; i < len; i++) {
+			m_flash[addr + i] |= 0x01;
+		}
+	}
+
+	m_stats.programs++;
+
+	return m_power_lost ? NRF_ERROR_TIMEOUT : NRF_SUCCESS;
+}
+
+
+ret_code_t spi_flash_erase_sector(uint32_t addr)
+{
+	assert(m_power_refs > 0);
+	assert(addr < SPI_FLASH_SIZE);
+
+	if(m_power_lost) {
+		return NRF_ERROR_TIMEOUT;
+	}
+
+	finish_erase();
+
+	uint32_t start = addr - (addr % SPI_FLASH_SECTOR_SIZE);
+	size_t len = SPI_FLASH_SECTOR_SIZE;
+
+	if(power_fails_now()) {
+		len /= 2;
+	}
+
+	memset(&m_flash[start], 0xFF, len);
+	m_stats.erases[start / SPI_FLASH_SECTOR_SIZE]++;
+
+	return m_power_lost ? NRF_ERROR_TIMEOUT : NRF_SUCCESS;
+}
+
+
+ret_code_t spi_flash_erase_sector_start(uint32_t addr)
+{
+	ret_code_t err_code = spi_flash_erase_sector(addr);
+
+	if(err_code == NRF_SUCCESS) {
+		m_erase_busy = SPI_FLASH_FAKE_ERASE_POLLS;
+	}
+
+	return err_code;
+}
+
+
+ret_code_t spi_flash_erase_poll(void)
+{
+	assert(m_power_refs > 0);
+
+	if(m_power_lost) {
+		return NRF_ERROR_TIMEOUT;
+	}
+
+	if(m_erase_busy == 0) {
+		return NRF_SUCCESS;
+	}
+
+	m_erase_busy--;
+	return NRF_ERROR_BUSY;
+}
@@ -0,0 +1,38 @@
+#ifndef SPI_FLASH_FAKE_H
+#define SPI_FLASH_FAKE_H
+
+#include <stdint.h>
+
+#include "../../src/spi_flash.h"
+
+#define SPI_FLASH_NUM_SECTORS  (SPI_FLASH_SIZE / SPI_FLASH_SECTOR_SIZE)
+
+// polls until an erase started with spi_flash_erase_sector_start() finishes
+#define SPI_FLASH_FAKE_ERASE_POLLS  3
+
+typedef struct {
+	uint32_t power_ups;
+	uint32_t reads;
+	uint32_t programs;
+	uint32_t erases[SPI_FLASH_NUM_SECTORS];
+	uint32_t erase_waits;   // operations that had to wait for a started erase
+} spi_flash_fake_stats_t;
+
+/**@brief Erase the whole flash and reset the statistics. */
+void spi_flash_fake_format(void);
+
+/**@brief Lose power after the given number of further program or erase
+ * operations. The operation at that point is only half done, all following
+ * operations fail until @ref spi_flash_fake_reboot() is called. */
+void spi_flash_fake_power_loss_after(uint32_t ops);
+
+/**@brief Restore power after a power loss. */
+void spi_flash_fake_reboot(void);
+
+/**@brief Let the lowest bit of every byte in the page at the given address
+ * stick at 1, so programming the page cannot be verified. */
+void spi_flash_fake_set_bad_page(uint32_t addr);
+
+void spi_flash_fake_get_stats(spi_flash_fake_stats_t *stats);
+
+#endif // SPI_FLASH_FAKE_H
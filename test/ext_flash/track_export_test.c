@@ -0,0 +1,317 @@
+/*
+ * Host test and benchmark for the export of the track log.
+ *
+ * The track log runs against the simulated flash (spi_flash_fake.c). The
+ * exported GPX stream is compared with a reference generated here with
+ * snprintf() and gmtime(). The compact stream is written to a file and the
+ * reference GPX to another one; the check target converts the former with
+ * tools/ble_client/track_export.py and compares the result.
+ *
+ * The benchmark measures how fast the streams are generated in notification
+ * sized chunks, including reading and decoding the track log. The times are
+ * measured on the host with profiling_now().
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spi_flash_fake.h"
+
+#include "../../src/track_export.h"
+#include "../../src/profiling.h"
+
+#define MAX_FIXES     20000
+
+// notification payload with the maximum ATT MTU
+#define NOTIFY_LEN    244
+
+#define BENCH_ROUNDS  20
+
+static track_log_fix_t m_ref[MAX_FIXES];
+static uint32_t        m_ref_count;
+
+static uint32_t m_rand = 815;
+
+static char    m_expected[4 * 1024 * 1024];
+static uint8_t m_stream[4 * 1024 * 1024];
+
+
+static uint32_t rand_next(void)
+{
+	m_rand = m_rand * 1103515245 + 12345;
+	return m_rand >> 8;
+}
+
+
+static int32_t rand_range(int32_t min, int32_t max)
+{
+	return min + (int32_t)(rand_next() % (uint32_t)(max - min + 1));
+}
+
+
+/**@brief Log a session of the given number of fixes, moving from the start
+ * position with a randomly changing velocity. */
+static void log_session(uint32_t start_time, int32_t lat, int32_t lon, int32_t alt, uint32_t n)
+{
+	track_log_fix_t fix = {start_time, lat, lon, alt};
+	int32_t vlat = rand_range(-10, 10);
+	int32_t vlon = rand_range(-10, 10);
+
+	for(uint32_t i = 0; i < n; i++) {
+		uint32_t dt = rand_range(5, 30);
+
+		vlat += rand_range(-2, 2);
+		vlon += rand_range(-2, 2);
+
+		fix.time += dt;
+		fix.lat  += vlat * (int32_t)dt;
+		fix.lon  += vlon * (int32_t)dt;
+		fix.alt  += rand_range(-2, 2);
+
+		assert(m_ref_count < MAX_FIXES);
+		m_ref[m_ref_count++] = fix;
+
+		assert(track_log_append(&fix) == NRF_SUCCESS);
+	}
+}
+
+
+static void reset(void)
+{
+	spi_flash_fake_format();
+	m_ref_count = 0;
+
+	assert(track_log_init() == NRF_SUCCESS);
+}
+
+
+static size_t format_coord(char *buf, size_t size, int32_t v)
+{
+	uint32_t abs_v = (v < 0) ? -(uint32_t)v : (uint32_t)v;
+
+	return snprintf(buf, size, "%s%u.%06u", (v < 0) ? "-" : "", abs_v / 1000000, abs_v % 1000000);
+}
+
+
+/**@brief Generate the expected GPX for the reference fixes in the time range. */
+static size_t expected_gpx(uint32_t start_time, uint32_t end_time)
+{
+	size_t len = 0;
+	size_t size = sizeof(m_expected);
+	uint32_t n = 0;
+	uint32_t prev_time = 0;
+
+	len += snprintf(m_expected + len, size - len,
+			"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<gpx version=\"1.1\" creator=\"T-Echo LoRa-APRS\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n"
+			"<trk><name>T-Echo track</name>\n");
+
+	for(uint32_t i = 0; i < m_ref_count; i++) {
+		const track_log_fix_t *fix = &m_ref[i];
+
+		if(fix->time < start_time || (end_time != 0 && fix->time > end_time)) {
+			continue;
+		}
+
+		if(n == 0) {
+			len += snprintf(m_expected + len, size - len, "<trkseg>\n");
+		} else if(fix->time < prev_time || fix->time - prev_time > TRACK_EXPORT_SEGMENT_GAP_S) {
+			len += snprintf(m_expected + len, size - len, "</trkseg>\n<trkseg>\n");
+		}
+
+		char lat[16], lon[16], timestr[32];
+		time_t t = fix->time;
+
+		format_coord(lat, sizeof(lat), fix->lat);
+		format_coord(lon, sizeof(lon), fix->lon);
+		strftime(timestr, sizeof(timestr), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+
+		len += snprintf(m_expected + len, size - len,
+				"<trkpt lat=\"%s\" lon=\"%s\"><ele>%d</ele><time>%s</time></trkpt>\n",
+				lat, lon, fix->alt, timestr);
+
+		prev_time = fix->time;
+		n++;
+	}
+
+	if(n > 0) {
+		len += snprintf(m_expected + len, size - len, "</trkseg>\n");
+	}
+
+	len += snprintf(m_expected + len, size - len, "</trk>\n</gpx>\n");
+
+	assert(len < size);
+	return len;
+}
+
+
+/**@brief Export the whole stream with the given chunk size.
+ * @returns The length of the stream in m_stream.
+ */
+static size_t export(track_export_format_t format, uint32_t start_time, uint32_t end_time,
+		size_t chunk_len, uint32_t *fixes)
+{
+	track_export_t exp;
+	size_t len = 0;
+	size_t n;
+
+	assert(track_export_start(&exp, format, start_time, end_time) == NRF_SUCCESS);
+
+	while((n = track_export_read(&exp, &m_stream[len], chunk_len)) > 0) {
+		len += n;
+		assert(len + chunk_len <= sizeof(m_stream));
+
+		// only the last chunk is not full
+		if(n < chunk_len) {
+			assert(track_export_read(&exp, &m_stream[len], chunk_len) == 0);
+			break;
+		}
+	}
+
+	assert(exp.read_error == NRF_SUCCESS);
+	assert(exp.bytes == len);
+
+	if(fixes) {
+		*fixes = exp.fixes;
+	}
+
+	track_export_end(&exp);
+
+	return len;
+}
+
+
+static void check_gpx(uint32_t start_time, uint32_t end_time, size_t chunk_len)
+{
+	size_t expected_len = expected_gpx(start_time, end_time);
+	size_t len = export(TRACK_EXPORT_FORMAT_GPX, start_time, end_time, chunk_len, NULL);
+
+	assert(len == expected_len);
+	assert(memcmp(m_stream, m_expected, len) == 0);
+}
+
+
+static void test_empty(void)
+{
+	track_export_t exp;
+	static const uint8_t compact[] = {'T', 'R', 'K', 1, 0, 0, 0, 0, 0};
+
+	reset();
+
+	check_gpx(0, 0, NOTIFY_LEN);
+
+	assert(export(TRACK_EXPORT_FORMAT_COMPACT, 0, 0, NOTIFY_LEN, NULL) == sizeof(compact));
+	assert(memcmp(m_stream, compact, sizeof(compact)) == 0);
+
+	assert(track_export_start(&exp, TRACK_EXPORT_NUM_FORMATS, 0, 0) == NRF_ERROR_INVALID_PARAM);
+}
+
+
+static void test_formats(const char *compact_path, const char *gpx_path)
+{
+	reset();
+
+	// several sessions with gaps, including negative coordinates close to
+	// zero and a position near the date line
+	log_session(1700000000, 48137000, 11575000, 520, 300);
+	log_session(1700007200, -33868000, 151209000, 12, 200);
+	log_session(1700086400, -400, -300, -5, 50);
+	log_session(1700090000, 71000000, -179999000, 3, 100);
+
+	// leap day and the end of a year
+	log_session(1709164800 - 500, 1000000, 2000000, 1000, 60);
+	log_session(1735689600 - 700, -1000000, -2000000, 4000, 80);
+
+	assert(track_log_flush() == NRF_SUCCESS);
+
+	check_gpx(0, 0, NOTIFY_LEN);
+	check_gpx(0, 0, 1);
+	check_gpx(0, 0, 7);
+
+	// time ranges
+	check_gpx(1700007200, 0, NOTIFY_LEN);
+	check_gpx(1700007200, 1700090000, NOTIFY_LEN);
+	check_gpx(1800000000, 0, NOTIFY_LEN);
+
+	// the compact stream, decoded by the host tool
+	uint32_t fixes;
+	size_t len = export(TRACK_EXPORT_FORMAT_COMPACT, 0, 0, NOTIFY_LEN, &fixes);
+
+	assert(fixes == m_ref_count);
+
+	FILE *f = fopen(compact_path, "wb");
+	assert(f);
+	assert(fwrite(m_stream, 1, len, f) == len);
+	fclose(f);
+
+	size_t gpx_len = expected_gpx(0, 0);
+
+	f = fopen(gpx_path, "wb");
+	assert(f);
+	assert(fwrite(m_expected, 1, gpx_len, f) == gpx_len);
+	fclose(f);
+
+	printf("formats: %u fixes, GPX %zu bytes (%.1f per fix), compact %zu bytes (%.1f per fix)\n",
+			fixes, gpx_len, (double)gpx_len / fixes, len, (double)len / fixes);
+
+	assert(len < 8 * fixes);
+}
+
+
+static void benchmark(void)
+{
+	static const struct {
+		const char *name;
+		track_export_format_t format;
+	} formats[] = {
+		{"GPX",     TRACK_EXPORT_FORMAT_GPX},
+		{"compact", TRACK_EXPORT_FORMAT_COMPACT},
+	};
+
+	reset();
+
+	// fill the log area completely
+	log_session(1700000000, 48137000, 11575000, 520, TRACK_LOG_FLASH_SIZE / 6);
+	assert(track_log_flush() == NRF_SUCCESS);
+
+	printf("%-8s %8s %12s %10s %12s\n", "format", "fixes", "bytes", "MB/s", "fixes/s");
+
+	for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		uint32_t fixes = 0;
+		size_t bytes = 0;
+
+		uint32_t start = profiling_now();
+
+		for(int round = 0; round < BENCH_ROUNDS; round++) {
+			bytes = export(formats[i].format, 0, 0, NOTIFY_LEN, &fixes);
+		}
+
+		uint32_t ticks = profiling_now() - start;
+		double seconds = (double)ticks / (PROFILING_TICKS_PER_US * 1e6);
+
+		printf("%-8s %8u %12zu %10.1f %12.0f\n", formats[i].name, fixes, bytes,
+				bytes * BENCH_ROUNDS / seconds / 1e6, fixes * BENCH_ROUNDS / seconds);
+	}
+
+	printf("measured on the host, including reading the simulated flash\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	if(argc != 3) {
+		fprintf(stderr, "Usage: %s <track.trk> <expected.gpx>\n", argv[0]);
+		return 1;
+	}
+
+	test_empty();
+	test_formats(argv[1], argv[2]);
+	benchmark();
+
+	printf("track export checks passed\n");
+
+	return 0;
+}
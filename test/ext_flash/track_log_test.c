@@ -0,0 +1,496 @@
+/*
+ * Host test for the persistent track log.
+ *
+ * The log runs against a simulated flash (spi_flash_fake.c) with a reduced
+ * log area, so the ring wraps around within a short test. The test checks
+ * the round trip of the delta encoding, the number of flash power-ups, that
+ * sector erases are polled instead of waited for, the wear distribution, the number of reads needed to find the write position
+ * and the recovery after power losses at random points.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_flash_fake.h"
+
+#include "../../src/track_log.h"
+
+#define MAX_FIXES     200000
+
+// reads to find the head: 2 per sector probed, plus the page search
+#define MAX_INIT_READS  (2 * (4 + 1) + 4 + 1)
+
+static track_log_fix_t m_ref[MAX_FIXES];
+static uint32_t        m_ref_count;
+
+static track_log_fix_t m_out[MAX_FIXES];
+static uint32_t        m_out_count;
+
+static uint32_t m_rand = 12345;
+
+static track_log_fix_t m_pos;
+static int32_t m_vlat, m_vlon;
+
+// calls of track_log_write() that found a running erase
+static uint32_t m_erase_polls;
+
+
+static uint32_t rand_next(void)
+{
+	m_rand = m_rand * 1103515245 + 12345;
+	return m_rand >> 8;
+}
+
+
+static int32_t rand_range(int32_t min, int32_t max)
+{
+	return min + (int32_t)(rand_next() % (uint32_t)(max - min + 1));
+}
+
+
+/**@brief Start a pedestrian track near Munich. */
+static void track_start(void)
+{
+	m_pos.time = 1700000000;
+	m_pos.lat = 48137000;
+	m_pos.lon = 11575000;
+	m_pos.alt = 520;
+	m_vlat = 5;
+	m_vlon = -3;
+}
+
+
+/**@brief Get the next fix, 5 to 12 seconds after the previous one. */
+static track_log_fix_t track_next(void)
+{
+	uint32_t dt = rand_range(5, 12);
+
+	m_vlat += rand_range(-2, 2);
+	m_vlon += rand_range(-2, 2);
+
+	m_pos.time += dt;
+	m_pos.lat  += m_vlat * (int32_t)dt;
+	m_pos.lon  += m_vlon * (int32_t)dt;
+	m_pos.alt  += rand_range(-1, 1);
+
+	return m_pos;
+}
+
+
+/**@brief Write a queued page like the main loop, one call per timer tick. */
+static ret_code_t write_pending(void)
+{
+	ret_code_t err_code = NRF_SUCCESS;
+
+	while(track_log_write_pending()) {
+		err_code = track_log_write();
+
+		if(err_code == NRF_ERROR_BUSY) {
+			m_erase_polls++;
+		}
+	}
+
+	return err_code;
+}
+
+
+static void append(const track_log_fix_t *fix)
+{
+	assert(m_ref_count < MAX_FIXES);
+
+	m_ref[m_ref_count++] = *fix;
+	assert(track_log_append(fix) == NRF_SUCCESS);
+	assert(write_pending() == NRF_SUCCESS);
+}
+
+
+static void read_all(void)
+{
+	track_log_reader_t reader;
+	track_log_fix_t fix;
+	ret_code_t err_code;
+
+	m_out_count = 0;
+
+	assert(track_log_read_start(&reader) == NRF_SUCCESS);
+
+	while((err_code = track_log_read_next(&reader, &fix)) == NRF_SUCCESS) {
+		assert(m_out_count < MAX_FIXES);
+		m_out[m_out_count++] = fix;
+	}
+
+	assert(err_code == NRF_ERROR_NOT_FOUND);
+
+	track_log_read_end(&reader);
+}
+
+
+static bool fix_equal(const track_log_fix_t *a, const track_log_fix_t *b)
+{
+	return a->time == b->time && a->lat == b->lat && a->lon == b->lon && a->alt == b->alt;
+}
+
+
+/**@brief Check that the read fixes are the last ones of the reference. */
+static void check_tail(void)
+{
+	assert(m_out_count <= m_ref_count);
+
+	uint32_t offset = m_ref_count - m_out_count;
+
+	for(uint32_t i = 0; i < m_out_count; i++) {
+		assert(fix_equal(&m_out[i], &m_ref[offset + i]));
+	}
+}
+
+
+static void test_empty(void)
+{
+	track_log_stats_t stats;
+
+	spi_flash_fake_format();
+
+	assert(track_log_init() == NRF_SUCCESS);
+	track_log_get_stats(&stats);
+	assert(stats.init_reads <= 4);
+
+	read_all();
+	assert(m_out_count == 0);
+
+	// an empty flush does not touch the flash
+	assert(track_log_flush() == NRF_SUCCESS);
+	track_log_get_stats(&stats);
+	assert(stats.pages_written == 0);
+}
+
+
+static void test_roundtrip(void)
+{
+	track_log_stats_t stats;
+	spi_flash_fake_stats_t flash_before, flash_after;
+
+	spi_flash_fake_format();
+	assert(track_log_init() == NRF_SUCCESS);
+
+	track_start();
+	m_ref_count = 0;
+
+	spi_flash_fake_get_stats(&flash_before);
+	m_erase_polls = 0;
+
+	for(int i = 0; i < 1000; i++) {
+		track_log_fix_t fix = track_next();
+		append(&fix);
+	}
+
+	// no write had to wait for a sector erase
+	spi_flash_fake_get_stats(&flash_after);
+	track_log_get_stats(&stats);
+
+	assert(stats.sector_erases > 0);
+	assert(flash_after.erase_waits == flash_before.erase_waits);
+	assert(m_erase_polls == stats.sector_erases * SPI_FLASH_FAKE_ERASE_POLLS);
+
+	// fixes too close to the previous one are dropped
+	track_log_fix_t fix = m_pos;
+	fix.time += TRACK_LOG_MIN_INTERVAL_S - 1;
+	assert(track_log_append(&fix) == NRF_SUCCESS);
+
+	assert(track_log_flush() == NRF_SUCCESS);
+
+	spi_flash_fake_get_stats(&flash_after);
+	track_log_get_stats(&stats);
+
+	assert(stats.fixes_logged == m_ref_count);
+	assert(stats.write_errors == 0);
+
+	// the flash is powered once per page
+	assert(flash_after.power_ups - flash_before.power_ups == stats.pages_written);
+
+	read_all();
+	assert(m_out_count == m_ref_count);
+	check_tail();
+
+	double bytes_per_fix = (double)(stats.pages_written * SPI_FLASH_PAGE_SIZE) / m_ref_count;
+
+	printf("roundtrip: %u fixes in %u pages, %.1f bytes per fix (%zu bytes uncompressed)\n",
+			m_ref_count, stats.pages_written, bytes_per_fix, sizeof(track_log_fix_t));
+
+	assert(bytes_per_fix < 8.0);
+
+	// the same fixes are found after a restart
+	assert(track_log_init() == NRF_SUCCESS);
+	track_log_get_stats(&stats);
+	assert(stats.init_reads <= MAX_INIT_READS);
+
+	read_all();
+	assert(m_out_count == m_ref_count);
+	check_tail();
+
+	// and the log continues at the same position
+	for(int i = 0; i < 100; i++) {
+		track_log_fix_t fix = track_next();
+		append(&fix);
+	}
+
+	assert(track_log_flush() == NRF_SUCCESS);
+
+	read_all();
+	assert(m_out_count == m_ref_count);
+	check_tail();
+}
+
+
+static void test_wrap(void)
+{
+	track_log_stats_t stats;
+	spi_flash_fake_stats_t flash_stats;
+	uint32_t max_init_reads = 0;
+
+	spi_flash_fake_format();
+	assert(track_log_init() == NRF_SUCCESS);
+
+	track_start();
+	m_ref_count = 0;
+
+	uint32_t pages = 0;
+
+	// about 3.5 rounds, with a restart every few pages
+	while(pages < 3 * TRACK_LOG_NUM_PAGES + TRACK_LOG_NUM_PAGES / 2) {
+		track_log_fix_t fix = track_next();
+		append(&fix);
+
+		track_log_get_stats(&stats);
+
+		if(stats.pages_written == 0 || stats.pages_written % 13 != 0) {
+			continue;
+		}
+
+		assert(track_log_flush() == NRF_SUCCESS);
+		track_log_get_stats(&stats);
+		pages += stats.pages_written;
+
+		assert(track_log_init() == NRF_SUCCESS);
+		track_log_get_stats(&stats);
+
+		if(stats.init_reads > max_init_reads) {
+			max_init_reads = stats.init_reads;
+		}
+
+		read_all();
+		check_tail();
+
+		// all sectors but the one at the write position are kept
+		if(pages >= TRACK_LOG_NUM_PAGES) {
+			uint32_t fixes_per_page = m_ref_count / pages;
+			uint32_t kept_pages = TRACK_LOG_NUM_PAGES - 2 * TRACK_LOG_PAGES_PER_SECTOR;
+
+			assert(m_out_count >= fixes_per_page * kept_pages * 9 / 10);
+		} else {
+			assert(m_out_count == m_ref_count);
+		}
+	}
+
+	spi_flash_fake_get_stats(&flash_stats);
+
+	uint32_t min_erases = UINT32_MAX;
+	uint32_t max_erases = 0;
+
+	for(uint32_t s = 0; s < TRACK_LOG_NUM_SECTORS; s++) {
+		if(flash_stats.erases[s] < min_erases) {
+			min_erases = flash_stats.erases[s];
+		}
+
+		if(flash_stats.erases[s] > max_erases) {
+			max_erases = flash_stats.erases[s];
+		}
+	}
+
+	// nothing outside the log area is touched
+	for(uint32_t s = TRACK_LOG_NUM_SECTORS; s < SPI_FLASH_NUM_SECTORS; s++) {
+		assert(flash_stats.erases[s] == 0);
+	}
+
+	printf("wrap: %u pages, %u fixes kept of %u, erases per sector %u to %u, max. %u reads at startup\n",
+			pages, m_out_count, m_ref_count, min_erases, max_erases, max_init_reads);
+
+	assert(max_erases - min_erases <= 1);
+	assert(max_init_reads <= MAX_INIT_READS);
+}
+
+
+static void test_bad_page(void)
+{
+	track_log_stats_t stats;
+
+	spi_flash_fake_format();
+	spi_flash_fake_set_bad_page(TRACK_LOG_FLASH_START + 2 * SPI_FLASH_PAGE_SIZE);
+
+	assert(track_log_init() == NRF_SUCCESS);
+
+	track_start();
+	m_ref_count = 0;
+
+	for(int i = 0; i < 300; i++) {
+		track_log_fix_t fix = track_next();
+		append(&fix);
+	}
+
+	assert(track_log_flush() == NRF_SUCCESS);
+
+	track_log_get_stats(&stats);
+	assert(stats.write_errors == 1);
+
+	read_all();
+	assert(m_out_count == m_ref_count);
+	check_tail();
+
+	// the damaged page is skipped after a restart as well
+	assert(track_log_init() == NRF_SUCCESS);
+
+	read_all();
+	assert(m_out_count == m_ref_count);
+	check_tail();
+}
+
+
+/**@brief Find a fix in the reference by its time stamp. */
+static int32_t find_ref(uint32_t time, uint32_t from)
+{
+	for(uint32_t i = from; i < m_ref_count; i++) {
+		if(m_ref[i].time == time) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+static void test_power_loss(void)
+{
+	static bool durable[MAX_FIXES];
+	track_log_stats_t stats;
+	uint32_t losses = 0;
+	uint32_t lost_fixes = 0;
+	uint32_t max_init_reads = 0;
+	uint32_t pages_total = 0;
+
+	spi_flash_fake_format();
+	assert(track_log_init() == NRF_SUCCESS);
+
+	track_start();
+	m_ref_count = 0;
+	memset(durable, 0, sizeof(durable));
+
+	// fixes in the page buffer
+	uint32_t pending_start = 0;
+
+	while(pages_total < 3 * TRACK_LOG_NUM_PAGES) {
+		// the power fails either while the flash is written or in between
+		spi_flash_fake_power_loss_after(rand_range(0, 40));
+		int appends = rand_range(1, 500);
+
+		for(int n = 0; n < appends; n++) {
+			track_log_fix_t fix = track_next();
+
+			m_ref[m_ref_count++] = fix;
+
+			track_log_get_stats(&stats);
+			uint32_t pages_before = stats.pages_written;
+
+			ret_code_t err_code = track_log_append(&fix);
+
+			if(err_code == NRF_SUCCESS) {
+				err_code = write_pending();
+			}
+
+			track_log_get_stats(&stats);
+
+			if(err_code != NRF_SUCCESS) {
+				break;
+			}
+
+			if(stats.pages_written != pages_before) {
+				// the buffer was written, the new fix starts the next page
+				for(uint32_t i = pending_start; i < m_ref_count - 1; i++) {
+					durable[i] = true;
+				}
+
+				pending_start = m_ref_count - 1;
+			}
+		}
+
+		pages_total += stats.pages_written;
+		lost_fixes += m_ref_count - pending_start;
+		losses++;
+
+		// the buffered fixes are gone with the power
+		pending_start = m_ref_count;
+
+		spi_flash_fake_reboot();
+
+		assert(track_log_init() == NRF_SUCCESS);
+		track_log_get_stats(&stats);
+
+		if(stats.init_reads > max_init_reads) {
+			max_init_reads = stats.init_reads;
+		}
+
+		read_all();
+
+		// the recovered fixes are in order and unchanged
+		uint32_t ref_idx = 0;
+
+		for(uint32_t i = 0; i < m_out_count; i++) {
+			int32_t idx = find_ref(m_out[i].time, ref_idx);
+
+			assert(idx >= 0);
+			assert(fix_equal(&m_out[i], &m_ref[idx]));
+
+			if(i > 0) {
+				// nothing that was written completely is missing
+				for(uint32_t j = ref_idx; j < (uint32_t)idx; j++) {
+					assert(!durable[j]);
+				}
+			}
+
+			ref_idx = idx + 1;
+		}
+
+		for(uint32_t j = ref_idx; j < m_ref_count; j++) {
+			assert(!durable[j]);
+		}
+
+		// before the first wrap, nothing is lost at the start either
+		if(pages_total < TRACK_LOG_NUM_PAGES - TRACK_LOG_PAGES_PER_SECTOR && m_out_count > 0) {
+			for(uint32_t j = 0; m_ref[j].time != m_out[0].time; j++) {
+				assert(!durable[j]);
+			}
+		}
+
+		// the time stamps continue after a restart
+		m_pos.time += 60;
+	}
+
+	printf("power loss: %u losses, %u pages, %u fixes lost from RAM, max. %u reads at startup\n",
+			losses, pages_total, lost_fixes, max_init_reads);
+
+	assert(max_init_reads <= MAX_INIT_READS);
+}
+
+
+int main(void)
+{
+	test_empty();
+	test_roundtrip();
+	test_wrap();
+	test_bad_page();
+	test_power_loss();
+
+	printf("track log checks passed\n");
+
+	return 0;
+}
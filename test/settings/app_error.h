@@ -0,0 +1,10 @@
+#ifndef APP_ERROR_H
+#define APP_ERROR_H
+
+#include <assert.h>
+
+#include "sdk_errors.h"
+
+#define APP_ERROR_CHECK(statement)  assert((statement) == NRF_SUCCESS)
+
+#endif // APP_ERROR_H
@@ -0,0 +1,525 @@
+/*
+ * Simulated flash data storage.
+ *
+ * Records are kept in RAM. Like the real FDS, write, update and delete
+ * operations are queued and only executed when the test processes the queue.
+ * The record data is copied at that time, so a caller that modifies its
+ * buffer before the operation completes is caught by the tests. An update
+ * writes the new record before the old one is invalidated, so a power loss
+ * never leaves a setting without a record.
+ *
+ * The flash layout is modelled as far as it matters for the space
+ * management: records occupy words in one of the data pages until a garbage
+ * collection copies the valid records of each page with dirty records to the
+ * swap page and erases the old page, which becomes the new swap page. Space
+ * for a write is reserved when it is queued, so a full flash is reported
+ * synchronously, like in the real FDS.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "sdk_config.h"
+#include "fds_fake.h"
+
+#define MAX_RECORDS       512
+#define MAX_RECORD_WORDS  128
+#define QUEUE_SIZE        FDS_OP_QUEUE_SIZE
+#define HEADER_WORDS      3
+#define PAGE_TAG_WORDS    2
+#define PAGE_WORDS        FDS_VIRTUAL_PAGE_SIZE
+#define DATA_PAGES        (FDS_VIRTUAL_PAGES - 1)
+
+typedef enum {
+	OP_INIT,
+	OP_WRITE,
+	OP_UPDATE,
+	OP_DELETE,
+	OP_GC,
+} op_type_t;
+
+typedef struct {
+	op_type_t   type;
+	uint32_t    record_id;    // update and delete
+	uint16_t    file_id;
+	uint16_t    key;
+	void const *p_data;
+	uint32_t    length_words;
+	size_t      page;         // write and update: page with the reserved space
+} op_t;
+
+typedef struct {
+	bool         valid;
+	bool         dirty;       // deleted or replaced, but not yet garbage collected
+	size_t       page;
+	fds_header_t header;
+	uint32_t     data[MAX_RECORD_WORDS];
+} record_t;
+
+typedef struct {
+	size_t   physical;        // index into m_erases
+	uint32_t write_offset;    // words written, including the page tag
+	uint32_t words_reserved;  // words reserved by queued writes
+	uint32_t dirty_words;
+} page_t;
+
+static record_t m_records[MAX_RECORDS];
+static uint32_t m_next_record_id;
+
+static page_t   m_pages[DATA_PAGES];
+static size_t   m_swap_physical;
+static uint32_t m_erases[FDS_VIRTUAL_PAGES];
+
+static op_t   m_queue[QUEUE_SIZE];
+static size_t m_queue_len;
+
+static fds_cb_t   m_callbacks[FDS_MAX_USERS];
+static size_t     m_num_callbacks;
+static bool       m_initialized;
+static ret_code_t m_fail_next;
+
+static fds_fake_stats_t m_stats;
+
+
+static record_t* find_by_id(uint32_t record_id)
+{
+	for(size_t i = 0; i < MAX_RECORDS; i++) {
+		if(m_records[i].valid && m_records[i].header.record_id == record_id) {
+			return &m_records[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+static void invalidate(record_t *rec)
+{
+	rec->valid = false;
+	rec->dirty = true;
+	m_pages[rec->page].dirty_words += HEADER_WORDS + rec->header.length_words;
+}
+
+
+static ret_code_t reserve(op_t *op)
+{
+	uint32_t words = HEADER_WORDS + op->length_words;
+
+	if(op->length_words > MAX_RECORD_WORDS) {
+		return FDS_ERR_RECORD_TOO_LARGE;
+	}
+
+	for(size_t p = 0; p < DATA_PAGES; p++) {
+		page_t *page = &m_pages[p];
+
+		if(page->write_offset + page->words_reserved + words <= PAGE_WORDS) {
+			page->words_reserved += words;
+			op->page = p;
+			return NRF_SUCCESS;
+		}
+	}
+
+	return FDS_ERR_NO_SPACE_IN_FLASH;
+}
+
+
+static ret_code_t enqueue(op_t *op)
+{
+	if(!m_initialized && op->type != OP_INIT) {
+		return FDS_ERR_NOT_INITIALIZED;
+	}
+
+	if(m_queue_len >= QUEUE_SIZE) {
+		return FDS_ERR_NO_SPACE_IN_QUEUES;
+	}
+
+	if(op->type == OP_WRITE || op->type == OP_UPDATE) {
+		ret_code_t err_code = reserve(op);
+
+		if(err_code != NRF_SUCCESS) {
+			return err_code;
+		}
+	}
+
+	m_queue[m_queue_len++] = *op;
+	return NRF_SUCCESS;
+}
+
+
+static ret_code_t store_record(const op_t *op, uint32_t *p_record_id)
+{
+	for(size_t i = 0; i < MAX_RECORDS; i++) {
+		record_t *rec = &m_records[i];
+
+		if(rec->valid || rec->dirty) {
+			continue;
+		}
+
+		assert(op->length_words > 0 && op->length_words <= MAX_RECORD_WORDS);
+
+		rec->valid = true;
+		rec->page = op->page;
+		rec->header.record_key = op->key;
+		rec->header.file_id = op->file_id;
+		rec->header.length_words = op->length_words;
+		rec->header.record_id = ++m_next_record_id;
+		memcpy(rec->data, op->p_data, op->length_words * 4);
+
+		m_pages[op->page].write_offset += HEADER_WORDS + op->length_words;
+
+		m_stats.writes++;
+		m_stats.words_written += HEADER_WORDS + op->length_words;
+
+		*p_record_id = rec->header.record_id;
+		return NRF_SUCCESS;
+	}
+
+	// the fake ran out of record slots, not the simulated flash
+	assert(false);
+	return FDS_ERR_INTERNAL;
+}
+
+
+static void collect_garbage(void)
+{
+	for(size_t p = 0; p < DATA_PAGES; p++) {
+		page_t *page = &m_pages[p];
+
+		if(page->dirty_words == 0) {
+			continue;
+		}
+
+		// the valid records are copied to the swap page, then the old page
+		// is erased and becomes the new swap page.
+		for(size_t i = 0; i < MAX_RECORDS; i++) {
+			if(m_records[i].dirty && m_records[i].page == p) {
+				m_records[i].dirty = false;
+			}
+		}
+
+		size_t old_physical = page->physical;
+
+		page->physical = m_swap_physical;
+		page->write_offset -= page->dirty_words;
+		page->dirty_words = 0;
+
+		m_erases[old_physical]++;
+		m_swap_physical = old_physical;
+	}
+
+	m_stats.gc_runs++;
+}
+
+
+void fds_fake_format(void)
+{
+	memset(m_records, 0, sizeof(m_records));
+	memset(&m_stats, 0, sizeof(m_stats));
+	memset(m_erases, 0, sizeof(m_erases));
+	m_next_record_id = 0;
+
+	for(size_t p = 0; p < DATA_PAGES; p++) {
+		m_pages[p].physical = p;
+		m_pages[p].write_offset = PAGE_TAG_WORDS;
+		m_pages[p].dirty_words = 0;
+	}
+
+	m_swap_physical = DATA_PAGES;
+
+	fds_fake_power_loss();
+}
+
+
+void fds_fake_power_loss(void)
+{
+	// reservations of lost operations are gone after the reset
+	for(size_t p = 0; p < DATA_PAGES; p++) {
+		m_pages[p].words_reserved = 0;
+	}
+
+	m_queue_len = 0;
+	m_num_callbacks = 0;
+	m_initialized = false;
+	m_fail_next = NRF_SUCCESS;
+}
+
+
+bool fds_fake_process_one(void)
+{
+	if(m_queue_len == 0) {
+		return false;
+	}
+
+	op_t op = m_queue[0];
+
+	memmove(&m_queue[0], &m_queue[1], (m_queue_len - 1) * sizeof(op_t));
+	m_queue_len--;
+
+	fds_evt_t evt;
+	memset(&evt, 0, sizeof(evt));
+
+	evt.result = m_fail_next;
+	m_fail_next = NRF_SUCCESS;
+
+	switch(op.type) {
+		case OP_INIT:
+			evt.id = FDS_EVT_INIT;
+			m_initialized = true;
+			break;
+
+		case OP_WRITE:
+		case OP_UPDATE:
+			evt.id = (op.type == OP_WRITE) ? FDS_EVT_WRITE : FDS_EVT_UPDATE;
+			evt.write.file_id = op.file_id;
+			evt.write.record_key = op.key;
+
+			m_pages[op.page].words_reserved -= HEADER_WORDS + op.length_words;
+
+			if(evt.result == NRF_SUCCESS) {
+				evt.result = store_record(&op, &evt.write.record_id);
+			}
+
+			if(evt.result == NRF_SUCCESS && op.type == OP_UPDATE) {
+				record_t *old = find_by_id(op.record_id);
+
+				if(old) {
+					invalidate(old);
+				}
+
+				evt.write.is_record_updated = true;
+			}
+			break;
+
+		case OP_DELETE:
+			{
+				record_t *rec = find_by_id(op.record_id);
+
+				evt.id = FDS_EVT_DEL_RECORD;
+				evt.del.record_id = op.record_id;
+
+				if(!rec) {
+					evt.result = FDS_ERR_NOT_FOUND;
+					break;
+				}
+
+				evt.del.file_id = rec->header.file_id;
+				evt.del.record_key = rec->header.record_key;
+
+				if(evt.result == NRF_SUCCESS) {
+					invalidate(rec);
+					m_stats.deletes++;
+				}
+			}
+			break;
+
+		case OP_GC:
+			evt.id = FDS_EVT_GC;
+
+			if(evt.result == NRF_SUCCESS) {
+				collect_garbage();
+			}
+			break;
+	}
+
+	for(size_t i = 0; i < m_num_callbacks; i++) {
+		m_callbacks[i](&evt);
+	}
+
+	return true;
+}
+
+
+void fds_fake_process_all(void)
+{
+	while(fds_fake_process_one()) {
+		// the callbacks may queue more operations
+	}
+}
+
+
+size_t fds_fake_queued(void)
+{
+	return m_queue_len;
+}
+
+
+void fds_fake_fail_next(ret_code_t result)
+{
+	m_fail_next = result;
+}
+
+
+size_t fds_fake_record_count(void)
+{
+	size_t count = 0;
+
+	for(size_t i = 0; i < MAX_RECORDS; i++) {
+		if(m_records[i].valid) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
+void fds_fake_get_stats(fds_fake_stats_t *stats)
+{
+	*stats = m_stats;
+
+	stats->max_erases = 0;
+	stats->total_erases = 0;
+
+	for(size_t i = 0; i < FDS_VIRTUAL_PAGES; i++) {
+		stats->total_erases += m_erases[i];
+
+		if(m_erases[i] > stats->max_erases) {
+			stats->max_erases = m_erases[i];
+		}
+	}
+}
+
+
+ret_code_t fds_register(fds_cb_t cb)
+{
+	if(m_num_callbacks >= FDS_MAX_USERS) {
+		return FDS_ERR_USER_LIMIT_REACHED;
+	}
+
+	m_callbacks[m_num_callbacks++] = cb;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t fds_init(void)
+{
+	op_t op = {.type = OP_INIT};
+
+	return enqueue(&op);
+}
+
+
+ret_code_t fds_record_find(uint16_t file_id, uint16_t record_key,
+		fds_record_desc_t *p_desc, fds_find_token_t *p_token)
+{
+	if(!m_initialized) {
+		return FDS_ERR_NOT_INITIALIZED;
+	}
+
+	for(size_t i = p_token->index; i < MAX_RECORDS; i++) {
+		record_t *rec = &m_records[i];
+
+		if(rec->valid && rec->header.file_id == file_id && rec->header.record_key == record_key) {
+			p_desc->record_id = rec->header.record_id;
+			p_token->index = i + 1;
+			return NRF_SUCCESS;
+		}
+	}
+
+	return FDS_ERR_NOT_FOUND;
+}
+
+
+ret_code_t fds_record_open(fds_record_desc_t *p_desc, fds_flash_record_t *p_flash_record)
+{
+	record_t *rec = find_by_id(p_desc->record_id);
+
+	if(!rec) {
+		return FDS_ERR_NOT_FOUND;
+	}
+
+	p_flash_record->p_header = &rec->header;
+	p_flash_record->p_data = rec->data;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t fds_record_close(fds_record_desc_t *p_desc)
+{
+	(void)p_desc;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t fds_record_write(fds_record_desc_t *p_desc, fds_record_t const *p_record)
+{
+	op_t op = {
+		.type = OP_WRITE,
+		.file_id = p_record->file_id,
+		.key = p_record->key,
+		.p_data = p_record->data.p_data,
+		.length_words = p_record->data.length_words,
+	};
+
+	(void)p_desc;
+	return enqueue(&op);
+}
+
+
+ret_code_t fds_record_update(fds_record_desc_t *p_desc, fds_record_t const *p_record)
+{
+	op_t op = {
+		.type = OP_UPDATE,
+		.record_id = p_desc->record_id,
+		.file_id = p_record->file_id,
+		.key = p_record->key,
+		.p_data = p_record->data.p_data,
+		.length_words = p_record->data.length_words,
+	};
+
+	return enqueue(&op);
+}
+
+
+ret_code_t fds_record_delete(fds_record_desc_t *p_desc)
+{
+	op_t op = {
+		.type = OP_DELETE,
+		.record_id = p_desc->record_id,
+	};
+
+	return enqueue(&op);
+}
+
+
+ret_code_t fds_gc(void)
+{
+	op_t op = {.type = OP_GC};
+
+	return enqueue(&op);
+}
+
+
+ret_code_t fds_stat(fds_stat_t *p_stat)
+{
+	if(!m_initialized) {
+		return FDS_ERR_NOT_INITIALIZED;
+	}
+
+	memset(p_stat, 0, sizeof(*p_stat));
+
+	p_stat->pages_available = DATA_PAGES;
+
+	for(size_t p = 0; p < DATA_PAGES; p++) {
+		const page_t *page = &m_pages[p];
+		uint32_t contig = PAGE_WORDS - page->write_offset - page->words_reserved;
+
+		p_stat->words_used += page->write_offset;
+		p_stat->words_reserved += page->words_reserved;
+		p_stat->freeable_words += page->dirty_words;
+
+		if(contig > p_stat->largest_contig) {
+			p_stat->largest_contig = contig;
+		}
+	}
+
+	for(size_t i = 0; i < MAX_RECORDS; i++) {
+		if(m_records[i].valid) {
+			p_stat->valid_records++;
+		} else if(m_records[i].dirty) {
+			p_stat->dirty_records++;
+		}
+	}
+
+	return NRF_SUCCESS;
+}
@@ -0,0 +1,43 @@
+#ifndef FDS_FAKE_H
+#define FDS_FAKE_H
+
+#include <stddef.h>
+
+#include "fds.h"
+
+typedef struct {
+	uint32_t writes;        // completed write and update operations
+	uint32_t deletes;       // completed delete operations
+	uint32_t words_written; // record data and headers
+	uint32_t gc_runs;       // completed garbage collections
+	uint32_t max_erases;    // erase count of the most worn physical page
+	uint32_t total_erases;  // erase count of all pages
+} fds_fake_stats_t;
+
+/**@brief Erase the simulated flash and forget all state. */
+void fds_fake_format(void);
+
+/**@brief Simulate a reset: queued operations are lost, the flash is kept. */
+void fds_fake_power_loss(void);
+
+/**@brief Complete the oldest queued operation.
+ * @returns  False if the queue was empty.
+ */
+bool fds_fake_process_one(void);
+
+/**@brief Complete all queued operations, including those queued by the
+ * callbacks. */
+void fds_fake_process_all(void);
+
+/**@brief Number of queued operations. */
+size_t fds_fake_queued(void);
+
+/**@brief Let the next operation fail with the given result. */
+void fds_fake_fail_next(ret_code_t result);
+
+/**@brief Number of valid records. */
+size_t fds_fake_record_count(void);
+
+void fds_fake_get_stats(fds_fake_stats_t *stats);
+
+#endif // FDS_FAKE_H
@@ -0,0 +1,6 @@
+#ifndef NRF_ERROR_H
+#define NRF_ERROR_H
+
+#include "sdk_errors.h"
+
+#endif // NRF_ERROR_H
@@ -0,0 +1,24 @@
+#ifndef NRF_LOG_H
+#define NRF_LOG_H
+
+/* Logging is disabled in the host harness. The arguments are still evaluated
+ * by the compiler to avoid unused variable warnings. */
+
+#define NRF_LOG_MODULE_REGISTER() extern int nrf_log_dummy
+
+static inline void nrf_log_discard(const char *fmt, ...) { (void)fmt; }
+
+#define NRF_LOG_ERROR(...)        nrf_log_discard(__VA_ARGS__)
+#define NRF_LOG_WARNING(...)      nrf_log_discard(__VA_ARGS__)
+#define NRF_LOG_INFO(...)         nrf_log_discard(__VA_ARGS__)
+#define NRF_LOG_DEBUG(...)        nrf_log_discard(__VA_ARGS__)
+
+#define NRF_LOG_HEXDUMP_INFO(p, len)  do { (void)(p); (void)(len); } while(0)
+#define NRF_LOG_HEXDUMP_DEBUG(p, len) do { (void)(p); (void)(len); } while(0)
+
+#define NRF_LOG_PUSH(s)           (s)
+
+#define NRF_LOG_FLOAT_MARKER      "%s"
+#define NRF_LOG_FLOAT(f)          ""
+
+#endif // NRF_LOG_H
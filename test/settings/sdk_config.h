@@ -0,0 +1,10 @@
+#ifndef SDK_CONFIG_H
+#define SDK_CONFIG_H
+
+// values as in config/sdk_config.h
+#define FDS_VIRTUAL_PAGES      3
+#define FDS_VIRTUAL_PAGE_SIZE  1024
+#define FDS_OP_QUEUE_SIZE      4
+#define FDS_MAX_USERS          4
+
+#endif // SDK_CONFIG_H
@@ -0,0 +1,550 @@
+/*
+ * Host test for the settings module.
+ *
+ * The flash data storage is simulated by fds_fake.c. The flush timer and the
+ * event queue are simulated here: the test decides when the quiet period has
+ * passed. A reset is simulated by dropping all queued flash operations and
+ * initializing the settings module again on the same simulated flash.
+ *
+ * Besides the functional checks, a typical menu session is replayed to
+ * compare the number of flash writes with and without the RAM cache.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "app_timer.h"
+#include "fds_fake.h"
+
+#include "../../src/settings.h"
+#include "../../src/settings_tlv.h"
+#include "../../src/event_queue.h"
+
+#define MAX_EVENTS  32
+
+static app_timer_t *m_timer;
+
+static event_handler_t m_event_handlers[EVENT_NUM_TYPES];
+static bool            m_event_pending[EVENT_NUM_TYPES];
+
+static settings_evt_t m_events[MAX_EVENTS];
+static settings_id_t  m_event_ids[MAX_EVENTS];
+static size_t         m_event_count;
+
+
+ret_code_t app_timer_create(app_timer_id_t const *p_timer_id, app_timer_mode_t mode,
+		app_timer_timeout_handler_t timeout_handler)
+{
+	assert(mode == APP_TIMER_MODE_SINGLE_SHOT);
+
+	m_timer = *p_timer_id;
+	m_timer->handler = timeout_handler;
+	m_timer->running = false;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void *p_context)
+{
+	assert(!timer_id->running);
+
+	timer_id->running = true;
+	timer_id->ticks = timeout_ticks;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id)
+{
+	timer_id->running = false;
+	return NRF_SUCCESS;
+}
+
+
+void event_queue_register(event_type_t type, event_handler_t handler)
+{
+	m_event_handlers[type] = handler;
+}
+
+
+void event_queue_post(event_type_t type)
+{
+	m_event_pending[type] = true;
+}
+
+
+static void dispatch_events(void)
+{
+	for(event_type_t type = 0; type < EVENT_NUM_TYPES; type++) {
+		if(m_event_pending[type]) {
+			m_event_pending[type] = false;
+			m_event_handlers[type]();
+		}
+	}
+}
+
+
+/**@brief Let the quiet period pass and complete all flash operations. */
+static void expire_flush_timer(void)
+{
+	if(m_timer->running) {
+		m_timer->running = false;
+		m_timer->handler(NULL);
+	}
+
+	dispatch_events();
+	fds_fake_process_all();
+}
+
+
+static void cb_settings(settings_evt_t evt, settings_id_t id)
+{
+	assert(m_event_count < MAX_EVENTS);
+
+	m_events[m_event_count] = evt;
+	m_event_ids[m_event_count] = id;
+	m_event_count++;
+}
+
+
+static size_t count_events(settings_evt_t evt)
+{
+	size_t count = 0;
+
+	for(size_t i = 0; i < m_event_count; i++) {
+		if(m_events[i] == evt) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
+/**@brief Simulate a (re)start of the firmware. */
+static void boot(void)
+{
+	fds_fake_power_loss();
+
+	m_event_count = 0;
+	memset(m_event_pending, 0, sizeof(m_event_pending));
+
+	assert(settings_init(cb_settings) == NRF_SUCCESS);
+	assert(settings_query(SETTINGS_ID_SOURCE_CALL, NULL, NULL) == NRF_ERROR_INVALID_STATE);
+
+	fds_fake_process_all();
+	assert(count_events(SETTINGS_EVT_INIT) == 1);
+}
+
+
+static void write_str(settings_id_t id, const char *str)
+{
+	assert(settings_write(id, (const uint8_t *)str, strlen(str) + 1) == NRF_SUCCESS);
+}
+
+
+static void check_str(settings_id_t id, const char *str)
+{
+	uint8_t buf[256];
+	size_t len = sizeof(buf);
+
+	assert(settings_query(id, buf, &len) == NRF_SUCCESS);
+
+	// padded to whole words
+	assert(len == ((strlen(str) + 1 + 3) & ~3U));
+	assert(strcmp((const char *)buf, str) == 0);
+}
+
+
+static void write_u32(settings_id_t id, uint32_t value)
+{
+	assert(settings_write(id, (const uint8_t *)&value, sizeof(value)) == NRF_SUCCESS);
+}
+
+
+static uint32_t read_u32(settings_id_t id)
+{
+	uint32_t value;
+	size_t len = sizeof(value);
+
+	assert(settings_query(id, (uint8_t *)&value, &len) == NRF_SUCCESS);
+	assert(len == sizeof(value));
+
+	return value;
+}
+
+
+static void write_u8(settings_id_t id, uint8_t value)
+{
+	assert(settings_write(id, &value, sizeof(value)) == NRF_SUCCESS);
+}
+
+
+static bool is_default(settings_id_t id)
+{
+	uint8_t buf[256];
+	size_t len = sizeof(buf);
+
+	return settings_query(id, buf, &len) == FDS_ERR_NOT_FOUND;
+}
+
+
+static void test_cache(void)
+{
+	fds_fake_stats_t fds_stats;
+	settings_stats_t stats;
+
+	fds_fake_format();
+	boot();
+
+	assert(is_default(SETTINGS_ID_SOURCE_CALL));
+	assert(settings_is_saved());
+
+	// values are available immediately, but not written yet
+	write_str(SETTINGS_ID_SOURCE_CALL, "DL1ABC-7");
+	write_u32(SETTINGS_ID_APRS_FLAGS, 0x1234);
+
+	check_str(SETTINGS_ID_SOURCE_CALL, "DL1ABC-7");
+	assert(read_u32(SETTINGS_ID_APRS_FLAGS) == 0x1234);
+
+	assert(fds_fake_queued() == 0);
+	assert(m_timer->running && m_timer->ticks == 5000);
+	assert(!settings_is_saved());
+
+	// changes during the quiet period are combined
+	write_u32(SETTINGS_ID_APRS_FLAGS, 0x5678);
+	write_u32(SETTINGS_ID_APRS_FLAGS, 0x9abc);
+
+	expire_flush_timer();
+
+	fds_fake_get_stats(&fds_stats);
+	assert(fds_stats.writes == 2);
+	assert(fds_fake_record_count() == 2);
+	assert(settings_is_saved());
+
+	assert(count_events(SETTINGS_EVT_UPDATE_COMPLETE) == 2);
+	assert(count_events(SETTINGS_EVT_FLUSH_COMPLETE) == 1);
+
+	settings_get_stats(&stats);
+	assert(stats.flash_writes == 2);
+	assert(stats.flash_writes_saved == 2);
+
+	// unchanged values are not written again
+	write_u32(SETTINGS_ID_APRS_FLAGS, 0x9abc);
+	assert(!m_timer->running);
+	assert(settings_is_saved());
+
+	settings_get_stats(&stats);
+	assert(stats.flash_writes_saved == 3);
+
+	// an empty comment deletes the record
+	write_str(SETTINGS_ID_COMMENT, "hello");
+	expire_flush_timer();
+	assert(fds_fake_record_count() == 3);
+
+	assert(settings_write(SETTINGS_ID_COMMENT, NULL, 0) == NRF_SUCCESS);
+	assert(is_default(SETTINGS_ID_COMMENT));
+	expire_flush_timer();
+	assert(fds_fake_record_count() == 2);
+
+	// invalid values are rejected before they reach the cache
+	assert(settings_write(SETTINGS_ID_APRS_FLAGS, (const uint8_t *)"ab", 2) == NRF_ERROR_INVALID_LENGTH);
+	assert(settings_write(SETTINGS_NUM_IDS, (const uint8_t *)"ab", 2) == NRF_ERROR_INVALID_PARAM);
+	assert(read_u32(SETTINGS_ID_APRS_FLAGS) == 0x9abc);
+
+	// too small buffers are reported with the required length
+	uint8_t small[4];
+	size_t small_len = sizeof(small);
+	assert(settings_query(SETTINGS_ID_SOURCE_CALL, small, &small_len) == NRF_ERROR_NO_MEM);
+	assert(small_len == 12);
+
+	// everything is loaded again after a reset
+	boot();
+	check_str(SETTINGS_ID_SOURCE_CALL, "DL1ABC-7");
+	assert(read_u32(SETTINGS_ID_APRS_FLAGS) == 0x9abc);
+	assert(is_default(SETTINGS_ID_COMMENT));
+	assert(settings_is_saved());
+
+	printf("RAM cache checks passed\n");
+}
+
+
+static void test_flush(void)
+{
+	fds_fake_stats_t fds_stats;
+
+	fds_fake_format();
+	boot();
+
+	// changes are lost if the device is reset during the quiet period...
+	write_u8(SETTINGS_ID_LORA_POWER, 3);
+	boot();
+	assert(is_default(SETTINGS_ID_LORA_POWER));
+
+	// ...but not if they are flushed before the shutdown
+	write_u8(SETTINGS_ID_LORA_POWER, 3);
+	write_str(SETTINGS_ID_COMMENT, "bye");
+	assert(settings_flush() == NRF_SUCCESS);
+	assert(!m_timer->running);
+
+	fds_fake_process_all();
+	assert(settings_is_saved());
+	assert(count_events(SETTINGS_EVT_FLUSH_COMPLETE) == 1);
+
+	boot();
+	check_str(SETTINGS_ID_COMMENT, "bye");
+
+	// a flush without changes completes immediately
+	assert(settings_flush() == NRF_SUCCESS);
+	assert(count_events(SETTINGS_EVT_FLUSH_COMPLETE) == 1);
+	assert(fds_fake_queued() == 0);
+
+	// a value that changes while its record is written is written again
+	write_str(SETTINGS_ID_COMMENT, "first");
+	expire_flush_timer();
+	fds_fake_get_stats(&fds_stats);
+	uint32_t writes_before = fds_stats.writes;
+
+	write_str(SETTINGS_ID_COMMENT, "second");
+	m_timer->running = false;
+	m_timer->handler(NULL);
+	dispatch_events();
+	assert(fds_fake_queued() == 1);
+
+	write_str(SETTINGS_ID_COMMENT, "third");
+	fds_fake_process_all();
+
+	// the record in flash was written from the copy made before the change
+	boot();
+	check_str(SETTINGS_ID_COMMENT, "second");
+
+	write_str(SETTINGS_ID_COMMENT, "second");
+	write_str(SETTINGS_ID_COMMENT, "third");
+	expire_flush_timer();
+	boot();
+	check_str(SETTINGS_ID_COMMENT, "third");
+
+	fds_fake_get_stats(&fds_stats);
+	assert(fds_stats.writes == writes_before + 2);
+
+	// a failed write is retried after the next quiet period
+	write_str(SETTINGS_ID_COMMENT, "retry");
+	m_timer->running = false;
+	m_timer->handler(NULL);
+	dispatch_events();
+	fds_fake_fail_next(FDS_ERR_NO_SPACE_IN_FLASH);
+	fds_fake_process_all();
+
+	assert(!settings_is_saved());
+	assert(m_timer->running);
+
+	expire_flush_timer();
+	assert(settings_is_saved());
+
+	boot();
+	check_str(SETTINGS_ID_COMMENT, "retry");
+
+	printf("flush checks passed\n");
+}
+
+
+static size_t make_snapshot(uint8_t *buf, size_t size)
+{
+	settings_tlv_writer_t writer;
+	uint32_t flags = 0xcafe;
+
+	settings_tlv_writer_init(&writer, buf, size);
+	assert(settings_tlv_add(&writer, SETTINGS_ID_SOURCE_CALL, (const uint8_t *)"DE0XYZ", 7));
+	assert(settings_tlv_add(&writer, SETTINGS_ID_APRS_FLAGS, (const uint8_t *)&flags, sizeof(flags)));
+	assert(settings_tlv_add(&writer, SETTINGS_ID_LORA_POWER, (const uint8_t *)"\x02", 1));
+
+	return settings_tlv_finish(&writer);
+}
+
+
+static void test_restore(void)
+{
+	uint8_t snapshot[SETTINGS_TLV_MAX_LEN];
+	size_t snapshot_len;
+	settings_id_t invalid_id;
+
+	fds_fake_format();
+	boot();
+
+	write_str(SETTINGS_ID_SOURCE_CALL, "DL1ABC");
+	write_str(SETTINGS_ID_COMMENT, "will be reset");
+	write_u8(SETTINGS_ID_LORA_POWER, 2);
+	expire_flush_timer();
+
+	// the exported snapshot contains the unpadded values
+	snapshot_len = sizeof(snapshot);
+	assert(settings_export_snapshot(snapshot, &snapshot_len) == NRF_SUCCESS);
+	assert(snapshot_len == SETTINGS_TLV_HEADER_LEN + (2 + 7) + (2 + 14) + (2 + 1) + SETTINGS_TLV_CRC_LEN);
+
+	// restore a different snapshot
+	snapshot_len = make_snapshot(snapshot, sizeof(snapshot));
+
+	m_event_count = 0;
+	assert(settings_import_snapshot(snapshot, snapshot_len, &invalid_id) == NRF_SUCCESS);
+	assert(settings_write(SETTINGS_ID_COMMENT, (const uint8_t *)"x", 2) == NRF_ERROR_BUSY);
+	assert(settings_import_snapshot(snapshot, snapshot_len, &invalid_id) == NRF_ERROR_BUSY);
+
+	fds_fake_process_all();
+
+	assert(count_events(SETTINGS_EVT_RESTORE_COMPLETE) == 1);
+	check_str(SETTINGS_ID_SOURCE_CALL, "DE0XYZ");
+	assert(read_u32(SETTINGS_ID_APRS_FLAGS) == 0xcafe);
+	assert(is_default(SETTINGS_ID_COMMENT));
+
+	// the unchanged LoRa power was not written again
+	settings_stats_t stats;
+	settings_get_stats(&stats);
+	assert(stats.flash_writes_saved >= 1);
+
+	// journal removed, only the three settings remain
+	assert(fds_fake_record_count() == 3);
+
+	boot();
+	check_str(SETTINGS_ID_SOURCE_CALL, "DE0XYZ");
+	assert(is_default(SETTINGS_ID_COMMENT));
+
+	// invalid snapshots are rejected without writing anything
+	fds_fake_stats_t before, after;
+	fds_fake_get_stats(&before);
+
+	snapshot[5] ^= 0x01;
+	assert(settings_import_snapshot(snapshot, snapshot_len, &invalid_id) == NRF_ERROR_INVALID_DATA);
+	snapshot[5] ^= 0x01;
+
+	settings_tlv_writer_t writer;
+	settings_tlv_writer_init(&writer, snapshot, sizeof(snapshot));
+	assert(settings_tlv_add(&writer, SETTINGS_ID_SOURCE_CALL, (const uint8_t *)"DE0XYZ", 7));
+	assert(settings_tlv_add(&writer, SETTINGS_ID_APRS_FLAGS, (const uint8_t *)"ab", 2));
+	size_t invalid_len = settings_tlv_finish(&writer);
+
+	assert(settings_import_snapshot(snapshot, invalid_len, &invalid_id) == NRF_ERROR_INVALID_PARAM);
+	assert(invalid_id == SETTINGS_ID_APRS_FLAGS);
+
+	fds_fake_get_stats(&after);
+	assert(after.writes == before.writes);
+	assert(fds_fake_queued() == 0);
+
+	printf("restore checks passed\n");
+}
+
+
+static void test_restore_power_loss(void)
+{
+	uint8_t snapshot[SETTINGS_TLV_MAX_LEN];
+	size_t snapshot_len = make_snapshot(snapshot, sizeof(snapshot));
+	settings_id_t invalid_id;
+
+	// interrupt the restore after every possible number of operations
+	for(size_t steps = 0; steps < 8; steps++) {
+		fds_fake_format();
+		boot();
+
+		write_str(SETTINGS_ID_SOURCE_CALL, "DL1ABC");
+		write_str(SETTINGS_ID_COMMENT, "old");
+		write_u32(SETTINGS_ID_APRS_FLAGS, 1);
+		expire_flush_timer();
+
+		assert(settings_import_snapshot(snapshot, snapshot_len, &invalid_id) == NRF_SUCCESS);
+
+		for(size_t i = 0; i < steps; i++) {
+			fds_fake_process_one();
+		}
+
+		bool journal_written = (steps > 0);
+
+		boot();
+		fds_fake_process_all();
+
+		if(journal_written) {
+			// the restore is completed from the journal
+			check_str(SETTINGS_ID_SOURCE_CALL, "DE0XYZ");
+			assert(read_u32(SETTINGS_ID_APRS_FLAGS) == 0xcafe);
+			assert(is_default(SETTINGS_ID_COMMENT));
+			assert(fds_fake_record_count() == 3);
+		} else {
+			// nothing has changed
+			check_str(SETTINGS_ID_SOURCE_CALL, "DL1ABC");
+			check_str(SETTINGS_ID_COMMENT, "old");
+			assert(read_u32(SETTINGS_ID_APRS_FLAGS) == 1);
+		}
+
+		assert(settings_is_saved());
+
+		// the restored values are also there after the next reset
+		boot();
+		assert(fds_fake_queued() == 0);
+	}
+
+	printf("restore power loss checks passed\n");
+}
+
+
+/**@brief Replay a menu session and compare the flash writes with the
+ * previous behaviour, where every change was written immediately. */
+static void test_menu_session(void)
+{
+	fds_fake_stats_t fds_stats;
+	settings_stats_t stats;
+	uint32_t changes = 0;
+
+	fds_fake_format();
+	boot();
+
+	// step through the TX power levels and back
+	for(int i = 0; i < 7; i++) {
+		write_u8(SETTINGS_ID_LORA_POWER, i);
+		changes++;
+	}
+
+	for(int i = 5; i >= 3; i--) {
+		write_u8(SETTINGS_ID_LORA_POWER, i);
+		changes++;
+	}
+
+	// toggle some flags
+	uint32_t flags = 0;
+	for(int i = 0; i < 6; i++) {
+		flags ^= 1 << (i % 3);
+		write_u32(SETTINGS_ID_APRS_FLAGS, flags);
+		changes++;
+	}
+
+	// select a symbol
+	const char *symbols[] = {"/>", "/b", "/[", "/b"};
+	for(size_t i = 0; i < 4; i++) {
+		assert(settings_write(SETTINGS_ID_SYMBOL_CODE, (const uint8_t *)symbols[i], 2) == NRF_SUCCESS);
+		changes++;
+	}
+
+	expire_flush_timer();
+
+	fds_fake_get_stats(&fds_stats);
+	settings_get_stats(&stats);
+
+	assert(fds_stats.writes == 3);
+	assert(stats.flash_writes == 3);
+	assert(stats.flash_writes_saved == changes - 3);
+
+	printf("menu session: %u changes, %u flash writes with cache, %u saved\n",
+			changes, stats.flash_writes, stats.flash_writes_saved);
+}
+
+
+int main(void)
+{
+	test_cache();
+	test_flush();
+	test_restore();
+	test_restore_power_loss();
+	test_menu_session();
+
+	printf("settings checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * Host simulation of the flash wear with and without the storage manager.
+ *
+ * Many configuration changes are written through the settings module to the
+ * simulated flash data storage (fds_fake.c). Without the storage manager,
+ * nothing ever runs a garbage collection, so the flash runs full and all
+ * further writes fail. With the storage manager, a garbage collection is run
+ * before that happens, but only while the simulated radio is idle.
+ *
+ * The flush timer and the event queue are simulated like in settings_test.c.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "app_timer.h"
+#include "fds_fake.h"
+
+#include "../../src/settings.h"
+#include "../../src/storage.h"
+#include "../../src/event_queue.h"
+
+#define CYCLES  5000
+
+static app_timer_t *m_timer;
+
+static event_handler_t m_event_handlers[EVENT_NUM_TYPES];
+static bool            m_event_pending[EVENT_NUM_TYPES];
+
+static bool     m_use_storage;
+static bool     m_radio_busy;
+
+static uint32_t m_flushes;
+static uint32_t m_failed_flushes;
+static uint32_t m_gc_deferred;
+static uint32_t m_gc_started_busy;
+
+
+ret_code_t app_timer_create(app_timer_id_t const *p_timer_id, app_timer_mode_t mode,
+		app_timer_timeout_handler_t timeout_handler)
+{
+	m_timer = *p_timer_id;
+	m_timer->handler = timeout_handler;
+	m_timer->running = false;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void *p_context)
+{
+	timer_id->running = true;
+	timer_id->ticks = timeout_ticks;
+	return NRF_SUCCESS;
+}
+
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id)
+{
+	timer_id->running = false;
+	return NRF_SUCCESS;
+}
+
+
+void event_queue_register(event_type_t type, event_handler_t handler)
+{
+	m_event_handlers[type] = handler;
+}
+
+
+void event_queue_post(event_type_t type)
+{
+	m_event_pending[type] = true;
+}
+
+
+/**@brief Dispatch events and complete flash operations until nothing is left. */
+static void run_until_idle(void)
+{
+	bool active;
+
+	do {
+		active = false;
+
+		for(event_type_t type = 0; type < EVENT_NUM_TYPES; type++) {
+			if(m_event_pending[type]) {
+				m_event_pending[type] = false;
+				m_event_handlers[type]();
+				active = true;
+			}
+		}
+
+		if(fds_fake_process_one()) {
+			active = true;
+		}
+	} while(active);
+}
+
+
+/**@brief Like handle_storage_gc() in main.c. */
+static void handle_storage_gc(void)
+{
+	if(m_radio_busy) {
+		m_gc_deferred++;
+		return;
+	}
+
+	assert(storage_run_gc() == NRF_SUCCESS);
+}
+
+
+static void cb_settings(settings_evt_t evt, settings_id_t id)
+{
+	if(evt != SETTINGS_EVT_FLUSH_COMPLETE) {
+		return;
+	}
+
+	m_flushes++;
+
+	if(!settings_is_saved()) {
+		m_failed_flushes++;
+	}
+
+	if(m_use_storage) {
+		// catches writes that were rejected before they were queued
+		storage_check();
+	}
+}
+
+
+/**@brief Start the GC from the storage manager only; count it if the radio
+ * is busy at that moment. */
+static void cb_fds_watch(fds_evt_t const *p_evt)
+{
+	if(p_evt->id == FDS_EVT_GC && m_radio_busy) {
+		m_gc_started_busy++;
+	}
+}
+
+
+static void write_str(settings_id_t id, const char *str)
+{
+	assert(settings_write(id, (const uint8_t *)str, strlen(str) + 1) == NRF_SUCCESS);
+}
+
+
+static void simulate(bool use_storage)
+{
+	fds_fake_stats_t fds_stats;
+	storage_stats_t  stats;
+	uint32_t         first_failure = 0;
+
+	m_use_storage = use_storage;
+	m_radio_busy = false;
+	m_flushes = 0;
+	m_failed_flushes = 0;
+	m_gc_deferred = 0;
+	m_gc_started_busy = 0;
+
+	memset(m_event_pending, 0, sizeof(m_event_pending));
+	memset(m_event_handlers, 0, sizeof(m_event_handlers));
+
+	fds_fake_format();
+	fds_fake_power_loss();
+
+	assert(fds_register(cb_fds_watch) == NRF_SUCCESS);
+
+	if(use_storage) {
+		assert(storage_init() == NRF_SUCCESS);
+		event_queue_register(EVENT_STORAGE_GC, handle_storage_gc);
+	}
+
+	assert(settings_init(cb_settings) == NRF_SUCCESS);
+	run_until_idle();
+
+	for(uint32_t cycle = 0; cycle < CYCLES; cycle++) {
+		char comment[40];
+		uint32_t flags = cycle;
+		uint8_t power = cycle % 8;
+
+		snprintf(comment, sizeof(comment), "T-Echo cycle %u%s", cycle,
+				(cycle % 5 == 0) ? " with a longer comment" : "");
+
+		write_str(SETTINGS_ID_COMMENT, comment);
+		assert(settings_write(SETTINGS_ID_APRS_FLAGS, (const uint8_t *)&flags, sizeof(flags)) == NRF_SUCCESS);
+		assert(settings_write(SETTINGS_ID_LORA_POWER, &power, sizeof(power)) == NRF_SUCCESS);
+
+		// the radio is busy in every third flush
+		m_radio_busy = (cycle % 3 == 0);
+
+		uint32_t failed_before = m_failed_flushes;
+
+		m_timer->running = false;
+		m_timer->handler(NULL);
+		run_until_idle();
+
+		if(m_failed_flushes != failed_before && first_failure == 0) {
+			first_failure = cycle + 1;
+		}
+
+		// the radio is idle again: the low speed tick retries a deferred GC
+		m_radio_busy = false;
+
+		if(use_storage && storage_gc_pending()) {
+			event_queue_post(EVENT_STORAGE_GC);
+		}
+
+		run_until_idle();
+	}
+
+	fds_fake_get_stats(&fds_stats);
+
+	printf("%s storage manager: %u flushes, %u failed",
+			use_storage ? "with" : "without", m_flushes, m_failed_flushes);
+
+	if(first_failure) {
+		printf(" (first after %u cycles)", first_failure);
+	}
+
+	printf(", %u record writes, %u GC runs, %u page erases (max. %u per page)\n",
+			fds_stats.writes, fds_stats.gc_runs, fds_stats.total_erases, fds_stats.max_erases);
+
+	if(!use_storage) {
+		assert(fds_stats.gc_runs == 0);
+		assert(m_failed_flushes > 0);
+		return;
+	}
+
+	storage_get_stats(&stats);
+
+	printf("  storage stats: %u writes, %u deletes, %u write failures, %u GC runs, %u words freed, %u GCs deferred\n",
+			stats.writes, stats.deletes, stats.write_failures, stats.gc_runs,
+			stats.words_freed, m_gc_deferred);
+
+	assert(m_failed_flushes == 0);
+	assert(stats.write_failures == 0);
+	assert(m_gc_started_busy == 0);
+	assert(m_gc_deferred > 0);
+
+	assert(stats.gc_runs == fds_stats.gc_runs);
+	assert(stats.writes == fds_stats.writes);
+	assert(stats.words_free >= STORAGE_GC_MIN_FREE_WORDS);
+
+	// the swap page rotates, so the wear is spread over all pages
+	assert(fds_stats.max_erases * FDS_VIRTUAL_PAGES <= fds_stats.total_erases + FDS_VIRTUAL_PAGES);
+}
+
+
+int main(void)
+{
+	assert(storage_gc_is_due(STORAGE_GC_MIN_FREE_WORDS - 1, STORAGE_GC_MIN_FREEABLE_WORDS));
+	assert(!storage_gc_is_due(STORAGE_GC_MIN_FREE_WORDS, STORAGE_GC_MIN_FREEABLE_WORDS));
+	assert(!storage_gc_is_due(0, STORAGE_GC_MIN_FREEABLE_WORDS - 1));
+
+	simulate(false);
+	simulate(true);
+
+	printf("storage simulation checks passed\n");
+
+	return 0;
+}
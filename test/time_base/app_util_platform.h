@@ -0,0 +1,9 @@
+#ifndef APP_UTIL_PLATFORM_H
+#define APP_UTIL_PLATFORM_H
+
+// values as in the nRF5 SDK for the S140 SoftDevice
+#define APP_IRQ_PRIORITY_HIGHEST  2
+#define APP_IRQ_PRIORITY_HIGH     2
+#define APP_IRQ_PRIORITY_LOW      6
+
+#endif // APP_UTIL_PLATFORM_H
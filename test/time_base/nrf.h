@@ -0,0 +1,26 @@
+#ifndef NRF_H
+#define NRF_H
+
+/* Minimal replacement for the device header. The RTC and the interrupt
+ * controller are simulated in time_base_test.c. */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+	RTC2_IRQn = 36,
+} IRQn_Type;
+
+typedef struct {
+	int unused;
+} NRF_RTC_Type;
+
+extern NRF_RTC_Type fake_rtc2;
+
+#define NRF_RTC2  (&fake_rtc2)
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+void NVIC_EnableIRQ(IRQn_Type irq);
+
+#endif // NRF_H
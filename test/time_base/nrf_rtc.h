@@ -0,0 +1,27 @@
+#ifndef NRF_RTC_H
+#define NRF_RTC_H
+
+/* Simulated RTC HAL, see time_base_test.c. */
+
+#include "nrf.h"
+
+typedef enum {
+	NRF_RTC_TASK_START,
+	NRF_RTC_TASK_STOP,
+	NRF_RTC_TASK_CLEAR,
+} nrf_rtc_task_t;
+
+typedef enum {
+	NRF_RTC_EVENT_OVERFLOW,
+} nrf_rtc_event_t;
+
+#define NRF_RTC_INT_OVERFLOW_MASK  (1 << 1)
+
+uint32_t nrf_rtc_counter_get(NRF_RTC_Type *p_reg);
+uint32_t nrf_rtc_event_pending(NRF_RTC_Type *p_reg, nrf_rtc_event_t event);
+void nrf_rtc_event_clear(NRF_RTC_Type *p_reg, nrf_rtc_event_t event);
+void nrf_rtc_int_enable(NRF_RTC_Type *p_reg, uint32_t mask);
+void nrf_rtc_prescaler_set(NRF_RTC_Type *p_reg, uint32_t val);
+void nrf_rtc_task_trigger(NRF_RTC_Type *p_reg, nrf_rtc_task_t task);
+
+#endif // NRF_RTC_H
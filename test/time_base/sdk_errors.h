@@ -0,0 +1,25 @@
+#ifndef SDK_ERRORS_H
+#define SDK_ERRORS_H
+
+#include <stdint.h>
+
+typedef uint32_t ret_code_t;
+
+// values as in the nRF5 SDK
+#define NRF_SUCCESS                     0
+#define NRF_ERROR_INTERNAL              3
+#define NRF_ERROR_NO_MEM                4
+#define NRF_ERROR_NOT_FOUND             5
+#define NRF_ERROR_NOT_SUPPORTED         6
+#define NRF_ERROR_INVALID_PARAM         7
+#define NRF_ERROR_INVALID_STATE         8
+#define NRF_ERROR_INVALID_LENGTH        9
+#define NRF_ERROR_INVALID_DATA         11
+#define NRF_ERROR_DATA_SIZE            12
+#define NRF_ERROR_TIMEOUT              13
+#define NRF_ERROR_NULL                 14
+#define NRF_ERROR_FORBIDDEN            15
+#define NRF_ERROR_BUSY                 17
+#define NRF_ERROR_RESOURCES            19
+
+#endif // SDK_ERRORS_H
@@ -0,0 +1,308 @@
+/*
+ * Host test for the time base.
+ *
+ * The RTC is simulated: its 24 bit counter is advanced by the test, and an
+ * overflow sets the overflow event and calls the interrupt handler unless the
+ * interrupt is blocked. Reading the counter can also advance it, which
+ * simulates time passing between two instructions of time_base_get().
+ *
+ * The time base is checked against the exact uptime over several weeks,
+ * including the wraparound of the 32 bit tick count after 48.5 days.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nrf.h"
+#include "nrf_rtc.h"
+
+#include "../../src/time_base.h"
+
+#define COUNTER_MASK      0xFFFFFF
+#define TICKS_PER_SEC     1024ULL
+
+#define DAY_TICKS         (24ULL * 3600 * TICKS_PER_SEC)
+
+// defined in time_base.c
+void RTC2_IRQHandler(void);
+
+NRF_RTC_Type fake_rtc2;
+
+static struct {
+	bool     running;
+	uint32_t prescaler;
+	uint32_t counter;
+	bool     overflow_event;
+	bool     overflow_int_enabled;
+	bool     irq_enabled;
+	bool     irq_blocked;      // interrupt masked, e.g. in a critical region
+	uint32_t ticks_per_read;   // ticks that pass each time the counter is read
+	bool     advance_first;    // ticks pass before (instead of after) the read
+	uint64_t total_ticks;      // all ticks since the start of the simulation
+	uint32_t irq_count;
+} m_rtc;
+
+
+static void run_pending_irq(void)
+{
+	if(m_rtc.overflow_event && m_rtc.overflow_int_enabled
+			&& m_rtc.irq_enabled && !m_rtc.irq_blocked) {
+		m_rtc.irq_count++;
+		RTC2_IRQHandler();
+	}
+}
+
+
+static void fake_rtc_advance(uint64_t ticks)
+{
+	assert(m_rtc.running);
+
+	while(ticks > 0) {
+		// step to the next overflow at most, so no interrupt is missed
+		uint64_t step = (COUNTER_MASK + 1) - m_rtc.counter;
+
+		if(step > ticks) {
+			step = ticks;
+		}
+
+		m_rtc.counter = (m_rtc.counter + step) & COUNTER_MASK;
+		m_rtc.total_ticks += step;
+		ticks -= step;
+
+		if(m_rtc.counter == 0) {
+			m_rtc.overflow_event = true;
+			run_pending_irq();
+		}
+	}
+}
+
+
+uint32_t nrf_rtc_counter_get(NRF_RTC_Type *p_reg)
+{
+	assert(p_reg == NRF_RTC2);
+
+	if(m_rtc.advance_first) {
+		fake_rtc_advance(m_rtc.ticks_per_read);
+		return m_rtc.counter;
+	}
+
+	uint32_t value = m_rtc.counter;
+	fake_rtc_advance(m_rtc.ticks_per_read);
+	return value;
+}
+
+
+uint32_t nrf_rtc_event_pending(NRF_RTC_Type *p_reg, nrf_rtc_event_t event)
+{
+	assert(p_reg == NRF_RTC2 && event == NRF_RTC_EVENT_OVERFLOW);
+	return m_rtc.overflow_event;
+}
+
+
+void nrf_rtc_event_clear(NRF_RTC_Type *p_reg, nrf_rtc_event_t event)
+{
+	assert(p_reg == NRF_RTC2 && event == NRF_RTC_EVENT_OVERFLOW);
+	m_rtc.overflow_event = false;
+}
+
+
+void nrf_rtc_int_enable(NRF_RTC_Type *p_reg, uint32_t mask)
+{
+	assert(p_reg == NRF_RTC2 && mask == NRF_RTC_INT_OVERFLOW_MASK);
+	m_rtc.overflow_int_enabled = true;
+}
+
+
+void nrf_rtc_prescaler_set(NRF_RTC_Type *p_reg, uint32_t val)
+{
+	assert(p_reg == NRF_RTC2);
+	assert(!m_rtc.running); // the prescaler can only be set while stopped
+	m_rtc.prescaler = val;
+}
+
+
+void nrf_rtc_task_trigger(NRF_RTC_Type *p_reg, nrf_rtc_task_t task)
+{
+	assert(p_reg == NRF_RTC2 && task == NRF_RTC_TASK_START);
+	m_rtc.running = true;
+}
+
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+	assert(irq == RTC2_IRQn);
+	(void)priority;
+}
+
+
+void NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+	assert(irq == RTC2_IRQn);
+}
+
+
+void NVIC_EnableIRQ(IRQn_Type irq)
+{
+	assert(irq == RTC2_IRQn);
+	m_rtc.irq_enabled = true;
+}
+
+
+/* Advance to the given number of ticks before the next overflow. */
+static void fake_rtc_advance_to_overflow(uint32_t ticks_before)
+{
+	uint32_t remaining = (COUNTER_MASK + 1) - m_rtc.counter;
+
+	if(remaining < ticks_before) {
+		remaining += COUNTER_MASK + 1;
+	}
+
+	fake_rtc_advance(remaining - ticks_before);
+}
+
+
+static uint64_t ticks_to_ms(uint64_t ticks)
+{
+	return ticks * 1000 / TICKS_PER_SEC;
+}
+
+
+/* Check the time base against the simulated uptime. If the counter advances
+ * while reading, the result may be from any point during the call. */
+static uint64_t check_time(uint64_t epoch_ticks)
+{
+	uint64_t before = m_rtc.total_ticks - epoch_ticks;
+	uint64_t now = time_base_get();
+	uint64_t after = m_rtc.total_ticks - epoch_ticks;
+
+	if(now < ticks_to_ms(before) || now > ticks_to_ms(after)) {
+		fprintf(stderr, "time base: %llu ms, expected %llu to %llu ms\n",
+				(unsigned long long)now,
+				(unsigned long long)ticks_to_ms(before),
+				(unsigned long long)ticks_to_ms(after));
+		assert(false);
+	}
+
+	return now;
+}
+
+
+static void test_conversion(uint64_t epoch_ticks)
+{
+	// every tick count in one second maps to the exact millisecond
+	for(int i = 0; i < 2 * (int)TICKS_PER_SEC; i++) {
+		fake_rtc_advance(1);
+		assert(time_base_get() == ticks_to_ms(m_rtc.total_ticks - epoch_ticks));
+	}
+}
+
+
+static void test_blocked_irq(uint64_t epoch_ticks)
+{
+	// the overflow happens while the interrupt is blocked
+	fake_rtc_advance_to_overflow(10);
+	check_time(epoch_ticks);
+
+	m_rtc.irq_blocked = true;
+	fake_rtc_advance(20);
+	assert(m_rtc.overflow_event);
+	check_time(epoch_ticks);
+
+	m_rtc.irq_blocked = false;
+	run_pending_irq();
+	assert(!m_rtc.overflow_event);
+	check_time(epoch_ticks);
+}
+
+
+static void test_race(uint64_t epoch_ticks)
+{
+	// the counter overflows while it is read, with and without the interrupt
+	// being blocked. Every start position near the overflow is tried.
+	for(int mode = 0; mode < 4; mode++) {
+		for(uint32_t offset = 1; offset <= 8; offset++) {
+			fake_rtc_advance_to_overflow(offset);
+
+			m_rtc.irq_blocked = mode & 1;
+			m_rtc.advance_first = mode & 2;
+			m_rtc.ticks_per_read = 1;
+
+			uint64_t last = 0;
+
+			for(int i = 0; i < 6; i++) {
+				uint64_t now = check_time(epoch_ticks);
+				assert(now >= last);
+				last = now;
+			}
+
+			m_rtc.ticks_per_read = 0;
+			m_rtc.advance_first = false;
+			m_rtc.irq_blocked = false;
+			run_pending_irq();
+
+			check_time(epoch_ticks);
+		}
+	}
+}
+
+
+static void test_weeks(uint64_t epoch_ticks)
+{
+	uint64_t end = m_rtc.total_ticks + 8 * 7 * DAY_TICKS;
+	uint64_t last = 0;
+	uint32_t irq_count_start = m_rtc.irq_count;
+	uint64_t ticks_start = m_rtc.total_ticks;
+
+	srand(4711);
+
+	while(m_rtc.total_ticks < end) {
+		// mostly short steps like event-driven calls, sometimes long idle phases
+		uint64_t step = (rand() % 16 == 0)
+			? (uint64_t)(rand() % (3 * COUNTER_MASK))
+			: (uint64_t)(rand() % 60000);
+
+		fake_rtc_advance(step);
+
+		uint64_t now = check_time(epoch_ticks);
+		assert(now >= last);
+		last = now;
+	}
+
+	double days = (m_rtc.total_ticks - ticks_start) / (double)DAY_TICKS;
+
+	printf("%.1f days, uptime %llu ms, %u interrupts (%.1f per day)\n",
+			days, (unsigned long long)last,
+			m_rtc.irq_count - irq_count_start,
+			(m_rtc.irq_count - irq_count_start) / days);
+
+	// the 32 bit tick count has wrapped, too
+	assert(m_rtc.total_ticks - epoch_ticks > (1ULL << 32));
+
+	// the only wakeups are the counter overflows (every 4.55 hours)
+	assert((m_rtc.irq_count - irq_count_start) / days < 5.5);
+}
+
+
+int main(void)
+{
+	// the counter does not start at 0 to check the epoch handling
+	m_rtc.running = true;
+	fake_rtc_advance(12345);
+	m_rtc.running = false;
+
+	uint64_t epoch_ticks = m_rtc.total_ticks;
+
+	assert(time_base_init() == NRF_SUCCESS);
+	assert(m_rtc.prescaler == 31);
+	assert(time_base_get() == 0);
+
+	test_conversion(epoch_ticks);
+	test_blocked_irq(epoch_ticks);
+	test_race(epoch_ticks);
+	test_weeks(epoch_ticks);
+
+	printf("time base checks passed\n");
+
+	return 0;
+}
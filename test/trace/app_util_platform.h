@@ -0,0 +1,8 @@
+#ifndef APP_UTIL_PLATFORM_H
+#define APP_UTIL_PLATFORM_H
+
+// the host harness is single-threaded
+#define CRITICAL_REGION_ENTER()  {
+#define CRITICAL_REGION_EXIT()   }
+
+#endif // APP_UTIL_PLATFORM_H
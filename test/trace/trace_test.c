@@ -0,0 +1,339 @@
+/*
+ * Host test and benchmark for the binary trace.
+ *
+ * The test writes a trace stream and the expected decoder output, which are
+ * compared by the check target after running tools/trace_decode.py on this
+ * binary. The format strings are taken from the trace_fmt section of this
+ * executable, just like from the firmware ELF.
+ *
+ * The benchmark compares the bytes and CPU time per event with the current
+ * NRF_LOG backend, which formats every message as text before sending it
+ * over RTT. The text formatting is reproduced with snprintf(). The times are
+ * measured on the host with profiling_now() and are only meaningful
+ * relative to each other.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../src/trace.h"
+#include "../../src/profiling.h"
+
+#define BENCH_ITERATIONS  20000
+
+static uint8_t m_stream[16384];
+static size_t  m_stream_len;
+static size_t  m_output_limit;   // bytes accepted per call, to test partial writes
+
+static FILE *m_expected;
+
+static uint8_t m_sink[512];
+
+// an uncompressed position report as generated by the tracker
+static const uint8_t m_frame[] =
+	"<\xff\x01" "DL1ABC-7>APLETK:!4807.38N/01131.00E>T-Echo 4.12V 12.3C";
+
+
+static size_t output_stream(const uint8_t *data, size_t len)
+{
+	if(len > m_output_limit) {
+		len = m_output_limit;
+	}
+
+	assert(m_stream_len + len <= sizeof(m_stream));
+
+	memcpy(&m_stream[m_stream_len], data, len);
+	m_stream_len += len;
+
+	return len;
+}
+
+
+static size_t output_sink(const uint8_t *data, size_t len)
+{
+	memcpy(m_sink, data, len < sizeof(m_sink) ? len : sizeof(m_sink));
+	return len;
+}
+
+
+static void flush_all(void)
+{
+	while(trace_flush()) {
+		// continue until the ring is empty or the output is full
+	}
+}
+
+
+#define EXPECT_INFO(fmt, ...) \
+	do { \
+		TRACE_INFO(fmt, ##__VA_ARGS__); \
+		fprintf(m_expected, fmt "\n", ##__VA_ARGS__); \
+	} while(0)
+
+
+static void expect_hexdump(const uint8_t *data, size_t len)
+{
+	TRACE_HEXDUMP("Generated frame:", data, len);
+
+	fprintf(m_expected, "Generated frame:");
+
+	for(size_t i = 0; i < len; i++) {
+		fprintf(m_expected, " %02x", data[i]);
+	}
+
+	fprintf(m_expected, "\n");
+}
+
+
+static void test_stream(void)
+{
+	trace_stats_t stats;
+
+	trace_init(output_stream);
+	m_output_limit = 100;
+
+	EXPECT_INFO("forced tx");
+	EXPECT_INFO("slot missed by %d ms", 12);
+	EXPECT_INFO("slot missed by %d ms", -250);
+	EXPECT_INFO("heading changed too much: was: %d, is: %d, delta: %d, threshold: %d", 87, 131, 44, 28);
+	EXPECT_INFO("report from source %u waits for the next slot, flags 0x%04x", 2, 0xbeef);
+	EXPECT_INFO("maximum: %u", 0xFFFFFFFFU);
+	expect_hexdump(m_frame, sizeof(m_frame) - 1);
+
+	flush_all();
+
+	// many events with flushes in between wrap around the ring
+	for(int i = 0; i < 200; i++) {
+		EXPECT_INFO("event %d of %d", i, 200);
+
+		if(i % 7 == 0) {
+			flush_all();
+		}
+	}
+
+	flush_all();
+
+	trace_get_stats(&stats);
+	assert(stats.dropped == 0);
+	assert(stats.bytes == m_stream_len);
+	assert(stats.bytes > TRACE_RING_SIZE);
+
+	// fill the ring without flushing: events are dropped and reported
+	uint32_t events_before = stats.events;
+	int written = 0;
+
+	for(int i = 0; i < 300; i++) {
+		uint32_t events = stats.events;
+
+		TRACE_INFO("fill %d", i);
+		trace_get_stats(&stats);
+
+		if(stats.events != events) {
+			// once the ring is full, no further event fits
+			assert(stats.dropped == 0);
+			fprintf(m_expected, "fill %d\n", i);
+			written++;
+		}
+	}
+
+	trace_get_stats(&stats);
+	assert(stats.dropped > 0);
+	assert(stats.events - events_before == (uint32_t)written);
+	assert(stats.max_fill <= TRACE_RING_SIZE);
+
+	flush_all();
+
+	fprintf(m_expected, "<%u events dropped>\n", stats.dropped);
+	EXPECT_INFO("recovered");
+
+	flush_all();
+
+	trace_get_stats(&stats);
+	assert(stats.bytes == m_stream_len);
+	assert(!trace_flush());
+
+	// a full output stops the flush
+	m_output_limit = 0;
+	TRACE_INFO("not sent");
+	assert(!trace_flush());
+
+	printf("stream checks passed: %zu bytes\n", m_stream_len);
+}
+
+
+/* Benchmark cases: each event is traced and formatted like the NRF_LOG
+ * backend does, with the "<info> module: " prefix and a CRLF line end. */
+
+static void trace_hexdump(void)
+{
+	TRACE_HEXDUMP("Generated frame:", m_frame, sizeof(m_frame) - 1);
+}
+
+
+static size_t format_hexdump(char *buf, size_t size)
+{
+	size_t len = snprintf(buf, size, "<info> tracker: Generated frame:\r\n");
+
+	// nrf_log prints 8 bytes per line, followed by the ASCII representation
+	for(size_t i = 0; i < sizeof(m_frame) - 1; i += 8) {
+		len += snprintf(buf + len, size - len, "<info> tracker: ");
+
+		for(size_t j = 0; j < 8; j++) {
+			if(i + j < sizeof(m_frame) - 1) {
+				len += snprintf(buf + len, size - len, " %02x", m_frame[i + j]);
+			} else {
+				len += snprintf(buf + len, size - len, "   ");
+			}
+		}
+
+		len += snprintf(buf + len, size - len, "|");
+
+		for(size_t j = 0; j < 8 && i + j < sizeof(m_frame) - 1; j++) {
+			char c = m_frame[i + j];
+			len += snprintf(buf + len, size - len, "%c", (c >= 0x20 && c < 0x7F) ? c : '.');
+		}
+
+		len += snprintf(buf + len, size - len, "\r\n");
+	}
+
+	return len;
+}
+
+
+static void trace_heading(void)
+{
+	TRACE_INFO("heading changed too much: was: %d, is: %d, delta: %d, threshold: %d", 87, 131, 44, 28);
+}
+
+
+static size_t format_heading(char *buf, size_t size)
+{
+	return snprintf(buf, size, "<info> tracker: heading changed too much: was: %d, is: %d, delta: %d, threshold: %d\r\n", 87, 131, 44, 28);
+}
+
+
+static void trace_slot(void)
+{
+	TRACE_INFO("slot missed by %d ms", 12);
+}
+
+
+static size_t format_slot(char *buf, size_t size)
+{
+	return snprintf(buf, size, "<info> tracker: slot missed by %d ms\r\n", 12);
+}
+
+
+static void trace_forced(void)
+{
+	TRACE_INFO("forced tx");
+}
+
+
+static size_t format_forced(char *buf, size_t size)
+{
+	return snprintf(buf, size, "<info> tracker: forced tx\r\n");
+}
+
+
+typedef struct {
+	const char *name;
+	void (*trace)(void);
+	size_t (*format)(char *buf, size_t size);
+} bench_case_t;
+
+static const bench_case_t BENCH_CASES[] = {
+	{"frame hexdump", trace_hexdump, format_hexdump},
+	{"4 arguments",   trace_heading, format_heading},
+	{"1 argument",    trace_slot,    format_slot},
+	{"no arguments",  trace_forced,  format_forced},
+};
+
+
+static void benchmark(void)
+{
+	char text[1024];
+	uint64_t total_text_ticks = 0;
+	uint64_t total_trace_ticks = 0;
+
+	printf("%-14s %12s %12s %14s %14s\n", "event", "text bytes", "trace bytes", "text ticks", "trace ticks");
+
+	for(size_t c = 0; c < sizeof(BENCH_CASES) / sizeof(BENCH_CASES[0]); c++) {
+		const bench_case_t *bench = &BENCH_CASES[c];
+		trace_stats_t stats;
+
+		trace_init(output_sink);
+
+		// bytes per event
+		bench->trace();
+		trace_get_stats(&stats);
+		flush_all();
+
+		size_t trace_bytes = stats.bytes;
+		size_t text_bytes = bench->format(text, sizeof(text));
+
+		assert(text_bytes < sizeof(text));
+		assert(trace_bytes < text_bytes);
+
+		// time per event, including the copy to the output
+		uint32_t start = profiling_now();
+
+		for(int i = 0; i < BENCH_ITERATIONS; i++) {
+			bench->trace();
+			flush_all();
+		}
+
+		uint32_t trace_ticks = profiling_now() - start;
+
+		start = profiling_now();
+
+		for(int i = 0; i < BENCH_ITERATIONS; i++) {
+			size_t len = bench->format(text, sizeof(text));
+			output_sink((const uint8_t *)text, len);
+		}
+
+		uint32_t text_ticks = profiling_now() - start;
+
+		trace_get_stats(&stats);
+		assert(stats.dropped == 0);
+
+		printf("%-14s %12zu %12zu %14.1f %14.1f\n", bench->name, text_bytes, trace_bytes,
+				(double)text_ticks / BENCH_ITERATIONS, (double)trace_ticks / BENCH_ITERATIONS);
+
+		total_text_ticks += text_ticks;
+		total_trace_ticks += trace_ticks;
+	}
+
+	printf("ticks at %u MHz, measured on the host\n", PROFILING_TICKS_PER_US);
+
+	// formatting text is much slower than packing a few bytes
+	assert(total_trace_ticks < total_text_ticks);
+}
+
+
+int main(int argc, char **argv)
+{
+	if(argc != 3) {
+		fprintf(stderr, "Usage: %s <trace.bin> <expected.txt>\n", argv[0]);
+		return 1;
+	}
+
+	m_expected = fopen(argv[2], "w");
+	assert(m_expected);
+
+	test_stream();
+
+	fclose(m_expected);
+
+	FILE *f = fopen(argv[1], "wb");
+	assert(f);
+	assert(fwrite(m_stream, 1, m_stream_len, f) == m_stream_len);
+	fclose(f);
+
+	benchmark();
+
+	printf("trace checks passed\n");
+
+	return 0;
+}
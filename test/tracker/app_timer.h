@@ -0,0 +1,6 @@
+#ifndef APP_TIMER_H
+#define APP_TIMER_H
+
+// only included for completeness, the host harness does not use any timers.
+
+#endif // APP_TIMER_H
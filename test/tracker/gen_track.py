@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+
+# Generate synthetic NMEA logs (RMC + GGA at 1 Hz) for the tracker replay
+# harness. The GNSS noise model is simple: the reported position follows a
+# slowly drifting random walk around the true position, and speed/heading are
+# derived from consecutive noisy positions like a real receiver does at low
+# speed.
+#
+# With --turns, the times of the turns are written instead of the NMEA log, in
+# seconds since the start of the track, so the replay harness can check which
+# beacons were caused by real turns.
+
+import math
+import random
+import sys
+import datetime
+
+EARTH_RADIUS_M = 6371000.0
+
+START_LAT = 49.0069
+START_LON = 8.4037
+START_TIME = datetime.datetime(2023, 5, 13, 6, 0, 0)
+
+def checksum(body):
+    c = 0
+    for ch in body:
+        c ^= ord(ch)
+    return f"{c:02X}"
+
+def fmt_coord(value, deg_digits, pos, neg):
+    hemi = pos if value >= 0 else neg
+    value = abs(value)
+    deg = int(value)
+    minutes = (value - deg) * 60
+    return f"{deg:0{deg_digits}d}{minutes:08.5f}", hemi
+
+def sentences(t, lat, lon, speed_mps, heading, alt=120.0):
+    timestr = t.strftime("%H%M%S.000")
+    datestr = t.strftime("%d%m%y")
+    lat_s, ns = fmt_coord(lat, 2, 'N', 'S')
+    lon_s, ew = fmt_coord(lon, 3, 'E', 'W')
+
+    rmc = f"GNRMC,{timestr},A,{lat_s},{ns},{lon_s},{ew},{speed_mps / 0.5144444:.2f},{heading:.2f},{datestr},,,A,V"
+    gga = f"GNGGA,{timestr},{lat_s},{ns},{lon_s},{ew},1,09,1.1,{alt:.1f},M,48.0,M,,"
+
+    return [f"${rmc}*{checksum(rmc)}", f"${gga}*{checksum(gga)}"]
+
+def move(lat, lon, heading_deg, dist_m):
+    h = math.radians(heading_deg)
+    dlat = dist_m * math.cos(h) / EARTH_RADIUS_M
+    dlon = dist_m * math.sin(h) / (EARTH_RADIUS_M * math.cos(math.radians(lat)))
+    return lat + math.degrees(dlat), lon + math.degrees(dlon)
+
+class Track:
+    def __init__(self, seed):
+        self.rng = random.Random(seed)
+        self.t = START_TIME
+        self.lat = START_LAT
+        self.lon = START_LON
+        self.heading = 0.0
+        # GNSS error state (meters, north/east)
+        self.err_n = 0.0
+        self.err_e = 0.0
+        self.prev_meas = None
+        self.lines = []
+        self.turns = []
+
+    def _noise_step(self, sigma):
+        # first-order Gauss-Markov process with 300 s correlation time
+        a = math.exp(-1.0 / 300.0)
+        self.err_n = a * self.err_n + self.rng.gauss(0, sigma * math.sqrt(1 - a*a))
+        self.err_e = a * self.err_e + self.rng.gauss(0, sigma * math.sqrt(1 - a*a))
+
+    def _emit(self, sigma, white):
+        self._noise_step(sigma)
+        err_n, err_e = self.err_n, self.err_e
+        if white:
+            err_n += self.rng.gauss(0, white)
+            err_e += self.rng.gauss(0, white)
+        lat, lon = move(self.lat, self.lon, 0.0, err_n)
+        lat, lon = move(lat, lon, 90.0, err_e)
+
+        if self.prev_meas:
+            plat, plon = self.prev_meas
+            dn = (lat - plat) * math.pi / 180 * EARTH_RADIUS_M
+            de = (lon - plon) * math.pi / 180 * EARTH_RADIUS_M * math.cos(math.radians(lat))
+            speed = math.hypot(dn, de)
+            heading = math.degrees(math.atan2(de, dn)) % 360
+        else:
+            speed, heading = 0.0, 0.0
+
+        self.prev_meas = (lat, lon)
+        self.lines += sentences(self.t, lat, lon, speed, heading)
+        self.t += datetime.timedelta(seconds=1)
+
+    def stay(self, seconds, sigma=3.0, white=0.0):
+        for _ in range(seconds):
+            self._emit(sigma, white)
+
+    def turn(self, turn_deg):
+        self.heading = (self.heading + self.rng.choice([-1, 1]) * turn_deg) % 360
+        self.turns.append(int((self.t - START_TIME).total_seconds()))
+
+    def go(self, seconds, speed, turn_every=0, turn_deg=90.0, sigma=2.0, white=0.0):
+        for i in range(seconds):
+            if turn_every and i > 0 and i % turn_every == 0:
+                self.turn(turn_deg)
+            self.lat, self.lon = move(self.lat, self.lon, self.heading, speed)
+            self._emit(sigma, white)
+
+def scenario_stationary(tr):
+    tr.stay(6 * 3600)
+
+def scenario_walk(tr):
+    # 90° turns, the default turn threshold at walking speed is 76°. Each walk
+    # after a break starts in a new direction.
+    for i in range(4):
+        if i > 0:
+            tr.turn(90)
+        tr.go(20 * 60, 1.4, turn_every=240, turn_deg=90)
+        tr.stay(10 * 60)
+
+def scenario_commute(tr):
+    tr.stay(3600)
+    tr.go(30 * 60, 14.0, turn_every=300, turn_deg=45)
+    tr.stay(4 * 3600)
+    tr.go(30 * 60, 14.0, turn_every=300, turn_deg=45)
+    tr.stay(3600)
+
+def scenario_urban(tr):
+    # walking between buildings: multipath adds 1 m of noise to each fix
+    for _ in range(3):
+        tr.stay(15 * 60, white=1.0)
+        tr.go(20 * 60, 1.4, turn_every=240, turn_deg=90, white=1.0)
+
+SCENARIOS = {
+    'stationary': scenario_stationary,
+    'walk': scenario_walk,
+    'commute': scenario_commute,
+    'urban': scenario_urban,
+}
+
+if __name__ == '__main__':
+    args = sys.argv[1:]
+    turns = bool(args) and args[0] == '--turns'
+    if turns:
+        args = args[1:]
+
+    if len(args) != 1 or args[0] not in SCENARIOS:
+        print(f"usage: {sys.argv[0]} [--turns] <{'|'.join(SCENARIOS)}>", file=sys.stderr)
+        sys.exit(1)
+
+    tr = Track(seed=args[0])
+    SCENARIOS[args[0]](tr)
+
+    if turns:
+        for t in tr.turns:
+            print(t)
+    else:
+        print("\n".join(tr.lines))
@@ -0,0 +1,19 @@
+#ifndef LORA_FAKE_H
+#define LORA_FAKE_H
+
+#include <stdint.h>
+
+#include "../../src/lora.h"
+
+/**@brief Time on air of a frame with the default modulation parameters
+ * (SF12, 125 kHz, CR 4/5, 8 preamble symbols, explicit header, CRC).
+ *
+ * @returns  The time on air in milliseconds.
+ */
+float lora_fake_calc_toa_ms(uint8_t n_bytes);
+
+uint32_t lora_fake_get_tx_count(void);
+float    lora_fake_get_airtime_ms(void);
+void     lora_fake_reset(void);
+
+#endif // LORA_FAKE_H
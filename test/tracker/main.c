@@ -0,0 +1,650 @@
+/*
+ * NMEA replay harness for the tracker.
+ *
+ * Replays a recorded NMEA log through nmea_parse() and the tracker like
+ * cb_gps() in main.c does. Virtual time is taken from the RMC timestamps, so
+ * hours of recording are processed in a fraction of a second.
+ *
+ * Each variant runs in a forked process because the tracker modules keep
+ * their state in static variables.
+ *
+ * If a list of turn times is given (see gen_track.py --turns), a beacon sent
+ * within TURN_WINDOW_MS after a real turn is counted as turn beacon, all other
+ * beacons are caused by the beacon rate or by GNSS noise. Beacons triggered by
+ * a heading change (see tracker_get_turn_counter()) outside of this window
+ * are counted as false turn beacons. In the walk and urban scenarios, these
+ * come from the heading noise at walking speed.
+ *
+ * Variants with the GNSS filter enabled are compared with the same variant
+ * without the filter: the filter must not increase the maximum position error
+ * and, with SmartBeaconing, must report at least as many real turns and not
+ * more false turn beacons. The difference in the number of other beacons is
+ * the number of beacons triggered by GNSS noise that the filter avoided. If
+ * most beacons of the unfiltered variant are false turn beacons, its maximum
+ * error is kept low by the noise and is not compared.
+ *
+ * The run-time of nmea_parse() and tracker_run() on the host is measured with
+ * the profiling module.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../../src/nmea.h"
+#include "../../src/aprs.h"
+#include "../../src/tracker.h"
+#include "../../src/gnss_sched.h"
+#include "../../src/gnss_filter.h"
+#include "../../src/utils.h"
+#include "../../src/profiling.h"
+
+#include "time_base_fake.h"
+#include "lora_fake.h"
+
+/* Current model. The figures are taken from doc/features.adoc, which the
+ * battery life claims in README.md are based on. */
+#define BATTERY_CAPACITY_MAH      800.0 // standard T-Echo battery
+#define CURRENT_IDLE_MA             0.1 // idle, BLE advertising
+#define CURRENT_GNSS_ACTIVE_MA     40.0 // GNSS tracking (“base current”)
+#define CURRENT_TX_MA              60.0 // additional current while transmitting
+
+/* Not covered by the documentation: the L76K standby current plus the
+ * quiescent current of the peripheral power rail, which stays on during
+ * standby. This is a conservative estimate. */
+#define CURRENT_GNSS_STANDBY_MA     1.0
+
+/* Time from wakeup to the first fix after a hot start (with margin). */
+#define HOT_START_TTFF_MS        5000
+
+// offset of the first NMEA timestamp relative to the firmware start
+#define REPLAY_START_OFFSET_MS  10000
+
+// a beacon within this time after a real turn is counted as turn beacon. This
+// covers the minimum time between turn beacons and the settling time of the
+// heading.
+#define TURN_WINDOW_MS          60000
+
+#define MAX_TURNS                 256
+
+// the filtered variants may exceed the maximum error of the unfiltered ones by
+// this much. The error is measured against the raw GNSS position, whose noise
+// is not part of the filtered reports.
+#define MAX_ERROR_TOLERANCE_M      10 // meters
+
+extern bool g_lora_fake_verbose;
+
+typedef struct {
+	const char *name;
+	bool        duty_cycling;
+
+	// SmartBeaconing parameters. Default parameters are used if NULL.
+	const tracker_smartbeacon_params_t *smartbeacon;
+
+	// maximum dead reckoning error in meters (0 = disabled)
+	uint16_t    dead_reckoning_m;
+
+	// feed the tracker with filtered positions like the firmware does
+	bool        gnss_filter;
+} variant_t;
+
+// beacon every 2 minutes, ignore turns. Reference for the SmartBeaconing
+// variants.
+static const tracker_smartbeacon_params_t FIXED_2MIN = {
+	.fast_rate_s = 120, .slow_rate_s = 120,
+	.fast_speed_kmh = 90, .slow_speed_kmh = 5,
+	.min_turn_angle_deg = 180, .turn_slope = 0, .min_turn_time_s = 120,
+};
+
+// typical settings of APRS trackers for car use
+static const tracker_smartbeacon_params_t CAR_PRESET = {
+	.fast_rate_s = 60, .slow_rate_s = 1200,
+	.fast_speed_kmh = 90, .slow_speed_kmh = 5,
+	.min_turn_angle_deg = 28, .turn_slope = 255, .min_turn_time_s = 15,
+};
+
+static const variant_t VARIANTS[] = {
+	{"continuous",   false, NULL,        0,   false},
+	{"duty-cycled",  true,  NULL,        0,   false},
+	{"fixed-2min",   false, &FIXED_2MIN, 0,   false},
+	{"car-preset",   false, &CAR_PRESET, 0,   false},
+	{"dr-100m",      false, NULL,        100, false},
+	{"dr-250m",      false, NULL,        250, false},
+	{"dr-500m",      false, NULL,        500, false},
+	{"filtered",     false, NULL,        0,   true},
+	{"duty-filt",    true,  NULL,        0,   true},
+	{"car-filt",     false, &CAR_PRESET, 0,   true},
+	{"dr-100m-filt", false, NULL,        100, true},
+	{"dr-250m-filt", false, NULL,        250, true},
+};
+
+#define NUM_VARIANTS (sizeof(VARIANTS) / sizeof(VARIANTS[0]))
+
+typedef struct {
+	uint32_t tx_count;
+	uint32_t turn_tx_count;
+	uint32_t false_turn_tx_count;
+	float    airtime_ms;
+	float    max_error_m;
+	uint64_t duration_ms;
+	uint64_t gnss_standby_ms;
+	double   avg_current_ma;
+	double   runtime_h;
+
+	profiling_stats_t nmea_parse;
+	profiling_stats_t tracker_run;
+} result_t;
+
+
+// times of the real turns (same time base as the replay)
+static uint64_t m_turns[MAX_TURNS];
+static size_t   m_num_turns;
+static bool     m_turns_loaded;
+
+// first turn that was not reported yet
+static size_t   m_next_turn;
+static uint32_t m_turn_tx_count;
+
+// turn triggers of the tracker up to the last beacon
+static uint32_t m_turn_triggers;
+static uint32_t m_false_turn_tx_count;
+
+
+static void cb_tracker(tracker_evt_t evt)
+{
+	// nothing to do
+}
+
+
+/* Count a beacon sent at the given time if it reports a real turn, or if it
+ * was triggered by a heading change without a real turn. */
+static void check_turn_beacon(uint64_t time)
+{
+	bool turn_triggered = tracker_get_turn_counter() != m_turn_triggers;
+
+	m_turn_triggers = tracker_get_turn_counter();
+
+	// turns that were not reported within the window
+	while(m_next_turn < m_num_turns && m_turns[m_next_turn] + TURN_WINDOW_MS <= time) {
+		m_next_turn++;
+	}
+
+	if(m_next_turn < m_num_turns && m_turns[m_next_turn] <= time) {
+		m_turn_tx_count++;
+		m_next_turn++;
+	} else if(turn_triggered && m_turns_loaded) {
+		m_false_turn_tx_count++;
+	}
+}
+
+
+/* Emulate the firmware's TX timer: transmit every report that is due up to
+ * the given time, each one at its due time. */
+static void run_tx_timer(uint64_t until)
+{
+	uint64_t due;
+
+	while((due = tracker_get_next_tx_time()) <= until) {
+		if(due < time_base_get()) {
+			due = time_base_get();
+		}
+
+		time_base_fake_set(due);
+
+		uint32_t tx_count = lora_fake_get_tx_count();
+		bool sent = tracker_transmit_due(due);
+
+		if(lora_fake_get_tx_count() != tx_count) {
+			check_turn_beacon(due);
+		}
+
+		if(!sent && tracker_get_next_tx_time() <= due) {
+			// nothing can be sent at this time
+			break;
+		}
+	}
+}
+
+
+static uint64_t datetime_to_unix(const nmea_datetime_t *dt)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = dt->date_y - 1900;
+	tm.tm_mon  = dt->date_m - 1;
+	tm.tm_mday = dt->date_d;
+	tm.tm_hour = dt->time_h;
+	tm.tm_min  = dt->time_m;
+	tm.tm_sec  = dt->time_s;
+
+	return (uint64_t)timegm(&tm);
+}
+
+
+static void run_variant(const variant_t *variant, FILE *log, result_t *result)
+{
+	char line[128];
+
+	nmea_data_t data;
+	nmea_data_t skipped;
+
+	uint64_t first_unix = 0;
+	bool     have_first = false;
+	uint64_t now = 0;
+
+	uint64_t wakeup_time = 0; // NMEA data is ignored until this time
+	bool     in_standby = false;
+	bool     standby_epoch = false; // rest of the second of the standby command
+	uint64_t standby_start = 0;
+	uint64_t standby_total = 0;
+
+	float    max_error = 0.0f;
+
+	memset(&data, 0, sizeof(data));
+
+	profiling_init();
+
+	aprs_init();
+	aprs_set_source("N0CALL-7");
+	aprs_set_dest("APLETK");
+	aprs_add_path("WIDE1-1");
+	aprs_set_icon('/', '[');
+	aprs_set_comment("replay");
+
+	tracker_init(cb_tracker);
+
+	if(variant->smartbeacon) {
+		if(tracker_set_smartbeacon_params(variant->smartbeacon) != NRF_SUCCESS) {
+			fprintf(stderr, "invalid SmartBeaconing parameters in variant %s\n", variant->name);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(tracker_set_dead_reckoning_max_error(variant->dead_reckoning_m) != NRF_SUCCESS) {
+		fprintf(stderr, "invalid dead reckoning error in variant %s\n", variant->name);
+		exit(EXIT_FAILURE);
+	}
+
+	tracker_force_tx();
+	gnss_sched_reset(0);
+	gnss_filter_reset();
+
+	lora_fake_reset();
+
+	m_next_turn = 0;
+	m_turn_tx_count = 0;
+	m_turn_triggers = 0;
+	m_false_turn_tx_count = 0;
+
+	rewind(log);
+
+	while(fgets(line, sizeof(line), log)) {
+		bool pos_updated = false;
+
+		// the module finishes the current second after the standby command.
+		// In these logs, each second starts with the RMC sentence.
+		if(standby_epoch && strncmp(line + 3, "RMC", 3) == 0) {
+			standby_epoch = false;
+		}
+
+		if(in_standby && !standby_epoch) {
+			// the module does not output anything in standby. Only the timestamp
+			// is evaluated to advance the virtual time.
+			nmea_parse(line, NULL, &skipped);
+
+			if(skipped.datetime_valid && have_first) {
+				now = (datetime_to_unix(&skipped.datetime) - first_unix) * 1000 + REPLAY_START_OFFSET_MS;
+			}
+
+			// the TX timer keeps running while the GNSS module sleeps
+			run_tx_timer(now);
+
+			if(now < wakeup_time + HOT_START_TTFF_MS) {
+				continue;
+			}
+
+			in_standby = false;
+			standby_total += wakeup_time - standby_start;
+
+			// continue with the latest state, including the timestamp
+			data = skipped;
+			continue;
+		}
+
+		uint32_t prof_start = profiling_start();
+		ret_code_t err_code = nmea_parse(line, &pos_updated, &data);
+		profiling_end(PROFILING_SPAN_NMEA_PARSE, prof_start);
+
+		if(err_code != NRF_SUCCESS) {
+			continue;
+		}
+
+		if(data.datetime_valid) {
+			uint64_t unix_time = datetime_to_unix(&data.datetime);
+
+			if(!have_first) {
+				first_unix = unix_time;
+				have_first = true;
+			}
+
+			now = (unix_time - first_unix) * 1000 + REPLAY_START_OFFSET_MS;
+		}
+
+		if(!pos_updated || !have_first) {
+			continue;
+		}
+
+		// reports that became due since the previous update
+		run_tx_timer(now);
+
+		time_base_fake_set(now);
+
+		aprs_args_t args;
+		memset(&args, 0, sizeof(args));
+		args.vbat_millivolt = 3900;
+
+		// the parser updates the data incrementally, so the filter works on a
+		// copy
+		nmea_data_t input = data;
+
+		prof_start = profiling_start();
+
+		if(variant->gnss_filter) {
+			gnss_filter_update(&input, now);
+		}
+
+		tracker_run(&input, &args);
+		profiling_end(PROFILING_SPAN_CB_GPS, prof_start);
+
+		// reports triggered by this update
+		run_tx_timer(now);
+
+		// the distance between the current position and the position shown on
+		// receivers' maps. Without dead reckoning, this is the distance to the
+		// last reported position.
+		float reported_lat, reported_lon;
+
+		if(data.pos_valid && tracker_get_reported_position(now, &reported_lat, &reported_lon)) {
+			float error = great_circle_distance_m(data.lat, data.lon, reported_lat, reported_lon);
+			if(error > max_error) {
+				max_error = error;
+			}
+		}
+
+		// like in the firmware, the scheduler gets the unfiltered data
+		if(variant->duty_cycling) {
+			uint32_t standby_ms = gnss_sched_update(&data, now,
+					tracker_get_next_forced_tx_time(args.transmit_env_data));
+
+			if(standby_ms > 0) {
+				in_standby = true;
+				standby_epoch = true;
+				standby_start = now;
+				wakeup_time = now + (standby_ms / 1000) * 1000; // 1 s resolution
+			}
+
+			if(in_standby && gnss_sched_get_state() != GNSS_SCHED_STATE_STANDBY) {
+				fprintf(stderr, "variant %s: standby ended by the output after the standby command\n", variant->name);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		if(in_standby) {
+			skipped = data;
+		}
+	}
+
+	if(in_standby) {
+		standby_total += ((now < wakeup_time) ? now : wakeup_time) - standby_start;
+	}
+
+	result->tx_count = lora_fake_get_tx_count();
+	result->turn_tx_count = m_turn_tx_count;
+	result->false_turn_tx_count = m_false_turn_tx_count;
+	result->airtime_ms = lora_fake_get_airtime_ms();
+	result->max_error_m = max_error;
+	result->duration_ms = now;
+	result->gnss_standby_ms = standby_total;
+
+	profiling_get_stats(PROFILING_SPAN_NMEA_PARSE, &result->nmea_parse);
+	profiling_get_stats(PROFILING_SPAN_CB_GPS, &result->tracker_run);
+
+	double duration_h = now / 3600000.0;
+	double gnss_active_h = (now - standby_total) / 3600000.0;
+	double gnss_standby_h = standby_total / 3600000.0;
+	double tx_h = result->airtime_ms / 3600000.0;
+
+	double charge_mah =
+		duration_h * CURRENT_IDLE_MA
+		+ gnss_active_h * CURRENT_GNSS_ACTIVE_MA
+		+ gnss_standby_h * CURRENT_GNSS_STANDBY_MA
+		+ tx_h * CURRENT_TX_MA;
+
+	result->avg_current_ma = (duration_h > 0) ? charge_mah / duration_h : 0;
+	result->runtime_h = (result->avg_current_ma > 0) ? BATTERY_CAPACITY_MAH / result->avg_current_ma : 0;
+}
+
+
+static void print_runtime(const char *name, const profiling_stats_t *stats)
+{
+	if(stats->count == 0) {
+		return;
+	}
+
+	printf("%-12s n=%u, min/avg/max = %.1f/%.1f/%.1f us on the host\n",
+			name, stats->count,
+			(double)stats->min_ticks / PROFILING_TICKS_PER_US,
+			(double)stats->total_ticks / stats->count / PROFILING_TICKS_PER_US,
+			(double)stats->max_ticks / PROFILING_TICKS_PER_US);
+}
+
+
+/* Find the variant that only differs by the disabled GNSS filter. */
+static bool find_unfiltered(const variant_t *variant, size_t *index)
+{
+	for(size_t i = 0; i < NUM_VARIANTS; i++) {
+		if(!VARIANTS[i].gnss_filter
+				&& VARIANTS[i].duty_cycling == variant->duty_cycling
+				&& VARIANTS[i].smartbeacon == variant->smartbeacon
+				&& VARIANTS[i].dead_reckoning_m == variant->dead_reckoning_m) {
+			*index = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/* Compare the filtered variants with the unfiltered ones.
+ *
+ * @returns  False if a filter suppressed real turns, sent more false turn
+ *           beacons or increased the maximum error. */
+static bool check_filter(const result_t *results)
+{
+	bool ok = true;
+
+	for(size_t i = 0; i < NUM_VARIANTS; i++) {
+		size_t base;
+
+		if(!VARIANTS[i].gnss_filter || !find_unfiltered(&VARIANTS[i], &base)) {
+			continue;
+		}
+
+		const result_t *filt = &results[i];
+		const result_t *unfilt = &results[base];
+
+		int noise_avoided = (int)(unfilt->tx_count - unfilt->turn_tx_count)
+			- (int)(filt->tx_count - filt->turn_tx_count);
+		int false_turns_avoided = (int)unfilt->false_turn_tx_count - (int)filt->false_turn_tx_count;
+
+		printf("%-12s %d other beacons avoided (%d false turns), %u/%u turns reported (%s: %u/%u)\n",
+				VARIANTS[i].name, noise_avoided, false_turns_avoided,
+				filt->turn_tx_count, (unsigned)m_num_turns,
+				VARIANTS[base].name, unfilt->turn_tx_count, (unsigned)m_num_turns);
+
+		// with dead reckoning, turns do not trigger beacons, so beacons near a
+		// turn are a coincidence
+		if(!VARIANTS[i].dead_reckoning_m && filt->turn_tx_count < unfilt->turn_tx_count) {
+			fprintf(stderr, "variant %s: real turns suppressed by the filter\n", VARIANTS[i].name);
+			ok = false;
+		}
+
+		if(false_turns_avoided < 0) {
+			fprintf(stderr, "variant %s: more false turn beacons with the filter\n", VARIANTS[i].name);
+			ok = false;
+		}
+
+		// if most beacons of the unfiltered variant are false turns, they keep
+		// its error low and it is no reference for the filtered one
+		bool noise_dominated = unfilt->false_turn_tx_count > unfilt->turn_tx_count;
+
+		if(noise_dominated) {
+			printf("%-12s max. error not compared, %s sent mostly false turn beacons\n",
+					VARIANTS[i].name, VARIANTS[base].name);
+		}
+
+		if(!noise_dominated && filt->max_error_m > unfilt->max_error_m + MAX_ERROR_TOLERANCE_M) {
+			fprintf(stderr, "variant %s: max. error grows from %.0f m to %.0f m\n",
+					VARIANTS[i].name, unfilt->max_error_m, filt->max_error_m);
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+
+/* Read the turn times in seconds since the start of the track. */
+static bool load_turns(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if(!f) {
+		perror(filename);
+		return false;
+	}
+
+	unsigned long seconds;
+
+	while(fscanf(f, "%lu", &seconds) == 1) {
+		if(m_num_turns >= MAX_TURNS) {
+			fprintf(stderr, "%s: too many turns\n", filename);
+			fclose(f);
+			return false;
+		}
+
+		m_turns[m_num_turns++] = (uint64_t)seconds * 1000 + REPLAY_START_OFFSET_MS;
+	}
+
+	fclose(f);
+	m_turns_loaded = true;
+	return true;
+}
+
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while((opt = getopt(argc, argv, "v")) != -1) {
+		switch(opt) {
+			case 'v':
+				g_lora_fake_verbose = true;
+				break;
+
+			default:
+				fprintf(stderr, "usage: %s [-v] <nmea log> [turn list]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(optind >= argc) {
+		fprintf(stderr, "usage: %s [-v] <nmea log> [turn list]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(optind + 1 < argc && !load_turns(argv[optind + 1])) {
+		return EXIT_FAILURE;
+	}
+
+	FILE *log = fopen(argv[optind], "r");
+	if(!log) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%-12s %6s %6s %6s %10s %10s %10s %10s %9s %10s\n",
+			"variant", "TX", "turns", "false", "airtime/s", "max err/m", "replay/h", "standby/%", "I_avg/mA", "runtime/h");
+
+	result_t results[NUM_VARIANTS];
+	memset(results, 0, sizeof(results));
+
+	for(size_t i = 0; i < NUM_VARIANTS; i++) {
+		int fds[2];
+
+		if(pipe(fds) != 0) {
+			perror("pipe");
+			return EXIT_FAILURE;
+		}
+
+		fflush(stdout);
+
+		pid_t pid = fork();
+		if(pid == 0) {
+			result_t result;
+
+			close(fds[0]);
+			run_variant(&VARIANTS[i], log, &result);
+
+			// _exit() does not flush the verbose output
+			fflush(stdout);
+
+			if(write(fds[1], &result, sizeof(result)) != sizeof(result)) {
+				_exit(EXIT_FAILURE);
+			}
+
+			_exit(EXIT_SUCCESS);
+		}
+
+		close(fds[1]);
+
+		result_t result;
+		ssize_t n = read(fds[0], &result, sizeof(result));
+		close(fds[0]);
+		waitpid(pid, NULL, 0);
+
+		if(n != sizeof(result)) {
+			fprintf(stderr, "variant %s failed\n", VARIANTS[i].name);
+			return EXIT_FAILURE;
+		}
+
+		printf("%-12s %6u %6u %6u %10.1f %10.0f %10.2f %10.1f %9.2f %10.1f\n",
+				VARIANTS[i].name,
+				result.tx_count,
+				result.turn_tx_count,
+				result.false_turn_tx_count,
+				result.airtime_ms / 1000.0,
+				result.max_error_m,
+				result.duration_ms / 3600000.0,
+				(result.duration_ms > 0) ? 100.0 * result.gnss_standby_ms / result.duration_ms : 0.0,
+				result.avg_current_ma,
+				result.runtime_h);
+
+		results[i] = result;
+	}
+
+	bool filter_ok = check_filter(results);
+
+	print_runtime("nmea_parse", &results[0].nmea_parse);
+	print_runtime("tracker_run", &results[0].tracker_run);
+
+	fclose(log);
+
+	return filter_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,21 @@
+#ifndef SDK_MACROS_H
+#define SDK_MACROS_H
+
+#include "sdk_errors.h"
+
+#define VERIFY_SUCCESS(statement) \
+	do { \
+		ret_code_t _err_code = (statement); \
+		if(_err_code != NRF_SUCCESS) { \
+			return _err_code; \
+		} \
+	} while(0)
+
+#define VERIFY_PARAM_NOT_NULL(param) \
+	do { \
+		if((param) == NULL) { \
+			return NRF_ERROR_NULL; \
+		} \
+	} while(0)
+
+#endif // SDK_MACROS_H
@@ -0,0 +1,15 @@
+#include <stdint.h>
+
+#include "time_base_fake.h"
+
+static uint64_t m_now;
+
+uint64_t time_base_get(void)
+{
+	return m_now;
+}
+
+void time_base_fake_set(uint64_t now)
+{
+	m_now = now;
+}
@@ -0,0 +1,12 @@
+#ifndef TIME_BASE_FAKE_H
+#define TIME_BASE_FAKE_H
+
+#include <stdint.h>
+
+#include "../../src/time_base.h"
+
+/**@brief Set the virtual time returned by time_base_get().
+ */
+void time_base_fake_set(uint64_t now);
+
+#endif // TIME_BASE_FAKE_H
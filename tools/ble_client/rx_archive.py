@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+
+# Download of the received-packet archive from the T-Echo (see src/rx_archive.h).
+#
+# A range of records is requested by writing the first sequence number and
+# the number of records to the RX archive characteristic. The firmware then
+# sends the records as a stream of notifications, which is terminated by an
+# end marker with the sequence number to continue from. Records are not
+# aligned to notifications, so the stream is reassembled here.
+#
+# Called directly, a stream that was saved to a file is decoded to CSV:
+#
+# Usage: rx_archive.py <stream.bin>
+
+import asyncio
+import csv
+import struct
+import sys
+import time
+from datetime import datetime, timezone
+
+UUID_CHAR_RX_ARCHIVE = '00000114-b493-bb5d-2a6a-4682945c9e00'
+
+STREAM_END = 0xFFFF
+
+FLAG_TIME_VALID = 0x01
+
+# frame length, sequence number, time, RSSI, SNR, flags
+HEADER = struct.Struct('<HIIhbB')
+
+
+class Record:
+    def __init__(self, seq, timestamp, rssi, snr, flags, frame):
+        self.seq = seq
+        self.time = timestamp if flags & FLAG_TIME_VALID else None
+        self.rssi_dbm = rssi / 10
+        self.snr_db = snr / 4
+        self.frame = frame
+
+
+class StreamDecoder:
+    """Reassembles records from notifications of arbitrary size."""
+
+    def __init__(self):
+        self.buf = b''
+        self.records = []
+        self.done = False
+        self.next_seq = None
+        self.bytes = 0
+
+    def feed(self, data):
+        self.buf += data
+        self.bytes += len(data)
+
+        while len(self.buf) >= 2 and not self.done:
+            length, = struct.unpack_from('<H', self.buf)
+
+            if length == STREAM_END:
+                if len(self.buf) < 6:
+                    break
+
+                self.next_seq, = struct.unpack_from('<I', self.buf, 2)
+                self.buf = self.buf[6:]
+                self.done = True
+                break
+
+            if length == 0:
+                raise ValueError('invalid record with an empty frame')
+
+            end = HEADER.size + length
+
+            if len(self.buf) < end:
+                break
+
+            _, seq, timestamp, rssi, snr, flags = HEADER.unpack_from(self.buf)
+            self.records.append(Record(seq, timestamp, rssi, snr, flags, self.buf[HEADER.size:end]))
+            self.buf = self.buf[end:]
+
+
+def frame_text(frame):
+    """Printable representation of a frame, which may contain binary data."""
+
+    out = ''
+
+    for b in frame:
+        if b == 0x5C:
+            out += '\\\\'
+        elif b < 0x20 or b >= 0x7F:
+            out += f'\\x{b:02x}'
+        else:
+            out += chr(b)
+
+    return out
+
+
+def write_csv(records, f):
+    writer = csv.writer(f, lineterminator='\n')
+    writer.writerow(['seq', 'time', 'rssi_dbm', 'snr_db', 'frame'])
+
+    for r in records:
+        if r.time is None:
+            timestr = ''
+        else:
+            timestr = datetime.fromtimestamp(r.time, timezone.utc).strftime('%Y-%m-%dT%H:%M:%SZ')
+
+        writer.writerow([r.seq, timestr, f'{r.rssi_dbm:.1f}', f'{r.snr_db:.2f}', frame_text(r.frame)])
+
+
+async def read_info(client):
+    """Return the first and the next sequence number in the archive."""
+
+    data = await client.read_gatt_char(UUID_CHAR_RX_ARCHIVE)
+    return struct.unpack('<II', data[:8])
+
+
+async def download(client, start=0, count=0, progress=None):
+    """Download count records (0 = all) beginning with sequence number start.
+
+    Returns the decoder with the records and the sequence number to continue from.
+    """
+
+    decoder = StreamDecoder()
+    finished = asyncio.Event()
+
+    def on_notify(_sender, data):
+        decoder.feed(bytes(data))
+
+        if progress:
+            progress(decoder)
+
+        if decoder.done:
+            finished.set()
+
+    await client.start_notify(UUID_CHAR_RX_ARCHIVE, on_notify)
+
+    try:
+        await client.write_gatt_char(UUID_CHAR_RX_ARCHIVE, struct.pack('<II', start, count), response=True)
+        await finished.wait()
+    finally:
+        await client.stop_notify(UUID_CHAR_RX_ARCHIVE)
+
+    return decoder
+
+
+async def download_to_csv(client, filename):
+    first_seq, next_seq = await read_info(client)
+
+    print(f"The archive contains {next_seq - first_seq} packets ({first_seq} to {next_seq - 1}).")
+
+    def progress(decoder):
+        print(f"\r{len(decoder.records)} packets, {decoder.bytes} bytes", end='')
+
+    start = time.monotonic()
+    decoder = await download(client, first_seq, 0, progress)
+    duration = time.monotonic() - start
+
+    print(f"\nDownloaded in {duration:.1f} s ({decoder.bytes / duration / 1000:.1f} kB/s).")
+
+    with open(filename, 'w', newline='') as f:
+        write_csv(decoder.records, f)
+
+    print(f"Written to {filename}.")
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        print(f'Usage: {sys.argv[0]} <stream.bin>', file=sys.stderr)
+        sys.exit(1)
+
+    with open(sys.argv[1], 'rb') as f:
+        decoder = StreamDecoder()
+        decoder.feed(f.read())
+
+    write_csv(decoder.records, sys.stdout)
+
+    if decoder.done:
+        print(f'# continue at {decoder.next_seq}', file=sys.stderr)
+    else:
+        print('# stream is incomplete', file=sys.stderr)
@@ -13,6 +13,9 @@ SETTINGS_IDS = {
         'LAST_BLE_SYMBOL':   0x0006,
         'LORA_RF_FREQUENCY': 0x0007,
         'LORA_MOD_PARAMS':   0x0008,
+        'SMARTBEACON':       0x0009,
+        'DEAD_RECKONING':    0x000A,
+        'ENERGY_MODEL':      0x000B,
     }
 
 APRS_FLAGS = {
@@ -24,6 +27,12 @@ APRS_FLAGS = {
         'ADD_WEATHER':       1 << 5,
         'STARTUP_RX_ON':     1 << 6,
         'STARTUP_TX_ON':     1 << 7,
+        'USE_DIGIPEATING':   1 << 8,
+        'USE_WIDEN_N':       1 << 9,
+        'FILL_IN_DIGIPEATER': 1 << 10,
+        'SLOTTED_TX':        1 << 11,
+        'TELEMETRY':         1 << 12,
+        'BLE_RX_BATCHING':   1 << 13,
     }
 
 MOD_PARAMS_SF = {
@@ -64,8 +73,93 @@ MOD_PARAMS_LDRO = {
 
 LORA_POWERS_DBM = [22, 20, 17, 14, 10, 0, -9]
 
+# (name, struct format, default) in the order of the SmartBeaconing setting
+SMARTBEACON_FIELDS = [
+        ('Fast rate [s]',          'H', 100),
+        ('Slow rate [s]',          'H', 1800),
+        ('Min. turn time [s]',     'H', 30),
+        ('Turn slope [deg*km/h]',  'H', 240),
+        ('Fast speed [km/h]',      'B', 70),
+        ('Slow speed [km/h]',      'B', 4),
+        ('Min. turn angle [deg]',  'B', 28),
+    ]
+
+SMARTBEACON_FORMAT = '<' + ''.join(f[1] for f in SMARTBEACON_FIELDS) + 'x'
+
+# all currents in units of 10 µA
+ENERGY_MODEL_FIELDS = [
+        ('Base (MCU, BLE)',         1),
+        ('3.3V regulator',         0.5),
+        ('Peripheral power',        2),
+        ('Activity: init',          0),
+        ('Activity: BLE connected', 2),
+        ('Activity: VBAT measure',  5),
+        ('Activity: e-paper',      30),
+        ('Activity: GNSS',        400),
+        ('Activity: LoRa RX',      50),
+        ('Activity: LEDs',        100),
+        ('Activity: BME280',        4),
+        ('Activity: SPI flash',     3),
+        ('GNSS standby',           10),
+        ('TX +22 dBm',           1180),
+        ('TX +20 dBm',           1020),
+        ('TX +17 dBm',            900),
+        ('TX +14 dBm',            450),
+        ('TX +10 dBm',            320),
+        ('TX 0 dBm',              150),
+        ('TX -9 dBm',             100),
+    ]
+
+ENERGY_MODEL_FORMAT = '<' + 'H' * len(ENERGY_MODEL_FIELDS)
+
 UUID_CHAR_SETTING_WRITE_SELECT = '00000110-b493-bb5d-2a6a-4682945c9e00'
 UUID_CHAR_SETTING_READ = '00000111-b493-bb5d-2a6a-4682945c9e00'
+UUID_CHAR_SETTINGS_SNAPSHOT = '00000112-b493-bb5d-2a6a-4682945c9e00'
+
+SNAPSHOT_VERSION = 1
+
+def crc16_ccitt(data):
+    crc = 0xFFFF
+
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+
+    return crc
+
+def parse_snapshot(data):
+    """Decode a settings snapshot into a dict {setting_id: value}.
+
+    Returns None if the snapshot is invalid."""
+    if len(data) < 6:
+        return None
+
+    version, count, entries_len = struct.unpack('<BBH', data[:4])
+
+    if version != SNAPSHOT_VERSION or len(data) < 4 + entries_len + 2:
+        return None
+
+    (crc,) = struct.unpack('<H', data[4 + entries_len:4 + entries_len + 2])
+
+    if crc != crc16_ccitt(data[:4 + entries_len]):
+        return None
+
+    values = {}
+    pos = 4
+
+    while pos + 2 <= 4 + entries_len:
+        setting_id, value_len = data[pos], data[pos + 1]
+        values[setting_id] = bytes(data[pos + 2:pos + 2 + value_len])
+        pos += 2 + value_len
+
+    if pos != 4 + entries_len or len(values) != count:
+        return None
+
+    return values
 
 class Setting:
     def __init__(self, name, data):
@@ -98,6 +192,15 @@ class Setting:
             cr_s = MOD_PARAMS_CR[cr]
             ldro_s = MOD_PARAMS_LDRO[ldro]
             return f"{sf_s}, {bw_s}, {cr_s}, {ldro_s}"
+        elif self.name == 'DEAD_RECKONING':
+            max_error, = struct.unpack('<H', self.data[:2])
+            return f"{max_error} m" if max_error else "disabled"
+        elif self.name == 'SMARTBEACON':
+            values = struct.unpack(SMARTBEACON_FORMAT, self.data[:12])
+            return ", ".join(f"{f[0]}: {v}" for f, v in zip(SMARTBEACON_FIELDS, values))
+        elif self.name == 'ENERGY_MODEL':
+            values = struct.unpack(ENERGY_MODEL_FORMAT, self.data[:struct.calcsize(ENERGY_MODEL_FORMAT)])
+            return ", ".join(f"{f[0]}: {v/100:.2f} mA" for f, v in zip(ENERGY_MODEL_FIELDS, values))
         else:
             return f"{self.data}"
 
@@ -248,6 +351,100 @@ class Setting:
                     local_data[3] = list(MOD_PARAMS_LDRO.keys())[int(selected_ldro)]
                     modified = True
 
+    def _edit_dead_reckoning(self):
+        print('Enter the maximum dead reckoning error in meters (at least 20).')
+        print('Enter 0 to disable dead reckoning. Leave empty to abort.')
+
+        while True:
+            inp = input('> ')
+
+            if not inp:
+                return False
+
+            try:
+                max_error = int(inp)
+            except ValueError:
+                print("Could not parse your input as integer. Try again.\n")
+                continue
+
+            if max_error != 0 and (max_error < 20 or max_error > 65535):
+                print("Value out of range. Try again.\n")
+                continue
+
+            self.data = struct.pack("<H", max_error)
+            return True
+
+    def _edit_smartbeacon(self):
+        if not self.data:
+            local_data = [f[2] for f in SMARTBEACON_FIELDS]
+        else:
+            local_data = list(struct.unpack(SMARTBEACON_FORMAT, self.data[:12]))
+
+        modified = False
+
+        while True:
+            options = dict(zip(range(len(SMARTBEACON_FIELDS)),
+                [f"{f[0]} [{v}]" for f, v in zip(SMARTBEACON_FIELDS, local_data)]))
+
+            selected = menu.choose_option("Select the parameter to edit:", options)
+
+            if not selected:
+                self.data = struct.pack(SMARTBEACON_FORMAT, *local_data)
+                return modified
+
+            idx = int(selected)
+            limit = 0xFFFF if SMARTBEACON_FIELDS[idx][1] == 'H' else 0xFF
+
+            inp = input(f"New value for {SMARTBEACON_FIELDS[idx][0]} (0-{limit}): ")
+
+            try:
+                value = int(inp)
+            except ValueError:
+                print("Could not parse your input as integer.\n")
+                continue
+
+            if value < 0 or value > limit:
+                print("Value out of range.\n")
+                continue
+
+            local_data[idx] = value
+            modified = True
+
+    def _edit_energy_model(self):
+        if not self.data:
+            local_data = [round(f[1] * 100) for f in ENERGY_MODEL_FIELDS]
+        else:
+            local_data = list(struct.unpack(ENERGY_MODEL_FORMAT, self.data[:struct.calcsize(ENERGY_MODEL_FORMAT)]))
+
+        modified = False
+
+        while True:
+            options = dict(zip(range(len(ENERGY_MODEL_FIELDS)),
+                [f"{f[0]} [{v/100:.2f} mA]" for f, v in zip(ENERGY_MODEL_FIELDS, local_data)]))
+
+            selected = menu.choose_option("Select the current to edit:", options)
+
+            if not selected:
+                self.data = struct.pack(ENERGY_MODEL_FORMAT, *local_data)
+                return modified
+
+            idx = int(selected)
+
+            inp = input(f"New current for {ENERGY_MODEL_FIELDS[idx][0]} in mA (0-655.35): ")
+
+            try:
+                value = round(float(inp) * 100)
+            except ValueError:
+                print("Could not parse your input as number.\n")
+                continue
+
+            if value < 0 or value > 0xFFFF:
+                print("Value out of range.\n")
+                continue
+
+            local_data[idx] = value
+            modified = True
+
     def edit_interactive(self):
         modified = False
 
@@ -263,6 +460,12 @@ class Setting:
             modified = self._edit_rf_frequency()
         elif self.name == 'LORA_MOD_PARAMS':
             modified = self._edit_mod_params()
+        elif self.name == 'SMARTBEACON':
+            modified = self._edit_smartbeacon()
+        elif self.name == 'DEAD_RECKONING':
+            modified = self._edit_dead_reckoning()
+        elif self.name == 'ENERGY_MODEL':
+            modified = self._edit_energy_model()
 
         if modified:
             self.modified = True
@@ -302,9 +505,31 @@ class AdvancedSettings:
 
         return True
 
+    async def _update_cache_from_snapshot(self):
+        try:
+            raw_data = await self._ble_client.read_gatt_char(UUID_CHAR_SETTINGS_SNAPSHOT)
+        except Exception:
+            # older firmware without the snapshot characteristic
+            return False
+
+        values = parse_snapshot(raw_data)
+
+        if values is None:
+            print("Error: invalid settings snapshot.")
+            return False
+
+        for name, setting_id in SETTINGS_IDS.items():
+            self._cache[name] = Setting(name, values.get(setting_id))
+
+        return True
+
     async def update_cache(self):
         print("Updating settings cache...")
 
+        if await self._update_cache_from_snapshot():
+            print("100 % loaded.")
+            return
+
         i = 1
         for name, setting_id in SETTINGS_IDS.items():
             data = await self._read_value(setting_id)
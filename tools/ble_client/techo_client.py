@@ -1,16 +1,26 @@
 #!/usr/bin/env python3
 
 import asyncio
+import struct
 from bleak import BleakScanner, BleakClient
 import traceback
 
 import settings
 import menu
+import rx_archive
+import track_export
 
 UUID_CHAR_SOURCE_CALL = '00000101-b493-bb5d-2a6a-4682945c9e00'
 UUID_CHAR_APRS_COMMENT = '00000102-b493-bb5d-2a6a-4682945c9e00'
 UUID_CHAR_APRS_SYMBOL = '00000103-b493-bb5d-2a6a-4682945c9e00'
 UUID_CHAR_RX_MESSAGE = '00000104-b493-bb5d-2a6a-4682945c9e00'
+UUID_CHAR_TX_MESSAGE = '00000105-b493-bb5d-2a6a-4682945c9e00'
+UUID_CHAR_ENERGY_STATS = '00000106-b493-bb5d-2a6a-4682945c9e00'
+
+ENERGY_CONSUMERS = ['Base', 'GNSS', 'LoRa RX', 'LoRa TX', 'Display', 'Other']
+ENERGY_ACTIVITIES = ['Init', 'BLE connected', 'VBAT measure', 'E-Paper', 'GNSS', 'LoRa', 'LEDs', 'BME280', 'SPI flash']
+ENERGY_RAILS = ['3.3V regulator', 'Peripheral power']
+ENERGY_TX_LEVELS = ['+22 dBm', '+20 dBm', '+17 dBm', '+14 dBm', '+10 dBm', '0 dBm', '-9 dBm']
 
 async def advanced_config(client):
     print("\n### Advanced settings menu ###")
@@ -56,6 +66,41 @@ async def advanced_config(client):
 
 
 
+async def show_energy_stats(client):
+    data = await client.read_gatt_char(UUID_CHAR_ENERGY_STATS)
+
+    if len(data) < 108:
+        print("No energy statistics available yet.")
+        return
+
+    values = list(struct.unpack('<27I', data[:108]))
+
+    uptime_s = values.pop(0)
+    total_uah = values.pop(0)
+
+    print(f"Uptime:       {uptime_s/3600:.1f} h")
+    print(f"Used charge:  {total_uah/1000:.2f} mAh")
+    if uptime_s > 0:
+        print(f"Avg. current: {total_uah/1000/(uptime_s/3600):.2f} mA")
+
+    print("\nCharge per consumer:")
+    for name in ENERGY_CONSUMERS:
+        print(f"  {name:16s} {values.pop(0)/1000:10.2f} mAh")
+
+    print("\nOn-time per activity:")
+    for name in ENERGY_ACTIVITIES:
+        print(f"  {name:16s} {values.pop(0):10d} s")
+
+    print("\nOn-time per rail:")
+    for name in ENERGY_RAILS:
+        print(f"  {name:16s} {values.pop(0):10d} s")
+
+    print(f"  {'GNSS standby':16s} {values.pop(0):10d} s")
+
+    print("\nTransmission time per power level:")
+    for name in ENERGY_TX_LEVELS:
+        print(f"  {name:16s} {values.pop(0)/1000:10.1f} s")
+
 async def main():
     print("Scanning for 5 seconds...")
 
@@ -111,6 +156,12 @@ async def main():
                 print("1 = Set source call")
                 print("2 = Set comment")
                 print("3 = Set symbol")
+                print("4 = Send APRS message")
+            print("5 = Show energy statistics")
+            print("6 = Download RX archive")
+            if is_paired:
+                print("7 = Download track as GPX")
+            if is_paired:
                 print("a = Advanced configuration")
             print("q = Disconnect and quit.")
 
@@ -153,6 +204,24 @@ async def main():
                     continue
 
                 await client.write_gatt_char(UUID_CHAR_APRS_SYMBOL, symbol.encode('utf-8'))
+            elif idx == 4:
+                addressee = input("Type the addressee call: ").strip().upper()
+                text = input("Type the message text: ").strip()
+                if not (1 <= len(addressee) <= 9) or not (1 <= len(text) <= 67):
+                    print("Error: the addressee must have 1 to 9 and the text 1 to 67 characters!")
+                    continue
+
+                await client.write_gatt_char(UUID_CHAR_TX_MESSAGE, f"{addressee}:{text}".encode('utf-8'))
+            elif idx == 5:
+                await show_energy_stats(client)
+            elif idx == 6:
+                filename = input("Type the output file name [rx_archive.csv]: ").strip()
+                await rx_archive.download_to_csv(client, filename or "rx_archive.csv")
+            elif idx == 7:
+                filename = input("Type the output file name [track.gpx]: ").strip()
+                answer = input("Let the T-Echo generate the GPX (slower) [y/n]? ").strip()
+                fmt = track_export.FORMAT_GPX if answer[:1] == 'y' else track_export.FORMAT_COMPACT
+                await track_export.download_to_gpx(client, filename or "track.gpx", fmt)
             else:
                 print("Command not understood.")
 
@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+
+# Download of the track log from the T-Echo (see src/track_export.h).
+#
+# An export is requested by writing the format and the time range to the
+# Track export characteristic. The firmware then streams the track as
+# notifications. In the compact format, the fixes are delta-encoded and are
+# rendered to GPX here; the firmware can also render GPX itself, which takes
+# about 15 times longer to transfer.
+#
+# Called directly, a compact stream that was saved to a file is converted to
+# GPX:
+#
+# Usage: track_export.py <track.trk>
+
+import asyncio
+import struct
+import sys
+import time
+from datetime import datetime, timezone
+
+UUID_CHAR_TRACK_EXPORT = '00000115-b493-bb5d-2a6a-4682945c9e00'
+
+FORMAT_COMPACT = 0
+FORMAT_GPX = 1
+
+COMPACT_MAGIC = b'TRK\x01'
+
+GPX_END = b'</gpx>\n'
+
+# fixes further apart start a new track segment
+SEGMENT_GAP_S = 600
+
+
+class Fix:
+    def __init__(self, timestamp, lat, lon, alt):
+        self.time = timestamp     # Unix timestamp
+        self.lat = lat            # 1e-6 degrees
+        self.lon = lon            # 1e-6 degrees
+        self.alt = alt            # meters
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def s32(v):
+    v &= 0xFFFFFFFF
+    return v - (1 << 32) if v >= (1 << 31) else v
+
+
+def read_varint(buf, pos):
+    """Return the value and the position after it, or None if it is incomplete."""
+
+    value = 0
+    shift = 0
+
+    while pos < len(buf):
+        byte = buf[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+
+        if byte < 0x80:
+            return value, pos
+
+    return None
+
+
+class CompactDecoder:
+    """Decodes the compact stream from notifications of arbitrary size."""
+
+    def __init__(self):
+        self.buf = b''
+        self.started = False
+        self.fixes = []
+        self.done = False
+        self.bytes = 0
+        self.prev = [0, 0, 0, 0]
+
+    def feed(self, data):
+        self.buf += data
+        self.bytes += len(data)
+
+        if not self.started:
+            if len(self.buf) < len(COMPACT_MAGIC):
+                return
+
+            if self.buf[:len(COMPACT_MAGIC)] != COMPACT_MAGIC:
+                raise ValueError('not a compact track stream')
+
+            self.buf = self.buf[len(COMPACT_MAGIC):]
+            self.started = True
+
+        pos = 0
+
+        while not self.done and pos < len(self.buf):
+            if self.buf[pos] == 0:
+                # end marker and number of fixes
+                if len(self.buf) < pos + 5:
+                    break
+
+                count, = struct.unpack_from('<I', self.buf, pos + 1)
+                if count != len(self.fixes):
+                    raise ValueError(f'{len(self.fixes)} fixes received, {count} sent')
+
+                pos += 5
+                self.done = True
+                break
+
+            values = []
+            end = pos
+
+            for _ in range(4):
+                result = read_varint(self.buf, end)
+                if result is None:
+                    break
+
+                value, end = result
+                values.append(value)
+
+            if len(values) < 4:
+                # the rest follows in the next notification
+                break
+
+            pos = end
+
+            self.prev[0] = (self.prev[0] + unzigzag(values[0] - 1)) & 0xFFFFFFFF
+            for i in range(1, 4):
+                self.prev[i] = s32(self.prev[i] + unzigzag(values[i]))
+
+            self.fixes.append(Fix(*self.prev))
+
+        self.buf = self.buf[pos:]
+
+
+def format_coord(v):
+    sign = '-' if v < 0 else ''
+    v = abs(v)
+    return f'{sign}{v // 1000000}.{v % 1000000:06d}'
+
+
+def write_gpx(fixes, f):
+    """Write the fixes in the same way as the firmware does."""
+
+    f.write('<?xml version="1.0" encoding="UTF-8"?>\n'
+            '<gpx version="1.1" creator="T-Echo LoRa-APRS" xmlns="http://www.topografix.com/GPX/1/1">\n'
+            '<trk><name>T-Echo track</name>\n')
+
+    prev = None
+
+    for fix in fixes:
+        if prev is None:
+            f.write('<trkseg>\n')
+        elif fix.time < prev.time or fix.time - prev.time > SEGMENT_GAP_S:
+            f.write('</trkseg>\n<trkseg>\n')
+
+        timestr = datetime.fromtimestamp(fix.time, timezone.utc).strftime('%Y-%m-%dT%H:%M:%SZ')
+
+        f.write(f'<trkpt lat="{format_coord(fix.lat)}" lon="{format_coord(fix.lon)}">'
+                f'<ele>{fix.alt}</ele><time>{timestr}</time></trkpt>\n')
+
+        prev = fix
+
+    if prev is not None:
+        f.write('</trkseg>\n')
+
+    f.write('</trk>\n</gpx>\n')
+
+
+async def download(client, fmt=FORMAT_COMPACT, start_time=0, end_time=0, progress=None):
+    """Download the fixes between start_time and end_time (0 = no limit).
+
+    Returns a CompactDecoder with the fixes, or the GPX data as bytes.
+    """
+
+    decoder = CompactDecoder()
+    gpx = bytearray()
+    finished = asyncio.Event()
+
+    def on_notify(_sender, data):
+        if fmt == FORMAT_COMPACT:
+            decoder.feed(bytes(data))
+            done = decoder.done
+            received = decoder.bytes
+        else:
+            gpx.extend(data)
+            done = gpx.endswith(GPX_END)
+            received = len(gpx)
+
+        if progress:
+            progress(received)
+
+        if done:
+            finished.set()
+
+    await client.start_notify(UUID_CHAR_TRACK_EXPORT, on_notify)
+
+    try:
+        await client.write_gatt_char(UUID_CHAR_TRACK_EXPORT,
+                                     struct.pack('<BII', fmt, start_time, end_time), response=True)
+        await finished.wait()
+    finally:
+        await client.stop_notify(UUID_CHAR_TRACK_EXPORT)
+
+    return decoder if fmt == FORMAT_COMPACT else bytes(gpx)
+
+
+async def download_to_gpx(client, filename, fmt=FORMAT_COMPACT, start_time=0, end_time=0):
+    def progress(received):
+        print(f"\r{received} bytes", end='')
+
+    start = time.monotonic()
+    result = await download(client, fmt, start_time, end_time, progress)
+    duration = time.monotonic() - start
+
+    if fmt == FORMAT_COMPACT:
+        received = result.bytes
+        with open(filename, 'w', newline='\n') as f:
+            write_gpx(result.fixes, f)
+        print(f"\n{len(result.fixes)} positions", end='')
+    else:
+        received = len(result)
+        with open(filename, 'wb') as f:
+            f.write(result)
+
+    print(f" downloaded in {duration:.1f} s ({received / max(duration, 1e-3) / 1000:.1f} kB/s).")
+    print(f"Written to {filename}.")
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        print(f'Usage: {sys.argv[0]} <track.trk>', file=sys.stderr)
+        sys.exit(1)
+
+    with open(sys.argv[1], 'rb') as f:
+        decoder = CompactDecoder()
+        decoder.feed(f.read())
+
+    if not decoder.done:
+        print('# stream is incomplete', file=sys.stderr)
+
+    write_gpx(decoder.fixes, sys.stdout)
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+
+# Decoder for the binary trace stream of the firmware (see src/trace.h).
+#
+# The format strings are read from the trace_fmt section of the ELF file that
+# was flashed. The stream is usually recorded from RTT channel 1, e.g. with
+#
+#   JLinkRTTLogger -Device NRF52840_XXAA -If SWD -Speed 4000 -RTTChannel 1 trace.bin
+#
+# Usage: trace_decode.py <firmware.elf> <trace.bin>
+
+import re
+import struct
+import sys
+
+TRACE_ID_DROPPED = 0xFFFF
+
+SECTION_NAMES = ('.trace_fmt', 'trace_fmt')
+
+# printf conversions supported by the firmware. Length modifiers are ignored
+# as all arguments are transferred as 32 bit values.
+CONVERSION_RE = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z)?([diuxXocH%])')
+
+
+def read_section(elf_path, names):
+    """Return the contents of the first section with one of the given names."""
+
+    with open(elf_path, 'rb') as f:
+        elf = f.read()
+
+    if elf[:4] != b'\x7fELF':
+        raise ValueError(f'{elf_path} is not an ELF file')
+
+    is_64 = (elf[4] == 2)
+    endian = '<' if elf[5] == 1 else '>'
+
+    if is_64:
+        e_shoff, = struct.unpack_from(endian + 'Q', elf, 0x28)
+        e_shentsize, e_shnum, e_shstrndx = struct.unpack_from(endian + 'HHH', elf, 0x3A)
+        sh_fmt = endian + 'IIQQQQ'
+    else:
+        e_shoff, = struct.unpack_from(endian + 'I', elf, 0x20)
+        e_shentsize, e_shnum, e_shstrndx = struct.unpack_from(endian + 'HHH', elf, 0x2E)
+        sh_fmt = endian + 'IIIIII'
+
+    sections = []
+    for i in range(e_shnum):
+        name, sh_type, _flags, _addr, offset, size = struct.unpack_from(sh_fmt, elf, e_shoff + i * e_shentsize)
+        sections.append((name, offset, size))
+
+    _, strtab_offset, _ = sections[e_shstrndx]
+
+    for name_offset, offset, size in sections:
+        end = elf.index(b'\0', strtab_offset + name_offset)
+        name = elf[strtab_offset + name_offset:end].decode()
+
+        if name in names:
+            return elf[offset:offset + size]
+
+    raise ValueError(f'{elf_path} has no trace format strings')
+
+
+def decode_varint(data, pos):
+    value = 0
+    shift = 0
+
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+
+        if byte < 0x80:
+            return value, pos
+
+
+def format_event(fmt, payload):
+    pos = 0
+    out = ''
+    last = 0
+
+    for m in CONVERSION_RE.finditer(fmt):
+        out += fmt[last:m.start()]
+        last = m.end()
+
+        flags, conv = m.groups()
+
+        if conv == '%':
+            out += '%'
+        elif conv == 'H':
+            # the hexdump uses the rest of the payload
+            out += ' '.join(f'{b:02x}' for b in payload[pos:])
+            pos = len(payload)
+        else:
+            value, pos = decode_varint(payload, pos)
+
+            if conv in 'di':
+                if value >= 1 << 31:
+                    value -= 1 << 32
+                conv = 'd'
+            elif conv == 'u':
+                conv = 'd'
+
+            out += ('%' + flags + conv) % value
+
+    return out + fmt[last:]
+
+
+def decode(strings, stream):
+    """Yield the decoded events of a trace stream."""
+
+    pos = 0
+
+    while pos + 3 <= len(stream):
+        event_id, length = struct.unpack_from('<HB', stream, pos)
+        payload = stream[pos + 3:pos + 3 + length]
+        pos += 3 + length
+
+        if len(payload) < length:
+            yield '<truncated event>'
+            break
+
+        if event_id == TRACE_ID_DROPPED:
+            count, _ = decode_varint(payload, 0)
+            yield f'<{count} events dropped>'
+            continue
+
+        if event_id >= len(strings):
+            yield f'<unknown event 0x{event_id:04x}: {payload.hex()}>'
+            continue
+
+        end = strings.index(b'\0', event_id)
+        fmt = strings[event_id:end].decode(errors='replace')
+
+        try:
+            yield format_event(fmt, payload)
+        except (IndexError, TypeError, ValueError):
+            yield f'<cannot decode "{fmt}": {payload.hex()}>'
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        print(f'Usage: {sys.argv[0]} <firmware.elf> <trace.bin>', file=sys.stderr)
+        sys.exit(1)
+
+    strings = read_section(sys.argv[1], SECTION_NAMES)
+
+    with open(sys.argv[2], 'rb') as f:
+        stream = f.read()
+
+    for line in decode(strings, stream):
+        print(line)